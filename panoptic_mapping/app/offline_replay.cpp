@@ -0,0 +1,281 @@
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <opencv2/core/mat.hpp>
+#include <yaml-cpp/yaml.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/globals.h"
+#include "panoptic_mapping/common/input_data.h"
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/integration/tsdf_integrator_base.h"
+#include "panoptic_mapping/labels/label_handler_base.h"
+#include "panoptic_mapping/map/mesh_service.h"
+#include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/map_management/map_manager_base.h"
+#include "panoptic_mapping/submap_allocation/freespace_allocator_base.h"
+#include "panoptic_mapping/submap_allocation/submap_allocator_base.h"
+#include "panoptic_mapping/tools/flat_dataset_reader.h"
+#include "panoptic_mapping/tools/frame_log_reader.h"
+#include "panoptic_mapping/tracking/id_tracker_base.h"
+
+/**
+ * Replays a dataset or a recorded frame log through the mapper without ROS.
+ * All frames are processed sequentially as fast as possible, such that runs
+ * are repeatable and report the throughput of every stage. The config file has
+ * the same layout as the mapper configs of panoptic_mapping_ros.
+ */
+
+DEFINE_string(config, "", "Mapper config file (.yaml) to use.");
+DEFINE_string(data_path, "", "Directory containing the dataset to replay.");
+DEFINE_string(frame_log, "",
+              "Frame log (see 'FrameLogWriter') to replay instead of a "
+              "dataset.");
+DEFINE_int32(max_frames, 0, "Maximum number of frames to replay, 0 for all.");
+DEFINE_int32(threads, std::thread::hardware_concurrency(),
+             "Number of threads of the global thread pool.");
+DEFINE_bool(numa_aware, false,
+            "Distribute the thread pool and submaps over the NUMA nodes.");
+DEFINE_string(save_map_path, "", "If set, save the final map (.panmap).");
+
+namespace panoptic_mapping {
+namespace {
+
+using ParamMap = config_utilities::internal::ParamMap;
+
+// Convert a yaml node into params, where nested maps become namespaces.
+XmlRpc::XmlRpcValue yamlToXmlRpc(const YAML::Node& node) {
+  if (node.IsSequence()) {
+    XmlRpc::XmlRpcValue value;
+    value.setSize(node.size());
+    for (size_t i = 0; i < node.size(); ++i) {
+      value[i] = yamlToXmlRpc(node[i]);
+    }
+    return value;
+  }
+  bool bool_value;
+  int int_value;
+  double double_value;
+  if (YAML::convert<bool>::decode(node, bool_value)) {
+    return XmlRpc::XmlRpcValue(bool_value);
+  } else if (YAML::convert<int>::decode(node, int_value)) {
+    return XmlRpc::XmlRpcValue(int_value);
+  } else if (YAML::convert<double>::decode(node, double_value)) {
+    return XmlRpc::XmlRpcValue(double_value);
+  }
+  return XmlRpc::XmlRpcValue(node.as<std::string>());
+}
+
+void yamlToParamMap(const YAML::Node& node, const std::string& name_space,
+                    ParamMap* params) {
+  for (const auto& entry : node) {
+    const std::string key = name_space + "/" + entry.first.as<std::string>();
+    if (entry.second.IsMap()) {
+      yamlToParamMap(entry.second, key, params);
+    } else if (!entry.second.IsNull()) {
+      (*params)[key] = yamlToXmlRpc(entry.second);
+    }
+  }
+}
+
+// Get the params of a module namespace, setting its type if not specified.
+ParamMap moduleParams(const ParamMap& params, const std::string& name_space,
+                      const std::string& default_type = "") {
+  ParamMap result = params;
+  result["_name_space"] = name_space;
+  result["_name_space_private"] = name_space;
+  if (!default_type.empty() &&
+      result.find(name_space + "/type") == result.end()) {
+    result[name_space + "/type"] = default_type;
+  }
+  return result;
+}
+
+template <typename ConfigT>
+ConfigT configFromParams(const ParamMap& params,
+                         const std::string& name_space) {
+  ConfigT config;
+  config_utilities::internal::setupConfigFromParamMap(
+      moduleParams(params, name_space), &config);
+  return config;
+}
+
+// Accumulated time of a processing stage.
+struct StageTiming {
+  std::string name;
+  double total_seconds = 0.0;
+};
+
+class OfflineReplay {
+ public:
+  explicit OfflineReplay(const ParamMap& params) {
+    // Setup all modules as in the PanopticMapper.
+    auto camera = std::make_shared<Camera>(
+        configFromParams<Camera::Config>(params, "/camera"));
+    std::shared_ptr<LabelHandlerBase> label_handler =
+        config_utilities::Factory::create<LabelHandlerBase>(
+            moduleParams(params, "/labels", "null"));
+    CHECK(label_handler) << "Could not create the label handler.";
+    ThreadPool* thread_pool = ThreadPool::getGlobalInstance();
+    thread_pool->setNumThreads(FLAGS_threads);
+    if (FLAGS_numa_aware) {
+      thread_pool->setScheduling({}, 0, true);
+    }
+    auto mesh_service = std::make_shared<MeshService>(
+        configFromParams<MeshService::Config>(params, "/mesh_service"));
+    globals_ = std::make_shared<Globals>(camera, label_handler, thread_pool,
+                                         mesh_service);
+    submaps_.setThreadPool(globals_->threadPool());
+    std::shared_ptr<SubmapAllocatorBase> submap_allocator =
+        config_utilities::Factory::create<SubmapAllocatorBase>(
+            moduleParams(params, "/submap_allocator", "null"));
+    std::shared_ptr<FreespaceAllocatorBase> freespace_allocator =
+        config_utilities::Factory::create<FreespaceAllocatorBase>(
+            moduleParams(params, "/freespace_allocator", "null"));
+    id_tracker_ = config_utilities::Factory::create<IDTrackerBase>(
+        moduleParams(params, "/id_tracker"), globals_);
+    tsdf_integrator_ = config_utilities::Factory::create<TsdfIntegratorBase>(
+        moduleParams(params, "/tsdf_integrator"), globals_);
+    map_manager_ = config_utilities::Factory::create<MapManagerBase>(
+        moduleParams(params, "/map_management", "null"));
+    CHECK(submap_allocator && freespace_allocator && id_tracker_ &&
+          tsdf_integrator_ && map_manager_)
+        << "Could not create all modules, check the config.";
+    id_tracker_->setSubmapAllocator(submap_allocator);
+    id_tracker_->setFreespaceAllocator(freespace_allocator);
+  }
+
+  // Works with all readers that have the interface of the FlatDatasetReader.
+  template <typename ReaderT>
+  void run(const ReaderT& reader) {
+    std::vector<StageTiming> stages = {{"reading"},
+                                       {"preprocessing"},
+                                       {"id_tracking"},
+                                       {"tsdf_integration"},
+                                       {"map_management"}};
+    size_t num_frames = 0;
+    for (size_t i = 0; i < reader.getNumberOfFrames(); ++i) {
+      InputData input;
+      auto t0 = std::chrono::steady_clock::now();
+      if (!reader.readFrame(i, &input)) {
+        continue;
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      preprocessInput(&input);
+      auto t2 = std::chrono::steady_clock::now();
+      id_tracker_->processInput(&submaps_, &input);
+      auto t3 = std::chrono::steady_clock::now();
+      tsdf_integrator_->processInput(&submaps_, &input);
+      auto t4 = std::chrono::steady_clock::now();
+      map_manager_->tick(&submaps_);
+      auto t5 = std::chrono::steady_clock::now();
+      const std::vector<decltype(t0)> times = {t0, t1, t2, t3, t4, t5};
+      for (size_t j = 0; j < stages.size(); ++j) {
+        stages[j].total_seconds +=
+            std::chrono::duration<double>(times[j + 1] - times[j]).count();
+      }
+      num_frames++;
+    }
+    tsdf_integrator_->finishIntegration(&submaps_);
+    map_manager_->finishMapping(&submaps_);
+    printThroughput(stages, num_frames);
+  }
+
+  bool saveMap(const std::string& file_path) const {
+    return submaps_.saveToFile(file_path);
+  }
+
+ private:
+  void preprocessInput(InputData* input) const {
+    cv::Mat vertex_map;
+    cv::Mat validity_image;
+    cv::Mat range_image;
+    const float max_range_in_image = globals_->camera()->computeDerivedImages(
+        input->depthImage(), &vertex_map, &validity_image, &range_image,
+        globals_->threadPool());
+    input->setVertexMap(vertex_map);
+    input->setValidityImage(validity_image);
+    input->setRangeImage(range_image, max_range_in_image);
+  }
+
+  static void printThroughput(const std::vector<StageTiming>& stages,
+                              size_t num_frames) {
+    std::stringstream info;
+    info << "Replayed " << num_frames << " frames.";
+    if (num_frames == 0) {
+      LOG(INFO) << info.str();
+      return;
+    }
+    // Throughput per stage, reading is excluded from the total.
+    double total_seconds = 0.0;
+    for (const StageTiming& stage : stages) {
+      info << "\n" << std::setw(20) << std::left << stage.name << ": "
+           << std::setw(10) << std::right << std::fixed << std::setprecision(3)
+           << stage.total_seconds * 1000.0 / num_frames << " ms/frame, "
+           << std::setw(10) << num_frames / stage.total_seconds << " frames/s";
+      if (stage.name != "reading") {
+        total_seconds += stage.total_seconds;
+      }
+    }
+    info << "\n" << std::setw(20) << std::left << "total" << ": "
+         << std::setw(10) << std::right << total_seconds * 1000.0 / num_frames
+         << " ms/frame, " << std::setw(10) << num_frames / total_seconds
+         << " frames/s";
+    LOG(INFO) << info.str() << "\n" << Timing::Print();
+  }
+
+  std::shared_ptr<Globals> globals_;
+  SubmapCollection submaps_;
+  std::unique_ptr<IDTrackerBase> id_tracker_;
+  std::unique_ptr<TsdfIntegratorBase> tsdf_integrator_;
+  std::unique_ptr<MapManagerBase> map_manager_;
+};
+
+}  // namespace
+}  // namespace panoptic_mapping
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_alsologtostderr = true;
+
+  // Load the config.
+  panoptic_mapping::ParamMap params;
+  try {
+    panoptic_mapping::yamlToParamMap(YAML::LoadFile(FLAGS_config), "",
+                                     &params);
+  } catch (const YAML::Exception& e) {
+    LOG(ERROR) << "Could not load config file '" << FLAGS_config
+               << "': " << e.what();
+    return 1;
+  }
+
+  // Replay.
+  panoptic_mapping::OfflineReplay replay(params);
+  if (!FLAGS_frame_log.empty()) {
+    panoptic_mapping::FrameLogReader::Config reader_config;
+    reader_config.file_path = FLAGS_frame_log;
+    reader_config.max_frames = FLAGS_max_frames;
+    panoptic_mapping::FrameLogReader reader(reader_config);
+    replay.run(reader);
+  } else {
+    panoptic_mapping::FlatDatasetReader::Config reader_config;
+    reader_config.data_path = FLAGS_data_path;
+    reader_config.max_frames = FLAGS_max_frames;
+    panoptic_mapping::FlatDatasetReader reader(reader_config);
+    replay.run(reader);
+  }
+  if (!FLAGS_save_map_path.empty() && !replay.saveMap(FLAGS_save_map_path)) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef PANOPTIC_MAPPING_COMMON_ALLOCATION_TRACKING_H_
+#define PANOPTIC_MAPPING_COMMON_ALLOCATION_TRACKING_H_
+
+#include <cstdint>
+
+namespace panoptic_mapping {
+namespace allocation_tracking {
+
+/**
+ * @brief Heap allocation counters of the calling thread. Counting is only
+ * compiled in if the library is built with the CMake option
+ * 'PANOPTIC_MAPPING_TRACK_ALLOCATIONS', which replaces the global operator
+ * new and delete. The timers then report the allocations of each scope.
+ * Memory freed by another thread than the one that allocated it shows up as
+ * negative live bytes in the freeing thread.
+ */
+struct Counters {
+  uint64_t num_allocations = 0;
+  uint64_t allocated_bytes = 0;
+  int64_t live_bytes = 0;
+  // Maximum of 'live_bytes', can be reset to measure the peak of a scope.
+  int64_t peak_live_bytes = 0;
+};
+
+// True if the library was built with allocation tracking.
+bool isEnabled();
+
+// Counters of the calling thread. All zero if tracking is disabled.
+Counters& threadCounters();
+
+}  // namespace allocation_tracking
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_ALLOCATION_TRACKING_H_
@@ -0,0 +1,85 @@
+#ifndef PANOPTIC_MAPPING_COMMON_BLOCK_LAYOUT_H_
+#define PANOPTIC_MAPPING_COMMON_BLOCK_LAYOUT_H_
+
+#include <cstddef>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Index math of the voxels of a block in linear index order (x fastest).
+ * For a positive template argument the number of voxels per side is a compile
+ * time constant, such that all conversions compile to shifts and masks and
+ * loops over the voxels have constant bounds. BlockLayout<0> reads the number
+ * of voxels per side at runtime. Use 'dispatchBlockLayout()' to select the
+ * layout once per block.
+ */
+template <int kVoxelsPerSide>
+class BlockLayout {
+ public:
+  static_assert(kVoxelsPerSide >= 0 &&
+                    (kVoxelsPerSide & (kVoxelsPerSide - 1)) == 0,
+                "The voxels per side need to be a power of 2.");
+
+  explicit BlockLayout(int voxels_per_side = kVoxelsPerSide)
+      : runtime_voxels_per_side_(voxels_per_side) {}
+
+  int voxelsPerSide() const {
+    if constexpr (kVoxelsPerSide > 0) {
+      return kVoxelsPerSide;
+    } else {
+      return runtime_voxels_per_side_;
+    }
+  }
+  size_t numVoxels() const {
+    const size_t vps = voxelsPerSide();
+    return vps * vps * vps;
+  }
+
+  size_t linearIndex(int x, int y, int z) const {
+    const size_t vps = voxelsPerSide();
+    return x + vps * (y + vps * z);
+  }
+  VoxelIndex voxelIndex(size_t linear_index) const {
+    const size_t vps = voxelsPerSide();
+    return VoxelIndex(static_cast<int>(linear_index % vps),
+                      static_cast<int>((linear_index / vps) % vps),
+                      static_cast<int>(linear_index / (vps * vps)));
+  }
+
+  // Center of a voxel of the block in the frame of its layer.
+  template <typename BlockT>
+  Point voxelCenter(const BlockT& block, size_t linear_index) const {
+    return block.origin() +
+           (voxelIndex(linear_index).template cast<FloatingPoint>() +
+            Point::Constant(0.5f)) *
+               block.voxel_size();
+  }
+
+ private:
+  int runtime_voxels_per_side_;
+};
+
+/**
+ * @brief Call function(layout) with the compile time layout matching the
+ * number of voxels per side if one exists (8, 16, 32), BlockLayout<0>
+ * otherwise.
+ */
+template <typename FunctionT>
+decltype(auto) dispatchBlockLayout(int voxels_per_side, FunctionT&& function) {
+  switch (voxels_per_side) {
+    case 8:
+      return function(BlockLayout<8>());
+    case 16:
+      return function(BlockLayout<16>());
+    case 32:
+      return function(BlockLayout<32>());
+    default:
+      return function(BlockLayout<0>(voxels_per_side));
+  }
+}
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_BLOCK_LAYOUT_H_
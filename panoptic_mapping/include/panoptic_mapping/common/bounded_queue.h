@@ -0,0 +1,90 @@
+#ifndef PANOPTIC_MAPPING_COMMON_BOUNDED_QUEUE_H_
+#define PANOPTIC_MAPPING_COMMON_BOUNDED_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace panoptic_mapping {
+
+/**
+ * Thread safe FIFO queue with a fixed capacity. Producers block while the
+ * queue is full and consumers block while it is empty, which provides back
+ * pressure between pipeline stages. Closing the queue wakes up all waiting
+ * threads, remaining elements can still be popped afterwards.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1) {}
+
+  /**
+   * @brief Add an element to the back of the queue, blocking while full.
+   *
+   * @return False if the queue was closed and the element was not added.
+   */
+  bool push(T value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [this]() { return closed_ || queue_.size() < capacity_; });
+    if (closed_) {
+      return false;
+    }
+    queue_.push_back(std::move(value));
+    lock.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Retrieve the front element of the queue, blocking while empty.
+   *
+   * @return False if the queue is closed and no elements are left.
+   */
+  bool pop(T* value) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return false;
+    }
+    *value = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // Stop accepting new elements and release all waiting threads.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+  }
+  bool empty() const { return size() == 0; }
+  bool isClosed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return closed_;
+  }
+
+ private:
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> queue_;
+  bool closed_ = false;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_BOUNDED_QUEUE_H_
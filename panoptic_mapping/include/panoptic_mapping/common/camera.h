@@ -8,6 +8,8 @@
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/range_image_pyramid.h"
+#include "panoptic_mapping/common/thread_pool.h"
 #include "panoptic_mapping/map/submap.h"
 #include "panoptic_mapping/map/submap_collection.h"
 
@@ -53,6 +55,12 @@ class Camera {
   bool pointIsInViewFrustum(const Point& point_C,
                             float inflation_distance = 0.f) const;
 
+  // Signed distance by which a point lies inside the view frustum, i.e. the
+  // point is in the frustum inflated by 'inflation_distance' iff the margin is
+  // >= 0. Moving the point by d changes the margin by at most d.
+  float viewFrustumMargin(const Point& point_C,
+                          float inflation_distance = 0.f) const;
+
   bool submapIsInViewFrustum(const Submap& submap,
                              const Transformation& T_M_C) const;
 
@@ -71,23 +79,73 @@ class Camera {
                                         bool only_active_submaps = true,
                                         bool include_freespace = false) const;
 
-  voxblox::BlockIndexList findVisibleBlocks(const Submap& subamp,
-                                            const Transformation& T_M_C,
-                                            const float max_range = -1.f) const;
+  // If a range pyramid of the current observation is provided, blocks that
+  // lie entirely behind the observed surface by more than the submap's
+  // truncation distance are also excluded.
+  voxblox::BlockIndexList findVisibleBlocks(
+      const Submap& subamp, const Transformation& T_M_C,
+      const float max_range = -1.f,
+      const RangeImagePyramid* range_pyramid = nullptr) const;
 
   std::unordered_map<int, voxblox::BlockIndexList> findVisibleBlocks(
       const SubmapCollection& submaps, const Transformation& T_M_C,
-      const float max_range = -1.f, bool only_active_submaps = true) const;
+      const float max_range = -1.f, bool only_active_submaps = true,
+      const RangeImagePyramid* range_pyramid = nullptr) const;
+
+  /**
+   * @brief Check whether a sphere lies entirely behind the observed surface.
+   *
+   * @param center_C Center of the sphere in camera frame.
+   * @param radius Radius of the sphere in meters.
+   * @param range_pyramid Range pyramid of the current observation.
+   * @param max_distance_behind_surface Distance behind the surface that is
+   * still considered observed, typically the truncation distance.
+   * @return True if no point of the sphere can be observed.
+   */
+  bool sphereIsBehindSurface(const Point& center_C, float radius,
+                             const RangeImagePyramid& range_pyramid,
+                             float max_distance_behind_surface) const;
 
   // Projection.
   bool projectPointToImagePlane(const Point& p_C, float* u, float* v) const;
 
   bool projectPointToImagePlane(const Point& p_C, int* u, int* v) const;
 
+  // Conservative pixel bounds of the projection of a sphere. Returns false if
+  // the sphere is not entirely in front of the camera.
+  bool projectSphereToImagePlane(const Point& center_C, float radius,
+                                 int* u_min, int* v_min, int* u_max,
+                                 int* v_max) const;
+
   cv::Mat computeVertexMap(const cv::Mat& depth_image) const;
 
   cv::Mat computeValidityImage(const cv::Mat& depth_image) const;
 
+  // Compute into existing images, which are only reallocated if their size or
+  // type does not match.
+  void computeVertexMap(const cv::Mat& depth_image, cv::Mat* vertex_map) const;
+
+  void computeValidityImage(const cv::Mat& depth_image,
+                            cv::Mat* validity_image) const;
+
+  /**
+   * @brief Compute all images derived from a depth image in a single pass,
+   * processed in bands of rows on the thread pool. Outputs that are nullptr
+   * are not computed and existing images are reused if their layout matches.
+   *
+   * @param depth_image Float depth image (CV_32FC1).
+   * @param vertex_map Output XYZ points (CV_32FC3), see 'computeVertexMap()'.
+   * @param validity_image Output validity of the depth (CV_8UC1), see
+   * 'computeValidityImage()'.
+   * @param range_image Output ray length of each pixel (CV_32FC1).
+   * @param thread_pool Pool to process the bands on, nullptr to run serially.
+   * @return Maximum ray length of all pixels whose ray length is within the
+   * camera range, 0 if there are none.
+   */
+  float computeDerivedImages(const cv::Mat& depth_image, cv::Mat* vertex_map,
+                             cv::Mat* validity_image, cv::Mat* range_image,
+                             ThreadPool* thread_pool = nullptr) const;
+
  private:
   const Config config_;
 
@@ -13,6 +13,9 @@
 #include <voxblox/mesh/mesh_layer.h>
 #include <voxblox/utils/timing.h>
 
+#include "panoptic_mapping/common/timing.h"
+#include "panoptic_mapping/common/tracing.h"
+
 namespace panoptic_mapping {
 /**
  * @brief Common Type definitions for the full framework.
@@ -100,14 +103,15 @@ inline std::string changeStateToString(const ChangeState& state) {
  * C - Camera (Sensor)
  */
 
-// Timing.
+// Timing. Timers record into thread-local statistics and also record their
+// spans for tracing, see 'timing::Timer' and 'Tracer'.
 #define PANOPTIC_MAPPING_TIMING_ENABLED  // Unset to disable all timers.
 #ifdef PANOPTIC_MAPPING_TIMING_ENABLED
-using Timer = voxblox::timing::Timer;
+using Timer = timing::Timer;
 #else
 using Timer = voxblox::timing::DummyTimer;
 #endif  // PANOPTIC_MAPPING_TIMING_ENABLED
-using Timing = voxblox::timing::Timing;
+using Timing = timing::Timing;
 
 }  // namespace panoptic_mapping
 
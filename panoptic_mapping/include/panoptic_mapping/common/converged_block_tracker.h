@@ -0,0 +1,90 @@
+#ifndef PANOPTIC_MAPPING_COMMON_CONVERGED_BLOCK_TRACKER_H_
+#define PANOPTIC_MAPPING_COMMON_CONVERGED_BLOCK_TRACKER_H_
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Tracks which blocks of the active submaps have converged, such that
+ * the integrator can skip them. A block is frozen once all voxels it updated
+ * were saturated and the measurements agreed with them for a number of
+ * consecutive updates. Frozen blocks are unfrozen by the integrator as soon
+ * as a cheap consistency test against the measurements fails.
+ */
+class ConvergedBlockTracker {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Number of consecutive converged updates after which a block is frozen.
+    // Use 0 to never freeze blocks.
+    int min_converged_updates = 0;
+
+    // Voxels are saturated if their weight is at least this fraction of the
+    // maximum weight of the integrator.
+    float saturation_fraction = 1.f;
+
+    // Maximum absolute difference between measured and stored distance of a
+    // voxel for an update to count as converged, in voxel sizes.
+    float max_residual = 0.1f;
+
+    // Maximum number of voxels of a frozen block that are tested against the
+    // measurements every frame.
+    int num_test_voxels = 8;
+
+    Config() { setConfigName("ConvergedBlockTracker"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit ConvergedBlockTracker(const Config& config);
+  virtual ~ConvergedBlockTracker() = default;
+
+  /**
+   * @brief Set up the states of all active submaps before integrating a
+   * frame. States of inactive or deleted submaps are dropped. Not thread-safe.
+   */
+  void prepare(const SubmapCollection& submaps);
+
+  // The following are thread-safe for all submaps set up by 'prepare()'.
+  bool isFrozen(int submap_id, const BlockIndex& index) const;
+  void unfreeze(int submap_id, const BlockIndex& index);
+
+  /**
+   * @brief Record an update of a block, freezing it after enough consecutive
+   * converged updates.
+   *
+   * @param converged Whether all updated voxels were saturated and within the
+   * residual.
+   */
+  void recordUpdate(int submap_id, const BlockIndex& index, bool converged);
+
+  // Drop all states.
+  void reset() { submaps_.clear(); }
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  struct BlockState {
+    int num_converged_updates = 0;
+    bool is_frozen = false;
+  };
+  struct SubmapStates {
+    voxblox::AnyIndexHashMapType<BlockState>::type blocks;
+    mutable std::mutex mutex;
+  };
+
+  const Config config_;
+  std::unordered_map<int, std::unique_ptr<SubmapStates>> submaps_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_CONVERGED_BLOCK_TRACKER_H_
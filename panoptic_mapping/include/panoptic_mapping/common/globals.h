@@ -5,7 +5,10 @@
 #include <utility>
 
 #include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/thread_pool.h"
 #include "panoptic_mapping/labels/label_handler_base.h"
+#include "panoptic_mapping/map/mesh_service.h"
+#include "panoptic_mapping/tools/quality_controller.h"
 
 namespace panoptic_mapping {
 
@@ -16,8 +19,15 @@ namespace panoptic_mapping {
 class Globals {
  public:
   Globals(std::shared_ptr<Camera> camera,
-          std::shared_ptr<LabelHandlerBase> label_handler)
-      : camera_(std::move(camera)), label_handler_(std::move(label_handler)) {}
+          std::shared_ptr<LabelHandlerBase> label_handler,
+          ThreadPool* thread_pool = ThreadPool::getGlobalInstance(),
+          std::shared_ptr<MeshService> mesh_service = nullptr,
+          std::shared_ptr<QualityController> quality_controller = nullptr)
+      : camera_(std::move(camera)),
+        label_handler_(std::move(label_handler)),
+        thread_pool_(thread_pool),
+        mesh_service_(std::move(mesh_service)),
+        quality_controller_(std::move(quality_controller)) {}
   virtual ~Globals() = default;
 
   // Access.
@@ -25,11 +35,23 @@ class Globals {
   const std::shared_ptr<LabelHandlerBase>& labelHandler() const {
     return label_handler_;
   }
+  ThreadPool* threadPool() const { return thread_pool_; }
+  // Can be nullptr, in which case meshes are updated by their consumers.
+  const std::shared_ptr<MeshService>& meshService() const {
+    return mesh_service_;
+  }
+  // Can be nullptr, in which case the configured quality is used.
+  const std::shared_ptr<QualityController>& qualityController() const {
+    return quality_controller_;
+  }
 
  private:
   // Components.
   std::shared_ptr<Camera> camera_;
   std::shared_ptr<LabelHandlerBase> label_handler_;
+  ThreadPool* thread_pool_;
+  std::shared_ptr<MeshService> mesh_service_;
+  std::shared_ptr<QualityController> quality_controller_;
 };
 
 }  // namespace panoptic_mapping
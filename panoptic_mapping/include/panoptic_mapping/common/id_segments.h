@@ -0,0 +1,107 @@
+#ifndef PANOPTIC_MAPPING_COMMON_ID_SEGMENTS_H_
+#define PANOPTIC_MAPPING_COMMON_ID_SEGMENTS_H_
+
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "panoptic_mapping/common/thread_pool.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Run-length representation of a segmentation image. Every row is
+ * split into runs of pixels with the same ID and the same depth validity, such
+ * that stages iterating the image can look up IDs and depth checks once per
+ * run instead of once per pixel. Additionally the bounding box and pixel
+ * counts of every segment are stored.
+ *
+ * The runs of each row cover the full row and are sorted by column.
+ */
+class IDSegments {
+ public:
+  // Pixels [u_begin, u_end) of a row.
+  struct Run {
+    int u_begin = 0;
+    int u_end = 0;
+    int id = 0;
+    // True if the depth of all pixels of the run is within the range limits.
+    bool is_valid = false;
+  };
+
+  struct Segment {
+    int id = 0;
+    // Bounding box of all pixels of the segment (inclusive).
+    int u_min = 0;
+    int v_min = 0;
+    int u_max = 0;
+    int v_max = 0;
+    int num_pixels = 0;
+    int num_valid_pixels = 0;
+  };
+
+  IDSegments() = default;
+
+  /**
+   * @brief Compute the runs and segments of a frame.
+   *
+   * @param id_image Segmentation image (CV_32SC1).
+   * @param depth_image Depth image (CV_32FC1) of the same size.
+   * @param min_range, max_range Depth range of valid pixels.
+   * @param thread_pool If provided, bands of rows are processed in parallel.
+   * @param num_bands Number of bands to split the image into.
+   */
+  void build(const cv::Mat& id_image, const cv::Mat& depth_image,
+             float min_range, float max_range,
+             ThreadPool* thread_pool = nullptr, int num_bands = 1);
+
+  /**
+   * @brief Replace all IDs, e.g. after tracking. Neighboring runs that end up
+   * with the same ID are merged and the segments are recomputed.
+   *
+   * @param translate Callable mapping an ID to its new ID.
+   */
+  template <typename TranslationT>
+  void relabel(TranslationT translate);
+
+  // Runs of row v.
+  const Run* rowBegin(int v) const { return runs_.data() + row_offsets_[v]; }
+  const Run* rowEnd(int v) const {
+    return runs_.data() + row_offsets_[v + 1];
+  }
+
+  // Segments sorted by ID. Returns nullptr if the ID is not present.
+  const std::vector<Segment>& getSegments() const { return segments_; }
+  const Segment* getSegment(int id) const;
+  std::vector<int> getIDs() const;
+
+  // Access.
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  size_t getNumberOfRuns() const { return runs_.size(); }
+  bool empty() const { return rows_ == 0; }
+
+ private:
+  // Merge neighboring runs with the same ID and validity.
+  void mergeRuns();
+  void computeSegments();
+
+  int rows_ = 0;
+  int cols_ = 0;
+  std::vector<Run> runs_;
+  std::vector<size_t> row_offsets_;  // Index of the first run of each row.
+  std::vector<Segment> segments_;
+};
+
+template <typename TranslationT>
+void IDSegments::relabel(TranslationT translate) {
+  for (Run& run : runs_) {
+    run.id = translate(run.id);
+  }
+  mergeRuns();
+  computeSegments();
+}
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_ID_SEGMENTS_H_
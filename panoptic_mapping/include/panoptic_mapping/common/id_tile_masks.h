@@ -0,0 +1,61 @@
+#ifndef PANOPTIC_MAPPING_COMMON_ID_TILE_MASKS_H_
+#define PANOPTIC_MAPPING_COMMON_ID_TILE_MASKS_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "panoptic_mapping/common/id_segments.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Coarse masks of where each ID of a segmentation image occurs. The
+ * image is split into square tiles and an integral image over the tiles that
+ * contain an ID is stored per ID, such that whether an ID occurs anywhere
+ * within an image region can be bounded conservatively in constant time.
+ */
+class IDTileMasks {
+ public:
+  static constexpr int kTileSize = 8;  // Pixels.
+
+  IDTileMasks() = default;
+
+  /**
+   * @brief Compute the masks of all IDs of a frame.
+   *
+   * @param id_image Segmentation image (CV_32SC1).
+   * @param segments Optional run-length segments of the same image, which are
+   * used instead of the pixels if provided.
+   */
+  void build(const cv::Mat& id_image, const IDSegments* segments = nullptr);
+
+  /**
+   * @brief Check whether an ID may occur in an image region. False positives
+   * are possible at the tile resolution, false negatives are not.
+   *
+   * @param id The ID to look up.
+   * @param u_min, v_min, u_max, v_max Pixel bounds of the region (inclusive).
+   * The region is clipped to the image.
+   * @return False if no pixel in the region has the ID.
+   */
+  bool mayContain(int id, int u_min, int v_min, int u_max, int v_max) const;
+
+  bool empty() const { return rows_ == 0; }
+
+ private:
+  int rows_ = 0;
+  int cols_ = 0;
+  int tile_rows_ = 0;
+  int tile_cols_ = 0;
+
+  // Integral images of (tile_rows_ + 1) x (tile_cols_ + 1) counts of tiles
+  // containing the ID, stored consecutively.
+  std::unordered_map<int, size_t> offsets_;  // <id, offset into integrals_>
+  std::vector<int> integrals_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_ID_TILE_MASKS_H_
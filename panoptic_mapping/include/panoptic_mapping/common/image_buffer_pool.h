@@ -0,0 +1,64 @@
+#ifndef PANOPTIC_MAPPING_COMMON_IMAGE_BUFFER_POOL_H_
+#define PANOPTIC_MAPPING_COMMON_IMAGE_BUFFER_POOL_H_
+
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+namespace panoptic_mapping {
+
+/**
+ * Thread safe pool of image buffers for per-frame derived images such as
+ * vertex maps and validity images. A buffer is handed out again once all
+ * cv::Mats referencing it, e.g. the ones stored in an InputData, were
+ * released, which avoids allocating new images for every frame. If all
+ * buffers are in use, additional images are allocated outside the pool.
+ */
+class ImageBufferPool {
+ public:
+  explicit ImageBufferPool(size_t capacity = 8) : capacity_(capacity) {}
+
+  /**
+   * @brief Get an image of the requested size and type. The content of the
+   * image is undefined.
+   */
+  cv::Mat get(int rows, int cols, int type) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (cv::Mat& buffer : buffers_) {
+      // Only the pool references the buffer.
+      if (buffer.u && buffer.u->refcount == 1 && buffer.rows == rows &&
+          buffer.cols == cols && buffer.type() == type) {
+        return buffer;
+      }
+    }
+    cv::Mat image(rows, cols, type);
+    if (buffers_.size() < capacity_) {
+      buffers_.emplace_back(image);
+    } else {
+      // Replace an unused buffer of different layout if possible.
+      for (cv::Mat& buffer : buffers_) {
+        if (buffer.u && buffer.u->refcount == 1) {
+          buffer = image;
+          break;
+        }
+      }
+    }
+    return image;
+  }
+
+  // Drop all buffers from the pool, images in use remain valid.
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.clear();
+  }
+
+ private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::vector<cv::Mat> buffers_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_IMAGE_BUFFER_POOL_H_
@@ -1,6 +1,9 @@
 #ifndef PANOPTIC_MAPPING_COMMON_INDEX_GETTER_H_
 #define PANOPTIC_MAPPING_COMMON_INDEX_GETTER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <utility>
 #include <vector>
@@ -38,6 +41,97 @@ class IndexGetter {
 
 typedef IndexGetter<int> SubmapIndexGetter;
 
+/**
+ * Lock-free alternative to the IndexGetter. Threads atomically claim chunks of
+ * consecutive indices, which keeps the synchronization overhead low even for
+ * fine-grained work items such as individual blocks.
+ */
+template <typename IndexT>
+class ChunkedIndexGetter {
+ public:
+  explicit ChunkedIndexGetter(std::vector<IndexT> indices,
+                              size_t chunk_size = 1)
+      : indices_(std::move(indices)),
+        chunk_size_(std::max<size_t>(chunk_size, 1)),
+        current_index_(0) {}
+
+  /**
+   * @brief Claim the next chunk of indices.
+   *
+   * @param begin Position of the first index of the chunk.
+   * @param end Position past the last index of the chunk.
+   * @return False if all indices have been handed out.
+   */
+  bool getNextChunk(size_t* begin, size_t* end) {
+    CHECK_NOTNULL(begin);
+    CHECK_NOTNULL(end);
+    const size_t start =
+        current_index_.fetch_add(chunk_size_, std::memory_order_relaxed);
+    if (start >= indices_.size()) {
+      return false;
+    }
+    *begin = start;
+    *end = std::min(start + chunk_size_, indices_.size());
+    return true;
+  }
+
+  const IndexT& operator[](size_t position) const {
+    return indices_[position];
+  }
+  size_t size() const { return indices_.size(); }
+
+ private:
+  const std::vector<IndexT> indices_;
+  const size_t chunk_size_;
+  std::atomic<size_t> current_index_;
+};
+
+/**
+ * Work items grouped by their preferred NUMA node, e.g. the home node of the
+ * submap they belong to. Threads claim chunks of their own node first and
+ * then help with the items of the other nodes.
+ */
+template <typename IndexT>
+class NodeLocalIndexGetter {
+ public:
+  explicit NodeLocalIndexGetter(std::vector<std::vector<IndexT>> node_indices,
+                                size_t chunk_size = 1) {
+    for (std::vector<IndexT>& indices : node_indices) {
+      getters_.emplace_back(std::make_unique<ChunkedIndexGetter<IndexT>>(
+          std::move(indices), chunk_size));
+    }
+  }
+
+  /**
+   * @brief Claim the next chunk of indices, preferring the given node.
+   *
+   * @param node Node of the calling thread.
+   * @param getter Set to the getter of the node the chunk belongs to.
+   * @param begin Position of the first index of the chunk in the getter.
+   * @param end Position past the last index of the chunk in the getter.
+   * @return False if all indices have been handed out.
+   */
+  bool getNextChunk(int node, const ChunkedIndexGetter<IndexT>** getter,
+                    size_t* begin, size_t* end) {
+    CHECK_NOTNULL(getter);
+    for (size_t i = 0; i < getters_.size(); ++i) {
+      const size_t index = (std::max(node, 0) + i) % getters_.size();
+      if (getters_[index]->getNextChunk(begin, end)) {
+        *getter = getters_[index].get();
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<std::unique_ptr<ChunkedIndexGetter<IndexT>>> getters_;
+};
+
+// Work items of block-parallel integration over multiple submaps.
+typedef std::pair<int, voxblox::BlockIndex> SubmapBlockIndex;
+typedef ChunkedIndexGetter<SubmapBlockIndex> SubmapBlockIndexGetter;
+
 }  // namespace panoptic_mapping
 
 #endif  // PANOPTIC_MAPPING_COMMON_INDEX_GETTER_H_
@@ -1,15 +1,20 @@
 #ifndef PANOPTIC_MAPPING_COMMON_INPUT_DATA_H_
 #define PANOPTIC_MAPPING_COMMON_INPUT_DATA_H_
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <opencv2/core/mat.hpp>
 
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/id_segments.h"
 
 namespace panoptic_mapping {
+class Camera;
 class InputDataUser;
 
 /**
@@ -40,7 +45,9 @@ class InputData {
     kDetectronLabels,
     kVertexMap,
     kValidityImage,
-    kUncertaintyImage
+    kUncertaintyImage,
+    kRangeImage,
+    kIDSegments
   };
 
   static std::string inputTypeToString(InputType type) {
@@ -59,6 +66,10 @@ class InputData {
         return "Vertex Map";
       case InputType::kValidityImage:
         return "Validity Image";
+      case InputType::kRangeImage:
+        return "Range Image";
+      case InputType::kIDSegments:
+        return "ID Segments";
       default:
         return "Unknown Input";
     }
@@ -101,11 +112,39 @@ class InputData {
     contained_inputs_.insert(InputType::kValidityImage);
   }
 
+  void setRangeImage(const cv::Mat& range_image, float max_range_in_image) {
+    range_image_ = range_image;
+    max_range_in_image_ = max_range_in_image;
+    contained_inputs_.insert(InputType::kRangeImage);
+  }
+
+  void setIDSegments(IDSegments id_segments) {
+    id_segments_ = std::move(id_segments);
+    contained_inputs_.insert(InputType::kIDSegments);
+  }
+
   void setUncertaintyImage(const cv::Mat& uncertainty_image) {
     uncertainty_image_ = uncertainty_image;
     contained_inputs_.insert(InputType::kUncertaintyImage);
   }
 
+  // Synchronized input of a further calibrated camera. Integrators that
+  // support multiple views fuse all views of an input in a single pass.
+  struct AdditionalView {
+    std::shared_ptr<InputData> input;
+    std::shared_ptr<const Camera> camera;
+  };
+  void addAdditionalView(std::shared_ptr<InputData> input,
+                         std::shared_ptr<const Camera> camera) {
+    additional_views_.push_back({std::move(input), std::move(camera)});
+  }
+
+  // Keep memory referenced by the images alive as long as this input, e.g.
+  // the buffers of messages the images were not copied from.
+  void addBufferOwner(std::shared_ptr<const void> owner) {
+    buffer_owners_.emplace_back(std::move(owner));
+  }
+
   // Access.
   // Access to constant data.
   const Transformation& T_M_C() const { return T_M_C_; }
@@ -118,10 +157,17 @@ class InputData {
   const cv::Mat& idImage() const { return id_image_; }
   const cv::Mat& validityImage() const { return validity_image_; }
   const cv::Mat& uncertaintyImage() const { return uncertainty_image_; }
+  const cv::Mat& rangeImage() const { return range_image_; }
+  const IDSegments& idSegments() const { return id_segments_; }
+  float maxRangeInImage() const { return max_range_in_image_; }
+  const std::vector<AdditionalView>& additionalViews() const {
+    return additional_views_;
+  }
 
   // Access to modifyable data.
   cv::Mat* idImagePtr() { return &id_image_; }
   cv::Mat* validityImagePtr() { return &validity_image_; }
+  IDSegments* idSegmentsPtr() { return &id_segments_; }
 
   // Tools.
   bool has(InputType input_type) const {
@@ -146,12 +192,22 @@ class InputData {
   // Common derived data.
   cv::Mat vertex_map_;      // XYZ points (CV32FC3), can be compute via camera.
   cv::Mat validity_image_;  // 0-1 image for valid pixels (CV_8UC1).
+  cv::Mat range_image_;     // Ray lengths (CV_32FC1), can be computed via
+                            // camera.
+  float max_range_in_image_ = 0.f;  // Largest ray length within the range.
+  IDSegments id_segments_;  // Runs of the id image, kept in sync with it.
 
   // Optional Input data.
   DetectronLabels detectron_labels_;
 
   // Content tracking.
   InputData::InputTypes contained_inputs_;
+
+  // Inputs of further cameras taken at the same time.
+  std::vector<AdditionalView> additional_views_;
+
+  // Owners of externally allocated image memory.
+  std::vector<std::shared_ptr<const void>> buffer_owners_;
 };
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,68 @@
+#ifndef PANOPTIC_MAPPING_COMMON_MORTON_ORDER_H_
+#define PANOPTIC_MAPPING_COMMON_MORTON_ORDER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Utilities to order blocks along the Morton (Z-order) curve, such that
+ * blocks that are processed consecutively are close in space. Block lists
+ * obtained from the hash maps of the layers are otherwise in random order.
+ */
+
+// Spread the lower 21 bits of a value to every third bit.
+inline uint64_t spreadMortonBits(uint64_t x) {
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffff;
+  x = (x | x << 16) & 0x1f0000ff0000ff;
+  x = (x | x << 8) & 0x100f00f00f00f00f;
+  x = (x | x << 4) & 0x10c30c30c30c30c3;
+  x = (x | x << 2) & 0x1249249249249249;
+  return x;
+}
+
+// Morton code of a block index. Indices are offset such that negative indices
+// within +-2^20 blocks are ordered correctly.
+inline uint64_t mortonCode(const BlockIndex& index) {
+  constexpr int64_t kOffset = int64_t(1) << 20;
+  return spreadMortonBits(static_cast<uint64_t>(index.x() + kOffset)) |
+         spreadMortonBits(static_cast<uint64_t>(index.y() + kOffset)) << 1 |
+         spreadMortonBits(static_cast<uint64_t>(index.z() + kOffset)) << 2;
+}
+
+/**
+ * @brief Sort items by the Morton code of their block index. The codes are
+ * computed once per item.
+ *
+ * @param items Items to sort in place.
+ * @param get_index Callable returning the block index of an item.
+ */
+template <typename ContainerT, typename GetIndexT>
+void sortMortonOrder(ContainerT* items, GetIndexT get_index) {
+  std::vector<std::pair<uint64_t, size_t>> codes;
+  codes.reserve(items->size());
+  for (size_t i = 0; i < items->size(); ++i) {
+    codes.emplace_back(mortonCode(get_index((*items)[i])), i);
+  }
+  std::sort(codes.begin(), codes.end());
+  ContainerT sorted;
+  sorted.reserve(items->size());
+  for (const auto& code_index_pair : codes) {
+    sorted.push_back(std::move((*items)[code_index_pair.second]));
+  }
+  items->swap(sorted);
+}
+
+inline void sortMortonOrder(voxblox::BlockIndexList* blocks) {
+  sortMortonOrder(blocks, [](const BlockIndex& index) { return index; });
+}
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_MORTON_ORDER_H_
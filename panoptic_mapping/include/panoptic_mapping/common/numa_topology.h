@@ -0,0 +1,52 @@
+#ifndef PANOPTIC_MAPPING_COMMON_NUMA_TOPOLOGY_H_
+#define PANOPTIC_MAPPING_COMMON_NUMA_TOPOLOGY_H_
+
+#include <string>
+#include <vector>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief The NUMA nodes of the machine and the CPU cores belonging to each of
+ * them. Read from sysfs on Linux, on other platforms or if the information is
+ * unavailable all cores are reported as a single node.
+ */
+class NumaTopology {
+ public:
+  // Access to the topology of this machine, read once.
+  static const NumaTopology& get() {
+    static const NumaTopology instance = detect();
+    return instance;
+  }
+
+  // Construct a topology from a list of cores per node, e.g. for testing.
+  explicit NumaTopology(std::vector<std::vector<int>> node_cores);
+
+  int getNumNodes() const { return static_cast<int>(node_cores_.size()); }
+  const std::vector<int>& getCores(int node) const {
+    return node_cores_[node];
+  }
+
+  // Returns the node of a core, 0 if the core is unknown.
+  int getNodeOfCore(int core) const;
+
+  // Node of the core the calling thread is currently executing on.
+  int getCurrentNode() const;
+
+  /**
+   * @brief Parse a sysfs CPU list such as "0-3,8,10-11".
+   *
+   * @return The listed cores, empty if the list is malformed.
+   */
+  static std::vector<int> parseCpuList(const std::string& cpu_list);
+
+ private:
+  static NumaTopology detect();
+
+  std::vector<std::vector<int>> node_cores_;
+  std::vector<int> core_nodes_;  // Core index -> node, -1 if unknown.
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_NUMA_TOPOLOGY_H_
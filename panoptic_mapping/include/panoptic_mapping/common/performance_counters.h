@@ -0,0 +1,48 @@
+#ifndef PANOPTIC_MAPPING_COMMON_PERFORMANCE_COUNTERS_H_
+#define PANOPTIC_MAPPING_COMMON_PERFORMANCE_COUNTERS_H_
+
+#include <cstdint>
+
+namespace panoptic_mapping {
+namespace performance_counters {
+
+/**
+ * @brief Hardware performance counters of the calling thread, read via Linux
+ * perf_event_open. Sampling is disabled by default. Once enabled, every
+ * thread opens its counters on first use, and the timers record the counts
+ * of their scopes. Counters that are not supported by the CPU or not
+ * permitted (see /proc/sys/kernel/perf_event_paranoid) read as zero.
+ */
+enum Event {
+  kCycles = 0,
+  kInstructions,
+  kCacheReferences,
+  kCacheMisses,
+  kBranches,
+  kBranchMisses,
+  kNumEvents
+};
+
+struct Values {
+  uint64_t counts[kNumEvents] = {};
+};
+
+const char* eventToString(Event event);
+
+// Enable sampling for all threads. Returns false if perf events are not
+// available on this system.
+bool enable();
+bool isEnabled();
+
+/**
+ * @brief Read the current counts of the calling thread, user space only.
+ *
+ * @param values Output counts since the counters of this thread were opened.
+ * @return True if at least the cycle counter could be read.
+ */
+bool readThreadCounters(Values* values);
+
+}  // namespace performance_counters
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_PERFORMANCE_COUNTERS_H_
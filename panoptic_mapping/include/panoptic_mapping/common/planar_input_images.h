@@ -0,0 +1,92 @@
+#ifndef PANOPTIC_MAPPING_COMMON_PLANAR_INPUT_IMAGES_H_
+#define PANOPTIC_MAPPING_COMMON_PLANAR_INPUT_IMAGES_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/input_data.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Per-frame copy of all integration inputs in a common planar layout.
+ * Every image is stored as a separate plane of 32 bit values with the same
+ * row stride, such that a single index addresses the same pixel in the range,
+ * ID, color, and uncertainty planes. Colors are packed as RGBA into one value,
+ * such that a pixel of every plane can be fetched by one 32 bit gather.
+ *
+ * All planes are aligned to 64 bytes, and rows are padded to a multiple of 16
+ * values. One additional row and column replicate the last pixels of the
+ * image, such that the 2x2 neighborhood of every pixel can be read without
+ * bounds checks.
+ */
+class PlanarInputImages {
+ public:
+  static constexpr size_t kAlignment = 64;  // Bytes.
+  static constexpr int kStrideMultiple = kAlignment / sizeof(float);
+
+  PlanarInputImages() = default;
+
+  /**
+   * @brief Copy the range image and all available images of the input into
+   * the planes. Memory is only reallocated if the image size grows.
+   *
+   * @param range_image Range image (rows x cols) as computed by the
+   * integrator.
+   * @param input Input of the same view to take the color, ID, and
+   * uncertainty images from if present.
+   */
+  void build(const Eigen::MatrixXf& range_image, const InputData& input);
+
+  // Index of pixel (u, v) in all planes. The neighbors are at +1 (u + 1),
+  // +stride (v + 1), and +stride + 1.
+  size_t index(int u, int v) const {
+    return static_cast<size_t>(v) * stride_ + u;
+  }
+
+  // Access.
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int stride() const { return stride_; }
+  bool empty() const { return rows_ == 0; }
+  bool hasColor() const { return has_color_; }
+  bool hasIds() const { return has_ids_; }
+  bool hasUncertainty() const { return has_uncertainty_; }
+  const float* range() const { return range_.get(); }
+  const uint32_t* color() const { return color_.get(); }  // RGBA.
+  const int* ids() const { return ids_.get(); }
+  const float* uncertainty() const { return uncertainty_.get(); }
+
+  static Color unpackColor(uint32_t rgba) {
+    return Color(rgba & 0xFF, (rgba >> 8) & 0xFF, (rgba >> 16) & 0xFF,
+                 rgba >> 24);
+  }
+
+ private:
+  struct AlignedDeleter {
+    void operator()(void* data) const { std::free(data); }
+  };
+  template <typename T>
+  using Plane = std::unique_ptr<T[], AlignedDeleter>;
+
+  template <typename T>
+  void allocate(Plane<T>* plane) const;
+
+  int rows_ = 0;
+  int cols_ = 0;
+  int stride_ = 0;
+  size_t capacity_ = 0;  // Values per plane.
+  bool has_color_ = false;
+  bool has_ids_ = false;
+  bool has_uncertainty_ = false;
+  Plane<float> range_;
+  Plane<uint32_t> color_;
+  Plane<int> ids_;
+  Plane<float> uncertainty_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_PLANAR_INPUT_IMAGES_H_
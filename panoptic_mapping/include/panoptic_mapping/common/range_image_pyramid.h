@@ -0,0 +1,47 @@
+#ifndef PANOPTIC_MAPPING_COMMON_RANGE_IMAGE_PYRAMID_H_
+#define PANOPTIC_MAPPING_COMMON_RANGE_IMAGE_PYRAMID_H_
+
+#include <vector>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Image pyramid storing the maximum range of each 2^k x 2^k pixel tile
+ * of a range image. This allows to conservatively bound the observed range
+ * within an arbitrary image region in constant time.
+ */
+class RangeImagePyramid {
+ public:
+  RangeImagePyramid() = default;
+  virtual ~RangeImagePyramid() = default;
+
+  /**
+   * @brief Compute all levels of the pyramid.
+   *
+   * @param range_image Range image (rows x cols) in meters.
+   */
+  void build(const Eigen::MatrixXf& range_image);
+
+  /**
+   * @brief Get an upper bound on the range in an image region.
+   *
+   * @param u_min, v_min, u_max, v_max Pixel bounds of the region (inclusive).
+   * The region is clipped to the image.
+   * @return The maximum range in the region, 0 if the region is empty.
+   */
+  float maxRange(int u_min, int v_min, int u_max, int v_max) const;
+
+  bool empty() const { return levels_.empty(); }
+
+  // Exchange the levels with another pyramid without copying them.
+  void swap(RangeImagePyramid& other) { levels_.swap(other.levels_); }
+
+ private:
+  std::vector<Eigen::MatrixXf> levels_;  // Level 0 is the full resolution.
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_RANGE_IMAGE_PYRAMID_H_
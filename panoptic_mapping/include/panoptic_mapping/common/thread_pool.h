@@ -0,0 +1,180 @@
+#ifndef PANOPTIC_MAPPING_COMMON_THREAD_POOL_H_
+#define PANOPTIC_MAPPING_COMMON_THREAD_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Persistent work-stealing thread pool. Every worker owns a task queue,
+ * processes its own tasks last-in-first-out and steals the oldest tasks of
+ * other workers when idle. Default uses a global singleton such that all
+ * modules share the same workers instead of spawning threads every frame.
+ *
+ * If NUMA-aware scheduling is enabled, every worker is assigned to a NUMA node
+ * of the machine. Tasks can be submitted to a node, idle workers steal tasks
+ * of their own node before those of other nodes.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads = std::thread::hardware_concurrency());
+  virtual ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Access to the global thread pool via singleton.
+  static ThreadPool* getGlobalInstance() {
+    static ThreadPool instance;
+    return &instance;
+  }
+
+  /**
+   * @brief Change the number of workers. All queued tasks are finished before
+   * the workers are replaced, so this should only be called during setup.
+   *
+   * @param num_threads Number of worker threads, at least 1.
+   */
+  void setNumThreads(int num_threads);
+  int getNumThreads() const { return static_cast<int>(workers_.size()); }
+
+  /**
+   * @brief Pin the workers to CPU cores and set their priority. Worker i is
+   * pinned to cores[i % cores.size()], such that workers do not migrate
+   * between cores. The settings persist if the number of threads is changed.
+   *
+   * @param cores Cores to distribute the workers over. Empty to not pin them.
+   * @param priority Real-time priority in [1, 99], 0 for default scheduling.
+   * See 'thread_scheduling::configureThread()'.
+   * @param numa_aware If true, every worker is assigned to the NUMA node of
+   * its core. Without cores, the workers are distributed round robin over
+   * the nodes and pinned to all cores of their node. Changing the node
+   * assignment restarts the workers, so this should only be called during
+   * setup.
+   */
+  void setScheduling(const std::vector<int>& cores, int priority,
+                     bool numa_aware = false);
+
+  // Number of NUMA nodes the workers are distributed over, at least 1. Nodes
+  // are numbered [0, getNumNodes()) in the order of the machine's nodes.
+  int getNumNodes() const { return static_cast<int>(node_workers_.size()); }
+
+  // Node of the calling worker, 0 if called from outside the pool.
+  int getCurrentNode() const;
+
+  /**
+   * @brief Schedule a function for execution in the pool.
+   *
+   * @param function Callable without arguments.
+   * @return Future holding the result of the function.
+   */
+  template <typename FunctionT>
+  std::future<std::invoke_result_t<FunctionT>> submit(FunctionT&& function) {
+    using ResultT = std::invoke_result_t<FunctionT>;
+    auto task = std::make_shared<std::packaged_task<ResultT()>>(
+        std::forward<FunctionT>(function));
+    std::future<ResultT> result = task->get_future();
+    pushTask([task]() { (*task)(); });
+    return result;
+  }
+
+  /**
+   * @brief Schedule a function for execution on a worker of a NUMA node,
+   * e.g. the home node of the data it processes. Workers of other nodes only
+   * execute it if they run out of local work.
+   *
+   * @param node Node in [0, getNumNodes()). Other values distribute the task
+   * as in 'submit()'.
+   * @param function Callable without arguments.
+   * @return Future holding the result of the function.
+   */
+  template <typename FunctionT>
+  std::future<std::invoke_result_t<FunctionT>> submitOnNode(
+      int node, FunctionT&& function) {
+    using ResultT = std::invoke_result_t<FunctionT>;
+    auto task = std::make_shared<std::packaged_task<ResultT()>>(
+        std::forward<FunctionT>(function));
+    std::future<ResultT> result = task->get_future();
+    pushTask([task]() { (*task)(); }, node);
+    return result;
+  }
+
+  /**
+   * @brief Wait for a future of this pool. While waiting, the calling thread
+   * helps executing queued tasks, which prevents dead locks when tasks are
+   * waited for from within the pool.
+   */
+  template <typename T>
+  T wait(std::future<T>* future) {
+    while (future->wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      if (!runPendingTask()) {
+        future->wait_for(std::chrono::microseconds(100));
+      }
+    }
+    return future->get();
+  }
+
+  // Wait for all futures, see 'wait()'.
+  template <typename T>
+  void waitAll(std::vector<std::future<T>>* futures) {
+    for (std::future<T>& future : *futures) {
+      wait(&future);
+    }
+  }
+
+  /**
+   * @brief Execute one queued task on the calling thread if available.
+   *
+   * @return True if a task was executed.
+   */
+  bool runPendingTask();
+
+ private:
+  using Task = std::function<void()>;
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void startWorkers(int num_threads);
+  // Compute the node and cores of every worker.
+  void assignNodes(int num_threads);
+  void applyScheduling();
+  void stopWorkers();
+  void workerLoop(int worker_index);
+  void pushTask(Task task, int node = -1);
+  bool popTask(int worker_index, Task* task);
+
+ private:
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_condition_;
+  std::atomic<int> num_pending_tasks_{0};
+  std::atomic<size_t> next_queue_{0};
+  bool stop_ = false;
+  std::vector<int> cores_;
+  int priority_ = 0;
+  bool numa_aware_ = false;
+
+  // Fixed while the workers are running.
+  std::vector<std::vector<int>> worker_cores_;
+  std::vector<int> worker_nodes_;               // Worker index -> node.
+  std::vector<std::vector<int>> node_workers_;  // Node -> worker indices.
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_THREAD_POOL_H_
@@ -0,0 +1,35 @@
+#ifndef PANOPTIC_MAPPING_COMMON_THREAD_SCHEDULING_H_
+#define PANOPTIC_MAPPING_COMMON_THREAD_SCHEDULING_H_
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace panoptic_mapping {
+namespace thread_scheduling {
+
+/**
+ * @brief Pin a thread to a set of CPU cores and optionally raise its priority,
+ * such that time critical threads are not migrated onto cores shared with
+ * other processes, e.g. camera drivers. Only supported on Linux, on other
+ * platforms a warning is printed and false is returned.
+ *
+ * @param thread Thread to configure.
+ * @param cores Indices of the cores the thread may run on. Empty to keep the
+ * current affinity.
+ * @param priority Real-time (SCHED_FIFO) priority in [1, 99]. 0 keeps the
+ * default scheduling policy. Usually requires CAP_SYS_NICE.
+ * @param name Name of the thread for logging.
+ * @return True if all requested settings were applied.
+ */
+bool configureThread(std::thread* thread, const std::vector<int>& cores,
+                     int priority, const std::string& name);
+
+// Same as above for the calling thread.
+bool configureCurrentThread(const std::vector<int>& cores, int priority,
+                            const std::string& name);
+
+}  // namespace thread_scheduling
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_THREAD_SCHEDULING_H_
@@ -0,0 +1,144 @@
+#ifndef PANOPTIC_MAPPING_COMMON_TIMING_H_
+#define PANOPTIC_MAPPING_COMMON_TIMING_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "panoptic_mapping/common/performance_counters.h"
+
+namespace panoptic_mapping {
+namespace timing {
+
+/**
+ * @brief Low overhead replacement of voxblox::timing. Every timer tag is
+ * registered once as a key with a fixed index. Timers accumulate into
+ * statistics owned by their thread, such that timing never takes a lock or
+ * looks up strings after the first use of a tag in a thread. The statistics
+ * of all threads are aggregated when they are read, without blocking the
+ * timed threads.
+ */
+class Key {
+ public:
+  // Register a tag, e.g. as a static member or local for hot code.
+  explicit Key(const std::string& tag);
+
+  size_t getIndex() const { return index_; }
+  const std::string& getTag() const;
+
+ private:
+  size_t index_;
+};
+
+/**
+ * @brief Drop-in replacement of voxblox::timing::Timer that records into
+ * thread-local statistics and reports every timed span to the global Tracer.
+ * If allocation tracking is compiled in, the heap allocations of the calling
+ * thread while timing are recorded as well, see allocation_tracking.h. If
+ * hardware performance counters are enabled, their counts are recorded, see
+ * performance_counters.h.
+ */
+class Timer {
+ public:
+  explicit Timer(const Key& key, bool construct_stopped = false);
+  // Tags given as string literals are cached per thread by address.
+  explicit Timer(const char* tag, bool construct_stopped = false);
+  explicit Timer(const std::string& tag, bool construct_stopped = false);
+  ~Timer() {
+    if (is_timing_) {
+      Stop();
+    }
+  }
+
+  void Start();
+  void Stop();
+  // Pausing interrupts the measurement without recording a sample.
+  void Pause();
+  void Unpause();
+  bool IsTiming() const { return is_timing_; }
+  size_t GetHandle() const { return index_; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  void startSegment();
+  void endSegment();
+
+  const size_t index_;
+  bool is_timing_ = false;
+  bool is_paused_ = false;
+  Clock::time_point start_;
+  Clock::duration elapsed_ = Clock::duration::zero();
+
+  // Allocation tracking. The peak assumes that timers of a thread are nested.
+  uint64_t allocations_start_ = 0;
+  uint64_t bytes_start_ = 0;
+  uint64_t num_allocations_ = 0;
+  uint64_t allocated_bytes_ = 0;
+  int64_t live_bytes_start_ = 0;
+  int64_t outer_peak_bytes_ = 0;
+
+  // Hardware performance counters.
+  bool has_counters_ = false;
+  performance_counters::Values counters_start_;
+  performance_counters::Values counters_;
+};
+
+/**
+ * @brief Access to the aggregated statistics of all timers, compatible with
+ * the interface of voxblox::timing::Timing.
+ */
+class Timing {
+ public:
+  struct Statistics {
+    uint64_t count = 0;
+    double total = 0.0;   // s
+    double mean = 0.0;    // s
+    double stddev = 0.0;  // s
+    double min = 0.0;     // s
+    double max = 0.0;     // s
+
+    // Only recorded if allocation tracking is enabled.
+    uint64_t num_allocations = 0;
+    uint64_t allocated_bytes = 0;
+    int64_t peak_bytes = 0;  // Maximum over all samples.
+
+    // Only recorded if performance counters are enabled. Total counts over
+    // the samples with counters.
+    uint64_t counter_samples = 0;
+    performance_counters::Values counters;
+
+    // Derived metrics, 0 if not available.
+    double instructionsPerCycle() const;
+    double cacheMissRate() const;
+    double branchMissRate() const;
+  };
+
+  // Aggregated statistics of a tag over all threads.
+  static Statistics getStatistics(const std::string& tag);
+  static double GetTotalSeconds(const std::string& tag);
+  static double GetMeanSeconds(const std::string& tag);
+  static size_t GetNumSamples(const std::string& tag);
+
+  // Statistics of a tag per thread that recorded samples.
+  static std::vector<Statistics> getThreadStatistics(const std::string& tag);
+
+  // Enable hardware performance counter sampling, see
+  // performance_counters.h. Returns false if they are not available.
+  static bool enablePerformanceCounters();
+
+  // Table of all statistics in the format of voxblox::timing, followed by the
+  // allocations and hardware counters per scope if recorded and the timers of
+  // voxblox itself.
+  static std::string Print();
+  static void Print(std::ostream& out);  // NOLINT
+
+  // Reset all statistics. Only safe while no timers are running.
+  static void Reset();
+};
+
+}  // namespace timing
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_TIMING_H_
@@ -0,0 +1,84 @@
+#ifndef PANOPTIC_MAPPING_COMMON_TRACING_H_
+#define PANOPTIC_MAPPING_COMMON_TRACING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Records individual timed spans with their thread and frame sequence
+ * number, as opposed to the aggregate statistics of voxblox::timing. All
+ * Timers report to the global tracer, which only stores spans while enabled.
+ * The recorded spans can be exported in the Chrome trace event format, which
+ * is readable by chrome://tracing and Perfetto.
+ */
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr int64_t kNoFrame = -1;
+
+  struct Span {
+    std::string name;
+    int64_t start_us;  // Since construction of the tracer.
+    int64_t duration_us;
+    int thread;  // Sequential id of the recording thread.
+    int64_t frame;
+  };
+
+  Tracer() = default;
+  virtual ~Tracer() = default;
+
+  // Access to the global tracer via singleton.
+  static Tracer* getGlobalInstance() {
+    static Tracer instance;
+    return &instance;
+  }
+
+  /**
+   * @brief Start recording spans. If more than 'max_spans' spans are
+   * recorded, the oldest ones are dropped.
+   */
+  void enable(size_t max_spans);
+  void disable() { enabled_ = false; }
+  bool isEnabled() const { return enabled_; }
+
+  /**
+   * @brief Set the frame sequence number assigned to new spans. Spans of
+   * threads that set a thread frame use that one instead, e.g. for pipeline
+   * stages processing different frames concurrently.
+   */
+  void setFrame(int64_t frame) { frame_ = frame; }
+  static void setThreadFrame(int64_t frame);
+
+  // Record a span if the tracer is enabled.
+  void recordSpan(const std::string& name, Clock::time_point start,
+                  Clock::time_point end);
+
+  // Remove all recorded spans.
+  void clear();
+  size_t getNumberOfSpans() const;
+
+  // Export all recorded spans in the Chrome trace event format (JSON).
+  std::string toChromeTrace() const;
+  bool writeChromeTrace(const std::string& file_path) const;
+
+ private:
+  const Clock::time_point epoch_ = Clock::now();
+  std::atomic<bool> enabled_{false};
+  std::atomic<int64_t> frame_{kNoFrame};
+  size_t max_spans_ = 0;
+  mutable std::mutex mutex_;
+  std::deque<Span> spans_;
+  std::unordered_map<std::thread::id, int> thread_ids_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_TRACING_H_
@@ -0,0 +1,102 @@
+#ifndef PANOPTIC_MAPPING_COMMON_VISIBLE_BLOCK_TRACKER_H_
+#define PANOPTIC_MAPPING_COMMON_VISIBLE_BLOCK_TRACKER_H_
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/range_image_pyramid.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Finds the visible blocks of a camera incrementally over consecutive
+ * frames. For each submap the frustum margins of all blocks are stored sorted
+ * at a reference pose. Since moving the camera by a small pose delta changes
+ * the margins by a bounded amount, only blocks near the frustum boundary and
+ * blocks that were allocated since the reference need to be re-tested. The
+ * result matches 'Camera::findVisibleBlocks()'.
+ */
+class VisibleBlockTracker {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Maximum bound on the displacement of a block in camera frame in meters
+    // up to which the stored margins are reused. Larger pose deltas to the
+    // reference re-test all blocks of a submap. Use 0 to always test all
+    // blocks.
+    float max_displacement = 0.f;
+
+    // Re-test all blocks of a submap after this many frames, which also bounds
+    // how long blocks allocated outside the integrator remain unnoticed if
+    // blocks were removed at the same time.
+    int max_reuse_frames = 20;
+
+    Config() { setConfigName("VisibleBlockTracker"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit VisibleBlockTracker(const Config& config);
+  virtual ~VisibleBlockTracker() = default;
+
+  /**
+   * @brief Find the visible blocks of all submaps, see
+   * 'Camera::findVisibleBlocks()'. Needs to be called with the same camera
+   * every frame.
+   *
+   * @param camera Camera to find the visible blocks of.
+   * @param submaps Submaps to search.
+   * @param T_M_C Current pose of the camera.
+   * @param only_active_submaps Whether to only search active submaps.
+   * @param range_pyramid Optional range pyramid for depth culling.
+   * @param new_blocks All blocks allocated since the last call per SubmapID.
+   * Blocks can also be included if they existed before.
+   * @return Visible blocks per SubmapID.
+   */
+  std::unordered_map<int, voxblox::BlockIndexList> findVisibleBlocks(
+      const Camera& camera, const SubmapCollection& submaps,
+      const Transformation& T_M_C, bool only_active_submaps = true,
+      const RangeImagePyramid* range_pyramid = nullptr,
+      const std::unordered_map<int, voxblox::IndexSet>* new_blocks = nullptr);
+
+  // Drop all stored margins.
+  void reset() { submaps_.clear(); }
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Stored margins of all blocks of a submap.
+  struct SubmapMargins {
+    Transformation T_C_S;  // Reference pose.
+    // (margin, block) pairs of all blocks at the reference, sorted ascending.
+    std::vector<std::pair<float, BlockIndex>> margins;
+    voxblox::IndexSet reference_blocks;
+    // Blocks allocated after the reference, which are always re-tested.
+    voxblox::IndexSet new_blocks;
+    int num_frames = 0;
+  };
+
+  // Re-test all blocks of a submap and store them at the current pose.
+  void resetMargins(const Camera& camera, const Submap& submap,
+                    const Transformation& T_C_S, SubmapMargins* margins) const;
+
+  // Bound of the displacement in camera frame of the blocks whose visibility
+  // can change between the reference and the current pose.
+  float computeDisplacementBound(const Camera& camera,
+                                 const Transformation& T_C_S_reference,
+                                 const Transformation& T_C_S,
+                                 float block_diag_half) const;
+
+  const Config config_;
+  std::unordered_map<int, SubmapMargins> submaps_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_COMMON_VISIBLE_BLOCK_TRACKER_H_
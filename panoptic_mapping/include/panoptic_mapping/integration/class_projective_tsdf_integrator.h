@@ -47,19 +47,18 @@ class ClassProjectiveIntegrator : public ProjectiveIntegrator {
   void processInput(SubmapCollection* submaps, InputData* input) override;
 
  protected:
-  void updateBlock(Submap* submap, InterpolatorBase* interpolator,
-                   const voxblox::BlockIndex& block_index,
-                   const Transformation& T_C_S,
-                   const InputData& input) const override;
+  void prepareSubmap(
+      Submap* submap,
+      const voxblox::BlockIndexList& block_indices) const override;
 
-  bool updateVoxel(InterpolatorBase* interpolator, TsdfVoxel* voxel,
-                   const Point& p_C, const InputData& input,
-                   const int submap_id, const bool is_free_space_submap,
-                   const float truncation_distance, const float voxel_size,
-                   ClassVoxel* class_voxel = nullptr) const override;
+  bool updatesClassLayer(const Submap& submap) const override {
+    return submap.hasClassLayer() &&
+           (!config_.update_only_tracked_submaps || submap.wasTracked());
+  }
 
-  void updateClassVoxel(InterpolatorBase* interpolator, ClassVoxel* voxel,
-                        const InputData& input, const int submap_id) const;
+  void updateClassVoxel(InterpolatorBase* interpolator, const InputData& input,
+                        const int id, const int submap_id,
+                        ClassVoxel* voxel) const override;
 
  private:
   const Config config_;
@@ -67,9 +66,16 @@ class ClassProjectiveIntegrator : public ProjectiveIntegrator {
       TsdfIntegratorBase, ClassProjectiveIntegrator, std::shared_ptr<Globals>>
       registration_;
 
-  // Cached data.
-  std::unordered_map<int, int> id_to_class_;
-  size_t num_classes_;
+  // Returns the class of a submap ID or kNoClassID if it does not exist. The
+  // unknown ID -1 has the unknown class -1.
+  int getClassOfID(int submap_id) const {
+    return submap_id == -1 ? -1 : label_table_->getClassID(submap_id);
+  }
+
+  // Cached data. The label table of the integrated collection, which is kept
+  // up to date by the collection.
+  static constexpr int kNoClassID = SubmapLabelTable::kNoClassID;
+  const SubmapLabelTable* label_table_ = nullptr;
 };
 
 }  // namespace panoptic_mapping
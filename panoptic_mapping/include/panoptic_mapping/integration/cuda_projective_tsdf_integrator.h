@@ -0,0 +1,94 @@
+#ifndef PANOPTIC_MAPPING_INTEGRATION_CUDA_PROJECTIVE_TSDF_INTEGRATOR_H_
+#define PANOPTIC_MAPPING_INTEGRATION_CUDA_PROJECTIVE_TSDF_INTEGRATOR_H_
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/integration/cuda_tsdf_kernels.h"
+#include "panoptic_mapping/integration/projective_tsdf_integrator.h"
+#include "panoptic_mapping/integration/tsdf_integrator_base.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Projective integrator that runs the voxel updates on a CUDA device.
+ * Block allocation, visibility, and the bookkeeping of updated blocks remain on
+ * the host, only the 'integrateBlocks()' stage is replaced: The visible blocks
+ * are copied to the device in batches, integrated, and copied back. Supports
+ * the nearest and bilinear interpolators. The converged block tracker and
+ * segment culling only apply to the CPU implementation, which is also used if
+ * no device is available. Only built if CUDA is found.
+ */
+class CudaProjectiveIntegrator : public ProjectiveIntegrator {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 4;
+
+    // Maximum number of blocks copied to the device at once.
+    int max_blocks_per_batch = 4096;
+
+    // Integration params.
+    ProjectiveIntegrator::Config pi_config;
+
+    Config() {
+      setConfigName("CudaProjectiveTsdfIntegrator");
+      pi_config.interpolation_method = "bilinear";
+    }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  CudaProjectiveIntegrator(const Config& config,
+                           std::shared_ptr<Globals> globals);
+  ~CudaProjectiveIntegrator() override = default;
+
+ protected:
+  void integrateBlocks(
+      SubmapCollection* submaps, const InputData& input,
+      std::vector<SubmapBlockIndex> work_items,
+      const std::unordered_map<int, Transformation>& T_C_S) override;
+
+  // Views are integrated one after the other, each on the device.
+  bool fusesViewsPerBlock() const override { return false; }
+
+ private:
+  const Config config_;
+  static config_utilities::Factory::RegistrationRos<
+      TsdfIntegratorBase, CudaProjectiveIntegrator, std::shared_ptr<Globals>>
+      registration_;
+
+  // Upload the images of the current view.
+  bool uploadImages(const InputData& input);
+
+  // Integrate the work items [begin, end), which need to have the same block
+  // layout, on the device and write the updated blocks back.
+  bool integrateBatch(SubmapCollection* submaps,
+                      const std::vector<SubmapBlockIndex>& work_items,
+                      size_t begin, size_t end,
+                      const std::unordered_map<int, Transformation>& T_C_S);
+
+  // Reset after a device error, then the CPU implementation is used.
+  std::unique_ptr<cuda::DeviceIntegrator> device_;
+  cuda::IntegrationParams params_;
+
+  // Staging buffers of a batch, reused between batches.
+  std::vector<cuda::BlockParams> block_params_;
+  std::vector<cuda::TsdfVoxel> voxels_;
+  std::vector<uint8_t> updated_;
+  struct BatchBlock {
+    Submap* submap;
+    BlockIndex index;
+    TsdfBlock::Ptr block;
+  };
+  std::vector<BatchBlock> blocks_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_INTEGRATION_CUDA_PROJECTIVE_TSDF_INTEGRATOR_H_
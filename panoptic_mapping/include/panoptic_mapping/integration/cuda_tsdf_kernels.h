@@ -0,0 +1,113 @@
+#ifndef PANOPTIC_MAPPING_INTEGRATION_CUDA_TSDF_KERNELS_H_
+#define PANOPTIC_MAPPING_INTEGRATION_CUDA_TSDF_KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Interface of the CUDA kernels of the projective TSDF integration. This header
+// only uses plain data types such that it can be included by both host and
+// device code, the CUDA runtime is only used in the implementation.
+
+namespace panoptic_mapping {
+namespace cuda {
+
+// Layout of a voxel on the device, identical to voxblox::TsdfVoxel.
+struct TsdfVoxel {
+  float distance;
+  float weight;
+  uint8_t r, g, b, a;
+};
+
+// Pinhole camera of the current view.
+struct CameraParams {
+  float fx, fy, vx, vy;
+  int width, height;
+  float min_range, max_range;
+};
+
+// Integrator params shared by all blocks of a frame.
+struct IntegrationParams {
+  CameraParams camera;
+  bool use_bilinear_interpolation = false;  // Otherwise nearest neighbor.
+  bool use_weight_dropoff = true;
+  float weight_dropoff_epsilon = 0.f;  // In meters, negative for voxel sizes.
+  bool use_constant_weight = false;
+  float max_weight = 1e5f;
+  bool foreign_rays_clear = true;
+  bool all_rays_update = false;
+  bool update_free_space_surface = false;
+};
+
+// Per block params. The rotation and translation map the voxel offsets
+// relative to the block origin into the camera frame.
+struct BlockParams {
+  float rotation[9];  // Row-major.
+  float translation[3];
+  int submap_id;
+  float voxel_size;
+  float truncation_distance;
+  float weight_scale;
+  bool is_free_space_submap;
+  bool store_color;
+};
+
+/**
+ * @brief Device buffers and kernels to integrate a frame into batches of
+ * blocks. The buffers are kept between frames and only grow. Not thread safe.
+ */
+class DeviceIntegrator {
+ public:
+  DeviceIntegrator();
+  ~DeviceIntegrator();
+
+  DeviceIntegrator(const DeviceIntegrator&) = delete;
+  DeviceIntegrator& operator=(const DeviceIntegrator&) = delete;
+
+  /**
+   * @brief Upload the images of the current view.
+   *
+   * @param range_image Column-major range image of height x width.
+   * @param id_image Row-major ID image.
+   * @param id_step Row stride of the ID image in bytes.
+   * @param color_image Row-major BGR color image, can be nullptr if no colors
+   * are fused.
+   * @param color_step Row stride of the color image in bytes.
+   * @return False if the upload failed, see 'getLastError()'.
+   */
+  bool uploadImages(int width, int height, const float* range_image,
+                    const uint8_t* id_image, size_t id_step,
+                    const uint8_t* color_image, size_t color_step);
+
+  /**
+   * @brief Integrate the uploaded view into a batch of blocks.
+   *
+   * @param params Params of the frame.
+   * @param blocks Params of all blocks.
+   * @param num_blocks Number of blocks in the batch.
+   * @param voxels_per_side Voxels per side of all blocks.
+   * @param voxels Voxels of all blocks in linear index order, updated in place.
+   * @param updated Output flag per voxel whether it was updated.
+   * @return False if the integration failed, in which case the content of
+   * 'voxels' is undefined, see 'getLastError()'.
+   */
+  bool integrate(const IntegrationParams& params, const BlockParams* blocks,
+                 size_t num_blocks, int voxels_per_side, TsdfVoxel* voxels,
+                 uint8_t* updated);
+
+  const std::string& getLastError() const { return last_error_; }
+
+ private:
+  struct Buffers;
+  std::unique_ptr<Buffers> buffers_;
+  std::string last_error_;
+};
+
+// Whether a CUDA device is available.
+bool isDeviceAvailable();
+
+}  // namespace cuda
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_INTEGRATION_CUDA_TSDF_KERNELS_H_
@@ -0,0 +1,72 @@
+#ifndef PANOPTIC_MAPPING_INTEGRATION_ISO_SURFACE_EXTRACTOR_H_
+#define PANOPTIC_MAPPING_INTEGRATION_ISO_SURFACE_EXTRACTOR_H_
+
+#include <vector>
+
+#include <voxblox/core/common.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/classification/class_layer.h"
+
+namespace panoptic_mapping {
+
+// TSDF blocks flagged updated with this bit need their iso-surface points to be
+// re-extracted. The ESDF flag is not used otherwise.
+constexpr voxblox::Update::Status kIsoSurfaceUpdateFlag =
+    voxblox::Update::Status::kEsdf;
+
+/**
+ * @brief Extracts iso-surface points directly from the zero crossings of the
+ * TSDF, without requiring a mesh. Every edge between two neighboring observed
+ * voxels whose signed distances have different signs yields one point, placed
+ * by linear interpolation as in marching cubes. The point weight is the
+ * linearly interpolated voxel weight, which equals the trilinear interpolation
+ * of the weights at the point used for mesh based iso-surface points.
+ */
+class IsoSurfaceExtractor {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // If true, submaps compute their iso-surface points from the TSDF and
+    // update them incrementally based on the updated blocks. Otherwise the
+    // vertices of the mesh are used. Note that every zero crossing yields a
+    // single point, whereas mesh vertices are duplicated for every adjacent
+    // triangle, so absolute point thresholds may need to be adapted.
+    bool extract_from_tsdf = false;
+
+    // Minimum TSDF weight of voxels to be considered observed.
+    float min_weight = 1e-6;
+
+    Config() { setConfigName("IsoSurfaceExtractor"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit IsoSurfaceExtractor(const Config& config);
+  virtual ~IsoSurfaceExtractor() = default;
+
+  /**
+   * @brief Extract the points on the edges from every voxel of a block to its
+   * neighbors in positive x, y and z direction, such that every edge belongs
+   * to exactly one block. The points thus also depend on the blocks at index
+   * + (1, 0, 0), + (0, 1, 0) and + (0, 0, 1).
+   *
+   * @param tsdf_layer The TSDF layer to extract points from.
+   * @param class_layer If not null, only edges between voxels belonging to the
+   * submap are considered.
+   * @param block_index Index of the block to extract.
+   * @param points Vector to append the extracted points to, in submap frame.
+   */
+  void extractBlock(const TsdfLayer& tsdf_layer, const ClassLayer* class_layer,
+                    const BlockIndex& block_index,
+                    std::vector<IsoSurfacePoint>* points) const;
+
+ private:
+  const Config config_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_INTEGRATION_ISO_SURFACE_EXTRACTOR_H_
@@ -26,6 +26,7 @@
 #define PANOPTIC_MAPPING_INTEGRATION_MESH_INTEGRATOR_H_
 
 #include <algorithm>
+#include <cstdint>
 #include <list>
 #include <memory>
 #include <thread>
@@ -40,7 +41,9 @@
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/thread_pool.h"
 #include "panoptic_mapping/map/classification/class_layer.h"
+#include "panoptic_mapping/map/flat_block_map.h"
 
 namespace panoptic_mapping {
 
@@ -70,6 +73,18 @@ class MeshIntegrator {
     // truncation distance.
     bool clear_foreign_voxels = false;
 
+    // If true, the cubes inside a block are processed in a batch: the SDF
+    // validity, signs and class belonging of all voxels are gathered once per
+    // block and only surface-crossing cubes are passed to marching cubes. The
+    // resulting meshes are identical.
+    bool use_batched_meshing = true;
+
+    // If true, 'generateMesh()' indexes the TSDF blocks in a flat hash map
+    // before meshing, which speeds up the neighbor block lookups on block
+    // borders at the cost of one pass over all blocks. Pays off if a large part
+    // of the layer is meshed.
+    bool use_flat_block_map = false;
+
     Config() { setConfigName("MeshIntegrator"); }
 
    protected:
@@ -81,14 +96,71 @@ class MeshIntegrator {
                  std::shared_ptr<TsdfLayer> tsdf_layer,
                  std::shared_ptr<MeshLayer> mesh_layer,
                  std::shared_ptr<ClassLayer> class_layer,
-                 float truncation_distance = 0.f);
+                 float truncation_distance = 0.f,
+                 ThreadPool* thread_pool = ThreadPool::getGlobalInstance());
 
   // Generates the mesh from the tsdf layer.
   void generateMesh(bool only_mesh_updated_blocks = true,
                     bool clear_updated_flag = true,
                     bool use_class_data = false);
 
+  /**
+   * @brief Split version of 'generateMesh()' such that the blocks of many
+   * layers can be meshed jointly. Allocates the meshes of all blocks to be
+   * updated and assigns them a new generation.
+   *
+   * @return Indices of the blocks to mesh with 'generateMeshBlock()'.
+   */
+  voxblox::BlockIndexList prepareMeshGeneration(
+      bool only_mesh_updated_blocks = true, bool use_class_data = false);
+
+  // Same as above but only for those of the given blocks that are flagged
+  // updated(kMesh).
+  voxblox::BlockIndexList prepareMeshGeneration(
+      const voxblox::BlockIndexList& block_indices,
+      bool use_class_data = false);
+
+  /**
+   * @brief Mesh a single block returned by 'prepareMeshGeneration()'.
+   * Different blocks can be meshed concurrently.
+   *
+   * @return True if the block was meshed.
+   */
+  bool generateMeshBlock(const BlockIndex& block_index,
+                         bool clear_updated_flag = true);
+
+  /**
+   * @brief Every call to 'generateMesh()' assigns a new globally unique
+   * generation to all blocks it re-meshes, such that users of the mesh can
+   * detect changes.
+   *
+   * @param block_index Index of the mesh block.
+   * @return Generation of the block mesh, 0 if it was never generated.
+   */
+  uint64_t getMeshGeneration(const BlockIndex& block_index) const;
+
+  /**
+   * @brief Assign a new generation to block meshes that were set externally,
+   * e.g. loaded from a file, such that users of the mesh detect them.
+   */
+  void setMeshesGenerated(const voxblox::BlockIndexList& block_indices) {
+    allocateMeshes(block_indices);
+  }
+
+  // Take over the generations of a copy of the mesh of 'other'.
+  void copyMeshGenerationsFrom(const MeshIntegrator& other) {
+    mesh_generations_ = other.mesh_generations_;
+  }
+
+  // The thread pool to run 'generateMesh()' on.
+  void setThreadPool(ThreadPool* thread_pool) {
+    thread_pool_ = CHECK_NOTNULL(thread_pool);
+  }
+
  protected:
+  // Allocate the meshes of the blocks and assign them a new generation.
+  void allocateMeshes(const voxblox::BlockIndexList& block_indices);
+
   void generateMeshBlocksFunction(
       const voxblox::BlockIndexList& all_tsdf_blocks, bool clear_updated_flag,
       voxblox::ThreadSafeIndex* index_getter);
@@ -99,6 +171,18 @@ class MeshIntegrator {
                         const ClassBlock::ConstPtr& class_block,
                         voxblox::Mesh* mesh);
 
+  void extractMeshInsideBlockBatched(const TsdfBlock& tsdf_block,
+                                     const ClassBlock::ConstPtr& class_block,
+                                     voxblox::VertexIndex* next_mesh_index,
+                                     voxblox::Mesh* mesh);
+
+  // Batched meshing for a block layout, see 'dispatchBlockLayout()'.
+  template <typename LayoutT>
+  void extractMeshInsideBlockBatchedImpl(
+      const LayoutT& layout, const TsdfBlock& tsdf_block,
+      const ClassBlock::ConstPtr& class_block,
+      voxblox::VertexIndex* next_mesh_index, voxblox::Mesh* mesh);
+
   void extractMeshInsideBlock(const TsdfBlock& tsdf_block,
                               const ClassBlock::ConstPtr& class_block,
                               const voxblox::VoxelIndex& index,
@@ -117,12 +201,16 @@ class MeshIntegrator {
                        const ClassBlock::ConstPtr& class_block,
                        voxblox::Mesh* mesh);
 
+  // Returns nullptr if the block is not allocated.
+  const TsdfBlock* getTsdfBlockPtr(const BlockIndex& block_index) const;
+
  protected:
   const MeshIntegrator::Config config_;
 
   std::shared_ptr<TsdfLayer> tsdf_layer_;
   std::shared_ptr<MeshLayer> mesh_layer_;
   std::shared_ptr<ClassLayer> class_layer_;
+  ThreadPool* thread_pool_;
 
   // Cached map config.
   FloatingPoint voxel_size_;
@@ -133,6 +221,12 @@ class MeshIntegrator {
 
   // Cached index map.
   Eigen::Matrix<int, 3, 8> cube_index_offsets_;
+
+  // Generation at which each block was last meshed.
+  voxblox::AnyIndexHashMapType<uint64_t>::type mesh_generations_;
+
+  // Only set during 'generateMesh()' if requested.
+  std::unique_ptr<FlatBlockMap<TsdfVoxel>> flat_blocks_;
 };
 
 }  // namespace panoptic_mapping
@@ -1,16 +1,30 @@
 #ifndef PANOPTIC_MAPPING_INTEGRATION_PROJECTION_INTERPOLATORS_H_
 #define PANOPTIC_MAPPING_INTEGRATION_PROJECTION_INTERPOLATORS_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <string>
+#include <unordered_map>
 
 #include <opencv2/core/mat.hpp>
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/planar_input_images.h"
 
 namespace panoptic_mapping {
 
+/**
+ * @brief Per-pixel flags whether the 2x2 neighborhood starting at (v, u) is
+ * free of depth discontinuities, i.e. whether bilinear interpolation is valid.
+ * Entries are 1 if valid and 0 otherwise.
+ */
+using InterpolationMask =
+    Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic>;
+
 /**
  * @brief Interface for different ways to interpolate the necessary values.
  * Use computeWeights() first to setup the interpolator, then use the
@@ -18,6 +32,8 @@ namespace panoptic_mapping {
  */
 class InterpolatorBase {
  public:
+  virtual ~InterpolatorBase() = default;
+
   /**
    * @brief Sets up the interpolator for a specific lookup and stores all
    * relevant information in the internal state. This method assumes that u and
@@ -54,7 +70,7 @@ class InterpolatorBase {
    */
   virtual int interpolateID(const cv::Mat& id_image) = 0;
 
-    /**
+  /**
    * @brief Compute the uncertainty based on the internally cached weights.
    *
    * @param uncertainty_image Uncertainty Image image to interpolate in.
@@ -68,15 +84,21 @@ class InterpolatorBase {
  computeWeights() first to setup the interpolator, then use the other functions
  to access the relevant data.
  */
-class InterpolatorNearest : public InterpolatorBase {
+class InterpolatorNearest final : public InterpolatorBase {
  public:
   void computeWeights(float u, float v,
                       const Eigen::MatrixXf& range_image) override;
   float interpolateRange(const Eigen::MatrixXf& range_image) override;
   Color interpolateColor(const cv::Mat& color_image) override;
-  float interpolateUncertainty(const cv::Mat& uncertainty_image)  override;
+  float interpolateUncertainty(const cv::Mat& uncertainty_image) override;
   int interpolateID(const cv::Mat& id_image) override;
 
+  // Lookups in the planar images of the same view, see PlanarInputImages.
+  float interpolateRange(const PlanarInputImages& images) const;
+  Color interpolateColor(const PlanarInputImages& images) const;
+  int interpolateID(const PlanarInputImages& images) const;
+  float interpolateUncertainty(const PlanarInputImages& images) const;
+
  protected:
   int u_;
   int v_;
@@ -92,15 +114,21 @@ class InterpolatorNearest : public InterpolatorBase {
  first to setup the interpolator, then use the other functions to access the
  relevant data.
  */
-class InterpolatorBilinear : public InterpolatorBase {
+class InterpolatorBilinear final : public InterpolatorBase {
  public:
   void computeWeights(float u, float v,
                       const Eigen::MatrixXf& range_image) override;
   float interpolateRange(const Eigen::MatrixXf& range_image) override;
-  float interpolateUncertainty(const cv::Mat& uncertainty_image)  override;
+  float interpolateUncertainty(const cv::Mat& uncertainty_image) override;
   Color interpolateColor(const cv::Mat& color_image) override;
   int interpolateID(const cv::Mat& id_image) override;
 
+  // Lookups in the planar images of the same view, see PlanarInputImages.
+  float interpolateRange(const PlanarInputImages& images) const;
+  Color interpolateColor(const PlanarInputImages& images) const;
+  int interpolateID(const PlanarInputImages& images) const;
+  float interpolateUncertainty(const PlanarInputImages& images) const;
+
  protected:
   int u_;
   int v_;
@@ -119,22 +147,58 @@ class InterpolatorBilinear : public InterpolatorBase {
  first to setup the interpolator, then use the other functions to access the
  relevant data.
  */
-class InterpolatorAdaptive : public InterpolatorBilinear {
+class InterpolatorAdaptive final : public InterpolatorBase {
  public:
+  // Default maximum range difference within the 2x2 neighborhood of a lookup
+  // to interpolate bilinearly.
+  static constexpr float kDefaultMaxDepthDifference = 0.2f;  // m
+
   void computeWeights(float u, float v,
                       const Eigen::MatrixXf& range_image) override;
+
+  /**
+   * @brief Same as computeWeights() but looks up whether to interpolate
+   * bilinearly in a mask precomputed once per range image, see
+   * computeMaskRow().
+   */
+  void computeWeights(float u, float v, const Eigen::MatrixXf& range_image,
+                      const InterpolationMask& mask);
+
+  /**
+   * @brief Compute row v of the interpolation mask for a range image, see
+   * InterpolationMask. The last row and column are never valid for bilinear
+   * interpolation.
+   *
+   * @param range_image Range image as stored in the input data.
+   * @param v Row to compute.
+   * @param max_depth_difference Maximum range difference in the neighborhood.
+   * @param mask Mask of the same size as the range image to write to.
+   */
+  static void computeMaskRow(const cv::Mat& range_image, int v,
+                             float max_depth_difference,
+                             InterpolationMask* mask);
+
+  void setMaxDepthDifference(float max_depth_difference) {
+    max_depth_difference_ = max_depth_difference;
+  }
   float interpolateRange(const Eigen::MatrixXf& range_image) override;
   Color interpolateColor(const cv::Mat& color_image) override;
   int interpolateID(const cv::Mat& id_image) override;
-  float interpolateUncertainty(const cv::Mat& uncertainty_image)  override;
+  float interpolateUncertainty(const cv::Mat& uncertainty_image) override;
+
+  // Lookups in the planar images of the same view, see PlanarInputImages.
+  float interpolateRange(const PlanarInputImages& images) const;
+  Color interpolateColor(const PlanarInputImages& images) const;
+  int interpolateID(const PlanarInputImages& images) const;
+  float interpolateUncertainty(const PlanarInputImages& images) const;
 
  protected:
-  int u_;
-  int v_;
-  int u_offset_[4] = {0, 0, 1, 1};
-  int v_offset_[4] = {0, 1, 0, 1};
-  float weight_[4];
+  InterpolatorBilinear bilinear_;
+  InterpolatorNearest nearest_;
+  static constexpr int u_offset_[4] = {0, 0, 1, 1};
+  static constexpr int v_offset_[4] = {0, 1, 0, 1};
   bool use_bilinear_;
+  float max_depth_difference_ = kDefaultMaxDepthDifference;
 
  private:
   static config_utilities::Factory::Registration<InterpolatorBase,
@@ -142,6 +206,294 @@ class InterpolatorAdaptive : public InterpolatorBilinear {
       registration_;
 };
 
+// The interpolators are defined inline such that they can be fully inlined
+// when used via their concrete (final) type, e.g. in templated integration.
+inline void InterpolatorNearest::computeWeights(
+    float u, float v, const Eigen::MatrixXf& range_image) {
+  u_ = std::round(u);
+  v_ = std::round(v);
+}
+
+inline float InterpolatorNearest::interpolateUncertainty(
+    const cv::Mat& uncertainty_image) {
+  return uncertainty_image.at<float>(v_, u_);
+}
+
+inline float InterpolatorNearest::interpolateRange(
+    const Eigen::MatrixXf& range_image) {
+  return range_image(v_, u_);
+}
+
+inline Color InterpolatorNearest::interpolateColor(const cv::Mat& color_image) {
+  auto color_bgr = color_image.at<cv::Vec3b>(v_, u_);
+  return Color(color_bgr[2], color_bgr[1], color_bgr[0]);
+}
+
+inline int InterpolatorNearest::interpolateID(const cv::Mat& id_image) {
+  return id_image.at<int>(v_, u_);
+}
+
+inline float InterpolatorNearest::interpolateRange(
+    const PlanarInputImages& images) const {
+  return images.range()[images.index(u_, v_)];
+}
+
+inline Color InterpolatorNearest::interpolateColor(
+    const PlanarInputImages& images) const {
+  return PlanarInputImages::unpackColor(images.color()[images.index(u_, v_)]);
+}
+
+inline int InterpolatorNearest::interpolateID(
+    const PlanarInputImages& images) const {
+  return images.ids()[images.index(u_, v_)];
+}
+
+inline float InterpolatorNearest::interpolateUncertainty(
+    const PlanarInputImages& images) const {
+  return images.uncertainty()[images.index(u_, v_)];
+}
+
+inline void InterpolatorBilinear::computeWeights(
+    float u, float v, const Eigen::MatrixXf& range_image) {
+  u_ = std::floor(u);
+  v_ = std::floor(v);
+  float du = u - static_cast<float>(u_);
+  float dv = v - static_cast<float>(v_);
+  weight_[0] = (1.f - du) * (1.f - dv);
+  weight_[1] = (1.f - du) * dv;
+  weight_[2] = du * (1.f - dv);
+  weight_[3] = du * dv;
+}
+
+inline float InterpolatorBilinear::interpolateRange(
+    const Eigen::MatrixXf& range_image) {
+  return range_image(v_, u_) * weight_[0] +
+         range_image(v_ + 1, u_) * weight_[1] +
+         range_image(v_, u_ + 1) * weight_[2] +
+         range_image(v_ + 1, u_ + 1) * weight_[3];
+}
+
+inline float InterpolatorBilinear::interpolateUncertainty(
+    const cv::Mat& uncertainty_image) {
+  return uncertainty_image.at<float>(v_, u_) * weight_[0] +
+         uncertainty_image.at<float>(v_ + 1, u_) * weight_[1] +
+         uncertainty_image.at<float>(v_, u_ + 1) * weight_[2] +
+         uncertainty_image.at<float>(v_ + 1, u_ + 1) * weight_[3];
+}
+
+inline Color InterpolatorBilinear::interpolateColor(
+    const cv::Mat& color_image) {
+  Eigen::Vector3f color(0, 0, 0);
+  auto c1 = color_image.at<cv::Vec3b>(v_, u_);
+  auto c2 = color_image.at<cv::Vec3b>(v_ + 1, u_);
+  auto c3 = color_image.at<cv::Vec3b>(v_, u_ + 1);
+  auto c4 = color_image.at<cv::Vec3b>(v_ + 1, u_ + 1);
+  for (size_t i = 0; i < 3; ++i) {
+    color[i] = c1[i] * weight_[0] + c2[i] * weight_[1] + c3[i] * weight_[2] +
+               c4[i] * weight_[3];
+  }
+  return Color(color[2], color[1], color[0]);  // bgr image
+}
+
+inline int InterpolatorBilinear::interpolateID(const cv::Mat& id_image) {
+  // Since IDs can not be interpolated we assign weight to all IDs in the image
+  // based on the corner weights and return  the highest weight ID.
+  std::unordered_map<int, float> ids;  // These are zero initialized by default.
+  ids[id_image.at<int>(v_, u_)] += weight_[0];
+  ids[id_image.at<int>(v_ + 1, u_)] += weight_[1];
+  ids[id_image.at<int>(v_, u_ + 1)] += weight_[2];
+  ids[id_image.at<int>(v_ + 1, u_ + 1)] += weight_[3];
+  return std::max_element(std::begin(ids), std::end(ids),
+                          [](const auto& p1, const auto& p2) {
+                            return p1.second < p2.second;
+                          })
+      ->first;
+}
+
+inline float InterpolatorBilinear::interpolateRange(
+    const PlanarInputImages& images) const {
+  const size_t index = images.index(u_, v_);
+  const size_t stride = images.stride();
+  const float* range = images.range();
+  return range[index] * weight_[0] + range[index + stride] * weight_[1] +
+         range[index + 1] * weight_[2] + range[index + stride + 1] * weight_[3];
+}
+
+inline float InterpolatorBilinear::interpolateUncertainty(
+    const PlanarInputImages& images) const {
+  const size_t index = images.index(u_, v_);
+  const size_t stride = images.stride();
+  const float* uncertainty = images.uncertainty();
+  return uncertainty[index] * weight_[0] +
+         uncertainty[index + stride] * weight_[1] +
+         uncertainty[index + 1] * weight_[2] +
+         uncertainty[index + stride + 1] * weight_[3];
+}
+
+inline Color InterpolatorBilinear::interpolateColor(
+    const PlanarInputImages& images) const {
+  const size_t index = images.index(u_, v_);
+  const size_t stride = images.stride();
+  const uint32_t* color = images.color();
+  const uint32_t corners[4] = {color[index], color[index + stride],
+                               color[index + 1], color[index + stride + 1]};
+  float rgb[3] = {0.f, 0.f, 0.f};
+  for (int i = 0; i < 4; ++i) {
+    for (int channel = 0; channel < 3; ++channel) {
+      rgb[channel] += ((corners[i] >> (8 * channel)) & 0xFF) * weight_[i];
+    }
+  }
+  return Color(rgb[0], rgb[1], rgb[2]);
+}
+
+inline int InterpolatorBilinear::interpolateID(
+    const PlanarInputImages& images) const {
+  // Same as above, the weights of equal IDs among the corners are summed.
+  const size_t index = images.index(u_, v_);
+  const size_t stride = images.stride();
+  const int* ids = images.ids();
+  const int corners[4] = {ids[index], ids[index + stride], ids[index + 1],
+                          ids[index + stride + 1]};
+  int best_id = corners[0];
+  float best_weight = -1.f;
+  for (int i = 0; i < 4; ++i) {
+    float weight = 0.f;
+    for (int j = 0; j < 4; ++j) {
+      if (corners[j] == corners[i]) {
+        weight += weight_[j];
+      }
+    }
+    if (weight > best_weight) {
+      best_weight = weight;
+      best_id = corners[i];
+    }
+  }
+  return best_id;
+}
+
+inline void InterpolatorAdaptive::computeWeights(
+    float u, float v, const Eigen::MatrixXf& range_image) {
+  const int u_floor = std::floor(u);
+  const int v_floor = std::floor(v);
+
+  // Check max depth difference.
+  float min = std::numeric_limits<float>::max();
+  float max = std::numeric_limits<float>::lowest();
+  for (size_t i = 0; i < 4; ++i) {
+    const float depth =
+        range_image(v_floor + v_offset_[i], u_floor + u_offset_[i]);
+    if (depth > max) {
+      max = depth;
+    }
+    if (depth < min) {
+      min = depth;
+    }
+    if (max - min > max_depth_difference_) {
+      use_bilinear_ = false;
+      nearest_.computeWeights(u, v, range_image);
+      return;
+    }
+  }
+  use_bilinear_ = true;
+  bilinear_.computeWeights(u, v, range_image);
+}
+
+inline void InterpolatorAdaptive::computeWeights(
+    float u, float v, const Eigen::MatrixXf& range_image,
+    const InterpolationMask& mask) {
+  use_bilinear_ = mask(static_cast<int>(std::floor(v)),
+                       static_cast<int>(std::floor(u)));
+  if (use_bilinear_) {
+    bilinear_.computeWeights(u, v, range_image);
+  } else {
+    nearest_.computeWeights(u, v, range_image);
+  }
+}
+
+inline void InterpolatorAdaptive::computeMaskRow(const cv::Mat& range_image,
+                                                 int v,
+                                                 float max_depth_difference,
+                                                 InterpolationMask* mask) {
+  const int cols = range_image.cols;
+  if (v + 1 >= range_image.rows) {
+    mask->row(v).setZero();
+    return;
+  }
+  const float* row = range_image.ptr<float>(v);
+  const float* next_row = range_image.ptr<float>(v + 1);
+  for (int u = 0; u + 1 < cols; ++u) {
+    const float min = std::min(std::min(row[u], row[u + 1]),
+                               std::min(next_row[u], next_row[u + 1]));
+    const float max = std::max(std::max(row[u], row[u + 1]),
+                               std::max(next_row[u], next_row[u + 1]));
+    (*mask)(v, u) = max - min <= max_depth_difference;
+  }
+  (*mask)(v, cols - 1) = 0;
+}
+
+inline float InterpolatorAdaptive::interpolateRange(
+    const Eigen::MatrixXf& range_image) {
+  if (use_bilinear_) {
+    return bilinear_.interpolateRange(range_image);
+  }
+  return nearest_.interpolateRange(range_image);
+}
+
+inline Color InterpolatorAdaptive::interpolateColor(
+    const cv::Mat& color_image) {
+  if (use_bilinear_) {
+    return bilinear_.interpolateColor(color_image);
+  }
+  return nearest_.interpolateColor(color_image);
+}
+
+inline float InterpolatorAdaptive::interpolateUncertainty(
+    const cv::Mat& uncertainty_image) {
+  if (use_bilinear_) {
+    return bilinear_.interpolateUncertainty(uncertainty_image);
+  }
+  return nearest_.interpolateUncertainty(uncertainty_image);
+}
+
+inline int InterpolatorAdaptive::interpolateID(const cv::Mat& id_image) {
+  if (use_bilinear_) {
+    return bilinear_.interpolateID(id_image);
+  }
+  return nearest_.interpolateID(id_image);
+}
+
+inline float InterpolatorAdaptive::interpolateRange(
+    const PlanarInputImages& images) const {
+  if (use_bilinear_) {
+    return bilinear_.interpolateRange(images);
+  }
+  return nearest_.interpolateRange(images);
+}
+
+inline Color InterpolatorAdaptive::interpolateColor(
+    const PlanarInputImages& images) const {
+  if (use_bilinear_) {
+    return bilinear_.interpolateColor(images);
+  }
+  return nearest_.interpolateColor(images);
+}
+
+inline int InterpolatorAdaptive::interpolateID(
+    const PlanarInputImages& images) const {
+  if (use_bilinear_) {
+    return bilinear_.interpolateID(images);
+  }
+  return nearest_.interpolateID(images);
+}
+
+inline float InterpolatorAdaptive::interpolateUncertainty(
+    const PlanarInputImages& images) const {
+  if (use_bilinear_) {
+    return bilinear_.interpolateUncertainty(images);
+  }
+  return nearest_.interpolateUncertainty(images);
+}
+
 }  // namespace panoptic_mapping
 
 #endif  // PANOPTIC_MAPPING_INTEGRATION_PROJECTION_INTERPOLATORS_H_
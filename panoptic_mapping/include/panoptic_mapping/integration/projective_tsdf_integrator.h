@@ -4,11 +4,17 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/camera.h"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/converged_block_tracker.h"
+#include "panoptic_mapping/common/id_tile_masks.h"
+#include "panoptic_mapping/common/index_getter.h"
+#include "panoptic_mapping/common/planar_input_images.h"
+#include "panoptic_mapping/common/visible_block_tracker.h"
 #include "panoptic_mapping/integration/projection_interpolators.h"
 #include "panoptic_mapping/integration/tsdf_integrator_base.h"
 
@@ -44,6 +50,12 @@ class ProjectiveIntegrator : public TsdfIntegratorBase {
     // Supported are {nearest, bilinear, adaptive}.
     std::string interpolation_method = "adaptive";
 
+    // Maximum range difference in meters between the four pixels around a
+    // projected voxel for adaptive interpolation to interpolate bilinearly.
+    // Otherwise the nearest pixel is used.
+    float interpolation_max_depth_difference =
+        InterpolatorAdaptive::kDefaultMaxDepthDifference;
+
     // If true, rays that don't belong to the submap ID are treated as clearing
     // rays.
     bool foreign_rays_clear = true;
@@ -53,13 +65,60 @@ class ProjectiveIntegrator : public TsdfIntegratorBase {
     // block.
     bool allocate_neighboring_blocks = false;
 
+    // If true, free space blocks are only allocated along camera rays up to
+    // the observed depth plus the truncation distance. Otherwise all blocks in
+    // the view frustum up to the maximum range are allocated.
+    bool use_depth_bounded_freespace_allocation = false;
+
+    // If true, skip blocks that lie entirely behind the observed surface by
+    // more than the truncation distance before iterating their voxels.
+    bool use_depth_culling = true;
+
     // If true, overwrite voxels that have a distance update larger than 0.05 m.
     bool use_longterm_fusion = false;
 
     // Number of threads used to perform integration. Integration is
-    // submap-parallel.
+    // block-parallel over all visible submaps.
     int integration_threads = std::thread::hardware_concurrency();
 
+    // Number of blocks claimed at once by an integration thread.
+    int integration_chunk_size = 4;
+
+    // Integrate submaps of each label only every N-th frame. The frames of
+    // different submaps are staggered by their ID. To keep the weights
+    // consistent, the measurement weights of the integrated frames are scaled
+    // by N in all voxel updates.
+    int instance_integration_period = 1;
+    int background_integration_period = 1;
+    int unknown_integration_period = 1;
+    int free_space_integration_period = 1;
+
+    // If larger than 1, buffer this many frames and integrate them
+    // block-major, applying all buffered frames to a block at once. This
+    // delays the integration of a frame until the buffer is full but pulls
+    // every visible block into cache only once per buffer.
+    int num_buffered_frames = 1;
+
+    // If true, the range image and the inputs of every view are copied into a
+    // planar, aligned, and padded layout once per frame, which the voxel
+    // updates of the built-in interpolators read from. See PlanarInputImages.
+    bool use_planar_images = false;
+
+    // If true, blocks of non free space submaps whose projection does not
+    // cover any pixel of the submap's ID are detected using IDTileMasks. If
+    // foreign rays don't clear, these blocks are skipped. Otherwise they are
+    // only cleared, which skips the ID, color, and weight branches of the full
+    // voxel update, and skipped if they are entirely behind the surface.
+    bool use_segment_culling = false;
+
+    // Reuse the visible blocks of the previous frames for small pose deltas.
+    // Only applies to inputs with a single view.
+    VisibleBlockTracker::Config visible_block_tracker;
+
+    // Skip blocks whose voxels converged until the measurements disagree with
+    // them. Only applies to the built-in interpolators.
+    ConvergedBlockTracker::Config converged_block_tracker;
+
     Config() { setConfigName("ProjectiveTsdfIntegrator"); }
 
    protected:
@@ -73,7 +132,58 @@ class ProjectiveIntegrator : public TsdfIntegratorBase {
 
   void processInput(SubmapCollection* submaps, InputData* input) override;
 
+  // Integrate all frames that are still buffered.
+  void finishIntegration(SubmapCollection* submaps) override;
+
  protected:
+  // Voxel centers of a block in camera frame, computed for all voxels at once.
+  // The buffers are only resized if the block layout changes, such that a
+  // projection that is reused for blocks of one layout does not allocate.
+  struct BlockProjection {
+    Eigen::Matrix3Xf p_C;
+    // False for voxels that are certainly behind the camera, out of range, or
+    // outside the image. All others still need to be checked individually.
+    Eigen::Array<bool, 1, Eigen::Dynamic> is_visible;
+
+    // Scratch data. Voxel centers relative to the block origin for the layout
+    // of the last projected block.
+    Eigen::Matrix3Xf offsets;
+    size_t voxels_per_side = 0;
+    float voxel_size = 0.f;
+    Eigen::Array<float, 1, Eigen::Dynamic> distance;
+    Eigen::Array<float, 1, Eigen::Dynamic> u;
+    Eigen::Array<float, 1, Eigen::Dynamic> v;
+
+    // Measurements of the view for the batched update, see
+    // 'interpolateBlock()' and 'fuseBlock()'. Only valid for visible voxels.
+    Eigen::Array<float, 1, Eigen::Dynamic> sdf;
+    Eigen::Array<float, 1, Eigen::Dynamic> weight;
+    Eigen::Array<float, 1, Eigen::Dynamic> measured_distance;
+    Eigen::Array<float, 1, Eigen::Dynamic> residual;
+    Eigen::Array<bool, 1, Eigen::Dynamic> is_updated;
+    Eigen::Array<bool, 1, Eigen::Dynamic> is_surface;
+    // Indices and ranges of the 2x2 pixel neighborhood, and the colors of
+    // surface voxels.
+    Eigen::Array<int, 4, Eigen::Dynamic> pixels;
+    Eigen::Array<float, 4, Eigen::Dynamic> ranges;
+    std::vector<Color> colors;
+  };
+
+  /**
+   * @brief Transform all voxel centers of a block into the camera frame and
+   * cull the ones that can not be updated. This is written as dense Eigen
+   * operations such that it is vectorized by the compiler.
+   *
+   * @param block The block whose voxels to project.
+   * @param T_C_S Transform from submap to camera frame.
+   * @param projection Output projection, reuse it for consecutive blocks.
+   */
+  void projectBlock(const TsdfBlock& block, const Transformation& T_C_S,
+                    BlockProjection* projection) const;
+  void projectBlock(const TsdfBlock& block, const Transformation& T_C_S,
+                    const Camera::Config& camera,
+                    BlockProjection* projection) const;
+
   /**
    * @brief Allocate all new blocks in all submaps.
    *
@@ -83,10 +193,76 @@ class ProjectiveIntegrator : public TsdfIntegratorBase {
   virtual void allocateNewBlocks(SubmapCollection* submaps,
                                  const InputData& input);
 
-  virtual void updateSubmap(Submap* submap, InterpolatorBase* interpolator,
-                            const voxblox::BlockIndexList& block_indices,
-                            const InputData& input) const;
+  /**
+   * @brief Allocate all blocks of the free space submap that can be updated by
+   * the current input. Requires the range image to be computed.
+   *
+   * @param space The free space submap.
+   * @param input Input measurements based on which blocks are allocated.
+   * @param block_indices Output indices of all allocated blocks, including
+   * blocks that existed before.
+   */
+  void allocateFreeSpaceBlocks(Submap* space, const InputData& input,
+                               voxblox::IndexSet* block_indices) const;
+
+  /**
+   * @brief Allocate the free space blocks by marching rays through the image.
+   * Rays are subsampled such that neighboring samples are at most half a block
+   * apart and terminate at the maximum observed depth of their image tile.
+   */
+  void allocateFreeSpaceBlocksAlongRays(
+      Submap* space, const InputData& input,
+      voxblox::IndexSet* block_indices) const;
 
+  /**
+   * @brief Prepare a submap for the parallel update of its visible blocks, such
+   * that 'updateBlock()' only looks blocks up and never modifies the layers.
+   * Called once per integrated submap and frame, in parallel over the submaps.
+   *
+   * @param submap The submap to prepare.
+   * @param block_indices The blocks of the submap that will be updated.
+   */
+  virtual void prepareSubmap(
+      Submap* submap, const voxblox::BlockIndexList& block_indices) const;
+
+  /**
+   * @brief Integrate the input into all given blocks. This is the compute
+   * intensive core of the integrator and the extension point for alternative
+   * compute backends, the default runs 'updateBlock()' on the thread pool.
+   *
+   * @param submaps Submap collection containing all blocks.
+   * @param input Input data used for the update.
+   * @param work_items All (submap ID, block index) pairs to update.
+   * @param T_C_S Transform from submap to camera frame for each submap ID.
+   */
+  virtual void integrateBlocks(
+      SubmapCollection* submaps, const InputData& input,
+      std::vector<SubmapBlockIndex> work_items,
+      const std::unordered_map<int, Transformation>& T_C_S);
+
+  /**
+   * @brief Whether blocks seen by several views of a multi-camera input are
+   * updated by all views at once. Otherwise the views are integrated one
+   * after the other. Derived classes that override 'updateBlock()' need to
+   * return false.
+   */
+  virtual bool fusesViewsPerBlock() const {
+    return interpolator_type_ != InterpolatorType::kOther;
+  }
+
+  // Number of threads used for the current frame, which the quality controller
+  // can reduce below the configured 'integration_threads'.
+  int numIntegrationThreads() const;
+
+  /**
+   * @brief Update all voxels of a block. For the built-in interpolators this
+   * dispatches once per block to a path that is specialized on the concrete
+   * interpolator type and does not call the virtual 'updateVoxel()' and
+   * 'computeSignedDistance()' and 'computeWeight()'. Derived classes that
+   * override these therefore also need to override 'updateBlock()'. Derived
+   * classes that maintain a class layer instead set the voxel update rules and
+   * implement 'updatesClassLayer()' and 'updateClassVoxel()'.
+   */
   virtual void updateBlock(Submap* submap, InterpolatorBase* interpolator,
                            const voxblox::BlockIndex& block_index,
                            const Transformation& T_C_S,
@@ -102,18 +278,44 @@ class ProjectiveIntegrator : public TsdfIntegratorBase {
    * @param input Input data used for the update.
    * @param submap_id SubmapID of the owning submap.
    * @param is_free_space_submap Whether the voxel belongs to a freespace map.
+   * @param store_color Whether the submap stores the color of its voxels.
    * @param truncation_distance Truncation distance to be used.
    * @param voxel_size Voxel size of the TSDF layer.
    * @param class_voxel Optional: class voxel to be updated.
+   * @param weight_scale Factor applied to the measurement weight, which
+   * accounts for the integration period of the submap.
 
    * @return True if the voxel was updated.
    */
   virtual bool updateVoxel(InterpolatorBase* interpolator, TsdfVoxel* voxel,
                            const Point& p_C, const InputData& input,
                            const int submap_id, const bool is_free_space_submap,
+                           const bool store_color,
                            const float truncation_distance,
                            const float voxel_size,
-                           ClassVoxel* class_voxel = nullptr) const;
+                           ClassVoxel* class_voxel = nullptr,
+                           const float weight_scale = 1.f) const;
+
+  /**
+   * @brief Whether the block updates also update the class layer of a submap
+   * via 'updateClassVoxel()'. The class blocks need to be allocated when
+   * preparing the submap.
+   */
+  virtual bool updatesClassLayer(const Submap& submap) const { return false; }
+
+  /**
+   * @brief Update a class voxel near the surface with a measurement.
+   *
+   * @param interpolator Interpolator that is set up for the voxel.
+   * @param input Input data of the view used for the update.
+   * @param id The interpolated ID of the measurement.
+   * @param submap_id SubmapID of the owning submap.
+   * @param class_voxel Class voxel to be updated.
+   */
+  virtual void updateClassVoxel(InterpolatorBase* interpolator,
+                                const InputData& input, const int id,
+                                const int submap_id,
+                                ClassVoxel* class_voxel) const {}
 
   /**
    * @brief Sets up the interpolator and computes the signed distance.
@@ -154,18 +356,272 @@ class ProjectiveIntegrator : public TsdfIntegratorBase {
                                  const float weight,
                                  const Color* color = nullptr) const;
 
-  // Cached data.
+  /**
+   * @brief Compute row v of the interpolation mask of the current view from
+   * the range image of the input if adaptive interpolation is used. This is
+   * done once per frame while building the range image such that the voxel
+   * updates only need a lookup.
+   */
+  void computeInterpolationMaskRow(const InputData& input, int v);
+
+  // Build the planar images of the current view if they are used.
+  void buildPlanarImages(const InputData& input);
+
+  // Rules of the built-in voxel update, which derived integrators can adapt.
+  struct VoxelUpdateRules {
+    // If true, every ray updates the TSDF with its measured distance and the
+    // class layer estimates which voxels belong to the submap. Otherwise only
+    // rays of the submap ID and rays into free space submaps do, and foreign
+    // rays clear if 'foreign_rays_clear' is set. Segment culling does not
+    // apply if all rays update.
+    bool all_rays_update = false;
+
+    // If true, the color and class voxels of free space submaps are also
+    // updated near the surface.
+    bool update_free_space_surface = false;
+
+    // If false, colors are not updated, e.g. if no color image is required.
+    bool update_color = true;
+  };
+  VoxelUpdateRules voxel_update_rules_;
+
+  // Integration period of the label of a submap, see the config. The
+  // measurement weights of the submap are scaled by this factor.
+  int getIntegrationPeriod(const Submap& submap) const;
+
+  // Cached data of the view that is currently processed.
   Eigen::MatrixXf range_image_;
+  InterpolationMask interpolation_mask_;
+  RangeImagePyramid range_pyramid_;
+  PlanarInputImages planar_images_;
+  IDTileMasks id_masks_;
   float max_range_in_image_ = 0.f;
   const Camera::Config* cam_config_;
+  const Camera* camera_ = nullptr;
   std::vector<std::unique_ptr<InterpolatorBase>>
       interpolators_;  // one for each thread.
 
+  // Blocks touched by the last call to 'allocateNewBlocks()' per SubmapID.
+  std::unordered_map<int, voxblox::IndexSet> allocated_blocks_;
+  std::unique_ptr<VisibleBlockTracker> visible_block_tracker_;
+  std::unique_ptr<ConvergedBlockTracker> converged_block_tracker_;
+
+  // Number of integrated frames, used to schedule the integration periods.
+  int frame_index_ = 0;
+
  private:
   const Config config_;
   static config_utilities::Factory::RegistrationRos<
       TsdfIntegratorBase, ProjectiveIntegrator, std::shared_ptr<Globals>>
       registration_;
+
+  // Interpolator types with a specialized update path.
+  enum class InterpolatorType { kNearest, kBilinear, kAdaptive, kOther };
+  InterpolatorType interpolator_type_;
+
+  // Views of a multi-camera input are identified by a bit in a mask.
+  static constexpr size_t kMaxViews = 32;
+
+  // Cached data of every view of a multi-camera input.
+  struct ViewData {
+    const InputData* input = nullptr;
+    const Camera* camera = nullptr;
+    Eigen::MatrixXf range_image;
+    InterpolationMask interpolation_mask;
+    RangeImagePyramid range_pyramid;
+    PlanarInputImages planar_images;
+    IDTileMasks id_masks;
+    float max_range_in_image = 0.f;
+  };
+  std::vector<ViewData> views_;
+
+  // Frames buffered for block-major integration. The images are shared with
+  // the original inputs and not copied.
+  std::vector<std::shared_ptr<InputData>> frame_buffer_;
+
+  // A view as used to update a block.
+  struct ViewUpdate {
+    const InputData* input;
+    const Camera* camera;
+    const Eigen::MatrixXf* range_image;
+    // Only set if adaptive interpolation is used.
+    const InterpolationMask* interpolation_mask;
+    Transformation T_C_S;
+    // Only set if planar images are used.
+    const PlanarInputImages* planar_images = nullptr;
+    // Only set if segment culling is used.
+    const IDTileMasks* id_masks = nullptr;
+    // Only set if depth culling is used.
+    const RangeImagePyramid* range_pyramid = nullptr;
+  };
+
+  // The interpolation mask to use for a view, if any.
+  const InterpolationMask* getInterpolationMask(
+      const InterpolationMask& mask) const {
+    return interpolator_type_ == InterpolatorType::kAdaptive ? &mask : nullptr;
+  }
+
+  // The planar images to use for a view, if any.
+  const PlanarInputImages* getPlanarImages(
+      const PlanarInputImages& images) const {
+    return config_.use_planar_images ? &images : nullptr;
+  }
+
+  // The ID masks to use for a view, if any.
+  const IDTileMasks* getIDMasks(const IDTileMasks& masks) const {
+    return config_.use_segment_culling ? &masks : nullptr;
+  }
+
+  // The range pyramid to use for a view, if any.
+  const RangeImagePyramid* getRangePyramid(
+      const RangeImagePyramid& pyramid) const {
+    return config_.use_depth_culling ? &pyramid : nullptr;
+  }
+
+  // Build the ID masks of the current view if they are used.
+  void buildIDMasks(const InputData& input);
+
+  // Whether a submap is integrated in the current frame.
+  bool integratesSubmap(const Submap& submap) const {
+    return (frame_index_ + submap.getID()) % getIntegrationPeriod(submap) == 0;
+  }
+
+  // Check whether any pixel of the submap ID lies near the projection of the
+  // block in a view that uses ID masks.
+  bool blockMayContainID(const TsdfBlock& block, const ViewUpdate& view,
+                         int submap_id) const;
+
+  // Check whether a block lies entirely behind the observed surface of a view
+  // that uses a range pyramid.
+  bool blockIsBehindSurface(const TsdfBlock& block,
+                            const ViewUpdate& view) const;
+
+  // Specialized update of voxels that can only be cleared by foreign rays,
+  // i.e. set to the truncation distance if they are in front of the surface.
+  template <typename InterpolatorT>
+  bool clearVoxelImpl(InterpolatorT* interpolator, TsdfVoxel* voxel,
+                      const Point& p_C, const ViewUpdate& view,
+                      const float truncation_distance, const float voxel_size,
+                      const float weight_scale = 1.f,
+                      float* residual = nullptr) const;
+
+  // Add an input and all its additional views to the views to integrate.
+  void addViews(const InputData& input);
+
+  /**
+   * @brief Integrate all added views, which can be the additional views of
+   * other cameras or buffered frames. Blocks are allocated and found for all
+   * views at once, and each block is updated by all views that see it.
+   */
+  void processViews(SubmapCollection* submaps);
+
+  // Prepare all integrated submaps of the visible blocks in parallel.
+  void prepareSubmaps(
+      SubmapCollection* submaps,
+      const std::unordered_map<int, voxblox::BlockIndexList>& block_lists);
+
+  // Integrate and clear the frame buffer.
+  void integrateBufferedFrames(SubmapCollection* submaps);
+
+  // Swap the cached data of a view with the data of the current view.
+  void swapCurrentView(ViewData* view);
+
+  // Update the blocks of all work items with the views set in their mask.
+  void integrateViewBlocks(
+      SubmapCollection* submaps, std::vector<SubmapBlockIndex> work_items,
+      const std::vector<uint32_t>& view_masks,
+      const std::vector<std::unordered_map<int, Transformation>>& T_C_S);
+
+  // Group the work items by the home node of their submap. Returns the
+  // positions of the items per NUMA node of the thread pool.
+  NodeLocalIndexGetter<size_t> groupByHomeNode(
+      const std::vector<SubmapBlockIndex>& work_items,
+      const SubmapCollection& submaps) const;
+
+  // Dispatch the update of a block by several views to the implementation for
+  // the interpolator type.
+  void updateBlockFromViews(Submap* submap, InterpolatorBase* interpolator,
+                            const voxblox::BlockIndex& block_index,
+                            const ViewUpdate* views, size_t num_views) const;
+
+  // Implementations of the update for a specific interpolator type. Using the
+  // final interpolator classes allows the compiler to inline the interpolation
+  // into the voxel loop. InterpolatorBase uses the virtual interface.
+  template <typename InterpolatorT>
+  void updateBlockImpl(Submap* submap, InterpolatorT* interpolator,
+                       const voxblox::BlockIndex& block_index,
+                       const ViewUpdate* views, size_t num_views) const;
+
+  /**
+   * @brief Exactly check the visibility of all projected voxels and look up
+   * their signed distances and weights in the view at once. Only implemented
+   * for the nearest and bilinear interpolators, whose range lookups are
+   * written as a gather over precomputed pixel indices.
+   *
+   * @param view View the block was projected into.
+   * @param voxel_size Voxel size of the block.
+   * @param truncation_distance Truncation distance of the submap.
+   * @param weight_scale Factor applied to all weights.
+   * @param projection Projection of the block, the sdf and weight are set.
+   */
+  template <typename InterpolatorT>
+  void interpolateBlock(const ViewUpdate& view, float voxel_size,
+                        float truncation_distance, float weight_scale,
+                        BlockProjection* projection) const;
+
+  /**
+   * @brief Fuse the measured distances and weights of a projection into all
+   * voxels of a block at once, equivalent to 'updateVoxelValues()' without
+   * color. Voxels with zero weight are not changed. Also computes the
+   * residuals of the fused voxels.
+   */
+  void fuseBlock(TsdfBlock* block, BlockProjection* projection) const;
+
+  template <typename InterpolatorT>
+  bool updateVoxelImpl(InterpolatorT* interpolator, TsdfVoxel* voxel,
+                       const Point& p_C, const ViewUpdate& view,
+                       const int submap_id, const bool is_free_space_submap,
+                       const bool store_color, const float truncation_distance,
+                       const float voxel_size,
+                       ClassVoxel* class_voxel = nullptr,
+                       const float weight_scale = 1.f,
+                       float* residual = nullptr) const;
+
+  /**
+   * @brief Test a sample of the observed voxels of a frozen block against the
+   * measurements of all views.
+   *
+   * @return False if any tested voxel would be updated to a distance that
+   * differs by more than the converged residual, or if the block has no
+   * observed voxels.
+   */
+  template <typename InterpolatorT>
+  bool frozenBlockIsConsistent(const Submap& submap,
+                               InterpolatorT* interpolator,
+                               const voxblox::BlockIndex& block_index,
+                               const TsdfBlock& block, const ViewUpdate* views,
+                               size_t num_views) const;
+
+  // Interpolate the inputs of a view, using its planar images if set.
+  template <typename InterpolatorT>
+  float interpolateRangeImpl(InterpolatorT* interpolator,
+                             const ViewUpdate& view) const;
+  template <typename InterpolatorT>
+  int interpolateIDImpl(InterpolatorT* interpolator,
+                        const ViewUpdate& view) const;
+  template <typename InterpolatorT>
+  Color interpolateColorImpl(InterpolatorT* interpolator,
+                             const ViewUpdate& view) const;
+
+  template <typename InterpolatorT>
+  bool computeSignedDistanceImpl(const Point& p_C, const ViewUpdate& view,
+                                 InterpolatorT* interpolator,
+                                 float* sdf) const;
+
+  float computeWeightImpl(const Camera::Config& camera, const Point& p_C,
+                          const float voxel_size,
+                          const float truncation_distance,
+                          const float sdf) const;
 };
 
 }  // namespace panoptic_mapping
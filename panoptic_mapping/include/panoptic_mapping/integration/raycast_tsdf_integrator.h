@@ -0,0 +1,129 @@
+#ifndef PANOPTIC_MAPPING_INTEGRATION_RAYCAST_TSDF_INTEGRATOR_H_
+#define PANOPTIC_MAPPING_INTEGRATION_RAYCAST_TSDF_INTEGRATOR_H_
+
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/integration/tsdf_integrator_base.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Integrator that casts rays from the measured points instead of
+ * projecting all voxels of the visible blocks into the image. Points are
+ * grouped by submap and the voxel they fall into, and a single merged ray is
+ * cast per group, similar to voxblox' merged integrator. Each ray only updates
+ * the submap of its segmentation ID and the free space submap, so the cost
+ * follows the number of points rather than the number of visible blocks. This
+ * is intended for sparse or long-range inputs, e.g. projected LiDAR.
+ */
+class RaycastIntegrator : public TsdfIntegratorBase {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 4;
+
+    // If true, drop off the weight behind the surface crossing.
+    bool use_weight_dropoff = true;
+
+    // Distance in meters where the weight dropp off reaches zero. Negative
+    // values  are multiples of the voxel size.
+    float weight_dropoff_epsilon = -1.f;
+
+    // If true, use unitary (w=1) weights per point to update the TSDF.
+    // Otherwise use weights as a function of the squared depth to approximate
+    // typical RGBD sensor confidence.
+    bool use_constant_weight = false;
+
+    // Maximum weight used for TSDF updates.
+    float max_weight = 1e5;
+
+    // If true, rays update the free space submap from the camera up to the
+    // truncation band. Otherwise only the truncation band around the points
+    // is updated in all submaps.
+    bool voxel_carving = true;
+
+    // Number of threads used to perform integration.
+    int integration_threads = std::thread::hardware_concurrency();
+
+    // Number of image rows, merged rays, or blocks claimed at once by an
+    // integration thread.
+    int integration_chunk_size = 16;
+
+    Config() { setConfigName("RaycastTsdfIntegrator"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  RaycastIntegrator(const Config& config, std::shared_ptr<Globals> globals);
+  ~RaycastIntegrator() override = default;
+
+  void processInput(SubmapCollection* submaps, InputData* input) override;
+
+ protected:
+  // All points of a submap that fall into the same voxel.
+  struct MergedPoint {
+    Point p_C_sum = Point::Zero();
+    Eigen::Vector3f color_sum = Eigen::Vector3f::Zero();
+    int num_points = 0;
+  };
+  typedef voxblox::LongIndexHashMapType<MergedPoint>::type MergedPoints;
+
+  // A single voxel update computed by a ray.
+  struct VoxelUpdate {
+    size_t linear_index;
+    float sdf;
+    float weight;
+    Color color;
+    bool has_color;
+  };
+  typedef voxblox::AnyIndexHashMapType<std::vector<VoxelUpdate>>::type
+      BlockUpdates;
+
+  /**
+   * @brief Group all valid points of the input by submap and voxel.
+   *
+   * @param submaps Submap collection to integrate into.
+   * @param input Input measurements.
+   * @return Merged points per SubmapID.
+   */
+  std::unordered_map<int, MergedPoints> mergePoints(
+      const SubmapCollection& submaps, const InputData& input) const;
+
+  /**
+   * @brief Cast a merged ray into a submap and compute the voxel updates.
+   *
+   * @param submap The submap to update.
+   * @param T_S_C Transform from camera to submap frame.
+   * @param point The merged point the ray ends at.
+   * @param is_free_space_submap Whether the submap is the free space submap.
+   * @param updates Output updates per block index.
+   */
+  void castRay(const Submap& submap, const Transformation& T_S_C,
+               const MergedPoint& point, bool is_free_space_submap,
+               BlockUpdates* updates) const;
+
+  // Weight of a single point at depth z for a signed distance.
+  float computeWeight(float z, float voxel_size, float truncation_distance,
+                      float sdf) const;
+
+  // Weighted averaging fusion of a voxel, identical to the projective
+  // integrator.
+  void updateVoxelValues(TsdfVoxel* voxel, const VoxelUpdate& update) const;
+
+ private:
+  const Config config_;
+  static config_utilities::Factory::RegistrationRos<
+      TsdfIntegratorBase, RaycastIntegrator, std::shared_ptr<Globals>>
+      registration_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_INTEGRATION_RAYCAST_TSDF_INTEGRATOR_H_
@@ -56,16 +56,13 @@ class SingleTsdfIntegrator : public ProjectiveIntegrator {
   // Override methods specific to the single TSDF update.
   void allocateNewBlocks(Submap* map, InputData* input);
 
-  void updateBlock(Submap* submap, InterpolatorBase* interpolator,
-                   const voxblox::BlockIndex& block_index,
-                   const Transformation& T_C_S,
-                   const InputData& input) const override;
+  bool updatesClassLayer(const Submap& submap) const override {
+    return submap.hasClassLayer() && config_.use_segmentation;
+  }
 
-  bool updateVoxel(InterpolatorBase* interpolator, TsdfVoxel* voxel,
-                   const Point& p_C, const InputData& input,
-                   const int submap_id, const bool is_free_space_submap,
-                   const float truncation_distance, const float voxel_size,
-                   ClassVoxel* class_voxel = nullptr) const override;
+  void updateClassVoxel(InterpolatorBase* interpolator, const InputData& input,
+                        const int id, const int submap_id,
+                        ClassVoxel* class_voxel) const override;
 
  private:
   const Config config_;
@@ -73,11 +70,8 @@ class SingleTsdfIntegrator : public ProjectiveIntegrator {
       TsdfIntegratorBase, SingleTsdfIntegrator, std::shared_ptr<Globals>>
       registration_;
 
-  void updateClassVoxel(InterpolatorBase* interpolator, const InputData& input,
-                        ClassVoxel* class_voxel) const;
-
   void updateUncertaintyVoxel(InterpolatorBase* interpolator,
-                              const InputData& input,
+                              const InputData& input, const int id,
                               UncertaintyVoxel* class_voxel) const;
 };
 
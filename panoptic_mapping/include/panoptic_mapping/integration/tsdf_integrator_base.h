@@ -25,6 +25,9 @@ class TsdfIntegratorBase : public InputDataUser {
 
   virtual void processInput(SubmapCollection* submaps, InputData* input) = 0;
 
+  // Integrate all inputs that were buffered but not yet integrated.
+  virtual void finishIntegration(SubmapCollection* submaps) {}
+
  protected:
   std::shared_ptr<Globals> globals_;
 };
@@ -4,6 +4,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/labels/label_entry.h"
@@ -48,9 +49,30 @@ class LabelHandlerBase {
   size_t numberOfLabels() const;
 
  protected:
+  /**
+   * @brief Freeze the labels into a flat lookup table indexed by segmentation
+   * ID, which all accessors use afterwards. Derived handlers should call this
+   * once all labels are set up, the labels must not change afterwards.
+   */
+  void buildLookupTable();
+
   // List of the labels associated with each segmentation ID. Labels are stored
   // by pointer such that derived label types can also be stored here.
   std::unordered_map<int, std::unique_ptr<LabelEntry>> labels_;
+
+ private:
+  // Returns nullptr if the segmentation ID does not exist.
+  const LabelEntry* findLabel(int segmentation_id) const;
+  // Assumes that the segmentation ID exists.
+  const LabelEntry& lookupLabel(int segmentation_id) const;
+
+  // Maximum range of segmentation IDs for which a lookup table is allocated.
+  static constexpr int kMaxLookupTableSize = 1 << 20;
+
+  // Flat lookup table, segmentation_id - min_id -> label, nullptr if absent.
+  bool use_lookup_table_ = false;
+  int min_id_ = 0;
+  std::vector<const LabelEntry*> lookup_table_;
 };
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,118 @@
+#ifndef PANOPTIC_MAPPING_MAP_BACKGROUND_MESHER_H_
+#define PANOPTIC_MAPPING_MAP_BACKGROUND_MESHER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+#include <voxblox/mesh/mesh_layer.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/integration/mesh_integrator.h"
+#include "panoptic_mapping/map/classification/class_layer.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Meshes the active submaps on a dedicated thread while the next frame
+ * is integrated. The dirty blocks are double buffered: 'capture()' takes a
+ * copy-on-write snapshot of every active submap with blocks flagged
+ * updated(kMesh) and clears the flags, such that blocks integrated afterwards
+ * form the next dirty set. The snapshots are meshed in the background and
+ * 'synchronize()' writes the resulting meshes back into the submaps. Each
+ * captured block remembers the mesh generation it had when captured, block
+ * meshes that were regenerated in the meantime are not overwritten.
+ *
+ * Both functions need to be called by the thread that owns the submap
+ * collection, the background thread only reads the snapshots.
+ */
+class BackgroundMesher {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Whether to use the class layer of submaps when meshing, if available.
+    bool use_class_layer = true;
+
+    Config() { setConfigName("BackgroundMesher"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit BackgroundMesher(const Config& config, bool print_config = true);
+  virtual ~BackgroundMesher();
+
+  /**
+   * @brief Snapshot the dirty blocks of all active submaps and start meshing
+   * them in the background. Waits for a previous capture that was not yet
+   * synchronized.
+   *
+   * @return Number of captured blocks.
+   */
+  size_t capture(SubmapCollection* submaps);
+
+  /**
+   * @brief Wait until the last capture is meshed and write its meshes into
+   * the submaps. Results of submaps or blocks that no longer exist are
+   * dropped. Call this before the meshes of active submaps are used, e.g.
+   * before submaps are finished.
+   *
+   * @return Number of updated block meshes.
+   */
+  size_t synchronize(SubmapCollection* submaps);
+
+  // Wait for the background thread and drop all results and snapshots, e.g.
+  // when the submap collection is replaced.
+  void reset();
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Layers of a submap as of one capture. Snapshot blocks are never modified,
+  // such that consecutive snapshots share all blocks that did not change.
+  struct Snapshot {
+    std::shared_ptr<TsdfLayer> tsdf;
+    std::shared_ptr<ClassLayer> classification;
+  };
+
+  struct Capture {
+    int submap_id;
+    Snapshot snapshot;
+    MeshIntegrator::Config mesh_config;
+    float truncation_distance;
+    voxblox::BlockIndexList blocks;
+    std::vector<uint64_t> generations;  // Of the blocks when captured.
+    std::shared_ptr<MeshLayer> meshes;  // Set by the background thread.
+  };
+
+  void meshingLoop();
+  void meshCapture(Capture* capture) const;
+
+  const Config config_;
+
+  // Last snapshot of each active submap.
+  std::unordered_map<int, Snapshot> snapshots_;
+
+  // Hand-over between the capturing and the background thread.
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<Capture> captures_;
+  bool has_work_ = false;
+  bool is_meshing_ = false;
+  bool shutdown_ = false;
+  uint64_t sequence_ = 0;
+  std::thread thread_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_BACKGROUND_MESHER_H_
@@ -0,0 +1,194 @@
+#ifndef PANOPTIC_MAPPING_MAP_BLOCK_POOL_H_
+#define PANOPTIC_MAPPING_MAP_BLOCK_POOL_H_
+
+#include <iterator>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+#include <voxblox/core/layer.h>
+
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/numa_topology.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Keeps removed voxblox blocks for reuse instead of freeing them. Since
+ * the block origin is fixed at construction, blocks are recycled for the same
+ * block index in any layer of identical layout, which covers the common case
+ * of blocks in the view frustum being pruned and re-allocated. Recycled blocks
+ * are reset to default voxels. The oldest blocks are freed if the pool exceeds
+ * its capacity. Default uses a global singleton per voxel type such that all
+ * submaps share the pool. On machines with multiple NUMA nodes, blocks are
+ * only recycled on the node they were released on, such that the memory of
+ * recycled blocks stays local to the workers of that node.
+ *
+ * @tparam VoxelT Voxel type of the blocks.
+ */
+template <typename VoxelT>
+class BlockPool {
+ public:
+  using BlockType = voxblox::Block<VoxelT>;
+  using BlockPtr = typename BlockType::Ptr;
+
+  static constexpr size_t kDefaultMaxBlocks = 1024;
+
+  explicit BlockPool(size_t max_blocks = kDefaultMaxBlocks)
+      : max_blocks_(max_blocks) {}
+  virtual ~BlockPool() = default;
+
+  BlockPool(const BlockPool&) = delete;
+  BlockPool& operator=(const BlockPool&) = delete;
+
+  // Access to the global block pool via singleton.
+  static BlockPool* getGlobalInstance() {
+    static BlockPool instance;
+    return &instance;
+  }
+
+  /**
+   * @brief Get the block at the given index, allocating it if necessary.
+   * Equivalent to 'Layer::allocateBlockPtrByIndex()' but reuses pooled blocks.
+   */
+  BlockPtr allocateBlockPtrByIndex(const BlockIndex& index,
+                                   voxblox::Layer<VoxelT>* layer) {
+    CHECK_NOTNULL(layer);
+    BlockPtr block = layer->getBlockPtrByIndex(index);
+    if (block) {
+      return block;
+    }
+    block = acquire(index, *layer);
+    if (!block) {
+      return layer->allocateNewBlock(index);
+    }
+    layer->insertBlock(std::make_pair(index, block));
+    return block;
+  }
+
+  BlockPtr allocateBlockPtrByCoordinates(const Point& coords,
+                                         voxblox::Layer<VoxelT>* layer) {
+    CHECK_NOTNULL(layer);
+    return allocateBlockPtrByIndex(
+        layer->computeBlockIndexFromCoordinates(coords), layer);
+  }
+
+  /**
+   * @brief Remove a block from the layer and keep it for reuse. Blocks that
+   * are still referenced elsewhere, e.g. by snapshots, are not recycled.
+   */
+  void removeBlock(const BlockIndex& index, voxblox::Layer<VoxelT>* layer) {
+    CHECK_NOTNULL(layer);
+    BlockPtr block = layer->getBlockPtrByIndex(index);
+    layer->removeBlock(index);
+    if (block && block.use_count() == 1) {
+      release(index, std::move(block));
+    }
+  }
+
+  // Pool management.
+  void setMaxBlocks(size_t max_blocks) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_blocks_ = max_blocks;
+    trim();
+  }
+  size_t getMaxBlocks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_blocks_;
+  }
+  size_t getNumberOfBlocks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_.size();
+  }
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocks_.clear();
+    layouts_.clear();
+  }
+
+ private:
+  // Blocks are only exchangeable between layers with identical layout, and
+  // are kept per NUMA node.
+  using Layout = std::tuple<size_t, FloatingPoint, int>;
+  struct Entry {
+    Layout layout;
+    BlockIndex index;
+    BlockPtr block;
+  };
+  using EntryList = std::list<Entry>;
+  using IndexMap = typename voxblox::AnyIndexHashMapType<
+      std::vector<typename EntryList::iterator>>::type;
+
+  BlockPtr acquire(const BlockIndex& index,
+                   const voxblox::Layer<VoxelT>& layer) {
+    BlockPtr block;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto layout_it =
+          layouts_.find(Layout(layer.voxels_per_side(), layer.voxel_size(),
+                               NumaTopology::get().getCurrentNode()));
+      if (layout_it == layouts_.end()) {
+        return nullptr;
+      }
+      auto index_it = layout_it->second.find(index);
+      if (index_it == layout_it->second.end()) {
+        return nullptr;
+      }
+      auto entry_it = index_it->second.back();
+      block = std::move(entry_it->block);
+      blocks_.erase(entry_it);
+      index_it->second.pop_back();
+      if (index_it->second.empty()) {
+        layout_it->second.erase(index_it);
+      }
+    }
+
+    // Reset the block to the state of a newly allocated one.
+    for (size_t i = 0; i < block->num_voxels(); ++i) {
+      block->getVoxelByLinearIndex(i) = VoxelT();
+    }
+    block->has_data() = false;
+    block->updated().reset();
+    return block;
+  }
+
+  void release(const BlockIndex& index, BlockPtr block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_blocks_ == 0u) {
+      return;
+    }
+    const Layout layout(block->voxels_per_side(), block->voxel_size(),
+                        NumaTopology::get().getCurrentNode());
+    blocks_.push_back(Entry{layout, index, std::move(block)});
+    layouts_[layout][index].push_back(std::prev(blocks_.end()));
+    trim();
+  }
+
+  // Free the oldest blocks until the pool fits its capacity.
+  void trim() {
+    while (blocks_.size() > max_blocks_) {
+      const Entry& oldest = blocks_.front();
+      IndexMap& index_map = layouts_[oldest.layout];
+      auto index_it = index_map.find(oldest.index);
+      // Entries are added in order, so the oldest is first for its index.
+      index_it->second.erase(index_it->second.begin());
+      if (index_it->second.empty()) {
+        index_map.erase(index_it);
+      }
+      blocks_.pop_front();
+    }
+  }
+
+  mutable std::mutex mutex_;
+  size_t max_blocks_;
+  EntryList blocks_;  // Oldest first.
+  std::map<Layout, IndexMap> layouts_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_BLOCK_POOL_H_
@@ -0,0 +1,115 @@
+#ifndef PANOPTIC_MAPPING_MAP_CHANGE_FEED_H_
+#define PANOPTIC_MAPPING_MAP_CHANGE_FEED_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief All changes of a submap collection between two published change
+ * sets. A block that is created is also reported as updated if data was
+ * integrated into it. Blocks of removed submaps are not listed. Removed
+ * submaps should be processed before created ones, since a loaded map can
+ * reuse the IDs of the replaced one.
+ */
+struct MapChangeSet {
+  struct BlockChanges {
+    voxblox::IndexSet created;
+    voxblox::IndexSet updated;
+    voxblox::IndexSet removed;
+  };
+
+  // Consecutive number of the change set, starting at 0.
+  uint64_t sequence_number = 0;
+
+  // Block changes by SubmapID.
+  std::unordered_map<int, BlockChanges> blocks;
+
+  // SubmapIDs of the changed submaps.
+  std::unordered_set<int> created_submaps;
+  std::unordered_set<int> removed_submaps;
+  std::unordered_set<int> finished_submaps;
+  std::unordered_set<int> moved_submaps;
+  // Submaps whose change state was updated by change detection.
+  std::unordered_set<int> change_state_submaps;
+
+  bool empty() const;
+
+  /**
+   * @brief Combine this change set with the change set emitted after it, such
+   * that the result is identical to recording both as one change set. Can be
+   * used by consumers that process the changes less often than every frame.
+   */
+  void merge(const MapChangeSet& later);
+};
+
+/**
+ * @brief Collects the changes reported by the integrators, the map manager and
+ * the submap collection and emits them once per frame to all subscribers,
+ * such that consumers like meshing, planning or map streaming do not need to
+ * scan the map for changes. Changes are only recorded while there are
+ * subscribers. Blocks that are only compressed, collapsed or evicted are not
+ * reported as removed since their data is kept. Recording is thread-safe.
+ */
+class ChangeFeed {
+ public:
+  using Callback = std::function<void(const MapChangeSet&)>;
+
+  enum class BlockChange { kCreated, kUpdated, kRemoved };
+  enum class SubmapChange {
+    kCreated,
+    kRemoved,
+    kFinished,
+    kMoved,
+    kChangeState
+  };
+
+  ChangeFeed() = default;
+  virtual ~ChangeFeed() = default;
+
+  /**
+   * @brief Register a callback that receives every published change set. The
+   * callbacks are invoked on the publishing thread, while the mapper holds
+   * the map, so they should be short and must not modify the map.
+   *
+   * @return ID of the subscription to unsubscribe.
+   */
+  int subscribe(Callback callback);
+  void unsubscribe(int subscription_id);
+  bool hasSubscribers() const { return has_subscribers_; }
+
+  // Recording.
+  void recordBlock(int submap_id, const BlockIndex& index, BlockChange change);
+  void recordSubmap(int submap_id, SubmapChange change);
+
+  /**
+   * @brief Emit all changes recorded since the last call to all subscribers
+   * and start a new change set. Empty change sets are not emitted.
+   */
+  void publish();
+
+ private:
+  // Pending changes.
+  std::mutex mutex_;
+  MapChangeSet pending_;
+  std::atomic<bool> has_subscribers_{false};
+
+  // Subscribers.
+  std::mutex subscribers_mutex_;
+  std::map<int, Callback> subscribers_;
+  int next_subscription_id_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_CHANGE_FEED_H_
@@ -26,9 +26,12 @@ struct BinaryCountVoxel : public ClassVoxel {
   float getProbability(const int id) const override;
   void incrementCount(const int id, const float weight = 1.f) override;
   bool mergeVoxel(const ClassVoxel& other) override;
-  std::vector<uint32_t> serializeVoxelToInt() const override;
-  bool deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
-                               size_t* data_index) override;
+  // Typed version of 'mergeVoxel()' without the type check.
+  bool mergeVoxel(const BinaryCountVoxel& other);
+  size_t getSerializedSize() const override;
+  size_t serializeVoxelToBuffer(uint32_t* data) const override;
+  bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                  size_t* data_index) override;
 
   // Data.
   ClassificationCount belongs_count = 0u;
@@ -50,6 +53,7 @@ class BinaryCountLayer : public ClassLayerImpl<BinaryCountVoxel> {
 
   ClassVoxelType getVoxelType() const override;
   std::unique_ptr<ClassLayer> clone() const override;
+  std::unique_ptr<ClassLayer> cloneEmpty() const override;
   static std::unique_ptr<ClassLayer> loadFromStream(
       const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
       uint64_t* /* tmp_byte_offset_ptr */);
@@ -4,10 +4,12 @@
 #include <memory>
 #include <utility>
 
+#include <glog/logging.h>
 #include <voxblox/core/block.h>
 
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/map/classification/class_voxel.h"
+#include "panoptic_mapping/map/voxel_mask.h"
 
 namespace panoptic_mapping {
 
@@ -22,6 +24,8 @@ class ClassBlock {
    public:
     explicit Ptr(ClassBlock* ptr = nullptr)
         : std::shared_ptr<ClassBlock>(ptr) {}
+    explicit Ptr(std::shared_ptr<ClassBlock> ptr)
+        : std::shared_ptr<ClassBlock>(std::move(ptr)) {}
     operator bool() const {
       if (!std::shared_ptr<ClassBlock>::operator bool()) {
         return false;
@@ -33,6 +37,8 @@ class ClassBlock {
    public:
     explicit ConstPtr(const ClassBlock* ptr = nullptr)
         : std::shared_ptr<const ClassBlock>(ptr) {}
+    explicit ConstPtr(std::shared_ptr<const ClassBlock> ptr)
+        : std::shared_ptr<const ClassBlock>(std::move(ptr)) {}
     operator bool() const {
       if (!std::shared_ptr<const ClassBlock>::operator bool()) {
         return false;
@@ -57,6 +63,21 @@ class ClassBlock {
   virtual ClassVoxel& getVoxelByVoxelIndex(const VoxelIndex& index) = 0;
   virtual ClassVoxelType getVoxelType() const = 0;
 
+  /**
+   * @brief Merge the voxels of another block of the same type and layout into
+   * this block, or overwrite them with the voxels of the other block. The type
+   * is checked once for the block, such that the voxels are processed without
+   * the virtual voxel interface.
+   *
+   * @param other Block to read the voxels from.
+   * @param merge_voxels Voxels to merge as in 'ClassVoxel::mergeVoxel()'.
+   * @param copy_voxels Voxels to overwrite with the voxels of other.
+   * @return False if the blocks are not of the same type.
+   */
+  virtual bool mergeBlock(const ClassBlock& other,
+                          const VoxelMask& merge_voxels,
+                          const VoxelMask& copy_voxels) = 0;
+
   // Additional checks for validity.
   operator bool() const { return isValid(); }
 
@@ -108,6 +129,25 @@ class ClassBlockImpl : public ClassBlock {
     return reinterpret_cast<const ClassVoxel&>(block_->getVoxelByLinearIndex(0))
         .getVoxelType();
   }
+  bool mergeBlock(const ClassBlock& other, const VoxelMask& merge_voxels,
+                  const VoxelMask& copy_voxels) override {
+    const auto* other_impl =
+        dynamic_cast<const ClassBlockImpl<VoxelT>*>(&other);
+    if (!other_impl) {
+      LOG(WARNING) << "Can not merge class blocks that are not of same type.";
+      return false;
+    }
+    const voxblox::Block<VoxelT>& other_block = *other_impl->block_;
+    // Calls the typed 'mergeVoxel()' of VoxelT where available.
+    merge_voxels.forEach([&](size_t i) {
+      block_->getVoxelByLinearIndex(i).mergeVoxel(
+          other_block.getVoxelByLinearIndex(i));
+    });
+    copy_voxels.forEach([&](size_t i) {
+      block_->getVoxelByLinearIndex(i) = other_block.getVoxelByLinearIndex(i);
+    });
+    return true;
+  }
 
   // Exposes the actual block if the type is known.
   voxblox::Block<VoxelT>& getBlock() { return *block_; }
@@ -50,6 +50,18 @@ class ClassLayer {
   virtual FloatingPoint voxel_size() const = 0;
   virtual FloatingPoint block_size() const = 0;
   virtual std::unique_ptr<ClassLayer> clone() const = 0;
+  // Create an empty layer of the same type, configuration and layout.
+  virtual std::unique_ptr<ClassLayer> cloneEmpty() const = 0;
+  /**
+   * @brief Create a copy-on-write snapshot of the layer. See 'snapshotLayer()'
+   * in layer_snapshot.h for details.
+   *
+   * @param previous Previous snapshot of this layer, can be nullptr.
+   * @param changed_blocks Blocks that changed since the previous snapshot.
+   */
+  virtual std::unique_ptr<ClassLayer> snapshot(
+      const ClassLayer* previous,
+      const voxblox::IndexSet& changed_blocks) const = 0;
 
   // Serialization
   virtual bool saveBlockToStream(BlockIndex block_index,
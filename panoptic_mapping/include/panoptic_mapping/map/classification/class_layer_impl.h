@@ -8,8 +8,10 @@
 #include <voxblox/core/layer.h>
 
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/block_pool.h"
 #include "panoptic_mapping/map/classification/class_block.h"
 #include "panoptic_mapping/map/classification/class_voxel.h"
+#include "panoptic_mapping/map/layer_snapshot.h"
 #include "panoptic_mapping/tools/serialization.h"
 
 namespace panoptic_mapping {
@@ -36,7 +38,9 @@ class ClassLayerImpl : public ClassLayer {
     return getClassBlockPtr(layer_.getBlockPtrByIndex(index));
   }
   ClassBlock::Ptr allocateBlockPtrByIndex(const BlockIndex& index) override {
-    return getClassBlockPtr(layer_.allocateBlockPtrByIndex(index));
+    return getClassBlockPtr(
+        BlockPool<VoxelT>::getGlobalInstance()->allocateBlockPtrByIndex(
+            index, &layer_));
   }
   ClassBlock::ConstPtr getBlockPtrByCoordinates(
       const Point& coords) const override {
@@ -46,7 +50,9 @@ class ClassLayerImpl : public ClassLayer {
     return getClassBlockPtr(layer_.getBlockPtrByCoordinates(coords));
   }
   ClassBlock::Ptr allocateBlockPtrByCoordinates(const Point& coords) override {
-    return getClassBlockPtr(layer_.allocateBlockPtrByCoordinates(coords));
+    return getClassBlockPtr(
+        BlockPool<VoxelT>::getGlobalInstance()->allocateBlockPtrByCoordinates(
+            coords, &layer_));
   }
   ClassBlock::Ptr allocateNewBlock(const BlockIndex& index) override {
     return getClassBlockPtr(layer_.allocateNewBlock(index));
@@ -57,7 +63,7 @@ class ClassLayerImpl : public ClassLayer {
 
   // General functions.
   void removeBlock(const BlockIndex& index) override {
-    layer_.removeBlock(index);
+    BlockPool<VoxelT>::getGlobalInstance()->removeBlock(index, &layer_);
   }
   void removeAllBlocks() override { layer_.removeAllBlocks(); }
   void removeBlockByCoordinates(const Point& coords) override {
@@ -82,6 +88,21 @@ class ClassLayerImpl : public ClassLayer {
   FloatingPoint voxel_size() const override { return layer_.voxel_size(); }
   FloatingPoint block_size() const override { return layer_.block_size(); }
 
+  // Snapshots.
+  std::unique_ptr<ClassLayer> snapshot(
+      const ClassLayer* previous,
+      const voxblox::IndexSet& changed_blocks) const override {
+    std::unique_ptr<ClassLayer> result = cloneEmpty();
+    auto* result_impl = dynamic_cast<ClassLayerImpl<VoxelT>*>(result.get());
+    CHECK_NOTNULL(result_impl);
+    // Blocks can only be shared if the previous layer is of the same type.
+    const auto* previous_impl =
+        dynamic_cast<const ClassLayerImpl<VoxelT>*>(previous);
+    snapshotLayer(layer_, previous_impl ? &previous_impl->layer_ : nullptr,
+                  changed_blocks, &result_impl->layer_);
+    return result;
+  }
+
   // Serialization.
   bool saveBlockToStream(BlockIndex block_index,
                          std::fstream* outfile_ptr) const override {
@@ -99,12 +120,17 @@ class ClassLayerImpl : public ClassLayer {
     proto.set_origin_x(block->origin().x());
     proto.set_origin_y(block->origin().y());
     proto.set_origin_z(block->origin().z());
+    // Size the data once and serialize the voxels directly into it.
+    size_t size = 0;
     for (size_t i = 0; i < block->num_voxels(); ++i) {
-      for (uint32_t word :
-           reinterpret_cast<const ClassVoxel&>(block->getVoxelByLinearIndex(i))
-               .serializeVoxelToInt()) {
-        proto.add_voxel_data(word);
-      }
+      size += block->getVoxelByLinearIndex(i).getSerializedSize();
+    }
+    proto.mutable_voxel_data()->Resize(size, 0u);
+    uint32_t* data = proto.mutable_voxel_data()->mutable_data();
+    size_t index = 0;
+    for (size_t i = 0; i < block->num_voxels(); ++i) {
+      const VoxelT& voxel = block->getVoxelByLinearIndex(i);
+      index += voxel.serializeVoxelToBuffer(data + index);
     }
     if (!voxblox::utils::writeProtoMsgToStream(proto, outfile_ptr)) {
       LOG(ERROR) << "Could not write class block proto message to stream.";
@@ -144,20 +170,13 @@ class ClassLayerImpl : public ClassLayer {
     layer_.removeBlockByCoordinates(origin);
     auto block = layer_.allocateNewBlockByCoordinates(origin);
 
-    // Read the data.
-    std::vector<uint32_t> data;
-    data.resize(block_proto.voxel_data_size());
+    // Load the voxels directly from the proto data.
+    const uint32_t* data = block_proto.voxel_data().data();
+    const size_t size = block_proto.voxel_data_size();
     size_t index = 0;
-    for (uint32_t word : block_proto.voxel_data()) {
-      data[index] = word;
-      index++;
-    }
-
-    // Load the voxels.
-    index = 0;
     for (size_t i = 0; i < block->num_voxels(); ++i) {
-      if (!reinterpret_cast<ClassVoxel&>(block->getVoxelByLinearIndex(i))
-               .deseriliazeVoxelFromInt(data, &index)) {
+      if (!block->getVoxelByLinearIndex(i).deserializeVoxelFromBuffer(
+              data, size, &index)) {
         LOG(WARNING) << "Could not serialize voxel from data.";
         return false;
       }
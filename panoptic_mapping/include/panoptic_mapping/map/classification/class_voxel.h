@@ -1,6 +1,8 @@
 #ifndef PANOPTIC_MAPPING_MAP_CLASSIFICATION_CLASS_VOXEL_H_
 #define PANOPTIC_MAPPING_MAP_CLASSIFICATION_CLASS_VOXEL_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 namespace panoptic_mapping {
@@ -12,7 +14,9 @@ enum class ClassVoxelType {
   kMovingBinaryCount,
   kFixedCount,
   kVariableCount,
-  kUncertainty
+  kUncertainty,
+  kDenseCount,
+  kTopKCount
 };
 
 /**
@@ -83,24 +87,45 @@ struct ClassVoxel {
    */
   virtual bool mergeVoxel(const ClassVoxel& other) = 0;
 
+  /**
+   * @brief Get the number of integer words the serialized voxel occupies, such
+   * that buffers for many voxels can be sized before serializing them.
+   */
+  virtual size_t getSerializedSize() const = 0;
+
   /**
    * @brief Serialization tool to serialize voxels and layers to integer data.
    *
-   * @param data The current binary data to append the voxel to.
+   * @param data The buffer to write the voxel to. Needs to hold at least
+   * 'getSerializedSize()' words.
+   * @return The number of words written.
    */
-  virtual std::vector<uint32_t> serializeVoxelToInt() const = 0;
+  virtual size_t serializeVoxelToBuffer(uint32_t* data) const = 0;
 
   /**
    * @brief De-serialize the voxel from integer data.
    *
    * @param data The data to read from.
+   * @param size The number of words in data.
    * @param data_index Index from where to read the data. This index should be
    * updated to point to the end of the serialized data such that the next voxel
    * can be read from there.
    * @return True if the voxel was correctly de-serialized, false otherwise.
    */
-  virtual bool deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
-                                       size_t* data_index) = 0;
+  virtual bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                          size_t* data_index) = 0;
+
+  // Vector versions of the buffer interfaces. These allocate per voxel and
+  // should not be used for whole blocks or layers.
+  std::vector<uint32_t> serializeVoxelToInt() const {
+    std::vector<uint32_t> result(getSerializedSize());
+    serializeVoxelToBuffer(result.data());
+    return result;
+  }
+  bool deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
+                               size_t* data_index) {
+    return deserializeVoxelFromBuffer(data.data(), data.size(), data_index);
+  }
 };
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,266 @@
+#ifndef PANOPTIC_MAPPING_MAP_CLASSIFICATION_DENSE_COUNT_H_
+#define PANOPTIC_MAPPING_MAP_CLASSIFICATION_DENSE_COUNT_H_
+
+#include <bitset>
+#include <memory>
+#include <vector>
+
+#include <voxblox/core/block.h>
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/Submap.pb.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/classification/class_block.h"
+#include "panoptic_mapping/map/classification/class_layer.h"
+#include "panoptic_mapping/map/classification/class_voxel.h"
+
+namespace panoptic_mapping {
+
+class DenseCountBlock;
+
+/**
+ * @brief Handle to a voxel of a DenseCountBlock that exposes the ClassVoxel
+ * interface. The voxel itself does not store any data, all counts are stored in
+ * the block.
+ */
+struct DenseCountVoxel : public ClassVoxel {
+ public:
+  DenseCountVoxel() = default;
+  DenseCountVoxel(DenseCountBlock* block, size_t index)
+      : block_(block), index_(index) {}
+
+  // Implement interfaces.
+  ClassVoxelType getVoxelType() const override;
+  bool isObserverd() const override;
+  bool belongsToSubmap() const override;
+  float getBelongingProbability() const override;
+  int getBelongingID() const override;
+  float getProbability(const int id) const override;
+  void incrementCount(const int id, const float weight = 1.f) override;
+  bool mergeVoxel(const ClassVoxel& other) override;
+  size_t getSerializedSize() const override;
+  size_t serializeVoxelToBuffer(uint32_t* data) const override;
+  bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                  size_t* data_index) override;
+
+ private:
+  friend class DenseCountBlock;
+  DenseCountBlock* block_ = nullptr;
+  size_t index_ = 0;
+};
+
+/**
+ * @brief Classification by counting the occurences of each label, equivalent to
+ * the FixedCountVoxel. All counts of a block are stored in one contiguous
+ * structure-of-arrays buffer (voxel x label) that is allocated on the first
+ * observation in the block, instead of a vector per voxel. The number of counts
+ * is a property of the block: Blocks with a fixed number of counts reject IDs
+ * out of range, blocks created with 0 counts grow to fit the observed IDs. The
+ * storage is padded to 8, 32, or 64 counts for small label sets, for which the
+ * count reductions are specialized at compile time.
+ */
+class DenseCountBlock : public ClassBlock {
+ public:
+  // If 'num_counts' is 0 the number of counts adapts to the observed IDs.
+  DenseCountBlock(const Point& origin, size_t voxels_per_side,
+                  FloatingPoint voxel_size, size_t num_counts);
+  DenseCountBlock(const DenseCountBlock& other);
+  DenseCountBlock& operator=(const DenseCountBlock& other) = delete;
+  ~DenseCountBlock() override = default;
+
+  // ClassBlock interfaces.
+  const ClassVoxel& getVoxelByLinearIndex(size_t index) const override {
+    return voxels_[index];
+  }
+  const ClassVoxel& getVoxelByVoxelIndex(
+      const VoxelIndex& index) const override {
+    return voxels_[computeLinearIndex(index)];
+  }
+  const ClassVoxel& getVoxelByCoordinates(const Point& coords) const override {
+    return voxels_[computeLinearIndex(coords)];
+  }
+  ClassVoxel& getVoxelByCoordinates(const Point& coords) override {
+    return voxels_[computeLinearIndex(coords)];
+  }
+  ClassVoxel* getVoxelPtrByCoordinates(const Point& coords) override {
+    return &voxels_[computeLinearIndex(coords)];
+  }
+  const ClassVoxel* getVoxelPtrByCoordinates(
+      const Point& coords) const override {
+    return &voxels_[computeLinearIndex(coords)];
+  }
+  ClassVoxel& getVoxelByLinearIndex(size_t index) override {
+    return voxels_[index];
+  }
+  ClassVoxel& getVoxelByVoxelIndex(const VoxelIndex& index) override {
+    return voxels_[computeLinearIndex(index)];
+  }
+  ClassVoxelType getVoxelType() const override {
+    return ClassVoxelType::kDenseCount;
+  }
+  bool mergeBlock(const ClassBlock& other, const VoxelMask& merge_voxels,
+                  const VoxelMask& copy_voxels) override;
+
+  // Direct access to the counts, which avoids the virtual voxel interface.
+  bool hasData() const { return !total_counts_.empty(); }
+  bool isObserved(size_t index) const {
+    return hasData() && total_counts_[index] > 0;
+  }
+  int getBelongingID(size_t index) const {
+    return hasData() ? current_indices_[index] : 0;
+  }
+  ClassificationCount getCount(size_t index, int id) const {
+    return hasData() ? counts_[index * stride_ + id] : 0;
+  }
+  ClassificationCount getTotalCount(size_t index) const {
+    return hasData() ? total_counts_[index] : 0;
+  }
+  void incrementCount(size_t index, int id);
+
+  // Block properties.
+  size_t num_voxels() const { return voxels_.size(); }
+  size_t voxels_per_side() const { return voxels_per_side_; }
+  FloatingPoint voxel_size() const { return voxel_size_; }
+  const Point& origin() const { return origin_; }
+  size_t numCounts() const { return num_counts_; }
+  bool hasFixedNumCounts() const { return fixed_num_counts_ != 0u; }
+  size_t getMemorySize() const;
+  std::bitset<voxblox::Update::kCount>& updated() { return updated_; }
+  const std::bitset<voxblox::Update::kCount>& updated() const {
+    return updated_;
+  }
+
+ protected:
+  bool isValid() const override { return true; }
+
+ private:
+  friend struct DenseCountVoxel;
+  void allocateCounts();
+  // Make sure IDs in [0, num_counts) can be stored. Returns false if this
+  // exceeds the fixed number of counts.
+  bool reserveCounts(size_t num_counts);
+  // Recompute the current index and count of a voxel from its counts.
+  void updateCurrentCount(size_t index);
+  // Add the counts of a voxel of other to, or overwrite, the voxel at index.
+  bool mergeVoxel(size_t index, const DenseCountBlock& other,
+                  size_t other_index);
+  bool copyVoxel(size_t index, const DenseCountBlock& other,
+                 size_t other_index);
+  size_t computeLinearIndex(const VoxelIndex& index) const;
+  size_t computeLinearIndex(const Point& coords) const;
+
+  const Point origin_;
+  const size_t voxels_per_side_;
+  const FloatingPoint voxel_size_;
+  const FloatingPoint voxel_size_inv_;
+  const size_t fixed_num_counts_;  // 0 for adaptive blocks.
+  size_t num_counts_;
+  size_t stride_;  // Padded number of counts stored per voxel.
+
+  // Structure of arrays, empty until the first observation in the block.
+  std::vector<ClassificationCount> counts_;  // <voxel * stride + id>
+  std::vector<ClassificationCount> total_counts_;
+  std::vector<ClassificationCount> current_counts_;
+  std::vector<int> current_indices_;
+
+  // Handles to expose the ClassVoxel interface.
+  std::vector<DenseCountVoxel> voxels_;
+  std::bitset<voxblox::Update::kCount> updated_;
+};
+
+/**
+ * @brief Class layer storing DenseCountBlocks. The number of counts is a
+ * property of every layer, such that no global setting is required and several
+ * mappers with different label sets can run in one process. Loaded layers are
+ * compatible with the serialization of the FixedCountLayer voxels.
+ */
+class DenseCountLayer : public ClassLayer {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Number of labels counted per voxel, IDs need to be in [0, num_counts).
+    // 0 adapts the number of counts of each block to the observed IDs.
+    int num_counts = 0;
+
+    Config() { setConfigName("DenseCountLayer"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  DenseCountLayer(const Config& config, const float voxel_size,
+                  const int voxels_per_side);
+  DenseCountLayer(const DenseCountLayer& other);
+  ~DenseCountLayer() override = default;
+
+  ClassVoxelType getVoxelType() const override;
+
+  // Voxblox interfaces.
+  ClassBlock::ConstPtr getBlockConstPtrByIndex(
+      const BlockIndex& index) const override;
+  ClassBlock::Ptr getBlockPtrByIndex(const BlockIndex& index) override;
+  ClassBlock::Ptr allocateBlockPtrByIndex(const BlockIndex& index) override;
+  ClassBlock::ConstPtr getBlockPtrByCoordinates(
+      const Point& coords) const override;
+  ClassBlock::Ptr getBlockPtrByCoordinates(const Point& coords) override;
+  ClassBlock::Ptr allocateBlockPtrByCoordinates(const Point& coords) override;
+  ClassBlock::Ptr allocateNewBlock(const BlockIndex& index) override;
+  ClassBlock::Ptr allocateNewBlockByCoordinates(const Point& coords) override;
+  void removeBlock(const BlockIndex& index) override;
+  void removeAllBlocks() override;
+  void removeBlockByCoordinates(const Point& coords) override;
+  void getAllAllocatedBlocks(voxblox::BlockIndexList* blocks) const override;
+  void getAllUpdatedBlocks(voxblox::Update::Status bit,
+                           voxblox::BlockIndexList* blocks) const override;
+  size_t getNumberOfAllocatedBlocks() const override;
+  bool hasBlock(const BlockIndex& block_index) const override;
+  size_t getMemorySize() const override;
+  size_t voxels_per_side() const override { return voxels_per_side_; }
+  FloatingPoint voxel_size() const override { return voxel_size_; }
+  FloatingPoint block_size() const override { return block_size_; }
+  std::unique_ptr<ClassLayer> clone() const override;
+  std::unique_ptr<ClassLayer> cloneEmpty() const override;
+  std::unique_ptr<ClassLayer> snapshot(
+      const ClassLayer* previous,
+      const voxblox::IndexSet& changed_blocks) const override;
+
+  // Serialization.
+  bool saveBlockToStream(BlockIndex block_index,
+                         std::fstream* outfile_ptr) const override;
+  bool saveBlocksToStream(bool include_all_blocks,
+                          voxblox::BlockIndexList blocks_to_include,
+                          std::fstream* outfile_ptr) const override;
+  bool addBlockFromProto(const voxblox::BlockProto& block_proto) override;
+  static std::unique_ptr<ClassLayer> loadFromStream(
+      const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
+      uint64_t* /* tmp_byte_offset_ptr */);
+
+  // Lookup.
+  ClassVoxel* getVoxelPtrByCoordinates(const Point& coords) override;
+  const ClassVoxel* getVoxelPtrByCoordinates(
+      const Point& coords) const override;
+
+  // Typed access if the layer type is known.
+  std::shared_ptr<DenseCountBlock> getDenseBlockPtrByIndex(
+      const BlockIndex& index) const;
+
+ private:
+  BlockIndex computeBlockIndex(const Point& coords) const;
+  std::shared_ptr<DenseCountBlock> createBlock(const BlockIndex& index) const;
+
+  const Config config_;
+  const FloatingPoint voxel_size_;
+  const size_t voxels_per_side_;
+  const FloatingPoint block_size_;
+  const FloatingPoint block_size_inv_;
+  voxblox::AnyIndexHashMapType<std::shared_ptr<DenseCountBlock>>::type blocks_;
+
+  static config_utilities::Factory::RegistrationRos<ClassLayer, DenseCountLayer,
+                                                    float, int>
+      registration_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_CLASSIFICATION_DENSE_COUNT_H_
@@ -15,7 +15,9 @@ namespace panoptic_mapping {
  * @brief Classification by counting the occurences of each label. The index 0
  * is generally reserved for the belonging submap by shifting all IDs by 1. The
  * memory for counting is lazily allocated since often only surface voxels are
- * relevant.
+ * relevant, and grows to the largest observed ID. The number of labels is thus
+ * a property of the data rather than a global setting, use the DenseCountLayer
+ * to fix the number of labels per layer.
  */
 struct FixedCountVoxel : public ClassVoxel {
  public:
@@ -28,22 +30,17 @@ struct FixedCountVoxel : public ClassVoxel {
   float getProbability(const int id) const override;
   void incrementCount(const int id, const float weight = 1.f) override;
   bool mergeVoxel(const ClassVoxel& other) override;
-  std::vector<uint32_t> serializeVoxelToInt() const override;
-  bool deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
-                               size_t* data_index) override;
+  // Typed version of 'mergeVoxel()' without the type check.
+  bool mergeVoxel(const FixedCountVoxel& other);
+  size_t getSerializedSize() const override;
+  size_t serializeVoxelToBuffer(uint32_t* data) const override;
+  bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                  size_t* data_index) override;
   // Data.
   std::vector<ClassificationCount> counts;
   int current_index = 0;
   ClassificationCount current_count = 0;
   ClassificationCount total_count = 0;
-
-  static size_t numCounts();
-  static void setNumCounts(size_t num_counts);
-
- private:
-  // Fixed count voxels store a fixed number of labels, which is currently set
-  // via this global setting.
-  static size_t kNumCounts;
 };
 
 class FixedCountLayer : public ClassLayerImpl<FixedCountVoxel> {
@@ -61,6 +58,7 @@ class FixedCountLayer : public ClassLayerImpl<FixedCountVoxel> {
 
   ClassVoxelType getVoxelType() const override;
   std::unique_ptr<ClassLayer> clone() const override;
+  std::unique_ptr<ClassLayer> cloneEmpty() const override;
   static std::unique_ptr<ClassLayer> loadFromStream(
       const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
       uint64_t* /* tmp_byte_offset_ptr */);
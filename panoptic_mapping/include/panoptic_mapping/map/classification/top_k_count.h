@@ -0,0 +1,85 @@
+#ifndef PANOPTIC_MAPPING_MAP_CLASSIFICATION_TOP_K_COUNT_H_
+#define PANOPTIC_MAPPING_MAP_CLASSIFICATION_TOP_K_COUNT_H_
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/Submap.pb.h"
+#include "panoptic_mapping/map/classification/class_layer_impl.h"
+#include "panoptic_mapping/map/classification/class_voxel.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Keep track of the most frequent IDs in a small inline array instead of
+ * the unordered map of the VariableCountVoxel, such that counting never
+ * allocates. If all entries are taken, a new ID replaces the entry with the
+ * lowest count and inherits its count (space-saving algorithm), which
+ * guarantees that frequent IDs are retained. ID 0 is generally used to store
+ * the belonging submap and shifting other IDs by 1.
+ */
+struct TopKCountVoxel : public ClassVoxel {
+ public:
+  // Maximum number of IDs stored per voxel.
+  static constexpr size_t kMaxEntries = 4;
+
+  // Implement interfaces.
+  ClassVoxelType getVoxelType() const override;
+  bool isObserverd() const override;
+  bool belongsToSubmap() const override;
+  float getBelongingProbability() const override;
+  int getBelongingID() const override;
+  float getProbability(const int id) const override;
+  void incrementCount(const int id, const float weight = 1.f) override;
+  bool mergeVoxel(const ClassVoxel& other) override;
+  // Typed version of 'mergeVoxel()' without the type check.
+  bool mergeVoxel(const TopKCountVoxel& other);
+  size_t getSerializedSize() const override;
+  size_t serializeVoxelToBuffer(uint32_t* data) const override;
+  bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                  size_t* data_index) override;
+
+  // Add a count to an ID, evicting the least frequent entry if necessary.
+  void addCount(int id, ClassificationCount count);
+
+  // Data.
+  std::array<int, kMaxEntries> ids;
+  std::array<ClassificationCount, kMaxEntries> counts;
+  uint8_t num_entries = 0;
+  int current_index = 0;
+  ClassificationCount current_count = 0;
+  ClassificationCount total_count = 0;
+};
+
+class TopKCountLayer : public ClassLayerImpl<TopKCountVoxel> {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    Config() { setConfigName("TopKCountLayer"); }
+
+   protected:
+    void fromRosParam() override {}
+    void printFields() const override {}
+  };
+
+  TopKCountLayer(const Config& config, const float voxel_size,
+                 const int voxels_per_side);
+
+  ClassVoxelType getVoxelType() const override;
+  std::unique_ptr<ClassLayer> clone() const override;
+  std::unique_ptr<ClassLayer> cloneEmpty() const override;
+  static std::unique_ptr<ClassLayer> loadFromStream(
+      const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
+      uint64_t* /* tmp_byte_offset_ptr */);
+
+ protected:
+  const Config config_;
+  static config_utilities::Factory::RegistrationRos<ClassLayer, TopKCountLayer,
+                                                    float, int>
+      registration_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_CLASSIFICATION_TOP_K_COUNT_H_
@@ -21,9 +21,12 @@ struct UncertaintyVoxel : public FixedCountVoxel {
   // Implement interfaces.
   ClassVoxelType getVoxelType() const override;
   bool mergeVoxel(const ClassVoxel& other) override;
-  std::vector<uint32_t> serializeVoxelToInt() const override;
-  bool deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
-                               size_t* data_index) override;
+  // Typed version of 'mergeVoxel()' without the type check.
+  bool mergeVoxel(const UncertaintyVoxel& other);
+  size_t getSerializedSize() const override;
+  size_t serializeVoxelToBuffer(uint32_t* data) const override;
+  bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                  size_t* data_index) override;
   // Data.
   float uncertainty = 0.f;
   bool is_ground_truth = false;
@@ -44,6 +47,7 @@ class UncertaintyLayer : public ClassLayerImpl<UncertaintyVoxel> {
 
   ClassVoxelType getVoxelType() const override;
   std::unique_ptr<ClassLayer> clone() const override;
+  std::unique_ptr<ClassLayer> cloneEmpty() const override;
   static std::unique_ptr<ClassLayer> loadFromStream(
       const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
       uint64_t* /* tmp_byte_offset_ptr */);
@@ -27,9 +27,12 @@ struct VariableCountVoxel : public ClassVoxel {
   float getProbability(const int id) const override;
   void incrementCount(const int id, const float weight = 1.f) override;
   bool mergeVoxel(const ClassVoxel& other) override;
-  std::vector<uint32_t> serializeVoxelToInt() const override;
-  bool deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
-                               size_t* data_index) override;
+  // Typed version of 'mergeVoxel()' without the type check.
+  bool mergeVoxel(const VariableCountVoxel& other);
+  size_t getSerializedSize() const override;
+  size_t serializeVoxelToBuffer(uint32_t* data) const override;
+  bool deserializeVoxelFromBuffer(const uint32_t* data, size_t size,
+                                  size_t* data_index) override;
   // Data.
   std::unordered_map<int, ClassificationCount> counts;
   int current_index = 0;
@@ -52,6 +55,7 @@ class VariableCountLayer : public ClassLayerImpl<VariableCountVoxel> {
 
   ClassVoxelType getVoxelType() const override;
   std::unique_ptr<ClassLayer> clone() const override;
+  std::unique_ptr<ClassLayer> cloneEmpty() const override;
   static std::unique_ptr<ClassLayer> loadFromStream(
       const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
       uint64_t* /* tmp_byte_offset_ptr */);
@@ -0,0 +1,72 @@
+#ifndef PANOPTIC_MAPPING_MAP_COLLAPSED_TSDF_BLOCKS_H_
+#define PANOPTIC_MAPPING_MAP_COLLAPSED_TSDF_BLOCKS_H_
+
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief TSDF blocks whose voxels are all equal, stored as a single voxel per
+ * block. Only blocks that are observed free beyond the truncation distance are
+ * collapsed, such as most of the free space. No surface can be within one
+ * voxel of these blocks, so meshing and iso-surface extraction are not
+ * affected by their absence from the TSDF layer. The object is never modified
+ * after construction and is therefore shared between clones and snapshots.
+ */
+class CollapsedTsdfBlocks {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // If true, uniform TSDF blocks that did not change for a while are
+    // collapsed by the map manager and expanded again when integrated.
+    bool collapse_uniform_blocks = false;
+
+    // Minimum weight of the voxels of collapsed blocks, e.g. to only collapse
+    // blocks whose weights are saturated.
+    float min_weight = 0.f;
+
+    Config() { setConfigName("CollapsedTsdfBlocks"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  using BlockMap = voxblox::AnyIndexHashMapType<TsdfVoxel>::type;
+
+  explicit CollapsedTsdfBlocks(BlockMap blocks);
+  virtual ~CollapsedTsdfBlocks() = default;
+
+  /**
+   * @brief Check whether a block can be collapsed.
+   *
+   * @param block The block to check.
+   * @param truncation_distance Truncation distance of the layer in meters.
+   * @param min_weight Minimum weight of the voxels.
+   * @param value Output value of all voxels if the block is collapsible.
+   * @return True if all voxels are equal, observed with at least the minimum
+   * weight, and at least the truncation distance in front of the surface.
+   */
+  static bool isCollapsible(const TsdfBlock& block, float truncation_distance,
+                            float min_weight, TsdfVoxel* value);
+
+  // Allocate a block filled with the value in the layer.
+  static void expandBlock(const BlockIndex& index, const TsdfVoxel& value,
+                          TsdfLayer* layer);
+
+  // Value of a collapsed block, nullptr if the block is not collapsed.
+  const TsdfVoxel* getVoxel(const BlockIndex& index) const;
+
+  const BlockMap& getBlocks() const { return blocks_; }
+  size_t size() const { return blocks_.size(); }
+  size_t getMemorySize() const;
+
+ private:
+  const BlockMap blocks_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_COLLAPSED_TSDF_BLOCKS_H_
@@ -0,0 +1,108 @@
+#ifndef PANOPTIC_MAPPING_MAP_COMPACT_ISO_SURFACE_POINTS_H_
+#define PANOPTIC_MAPPING_MAP_COMPACT_ISO_SURFACE_POINTS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Read-only quantized storage of the iso-surface points of inactive
+ * submaps. The points are grouped by the block they fall into and store their
+ * position relative to the block origin in 16 bits per axis and their weight
+ * in 8 bits, which halves the memory of the full precision points. Optionally
+ * the points are subsampled deterministically to a target count.
+ */
+class CompactIsoSurfacePoints {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // If true, the iso-surface points of inactive submaps are compacted.
+    bool compact_inactive = false;
+
+    // If > 0, every submap keeps at most this many evenly spaced points.
+    int max_points = 0;
+
+    Config() { setConfigName("CompactIsoSurfacePoints"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  /**
+   * @brief Quantize a set of iso-surface points.
+   *
+   * @param points The full precision points in submap frame.
+   * @param block_size Size of the blocks to group the points by in meters.
+   * @param max_points If > 0, keep at most this many points.
+   */
+  CompactIsoSurfacePoints(const std::vector<IsoSurfacePoint>& points,
+                          float block_size, size_t max_points = 0);
+  virtual ~CompactIsoSurfacePoints() = default;
+
+  size_t size() const { return points_.size(); }
+  bool empty() const { return points_.empty(); }
+
+  // Random access decoding, which looks up the block of the point.
+  IsoSurfacePoint getPoint(size_t index) const {
+    return decode(findBlock(index), points_[index]);
+  }
+
+  /**
+   * @brief Decode the points [begin, end) block by block and call the
+   * function for each of them.
+   *
+   * @param function Called with each decoded point, iteration stops if it
+   * returns false.
+   */
+  template <typename FunctionT>
+  void forEachPoint(size_t begin, size_t end, FunctionT function) const {
+    end = std::min(end, points_.size());
+    for (size_t block = begin < end ? findBlock(begin) : blocks_.size();
+         block < blocks_.size() && blocks_[block].begin < end; ++block) {
+      const size_t block_end = std::min<size_t>(blockEnd(block), end);
+      for (size_t i = std::max<size_t>(blocks_[block].begin, begin);
+           i < block_end; ++i) {
+        if (!function(decode(block, points_[i]))) {
+          return;
+        }
+      }
+    }
+  }
+
+  // Decode all points.
+  std::vector<IsoSurfacePoint> decodeAll() const;
+
+  size_t getMemorySize() const;
+
+ private:
+  struct Block {
+    BlockIndex index;
+    uint32_t begin;  // First point of the block.
+  };
+  struct CompactPoint {
+    uint16_t position[3];
+    uint8_t weight;
+  };
+
+  size_t findBlock(size_t point_index) const;
+  size_t blockEnd(size_t block) const {
+    return block + 1 < blocks_.size() ? blocks_[block + 1].begin
+                                      : points_.size();
+  }
+  IsoSurfacePoint decode(size_t block, const CompactPoint& point) const;
+
+  float block_size_;
+  float position_step_;
+  float weight_step_ = 0.f;
+  std::vector<Block> blocks_;
+  std::vector<CompactPoint> points_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_COMPACT_ISO_SURFACE_POINTS_H_
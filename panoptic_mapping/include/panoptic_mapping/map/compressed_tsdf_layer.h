@@ -0,0 +1,84 @@
+#ifndef PANOPTIC_MAPPING_MAP_COMPRESSED_TSDF_LAYER_H_
+#define PANOPTIC_MAPPING_MAP_COMPRESSED_TSDF_LAYER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <voxblox/core/layer.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Compact read-only copy of a TSDF layer. Distances are quantized
+ * linearly within the truncation band, weights logarithmically to 8 bits, and
+ * colors are optionally dropped. This reduces the voxel size from 12 to 2-6
+ * bytes and is intended to store inactive submaps.
+ */
+class CompressedTsdfLayer {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // If true, the TSDF layer of submaps is compressed when they become
+    // inactive and decompressed on access.
+    bool compress_inactive = false;
+
+    // Number of bits used to store the distance, 8 or 16.
+    int distance_bits = 8;
+
+    // If true, colors are not stored and decompressed voxels are gray.
+    bool drop_color = false;
+
+    Config() { setConfigName("CompressedTsdfLayer"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  /**
+   * @brief Compress all allocated blocks of a layer.
+   *
+   * @param config Compression settings.
+   * @param layer The layer to compress.
+   * @param truncation_distance Truncation distance of the layer in meters,
+   * larger distances are clamped.
+   */
+  CompressedTsdfLayer(const Config& config, const TsdfLayer& layer,
+                      float truncation_distance);
+  virtual ~CompressedTsdfLayer() = default;
+
+  /**
+   * @brief Write all compressed blocks into a layer of the same layout, blocks
+   * that already exist are replaced.
+   */
+  void decompress(TsdfLayer* layer) const;
+
+  size_t getNumberOfBlocks() const { return blocks_.size(); }
+  size_t getMemorySize() const;
+
+ private:
+  struct CompressedBlock {
+    BlockIndex index;
+    std::vector<uint8_t> distances;  // 1 or 2 bytes per voxel.
+    std::vector<uint8_t> weights;
+    std::vector<voxblox::Color> colors;  // Empty if colors are dropped.
+  };
+
+  uint8_t compressWeight(float weight) const;
+  float decompressWeight(uint8_t code) const;
+
+  const Config config_;
+  const float truncation_distance_;
+  const size_t voxels_per_side_;
+  const float voxel_size_;
+  float max_distance_code_;
+  float min_log_weight_ = 0.f;
+  float log_weight_step_ = 1.f;
+  std::vector<CompressedBlock> blocks_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_COMPRESSED_TSDF_LAYER_H_
@@ -0,0 +1,90 @@
+#ifndef PANOPTIC_MAPPING_MAP_FLAT_BLOCK_MAP_H_
+#define PANOPTIC_MAPPING_MAP_FLAT_BLOCK_MAP_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <voxblox/core/layer.h>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Read-only open-addressing hash map from block indices to the blocks
+ * of a layer. The entries are stored in a single flat array and probed
+ * linearly, such that a lookup touches one or two cache lines instead of
+ * chasing the nodes of the layer's 'std::unordered_map'. The map holds raw
+ * pointers and is only valid as long as no blocks are allocated in or removed
+ * from the layer, it is intended to be built for read-only phases with many
+ * lookups, e.g. change detection or meshing a whole layer.
+ *
+ * @tparam VoxelT Voxel type of the layer.
+ */
+template <typename VoxelT>
+class FlatBlockMap {
+ public:
+  using BlockType = voxblox::Block<VoxelT>;
+
+  explicit FlatBlockMap(const voxblox::Layer<VoxelT>& layer) {
+    voxblox::BlockIndexList block_indices;
+    layer.getAllAllocatedBlocks(&block_indices);
+
+    // Keep the load factor at most 0.5 for short probe sequences.
+    size_t capacity = 16;
+    while (capacity < 2 * block_indices.size()) {
+      capacity *= 2;
+    }
+    mask_ = capacity - 1;
+    entries_.resize(capacity);
+    for (const BlockIndex& index : block_indices) {
+      size_t slot = hash(index) & mask_;
+      while (entries_[slot].block) {
+        slot = (slot + 1) & mask_;
+      }
+      entries_[slot].index = index;
+      entries_[slot].block = layer.getBlockPtrByIndex(index).get();
+    }
+    size_ = block_indices.size();
+  }
+  virtual ~FlatBlockMap() = default;
+
+  // Returns nullptr if the block is not allocated.
+  const BlockType* find(const BlockIndex& index) const {
+    size_t slot = hash(index) & mask_;
+    while (entries_[slot].block) {
+      if (entries_[slot].index == index) {
+        return entries_[slot].block;
+      }
+      slot = (slot + 1) & mask_;
+    }
+    return nullptr;
+  }
+
+  size_t size() const { return size_; }
+  size_t getMemorySize() const { return entries_.capacity() * sizeof(Entry); }
+
+ private:
+  struct Entry {
+    BlockIndex index = BlockIndex::Zero();
+    const BlockType* block = nullptr;
+  };
+
+  static size_t hash(const BlockIndex& index) {
+    // Mix the coordinates and take the high bits of a Fibonacci hash, such
+    // that neighboring blocks are spread over the table.
+    const uint64_t key =
+        (static_cast<uint64_t>(static_cast<uint32_t>(index.x())) * 73856093u) ^
+        (static_cast<uint64_t>(static_cast<uint32_t>(index.y())) * 19349669u) ^
+        (static_cast<uint64_t>(static_cast<uint32_t>(index.z())) * 83492791u);
+    return static_cast<size_t>((key * 11400714819323198485ull) >> 32);
+  }
+
+  std::vector<Entry> entries_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_FLAT_BLOCK_MAP_H_
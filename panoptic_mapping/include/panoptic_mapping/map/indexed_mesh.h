@@ -0,0 +1,102 @@
+#ifndef PANOPTIC_MAPPING_MAP_INDEXED_MESH_H_
+#define PANOPTIC_MAPPING_MAP_INDEXED_MESH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+#include <voxblox/mesh/mesh_layer.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief A single indexed triangle mesh of a whole mesh layer. The per-block
+ * meshes of voxblox store every triangle with its own three vertices, the
+ * indexed mesh welds coincident vertices such that neighboring triangles share
+ * them, also across block borders. This allows to simplify the mesh by quadric
+ * edge collapses, which is intended for inactive submaps, whose surfaces do not
+ * change anymore.
+ */
+class IndexedMesh {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Vertices closer than this are welded into one, in voxel sizes.
+    float weld_distance = 0.01f;
+
+    // If true, a decimated mesh is built for inactive submaps.
+    bool decimate_inactive = false;
+
+    // Fraction of the triangles to keep when decimating.
+    float target_ratio = 0.25f;
+
+    // Edges are only collapsed if the resulting vertex deviates at most this
+    // much from the original surface, in voxel sizes.
+    float max_error = 0.1f;
+
+    Config() { setConfigName("IndexedMesh"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  IndexedMesh() = default;
+
+  /**
+   * @brief Weld all meshes of a mesh layer into one indexed mesh.
+   *
+   * @param mesh_layer The layer to convert.
+   * @param weld_distance Vertices closer than this are merged, in meters.
+   */
+  IndexedMesh(const MeshLayer& mesh_layer, float weld_distance);
+  virtual ~IndexedMesh() = default;
+
+  /**
+   * @brief Simplify the mesh by collapsing its cheapest edges first, where the
+   * cost of a collapse is the quadric error of the merged vertex to the planes
+   * of the original triangles. Borders of the mesh are preserved and
+   * collapses that would flip triangles are skipped.
+   *
+   * @param target_triangles Stop once at most this many triangles are left.
+   * @param max_error Largest allowed deviation of a vertex from the original
+   * surface in meters.
+   */
+  void decimate(size_t target_triangles, float max_error);
+
+  /**
+   * @brief Write the mesh back into the blocks of a mesh layer. Each triangle
+   * is stored in the block containing its centroid, such that the result can
+   * be published like any other mesh layer.
+   */
+  void toMeshLayer(MeshLayer* mesh_layer) const;
+
+  // Quantized position key under which vertices are welded.
+  static voxblox::LongIndex weldKey(const Point& position,
+                                    float inv_weld_distance);
+
+  // Access.
+  const Pointcloud& getVertices() const { return vertices_; }
+  const Pointcloud& getNormals() const { return normals_; }
+  const voxblox::Colors& getColors() const { return colors_; }
+  // Three consecutive vertex indices per triangle.
+  const std::vector<uint32_t>& getIndices() const { return indices_; }
+  size_t getNumberOfVertices() const { return vertices_.size(); }
+  size_t getNumberOfTriangles() const { return indices_.size() / 3; }
+  size_t getMemorySize() const;
+
+ private:
+  // Area weighted average of the normals of the adjacent triangles.
+  void computeNormals();
+
+  Pointcloud vertices_;
+  Pointcloud normals_;
+  voxblox::Colors colors_;
+  std::vector<uint32_t> indices_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_INDEXED_MESH_H_
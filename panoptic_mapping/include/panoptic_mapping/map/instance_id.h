@@ -1,23 +1,23 @@
 #ifndef PANOPTIC_MAPPING_MAP_INSTANCE_ID_H_
 #define PANOPTIC_MAPPING_MAP_INSTANCE_ID_H_
 
+#include <mutex>
 #include <unordered_map>
 
 namespace panoptic_mapping {
 
 /**
- * Class for ID management. Default uses a global singleton but e.g. individual
- * submap collections are allowed to have separate.
+ * Class for ID management. Every submap collection owns its manager, such that
+ * independent collections do not share any ID state. IDs can be requested,
+ * registered and released concurrently.
  */
 class InstanceIDManager {
  public:
   InstanceIDManager();
 
-  // Default is a global instance id manager, as singleton.
-  static InstanceIDManager* getGlobalInstance() {
-    static InstanceIDManager instance;
-    return &instance;
-  }
+  // Copies the ID state, e.g. for clones of the owning collection.
+  InstanceIDManager(const InstanceIDManager& other);
+  InstanceIDManager& operator=(const InstanceIDManager& other);
 
  private:
   friend class InstanceID;
@@ -31,6 +31,7 @@ class InstanceIDManager {
   static const bool kAllowIDReuse = false;
 
   // Tracking.
+  mutable std::mutex mutex_;
   int current_id_;
   std::unordered_map<int, int> used_ids_;
 
@@ -45,10 +46,8 @@ class InstanceIDManager {
 class InstanceID {
  public:
   // controlled con- and destruction.
-  explicit InstanceID(
-      InstanceIDManager* manager = InstanceIDManager::getGlobalInstance());
-  explicit InstanceID(int id, InstanceIDManager* manager =
-                                  InstanceIDManager::getGlobalInstance());
+  explicit InstanceID(InstanceIDManager* manager);
+  InstanceID(int id, InstanceIDManager* manager);
   InstanceID(const InstanceID& other);
   ~InstanceID();
 
@@ -0,0 +1,72 @@
+#ifndef PANOPTIC_MAPPING_MAP_LAYER_SNAPSHOT_H_
+#define PANOPTIC_MAPPING_MAP_LAYER_SNAPSHOT_H_
+
+#include <memory>
+#include <utility>
+
+#include <voxblox/core/layer.h>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Copy the voxels and flags of a block into an allocated block of the
+ * same layout. Avoids the protobuf round trip of the voxblox layer copy.
+ */
+template <typename VoxelT>
+void copyBlock(const voxblox::Block<VoxelT>& source,
+               voxblox::Block<VoxelT>* target) {
+  CHECK_NOTNULL(target);
+  CHECK_EQ(source.num_voxels(), target->num_voxels());
+  for (size_t i = 0; i < source.num_voxels(); ++i) {
+    target->getVoxelByLinearIndex(i) = source.getVoxelByLinearIndex(i);
+  }
+  target->has_data() = source.has_data();
+  target->updated() = source.updated();
+}
+
+/**
+ * @brief Create a copy-on-write snapshot of a layer. Blocks that are listed as
+ * changed or are not contained in the previous snapshot are copied, all other
+ * blocks are shared with the previous snapshot by reference counting.
+ * Blocks of snapshots are never modified after creation, which is what makes
+ * sharing them between snapshots safe.
+ *
+ * @param source Layer to take the snapshot of.
+ * @param previous Previous snapshot of the same source layer, can be nullptr.
+ * @param changed_blocks Blocks of the source that changed since the previous
+ * snapshot.
+ * @param result Empty layer of the same layout to add the blocks to.
+ * @return Number of blocks that were copied.
+ */
+template <typename VoxelT>
+size_t snapshotLayer(const voxblox::Layer<VoxelT>& source,
+                     const voxblox::Layer<VoxelT>* previous,
+                     const voxblox::IndexSet& changed_blocks,
+                     voxblox::Layer<VoxelT>* result) {
+  CHECK_NOTNULL(result);
+  size_t num_copied = 0;
+  voxblox::BlockIndexList block_indices;
+  source.getAllAllocatedBlocks(&block_indices);
+  for (const BlockIndex& index : block_indices) {
+    if (previous && changed_blocks.find(index) == changed_blocks.end()) {
+      typename voxblox::Block<VoxelT>::ConstPtr shared =
+          previous->getBlockPtrByIndex(index);
+      if (shared) {
+        result->insertBlock(std::make_pair(
+            index,
+            std::const_pointer_cast<voxblox::Block<VoxelT>>(shared)));
+        continue;
+      }
+    }
+    copyBlock(source.getBlockByIndex(index),
+              result->allocateNewBlock(index).get());
+    ++num_copied;
+  }
+  return num_copied;
+}
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_LAYER_SNAPSHOT_H_
@@ -0,0 +1,82 @@
+#ifndef PANOPTIC_MAPPING_MAP_LEVEL_OF_DETAIL_PYRAMID_H_
+#define PANOPTIC_MAPPING_MAP_LEVEL_OF_DETAIL_PYRAMID_H_
+
+#include <memory>
+#include <vector>
+
+#include <voxblox/core/layer.h>
+#include <voxblox/mesh/mesh_layer.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/integration/mesh_integrator.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Read-only coarser representations of a TSDF layer and its mesh. Each
+ * level halves the voxels per side of the previous one while keeping the block
+ * layout, such that block indices are identical on all levels. Intended for
+ * inactive submaps, where consumers far away can use a coarse level.
+ */
+class LevelOfDetailPyramid {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Number of coarser levels to build for inactive submaps. Use 0 to not
+    // build any. Levels are limited by the voxels per side of the submap.
+    int num_levels = 0;
+
+    // A level is selected if its voxels cover at most this many pixels in the
+    // image, i.e. if the finer details would not be visible.
+    float max_pixels_per_voxel = 1.f;
+
+    Config() { setConfigName("LevelOfDetailPyramid"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  struct Level {
+    std::shared_ptr<TsdfLayer> tsdf_layer;
+    std::shared_ptr<MeshLayer> mesh_layer;
+  };
+
+  /**
+   * @brief Build all levels from a TSDF layer.
+   *
+   * @param config Number of levels and their selection.
+   * @param layer The native resolution layer to downsample.
+   * @param mesh_config Meshing of the coarse levels.
+   * @param truncation_distance Truncation distance of the layer in meters.
+   */
+  LevelOfDetailPyramid(const Config& config, const TsdfLayer& layer,
+                       const MeshIntegrator::Config& mesh_config,
+                       float truncation_distance);
+  virtual ~LevelOfDetailPyramid() = default;
+
+  // Access. Level 0 is the first coarse level with twice the voxel size.
+  size_t getNumberOfLevels() const { return levels_.size(); }
+  const Level& getLevel(size_t level) const { return levels_.at(level); }
+
+  /**
+   * @brief Select the coarsest level whose voxels do not cover more pixels
+   * than allowed.
+   *
+   * @param distance Distance of the viewer to the submap in meters.
+   * @param focal_length Focal length of the viewer in pixels.
+   * @return The selected level or -1 if the native resolution is required.
+   */
+  int selectLevel(float distance, float focal_length) const;
+
+  size_t getMemorySize() const;
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+  std::vector<Level> levels_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_LEVEL_OF_DETAIL_PYRAMID_H_
@@ -0,0 +1,82 @@
+#ifndef PANOPTIC_MAPPING_MAP_MAPPED_TSDF_LAYER_H_
+#define PANOPTIC_MAPPING_MAP_MAPPED_TSDF_LAYER_H_
+
+#include <cstdint>
+#include <string>
+
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Read-only view of a TSDF layer stored in a raw block file. The file is
+ * memory-mapped and voxels are accessed directly in the mapped memory, such
+ * that opening only reads the block table and no voxel data is deserialized
+ * or copied. Intended for read-only map consumers such as evaluation or
+ * planning servers. Files are written with 'MappedTsdfLayer::saveToFile()' and
+ * are only portable between machines of the same endianness.
+ */
+class MappedTsdfLayer {
+ public:
+  MappedTsdfLayer() = default;
+  ~MappedTsdfLayer();
+
+  MappedTsdfLayer(const MappedTsdfLayer&) = delete;
+  MappedTsdfLayer& operator=(const MappedTsdfLayer&) = delete;
+
+  /**
+   * @brief Write all blocks of a TSDF layer as raw block file.
+   *
+   * @param layer The layer to save.
+   * @param file_path Filename including full path and extension to write to.
+   * @return True if the file was written successfully.
+   */
+  static bool saveToFile(const TsdfLayer& layer, const std::string& file_path);
+
+  /**
+   * @brief Memory-map a raw block file, closing the currently mapped file.
+   *
+   * @param file_path Filename including full path and extension to map.
+   * @return True if the file was mapped and is valid.
+   */
+  bool open(const std::string& file_path);
+  void close();
+  bool isOpen() const { return data_ != nullptr; }
+
+  /**
+   * @brief Copy all blocks into a TSDF layer of the same layout, which is a
+   * plain memory copy per block.
+   *
+   * @param layer Layer to insert the blocks into. Existing blocks are replaced.
+   * @return True if the layouts match.
+   */
+  bool copyToLayer(TsdfLayer* layer) const;
+
+  // Lookup. Returns nullptr for unallocated blocks.
+  const TsdfVoxel* getBlockVoxels(const BlockIndex& index) const;
+  const TsdfVoxel* getVoxelPtrByCoordinates(const Point& coords) const;
+
+  // Properties.
+  size_t getNumberOfAllocatedBlocks() const { return blocks_.size(); }
+  void getAllAllocatedBlocks(voxblox::BlockIndexList* blocks) const;
+  size_t voxels_per_side() const { return voxels_per_side_; }
+  FloatingPoint voxel_size() const { return voxel_size_; }
+  FloatingPoint block_size() const { return block_size_; }
+
+ private:
+  // Pointers into the mapped memory.
+  voxblox::AnyIndexHashMapType<const TsdfVoxel*>::type blocks_;
+  void* data_ = nullptr;
+  size_t data_size_ = 0;
+  size_t voxels_per_side_ = 0;
+  FloatingPoint voxel_size_ = 0.f;
+  FloatingPoint voxel_size_inv_ = 0.f;
+  FloatingPoint block_size_ = 0.f;
+  FloatingPoint block_size_inv_ = 0.f;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_MAPPED_TSDF_LAYER_H_
@@ -0,0 +1,85 @@
+#ifndef PANOPTIC_MAPPING_MAP_MESH_SERVICE_H_
+#define PANOPTIC_MAPPING_MAP_MESH_SERVICE_H_
+
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Demand-driven meshing of submaps. Consumers of the meshes, such as
+ * the visualization or the approximate rendering of the tracker, request the
+ * blocks they need and only those whose TSDF changed since they were last
+ * meshed (updated(kMesh) flag) are re-meshed. Requests are processed jointly on
+ * the global thread pool within a configurable time budget, blocks that do not
+ * fit into the budget are carried over to the next call of
+ * 'processRequests()'.
+ */
+class MeshService {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Maximum time in milliseconds spent meshing per call of
+    // 'processRequests()'. Use 0 for no limit.
+    float max_meshing_time_ms = 0.f;
+
+    // Whether to use the class layer of submaps when meshing, if available.
+    bool use_class_layer = true;
+
+    Config() { setConfigName("MeshService"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit MeshService(const Config& config, bool print_config = true);
+  virtual ~MeshService() = default;
+
+  // Requests. Requesting blocks that are already current is cheap.
+  void requestBlocks(int submap_id,
+                     const voxblox::BlockIndexList& block_indices);
+  void requestSubmap(const Submap& submap);
+
+  // Request all blocks of the given submaps that are in the view frustum.
+  void requestVisibleBlocks(const SubmapCollection& submaps,
+                            const std::vector<int>& submap_ids,
+                            const Camera& camera, const Transformation& T_M_C);
+
+  /**
+   * @brief Mesh all outdated requested blocks until the time budget is used up.
+   * Blocks carried over from previous calls are meshed first. Requests of
+   * submaps that no longer exist are dropped.
+   *
+   * @param submaps Collection the requested submaps belong to.
+   * @return Number of meshed blocks.
+   */
+  size_t processRequests(SubmapCollection* submaps);
+
+  // Number of requested blocks that were not yet processed.
+  size_t getNumberOfPendingBlocks() const;
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+
+  // Requested blocks in order of their first request.
+  mutable std::mutex mutex_;
+  std::vector<std::pair<int, BlockIndex>> pending_;
+  std::unordered_map<int, voxblox::IndexSet> pending_set_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_MESH_SERVICE_H_
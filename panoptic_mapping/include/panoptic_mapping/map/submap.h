@@ -1,8 +1,11 @@
 #ifndef PANOPTIC_MAPPING_MAP_SUBMAP_H_
 #define PANOPTIC_MAPPING_MAP_SUBMAP_H_
 
+#include <array>
+#include <atomic>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -14,17 +17,73 @@
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/Submap.pb.h"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/integration/iso_surface_extractor.h"
 #include "panoptic_mapping/integration/mesh_integrator.h"
 #include "panoptic_mapping/map/classification/class_block.h"
 #include "panoptic_mapping/map/classification/class_layer.h"
 #include "panoptic_mapping/map/classification/class_voxel.h"
+#include "panoptic_mapping/map/change_feed.h"
+#include "panoptic_mapping/map/collapsed_tsdf_blocks.h"
+#include "panoptic_mapping/map/compact_iso_surface_points.h"
+#include "panoptic_mapping/map/compressed_tsdf_layer.h"
+#include "panoptic_mapping/map/indexed_mesh.h"
 #include "panoptic_mapping/map/instance_id.h"
+#include "panoptic_mapping/map/level_of_detail_pyramid.h"
 #include "panoptic_mapping/map/submap_bounding_volume.h"
 #include "panoptic_mapping/map/submap_id.h"
+#include "panoptic_mapping/map/submap_label_table.h"
+#include "panoptic_mapping/map/submap_spatial_index.h"
+#include "panoptic_mapping/map/submap_spill_file.h"
+#include "panoptic_mapping/map/voxel_mask.h"
 
 namespace panoptic_mapping {
 
 class LayerManipulator;
+struct TsdfQuantization;
+
+/**
+ * @brief Memory used by the data of a submap in bytes, split by layer type.
+ */
+struct SubmapMemoryUsage {
+  size_t tsdf = 0;  // Including compressed TSDF data.
+  size_t classification = 0;
+  size_t mesh = 0;
+  size_t iso_surface_points = 0;
+  size_t overhead = 0;  // The submap object itself.
+
+  size_t total() const {
+    return tsdf + classification + mesh + iso_surface_points + overhead;
+  }
+  SubmapMemoryUsage& operator+=(const SubmapMemoryUsage& rhs);
+};
+
+/**
+ * @brief Handle to the TSDF block and, if the submap has a class layer, the
+ * class block at the same block index, such that users look up each layer
+ * once per block.
+ */
+struct SubmapBlocks {
+  TsdfBlock::Ptr tsdf;
+  ClassBlock::Ptr classification;
+
+  explicit operator bool() const { return static_cast<bool>(tsdf); }
+};
+
+/**
+ * @brief Which data of a submap to load from a stream. Data that is not loaded
+ * is stepped over in the stream without being decoded.
+ */
+struct SubmapLoadOptions {
+  // Whether to load the class layer, if the submap has one.
+  bool load_class_layer = true;
+
+  // If set, only blocks intersecting this axis-aligned box in mission frame
+  // are loaded. Stored derived data is then ignored and needs recomputing.
+  bool use_bounding_box = false;
+  Point box_min_M = Point::Zero();
+  Point box_max_M = Point::Zero();
+};
 
 class Submap {
  public:
@@ -44,9 +103,42 @@ class Submap {
     // classification.
     config_utilities::VariableConfig<ClassLayer> classification;
 
+    // If true, class blocks are not allocated together with every TSDF block
+    // but only for blocks that lie within the truncation band of a
+    // measurement, where voxels can receive class updates. Missing class blocks
+    // are treated as unobserved, i.e. as belonging to the submap.
+    bool allocate_class_blocks_in_surface_band = false;
+
+    // If false, the integrators don't fuse color into the voxels of the
+    // submap, its mesh is not colored from the TSDF, and colors are dropped
+    // when compressing or writing quantized TSDF blocks. Visualizations then
+    // use the submap or class colors.
+    bool store_color = true;
+
     // Config of the mesh integrator.
     MeshIntegrator::Config mesh;
 
+    // Extraction of the iso-surface points.
+    IsoSurfaceExtractor::Config iso_surface;
+
+    // Compression of the TSDF layer of inactive submaps.
+    CompressedTsdfLayer::Config tsdf_compression;
+
+    // Collapsing of uniform TSDF blocks.
+    CollapsedTsdfBlocks::Config block_collapsing;
+
+    // Computation of the bounding volume.
+    SubmapBoundingVolume::Config bounding_volume;
+
+    // Coarser levels of detail built for inactive submaps.
+    LevelOfDetailPyramid::Config level_of_detail;
+
+    // Welding and decimation of the meshes of inactive submaps.
+    IndexedMesh::Config mesh_decimation;
+
+    // Quantized storage of the iso-surface points of inactive submaps.
+    CompactIsoSurfacePoints::Config iso_surface_compaction;
+
     Config() { setConfigName("Submap"); }
 
     // Utility tool that checks whether a classification layer was specified.
@@ -59,62 +151,250 @@ class Submap {
   };
 
   // Construction.
-  explicit Submap(
-      const Config& config,
-      SubmapIDManager* submap_id_manager = SubmapIDManager::getGlobalInstance(),
-      InstanceIDManager* instance_id_manager =
-          InstanceIDManager::getGlobalInstance());
+  Submap(const Config& config, SubmapIDManager* submap_id_manager,
+         InstanceIDManager* instance_id_manager);
+
+  /**
+   * @brief Construct a submap that shares its config with other submaps, which
+   * avoids copying and validating the config for every new submap.
+   *
+   * @param config Shared config, which is expected to be valid.
+   */
+  Submap(std::shared_ptr<const Config> config,
+         SubmapIDManager* submap_id_manager,
+         InstanceIDManager* instance_id_manager);
   virtual ~Submap() = default;
 
   // Const accessors.
-  const Config& getConfig() const { return config_; }
+  const Config& getConfig() const { return *config_; }
+  const std::shared_ptr<const Config>& getSharedConfig() const {
+    return config_;
+  }
   int getID() const { return id_; }
   int getInstanceID() const { return instance_id_; }
   int getClassID() const { return class_id_; }
   PanopticLabel getLabel() const { return label_; }
   const std::string& getName() const { return name_; }
   const std::string& getFrameName() const { return frame_name_; }
-  const TsdfLayer& getTsdfLayer() const { return *tsdf_layer_; }
-  const ClassLayer& getClassLayer() const { return *class_layer_; }
-  const voxblox::MeshLayer& getMeshLayer() const { return *mesh_layer_; }
+  const TsdfLayer& getTsdfLayer() const {
+    restoreLayers();
+    return *tsdf_layer_;
+  }
+  const ClassLayer& getClassLayer() const {
+    restoreLayers();
+    return *class_layer_;
+  }
+  const voxblox::MeshLayer& getMeshLayer() const {
+    restoreLayers();
+    initializeMeshing();
+    return *mesh_layer_;
+  }
+  uint64_t getMeshGeneration(const BlockIndex& block_index) const {
+    initializeMeshing();
+    return mesh_integrator_->getMeshGeneration(block_index);
+  }
   const Transformation& getT_M_S() const { return T_M_S_; }
   const Transformation& getT_S_M() const { return T_M_S_inv_; }
   bool isActive() const { return is_active_; }
+  // Inactive submaps whose deactivation is finished in the background. Their
+  // data is the one of when they were deactivated until finished.
+  bool isFinishing() const { return is_finishing_; }
   bool wasTracked() const { return was_tracked_; }
+  // NUMA node of the thread pool whose workers allocate and process the
+  // blocks of this submap, see 'ThreadPool::submitOnNode()'.
+  int getHomeNode() const { return home_node_; }
+  // Thread pool of the collection the submap belongs to.
+  ThreadPool* getThreadPool() const { return thread_pool_; }
   bool hasClassLayer() const { return has_class_layer_; }
+  bool isTsdfLayerCompressed() const {
+    return tsdf_is_compressed_.load(std::memory_order_acquire);
+  }
+  bool isEvicted() const { return is_evicted_.load(std::memory_order_acquire); }
+  // Value of the access clock when the layers of this submap were last used.
+  uint64_t getLastAccess() const { return last_access_; }
+  // Memory used by all layers and the iso-surface points in bytes.
+  size_t getMemorySize() const { return getMemoryUsage().total(); }
+  SubmapMemoryUsage getMemoryUsage() const;
+  // Full precision iso-surface points, empty if they were compacted.
   const std::vector<IsoSurfacePoint>& getIsoSurfacePoints() const {
     return iso_surface_points_;
   }
+  // Compacted iso-surface points, only available for inactive submaps if
+  // configured. Returns nullptr otherwise.
+  const CompactIsoSurfacePoints* getCompactIsoSurfacePoints() const {
+    return compact_iso_surface_points_.get();
+  }
+  // Number of iso-surface points in either representation.
+  size_t getNumberOfIsoSurfacePoints() const {
+    return compact_iso_surface_points_ ? compact_iso_surface_points_->size()
+                                       : iso_surface_points_.size();
+  }
   ChangeState getChangeState() const { return change_state_; }
   const SubmapBoundingVolume& getBoundingVolume() const {
     return bounding_volume_;
   }
-
-  // Modifying accessors.
-  std::shared_ptr<TsdfLayer>& getTsdfLayerPtr() { return tsdf_layer_; }
-  std::shared_ptr<ClassLayer>& getClassLayerPtr() { return class_layer_; }
-  std::shared_ptr<voxblox::MeshLayer>& getMeshLayerPtr() { return mesh_layer_; }
+  // Coarser levels of detail, only available for inactive submaps if
+  // configured. Returns nullptr otherwise.
+  const LevelOfDetailPyramid* getLevelOfDetail() const {
+    return level_of_detail_.get();
+  }
+  // Welded and decimated mesh, only available for inactive submaps if
+  // configured. Returns nullptr otherwise.
+  const std::shared_ptr<const IndexedMesh>& getDecimatedMesh() const {
+    return decimated_mesh_;
+  }
+  // Masks of the observed and near-surface voxels of each TSDF block.
+  const SubmapVoxelMasks& getVoxelMasks() const { return voxel_masks_; }
+
+  // Modifying accessors. Accessing the TSDF layer for modification discards the
+  // compressed data.
+  std::shared_ptr<TsdfLayer>& getTsdfLayerPtr();
+  std::shared_ptr<ClassLayer>& getClassLayerPtr() {
+    restoreLayers();
+    return class_layer_;
+  }
+  std::shared_ptr<voxblox::MeshLayer>& getMeshLayerPtr() {
+    restoreLayers();
+    initializeMeshing();
+    return mesh_layer_;
+  }
   std::vector<IsoSurfacePoint>* getIsoSurfacePointsPtr() {
     return &iso_surface_points_;
   }
   SubmapBoundingVolume* getBoundingVolumePtr() { return &bounding_volume_; }
+  SubmapVoxelMasks* getVoxelMasksPtr() { return &voxel_masks_; }
+
+  /**
+   * @brief Restore evicted or compressed layers and discard the data derived
+   * from the TSDF layer, such that the blocks can be modified. Not thread
+   * safe, this is called once per submap before blocks are updated in
+   * parallel.
+   */
+  void prepareLayersForUpdate();
+
+  /**
+   * @brief Get the TSDF and class block at the index for modification. The
+   * handle is empty if the TSDF block is not allocated. This is a plain lookup
+   * that can be called concurrently, 'prepareLayersForUpdate()' needs to be
+   * called before.
+   */
+  SubmapBlocks getBlocks(const BlockIndex& block_index);
+
+  /**
+   * @brief Get or allocate the TSDF and, if the submap has a class layer, the
+   * class block at the index, such that the block sets of the layers stay
+   * consistent. If 'allocate_class_blocks_in_surface_band' is set, only
+   * existing class blocks are returned.
+   */
+  SubmapBlocks allocateBlocks(const BlockIndex& block_index);
+
+  /**
+   * @brief Get or allocate the class block at the index for submaps that have
+   * a class layer. Class blocks are only allocated where the TSDF block
+   * exists, returns nullptr otherwise.
+   */
+  ClassBlock::Ptr allocateClassBlock(const BlockIndex& block_index);
 
   // Setters.
   void setT_M_S(const Transformation& T_M_S);
-  void setInstanceID(int id) { instance_id_ = id; }
-  void setClassID(int id) { class_id_ = id; }
+  void setInstanceID(int id);
+  void setClassID(int id);
   void setLabel(PanopticLabel label) { label_ = label; }
   void setName(const std::string& name) { name_ = name; }
   void setFrameName(const std::string& name) { frame_name_ = name; }
-  void setChangeState(ChangeState state) { change_state_ = state; }
+  void setChangeState(ChangeState state);
   void setIsActive(bool is_active) { is_active_ = is_active; }
   void setWasTracked(bool was_tracked) { was_tracked_ = was_tracked; }
+  void setHomeNode(int node) { home_node_ = node; }
+  void setThreadPool(ThreadPool* thread_pool);
 
   // Processing.
   /**
    * @brief Set the submap status to inactive and update its status accordingly.
+   *
+   * @param defer_finishing If true, only mark the submap as inactive and
+   * finishing. The remaining work of 'finishDeactivation()' is then up to the
+   * caller, e.g. on a clone via 'adoptFinishedClone()'.
+   */
+  void finishActivePeriod(bool defer_finishing = false);
+
+  /**
+   * @brief Update all quantities of a deactivated submap and build its level
+   * of detail and compressed TSDF layer if configured. This is the expensive
+   * part of 'finishActivePeriod()'.
+   */
+  void finishDeactivation();
+
+  /**
+   * @brief Replace the data of this finishing submap with the data of a clone
+   * finished via 'finishDeactivation()'. The clone is left without data. This
+   * allows finishing submaps on other threads while the map is in use.
+   *
+   * @param finished Clone of this submap taken when it was deactivated.
+   */
+  void adoptFinishedClone(Submap* finished);
+
+  /**
+   * @brief Replace the TSDF layer by its compressed representation to save
+   * memory. The layer is decompressed transparently on the next access, and
+   * compressed data is reused if the layer was not modified in the meantime.
+   * References to the TSDF layer or its blocks obtained before this call are
+   * invalidated, so this must not be called while other threads access the
+   * layer.
+   */
+  void compressTsdfLayer();
+
+  /**
+   * @brief Replace the iso-surface points by their compact representation,
+   * see 'CompactIsoSurfacePoints'. The full points are recomputed the next time
+   * the iso-surface is updated.
+   */
+  void compactIsoSurfacePoints();
+
+  /**
+   * @brief Write the TSDF, class, and mesh layers to the spill file and release
+   * them, only meta data, the bounding volume, and the iso-surface points are
+   * kept in memory. The layers are loaded back and the mesh is regenerated on
+   * the next access. The same restrictions as for 'compressTsdfLayer()' apply.
+   *
+   * @param spill_file File to write the layers to, is kept alive by the submap.
+   * @return True if the layers were evicted.
+   */
+  bool evictLayers(const std::shared_ptr<SubmapSpillFile>& spill_file);
+
+  /**
+   * @brief Remove all uniform TSDF blocks that did not change since the last
+   * call from the TSDF layer and store them collapsed, see
+   * 'CollapsedTsdfBlocks'. Blocks with class data are not collapsed. Does
+   * nothing unless enabled in the config. The same restrictions as for
+   * 'compressTsdfLayer()' apply.
+   *
+   * @return The number of collapsed blocks.
    */
-  void finishActivePeriod();
+  size_t collapseUniformBlocks();
+
+  /**
+   * @brief Expand the collapsed blocks among the given blocks into the TSDF
+   * layer. Called by the integrators before allocating blocks to update.
+   */
+  void expandCollapsedBlocks(const voxblox::IndexSet& block_indices);
+  void expandAllCollapsedBlocks();
+
+  // Collapsed TSDF blocks, nullptr if there are none.
+  const CollapsedTsdfBlocks* getCollapsedBlocks() const {
+    return collapsed_blocks_.get();
+  }
+
+  // Number of TSDF blocks including collapsed blocks.
+  size_t getNumberOfTsdfBlocks() const;
+
+  /**
+   * @brief Advance the clock used to record layer accesses, which is used to
+   * find the least recently used submaps.
+   *
+   * @return The new value of the clock.
+   */
+  static uint64_t tickAccessClock() { return ++access_clock_; }
 
   /**
    * @brief Update all dynamically computable quantities.
@@ -125,10 +405,52 @@ class Submap {
   void updateEverything(bool only_updated_blocks = true);
 
   /**
-   * @brief Update the bounding volume based on all allocated blocks.
+   * @brief Record a TSDF block whose voxels were changed, such that consumers
+   * can process only the changes since they last checked, e.g. incremental
+   * change detection. Unlike the update flags of the blocks, the record is not
+   * reset by meshing or snapshots. Thread-safe.
+   */
+  void recordChangedBlock(const BlockIndex& index);
+
+  // Report allocated or removed blocks to the change feed of the owning
+  // collection if set. Blocks allocated via 'allocateBlocks()' are reported
+  // automatically.
+  void recordCreatedBlock(const BlockIndex& index);
+  void recordRemovedBlock(const BlockIndex& index);
+  bool hasChangeFeed() const {
+    return change_feed_ && change_feed_->hasSubscribers();
+  }
+
+  // Independent consumers of the changed block record.
+  enum class ChangeConsumer {
+    kChangeDetection = 0,
+    kEsdf,
+    kVisualization,
+    kPlanningVisualization,
+    kBlockCollapsing,
+    kNumConsumers
+  };
+
+  // Get and clear all blocks recorded since the last call of the consumer.
+  voxblox::IndexSet takeChangedBlocks(
+      ChangeConsumer consumer = ChangeConsumer::kChangeDetection);
+
+  /**
+   * @brief Update the bounding volume based on all allocated blocks. Also
+   * updates the spatial index of the owning collection if set.
    */
   void updateBoundingVolume();
 
+  /**
+   * @brief Expand the bounding volume to contain newly allocated blocks, which
+   * is cheaper than 'updateBoundingVolume()' since it does not visit all
+   * blocks. Also updates the spatial index of the owning collection if set.
+   *
+   * @param new_blocks Indices of all blocks allocated since the last update.
+   * May include blocks that existed before.
+   */
+  void updateBoundingVolume(const voxblox::IndexSet& new_blocks);
+
   /**
    * @brief Update the mesh based on the current tsdf blocks. Set
    * only_updated_blocks true for incremental mesh updates, false for a full
@@ -141,15 +463,54 @@ class Submap {
    */
   void updateMesh(bool only_updated_blocks = true, bool use_class_layer = true);
 
+  /**
+   * @brief Split version of 'updateMesh()' to mesh many submaps jointly, see
+   * 'SubmapCollection::updateMeshes()'. Needs to be called sequentially.
+   *
+   * @return Indices of the blocks to mesh with 'updateMeshBlock()'.
+   */
+  voxblox::BlockIndexList prepareMeshUpdate(bool only_updated_blocks = true,
+                                            bool use_class_layer = true);
+  // Prepare the update of only those of the given blocks whose mesh is
+  // outdated.
+  voxblox::BlockIndexList prepareMeshUpdate(
+      const voxblox::BlockIndexList& block_indices,
+      bool use_class_layer = true);
+
+  // Mesh a block returned by 'prepareMeshUpdate()'. Thread-safe for different
+  // blocks.
+  bool updateMeshBlock(const BlockIndex& block_index);
+
+  /**
+   * @brief Take over block meshes that were generated outside of the submap,
+   * e.g. by the 'BackgroundMesher', and assign them a new generation.
+   *
+   * @param meshes Layer containing the meshes, which are swapped out.
+   * @param block_indices Blocks to take the meshes of.
+   * @return Number of updated block meshes.
+   */
+  size_t setMeshBlocks(voxblox::MeshLayer* meshes,
+                       const voxblox::BlockIndexList& block_indices);
+
   /**
    * @brief Compute the iso-surface points of the submap based on its current
    * mesh. Currently all surface points are computed from scratch every time,
    * but since they are currently only computed when a submap is finished it
-   * should be fine. This function utilizes the stored mesh so make sure
-   * updateMesh is called earlier.
+   * should be fine. This function utilizes the stored mesh and updates all
+   * outdated mesh blocks first.
    */
   void computeIsoSurfacePoints();
 
+  /**
+   * @brief Update the iso-surface points by extracting them directly from the
+   * TSDF, see 'IsoSurfaceExtractor'. Does not require a mesh and runs in
+   * parallel over blocks.
+   *
+   * @param only_updated_blocks If true, only re-extract the blocks flagged
+   * updated(kIsoSurfaceUpdateFlag) and their neighbors, otherwise extract all.
+   */
+  void updateIsoSurfacePoints(bool only_updated_blocks = true);
+
   /**
    * @brief Removes non-belonging points from the TSDF and deletes the class
    * layer. Uses the provided manipulator to perform the class layer
@@ -159,10 +520,30 @@ class Submap {
    * of the class layer.
    * @param clear_class_layer True: erase the class layer. False: keep the class
    * layer for lookups, but no further manipulations.
+   * @param update_submap False: skip 'updateEverything()', e.g. to update many
+   * submaps jointly afterwards.
    * @return True if any blocks remain, false if the TSDF map was cleared.
    */
   bool applyClassLayer(const LayerManipulator& manipulator,
-                       bool clear_class_layer = true);
+                       bool clear_class_layer = true,
+                       bool update_submap = true);
+
+  /**
+   * @brief Resample the TSDF and class layers to a different voxel size and
+   * adopt a copy of the config with this voxel size. The truncation distance
+   * is scaled to cover the same number of voxels. All data derived from the
+   * layers, such as meshes, levels of detail, and compressed data, is
+   * discarded and recomputed on demand.
+   *
+   * @param manipulator Manipulator used to interpolate the layers.
+   * @param voxel_size New voxel size in meters.
+   * @param update_submap False: skip 'updateEverything()', e.g. if the submap
+   * is finished afterwards.
+   * @return True if the layers were resampled, false if the voxel size did not
+   * change.
+   */
+  bool revoxelize(const LayerManipulator& manipulator, float voxel_size,
+                  bool update_submap = true);
 
   /**
    * @brief Create a deep copy of the submap. Notice that new submapID and
@@ -178,18 +559,74 @@ class Submap {
   std::unique_ptr<Submap> clone(SubmapIDManager* submap_id_manager,
                                 InstanceIDManager* instance_id_manager) const;
 
+  /**
+   * @brief Create a copy-on-write snapshot of the submap for read-only access.
+   * Only blocks that changed since the previous snapshot are copied, all other
+   * blocks are shared with the previous snapshot. Changes are tracked using the
+   * kMap update flag of the TSDF blocks, which is reset by this function.
+   *
+   * @param previous Previous snapshot of this submap, can be nullptr.
+   * @param submap_id_manager Pointer to the submapID manager of the snapshot.
+   * @param instance_id_manager Pointer to the instanceID manager of the
+   * snapshot.
+   * @return Unique pointer holding the snapshot.
+   */
+  std::unique_ptr<Submap> snapshot(const Submap* previous,
+                                   SubmapIDManager* submap_id_manager,
+                                   InstanceIDManager* instance_id_manager);
+
  private:
   friend class SubmapCollection;
-  const Config config_;
+  // Only replaced by 'revoxelize()' and when adopting a re-voxelized clone.
+  std::shared_ptr<const Config> config_;
 
   // This constructor is intended to allow deep copies of the submap collection,
-  // moving the id to the new id managers.
-  Submap(const Config& config, SubmapIDManager* submap_id_manager,
+  // moving the id to the new id managers. The layers are not set up and need
+  // to be set by the caller.
+  Submap(std::shared_ptr<const Config> config,
+         SubmapIDManager* submap_id_manager,
          InstanceIDManager* instance_id_manager, int submap_id);
 
+  // This constructor assigns the IDs but defers setting up the layers to
+  // 'initialize()', such that batches of submaps can be initialized in
+  // parallel while their IDs are assigned in a deterministic order.
+  struct DeferInitialization {};
+  Submap(std::shared_ptr<const Config> config,
+         SubmapIDManager* submap_id_manager,
+         InstanceIDManager* instance_id_manager, DeferInitialization);
+
   // Setup.
   void initialize();
 
+  // The mesh layer and integrator are only created when the submap is first
+  // meshed, since many short-lived submaps are never meshed.
+  void initializeMeshing() const;
+
+  // Copy the mesh to another submap with identical layers if it was set up.
+  // Unchanged block meshes of a previous copy of this submap are shared.
+  void copyMeshTo(Submap* other, const Submap* previous = nullptr) const;
+
+  // Propagate the bounding volume in mission frame to the spatial index.
+  void updateSpatialIndex() const;
+
+  // Copy all meta data that is not stored in the layers.
+  void copyMembersTo(Submap* other) const;
+
+  // Record the access and load evicted or compressed layers if necessary.
+  // The flags are only cleared by 'loadLayers()' after the layers were
+  // loaded, so the acquire loads make the loaded layers visible.
+  void restoreLayers() const {
+    const uint64_t now = access_clock_.load(std::memory_order_relaxed);
+    if (last_access_.load(std::memory_order_relaxed) != now) {
+      last_access_.store(now, std::memory_order_relaxed);
+    }
+    if (is_evicted_.load(std::memory_order_acquire) ||
+        tsdf_is_compressed_.load(std::memory_order_acquire)) {
+      loadLayers();
+    }
+  }
+  void loadLayers() const;
+
   // IO.
   /**
    * @brief Serialize the submap to protobuf.
@@ -202,9 +639,19 @@ class Submap {
    * @brief Save the submap to file.
    *
    * @param outfile_ptr The file to write the protobuf data to.
+   * @param include_derived_data If true, also store the mesh, iso-surface
+   * points, and bounding volume if they are up to date, such that loading can
+   * skip recomputing them.
    * @return Success of the saving operation.
    */
-  bool saveToStream(std::fstream* outfile_ptr) const;
+  bool saveToStream(std::fstream* outfile_ptr,
+                    bool include_derived_data = false) const;
+
+  /**
+   * @brief Hash of the voxel layout and the content of the TSDF and class
+   * layers. Used to verify that stored derived data belongs to the layers.
+   */
+  uint64_t computeContentHash() const;
 
   /**
    * @brief Load the submap from file.
@@ -217,13 +664,94 @@ class Submap {
    * into.
    * @param instance_manager Instance ID manager of the collection to laod the
    * submap into.
+   * @param loaded_derived_data Optional output whether stored derived data was
+   * applied, in which case it does not need to be recomputed.
+   * @param options Which data of the submap to load.
    * @return Unique pointer to the loaded submap.
    */
   static std::unique_ptr<Submap> loadFromStream(
       std::istream* proto_file_ptr, uint64_t* tmp_byte_offset_ptr,
-      SubmapIDManager* id_manager = SubmapIDManager::getGlobalInstance(),
-      InstanceIDManager* instance_manager =
-          InstanceIDManager::getGlobalInstance());
+      SubmapIDManager* id_manager, InstanceIDManager* instance_manager,
+      bool* loaded_derived_data = nullptr,
+      const SubmapLoadOptions& options = SubmapLoadOptions());
+
+  /**
+   * @brief The two stages of 'loadFromStream()'. Creating the submap from its
+   * header assigns IDs and is not thread safe, loading the layers of different
+   * submaps can run in parallel.
+   *
+   * @param submap_proto Header of the submap as read from the stream.
+   * @param id_manager Submap ID manager of the collection to load the submap
+   * into.
+   * @param instance_manager Instance ID manager of the collection to load the
+   * submap into.
+   * @return Unique pointer to the new submap without data.
+   */
+  static std::unique_ptr<Submap> createFromProto(
+      const SubmapProto& submap_proto, SubmapIDManager* id_manager,
+      InstanceIDManager* instance_manager);
+
+  /**
+   * @brief Load the TSDF and class blocks that follow the header in the stream.
+   *
+   * @param submap_proto Header of the submap created by 'createFromProto()'.
+   * @param proto_file_ptr Stream to read from.
+   * @param tmp_byte_offset_ptr Byte offset of the first block, is advanced
+   * past the data of this submap.
+   * @param loaded_derived_data Optional output whether stored derived data
+   * matched the loaded layers and was applied, such that it does not need to
+   * be recomputed.
+   * @param options Which data of the submap to load.
+   * @return True if all blocks were read.
+   */
+  bool loadLayersFromStream(
+      const SubmapProto& submap_proto, std::istream* proto_file_ptr,
+      uint64_t* tmp_byte_offset_ptr, bool* loaded_derived_data = nullptr,
+      const SubmapLoadOptions& options = SubmapLoadOptions());
+
+  // Set all meta data stored in the submap header.
+  void applyProto(const SubmapProto& submap_proto);
+
+  // Store and load the derived data, see 'saveToStream()'.
+  bool hasUpToDateDerivedData() const;
+  bool saveDerivedDataToStream(std::ostream* outfile_ptr) const;
+  bool loadDerivedDataFromStream(std::istream* proto_file_ptr,
+                                 uint64_t* tmp_byte_offset_ptr, bool* applied);
+  static bool skipDerivedDataFromStream(std::istream* proto_file_ptr,
+                                        uint64_t* tmp_byte_offset_ptr);
+
+  /**
+   * @brief Save the submap header followed by only the given TSDF blocks and
+   * the class blocks at the same indices. Used for incremental checkpoints
+   * and streaming.
+   *
+   * @param block_indices Blocks to save, need to exist in the TSDF layer or be
+   * collapsed. Collapsed blocks are written expanded.
+   * @param outfile_ptr The stream to write the protobuf data to.
+   * @param quantization If set, TSDF blocks are written quantized, see
+   * 'encodeTsdfBlock()'.
+   * @return Success of the saving operation.
+   */
+  bool saveBlocksToStream(const voxblox::BlockIndexList& block_indices,
+                          std::ostream* outfile_ptr,
+                          const TsdfQuantization* quantization = nullptr) const;
+
+  /**
+   * @brief Apply data written by 'saveBlocksToStream()', replacing the meta
+   * data and all contained blocks of this submap.
+   *
+   * @param updated_blocks Optional output of the indices of all loaded TSDF
+   * blocks.
+   * @return True if all blocks were loaded.
+   */
+  bool applyUpdateFromStream(const SubmapProto& submap_proto,
+                             std::istream* proto_file_ptr,
+                             uint64_t* tmp_byte_offset_ptr,
+                             voxblox::BlockIndexList* updated_blocks = nullptr);
+
+  // Whether two snapshots of the same submap refer to the same layer data,
+  // including compressed or evicted data.
+  bool sharesDataWith(const Submap& other) const;
 
   // Labels.
   const SubmapID id_;       // UUID
@@ -234,9 +762,12 @@ class Submap {
 
   // State.
   bool is_active_ = true;
+  bool is_finishing_ = false;
   bool was_tracked_ = true;  // Set to true by the id tracker if matched.
   bool has_class_layer_ = false;
   ChangeState change_state_ = ChangeState::kNew;
+  int home_node_ = 0;
+  ThreadPool* thread_pool_ = ThreadPool::getGlobalInstance();
 
   // Transformations.
   std::string frame_name_;
@@ -246,12 +777,55 @@ class Submap {
   // Map.
   std::shared_ptr<TsdfLayer> tsdf_layer_;
   std::shared_ptr<ClassLayer> class_layer_;
-  std::shared_ptr<voxblox::MeshLayer> mesh_layer_;
+  mutable std::shared_ptr<voxblox::MeshLayer> mesh_layer_;
   std::vector<IsoSurfacePoint> iso_surface_points_;
+  // Iso-surface points per block if extracted from the TSDF.
+  voxblox::AnyIndexHashMapType<std::vector<IsoSurfacePoint>>::type
+      iso_surface_blocks_;
+  // Quantized iso-surface points of inactive submaps, never modified and thus
+  // shared between clones and snapshots.
+  std::shared_ptr<const CompactIsoSurfacePoints> compact_iso_surface_points_;
   SubmapBoundingVolume bounding_volume_;
+  SubmapVoxelMasks voxel_masks_;
+  SubmapSpatialIndex* spatial_index_ = nullptr;  // Set by the collection.
+  SubmapLabelTable* label_table_ = nullptr;       // Set by the collection.
+  ChangeFeed* change_feed_ = nullptr;              // Set by the collection.
+  std::array<voxblox::IndexSet,
+             static_cast<size_t>(ChangeConsumer::kNumConsumers)>
+      changed_blocks_;
+  std::mutex changed_blocks_mutex_;
+
+  // Compressed TSDF data, which is never modified and thus shared between
+  // clones and snapshots. If set, the TSDF layer only holds blocks while it is
+  // decompressed.
+  std::shared_ptr<const CompressedTsdfLayer> compressed_tsdf_layer_;
+  mutable std::atomic<bool> tsdf_is_compressed_{false};
+  mutable std::mutex layer_mutex_;
+
+  // Levels of detail of inactive submaps, shared like the compressed data.
+  std::shared_ptr<const LevelOfDetailPyramid> level_of_detail_;
+
+  // Decimated mesh of inactive submaps, shared like the levels of detail.
+  std::shared_ptr<const IndexedMesh> decimated_mesh_;
+
+  // Uniform blocks removed from the TSDF layer, never modified and thus
+  // shared between clones and snapshots.
+  std::shared_ptr<const CollapsedTsdfBlocks> collapsed_blocks_;
+
+  // Evicted layers are stored in the spill file.
+  std::shared_ptr<SubmapSpillFile> spill_file_;
+  uint64_t spill_offset_ = 0;
+  mutable std::atomic<bool> is_evicted_{false};
+  mutable std::atomic<uint64_t> last_access_{0};
+  static std::atomic<uint64_t> access_clock_;
+
+  // Snapshots remember their source to only reuse data of the same submap.
+  std::weak_ptr<TsdfLayer> snapshot_source_;
 
   // Processing.
-  std::unique_ptr<MeshIntegrator> mesh_integrator_;
+  mutable std::unique_ptr<MeshIntegrator> mesh_integrator_;
+  mutable std::atomic<bool> has_meshing_{false};
+  mutable std::mutex meshing_mutex_;
 };
 
 }  // namespace panoptic_mapping
@@ -1,6 +1,11 @@
 #ifndef PANOPTIC_MAPPING_MAP_SUBMAP_BOUNDING_VOLUME_H_
 #define PANOPTIC_MAPPING_MAP_SUBMAP_BOUNDING_VOLUME_H_
 
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
 
 namespace panoptic_mapping {
@@ -9,16 +14,51 @@ class Submap;
 
 /**
  * This class interfaces conservative bounding volumes to hierarchically
- * prune submaps. Implemented using an inexact conservative sphere
- * approximation. The bounding volume is owned by the submap it references.
+ * prune submaps. Implemented using a conservative sphere around all allocated
+ * blocks. The sphere is expanded incrementally when blocks are allocated and
+ * only recomputed from scratch when it became loose, i.e. after the number of
+ * blocks doubled or a quarter of them was removed. The bounding volume is owned
+ * by the submap it references.
  */
 class SubmapBoundingVolume {
  public:
+  struct Config : public config_utilities::Config<Config> {
+    // If true, recomputations find the exact minimum sphere enclosing all
+    // block centers. Otherwise the sphere is centered on the grid-aligned
+    // bounding box, which is faster but generally a significant
+    // over-estimation.
+    bool use_miniball = false;
+
+    Config() { setConfigName("SubmapBoundingVolume"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+  };
+
   explicit SubmapBoundingVolume(const Submap& submap);
   ~SubmapBoundingVolume() = default;
 
   // Interaction.
+  /**
+   * @brief Update the volume if the number of allocated blocks changed. Added
+   * blocks that were not passed to 'expand()' cause a recomputation, removed
+   * blocks only shrink the volume once a quarter of them was removed.
+   */
   void update();
+
+  /**
+   * @brief Expand the volume to contain the given blocks, which are expected
+   * to be allocated. Blocks that are already contained are cheap to pass.
+   */
+  void expand(const voxblox::IndexSet& block_indices);
+
+  // Copy the volume of another submap with identical TSDF blocks.
+  void copyFrom(const SubmapBoundingVolume& other);
+
+  // Set a volume that is known to contain all current blocks, e.g. when it
+  // was stored with the submap.
+  void set(const Point& center, FloatingPoint radius,
+           FloatingPoint center_radius);
   bool contains_S(const Point& point_S) const;
   bool contains_M(const Point& point_M) const;
   bool intersects(const SubmapBoundingVolume& other) const;
@@ -28,12 +68,21 @@ class SubmapBoundingVolume {
   // Access.
   FloatingPoint getRadius() const { return radius_; }
   const Point& getCenter() const { return center_; }
+  FloatingPoint getCenterRadius() const { return center_radius_; }
 
  private:
+  // Recompute the volume from all allocated blocks.
+  void recompute();
+
+  // Grow the sphere of the block centers to contain a block center.
+  void addBlockCenter(const Point& block_center);
+
   const Submap* const submap_;
   Point center_;  // This is in submap frame.
   FloatingPoint radius_;
+  FloatingPoint center_radius_;  // Radius of the sphere of the block centers.
   size_t num_previous_blocks_;
+  size_t num_recomputed_blocks_;  // Number of blocks at the last recompute.
 };
 
 }  // namespace panoptic_mapping
@@ -1,6 +1,8 @@
 #ifndef PANOPTIC_MAPPING_MAP_SUBMAP_COLLECTION_H_
 #define PANOPTIC_MAPPING_MAP_SUBMAP_COLLECTION_H_
 
+#include <map>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -9,10 +11,76 @@
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/change_feed.h"
 #include "panoptic_mapping/map/submap.h"
+#include "panoptic_mapping/map/submap_label_table.h"
+#include "panoptic_mapping/map/submap_spatial_index.h"
 
 namespace panoptic_mapping {
 
+class MapCheckpointProto;
+class SubmapIndexEntryProto;
+struct TsdfQuantization;
+
+/**
+ * @brief Correspondence of the IDs of a source collection, e.g. of a streaming
+ * robot, to the IDs of its submaps ingested into another collection. See
+ * 'SubmapCollection::applyCheckpointFromStream()'.
+ */
+struct SourceIDMap {
+  std::unordered_map<int, int> submap_ids;    // Source to local SubmapID.
+  std::unordered_map<int, int> instance_ids;  // Source to local InstanceID.
+};
+
+/**
+ * @brief Subset of the submaps written to a checkpoint, e.g. to split the map
+ * into several streams. See 'SubmapCollection::saveCheckpointToStream()'.
+ */
+struct CheckpointSelection {
+  // Submaps to write.
+  std::unordered_set<int> submap_ids;
+
+  // Submaps written by the previous checkpoint. Selected submaps that were not
+  // are written completely.
+  std::unordered_set<int> previous_submap_ids;
+};
+
+/**
+ * @brief Which submaps and layers of a saved map to load, e.g. for read-only
+ * consumers that only need parts of the map. See
+ * 'SubmapCollection::loadFromFile()'.
+ */
+struct MapLoadOptions {
+  // Labels and ClassIDs of the submaps to load, empty to load all. Filtering
+  // submaps requires an indexed map file.
+  std::vector<PanopticLabel> labels;
+  std::vector<int> class_ids;
+
+  // Layers and region to load of every submap. If a bounding box is set,
+  // submaps without blocks in it are not loaded.
+  SubmapLoadOptions layers;
+
+  // Whether to recompute the derived data that was not stored in the file. If
+  // 'recompute_meshes' is false only the bounding volumes are recomputed.
+  bool recompute_data = true;
+  bool recompute_meshes = true;
+};
+
+/**
+ * @brief Memory used by all submaps of a collection in bytes, aggregated over
+ * all submaps, per panoptic label, and per submap.
+ */
+struct CollectionMemoryUsage {
+  SubmapMemoryUsage total;
+  std::map<PanopticLabel, SubmapMemoryUsage> per_label;
+  std::map<int, SubmapMemoryUsage> per_submap;  // By SubmapID.
+  int num_submaps = 0;
+  int num_evicted_submaps = 0;
+
+  // Summary table in MB per label and layer type.
+  std::string toString() const;
+};
+
 /***
  * @brief This class contains and manages access to all submaps. It represents
  * the full map consisting of all submaps.
@@ -26,12 +94,18 @@ class SubmapCollection {
 
   // IO.
   /**
-   * @brief Save the current map to disk (.panmap file).
+   * @brief Save the current map to disk (.panmap file). The file ends with an
+   * index of the byte range and bounding sphere of every submap, such that
+   * submaps can be loaded in parallel or selectively.
    *
    * @param file_path Filename including full path and extension to save to.
+   * @param include_derived_data If true, also store the up to date meshes,
+   * iso-surface points, and bounding volumes of the submaps, such that they
+   * don't need to be recomputed when loading the map.
    * @return True if the map was saved successfully.
    */
-  bool saveToFile(const std::string& file_path) const;
+  bool saveToFile(const std::string& file_path,
+                  bool include_derived_data = false) const;
 
   /**
    * @brief Load a saved map (.panmap file) from disk, overwriting the current
@@ -39,11 +113,108 @@ class SubmapCollection {
    *
    * @param file_path Filename including full path and extension to load.
    * @param recompute_data Whether to recompute all derived qualities (such as
-   * meshes, bounding volumes, ...) for loaded map.
+   * meshes, bounding volumes, ...) for loaded map. Submaps whose derived data
+   * was stored in the file and matches their layers are not recomputed.
    * @return True if the map was loaded successfully.
    */
   bool loadFromFile(const std::string& file_path, bool recompute_data = true);
 
+  /**
+   * @brief Load the selected submaps and layers of a saved map, overwriting
+   * the current content of the submap collection. Data that is not selected is
+   * stepped over without being decoded.
+   *
+   * @param file_path Filename including full path and extension to load.
+   * @param options Which submaps and layers to load.
+   * @return True if the map was loaded successfully.
+   */
+  bool loadFromFile(const std::string& file_path,
+                    const MapLoadOptions& options);
+
+  /**
+   * @brief Load only the given submaps of a saved map, overwriting the current
+   * content of the submap collection. Requires an indexed map file.
+   *
+   * @param file_path Filename including full path and extension to load.
+   * @param submap_ids SubmapIDs of the submaps to load as they were saved.
+   * Loaded submaps are assigned new IDs.
+   * @param recompute_data Whether to recompute all derived qualities.
+   * @return True if the map was loaded successfully.
+   */
+  bool loadSubmapsFromFile(const std::string& file_path,
+                           const std::vector<int>& submap_ids,
+                           bool recompute_data = true);
+
+  /**
+   * @brief Load only the submaps of a saved map whose bounding volume
+   * intersects a sphere, overwriting the current content of the submap
+   * collection. Requires an indexed map file.
+   *
+   * @param file_path Filename including full path and extension to load.
+   * @param center_M Center of the query sphere in mission frame.
+   * @param radius Radius of the query sphere in meters.
+   * @param recompute_data Whether to recompute all derived qualities.
+   * @return True if the map was loaded successfully.
+   */
+  bool loadSubmapsInRegionFromFile(const std::string& file_path,
+                                   const Point& center_M, FloatingPoint radius,
+                                   bool recompute_data = true);
+
+  /**
+   * @brief Append a checkpoint of this collection, usually a snapshot, to a
+   * checkpoint file. Only submaps and blocks that changed since the previous
+   * checkpoint are written. Changes are found by comparing to the previous
+   * snapshot, with which all unchanged blocks are shared.
+   *
+   * @param previous Collection written in the previous checkpoint of the file,
+   * nullptr to write all submaps.
+   * @param sequence_number Number of the checkpoint in the file.
+   * @param outfile_ptr The stream to append the checkpoint to.
+   * @param quantization If set, TSDF blocks are written quantized, see
+   * 'encodeTsdfBlock()'.
+   * @param selection If set, only the selected submaps are written and listed
+   * in the checkpoint.
+   * @return True if the checkpoint was written successfully.
+   */
+  bool saveCheckpointToStream(
+      const SubmapCollection* previous, uint64_t sequence_number,
+      std::ostream* outfile_ptr, const TsdfQuantization* quantization = nullptr,
+      const CheckpointSelection* selection = nullptr) const;
+
+  /**
+   * @brief Apply a single checkpoint written by 'saveCheckpointToStream()' to
+   * the collection without reloading it, e.g. to ingest streamed submaps.
+   * Submaps and instances are tracked by their ID at the source, such that
+   * the submaps of several sources can be aggregated in one collection. Only
+   * submaps registered in the ID map are modified or removed.
+   *
+   * @param checkpoint_proto Header of the checkpoint as read from the stream.
+   * @param proto_file_ptr Stream to read the submap updates from.
+   * @param tmp_byte_offset_ptr Byte offset, is advanced past the checkpoint.
+   * @param id_map IDs of the source, updated with all created and removed
+   * submaps.
+   * @param updated_blocks Optional output of the loaded TSDF blocks per
+   * SubmapID in this collection.
+   * @return True if the checkpoint was applied completely. Otherwise the
+   * submap updates before the failure remain applied.
+   */
+  bool applyCheckpointFromStream(
+      const MapCheckpointProto& checkpoint_proto, std::istream* proto_file_ptr,
+      uint64_t* tmp_byte_offset_ptr, SourceIDMap* id_map,
+      std::unordered_map<int, voxblox::BlockIndexList>* updated_blocks =
+          nullptr);
+
+  /**
+   * @brief Load the state of the latest complete checkpoint of a checkpoint
+   * file, overwriting the current content of the submap collection.
+   *
+   * @param file_path Filename including full path and extension to load.
+   * @param recompute_data Whether to recompute all derived qualities.
+   * @return True if at least one checkpoint was loaded.
+   */
+  bool loadFromCheckpointFile(const std::string& file_path,
+                              bool recompute_data = true);
+
   // Modifying the collection.
   /**
    * @brief Create a new submap and add it to the collection. This is the only
@@ -55,13 +226,64 @@ class SubmapCollection {
   Submap* createSubmap(const Submap::Config& config);
 
   /**
-   * @brief Remove a submap from the collection.
+   * @brief Create a new submap that shares its config with other submaps,
+   * which is cheaper if many submaps of the same config are created.
+   *
+   * @param config Shared config of the submap to create, expected to be valid.
+   * @return Pointer to the newly created submap.
+   */
+  Submap* createSubmap(std::shared_ptr<const Submap::Config> config);
+
+  /**
+   * @brief Create a batch of new submaps. The IDs are assigned in the order of
+   * the configs and the submaps are set up in parallel, which is cheaper than
+   * creating many submaps one at a time.
+   *
+   * @param configs Shared configs of the submaps to create, expected to be
+   * valid.
+   * @return Pointers to the newly created submaps, in the order of the configs.
+   */
+  std::vector<Submap*> createSubmaps(
+      const std::vector<std::shared_ptr<const Submap::Config>>& configs);
+
+  /**
+   * @brief Reserve the storage for a number of submaps, such that adding them
+   * does not reallocate the collection.
+   */
+  void reserve(size_t num_submaps);
+
+  /**
+   * @brief Remove a submap from the collection in amortized constant time. The
+   * slot of the submap is freed and the slots are compacted once more than
+   * half of them are free, keeping the iteration order of all other submaps.
    *
    * @param id SubmapID of the submap to be deleted.
    * @return True if the submap existed and was deleted.
    */
   bool removeSubmap(int id);
 
+  /**
+   * @brief Remove multiple submaps from the collection, compacting the slots in
+   * a single pass afterwards.
+   *
+   * @param ids SubmapIDs of the submaps to be deleted.
+   * @return Number of submaps that existed and were deleted.
+   */
+  size_t removeSubmaps(const std::vector<int>& ids);
+
+  /**
+   * @brief Apply corrected poses to many submaps at once, e.g. after a loop
+   * closure of a SLAM backend. The spatial index is updated in a single pass
+   * and the generation changes only once. Derived data in submap frame, such
+   * as bounding volumes, meshes, and the ESDF, stays valid. Consumers of
+   * relative poses between submaps compare them to detect the change.
+   *
+   * @param T_M_S New transforms from submap to mission frame per SubmapID.
+   * SubmapIDs that do not exist are ignored.
+   * @return Number of submaps whose pose changed.
+   */
+  size_t setSubmapPoses(const std::unordered_map<int, Transformation>& T_M_S);
+
   /**
    * @brief Remove all submaps contained in the collection. Also resets the
    * SubmapID and InstanceID trackers.
@@ -69,7 +291,7 @@ class SubmapCollection {
   void clear();
 
   // Access.
-  size_t size() const { return submaps_.size(); }
+  size_t size() const { return num_submaps_; }
   /**
    * @brief Whether the submap of given ID exists.
    *
@@ -95,10 +317,57 @@ class SubmapCollection {
   Submap* getSubmapPtr(int id);
 
   int getActiveFreeSpaceSubmapID() const { return active_freespace_submap_id_; }
+  // The submaps of each instance, kept up to date with all changes.
   const std::unordered_map<int, std::unordered_set<int>>&
   getInstanceToSubmapIDTable() const {
-    return instance_to_submap_ids_;
+    return label_table_->getInstanceToSubmapIDs();
   }
+  const SubmapLabelTable& getLabelTable() const { return *label_table_; }
+
+  /**
+   * @brief Find all submaps whose bounding volume intersects a sphere using the
+   * spatial index of the collection.
+   *
+   * @param center_M Center of the query sphere in mission frame.
+   * @param radius Radius of the query sphere in meters. Use 0 to look up all
+   * submaps whose bounding volume contains the center point.
+   * @return IDs of all intersecting submaps in the iteration order of the
+   * collection.
+   */
+  std::vector<int> findSubmapsIntersecting(const Point& center_M,
+                                           FloatingPoint radius) const;
+
+  /**
+   * @brief Generation of the collection, which changes whenever submaps are
+   * added, removed, moved, or change their extent, and when blocks are removed
+   * by the map management. Used to invalidate cached lookups.
+   */
+  uint64_t getGeneration() const { return spatial_index_->getGeneration(); }
+  void incrementGeneration() { spatial_index_->incrementGeneration(); }
+
+  /**
+   * @brief Report all changes of the collection and its submaps to a change
+   * feed. All submaps already in the collection are reported as created,
+   * without listing their blocks.
+   *
+   * @param change_feed Feed to report to, nullptr to stop reporting.
+   */
+  void setChangeFeed(std::shared_ptr<ChangeFeed> change_feed);
+  ChangeFeed* getChangeFeed() const { return change_feed_.get(); }
+
+  /**
+   * @brief Set the thread pool that processes the submaps of this collection,
+   * usually the one of the Globals of the mapper that owns it. Defaults to the
+   * global thread pool. Clones and snapshots use the same thread pool.
+   */
+  void setThreadPool(ThreadPool* thread_pool);
+  ThreadPool* getThreadPool() const { return thread_pool_; }
+
+  /**
+   * @brief Compute the memory used by all submaps, split by layer type. This
+   * does not restore the layers of evicted or compressed submaps.
+   */
+  CollectionMemoryUsage computeMemoryUsage() const;
 
   // Setters.
   void setActiveFreeSpaceSubmapID(int id) { active_freespace_submap_id_ = id; }
@@ -110,8 +379,18 @@ class SubmapCollection {
   void updateIDList(const std::vector<int>& id_list, std::vector<int>* new_ids,
                     std::vector<int>* deleted_ids) const;
 
-  // Update the list of contained submaps for each instance.
-  void updateInstanceToSubmapIDTable();
+  /**
+   * @brief Update the meshes of multiple submaps. The blocks to mesh of all
+   * submaps are gathered into a single task list that is processed on the
+   * thread pool, which avoids the per-submap overhead for many small submaps.
+   * See 'Submap::updateMesh()' for the arguments.
+   */
+  static void updateMeshes(const std::vector<Submap*>& submaps,
+                           ThreadPool* thread_pool,
+                           bool only_updated_blocks = true,
+                           bool use_class_layer = true);
+  void updateMeshes(bool only_updated_blocks = true,
+                    bool use_class_layer = true);
 
   // Creates a deep copy of all submaps, with new submap and instance id
   // managers. The submap ids may diverge when new submaps are added after
@@ -119,6 +398,16 @@ class SubmapCollection {
   // fused back to the original collection.
   std::unique_ptr<SubmapCollection> clone() const;
 
+  /**
+   * @brief Create a copy-on-write snapshot of all submaps for read-only access.
+   * Submaps and blocks that did not change since the previous snapshot are
+   * shared with it, only changed blocks are copied. See 'Submap::snapshot()'.
+   *
+   * @param previous The previous snapshot of this collection, can be nullptr.
+   * @return The new snapshot.
+   */
+  std::unique_ptr<SubmapCollection> snapshot(const SubmapCollection* previous);
+
   /**
    * @brief Creates a filename that matches the map file extension (.panmap) if
    * that's not already the case.
@@ -129,28 +418,84 @@ class SubmapCollection {
   static std::string checkMapFileExtension(const std::string& file);
 
  private:
+  // Version of the written map files. Version 1 files have no index.
+  static constexpr int kMapFileVersion = 2;
+  using IndexFilter = std::function<bool(const SubmapIndexEntryProto&)>;
+
+  // Append a submap to the slots and register it with the lookup tables and
+  // the spatial index.
+  Submap* appendSubmap(std::unique_ptr<Submap> submap);
+  void addToSpatialIndex(Submap* submap);
+  void assignHomeNode(Submap* submap) const;
+
+  // Free the slot of a submap without compacting.
+  bool releaseSubmap(int id);
+
+  // Move all submaps to the front of the slots, keeping their order.
+  void compact();
+
+  // Remove all submaps without resetting the ID managers.
+  void clearSubmaps();
+
+  // Load all submaps for which the filter and options are true. Without
+  // submap filters the full map is loaded, which also supports files without
+  // index.
+  bool loadFromFileImpl(const std::string& file_path,
+                        const MapLoadOptions& options,
+                        const IndexFilter& filter);
+  // The loaders return all submaps whose derived data was not stored.
+  bool loadSequentially(std::istream* proto_file, uint64_t* byte_offset,
+                        size_t num_submaps, const SubmapLoadOptions& options,
+                        std::vector<Submap*>* submaps_to_recompute);
+  bool loadIndexed(const std::string& file_name,
+                   const std::vector<SubmapIndexEntryProto>& entries,
+                   const MapLoadOptions& options,
+                   std::vector<Submap*>* submaps_to_recompute);
+
+  // Whether a loaded submap is kept according to the load options.
+  static bool keepLoadedSubmap(const Submap& submap,
+                               const SubmapLoadOptions& options);
+
+  // Recompute all derived data of the given submaps in parallel.
+  void recomputeData(const std::vector<Submap*>& submaps,
+                     bool recompute_meshes = true);
+
   // IDs are managed within a submap collection.
   SubmapIDManager submap_id_manager_;
   InstanceIDManager instance_id_manager_;
 
-  // The map.
+  // The map. Slots of removed submaps are nullptr until they are compacted,
+  // such that removal does not need to shift the slots of all other submaps.
   std::vector<std::unique_ptr<Submap>> submaps_;
+  size_t num_submaps_ = 0;
 
-  // Bookkeeping.
+  // Bookkeeping. Maps SubmapIDs to their slot in submaps_.
   std::unordered_map<int, size_t> id_to_index_;
-  std::unordered_map<int, std::unordered_set<int>> instance_to_submap_ids_;
   int active_freespace_submap_id_ = -1;
 
+  // Index over all submap bounding volumes and the instance and class IDs of
+  // all submaps. Held by pointer since the submaps refer to them and the
+  // collection is movable.
+  std::unique_ptr<SubmapSpatialIndex> spatial_index_ =
+      std::make_unique<SubmapSpatialIndex>();
+  std::unique_ptr<SubmapLabelTable> label_table_ =
+      std::make_unique<SubmapLabelTable>();
+  std::shared_ptr<ChangeFeed> change_feed_;
+  ThreadPool* thread_pool_ = ThreadPool::getGlobalInstance();
+
  public:
-  // Iterators over submaps.
-  class iterator : public std::iterator<std::random_access_iterator_tag, Submap,
+  // Iterators over submaps, skipping the free slots.
+  class iterator : public std::iterator<std::forward_iterator_tag, Submap,
                                         size_t, Submap*, Submap&> {
    public:
     explicit iterator(size_t index = 0,
                       std::vector<std::unique_ptr<Submap>>* data = nullptr)
-        : index_(index), data_(data) {}
+        : data_(data), index_(index) {
+      skipFreeSlots();
+    }
     iterator& operator++() {
       index_++;
+      skipFreeSlots();
       return *this;
     }
     iterator operator++(int) {
@@ -166,20 +511,29 @@ class SubmapCollection {
     pointer operator->() const { return data_->at(index_).get(); }
 
    private:
+    void skipFreeSlots() {
+      while (data_ && index_ < data_->size() && !(*data_)[index_]) {
+        index_++;
+      }
+    }
+
     std::vector<std::unique_ptr<Submap>>* const data_;
     size_t index_;
   };
 
   class const_iterator
-      : public std::iterator<std::random_access_iterator_tag, const Submap,
-                             size_t, Submap const*, const Submap&> {
+      : public std::iterator<std::forward_iterator_tag, const Submap, size_t,
+                             Submap const*, const Submap&> {
    public:
     explicit const_iterator(
         size_t index = 0,
         const std::vector<std::unique_ptr<Submap>>* data = nullptr)
-        : index_(index), data_(data) {}
+        : data_(data), index_(index) {
+      skipFreeSlots();
+    }
     const_iterator& operator++() {
       index_++;
+      skipFreeSlots();
       return *this;
     }
     const_iterator operator++(int) {
@@ -195,6 +549,12 @@ class SubmapCollection {
     pointer operator->() const { return data_->at(index_).get(); }
 
    private:
+    void skipFreeSlots() {
+      while (data_ && index_ < data_->size() && !(*data_)[index_]) {
+        index_++;
+      }
+    }
+
     const std::vector<std::unique_ptr<Submap>>* const data_;
     size_t index_;
   };
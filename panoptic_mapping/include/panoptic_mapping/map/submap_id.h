@@ -1,23 +1,24 @@
 #ifndef PANOPTIC_MAPPING_MAP_SUBMAP_ID_H_
 #define PANOPTIC_MAPPING_MAP_SUBMAP_ID_H_
 
+#include <mutex>
 #include <queue>
 
 namespace panoptic_mapping {
 
 /**
- * @brief Class for ID management. Default uses a global singleton but e.g.
- * individual submap collections are allowed to have separate.
+ * @brief Class for ID management. Every submap collection owns its manager,
+ * such that independent collections, e.g. of several mappers in the same
+ * process, do not share any ID state. IDs can be requested and released
+ * concurrently.
  */
 class SubmapIDManager {
  public:
   SubmapIDManager();
 
-  // Access to the global id manager via singleton.
-  static SubmapIDManager* getGlobalInstance() {
-    static SubmapIDManager instance;
-    return &instance;
-  }
+  // Copies the ID state, e.g. for clones of the owning collection.
+  SubmapIDManager(const SubmapIDManager& other);
+  SubmapIDManager& operator=(const SubmapIDManager& other);
 
  private:
   friend class SubmapID;
@@ -30,6 +31,7 @@ class SubmapIDManager {
   // Currently submap IDs are assumed to be unique over the lifetime of a run.
   static const bool kAllowIDReuse = false;
 
+  mutable std::mutex mutex_;
   int current_id_;
   std::queue<int> vacant_ids_;
 };
@@ -40,8 +42,7 @@ class SubmapIDManager {
 class SubmapID {
  public:
   // Controlled con- and destruction.
-  explicit SubmapID(
-      SubmapIDManager* manager = SubmapIDManager::getGlobalInstance());
+  explicit SubmapID(SubmapIDManager* manager);
   ~SubmapID();
 
   SubmapID(const SubmapID&) = delete;
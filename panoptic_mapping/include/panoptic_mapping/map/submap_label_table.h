@@ -0,0 +1,52 @@
+#ifndef PANOPTIC_MAPPING_MAP_SUBMAP_LABEL_TABLE_H_
+#define PANOPTIC_MAPPING_MAP_SUBMAP_LABEL_TABLE_H_
+
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Lookup tables of the instance and class IDs of all submaps in a
+ * collection. The tables are kept up to date incrementally by the collection
+ * and the submaps whenever submaps are added, removed, or change their IDs, so
+ * they never need to be rebuilt.
+ */
+class SubmapLabelTable {
+ public:
+  // Returned for submaps that do not exist.
+  static constexpr int kNoClassID = std::numeric_limits<int>::min();
+
+  SubmapLabelTable() = default;
+  virtual ~SubmapLabelTable() = default;
+
+  // Modification.
+  void add(int submap_id, int instance_id, int class_id);
+  void remove(int submap_id, int instance_id);
+  void setInstanceID(int submap_id, int previous_instance_id, int instance_id);
+  void setClassID(int submap_id, int class_id);
+  void clear();
+
+  // Lookups.
+  int getClassID(int submap_id) const {
+    const size_t index = static_cast<size_t>(submap_id);
+    return submap_id >= 0 && index < submap_to_class_.size()
+               ? submap_to_class_[index]
+               : kNoClassID;
+  }
+  const std::unordered_map<int, std::unordered_set<int>>&
+  getInstanceToSubmapIDs() const {
+    return instance_to_submap_ids_;
+  }
+
+ private:
+  // Flat table of the class of every SubmapID, which are assigned densely.
+  std::vector<int> submap_to_class_;
+  std::unordered_map<int, std::unordered_set<int>> instance_to_submap_ids_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_SUBMAP_LABEL_TABLE_H_
@@ -0,0 +1,82 @@
+#ifndef PANOPTIC_MAPPING_MAP_SUBMAP_SPATIAL_INDEX_H_
+#define PANOPTIC_MAPPING_MAP_SUBMAP_SPATIAL_INDEX_H_
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Loose octree over the bounding spheres of all submaps in mission
+ * frame, implemented as one hashed grid per octree level. Each sphere is stored
+ * in the cell of its center on the finest level whose cells are at least twice
+ * the sphere's radius, so queries only need to visit the cells near the query
+ * volume. The index is kept up to date by the submaps whenever their bounding
+ * volume or pose changes.
+ */
+class SubmapSpatialIndex {
+ public:
+  explicit SubmapSpatialIndex(float min_cell_size = 1.f);
+  virtual ~SubmapSpatialIndex() = default;
+
+  // Bounding sphere of a submap in mission frame.
+  struct Sphere {
+    int submap_id;
+    Point center_M;
+    float radius;
+  };
+
+  // Modification.
+  void update(int submap_id, const Point& center_M, float radius);
+
+  // Update many submaps at once, acquiring the index only once.
+  void update(const std::vector<Sphere>& spheres);
+  void remove(int submap_id);
+  void clear();
+
+  /**
+   * @brief Find all submaps whose bounding sphere intersects a query sphere.
+   *
+   * @param center_M Center of the query sphere in mission frame.
+   * @param radius Radius of the query sphere in meters.
+   * @return The IDs of all intersecting submaps, in no particular order.
+   */
+  std::vector<int> findIntersecting(const Point& center_M, float radius) const;
+
+  size_t size() const;
+
+  // Counter that is incremented on every change of the index.
+  uint64_t getGeneration() const { return generation_; }
+  void incrementGeneration() { generation_++; }
+
+ private:
+  struct Entry {
+    Point center;
+    float radius;
+    int level;
+    voxblox::BlockIndex cell;
+  };
+  typedef std::unordered_map<voxblox::BlockIndex, std::vector<int>,
+                             voxblox::AnyIndexHash>
+      Level;
+
+  float cellSize(int level) const;
+  voxblox::BlockIndex cellIndex(const Point& point, int level) const;
+  void removeFromCell(int submap_id, const Entry& entry);
+  // Returns true if the entry changed. Requires the mutex to be locked.
+  bool updateLocked(int submap_id, const Point& center_M, float radius);
+
+  const float min_cell_size_;
+  mutable std::mutex mutex_;
+  std::unordered_map<int, Entry> entries_;
+  std::vector<Level> levels_;
+  std::atomic<uint64_t> generation_{0};
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_SUBMAP_SPATIAL_INDEX_H_
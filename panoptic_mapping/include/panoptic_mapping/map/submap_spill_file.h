@@ -0,0 +1,39 @@
+#ifndef PANOPTIC_MAPPING_MAP_SUBMAP_SPILL_FILE_H_
+#define PANOPTIC_MAPPING_MAP_SUBMAP_SPILL_FILE_H_
+
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Append-only binary file to store the layers of submaps that were
+ * evicted from memory. Data is never overwritten, such that offsets stay valid
+ * for all submaps, clones and snapshots referencing them. The file is removed
+ * when the object is destroyed.
+ */
+class SubmapSpillFile {
+ public:
+  explicit SubmapSpillFile(const std::string& file_path);
+  virtual ~SubmapSpillFile();
+
+  SubmapSpillFile(const SubmapSpillFile&) = delete;
+  SubmapSpillFile& operator=(const SubmapSpillFile&) = delete;
+
+  bool isOpen() const { return stream_.is_open(); }
+  const std::string& getFilePath() const { return file_path_; }
+
+  // The stream may only be accessed while holding the mutex.
+  std::mutex& mutex() { return mutex_; }
+  std::fstream* stream() { return &stream_; }
+
+ private:
+  const std::string file_path_;
+  std::fstream stream_;
+  std::mutex mutex_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_SUBMAP_SPILL_FILE_H_
@@ -0,0 +1,156 @@
+#ifndef PANOPTIC_MAPPING_MAP_VOXEL_MASK_H_
+#define PANOPTIC_MAPPING_MAP_VOXEL_MASK_H_
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Compact bitmask over the voxels of a block in linear index order.
+ */
+class VoxelMask {
+ public:
+  explicit VoxelMask(size_t num_voxels = 0)
+      : words_((num_voxels + kWordBits - 1) / kWordBits, 0u) {}
+
+  void set(size_t linear_index) {
+    words_[linear_index / kWordBits] |= bit(linear_index);
+  }
+  void reset(size_t linear_index) {
+    words_[linear_index / kWordBits] &= ~bit(linear_index);
+  }
+  bool test(size_t linear_index) const {
+    return words_[linear_index / kWordBits] & bit(linear_index);
+  }
+  bool none() const {
+    for (const uint64_t word : words_) {
+      if (word) {
+        return false;
+      }
+    }
+    return true;
+  }
+  size_t getMemorySize() const { return words_.capacity() * sizeof(uint64_t); }
+
+  /**
+   * @brief Call f(linear_index) for all set voxels in increasing order, using
+   * bit scans to skip unset voxels.
+   */
+  template <typename F>
+  void forEach(F&& f) const {
+    for (size_t i = 0; i < words_.size(); ++i) {
+      uint64_t word = words_[i];
+      while (word) {
+        f(i * kWordBits + __builtin_ctzll(word));
+        word &= word - 1u;
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t kWordBits = 64;
+  static uint64_t bit(size_t linear_index) {
+    return uint64_t(1) << (linear_index % kWordBits);
+  }
+
+  std::vector<uint64_t> words_;
+};
+
+/**
+ * @brief Masks of the observed and near-surface voxels of all blocks of a
+ * submap, maintained by the integrators. The masks are conservative: every
+ * observed voxel is set, but voxels that were unobserved or moved away from the
+ * surface by other modifications may still be set, so consumers still check
+ * the voxels they visit. Blocks without a mask are scanned fully.
+ */
+class SubmapVoxelMasks {
+ public:
+  struct BlockMasks {
+    VoxelMask observed;
+    VoxelMask near_surface;
+  };
+
+  // Voxels whose absolute distance is at most this are near the surface.
+  explicit SubmapVoxelMasks(float near_surface_distance)
+      : near_surface_distance_(near_surface_distance) {}
+  virtual ~SubmapVoxelMasks() = default;
+
+  void copyFrom(const SubmapVoxelMasks& other);
+
+  /**
+   * @brief Update the masks of a block after its voxels were modified.
+   * Thread-safe for different blocks.
+   *
+   * @param index Index of the block.
+   * @param block The block after the modification.
+   * @param voxels The modified voxels. If nullptr or if the block has no masks
+   * yet, the masks are computed from all voxels.
+   */
+  void update(const BlockIndex& index, const TsdfBlock& block,
+              const VoxelMask* voxels = nullptr);
+  void remove(const BlockIndex& index);
+  void clear();
+
+  // Returns nullptr if the block has no masks.
+  const BlockMasks* get(const BlockIndex& index) const;
+  size_t getMemorySize() const;
+
+  /**
+   * @brief Call f(linear_index) for all voxels of a block that may be observed.
+   */
+  template <typename F>
+  void forEachObservedVoxel(const BlockIndex& index, const TsdfBlock& block,
+                            F&& f) const {
+    const BlockMasks* masks = get(index);
+    if (masks) {
+      masks->observed.forEach(f);
+      return;
+    }
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      if (isObserved(block.getVoxelByLinearIndex(i))) {
+        f(i);
+      }
+    }
+  }
+
+  /**
+   * @brief Call f(linear_index) for all voxels of a block that may be observed
+   * and near the surface.
+   */
+  template <typename F>
+  void forEachNearSurfaceVoxel(const BlockIndex& index, const TsdfBlock& block,
+                               F&& f) const {
+    const BlockMasks* masks = get(index);
+    if (masks) {
+      masks->near_surface.forEach(f);
+      return;
+    }
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      if (isNearSurface(block.getVoxelByLinearIndex(i))) {
+        f(i);
+      }
+    }
+  }
+
+ private:
+  bool isObserved(const TsdfVoxel& voxel) const { return voxel.weight > 0.f; }
+  bool isNearSurface(const TsdfVoxel& voxel) const {
+    return isObserved(voxel) &&
+           std::abs(voxel.distance) <= near_surface_distance_;
+  }
+  void updateVoxel(const TsdfVoxel& voxel, size_t linear_index,
+                   BlockMasks* masks) const;
+
+  float near_surface_distance_;
+  voxblox::AnyIndexHashMapType<BlockMasks>::type masks_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_MAP_VOXEL_MASK_H_
@@ -2,6 +2,7 @@
 #define PANOPTIC_MAPPING_MAP_MANAGEMENT_ACTIVITY_MANAGER_H_
 
 #include <unordered_map>
+#include <vector>
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
@@ -28,6 +29,13 @@ class ActivityManager {
         0;  // Deactivate submaps when not observed for x frames. Use 0 to
             // ignore.
 
+    // Active set caps. If more object submaps are active, or their allocated
+    // blocks exceed the volume, the least recently tracked submaps are
+    // deactivated. Submaps tracked in the current frame are kept, so the caps
+    // can be exceeded temporarily. Use 0 to ignore.
+    int max_active_submaps = 0;
+    float max_active_volume = 0.f;  // m^3
+
     Config() { setConfigName("ActivityManager"); }
 
    protected:
@@ -38,12 +46,24 @@ class ActivityManager {
   explicit ActivityManager(const Config& config);
   virtual ~ActivityManager() = default;
 
-  // Check all criteria.
-  void processSubmaps(SubmapCollection* submaps);
+  /**
+   * @brief Check all criteria.
+   *
+   * @param submaps Submaps to check.
+   * @param deactivated_submaps If set, submaps are deactivated with deferred
+   * finishing and their IDs are appended here, see
+   * 'Submap::finishActivePeriod()'.
+   */
+  void processSubmaps(SubmapCollection* submaps,
+                      std::vector<int>* deactivated_submaps = nullptr);
 
  private:
   bool checkRequiredRedetection(Submap* submap);
-  void checkMissedDetections(Submap* submap);
+  void checkMissedDetections(Submap* submap,
+                             std::vector<int>* deactivated_submaps);
+  void enforceActiveSetCaps(SubmapCollection* submaps,
+                            std::vector<int>* deactivated_submaps);
+  void deactivate(Submap* submap, std::vector<int>* deactivated_submaps);
 
  private:
   const Config config_;
@@ -51,6 +71,8 @@ class ActivityManager {
   // Tracking data.
   std::unordered_map<int, int> submap_redetection_counts_;
   std::unordered_map<int, int> submap_missed_detection_counts_;
+  std::unordered_map<int, int> submap_last_tracked_frames_;
+  int frame_index_ = 0;
 };
 
 }  // namespace panoptic_mapping
@@ -34,10 +34,19 @@ class LayerManipulator {
   /* Tools */
   // Trim the TSDF layer according to the provided class layer. Tsdf and class
   // layer are expected to have identical layout, extent and transformation.
-  void applyClassificationLayer(TsdfLayer* tsdf_layer,
-                                const ClassLayer& class_layer,
-                                float truncation_distance) const;
+  // The blocks are processed in parallel on the thread pool. If the voxel
+  // masks of the layer are given, only observed voxels are visited and the
+  // masks are kept up to date. If removed_blocks is given, the indices of all
+  // blocks that no longer contain data are appended.
+  void applyClassificationLayer(
+      TsdfLayer* tsdf_layer, const ClassLayer& class_layer,
+      float truncation_distance, ThreadPool* thread_pool,
+      SubmapVoxelMasks* voxel_masks = nullptr,
+      voxblox::BlockIndexList* removed_blocks = nullptr) const;
 
+  // Fuse submap A into B, processing the blocks of B in parallel on the thread
+  // pool of B. If both submaps share pose and layout voxels are merged
+  // directly, otherwise A is interpolated at the voxel centers of B.
   void mergeSubmapAintoB(const Submap& A, Submap* B) const;
 
   /**
@@ -45,8 +54,12 @@ class LayerManipulator {
    * through the projective TSDF.
    *
    * @param layer Layer to ESDFify.
+   * @param thread_pool Thread pool to process the blocks on.
+   * @param voxel_masks Optional voxel masks of the layer. If given, only the
+   * observed voxels are processed and the masks are kept up to date.
    */
-  void unprojectTsdfLayer(TsdfLayer* layer) const;
+  void unprojectTsdfLayer(TsdfLayer* layer, ThreadPool* thread_pool,
+                          SubmapVoxelMasks* voxel_masks = nullptr) const;
 
  private:
   const Config config_;
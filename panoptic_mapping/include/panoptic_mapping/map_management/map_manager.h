@@ -1,8 +1,12 @@
 #ifndef PANOPTIC_MAPPING_MAP_MANAGEMENT_MAP_MANAGER_H_
 #define PANOPTIC_MAPPING_MAP_MANAGEMENT_MAP_MANAGER_H_
 
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -29,6 +33,13 @@ class MapManager : public MapManagerBase {
     int prune_active_blocks_frequency = 0;
     int change_detection_frequency = 0;
     int activity_management_frequency = 0;
+    int collapse_uniform_blocks_frequency = 0;
+
+    // If either budget is set, each pruning action only checks this many
+    // blocks or for this long, continuing round-robin through the active
+    // submaps in the next action. Set 0 to prune all active blocks at once.
+    int max_pruned_blocks_per_tick = 0;
+    float max_pruning_time_ms = 0.f;
 
     // If true, submaps that are deactivated are checked for alignment with
     // inactive maps and merged together if a match is found.
@@ -39,6 +50,55 @@ class MapManager : public MapManagerBase {
     // the loss of classification information.
     bool apply_class_layer_when_deactivating_submaps = false;
 
+    // If true, instance submaps are re-voxelized when they are deactivated,
+    // resampling their layers to a voxel size chosen from their observed
+    // extent and surface area, see 'computeRevoxelizationVoxelSize()'.
+    bool revoxelize_deactivated_submaps = false;
+
+    // Number of surface voxels a re-voxelized submap should approximately
+    // have. This bounds the memory of large objects.
+    int revoxelization_surface_voxels = 4000;
+
+    // Minimum number of voxels across the largest side of the observed extent
+    // of a submap. This keeps small objects at a fine resolution.
+    int revoxelization_min_voxels_across = 24;
+
+    // Range of voxel sizes in meters to choose from.
+    float revoxelization_min_voxel_size = 0.02f;
+    float revoxelization_max_voxel_size = 0.1f;
+
+    // Submaps are only re-voxelized if the voxel size changes by more than
+    // this fraction, since every resampling smoothes the submap.
+    float revoxelization_min_change = 0.25f;
+
+    // Maximum memory used by all submaps in MB, set 0 to turn off. If
+    // exceeded, the least recently used inactive submaps are evicted to the
+    // spill file and loaded back when accessed.
+    float memory_budget = 0.f;
+
+    // Inactive submaps are only evicted if they were not accessed for this
+    // many ticks.
+    int min_eviction_age = 10;
+
+    // File to store evicted submaps in, is removed on shutdown.
+    std::string spill_file_path = "/tmp/panoptic_mapping_spill.bin";
+
+    // If true, pruning, change detection, and the search for merge candidates
+    // of deactivated submaps run on a background thread on a snapshot of the
+    // map. The resulting edits are applied in 'tick()' after the background
+    // tasks finished, tasks becoming due meanwhile are deferred.
+    bool use_background_thread = false;
+
+    // If true, the meshing, iso-surface extraction, and compression of
+    // deactivated submaps, and applying their class layers if requested, run
+    // on clones of the submaps on background workers. The submaps are inactive
+    // immediately but skipped by change detection, merging, and eviction until
+    // their finished data is adopted in 'tick()'.
+    bool defer_submap_finishing = false;
+
+    // Maximum number of submaps that are finished in parallel.
+    int num_finishing_threads = 1;
+
     // Member configs.
     TsdfRegistrator::Config tsdf_registrator_config;
     ActivityManager::Config activity_manager_config;
@@ -57,18 +117,93 @@ class MapManager : public MapManagerBase {
   // Perform all actions when with specified timings.
   void tick(SubmapCollection* submaps) override;
   void finishMapping(SubmapCollection* submaps) override;
+  void setThreadSafeSubmapCollection(
+      std::shared_ptr<ThreadSafeSubmapCollection> submaps) override;
+  void setQualityController(
+      std::shared_ptr<const QualityController> quality_controller) override;
 
   // Perform specific tasks.
   void pruneActiveBlocks(SubmapCollection* submaps);
+  void pruneActiveBlocksAmortized(SubmapCollection* submaps);
   void manageSubmapActivity(SubmapCollection* submaps);
   void performChangeDetection(SubmapCollection* submaps);
+  void enforceMemoryBudget(SubmapCollection* submaps);
+  void collapseUniformBlocks(SubmapCollection* submaps);
+
+  // Wait for running background tasks and apply their results.
+  void waitForBackgroundTasks(SubmapCollection* submaps);
+
+  // Finish all submaps whose deactivation was deferred.
+  void waitForFinishingSubmaps(SubmapCollection* submaps);
 
   // Tools.
   bool mergeSubmapIfPossible(SubmapCollection* submaps, int submap_id,
                              int* merged_id = nullptr);
 
+  /**
+   * @brief Merge the submaps of another session, e.g. a loaded map, into the
+   * map. Candidates are found via the spatial index of the map, such that only
+   * inactive submaps of the same class whose bounding volumes intersect are
+   * compared. Matches are verified with the TSDF registrator in parallel and
+   * fused into the matching submap, all other submaps of the session are added
+   * as new inactive submaps. The free space of the session is fused into the
+   * active free space submap of the map.
+   *
+   * @param other Submaps of the session to merge, need to have up to date
+   * iso-surface points and bounding volumes.
+   * @param submaps Map to merge the session into.
+   * @return The number of submaps of other fused into existing submaps.
+   */
+  size_t mergeSubmapCollection(const SubmapCollection& other,
+                               SubmapCollection* submaps);
+
  protected:
-  std::string pruneBlocks(Submap* submap) const;
+  // Remove all blocks without belonging voxels. If block_indices is set only
+  // these blocks are checked.
+  std::string pruneBlocks(
+      Submap* submap,
+      const voxblox::BlockIndexList* block_indices = nullptr) const;
+  // Remove the block if it has no belonging voxels, returns true if removed.
+  bool pruneBlock(Submap* submap, const BlockIndex& index) const;
+  bool hasBelongingVoxels(const Submap& submap, const BlockIndex& index) const;
+
+  /**
+   * @brief Choose the voxel size of a deactivated instance submap. The voxel
+   * size is chosen such that the observed surface consists of about
+   * 'revoxelization_surface_voxels' voxels, but at most such that the largest
+   * side of the observed extent spans 'revoxelization_min_voxels_across'
+   * voxels, and clamped to the configured range.
+   *
+   * @return The voxel size, or the current voxel size if it does not change
+   * by more than 'revoxelization_min_change'.
+   */
+  float computeRevoxelizationVoxelSize(const Submap& submap) const;
+
+  // Re-voxelize a deactivated instance submap if configured, without updating
+  // it. Returns true if the submap was resampled.
+  bool revoxelizeSubmap(Submap* submap) const;
+
+  // Returns the ID of an inactive submap the submap can be merged into or -1.
+  int findMergeTarget(const SubmapCollection& submaps,
+                      const Submap& submap) const;
+  void mergeSubmaps(SubmapCollection* submaps, int submap_id, int target_id);
+  void mergeDeactivatedSubmaps(SubmapCollection* submaps,
+                               const std::vector<int>& submap_ids);
+
+  /**
+   * @brief Apply a function to each submap on the global thread pool and
+   * report the progress. Used to finish mapping, the function needs to be
+   * thread safe for different submaps.
+   *
+   * @param submaps Submaps to process.
+   * @param thread_pool Thread pool to process the submaps on.
+   * @param name Name of the step used in the progress report.
+   * @param function Function taking the index in 'submaps' and the submap.
+   */
+  void processSubmapsInParallel(
+      const std::vector<Submap*>& submaps, ThreadPool* thread_pool,
+      const std::string& name,
+      const std::function<void(size_t, Submap*)>& function) const;
 
  private:
   static config_utilities::Factory::RegistrationRos<MapManagerBase, MapManager>
@@ -79,21 +214,88 @@ class MapManager : public MapManagerBase {
   std::shared_ptr<ActivityManager> activity_manager_;
   std::shared_ptr<TsdfRegistrator> tsdf_registrator_;
   std::shared_ptr<LayerManipulator> layer_manipulator_;
+  std::shared_ptr<SubmapSpillFile> spill_file_;
+  uint64_t access_time_ = 0;
+
+  // Amortized pruning state: the remaining submaps of the current pass and
+  // blocks of the current submap.
+  std::deque<int> pruning_queue_;
+  int pruning_submap_id_ = -1;
+  voxblox::BlockIndexList pruning_blocks_;
+  size_t next_pruning_block_ = 0;
 
   // Action tick counters.
   class Ticker {
    public:
+    // Deferrable tasks run less often if the quality controller requests it.
     Ticker(unsigned int max_ticks,
-           std::function<void(SubmapCollection* submaps)> action)
-        : max_ticks_(max_ticks), action_(std::move(action)) {}
-    void tick(SubmapCollection* submaps);
+           std::function<void(SubmapCollection* submaps)> action,
+           bool is_deferrable = false)
+        : max_ticks_(max_ticks),
+          action_(std::move(action)),
+          is_deferrable_(is_deferrable) {}
+    void tick(SubmapCollection* submaps, unsigned int interval_factor = 1);
 
    private:
     unsigned int current_tick_ = 0;
     const unsigned int max_ticks_;
     const std::function<void(SubmapCollection* submaps)> action_;
+    const bool is_deferrable_;
   };
   std::vector<Ticker> tickers_;
+  std::shared_ptr<const QualityController> quality_controller_;
+
+  // Background map management.
+  enum BackgroundTask : unsigned int {
+    kPruneActiveBlocks = 1u << 0,
+    kChangeDetection = 1u << 1,
+    kMergeDeactivatedSubmaps = 1u << 2
+  };
+  struct BackgroundResult {
+    // Per submap ID.
+    std::unordered_map<int, voxblox::BlockIndexList> prunable_blocks;
+    std::unordered_map<int, ChangeState> change_states;
+
+    // Pairs of the ID of a submap and the ID of the submap to merge it into.
+    std::vector<std::pair<int, int>> merges;
+
+    // Latency of every executed task in ms.
+    std::vector<std::pair<std::string, double>> task_times;
+  };
+  void scheduleBackgroundTask(BackgroundTask task);
+  void processBackgroundTasks(SubmapCollection* submaps);
+  BackgroundResult runBackgroundTasks(
+      const SubmapCollection& submaps, unsigned int tasks,
+      const std::unordered_map<int, voxblox::IndexSet>& changed_blocks,
+      const std::vector<int>& merge_candidates) const;
+  void applyBackgroundResult(SubmapCollection* submaps,
+                             const BackgroundResult& result);
+  void discardBackgroundTasks();
+
+  // Deferred finishing of deactivated submaps.
+  struct FinishingSubmap {
+    int submap_id;
+    std::future<std::unique_ptr<Submap>> finished;
+  };
+  void startFinishingSubmaps(SubmapCollection* submaps);
+  void adoptFinishedSubmaps(SubmapCollection* submaps, bool wait);
+
+  // IDs of the clones being finished, such that they don't interfere with the
+  // IDs of the map.
+  SubmapIDManager finishing_submap_id_manager_;
+  InstanceIDManager finishing_instance_id_manager_;
+  std::deque<int> finishing_queue_;
+  std::vector<FinishingSubmap> finishing_submaps_;
+
+  std::shared_ptr<ThreadSafeSubmapCollection> thread_safe_submaps_;
+  std::shared_ptr<const SubmapCollection> snapshot_;
+  unsigned int due_tasks_ = 0;
+  std::vector<int> merge_candidates_;
+  int num_deferred_tasks_ = 0;
+  int background_ticks_ = 0;
+
+  // Declared last such that running tasks finish before members are destroyed.
+  std::future<BackgroundResult> background_tasks_;
 };
 
 }  // namespace panoptic_mapping
@@ -1,7 +1,11 @@
 #ifndef PANOPTIC_MAPPING_MAP_MANAGEMENT_MAP_MANAGER_BASE_H_
 #define PANOPTIC_MAPPING_MAP_MANAGEMENT_MAP_MANAGER_BASE_H_
 
+#include <memory>
+
 #include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/tools/quality_controller.h"
+#include "panoptic_mapping/tools/thread_safe_submap_collection.h"
 
 namespace panoptic_mapping {
 
@@ -17,6 +21,16 @@ class MapManagerBase {
   // Perform all actions when with specified timings.
   virtual void tick(SubmapCollection* submaps) = 0;
   virtual void finishMapping(SubmapCollection* submaps) = 0;
+
+  // Set the thread-safe wrapper of the managed submaps, through which
+  // snapshots of the map are taken if map management requires them.
+  virtual void setThreadSafeSubmapCollection(
+      std::shared_ptr<ThreadSafeSubmapCollection> submaps) {}
+
+  // Set the quality controller that decides whether deferrable map management
+  // tasks run less frequently under load.
+  virtual void setQualityController(
+      std::shared_ptr<const QualityController> quality_controller) {}
 };
 
 }  // namespace panoptic_mapping
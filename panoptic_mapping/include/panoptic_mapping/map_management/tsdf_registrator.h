@@ -1,12 +1,15 @@
 #ifndef PANOPTIC_MAPPING_MAP_MANAGEMENT_TSDF_REGISTRATOR_H_
 #define PANOPTIC_MAPPING_MAP_MANAGEMENT_TSDF_REGISTRATOR_H_
 
+#include <map>
 #include <string>
-
-#include <voxblox/interpolator/interpolator.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/flat_block_map.h"
 #include "panoptic_mapping/map/submap.h"
 #include "panoptic_mapping/map/submap_collection.h"
 
@@ -54,9 +57,33 @@ class TsdfRegistrator {
     float normalization_max_weight = 5000.f;
 
     // Number of threads used to perform change detection. Change detection is
-    // submap-parallel.
+    // parallel over pairs of submaps and chunks of their iso-surface points.
     int integration_threads = std::thread::hardware_concurrency();
 
+    // Number of iso-surface points compared per task. Large submaps are split
+    // into several tasks such that the work is balanced across threads.
+    int points_per_task = 2000;
+
+    // If true, only re-evaluate the reference points near TSDF blocks of the
+    // active submaps that changed since the last check, keeping the counts of
+    // all other points. The cost then scales with the changes, not the map.
+    bool use_incremental_change_detection = false;
+
+    // If true, the blocks of each compared active submap are indexed in a flat
+    // hash map once per change detection, which speeds up the block lookups of
+    // the interpolation at the cost of one pass over the blocks.
+    bool use_flat_block_maps = false;
+
+    // If true, the allocated blocks of each compared active submap are
+    // summarized in a coarse occupancy signature of cells of several blocks.
+    // Chunks of reference points whose bounding box does not overlap any
+    // occupied cell are skipped, since their interpolation fails anyway. Only
+    // used without incremental change detection.
+    bool use_occupancy_signatures = false;
+
+    // Side length of the cells of the occupancy signatures in blocks.
+    int signature_cell_blocks = 4;
+
     Config() { setConfigName("TsdfRegistrator"); }
 
    protected:
@@ -67,7 +94,22 @@ class TsdfRegistrator {
   explicit TsdfRegistrator(const Config& config);
   virtual ~TsdfRegistrator() = default;
 
-  void checkSubmapCollectionForChange(SubmapCollection* submaps) const;
+  void checkSubmapCollectionForChange(SubmapCollection* submaps);
+
+  /**
+   * @brief Compute the change states of the inactive submaps without modifying
+   * the collection, such that change detection can run on a snapshot.
+   *
+   * @param submaps Submaps to check for change.
+   * @param changed_blocks TSDF blocks per submap ID that changed since the last
+   * check, only used for incremental change detection.
+   * @param change_states Resulting change states per submap ID, only contains
+   * submaps that conflict or match.
+   */
+  void detectChanges(
+      const SubmapCollection& submaps,
+      const std::unordered_map<int, voxblox::IndexSet>& changed_blocks,
+      std::unordered_map<int, ChangeState>* change_states);
 
   void mergeMatchingSubmaps(SubmapCollection* submaps);
 
@@ -78,17 +120,58 @@ class TsdfRegistrator {
  private:
   const Config config_;
 
+  // Weighted point counts of comparing the iso-surface points of a reference
+  // submap against another submap. Counts of several point ranges are summed.
+  struct ComparisonStats {
+    float conflicting_points = 0.f;
+    float matched_points = 0.f;
+    float total_weight = 0.f;
+
+    // True if the conflicting points exceeded the rejection count early.
+    bool rejected = false;
+
+    void add(const ComparisonStats& other);
+  };
+
+  // Incremental change detection state of comparing a reference submap to
+  // another submap.
+  struct PairState {
+    Transformation T_O_R;
+    size_t num_reference_points = 0;
+
+    // Indices of the reference points and their counts per block of the other
+    // submap they fall into.
+    voxblox::AnyIndexHashMapType<std::vector<uint32_t>>::type block_points;
+    voxblox::AnyIndexHashMapType<ComparisonStats>::type block_stats;
+  };
+
+  // Keyed by the IDs of the reference and other submap.
+  std::map<std::pair<int, int>, PairState> pair_states_;
+
   // Methods.
-  bool getDistanceAndWeightAtPoint(
-      float* distance, float* weight, const IsoSurfacePoint& point,
-      const Transformation& T_P_S,
-      const voxblox::Interpolator<TsdfVoxel>& interpolator) const;
+  // Compare the points [begin, end) of the reference, or if set the points
+  // point_indices[begin, end). If set, the blocks of the other submap are
+  // looked up in other_blocks.
+  void compareIsoSurfacePoints(
+      const Submap& reference, const Submap& other,
+      const std::vector<uint32_t>* point_indices, size_t begin, size_t end,
+      bool allow_early_rejection, ComparisonStats* stats,
+      const FlatBlockMap<TsdfVoxel>* other_blocks = nullptr) const;
+
+  void resetPairState(const Submap& reference, const Submap& other,
+                      const Transformation& T_O_R, PairState* state) const;
+
+  bool evaluateComparison(const Submap& reference,
+                          const ComparisonStats& stats,
+                          bool* submaps_match) const;
+
+  float computeRejectionCount(const Submap& reference) const;
 
   float computeCombinedWeight(float w1, float w2) const;
 
-  // For parallel change detection.
-  std::string checkSubmapForChange(const SubmapCollection& submaps,
-                                   Submap* submap) const;
+  // Active submaps the reference submap needs to be compared to.
+  std::vector<int> getComparedSubmaps(const SubmapCollection& submaps,
+                                      const Submap& reference) const;
 };
 
 }  // namespace panoptic_mapping
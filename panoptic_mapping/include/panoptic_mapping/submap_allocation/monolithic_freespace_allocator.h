@@ -1,15 +1,22 @@
 #ifndef PANOPTIC_MAPPING_SUBMAP_ALLOCATION_MONOLITHIC_FREESPACE_ALLOCATOR_H_
 #define PANOPTIC_MAPPING_SUBMAP_ALLOCATION_MONOLITHIC_FREESPACE_ALLOCATOR_H_
 
+#include <memory>
+#include <string>
+
+#include <voxblox/core/block_hash.h>
+
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/labels/label_handler_base.h"
+#include "panoptic_mapping/map/submap_spill_file.h"
 #include "panoptic_mapping/submap_allocation/freespace_allocator_base.h"
 
 namespace panoptic_mapping {
 
 /**
  * @brief This submap allocator creates a monolithic submap to cover all
- * freespace.
+ * freespace. Optionally, the submap is kept as a rolling window around the
+ * camera, such that its size does not grow with the trajectory.
  */
 class MonolithicFreespaceAllocator : public FreespaceAllocatorBase {
  public:
@@ -21,11 +28,26 @@ class MonolithicFreespaceAllocator : public FreespaceAllocatorBase {
     // truncation distance to make them multiples of the voxelsizes.
     Submap::Config submap;
 
+    // If positive, blocks whose centers are further than this from the camera
+    // are removed from the freespace submap. Should exceed the integration
+    // range of the sensor.
+    float rolling_window_radius = -1.f;
+
+    // The rolling window is only updated when the camera moved at least this
+    // far since the last update.
+    float rolling_window_update_distance = 1.f;
+
+    // If set, removed blocks are stored in this file, which is removed on
+    // shutdown, and restored when the camera returns. Otherwise they are
+    // discarded.
+    std::string rolling_window_spill_file_path = "";
+
     Config() { setConfigName("MonolithicFreespaceAllocator"); }
 
    protected:
     void setupParamsAndPrinting() override;
     void checkParams() const override;
+    void initializeDependentVariableDefaults() override;
   };
 
   // Construction.
@@ -33,14 +55,26 @@ class MonolithicFreespaceAllocator : public FreespaceAllocatorBase {
                                         bool print_config = true);
   ~MonolithicFreespaceAllocator() override = default;
 
-  Submap* allocateSubmap(SubmapCollection* submaps,
-                         InputData* /* input */) override;
+  Submap* allocateSubmap(SubmapCollection* submaps, InputData* input) override;
 
  private:
+  // Remove blocks that left the window and restore spilled blocks that
+  // entered it.
+  void updateRollingWindow(Submap* submap, const Point& position_M);
+  bool spillBlock(const TsdfLayer& layer, const BlockIndex& index);
+  bool restoreBlock(const BlockIndex& index, TsdfLayer* layer,
+                    TsdfLayer::BlockMergingStrategy strategy);
+
   static config_utilities::Factory::RegistrationRos<
       FreespaceAllocatorBase, MonolithicFreespaceAllocator>
       registration_;
   const Config config_;
+
+  // Rolling window.
+  int window_submap_id_ = -1;
+  Point last_window_position_M_;
+  std::unique_ptr<SubmapSpillFile> spill_file_;
+  voxblox::AnyIndexHashMapType<uint64_t>::type spilled_blocks_;
 };
 }  // namespace panoptic_mapping
 
@@ -1,6 +1,11 @@
 #ifndef PANOPTIC_MAPPING_SUBMAP_ALLOCATION_SEMANTIC_SUBMAP_ALLOCATOR_H_
 #define PANOPTIC_MAPPING_SUBMAP_ALLOCATION_SEMANTIC_SUBMAP_ALLOCATOR_H_
 
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
 #include "panoptic_mapping/labels/label_entry.h"
 #include "panoptic_mapping/submap_allocation/submap_allocator_base.h"
@@ -32,6 +37,12 @@ class SemanticSubmapAllocator : public SubmapAllocatorBase {
     // submap. Negative values are multiples of the voxel size.
     float truncation_distance = -2.f;
 
+    // Whether the submaps of each label store the color of their voxels. This
+    // overwrites the submap config.
+    bool store_instance_color = true;
+    bool store_background_color = true;
+    bool store_unknown_color = true;
+
     Config() { setConfigName("SemanticSubmapAllocator"); }
 
    protected:
@@ -46,12 +57,27 @@ class SemanticSubmapAllocator : public SubmapAllocatorBase {
 
   Submap* allocateSubmap(SubmapCollection* submaps, InputData* /* input */,
                          int /* input_id */, const LabelEntry& label) override;
+  std::vector<Submap*> allocateSubmaps(
+      SubmapCollection* submaps, InputData* /* input */,
+      const std::vector<int>& input_ids,
+      const std::vector<LabelEntry>& labels) override;
 
  private:
   static config_utilities::Factory::RegistrationRos<SubmapAllocatorBase,
                                                     SemanticSubmapAllocator>
       registration_;
   const Config config_;
+
+  // The submap configs only differ in the voxel size and whether they store
+  // color, and are shared by all submaps with the same values.
+  std::map<std::pair<float, bool>, std::shared_ptr<const Submap::Config>>
+      submap_configs_;
+
+  const std::shared_ptr<const Submap::Config>& getSubmapConfig(
+      const LabelEntry& label);
+  float getVoxelSize(const LabelEntry& label) const;
+  bool storesColor(const LabelEntry& label) const;
+  static void setLabel(const LabelEntry& label, Submap* submap);
 };
 }  // namespace panoptic_mapping
 
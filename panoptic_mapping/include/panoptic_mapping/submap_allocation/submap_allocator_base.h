@@ -1,6 +1,8 @@
 #ifndef PANOPTIC_MAPPING_SUBMAP_ALLOCATION_SUBMAP_ALLOCATOR_BASE_H_
 #define PANOPTIC_MAPPING_SUBMAP_ALLOCATION_SUBMAP_ALLOCATOR_BASE_H_
 
+#include <vector>
+
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/common/input_data_user.h"
 #include "panoptic_mapping/labels/label_entry.h"
@@ -32,6 +34,32 @@ class SubmapAllocatorBase : public InputDataUser {
    */
   virtual Submap* allocateSubmap(SubmapCollection* submaps, InputData* input,
                                  int input_id, const LabelEntry& label) = 0;
+
+  /**
+   * @brief Allocate a batch of new submaps, e.g. for all unmatched segments of
+   * a frame. Allocators can override this to create the submaps jointly, the
+   * default allocates them one at a time.
+   *
+   * @param submaps Collection to allocate the submaps in.
+   * @param input The input data based on which the submaps are allocated.
+   * @param input_ids The ids in the id image of the submaps to allocate.
+   * @param labels The label data of each submap, same size as input_ids.
+   * @return Pointers to the newly allocated submaps in the order of the
+   * input_ids, nullptr where allocation failed.
+   */
+  virtual std::vector<Submap*> allocateSubmaps(
+      SubmapCollection* submaps, InputData* input,
+      const std::vector<int>& input_ids,
+      const std::vector<LabelEntry>& labels) {
+    CHECK_EQ(input_ids.size(), labels.size());
+    submaps->reserve(submaps->size() + input_ids.size());
+    std::vector<Submap*> result;
+    result.reserve(input_ids.size());
+    for (size_t i = 0; i < input_ids.size(); ++i) {
+      result.push_back(allocateSubmap(submaps, input, input_ids[i], labels[i]));
+    }
+    return result;
+  }
 };
 
 }  // namespace panoptic_mapping
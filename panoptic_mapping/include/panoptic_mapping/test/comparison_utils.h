@@ -6,10 +6,13 @@
 
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/map/classification/binary_count.h"
+#include "panoptic_mapping/map/classification/dense_count.h"
 #include "panoptic_mapping/map/classification/fixed_count.h"
 #include "panoptic_mapping/map/classification/moving_binary_count.h"
+#include "panoptic_mapping/map/classification/top_k_count.h"
 #include "panoptic_mapping/map/classification/uncertainty.h"
 #include "panoptic_mapping/map/classification/variable_count.h"
+#include "panoptic_mapping/map/submap_collection.h"
 
 namespace panoptic_mapping {
 namespace test {
@@ -100,6 +103,27 @@ inline bool checkVoxelEqual(const UncertaintyVoxel& v1,
          v1.uncertainty == v2.uncertainty;
 }
 
+inline bool checkVoxelEqual(const TopKCountVoxel& v1,
+                            const TopKCountVoxel& v2) {
+  EXPECT_EQ(v1.num_entries, v2.num_entries);
+  EXPECT_EQ(v1.current_index, v2.current_index);
+  EXPECT_EQ(v1.current_count, v2.current_count);
+  EXPECT_EQ(v1.total_count, v2.total_count);
+  if (v1.num_entries != v2.num_entries) {
+    return false;
+  }
+  bool entries_equal = true;
+  for (size_t i = 0; i < v1.num_entries; ++i) {
+    EXPECT_EQ(v1.ids[i], v2.ids[i]);
+    EXPECT_EQ(v1.counts[i], v2.counts[i]);
+    entries_equal = entries_equal && v1.ids[i] == v2.ids[i] &&
+                    v1.counts[i] == v2.counts[i];
+  }
+  return entries_equal && v1.current_index == v2.current_index &&
+         v1.current_count == v2.current_count &&
+         v1.total_count == v2.total_count;
+}
+
 template <typename T>
 inline bool checkBlockEqual(const voxblox::Block<T>& blk1,
                             const voxblox::Block<T>& blk2) {
@@ -114,6 +138,59 @@ inline bool checkBlockEqual(const voxblox::Block<T>& blk1,
   return all_voxels_equal;
 }
 
+inline bool checkBlockEqual(const DenseCountBlock& blk1,
+                            const DenseCountBlock& blk2) {
+  EXPECT_EQ(blk1.numCounts(), blk2.numCounts());
+  EXPECT_EQ(blk1.num_voxels(), blk2.num_voxels());
+  if (blk1.numCounts() != blk2.numCounts() ||
+      blk1.num_voxels() != blk2.num_voxels()) {
+    return false;
+  }
+  bool all_voxels_equal = true;
+  for (size_t i = 0; i < blk1.num_voxels() && all_voxels_equal; ++i) {
+    all_voxels_equal = blk1.isObserved(i) == blk2.isObserved(i) &&
+                       blk1.getTotalCount(i) == blk2.getTotalCount(i);
+    if (!blk1.isObserved(i) || !all_voxels_equal) {
+      continue;
+    }
+    for (size_t id = 0; id < blk1.numCounts(); ++id) {
+      all_voxels_equal =
+          all_voxels_equal && blk1.getCount(i, id) == blk2.getCount(i, id);
+    }
+    // The belonging ID can be ambiguous for identical maximum counts, so only
+    // the maximum count is compared.
+    all_voxels_equal =
+        all_voxels_equal && blk1.getCount(i, blk1.getBelongingID(i)) ==
+                                blk2.getCount(i, blk2.getBelongingID(i));
+    EXPECT_TRUE(all_voxels_equal) << "Voxel " << i << " differs.";
+  }
+  return all_voxels_equal;
+}
+
+inline bool checkLayerEqual(const DenseCountLayer& layer1,
+                            const DenseCountLayer& layer2) {
+  // Check number of blocks.
+  voxblox::BlockIndexList indices;
+  EXPECT_EQ(layer1.getNumberOfAllocatedBlocks(),
+            layer2.getNumberOfAllocatedBlocks());
+  layer1.getAllAllocatedBlocks(&indices);
+
+  // Check content of blocks.
+  bool all_blocks_equal = true;
+  for (const BlockIndex& index : indices) {
+    EXPECT_TRUE(layer2.hasBlock(index));
+    if (!layer2.hasBlock(index)) {
+      return false;
+    }
+    all_blocks_equal =
+        all_blocks_equal &&
+        checkBlockEqual(*layer1.getDenseBlockPtrByIndex(index),
+                        *layer2.getDenseBlockPtrByIndex(index));
+  }
+  EXPECT_TRUE(all_blocks_equal);
+  return all_blocks_equal;
+}
+
 template <typename T>
 inline bool checkLayerEqual(const voxblox::Layer<T>& layer1,
                             const voxblox::Layer<T>& layer2) {
@@ -137,6 +214,26 @@ inline bool checkLayerEqual(const voxblox::Layer<T>& layer1,
   return all_blocks_equal;
 }
 
+// Check that two collections contain equal submaps in the same order.
+inline bool checkSubmapsEqual(const SubmapCollection& map1,
+                              const SubmapCollection& map2) {
+  EXPECT_EQ(map1.size(), map2.size());
+  if (map1.size() != map2.size()) {
+    return false;
+  }
+  auto it = map2.begin();
+  for (const Submap& submap : map1) {
+    EXPECT_EQ(submap.getInstanceID(), it->getInstanceID());
+    EXPECT_EQ(submap.getClassID(), it->getClassID());
+    EXPECT_EQ(submap.getLabel(), it->getLabel());
+    if (!checkLayerEqual(submap.getTsdfLayer(), it->getTsdfLayer())) {
+      return false;
+    }
+    ++it;
+  }
+  return true;
+}
+
 }  // namespace test
 }  // namespace panoptic_mapping
 
@@ -6,8 +6,10 @@
 
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/map/classification/binary_count.h"
+#include "panoptic_mapping/map/classification/dense_count.h"
 #include "panoptic_mapping/map/classification/fixed_count.h"
 #include "panoptic_mapping/map/classification/moving_binary_count.h"
+#include "panoptic_mapping/map/classification/top_k_count.h"
 #include "panoptic_mapping/map/classification/uncertainty.h"
 #include "panoptic_mapping/map/classification/variable_count.h"
 
@@ -93,6 +95,37 @@ void randomizeVoxel(UncertaintyVoxel* voxel) {
   voxel->uncertainty = getRandomReal<float>();
 }
 
+void randomizeVoxel(TopKCountVoxel* voxel) {
+  // Add the counts such that the cached statistics stay consistent. No IDs
+  // are evicted so all counts are serialized.
+  *voxel = TopKCountVoxel();
+  std::uniform_int_distribution<size_t> num_ids_distribution(
+      0, TopKCountVoxel::kMaxEntries);
+  const size_t num_ids = num_ids_distribution(random_engine);
+  for (size_t i = 0; i < num_ids; ++i) {
+    voxel->addCount(getRandomInt<int16_t>(),
+                    getRandomInt<ClassificationCount>());
+  }
+}
+
+void randomizeBlock(DenseCountBlock* block, size_t num_counts,
+                    float observed_fraction) {
+  // Observe the highest ID once such that the block stores 'num_counts'.
+  std::uniform_real_distribution<float> fraction_distribution(0.f, 1.f);
+  std::uniform_int_distribution<int> id_distribution(0, num_counts - 1);
+  std::uniform_int_distribution<size_t> observations_distribution(1, 20);
+  block->incrementCount(0, num_counts - 1);
+  for (size_t i = 0; i < block->num_voxels(); ++i) {
+    if (fraction_distribution(random_engine) >= observed_fraction) {
+      continue;
+    }
+    const size_t num_observations = observations_distribution(random_engine);
+    for (size_t j = 0; j < num_observations; ++j) {
+      block->incrementCount(i, id_distribution(random_engine));
+    }
+  }
+}
+
 }  // namespace test
 }  // namespace panoptic_mapping
 
@@ -0,0 +1,99 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_ESDF_MAP_H_
+#define PANOPTIC_MAPPING_TOOLS_ESDF_MAP_H_
+
+#include <memory>
+
+#include <voxblox/core/layer.h>
+#include <voxblox/core/voxel.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Euclidean signed distance field of the active free space submap for
+ * planning. The ESDF is updated incrementally from the TSDF blocks that
+ * changed since the last update, using the voxblox ESDF integrator. Collapsed
+ * TSDF blocks are expanded for the update.
+ */
+class EsdfMap {
+ public:
+  using EsdfVoxel = voxblox::EsdfVoxel;
+  using EsdfLayer = voxblox::Layer<EsdfVoxel>;
+
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Distances are propagated up to this distance in meters, unknown and
+    // farther space is set to the default distance.
+    float max_distance = 2.f;
+    float default_distance = 2.f;
+
+    // Distances within this range in meters are taken directly from the TSDF.
+    float min_distance = 0.2f;
+
+    // TSDF voxels with lower weight are considered unobserved.
+    float min_weight = 1e-6f;
+
+    // If true, use the full euclidean distance instead of quasi-euclidean
+    // propagation.
+    bool full_euclidean_distance = false;
+
+    Config() { setConfigName("EsdfMap"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit EsdfMap(const Config& config, bool print_config = true);
+  virtual ~EsdfMap() = default;
+
+  /**
+   * @brief Update the ESDF from the TSDF blocks of the active free space submap
+   * that changed since the last update. If the free space submap changed the
+   * ESDF is recomputed from scratch.
+   *
+   * @param submaps Collection containing the free space submap.
+   */
+  void update(SubmapCollection* submaps);
+
+  /**
+   * @brief Same as above for a snapshot of the collection, such that the ESDF
+   * can be updated concurrently to mapping.
+   *
+   * @param submaps Snapshot containing the free space submap.
+   * @param changed_blocks Blocks taken from the mapped collection with
+   * 'takeChangedBlocks()' when the snapshot was taken.
+   */
+  void update(const SubmapCollection& submaps,
+              const voxblox::IndexSet& changed_blocks);
+
+  // Take the blocks of the active free space submap that changed since the
+  // last call.
+  static voxblox::IndexSet takeChangedBlocks(SubmapCollection* submaps);
+
+  // Lookups in mission frame. Return false if the position is not observed.
+  bool getDistance(const Point& position, float* distance) const;
+  bool getDistanceAndGradient(const Point& position, float* distance,
+                              Point* gradient) const;
+
+  // Access.
+  const EsdfLayer* getEsdfLayer() const { return esdf_layer_.get(); }
+  int getSubmapID() const { return submap_id_; }
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+  std::unique_ptr<EsdfLayer> esdf_layer_;
+
+  // Free space submap the ESDF was computed from and its pose.
+  int submap_id_ = -1;
+  Transformation T_M_S_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_ESDF_MAP_H_
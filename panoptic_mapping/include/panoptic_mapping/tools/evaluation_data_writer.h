@@ -52,8 +52,8 @@ class EvaluationDataWriter : public LogDataWriter {
   void setupLogFile() override;
   void setupEvaluations() override;
 
-  // Evaluations. The data are always preceded by a separating comma.
-  void storeSubmaps(const SubmapCollection& submaps);
+  // Evaluations.
+  void storeSubmaps(const SubmapCollection& submaps, Entry* entry);
 };
 
 }  // namespace panoptic_mapping
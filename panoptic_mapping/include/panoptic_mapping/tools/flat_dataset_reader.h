@@ -0,0 +1,63 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_FLAT_DATASET_READER_H_
+#define PANOPTIC_MAPPING_TOOLS_FLAT_DATASET_READER_H_
+
+#include <string>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/input_data.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Reads frames from a directory in the layout of the flat dataset, i.e.
+ * a 'timestamps.csv' file listing all frame IDs and per frame the files
+ * '<id>_depth.tiff', '<id>_color.png', '<id>_segmentation.png' and
+ * '<id>_pose.txt', without requiring ROS.
+ */
+class FlatDatasetReader {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Directory containing the dataset.
+    std::string data_path = "";
+
+    // Maximum number of frames to read. Use 0 to read all frames.
+    int max_frames = 0;
+
+    Config() { setConfigName("FlatDatasetReader"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit FlatDatasetReader(const Config& config, bool print_config = true);
+  virtual ~FlatDatasetReader() = default;
+
+  // Number of frames in the dataset, sorted by their timestamps.
+  size_t getNumberOfFrames() const { return frame_ids_.size(); }
+
+  /**
+   * @brief Read the images and pose of a frame.
+   *
+   * @param index Index of the frame in [0, getNumberOfFrames()).
+   * @param input Input data to store the depth, color, and id images, the pose
+   * and the timestamp of the frame in.
+   * @return False if any of the files is missing or invalid.
+   */
+  bool readFrame(size_t index, InputData* input) const;
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+  std::vector<std::string> frame_ids_;
+  std::vector<double> timestamps_;  // s
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_FLAT_DATASET_READER_H_
@@ -0,0 +1,69 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_FRAME_LOG_LAYOUT_H_
+#define PANOPTIC_MAPPING_TOOLS_FRAME_LOG_LAYOUT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace panoptic_mapping {
+namespace frame_log {
+
+/**
+ * @brief File layout of the frame logs written by the 'FrameLogWriter' and
+ * read by the 'FrameLogReader'. The file starts with a FileHeader followed by
+ * the frames in recording order. Every frame starts with a FrameHeader, which
+ * is followed by its ImageRecords, LabelRecords, the sensor frame name, and
+ * the pixel data of all images. Pixels are stored row-major and continuous in
+ * the OpenCV type of the image, such that a memory mapped log can be used
+ * without copies. All offsets are in bytes from the start of the frame, frames
+ * and pixel data are aligned to kAlignment bytes. A truncated last frame, e.g.
+ * of a recording that was interrupted, is ignored.
+ */
+
+constexpr uint32_t kMagic = 0x474c4650;  // "PFLG"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kAlignment = 64;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t padding;
+};
+
+struct FrameHeader {
+  uint64_t size;  // Bytes of the frame including this header and padding.
+  double timestamp;
+  double T_M_C_position[3];
+  double T_M_C_rotation[4];  // Quaternion as w, x, y, z.
+  uint32_t num_images;
+  uint32_t num_labels;
+  uint32_t frame_name_size;
+  uint32_t padding;
+};
+
+struct ImageRecord {
+  uint32_t input_type;  // InputData::InputType.
+  int32_t rows;
+  int32_t cols;
+  int32_t cv_type;
+  uint64_t data_offset;
+};
+
+struct LabelRecord {
+  int32_t id;
+  int32_t is_thing;
+  int32_t category_id;
+  int32_t instance_id;
+  float score;
+};
+
+inline size_t alignUp(size_t bytes) {
+  return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Offset of the first frame from the start of the file.
+inline size_t framesOffset() { return alignUp(sizeof(FileHeader)); }
+
+}  // namespace frame_log
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_FRAME_LOG_LAYOUT_H_
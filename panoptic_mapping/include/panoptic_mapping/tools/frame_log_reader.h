@@ -0,0 +1,75 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_FRAME_LOG_READER_H_
+#define PANOPTIC_MAPPING_TOOLS_FRAME_LOG_READER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/input_data.h"
+#include "panoptic_mapping/tools/frame_log_layout.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Replays frame logs recorded by the 'FrameLogWriter' without ROS. The
+ * log is memory mapped and the depth, color, and uncertainty images of the
+ * read inputs refer to the mapped pixels directly. Has the same interface as
+ * the 'FlatDatasetReader', such that it can replace it, e.g. in the offline
+ * replay app.
+ */
+class FrameLogReader {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Frame log to read.
+    std::string file_path = "";
+
+    // Maximum number of frames to read. Use 0 to read all frames.
+    int max_frames = 0;
+
+    Config() { setConfigName("FrameLogReader"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit FrameLogReader(const Config& config, bool print_config = true);
+  virtual ~FrameLogReader() = default;
+
+  // Number of complete frames in the log in recording order.
+  size_t getNumberOfFrames() const { return frame_offsets_.size(); }
+
+  /**
+   * @brief Read an input of the log. The input keeps the mapping alive while
+   * it refers to it. The id image is copied since it is modified by the
+   * tracking.
+   *
+   * @param index Index of the frame in [0, getNumberOfFrames()).
+   * @param input Input data to store the images, labels, pose, and timestamp
+   * of the frame in.
+   * @return False if the frame is invalid.
+   */
+  bool readFrame(size_t index, InputData* input) const;
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Read-only mapping of the log file.
+  struct Mapping {
+    ~Mapping();
+    const char* data = nullptr;
+    size_t size = 0;
+  };
+
+  const Config config_;
+  std::shared_ptr<const Mapping> mapping_;
+  std::vector<size_t> frame_offsets_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_FRAME_LOG_READER_H_
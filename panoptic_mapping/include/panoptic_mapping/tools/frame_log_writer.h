@@ -0,0 +1,69 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_FRAME_LOG_WRITER_H_
+#define PANOPTIC_MAPPING_TOOLS_FRAME_LOG_WRITER_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/input_data.h"
+#include "panoptic_mapping/tools/frame_log_layout.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Records synchronized inputs to a binary frame log, such that they can
+ * be replayed exactly and without ROS using the 'FrameLogReader', e.g. to
+ * reproduce slow frames. Stores the depth, color, id, and uncertainty images,
+ * the detectron labels, the pose, and the timestamp of every input, see
+ * 'frame_log_layout.h'. Derived images are not stored since they are
+ * recomputed when the frame is processed.
+ */
+class FrameLogWriter {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // File to write the log to, an existing file is overwritten.
+    std::string file_path = "";
+
+    // Maximum number of frames to record. Use 0 to record all frames.
+    int max_frames = 0;
+
+    Config() { setConfigName("FrameLogWriter"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit FrameLogWriter(const Config& config, bool print_config = true);
+  virtual ~FrameLogWriter() = default;
+
+  /**
+   * @brief Append an input to the log. Not thread safe.
+   *
+   * @return True if the frame was written.
+   */
+  bool writeFrame(const InputData& input);
+
+  // Whether the log file was opened successfully.
+  bool isOpen() const { return file_.is_open(); }
+
+  size_t getNumberOfFrames() const { return num_frames_; }
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+  std::ofstream file_;
+  size_t num_frames_ = 0;
+
+  // Serialization buffer, reused for all frames.
+  std::vector<char> buffer_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_FRAME_LOG_WRITER_H_
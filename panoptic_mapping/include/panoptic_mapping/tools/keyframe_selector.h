@@ -0,0 +1,95 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_KEYFRAME_SELECTOR_H_
+#define PANOPTIC_MAPPING_TOOLS_KEYFRAME_SELECTOR_H_
+
+#include <string>
+
+#include <opencv2/core/mat.hpp>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/input_data.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Decides how much of the mapping pipeline to run for each input frame.
+ * Frames are keyframes if the camera moved or the segmentation changed enough
+ * since the last keyframe. Other frames are only tracked or skipped entirely,
+ * which keeps the mapper real-time when the camera is stationary or when
+ * frames queue up under CPU contention.
+ */
+class KeyframeSelector {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // A frame is a keyframe if the camera moved at least this far or rotated
+    // at least this much since the last keyframe.
+    float min_translation = 0.05f;  // m
+    float min_rotation = 5.f;       // deg
+
+    // A frame is a keyframe if at least this fraction of the sampled pixels
+    // changed their segmentation ID since the last keyframe. Use a value > 1
+    // to ignore the segmentation.
+    float min_segmentation_change = 0.1f;
+
+    // Pixel stride in both image directions at which the segmentation is
+    // compared.
+    int segmentation_stride = 8;
+
+    // Force a keyframe after this many non-keyframes. Use 0 to never force.
+    int max_frames_between_keyframes = 30;
+
+    // If true, non-keyframes are still tracked such that the tracking state
+    // stays up to date, but not integrated.
+    bool track_skipped_frames = true;
+
+    // If more than this many frames are waiting to be processed, the motion
+    // and segmentation thresholds are scaled by the number of excess frames
+    // and non-keyframes are skipped entirely. Use 0 to ignore the backlog.
+    int max_backlog = 2;
+
+    Config() { setConfigName("KeyframeSelector"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  enum class Decision { kKeyframe, kTrackOnly, kSkip };
+
+  explicit KeyframeSelector(const Config& config, bool print_config = true);
+  virtual ~KeyframeSelector() = default;
+
+  /**
+   * @brief Decide how to process a frame. Must be called for every frame in
+   * order, before the segmentation is modified by tracking.
+   *
+   * @param input The frame to process.
+   * @param backlog Number of frames that are waiting to be processed.
+   * @return How much of the frame to process.
+   */
+  Decision processInput(const InputData& input, size_t backlog = 0);
+
+  void reset();
+
+  static std::string decisionToString(Decision decision);
+  const Config& getConfig() const { return config_; }
+
+ private:
+  bool isKeyframe(const InputData& input, size_t backlog) const;
+  float computeSegmentationChange(const cv::Mat& id_image) const;
+  cv::Mat sampleIdImage(const cv::Mat& id_image) const;
+
+  const Config config_;
+
+  // State of the last keyframe.
+  bool has_keyframe_ = false;
+  Transformation T_M_C_keyframe_;
+  cv::Mat sampled_ids_keyframe_;
+  int frames_since_keyframe_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_KEYFRAME_SELECTOR_H_
@@ -1,9 +1,15 @@
 #ifndef PANOPTIC_MAPPING_TOOLS_LOG_DATA_WRITER_H_
 #define PANOPTIC_MAPPING_TOOLS_LOG_DATA_WRITER_H_
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <fstream>
 #include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <variant>
 #include <vector>
 
 #include "panoptic_mapping/3rd_party/config_utilities.hpp"
@@ -15,7 +21,15 @@ namespace panoptic_mapping {
 
 /**
  * @brief Utility class that evaluates certain metrics during experiments and
- * writes them to a log file.
+ * writes them to a log file. The metrics are computed on the calling thread,
+ * while formatting and writing can happen on a background thread.
+ *
+ * Binary logs ('.panlog') are columnar: A header with the magic number
+ * 'PMLG', the format version, the number of columns and for each column its
+ * type (uint8) and name, followed by blocks of rows. Each block stores the
+ * number of rows, then for each column all values of the block: int64 or
+ * double values, or texts as uint32 length and characters. The first column
+ * is always the time stamp. All numbers are written little endian.
  */
 class LogDataWriter : public DataWriterBase {
  public:
@@ -32,6 +46,17 @@ class LogDataWriter : public DataWriterBase {
     bool evaluate_number_of_submaps = true;
     bool evaluate_number_of_active_submaps = true;
     bool evaluate_number_of_objects = true;
+    bool evaluate_memory_usage = false;
+
+    // If true, entries are formatted and written on a background thread.
+    bool asynchronous = true;
+
+    // Maximum number of entries waiting to be written, further entries are
+    // dropped. Use 0 for no limit.
+    int max_queued_entries = 1000;
+
+    // If true, write the binary columnar format instead of CSV.
+    bool binary_output = false;
 
     Config() { setConfigName("LogDataWriter"); }
 
@@ -52,23 +77,59 @@ class LogDataWriter : public DataWriterBase {
   const Config config_;
 
  protected:
+  // Values and types of the logged columns.
+  using Value = std::variant<int64_t, double, std::string>;
+  enum class ColumnType : uint8_t { kInteger = 0, kFloat = 1, kText = 2 };
+
+  // All data of one call to writeData().
+  struct Entry {
+    double time_stamp = 0.0;
+    std::vector<Value> values;
+
+    // Work run on the writing thread before the entry is written, e.g. to
+    // store copies of the map.
+    std::vector<std::function<void()>> jobs;
+  };
+
   // Data.
   bool is_setup_ = false;
   std::string output_path_;
   std::string outfile_name_;
   std::ofstream outfile_;
-  std::vector<std::function<void(const SubmapCollection&)>> evaluations_;
+  std::vector<std::string> column_names_;
+  std::vector<ColumnType> column_types_;
+  std::vector<std::function<void(const SubmapCollection&, Entry*)>>
+      evaluations_;
 
   // Methods.
   virtual void setup();
+  // Sets the output path and the name of the log file without extension.
   virtual void setupLogFile();
   virtual void setupEvaluations();
-  void writeEntry(const std::string& value);
+  void addColumn(const std::string& name, ColumnType type);
+  bool isAsynchronous() const { return config_.asynchronous; }
+
+  // Evaluations. Each adds the values of its columns to the entry.
+  void evaluateNumberOfSubmaps(const SubmapCollection& submaps, Entry* entry);
+  void evaluateNumberOfActiveSubmaps(const SubmapCollection& submaps,
+                                     Entry* entry);
+  void evaluateNumberOfObjects(const SubmapCollection& submaps, Entry* entry);
+  void evaluateMemoryUsage(const SubmapCollection& submaps, Entry* entry);
 
-  // Evaluations. The data are always preceded by a separating comma.
-  void evaluateNumberOfSubmaps(const SubmapCollection& submaps);
-  void evaluateNumberOfActiveSubmaps(const SubmapCollection& submaps);
-  void evaluateNumberOfObjects(const SubmapCollection& submaps);
+ private:
+  // Writing.
+  void writeHeader();
+  void writeEntries(std::vector<Entry>* entries);
+  void writeText(const Entry& entry);
+  void writeBinary(const std::vector<Entry>& entries);
+  void writerLoop();
+
+  std::thread writer_thread_;
+  std::mutex queue_mutex_;
+  std::condition_variable queue_condition_;
+  std::deque<Entry> queue_;
+  bool stop_writer_ = false;
+  uint64_t num_dropped_entries_ = 0;
 };
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,89 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_MAP_CHECKPOINTER_H_
+#define PANOPTIC_MAPPING_TOOLS_MAP_CHECKPOINTER_H_
+
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Utility class that periodically saves snapshots of the map to an
+ * append-only checkpoint file. Each checkpoint only contains the submaps and
+ * blocks that changed since the previous checkpoint, and is written on a
+ * background thread. Checkpoint files can be loaded with
+ * 'SubmapCollection::loadFromCheckpointFile()' or compacted into a regular
+ * map file with 'MapCheckpointer::compact()'.
+ */
+class MapCheckpointer {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Checkpoint file to write to. Existing files are overwritten.
+    std::string file_path = "";
+
+    // After this many incremental checkpoints the file is rewritten with a
+    // full checkpoint, which bounds its size. Use 0 to never rewrite.
+    int max_incremental_checkpoints = 100;
+
+    Config() { setConfigName("MapCheckpointer"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit MapCheckpointer(const Config& config, bool print_config = true);
+  virtual ~MapCheckpointer();
+
+  /**
+   * @brief Start writing a checkpoint of a snapshot on a background thread.
+   * The snapshot is retained until the next checkpoint to find the changes.
+   *
+   * @param snapshot Snapshot of the map, see 'SubmapCollection::snapshot()'.
+   * Successive checkpoints should be taken from the same chain of snapshots.
+   * @return False if the previous checkpoint is still being written, in which
+   * case this checkpoint is skipped.
+   */
+  bool writeCheckpointAsync(std::shared_ptr<const SubmapCollection> snapshot);
+
+  // Write a checkpoint, blocking until it is written.
+  bool writeCheckpoint(std::shared_ptr<const SubmapCollection> snapshot);
+
+  // Whether a checkpoint is currently being written.
+  bool isBusy() const;
+
+  // Wait for the current checkpoint to be written.
+  void wait();
+
+  /**
+   * @brief Load the latest checkpoint of a checkpoint file and save it as a
+   * regular map file (.panmap).
+   *
+   * @param checkpoint_file Checkpoint file to read.
+   * @param map_file Map file to write.
+   * @return True if the map was saved successfully.
+   */
+  static bool compact(const std::string& checkpoint_file,
+                      const std::string& map_file);
+
+ private:
+  bool write(const std::shared_ptr<const SubmapCollection>& snapshot);
+
+  const Config config_;
+  std::fstream file_;
+  std::shared_ptr<const SubmapCollection> previous_;
+  int num_incremental_checkpoints_ = 0;
+  uint64_t sequence_number_ = 0;
+  std::future<bool> pending_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_MAP_CHECKPOINTER_H_
@@ -1,6 +1,8 @@
 #ifndef PANOPTIC_MAPPING_TOOLS_MAP_RENDERER_H_
 #define PANOPTIC_MAPPING_TOOLS_MAP_RENDERER_H_
 
+#include <vector>
+
 #include <opencv2/core/mat.hpp>
 #include <voxblox/utils/color_maps.h>
 
@@ -13,14 +15,24 @@
 namespace panoptic_mapping {
 
 /**
- * Preliminary tool to visualize the map for debugging. Not very efficient or
- * sophisticated.
+ * Renders the submap meshes into images of submap IDs, classes, and depths,
+ * e.g. for visualization. By default the mesh triangles are rasterized with a
+ * depth buffer in tiles of image rows in parallel, such that the cost is
+ * proportional to the covered pixels rather than to the mesh vertices.
+ * Assumes that the meshes are up to date and does not perform a meshing step
+ * of its own, use 'MeshService::requestVisibleBlocks()' to update them.
  */
 class MapRenderer {
  public:
   struct Config : public config_utilities::Config<Config> {
     int verbosity = 4;
 
+    // If true, rasterize the mesh triangles. Otherwise only the mesh vertices
+    // are projected, which is cheaper for sparse meshes but leaves gaps.
+    bool use_rasterization = true;
+
+    // If true, projected vertices are painted with the size of a voxel to
+    // compensate for their sparsity. Only used without rasterization.
     bool impaint_voxel_size = false;
 
     Config() { setConfigName("MapRenderer"); }
@@ -35,26 +47,76 @@ class MapRenderer {
   virtual ~MapRenderer() = default;
 
   // Tools.
-  // Approximate rendering.
   cv::Mat renderActiveSubmapIDs(const SubmapCollection& submaps,
                                 const Transformation& T_M_C);
   cv::Mat renderActiveSubmapClasses(const SubmapCollection& submaps,
                                     const Transformation& T_M_C);
+
+  /**
+   * @brief Render the submap IDs, class IDs, and depths of the closest surface
+   * in a single pass.
+   *
+   * @param submaps Submaps to render, free space submaps are skipped.
+   * @param T_M_C Pose of the camera in mission frame.
+   * @param only_active_submaps If false, also render inactive submaps.
+   * @param id_image Optional output submap IDs (CV_32SC1), -1 where no
+   * surface is visible.
+   * @param class_image Optional output class IDs (CV_32SC1), -1 where no
+   * surface is visible.
+   * @param depth_image Optional output depths along the optical axis
+   * (CV_32FC1), 0 where no surface is visible.
+   */
+  void render(const SubmapCollection& submaps, const Transformation& T_M_C,
+              bool only_active_submaps, cv::Mat* id_image,
+              cv::Mat* class_image = nullptr,
+              cv::Mat* depth_image = nullptr) const;
+
   cv::Mat colorIdImage(const cv::Mat& id_image, int colors_per_revolution = 20);
 
  private:
   const Config config_;
   Camera camera_;
-
-  //
-  Eigen::MatrixXf range_image_;
   voxblox::ExponentialOffsetIdColorMap id_color_map_;
 
+  // Number of image rows rendered together by one thread.
+  static constexpr int kRowsPerTile_ = 16;
+
+  // The mesh to render for each visible submap.
+  struct VisibleSubmap {
+    const Submap* submap;
+    const MeshLayer* mesh_layer;
+    float voxel_size;
+    Transformation T_C_S;
+  };
+
+  // A triangle in image coordinates of the rendered submap at 'index'.
+  struct ProjectedTriangle {
+    float u[3];
+    float v[3];
+    float inv_depth[3];
+    int u_min, u_max, v_min, v_max;
+    int index;
+  };
+
   // Methods.
-  cv::Mat render(const SubmapCollection& submaps, const Transformation& T_M_C,
-                 bool only_active_submaps, int (*paint)(const Submap&));
-  static int paintSubmapID(const Submap& submap);
-  static int paintClass(const Submap& submap);
+  std::vector<VisibleSubmap> findVisibleSubmaps(const SubmapCollection& submaps,
+                                                const Transformation& T_M_C,
+                                                bool only_active_submaps) const;
+
+  // Render the index of the closest visible submap and its depth per pixel.
+  void rasterize(const std::vector<VisibleSubmap>& visible_submaps,
+                 ThreadPool* thread_pool, cv::Mat* index_image,
+                 cv::Mat* depth_image) const;
+  void splat(const std::vector<VisibleSubmap>& visible_submaps,
+             cv::Mat* index_image, cv::Mat* depth_image) const;
+
+  // Project the triangles of a mesh and sort them into tiles of image rows.
+  void projectTriangles(const VisibleSubmap& visible_submap, int index,
+                        std::vector<std::vector<ProjectedTriangle>>* tiles)
+      const;
+  static void rasterizeTriangle(const ProjectedTriangle& triangle,
+                                int v_begin, int v_end, cv::Mat* index_image,
+                                cv::Mat* inv_depth_image);
 };
 
 }  // namespace panoptic_mapping
@@ -1,13 +1,19 @@
 #ifndef PANOPTIC_MAPPING_TOOLS_PLANNING_INTERFACE_H_
 #define PANOPTIC_MAPPING_TOOLS_PLANNING_INTERFACE_H_
 
+#include <cstdint>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "panoptic_mapping/map/submap.h"
 #include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/tools/esdf_map.h"
 
 namespace panoptic_mapping {
 
+class VoxelStateMap;
+
 /**
  * @brief This class implements a high level interfaces for lookups on the
  * submap collection.
@@ -25,9 +31,48 @@ class PlanningInterface {
     kExpectedOccupied,
   };
 
+  /**
+   * @brief Cache for consecutive nearby lookups, e.g. along a trajectory. It
+   * holds the candidate submaps of the last queried region and the last
+   * looked up block per candidate, such that lookups within the same region
+   * neither query the spatial index nor the block hash maps. The cache is
+   * invalidated when the generation of the submap collection changes. Not
+   * thread-safe, use one context per thread.
+   */
+  class QueryContext {
+   public:
+    QueryContext() = default;
+
+   private:
+    friend class PlanningInterface;
+    struct CachedBlock {
+      BlockIndex index;
+      TsdfBlock::ConstPtr block;
+    };
+    bool is_valid = false;
+    uint64_t generation = 0;
+    FloatingPoint cell_size = 1.f;
+    BlockIndex region;
+    std::vector<int> submap_ids;
+    std::vector<CachedBlock> blocks;  // Per candidate submap.
+  };
+
   // Access.
   const SubmapCollection& getSubmapCollection() const { return *submaps_; }
 
+  // Set the ESDF used for the ESDF lookups.
+  void setEsdfMap(std::shared_ptr<const EsdfMap> esdf_map) {
+    esdf_map_ = std::move(esdf_map);
+  }
+  bool hasEsdfMap() const { return static_cast<bool>(esdf_map_); }
+
+  // Set a materialized voxel state map, which then answers all voxel state
+  // lookups in constant time at its resolution.
+  void setVoxelStateMap(std::shared_ptr<const VoxelStateMap> voxel_state_map) {
+    voxel_state_map_ = std::move(voxel_state_map);
+  }
+  bool hasVoxelStateMap() const { return static_cast<bool>(voxel_state_map_); }
+
   // Lookups.
   bool isObserved(const Point& position,
                   bool include_inactive_maps = true) const;
@@ -36,9 +81,79 @@ class PlanningInterface {
                    bool consider_change_state = true,
                    bool include_free_space = true) const;
 
+  // Lookups using a query context to cache lookups of nearby positions.
+  bool isObserved(const Point& position, QueryContext* context,
+                  bool include_inactive_maps = true) const;
+  VoxelState getVoxelState(const Point& position, QueryContext* context) const;
+
+  // Voxel state derived from the submaps, also if a voxel state map is set.
+  VoxelState computeVoxelState(const Point& position,
+                               QueryContext* context) const;
+  bool getDistance(const Point& position, QueryContext* context,
+                   float* distance, bool consider_change_state = true,
+                   bool include_free_space = true) const;
+
+  // Euclidean signed distance and optionally its gradient in mission frame.
+  // Returns false if no ESDF is set or the position is not observed.
+  bool getEsdfDistance(const Point& position, float* distance,
+                       Point* gradient = nullptr) const;
+
+  /**
+   * @brief Batched versions of the lookups above for many positions. Queries
+   * are grouped by block, such that the candidate submaps are looked up once
+   * per block, and processed in parallel on the global thread pool. Results
+   * are stored per position in the order of the positions.
+   */
+  void isObserved(const Pointcloud& positions, std::vector<uint8_t>* observed,
+                  bool include_inactive_maps = true) const;
+  void getVoxelStates(const Pointcloud& positions,
+                      std::vector<VoxelState>* states) const;
+  // Distances of unobserved positions are set to 0.
+  void getDistances(const Pointcloud& positions, std::vector<float>* distances,
+                    std::vector<uint8_t>* observed,
+                    bool consider_change_state = true,
+                    bool include_free_space = true) const;
+
  private:
   std::shared_ptr<const SubmapCollection> submaps_;
+  std::shared_ptr<const EsdfMap> esdf_map_;
+  std::shared_ptr<const VoxelStateMap> voxel_state_map_;
   static constexpr float kObservedMinWeight_ = 1e-6;
+
+  // Lookups given the IDs of candidate submaps in iteration order of the
+  // collection, which must include all submaps containing the position. If a
+  // context is given, its blocks correspond to the submap IDs.
+  bool isObserved(const Point& position, const std::vector<int>& submap_ids,
+                  bool include_inactive_maps,
+                  QueryContext* context = nullptr) const;
+  VoxelState getVoxelState(const Point& position,
+                           const std::vector<int>& submap_ids,
+                           QueryContext* context = nullptr) const;
+  bool getDistance(const Point& position, const std::vector<int>& submap_ids,
+                   float* distance, bool consider_change_state,
+                   bool include_free_space) const;
+
+  // Look up the block containing the position, using the cache if set.
+  static const TsdfBlock* lookupBlock(const Submap& submap,
+                                      const Point& position_S,
+                                      QueryContext::CachedBlock* cache);
+
+  // Look up the voxel at the position, including collapsed blocks.
+  static const TsdfVoxel* lookupVoxel(const Submap& submap,
+                                      const Point& position_S,
+                                      QueryContext::CachedBlock* cache);
+
+  // Make sure the context holds the candidate submaps of the position.
+  void updateContext(const Point& position, QueryContext* context) const;
+
+  // Size of the query regions, which is the finest block size of all submaps.
+  FloatingPoint computeCellSize() const;
+
+  // Call function(index, submap_ids) for all positions in parallel, grouped by
+  // block.
+  template <typename FunctionT>
+  void processBatch(const Pointcloud& positions,
+                    const FunctionT& function) const;
 };
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,127 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_QUALITY_CONTROLLER_H_
+#define PANOPTIC_MAPPING_TOOLS_QUALITY_CONTROLLER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Adapts the processing quality to a frame deadline. The controller
+ * tracks smoothed per-stage frame times and, if the frames take too long,
+ * switches the tracker to approximate rendering and coarsens its resolution, or
+ * defers map management, depending on which stage takes longer. When there is
+ * headroom again the reductions are undone. If the full quality leaves
+ * headroom, integration threads are yielded to other processes sharing the
+ * CPU, and they are reclaimed first when the load rises again. The modules read
+ * the current knobs every frame, such that they stay within the configured
+ * bounds of their own configs. The interpolation method is not adjusted, since
+ * the interpolators are fixed when the integrator is constructed.
+ */
+class QualityController {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Target processing time per frame. Use 0 to disable adjustments.
+    float frame_deadline = 0.f;  // ms
+
+    // Quality is reduced if the smoothed frame time exceeds this fraction of
+    // the deadline, and restored if it drops below the lower fraction.
+    float upper_load = 0.9f;
+    float lower_load = 0.6f;
+
+    // Weight of the latest frame in the exponentially smoothed stage times.
+    float smoothing = 0.2f;
+
+    // Minimum number of frames between two adjustments, such that the effect
+    // of an adjustment is observed before the next one.
+    int adjustment_interval = 10;
+
+    // Largest factor by which the rendering subsampling of the tracker is
+    // multiplied. Factors are powers of two.
+    int max_rendering_subsampling_factor = 4;
+
+    // Largest factor by which the intervals of deferrable map management
+    // tasks, such as change detection and pruning, are stretched.
+    int max_map_management_interval_factor = 8;
+
+    // Largest factor by which the number of integration threads is divided
+    // while there is headroom. Factors are powers of two, 1 to never yield
+    // threads. At least one thread is always used.
+    int max_integration_threads_divisor = 1;
+
+    // True: Switch the tracker to approximate rendering before coarsening its
+    // resolution. Has no effect if the tracker renders approximately already.
+    bool allow_approximate_rendering = true;
+
+    Config() { setConfigName("QualityController"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit QualityController(const Config& config, bool print_config = true);
+  virtual ~QualityController() = default;
+
+  /**
+   * @brief Record the stage times of a processed frame and adjust the quality
+   * if needed. Must be called once per frame.
+   *
+   * @param tracking Time spent on ID tracking in ms.
+   * @param integration Time spent on integration in ms.
+   * @param management Time spent on map management in ms.
+   */
+  void recordFrame(float tracking, float integration, float management);
+
+  // Current factors. Thread-safe.
+  int getRenderingSubsamplingFactor() const {
+    return rendering_subsampling_factor_;
+  }
+  int getMapManagementIntervalFactor() const {
+    return map_management_interval_factor_;
+  }
+  int getIntegrationThreadsDivisor() const {
+    return integration_threads_divisor_;
+  }
+  bool useApproximateRendering() const { return use_approximate_rendering_; }
+
+  // Number of integration threads to use for the configured number. Thread-
+  // safe.
+  int getIntegrationThreads(int configured_threads) const {
+    return std::max(1, configured_threads / integration_threads_divisor_);
+  }
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Returns true if a factor was changed.
+  bool reduceQuality();
+  bool restoreQuality();
+  bool yieldThreads();
+  void logAdjustment(const std::string& action) const;
+
+  const Config config_;
+
+  // Smoothed stage times in ms.
+  float tracking_ = 0.f;
+  float integration_ = 0.f;
+  float management_ = 0.f;
+  bool has_times_ = false;
+  int frames_since_adjustment_ = 0;
+  bool is_saturated_ = false;
+
+  std::atomic<int> rendering_subsampling_factor_{1};
+  std::atomic<int> map_management_interval_factor_{1};
+  std::atomic<int> integration_threads_divisor_{1};
+  std::atomic<bool> use_approximate_rendering_{false};
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_QUALITY_CONTROLLER_H_
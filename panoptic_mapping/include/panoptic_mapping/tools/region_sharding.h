@@ -0,0 +1,69 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_REGION_SHARDING_H_
+#define PANOPTIC_MAPPING_TOOLS_REGION_SHARDING_H_
+
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Assignment of space to a fixed number of shards, e.g. map servers in
+ * different processes. Space is split into cubic regions that are hashed to
+ * the shards. A submap belongs to all shards whose regions its bounding
+ * volume intersects, such that every shard holds all submaps that contain its
+ * positions. The assignment only depends on the config, so mapping nodes,
+ * servers, and clients agree on it without communication.
+ */
+class RegionSharding {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Number of shards to split the map into.
+    int num_shards = 1;
+
+    // Side length of the regions in meters.
+    float region_size = 20.f;
+
+    Config() { setConfigName("RegionSharding"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit RegionSharding(const Config& config);
+  virtual ~RegionSharding() = default;
+
+  // Shard of the region containing a position in mission frame.
+  int getShard(const Point& position_M) const;
+
+  // All shards whose regions intersect a sphere in mission frame, sorted.
+  std::vector<int> getShards(const Point& center_M, FloatingPoint radius) const;
+
+  // All shards the submap belongs to, based on its bounding volume.
+  std::vector<int> getShards(const Submap& submap) const;
+  bool submapIsInShard(const Submap& submap, int shard) const;
+
+  /**
+   * @brief Split a batch of queries by shard.
+   *
+   * @param positions Query positions in mission frame.
+   * @param indices Output indices of the positions per shard, in the order of
+   * the positions.
+   */
+  void splitByShard(const Pointcloud& positions,
+                    std::vector<std::vector<size_t>>* indices) const;
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  int getShard(const BlockIndex& region) const;
+
+  const Config config_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_REGION_SHARDING_H_
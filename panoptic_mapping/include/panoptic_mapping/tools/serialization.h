@@ -1,11 +1,16 @@
 #ifndef PANOPTIC_MAPPING_TOOLS_SERIALIZATION_H_
 #define PANOPTIC_MAPPING_TOOLS_SERIALIZATION_H_
 
+#include <functional>
+#include <istream>
 #include <memory>
+#include <ostream>
 #include <utility>
 
+#include <google/protobuf/message.h>
 #include <voxblox/Block.pb.h>
 
+#include "panoptic_mapping/ClassLayer.pb.h"
 #include "panoptic_mapping/Submap.pb.h"
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/map/classification/class_layer.h"
@@ -73,6 +78,156 @@ bool loadClassBlocksFromStream(const SubmapProto& submap_proto,
 bool isCompatible(const voxblox::BlockProto& block_proto,
                   const ClassLayer& layer);
 
+/**
+ * @brief Get the number of words needed to serialize the first num_voxels
+ * voxels of a class block, such that a buffer can be sized once for the block.
+ */
+size_t getSerializedClassBlockSize(const ClassBlock& block, size_t num_voxels);
+
+/**
+ * @brief Serialize the voxels of a class block into a caller-provided buffer
+ * without intermediate allocations.
+ *
+ * @param block Block to serialize.
+ * @param num_voxels Number of voxels to serialize.
+ * @param data Buffer holding at least 'getSerializedClassBlockSize()' words.
+ * @param offsets Optional buffer of num_voxels + 1 entries that is set to the
+ * start of every voxel in data, followed by the end of the last voxel.
+ * @return The number of words written.
+ */
+size_t serializeClassBlock(const ClassBlock& block, size_t num_voxels,
+                           uint32_t* data, size_t* offsets = nullptr);
+
+/**
+ * @brief De-serialize the first num_voxels voxels of a class block from a
+ * buffer written by 'serializeClassBlock()'.
+ *
+ * @return True if all voxels were de-serialized.
+ */
+bool deserializeClassBlock(const uint32_t* data, size_t size,
+                           size_t num_voxels, ClassBlock* block);
+
+// Encodings of the class blocks of a submap, stored in the SubmapProto.
+enum class ClassBlockEncoding : uint32_t { kVoxbloxBlock = 0, kRunLength };
+
+/**
+ * @brief Encode the serialized voxels of a class block. Runs of voxels equal to
+ * their predecessor, such as unobserved voxels, are stored as a single count.
+ * All other voxels are stored as zigzag varint deltas to the words of the
+ * previous voxel. The encoding works for all class voxel types and is
+ * independent of the layer specific block serialization.
+ *
+ * @param layer Layer containing the block.
+ * @param index Index of the block to encode.
+ * @param proto Proto to write the encoded block to.
+ * @return True if the block exists.
+ */
+bool encodeClassBlock(const ClassLayer& layer, const BlockIndex& index,
+                      ClassBlockProto* proto);
+
+/**
+ * @brief Decode a block encoded with 'encodeClassBlock()' and add it to a
+ * layer, replacing existing blocks at its index.
+ *
+ * @return True if the block was decoded successfully.
+ */
+bool decodeClassBlock(const ClassBlockProto& proto, ClassLayer* layer);
+
+// Write the given blocks of a class layer as encoded ClassBlockProtos.
+bool saveClassBlocksToStream(const ClassLayer& layer,
+                             const voxblox::BlockIndexList& block_indices,
+                             std::ostream* outfile_ptr);
+
+/**
+ * @brief Write a size-prefixed proto message to a stream. Uses the same format
+ * as 'voxblox::utils::writeProtoMsgToStream()' but works for all streams, e.g.
+ * to serialize data into memory.
+ */
+bool writeProtoMsgToStream(const google::protobuf::Message& message,
+                           std::ostream* stream_out);
+
+// Encodings of the TSDF blocks of a submap, stored in the SubmapProto.
+enum class TsdfBlockEncoding : uint32_t { kVoxbloxBlock = 0, kQuantized };
+
+// Settings of the quantized TSDF block encoding, see 'encodeTsdfBlock()'.
+struct TsdfQuantization {
+  // Number of bits used to store the distance, 8 or 16.
+  int distance_bits = 16;
+
+  // If true, colors are not stored and decoded voxels are gray.
+  bool drop_color = false;
+};
+
+/**
+ * @brief Encode a TSDF block compactly, e.g. for transmission. Distances are
+ * quantized linearly within the truncation band and weights logarithmically
+ * to 8 bits within the weight range of the block, as in the
+ * CompressedTsdfLayer. Unobserved voxels and runs of equal quantized voxels
+ * are run-length encoded.
+ *
+ * @param layer Layer containing the block.
+ * @param index Index of the block to encode.
+ * @param truncation_distance Truncation distance of the layer in meters,
+ * larger distances are clamped.
+ * @param quantization Quantization settings.
+ * @param proto Proto to write the encoded block to.
+ * @return True if the block exists.
+ */
+bool encodeTsdfBlock(const TsdfLayer& layer, const BlockIndex& index,
+                     float truncation_distance,
+                     const TsdfQuantization& quantization,
+                     TsdfBlockProto* proto);
+
+/**
+ * @brief Decode a block encoded with 'encodeTsdfBlock()' and write it to a
+ * layer, replacing existing blocks at its index.
+ *
+ * @param index Optional output of the index of the decoded block.
+ * @return True if the block was decoded successfully.
+ */
+bool decodeTsdfBlock(const TsdfBlockProto& proto, float truncation_distance,
+                     TsdfLayer* layer, BlockIndex* index = nullptr);
+
+/**
+ * @brief Write the given blocks of a TSDF layer.
+ *
+ * @param quantization If set, the blocks are written as quantized
+ * TsdfBlockProtos, otherwise as voxblox BlockProtos.
+ */
+bool saveTsdfBlocksToStream(const TsdfLayer& layer,
+                            const voxblox::BlockIndexList& block_indices,
+                            float truncation_distance,
+                            const TsdfQuantization* quantization,
+                            std::ostream* outfile_ptr);
+
+// Returns whether the block at the given index is to be loaded.
+using BlockFilter = std::function<bool(const BlockIndex&)>;
+
+/**
+ * @brief Read the TSDF blocks of a submap in the encoding of its header and
+ * write them to a layer, replacing existing blocks.
+ *
+ * @param loaded_blocks Optional output of the indices of all loaded blocks.
+ * @param block_filter Optional filter. Rejected blocks are read from the
+ * stream but neither decoded nor added to the layer.
+ * @return True if all blocks were read.
+ */
+bool loadTsdfBlocksFromStream(const SubmapProto& submap_proto,
+                              std::istream* proto_file_ptr,
+                              uint64_t* tmp_byte_offset_ptr, TsdfLayer* layer,
+                              voxblox::BlockIndexList* loaded_blocks = nullptr,
+                              const BlockFilter& block_filter = BlockFilter());
+
+/**
+ * @brief Step over the next length-prefixed protobuf message of a stream
+ * without reading it.
+ *
+ * @param tmp_byte_offset_ptr Byte offset of the message, is advanced past it.
+ * @return True if the length of the message could be read.
+ */
+bool skipProtoMsgFromStream(std::istream* proto_file_ptr,
+                            uint64_t* tmp_byte_offset_ptr);
+
 }  // namespace panoptic_mapping
 
 #endif  // PANOPTIC_MAPPING_TOOLS_SERIALIZATION_H_
@@ -0,0 +1,115 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_SHARED_MAP_CLIENT_H_
+#define PANOPTIC_MAPPING_TOOLS_SHARED_MAP_CLIENT_H_
+
+#include <cstdint>
+#include <string>
+
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/tools/planning_interface.h"
+#include "panoptic_mapping/tools/shared_map_layout.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Read-only access to the map snapshots exported by a
+ * 'SharedMapExporter' of another process on the same machine. Implements the
+ * lookups of the 'PlanningInterface' directly on the shared memory segment,
+ * such that queries neither copy the map nor communicate with the mapper.
+ * Every query evaluates the latest published generation and is retried if the
+ * snapshot is overwritten while it is evaluated. Queries are thread-safe.
+ */
+class SharedMapClient {
+ public:
+  using VoxelState = PlanningInterface::VoxelState;
+
+  SharedMapClient() = default;
+  explicit SharedMapClient(const std::string& segment_name);
+  virtual ~SharedMapClient();
+
+  SharedMapClient(const SharedMapClient&) = delete;
+  SharedMapClient& operator=(const SharedMapClient&) = delete;
+
+  /**
+   * @brief Map the shared memory segment of an exporter.
+   *
+   * @param segment_name Name of the segment, see 'SharedMapExporter::Config'.
+   * @return True if the segment exists and was created by a compatible
+   * exporter.
+   */
+  bool connect(const std::string& segment_name);
+  void disconnect();
+  bool isConnected() const { return header_ != nullptr; }
+
+  // Generation of the latest published snapshot, 0 if none was published.
+  uint64_t getGeneration() const;
+
+  /**
+   * @brief Lookups with the semantics of the lookups of the same name of the
+   * 'PlanningInterface'. Return false or kUnknown if no snapshot is available
+   * or the snapshot kept changing during the query.
+   */
+  bool isObserved(const Point& position,
+                  bool include_inactive_maps = true) const;
+  VoxelState getVoxelState(const Point& position) const;
+  bool getDistance(const Point& position, float* distance,
+                   bool consider_change_state = true,
+                   bool include_free_space = true) const;
+
+ private:
+  // Number of attempts to evaluate a query on a consistent snapshot.
+  static constexpr int kMaxAttempts = 16;
+  static constexpr float kObservedMinWeight_ = 1e-6;
+
+  // View of a slot that is valid while its sequence number does not change.
+  struct Slot {
+    const char* data;
+    size_t size;
+    uint32_t num_submaps;
+  };
+
+  /**
+   * @brief Evaluate a query on the current slot until the result is
+   * consistent. 'query' is called as query(slot), returns the result and must
+   * only read the slot through the bounds checked accessors below.
+   */
+  template <typename ResultT, typename QueryT>
+  bool evaluate(QueryT query, ResultT* result) const;
+
+  // Bounds checked accessors, which return nullptr for invalid offsets.
+  static const shared_map::SubmapRecord* getRecord(const Slot& slot,
+                                                   uint32_t index);
+  static const shared_map::BlockEntry* findBlock(
+      const Slot& slot, const shared_map::SubmapRecord& record,
+      const BlockIndex& index);
+  static const shared_map::Voxel* lookupVoxel(
+      const Slot& slot, const shared_map::SubmapRecord& record,
+      const voxblox::GlobalIndex& voxel_index);
+
+  // Position in submap frame if it is within the bounding volume.
+  static bool transformToSubmap(const shared_map::SubmapRecord& record,
+                                const Point& position, Point* position_S);
+
+  // Whether the voxel at the position belongs to the submap according to its
+  // class mask.
+  static bool belongsToSubmap(const Slot& slot,
+                              const shared_map::SubmapRecord& record,
+                              const Point& position_S);
+
+  // Trilinearly interpolated distance, falling back to uniform blocks.
+  static bool interpolateDistance(const Slot& slot,
+                                  const shared_map::SubmapRecord& record,
+                                  const Point& position_S, float* distance);
+
+  bool isObserved(const Slot& slot, const Point& position,
+                  bool include_inactive_maps) const;
+  VoxelState getVoxelState(const Slot& slot, const Point& position) const;
+  bool getDistance(const Slot& slot, const Point& position, float* distance,
+                   bool consider_change_state, bool include_free_space) const;
+
+  const shared_map::SegmentHeader* header_ = nullptr;
+  size_t segment_size_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_SHARED_MAP_CLIENT_H_
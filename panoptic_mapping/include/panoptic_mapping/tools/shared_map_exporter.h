@@ -0,0 +1,80 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_SHARED_MAP_EXPORTER_H_
+#define PANOPTIC_MAPPING_TOOLS_SHARED_MAP_EXPORTER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/tools/shared_map_layout.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Exports read-only snapshots of the map to a POSIX shared memory
+ * segment, such that other processes on the same machine can query the map
+ * without copies or messages using the 'SharedMapClient'. Each export writes
+ * the submap metadata, block index and TSDF voxels of a snapshot and publishes
+ * it as a new generation, see 'shared_map_layout.h'. The segment is removed
+ * when the exporter is destroyed.
+ */
+class SharedMapExporter {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Name of the shared memory segment, starting with '/'.
+    std::string segment_name = "/panoptic_mapping";
+
+    // Size of each of the two snapshot slots in MB. Snapshots that do not fit
+    // are not exported.
+    int slot_size_mb = 256;
+
+    // Which submaps to export.
+    bool include_inactive_submaps = true;
+    bool include_free_space = true;
+
+    Config() { setConfigName("SharedMapExporter"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit SharedMapExporter(const Config& config, bool print_config = true);
+  virtual ~SharedMapExporter();
+
+  /**
+   * @brief Write the submaps to the shared memory segment and publish them as
+   * the latest generation.
+   *
+   * @param submaps Submaps to export, e.g. a snapshot of the map.
+   * @return True if the snapshot was exported.
+   */
+  bool exportSnapshot(const SubmapCollection& submaps);
+
+  // Whether the shared memory segment was created successfully.
+  bool isOpen() const { return header_ != nullptr; }
+
+  // Generation of the latest exported snapshot, 0 if none was exported.
+  uint64_t getGeneration() const;
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Size of the exported data of a submap in bytes.
+  static size_t computeSubmapSize(const Submap& submap);
+
+  // Write a submap to the slot starting at 'offset', returns the new offset.
+  static size_t writeSubmap(const Submap& submap, char* slot, size_t offset,
+                            shared_map::SubmapRecord* record);
+
+  const Config config_;
+  shared_map::SegmentHeader* header_ = nullptr;
+  size_t segment_size_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_SHARED_MAP_EXPORTER_H_
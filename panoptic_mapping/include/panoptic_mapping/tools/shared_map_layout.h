@@ -0,0 +1,114 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_SHARED_MAP_LAYOUT_H_
+#define PANOPTIC_MAPPING_TOOLS_SHARED_MAP_LAYOUT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace panoptic_mapping {
+namespace shared_map {
+
+/**
+ * @brief Memory layout of map snapshots exported to a POSIX shared memory
+ * segment by the 'SharedMapExporter' and read by the 'SharedMapClient'. The
+ * segment starts with a SegmentHeader followed by two slots of equal size.
+ * Snapshots are written to the slot that is not current, which is then
+ * published by switching the current slot and incrementing the generation.
+ * Every slot is guarded by a sequence lock, such that readers detect if the
+ * slot was overwritten during a query and retry.
+ *
+ * A slot contains the SubmapRecords of all exported submaps in iteration order
+ * of the collection. Every record references an open addressing hash table of
+ * BlockEntries with linear probing, whose capacity is a power of 2. Blocks
+ * store the voxels of the block in linear index order, or a single voxel for
+ * uniform (collapsed) blocks. All offsets are in bytes from the start of the
+ * slot and 8-byte aligned.
+ */
+
+constexpr uint32_t kMagic = 0x4d4e4150;  // "PANM"
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kNumSlots = 2;
+constexpr size_t kAlignment = 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Shared memory requires lock free atomics.");
+
+struct SlotHeader {
+  // Odd while the slot is being written.
+  std::atomic<uint64_t> sequence;
+  uint64_t generation;
+  uint64_t used_bytes;
+  uint32_t num_submaps;
+  uint32_t padding;
+};
+
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t slot_size;  // Bytes.
+  // Generation of the latest published snapshot, 0 if none was published.
+  std::atomic<uint64_t> generation;
+  std::atomic<uint64_t> current_slot;
+  SlotHeader slots[kNumSlots];
+};
+
+struct SubmapRecord {
+  int32_t id;
+  int32_t class_id;
+  int32_t label;         // PanopticLabel.
+  int32_t change_state;  // ChangeState.
+  uint8_t is_active;
+  uint8_t has_class_masks;
+  uint16_t padding;
+  int32_t voxels_per_side;
+  float voxel_size;
+  float truncation_distance;
+  float T_S_M[12];  // Row-major 3x4 matrix.
+  float bounding_center[3];
+  float bounding_radius;
+  uint64_t blocks_offset;
+  uint64_t blocks_capacity;
+};
+
+struct BlockEntry {
+  static constexpr uint32_t kOccupied = 1;
+  static constexpr uint32_t kUniform = 2;
+  int32_t x;
+  int32_t y;
+  int32_t z;
+  uint32_t flags;
+  uint64_t voxels_offset;
+  // Bit mask of the voxels that belong to the submap, 0 if the block has no
+  // class block.
+  uint64_t class_mask_offset;
+};
+
+struct Voxel {
+  float distance;
+  float weight;
+};
+
+inline size_t alignUp(size_t bytes) {
+  return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Offset of the first slot from the start of the segment.
+inline size_t slotsOffset() { return alignUp(sizeof(SegmentHeader)); }
+
+// Size of the class mask of a block in bytes.
+inline size_t classMaskSize(size_t num_voxels) {
+  return (num_voxels + 63) / 64 * sizeof(uint64_t);
+}
+
+// Start index of a block in its hash table.
+inline uint64_t blockHash(int32_t x, int32_t y, int32_t z) {
+  uint64_t hash = static_cast<uint32_t>(x);
+  hash = hash * 0x9e3779b97f4a7c15ull + static_cast<uint32_t>(y);
+  hash = hash * 0x9e3779b97f4a7c15ull + static_cast<uint32_t>(z);
+  return hash ^ (hash >> 29);
+}
+
+}  // namespace shared_map
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_SHARED_MAP_LAYOUT_H_
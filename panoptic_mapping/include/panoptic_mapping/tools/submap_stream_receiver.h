@@ -0,0 +1,79 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_SUBMAP_STREAM_RECEIVER_H_
+#define PANOPTIC_MAPPING_TOOLS_SUBMAP_STREAM_RECEIVER_H_
+
+#include <string>
+#include <vector>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Ingests the messages of a single 'SubmapStreamer' into a submap
+ * collection, which can aggregate the streams of several sources with one
+ * receiver each. Streamed submaps are created, updated block-wise, and removed
+ * in place without reloading the collection. If a message is lost, incremental
+ * messages are rejected until the next full message arrives.
+ */
+class SubmapStreamReceiver {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // If true, the meshes of the received blocks are updated.
+    bool update_meshes = true;
+
+    // If true, received submaps are set inactive such that they are not
+    // modified by local integration.
+    bool deactivate_submaps = true;
+
+    Config() { setConfigName("SubmapStreamReceiver"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit SubmapStreamReceiver(const Config& config,
+                                bool print_config = true);
+  virtual ~SubmapStreamReceiver() = default;
+
+  /**
+   * @brief Apply a message encoded by 'SubmapStreamer::encodeMessage()'.
+   *
+   * @param message The binary message.
+   * @param submaps Collection to ingest the submaps into, needs to be the same
+   * for all messages of the stream.
+   * @return True if the message was applied.
+   */
+  bool applyMessage(const std::string& message, SubmapCollection* submaps);
+
+  /**
+   * @brief Remove all submaps received from the stream from the collection and
+   * wait for the next full message.
+   */
+  void reset(SubmapCollection* submaps);
+
+  // Whether the received state is consistent with the source.
+  bool isSynchronized() const { return is_synchronized_; }
+
+  // IDs of the received submaps in the collection.
+  std::vector<int> getSubmapIDs() const;
+
+  // Correspondence of the source to the collection IDs.
+  const SourceIDMap& getIDMap() const { return id_map_; }
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+  SourceIDMap id_map_;
+  bool is_synchronized_ = false;
+  uint64_t next_sequence_number_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_SUBMAP_STREAM_RECEIVER_H_
@@ -0,0 +1,98 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_SUBMAP_STREAMER_H_
+#define PANOPTIC_MAPPING_TOOLS_SUBMAP_STREAMER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Encodes snapshots of the map into compact binary messages for
+ * streaming submaps to other processes, e.g. from robots to a central server.
+ * Each message is a map checkpoint that only contains the submaps and blocks
+ * that changed since the previous message, with optionally quantized TSDF
+ * blocks. Messages are applied by a 'SubmapStreamReceiver'. Full messages are
+ * sent periodically such that receivers can recover from lost messages.
+ */
+class SubmapStreamer {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // After this many incremental messages a full message with all submaps is
+    // sent. Use 0 to only send full messages when requested.
+    int max_incremental_messages = 50;
+
+    // If true, TSDF blocks are quantized and run-length encoded.
+    bool quantize_tsdf = true;
+
+    // Number of bits used to store quantized distances, 8 or 16.
+    int distance_bits = 16;
+
+    // If true, quantized blocks are sent without color.
+    bool drop_color = false;
+
+    Config() { setConfigName("SubmapStreamer"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit SubmapStreamer(const Config& config, bool print_config = true);
+  virtual ~SubmapStreamer() = default;
+
+  /**
+   * @brief Encode the changes of a snapshot since the previous message. The
+   * snapshot is retained until the next message to find the changes.
+   *
+   * @param snapshot Snapshot of the map, see 'SubmapCollection::snapshot()'.
+   * Successive messages should be encoded from the same chain of snapshots.
+   * @param message Output binary message.
+   * @return True if a message was encoded, false if nothing changed or
+   * encoding failed.
+   */
+  bool encodeMessage(std::shared_ptr<const SubmapCollection> snapshot,
+                     std::string* message);
+
+  /**
+   * @brief Only stream the submaps that pass a filter, e.g. the submaps of a
+   * region. Submaps that stop passing are removed at the receiver, submaps
+   * that start passing are sent completely.
+   *
+   * @param filter Function evaluated on the submaps of each snapshot.
+   */
+  void setSubmapFilter(std::function<bool(const Submap&)> filter) {
+    submap_filter_ = std::move(filter);
+  }
+
+  // Send all submaps with the next message, e.g. when a receiver connects.
+  // Thread-safe.
+  void requestFullMessage() { full_message_requested_ = true; }
+
+  // Sequence number of the next message.
+  uint64_t getSequenceNumber() const { return sequence_number_; }
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  const Config config_;
+  std::function<bool(const Submap&)> submap_filter_;
+  std::shared_ptr<const SubmapCollection> previous_;
+  std::unordered_set<int> previous_ids_;
+  int num_incremental_messages_ = 0;
+  uint64_t sequence_number_ = 0;
+  std::atomic<bool> full_message_requested_{false};
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_SUBMAP_STREAMER_H_
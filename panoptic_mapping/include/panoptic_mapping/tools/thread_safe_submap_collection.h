@@ -1,7 +1,10 @@
 #ifndef PANOPTIC_MAPPING_TOOLS_THREAD_SAFE_SUBMAP_COLLECTION_H_
 #define PANOPTIC_MAPPING_TOOLS_THREAD_SAFE_SUBMAP_COLLECTION_H_
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <utility>
 
 #include "panoptic_mapping/common/common.h"
@@ -11,45 +14,70 @@ namespace panoptic_mapping {
 
 /**
  * This class wraps a submap collection for thread-safe read-only access by
- * simply copying the original submap collection.
+ * taking copy-on-write snapshots of the original submap collection. Submaps and
+ * blocks that did not change between updates are shared between snapshots.
  */
 
 class ThreadSafeSubmapCollection {
  public:
   /* Construction */
   explicit ThreadSafeSubmapCollection(std::shared_ptr<SubmapCollection> submaps)
-      : submaps_source_(std::move(submaps)), updated_(new bool()) {
+      : submaps_source_(std::move(submaps)) {
     update();
   }
   virtual ~ThreadSafeSubmapCollection() = default;
 
   /* Interaction */
-  // Update the lookup submaps based on the source submaps.
-  void update() {
+  // Update the lookup submaps based on the source submaps and return the new
+  // snapshot. Concurrent updates are serialized, since each snapshot is taken
+  // relative to the previous one.
+  std::shared_ptr<const SubmapCollection> update() {
+    std::lock_guard<std::mutex> update_lock(*update_mutex_);
     Timer timer("tools/thread_safe_submap_collection/update");
-    submaps_ = submaps_source_->clone();
+    std::shared_ptr<const SubmapCollection> snapshot =
+        submaps_source_->snapshot(getSubmapsPtr().get());
     timer.Stop();
-    *updated_ = true;
+    std::lock_guard<std::mutex> lock(*mutex_);
+    submaps_ = snapshot;
+    ++generation_;
+    return snapshot;
   }
 
-  // Check whether there were any updates since the last lookup.
-  bool wasUpdated() const { return *updated_; }
+  // The generation increases with every update. Each consumer keeps the
+  // generation of the snapshot it last read to check for updates.
+  uint64_t getGeneration() const { return generation_; }
+  bool wasUpdatedSince(uint64_t generation) const {
+    return generation_ > generation;
+  }
+
+  // Get read-only access to the current snapshot. The reference is only valid
+  // until the next update, use 'getSubmapsPtr()' if updates can happen
+  // concurrently.
+  const SubmapCollection& getSubmaps() const { return *getSubmapsPtr(); }
 
-  // Get thread-safe read-only access to the collection
-  const SubmapCollection& getSubmaps() const {
-    *updated_ = false;
-    return *submaps_;
+  // Get shared ownership of the current snapshot, which remains valid even if
+  // the collection is updated while it is being accessed. Optionally also
+  // returns the generation of the snapshot.
+  std::shared_ptr<const SubmapCollection> getSubmapsPtr(
+      uint64_t* generation = nullptr) const {
+    std::lock_guard<std::mutex> lock(*mutex_);
+    if (generation) {
+      *generation = generation_;
+    }
+    return submaps_;
   }
 
  private:
   // Reference to the original submap collection.
   std::shared_ptr<SubmapCollection> submaps_source_;
 
-  // Deep copy of the submap collection for thread-safe read-only access.
-  std::unique_ptr<SubmapCollection> submaps_;
+  // Snapshot of the submap collection for thread-safe read-only access.
+  std::shared_ptr<const SubmapCollection> submaps_;
+  std::unique_ptr<std::mutex> mutex_ = std::make_unique<std::mutex>();
+  std::unique_ptr<std::mutex> update_mutex_ = std::make_unique<std::mutex>();
 
-  // Track whether the submaps were updated since last lookup.
-  std::unique_ptr<bool> updated_;
+  // Number of updates, only changed together with the snapshot.
+  std::atomic<uint64_t> generation_{0};
 };
 
 }  // namespace panoptic_mapping
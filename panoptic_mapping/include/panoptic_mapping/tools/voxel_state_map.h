@@ -0,0 +1,120 @@
+#ifndef PANOPTIC_MAPPING_TOOLS_VOXEL_STATE_MAP_H_
+#define PANOPTIC_MAPPING_TOOLS_VOXEL_STATE_MAP_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/change_feed.h"
+#include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/tools/planning_interface.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Materialized voxel states of the whole map for high-rate collision
+ * checking. The states as computed by 'PlanningInterface::getVoxelState()' are
+ * sampled at the cell centers of a global grid and stored in 4 bits per cell
+ * in sparse blocks, blocks that are entirely unknown are not stored. Lookups
+ * thus take constant time, independent of the number of overlapping submaps.
+ *
+ * The grid is kept up to date incrementally: 'processChanges()' marks the grid
+ * blocks covered by the changed submap blocks of a change set, as well as the
+ * whole extent of submaps that were created, removed, moved, finished, or
+ * whose change state was updated by change detection. 'update()' then
+ * recomputes the marked blocks.
+ */
+class VoxelStateMap {
+ public:
+  using VoxelState = PlanningInterface::VoxelState;
+
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // Grid resolution in meters. Lookups return the state at the center of
+    // the cell containing the position.
+    float voxel_size = 0.1f;
+
+    // Number of cells per block side.
+    int voxels_per_side = 16;
+
+    Config() { setConfigName("VoxelStateMap"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit VoxelStateMap(const Config& config, bool print_config = true);
+  virtual ~VoxelStateMap() = default;
+
+  /**
+   * @brief Mark the grid blocks affected by a change set for the next update.
+   * If change sets were missed, all submaps are marked. Call this from a
+   * subscription to the change feed of the collection.
+   *
+   * @param changes The change set of the collection.
+   * @param submaps The collection after the changes.
+   */
+  void processChanges(const MapChangeSet& changes,
+                      const SubmapCollection& submaps);
+
+  /**
+   * @brief Recompute all marked grid blocks in parallel. On the first call,
+   * the states of the whole map are computed.
+   *
+   * @param planning_interface Interface to the collection the changes were
+   * processed for.
+   */
+  void update(const PlanningInterface& planning_interface);
+
+  // Constant time lookup in mission frame. Not thread-safe with 'update()'.
+  VoxelState getVoxelState(const Point& position) const;
+
+  // Access.
+  size_t getNumberOfBlocks() const { return blocks_.size(); }
+  size_t getNumberOfDirtyBlocks() const { return dirty_blocks_.size(); }
+  size_t getMemorySize() const;
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Two cells per byte, the lower nibble holds the even cell.
+  using StateBlock = std::vector<uint8_t>;
+
+  // Mark the grid blocks overlapping an axis aligned box in mission frame and
+  // add them to the blocks.
+  void addBlocksInBox(const Point& min_M, const Point& max_M,
+                      voxblox::IndexSet* blocks);
+  // Mark the recorded extent of a submap and forget it.
+  void markSubmap(int submap_id);
+  // Mark and record the extent of the bounding volume of a submap.
+  void markBoundingVolume(const Submap& submap);
+  // Mark all submaps of the collection, dropping all recorded extents.
+  void markAll(const SubmapCollection& submaps);
+
+  // Compute the states of a block, returns false if all cells are unknown.
+  bool computeBlock(const PlanningInterface& planning_interface,
+                    const BlockIndex& index, StateBlock* block) const;
+
+  const Config config_;
+  const FloatingPoint block_size_;
+  const FloatingPoint block_size_inv_;
+  const size_t num_cells_;
+
+  voxblox::AnyIndexHashMapType<StateBlock>::type blocks_;
+
+  // Grid blocks to recompute and the grid blocks covered by each submap.
+  voxblox::IndexSet dirty_blocks_;
+  std::unordered_map<int, voxblox::IndexSet> submap_blocks_;
+  bool is_initialized_ = false;
+  bool has_sequence_number_ = false;
+  uint64_t next_sequence_number_ = 0;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TOOLS_VOXEL_STATE_MAP_H_
@@ -32,8 +32,9 @@ class DetectronIDTracker : public ProjectiveIDTracker {
   void processInput(SubmapCollection* submaps, InputData* input) override;
 
  protected:
-  Submap* allocateSubmap(int input_id, SubmapCollection* submaps,
-                         InputData* input) override;
+  std::vector<Submap*> allocateSubmaps(const std::vector<int>& input_ids,
+                                       SubmapCollection* submaps,
+                                       InputData* input) override;
   bool classesMatch(int input_id, int submap_class_id) override;
 
  private:
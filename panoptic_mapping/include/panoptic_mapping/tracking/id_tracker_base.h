@@ -51,6 +51,20 @@ class IDTrackerBase : public InputDataUser {
     visualize_ = true;
   }
 
+  /**
+   * @brief Sets a callback that is queried whether an image is currently
+   * requested, e.g. because its topic has subscribers. Images that are not
+   * requested are neither computed nor visualized. If not set, all images are
+   * requested while visualization is on.
+   *
+   * @param callback The function that returns whether the image of the given
+   * name is requested.
+   */
+  void setVisualizationRequestedCallback(
+      std::function<bool(const std::string&)> callback) {
+    visualization_requested_callback_ = std::move(callback);
+  }
+
   /**
    * @brief Set the submap allocator that is used to allocate non-freespace
    * maps.
@@ -80,6 +94,10 @@ class IDTrackerBase : public InputDataUser {
 
   // Visualization
   bool visualizationIsOn() const { return visualize_; }
+  bool visualizationIsRequested(const std::string& name) const {
+    return visualize_ && (!visualization_requested_callback_ ||
+                          visualization_requested_callback_(name));
+  }
   void visualize(const cv::Mat& image, const std::string& name) {
     if (visualize_) {
       visualization_callback_(image, name);
@@ -90,6 +108,7 @@ class IDTrackerBase : public InputDataUser {
   bool visualize_ = false;
   std::function<void(const cv::Mat&, const std::string&)>
       visualization_callback_;
+  std::function<bool(const std::string&)> visualization_requested_callback_;
 };
 
 }  // namespace panoptic_mapping
@@ -1,10 +1,12 @@
 #ifndef PANOPTIC_MAPPING_TRACKING_PROJECTIVE_ID_TRACKER_H_
 #define PANOPTIC_MAPPING_TRACKING_PROJECTIVE_ID_TRACKER_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <opencv2/core/mat.hpp>
@@ -16,6 +18,7 @@
 #include "panoptic_mapping/tools/map_renderer.h"
 #include "panoptic_mapping/tracking/id_tracker_base.h"
 #include "panoptic_mapping/tracking/tracking_info.h"
+#include "panoptic_mapping/tracking/tsdf_raycast_renderer.h"
 
 namespace panoptic_mapping {
 
@@ -44,11 +47,61 @@ class ProjectiveIDTracker : public IDTrackerBase {
     // False: Match any mask to the highest metric submap.
     bool use_class_data_for_matching = true;
 
+    // True: Assign all masks jointly such that the sum of the tracking metric
+    // over all matches is maximized and every submap is matched at most once.
+    // False: Greedily match every mask to its highest metric submap.
+    bool use_global_matching = false;
+
     // True: Compute masks by projecting the iso-surface poitns into the frame
     // and account for voxel size. False (experimental): look up each vertex of
     // the depth map in the submap.
     bool use_approximate_rendering = true;
 
+    // True: Render all visible submaps by raycasting their TSDF layers into a
+    // shared depth and ID buffer, such that tracking does not depend on the
+    // meshes. Overrides 'use_approximate_rendering'. Subsampled by
+    // 'rendering_subsampling'.
+    bool use_raycast_rendering = false;
+    TsdfRaycastRenderer::Config raycaster;
+
+    // True: When using approximate rendering, rasterize all visible submaps
+    // into a shared depth and ID buffer such that every pixel is only
+    // attributed to the closest submap. False: Render each submap separately.
+    bool use_depth_buffer = false;
+
+    // True: Map the input and submap IDs to dense indices each frame and
+    // count overlaps in flat histograms instead of hash maps. Only affects
+    // approximate rendering.
+    bool use_compact_counting = false;
+
+    // True: Compute the run-length ID segments of each frame and use them
+    // instead of the dense ID image for counting, translating the IDs, and
+    // for the integrator. Cheaper for images with few, large segments.
+    bool use_id_segments = false;
+
+    // True: Cache the projected surface points of each mesh block and reuse
+    // them in later frames while the block mesh is unchanged and the block has
+    // moved less than the thresholds below in the image. Only affects
+    // approximate rendering.
+    bool use_projection_cache = false;
+
+    // Maximum motion in pixels of the projected block center for which cached
+    // projections are reused.
+    float projection_cache_max_pixel_shift = 0.5f;
+
+    // Maximum change in depth in meters of the block center for which cached
+    // projections are reused.
+    float projection_cache_max_depth_change = 0.01f;
+
+    // True: When using approximate rendering, first estimate the tracking
+    // metrics at a resolution reduced by 'coarse_rendering_subsampling' and
+    // only render submaps at full resolution whose match is ambiguous, i.e.
+    // whose metric is within 'coarse_to_fine_margin' of the acceptance
+    // threshold or of the best candidate of a mask.
+    bool use_coarse_to_fine_rendering = false;
+    int coarse_rendering_subsampling = 4;
+    float coarse_to_fine_margin = 0.1f;
+
     // Subsample the number of looked up vertices when using
     // 'use_approximate_rendering=false' by this factor squared.
     int rendering_subsampling = 1;
@@ -78,19 +131,118 @@ class ProjectiveIDTracker : public IDTrackerBase {
  protected:
   // Internal methods.
   virtual bool classesMatch(int input_id, int submap_class_id);
-  virtual Submap* allocateSubmap(int input_id, SubmapCollection* submaps,
-                                 InputData* input);
+  // Allocate the submaps of all unmatched input IDs of a frame in one batch.
+  // Returns the new submaps in order of the input IDs, nullptr if not
+  // allocated.
+  virtual std::vector<Submap*> allocateSubmaps(
+      const std::vector<int>& input_ids, SubmapCollection* submaps,
+      InputData* input);
+  // Replace all input IDs by the assigned submap IDs, in the ID image and
+  // the ID segments if present.
+  void translateIDImage(const std::unordered_map<int, int>& input_to_output,
+                        InputData* input) const;
+  // Map the input IDs of a frame to dense indices.
+  std::unique_ptr<DenseIDMap> computeInputIDMap(const InputData& input) const;
+  // Count the input pixels of a frame, using the ID segments if present.
+  void insertInputData(const InputData& input,
+                       TrackingInfoAggregator* tracking_data,
+                       const DenseIDMap* input_ids) const;
   TrackingInfoAggregator computeTrackingData(SubmapCollection* submaps,
                                              InputData* input);
+  // Returns <input_id, <submap_id, value>> of all matched input IDs.
+  std::unordered_map<int, std::pair<int, float>> computeGlobalMatches(
+      const TrackingInfoAggregator& tracking_data,
+      const SubmapCollection& submaps);
   TrackingInfo renderTrackingInfo(const Submap& submap,
                                   const InputData& input) const;
 
-  TrackingInfo renderTrackingInfoApproximate(const Submap& submap,
-                                             const InputData& input) const;
+  // Projected surface points of mesh blocks that can be cached over frames.
+  struct ProjectedVertex {
+    int u, v;
+    float depth;
+    int size_x, size_y;
+  };
+  struct BlockProjectionCache {
+    uint64_t mesh_generation = 0;
+    Transformation T_C_S;  // Pose at which the projection was computed.
+    std::vector<ProjectedVertex> vertices;
+  };
+  struct SubmapProjectionCache {
+    // Entries used in the last frame and in the current frame.
+    voxblox::AnyIndexHashMapType<BlockProjectionCache>::type previous;
+    voxblox::AnyIndexHashMapType<BlockProjectionCache>::type current;
+  };
+  // Mesh the visible blocks via the mesh service for approximate rendering.
+  void updateVisibleMeshes(const std::vector<int>& visible_submap_ids,
+                           const Transformation& T_M_C,
+                           SubmapCollection* submaps);
+  void updateProjectionCache(const std::vector<int>& visible_submap_ids);
+  SubmapProjectionCache* getProjectionCache(int submap_id);
+  const std::vector<ProjectedVertex>& projectMeshBlock(
+      const Submap& submap, const voxblox::BlockIndex& block_index,
+      const Transformation& T_C_S, SubmapProjectionCache* cache,
+      std::vector<ProjectedVertex>* buffer) const;
+
+  // Scratch memory of a rendering thread that is reused over frames.
+  struct RenderScratch {
+    TrackingRenderBuffer buffer;
+    std::vector<ProjectedVertex> vertices;
+  };
+
+  TrackingInfo renderTrackingInfoApproximate(
+      const Submap& submap, const InputData& input,
+      const DenseIDMap* input_ids = nullptr,
+      SubmapProjectionCache* cache = nullptr,
+      RenderScratch* scratch = nullptr, int subsampling = 1) const;
+
+  // Render the tracking infos of all given submaps in parallel.
+  std::vector<TrackingInfo> renderTrackingInfos(
+      const std::vector<int>& submap_ids, const SubmapCollection& submaps,
+      const InputData& input, const DenseIDMap* input_ids, int subsampling);
+  // Replace coarse tracking infos of ambiguous matches by full resolution ones.
+  void refineTrackingInfos(const TrackingInfoAggregator& input_data,
+                           const SubmapCollection& submaps,
+                           const InputData& input, const DenseIDMap* input_ids,
+                           std::vector<TrackingInfo>* infos);
 
   TrackingInfo renderTrackingInfoVertices(const Submap& submap,
                                           const InputData& input) const;
 
+  // Z-buffered rendering of all submaps in a single pass.
+  struct Splat {
+    int u_min, u_max, v_min, v_max;
+    float depth;
+    int submap_id;
+  };
+  TrackingInfoAggregator computeTrackingDataDepthBuffered(
+      SubmapCollection* submaps, InputData* input);
+  void projectSubmapSplats(const Submap& submap, const InputData& input,
+                           int rows_per_tile,
+                           std::vector<std::vector<Splat>>* tiles,
+                           SubmapProjectionCache* cache = nullptr) const;
+
+  // Rendering of all submaps by raycasting their TSDF layers.
+  TrackingInfoAggregator computeTrackingDataRaycast(SubmapCollection* submaps,
+                                                    InputData* input);
+
+  // Counting of the overlaps of a rendered ID buffer with the input IDs, per
+  // tile of rows. Compact counting uses a flat histogram of
+  // [submap_index * num_inputs + input_index] per tile.
+  typedef std::unordered_map<int, std::unordered_map<int, int>>
+      CountMap;  // <submap_id, <input_id, count>>
+  struct TileCounts {
+    CountMap sparse;
+    std::vector<int> dense;
+  };
+  void countTileOverlaps(const cv::Mat& id_buffer, const InputData& input,
+                         int v_begin, int v_end, int subsampling,
+                         const DenseIDMap* submap_ids,
+                         const DenseIDMap* input_ids,
+                         TileCounts* counts) const;
+  std::vector<TrackingInfo> mergeTileCounts(
+      const std::vector<TileCounts>& tile_counts,
+      const DenseIDMap* submap_ids, const DenseIDMap* input_ids) const;
+
  private:
   static config_utilities::Factory::RegistrationRos<
       IDTrackerBase, ProjectiveIDTracker, std::shared_ptr<Globals>>
@@ -101,7 +253,18 @@ class ProjectiveIDTracker : public IDTrackerBase {
 
  protected:
   MapRenderer renderer_;  // The renderer is only used if visualization is on.
+  TsdfRaycastRenderer raycast_renderer_;
   cv::Mat rendered_vis_;  // Store visualization data.
+  // Whether the rendered image is requested for the current frame.
+  bool visualize_rendered_ = false;
+  // Rendering subsampling of the current frame, adapted by the quality
+  // controller if there is one.
+  int rendering_subsampling_ = 1;
+  // Whether the current frame is rendered approximately, also enabled by the
+  // quality controller under load.
+  bool use_approximate_rendering_ = false;
+  std::unordered_map<int, SubmapProjectionCache> projection_cache_;
+  std::vector<RenderScratch> render_scratch_;  // One per rendering thread.
 };
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,35 @@
+#ifndef PANOPTIC_MAPPING_TRACKING_SPARSE_ASSIGNMENT_H_
+#define PANOPTIC_MAPPING_TRACKING_SPARSE_ASSIGNMENT_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace panoptic_mapping {
+
+/**
+ * A possible association between a row (e.g. an input segment) and a column
+ * (e.g. a submap) with a value to be maximized.
+ */
+struct AssignmentCandidate {
+  int row;
+  int col;
+  float value;
+};
+
+/**
+ * @brief Compute the assignment of rows to columns that maximizes the sum of
+ * values, where every row and column is assigned at most once. Only the given
+ * candidates are considered, all values are expected to be non-negative. The
+ * candidate graph is split into connected components that are solved exactly
+ * with the Hungarian method, such that the cost only depends on the size of
+ * clusters of mutually overlapping candidates.
+ *
+ * @param candidates All candidate pairs, each pair should appear only once.
+ * @return Indices of the selected candidates.
+ */
+std::vector<size_t> solveSparseAssignment(
+    const std::vector<AssignmentCandidate>& candidates);
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TRACKING_SPARSE_ASSIGNMENT_H_
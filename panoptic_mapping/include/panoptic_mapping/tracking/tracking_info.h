@@ -12,6 +12,8 @@
 #include <opencv2/core/mat.hpp>
 
 #include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/id_segments.h"
+#include "panoptic_mapping/common/thread_pool.h"
 
 namespace panoptic_mapping {
 
@@ -24,18 +26,80 @@ namespace panoptic_mapping {
 
 class TrackingInfoAggregator;
 
+/**
+ * @brief Maps the IDs present in a frame to dense indices [0, size) such that
+ * pixels can be counted in flat histograms instead of hash maps. Uses a lookup
+ * table if the IDs span a small enough range.
+ */
+class DenseIDMap {
+ public:
+  DenseIDMap() = default;
+  explicit DenseIDMap(const cv::Mat& id_image);
+  explicit DenseIDMap(const std::vector<int>& ids);
+
+  // Returns -1 if the id is not contained.
+  int getIndex(int id) const {
+    if (use_lookup_table_) {
+      const size_t offset = static_cast<size_t>(id - min_id_);
+      return offset < lookup_table_.size() ? lookup_table_[offset] : -1;
+    }
+    auto it = fallback_map_.find(id);
+    return it == fallback_map_.end() ? -1 : it->second;
+  }
+  int getID(int index) const { return ids_[index]; }
+  size_t size() const { return ids_.size(); }
+
+ private:
+  void setupIndices();
+
+  // Maximum range of IDs for which a lookup table is allocated.
+  static constexpr int kMaxLookupTableSize = 1 << 20;
+
+  std::vector<int> ids_;  // Sorted unique IDs, index -> id.
+  bool use_lookup_table_ = true;
+  int min_id_ = 0;
+  std::vector<int> lookup_table_;  // id - min_id -> index, -1 if not present.
+  std::unordered_map<int, int> fallback_map_;  // id -> index.
+};
+
+/**
+ * @brief Reusable scratch memory for approximate rendering. Instances should be
+ * kept per thread and passed to consecutive TrackingInfos such that rendering
+ * does not allocate a full resolution image for every submap and frame.
+ */
+struct TrackingRenderBuffer {
+  // Zero everywhere except while a TrackingInfo is rendering into it.
+  cv::Mat image;
+  std::vector<int> dense_counts;
+};
+
 class TrackingInfo {
  public:
   explicit TrackingInfo(int submap_id) : submap_id_(submap_id) {}
-  TrackingInfo(int submap_id, Camera::Config camera);
+  // If a render buffer is provided it is used instead of allocating a new
+  // image. The buffer must not be used by another TrackingInfo until this one
+  // is evaluated.
+  TrackingInfo(int submap_id, const Camera::Config& camera,
+               TrackingRenderBuffer* buffer = nullptr);
   ~TrackingInfo() = default;
 
   // Approximate rendering.
   void insertRenderedPoint(int u, int v, int size_x, int size_y);
-  void evaluate(const cv::Mat& id_image, const cv::Mat& depth_image);
+  // If an ID map is provided the pixels are counted in a dense histogram. With
+  // subsampling only every n-th pixel in each direction is counted with a
+  // weight of n^2, approximating the full resolution counts.
+  void evaluate(const cv::Mat& id_image, const cv::Mat& depth_image,
+                const DenseIDMap* id_map = nullptr, int subsampling = 1);
+  // Same as above but looks up IDs and depth validity per run of the
+  // segments, which must be built with the range limits of the camera.
+  void evaluate(const IDSegments& segments, const DenseIDMap* id_map = nullptr,
+                int subsampling = 1);
 
   // Vertex rendering.
   void insertVertexPoint(int input_id);
+
+  // Directly add pixel counts of an input ID, e.g. from a shared renderer.
+  void insertCount(int input_id, int count);
   void insertVertexVisualizationPoint(int u, int v) {
     points_.push_back({u, v});
   }
@@ -44,13 +108,22 @@ class TrackingInfo {
 
  private:
   friend TrackingInfoAggregator;
+  // Count the covered pixels. 'row_lookup(v)' returns a callable that is
+  // invoked with increasing columns u of row v and returns whether the pixel
+  // has valid depth and sets its ID.
+  template <typename RowLookupT>
+  void evaluateRows(RowLookupT row_lookup, const DenseIDMap* id_map,
+                    int subsampling);
+
   const int submap_id_;
   std::unordered_map<int, int> counts_;  // <input_id, count>
 
   // Approximate rendering.
-  const Camera::Config camera_;
+  int width_, height_;
+  float min_range_, max_range_;
   int u_min_, u_max_, v_min_, v_max_;
   cv::Mat image_;
+  TrackingRenderBuffer* buffer_ = nullptr;
 
   // Visualization data vertex rendering.
   std::vector<Eigen::Vector2i> points_;
@@ -65,9 +138,17 @@ class TrackingInfoAggregator {
   // Input.
   void insertTrackingInfos(const std::vector<TrackingInfo>& infos);
   void insertTrackingInfo(const TrackingInfo& info);
+  // If a thread pool is provided the image is processed in parallel bands of
+  // rows.
   void insertInputImage(const cv::Mat& id_image, const cv::Mat& depth_image,
-                        const Camera::Config& camera,
-                        int rendering_subsampling);
+                        const Camera::Config& camera, int rendering_subsampling,
+                        const DenseIDMap* id_map = nullptr,
+                        ThreadPool* thread_pool = nullptr, int num_bands = 1);
+  // Same as above but counts whole runs of the segments at once. The
+  // segments must be built with the range limits of the camera.
+  void insertInputSegments(const IDSegments& segments,
+                           int rendering_subsampling,
+                           const DenseIDMap* id_map = nullptr);
 
   // Get results. Requires that all input data is already set.
   std::vector<int> getInputIDs() const;
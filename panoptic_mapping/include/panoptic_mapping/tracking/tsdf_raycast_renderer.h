@@ -0,0 +1,114 @@
+#ifndef PANOPTIC_MAPPING_TRACKING_TSDF_RAYCAST_RENDERER_H_
+#define PANOPTIC_MAPPING_TRACKING_TSDF_RAYCAST_RENDERER_H_
+
+#include <vector>
+
+#include <opencv2/core/mat.hpp>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/map/submap_collection.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Renders the submap IDs and depths of the surfaces observed in a depth
+ * image by raycasting the TSDF layers of the submaps directly, such that
+ * rendering does not depend on up-to-date meshes. As for the other tracking
+ * renderers, a surface only counts if it lies within the depth tolerance of
+ * the measurement, so every ray is only marched in a band around the measured
+ * depth, skipping unallocated blocks. The image is split into square tiles
+ * that are rendered in parallel.
+ */
+class TsdfRaycastRenderer {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    // Minimum weight of a voxel to be considered observed.
+    float min_weight = 1e-6f;
+
+    // Minimum step along a ray in voxel sizes. Larger steps are taken in front
+    // of the surface according to the stored distance.
+    float min_step = 0.5f;
+
+    // Maximum number of steps per ray and submap.
+    int max_steps = 64;
+
+    // Side length of the image tiles in pixels.
+    int tile_size = 32;
+
+    Config() { setConfigName("TsdfRaycastRenderer"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  explicit TsdfRaycastRenderer(const Config& config);
+  virtual ~TsdfRaycastRenderer() = default;
+
+  /**
+   * @brief Render the closest surface of the given submaps that agrees with
+   * the measured depth for every sampled pixel.
+   *
+   * @param submaps Submap collection containing the submaps to render.
+   * @param submap_ids IDs of the submaps to render.
+   * @param camera Camera the depth image was taken with.
+   * @param T_M_C Pose of the camera in mission frame.
+   * @param depth_image Measured depth image (CV_32FC1).
+   * @param depth_tolerance Maximum difference between the rendered and the
+   * measured depth in meters. Negative values indicate multiples of the voxel
+   * size of each submap.
+   * @param subsampling Only pixels whose coordinates are multiples of this
+   * value are rendered.
+   * @param thread_pool Thread pool to render the tiles on.
+   * @param num_threads Number of tasks to render the tiles with.
+   * @param rendered_depth Output depth in meters (CV_32FC1), 0 where no
+   * surface was rendered.
+   * @param rendered_ids Output submap IDs (CV_32SC1), -1 where no surface
+   * was rendered.
+   */
+  void render(const SubmapCollection& submaps,
+              const std::vector<int>& submap_ids, const Camera& camera,
+              const Transformation& T_M_C, const cv::Mat& depth_image,
+              float depth_tolerance, int subsampling, ThreadPool* thread_pool,
+              int num_threads, cv::Mat* rendered_depth,
+              cv::Mat* rendered_ids) const;
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Submap data shared by all rays of a frame.
+  struct SubmapView {
+    const Submap* submap;
+    Transformation T_S_C;
+    Point center_C;  // Of the bounding volume.
+    float radius;
+    int u_min, v_min, u_max, v_max;  // Conservative image bounds.
+    float depth_tolerance;
+  };
+
+  void renderTile(const std::vector<SubmapView>& views, const Camera& camera,
+                  const cv::Mat& depth_image, int subsampling, int u_begin,
+                  int v_begin, cv::Mat* rendered_depth,
+                  cv::Mat* rendered_ids) const;
+
+  /**
+   * @brief March a ray through the TSDF layer of a submap and find the first
+   * zero crossing from front to back within [t_hit_min, t_max].
+   *
+   * @param direction_C Normalized ray direction in camera frame.
+   * @param t_begin Distance along the ray to start marching at in meters.
+   * @param t_hit Output distance of the surface along the ray.
+   * @return True if a surface was found.
+   */
+  bool castRay(const SubmapView& view, const Point& direction_C, float t_begin,
+               float t_hit_min, float t_max, float* t_hit) const;
+
+  const Config config_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_TRACKING_TSDF_RAYCAST_RENDERER_H_
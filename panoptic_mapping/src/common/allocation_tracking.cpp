@@ -0,0 +1,151 @@
+#include "panoptic_mapping/common/allocation_tracking.h"
+
+#ifdef PANOPTIC_MAPPING_TRACK_ALLOCATIONS
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#endif
+
+namespace panoptic_mapping {
+namespace allocation_tracking {
+
+namespace {
+// Constant initialized, so it can be used from operator new at any time.
+thread_local Counters counters;
+}  // namespace
+
+Counters& threadCounters() { return counters; }
+
+#ifdef PANOPTIC_MAPPING_TRACK_ALLOCATIONS
+
+bool isEnabled() { return true; }
+
+namespace {
+
+// The usable size is used for allocations and deallocations alike, such that
+// the live bytes of a thread return to zero.
+void onAllocate(void* pointer) {
+  const auto size = static_cast<int64_t>(malloc_usable_size(pointer));
+  counters.num_allocations++;
+  counters.allocated_bytes += size;
+  counters.live_bytes += size;
+  if (counters.live_bytes > counters.peak_live_bytes) {
+    counters.peak_live_bytes = counters.live_bytes;
+  }
+}
+
+void onFree(void* pointer) {
+  counters.live_bytes -= static_cast<int64_t>(malloc_usable_size(pointer));
+}
+
+void* allocate(std::size_t size) {
+  void* pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer) {
+    onAllocate(pointer);
+  }
+  return pointer;
+}
+
+void* allocateAligned(std::size_t size, std::align_val_t alignment) {
+  void* pointer = nullptr;
+  const std::size_t align = std::max(static_cast<std::size_t>(alignment),
+                                     sizeof(void*));
+  if (posix_memalign(&pointer, align, size == 0 ? 1 : size) != 0) {
+    return nullptr;
+  }
+  onAllocate(pointer);
+  return pointer;
+}
+
+void deallocate(void* pointer) {
+  if (pointer) {
+    onFree(pointer);
+    std::free(pointer);
+  }
+}
+
+}  // namespace
+
+#else  // PANOPTIC_MAPPING_TRACK_ALLOCATIONS
+
+bool isEnabled() { return false; }
+
+#endif  // PANOPTIC_MAPPING_TRACK_ALLOCATIONS
+
+}  // namespace allocation_tracking
+}  // namespace panoptic_mapping
+
+#ifdef PANOPTIC_MAPPING_TRACK_ALLOCATIONS
+
+// Replacements of the global allocation functions.
+namespace at = panoptic_mapping::allocation_tracking;
+
+void* operator new(std::size_t size) {
+  void* pointer = at::allocate(size);
+  if (!pointer) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return at::allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return at::allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  void* pointer = at::allocateAligned(size, alignment);
+  if (!pointer) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept { at::deallocate(pointer); }
+
+void operator delete[](void* pointer) noexcept { at::deallocate(pointer); }
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  at::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept {
+  at::deallocate(pointer);
+}
+
+#endif  // PANOPTIC_MAPPING_TRACK_ALLOCATIONS
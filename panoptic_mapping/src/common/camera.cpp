@@ -1,5 +1,8 @@
 #include "panoptic_mapping/common/camera.h"
 
+#include <algorithm>
+#include <cmath>
+#include <future>
 #include <unordered_map>
 #include <vector>
 
@@ -71,6 +74,15 @@ bool Camera::pointIsInViewFrustum(const Point& point_C,
   return true;
 }
 
+float Camera::viewFrustumMargin(const Point& point_C,
+                                float inflation_distance) const {
+  float margin = std::min(point_C.z(), config_.max_range - point_C.norm());
+  for (const Point& view_frustum_plane : view_frustum_) {
+    margin = std::min(margin, point_C.dot(view_frustum_plane));
+  }
+  return margin + inflation_distance;
+}
+
 bool Camera::submapIsInViewFrustum(const Submap& submap,
                                    const Transformation& T_M_C) const {
   const float radius = submap.getBoundingVolume().getRadius();
@@ -137,7 +149,10 @@ std::vector<int> Camera::findVisibleSubmapIDs(const SubmapCollection& submaps,
                                               bool only_active_submaps,
                                               bool include_freespace) const {
   std::vector<int> result;
-  for (const Submap& submap : submaps) {
+  // Only submaps within the maximum range can be visible.
+  for (const int id : submaps.findSubmapsIntersecting(T_M_C.getPosition(),
+                                                      config_.max_range)) {
+    const Submap& submap = submaps.getSubmap(id);
     if (!submap.isActive() && only_active_submaps) {
       continue;
     }
@@ -152,9 +167,51 @@ std::vector<int> Camera::findVisibleSubmapIDs(const SubmapCollection& submaps,
   return result;
 }
 
-voxblox::BlockIndexList Camera::findVisibleBlocks(const Submap& submap,
-                                                  const Transformation& T_M_C,
-                                                  const float max_range) const {
+bool Camera::projectSphereToImagePlane(const Point& center_C, float radius,
+                                       int* u_min, int* v_min, int* u_max,
+                                       int* v_max) const {
+  CHECK_NOTNULL(u_min);
+  CHECK_NOTNULL(v_min);
+  CHECK_NOTNULL(u_max);
+  CHECK_NOTNULL(v_max);
+  const float z_min = center_C.z() - radius;
+  if (z_min <= 1e-3f) {
+    return false;
+  }
+  // Bound the sphere by its axis aligned box and project the extreme corners.
+  const float z_max = center_C.z() + radius;
+  const float x_min = center_C.x() - radius;
+  const float x_max = center_C.x() + radius;
+  const float y_min = center_C.y() - radius;
+  const float y_max = center_C.y() + radius;
+  const float u_low = std::min(x_min / z_min, x_min / z_max);
+  const float u_high = std::max(x_max / z_min, x_max / z_max);
+  const float v_low = std::min(y_min / z_min, y_min / z_max);
+  const float v_high = std::max(y_max / z_min, y_max / z_max);
+  *u_min = std::floor(u_low * config_.fx + config_.vx);
+  *u_max = std::ceil(u_high * config_.fx + config_.vx);
+  *v_min = std::floor(v_low * config_.fy + config_.vy);
+  *v_max = std::ceil(v_high * config_.fy + config_.vy);
+  return true;
+}
+
+bool Camera::sphereIsBehindSurface(const Point& center_C, float radius,
+                                   const RangeImagePyramid& range_pyramid,
+                                   float max_distance_behind_surface) const {
+  int u_min, v_min, u_max, v_max;
+  if (!projectSphereToImagePlane(center_C, radius, &u_min, &v_min, &u_max,
+                                 &v_max)) {
+    return false;
+  }
+  // Pad by one pixel to cover interpolation neighbors.
+  const float max_range =
+      range_pyramid.maxRange(u_min - 1, v_min - 1, u_max + 1, v_max + 1);
+  return center_C.norm() - radius > max_range + max_distance_behind_surface;
+}
+
+voxblox::BlockIndexList Camera::findVisibleBlocks(
+    const Submap& submap, const Transformation& T_M_C, const float max_range,
+    const RangeImagePyramid* range_pyramid) const {
   // Setup.
   voxblox::BlockIndexList result;
   voxblox::BlockIndexList all_blocks;
@@ -163,6 +220,7 @@ voxblox::BlockIndexList Camera::findVisibleBlocks(const Submap& submap,
       T_M_C.inverse() * submap.getT_M_S();  // p_C = T_C_M * T_M_S * p_S
   const FloatingPoint block_size = submap.getTsdfLayer().block_size();
   const FloatingPoint block_diag_half = std::sqrt(3.0f) * block_size / 2.0f;
+  const float truncation_distance = submap.getConfig().truncation_distance;
 
   // Iterate through all blocks.
   for (auto& index : all_blocks) {
@@ -173,18 +231,27 @@ voxblox::BlockIndexList Camera::findVisibleBlocks(const Submap& submap,
     if (max_range > 0 && p_C.norm() > config_.max_range + block_diag_half) {
       continue;
     }
-    if (pointIsInViewFrustum(p_C, block_diag_half)) {
-      result.push_back(index);
+    if (!pointIsInViewFrustum(p_C, block_diag_half)) {
+      continue;
+    }
+    if (range_pyramid &&
+        sphereIsBehindSurface(p_C, block_diag_half, *range_pyramid,
+                              truncation_distance)) {
+      continue;
     }
+    result.push_back(index);
   }
   return result;
 }
 
 std::unordered_map<int, voxblox::BlockIndexList> Camera::findVisibleBlocks(
     const SubmapCollection& submaps, const Transformation& T_M_C,
-    const float max_range, bool only_active_submaps) const {
+    const float max_range, bool only_active_submaps,
+    const RangeImagePyramid* range_pyramid) const {
   std::unordered_map<int, voxblox::BlockIndexList> result;
-  for (const Submap& submap : submaps) {
+  for (const int id : submaps.findSubmapsIntersecting(T_M_C.getPosition(),
+                                                      config_.max_range)) {
+    const Submap& submap = submaps.getSubmap(id);
     if (!submap.isActive() && only_active_submaps) {
       continue;
     }
@@ -192,7 +259,7 @@ std::unordered_map<int, voxblox::BlockIndexList> Camera::findVisibleBlocks(
       continue;
     }
     voxblox::BlockIndexList block_list =
-        findVisibleBlocks(submap, T_M_C, max_range);
+        findVisibleBlocks(submap, T_M_C, max_range, range_pyramid);
     if (!block_list.empty()) {
       result[submap.getID()] = block_list;
     }
@@ -201,33 +268,121 @@ std::unordered_map<int, voxblox::BlockIndexList> Camera::findVisibleBlocks(
 }
 
 cv::Mat Camera::computeVertexMap(const cv::Mat& depth_image) const {
+  cv::Mat vertices;
+  computeVertexMap(depth_image, &vertices);
+  return vertices;
+}
+
+cv::Mat Camera::computeValidityImage(const cv::Mat& depth_image) const {
+  cv::Mat validity_image;
+  computeValidityImage(depth_image, &validity_image);
+  return validity_image;
+}
+
+void Camera::computeVertexMap(const cv::Mat& depth_image,
+                              cv::Mat* vertex_map) const {
+  CHECK_NOTNULL(vertex_map);
   // Compute the 3D pointcloud from a depth image.
-  cv::Mat vertices(depth_image.size(), CV_32FC3);
+  vertex_map->create(depth_image.size(), CV_32FC3);
   const float fx_inv = 1.f / config_.fx;
   const float fy_inv = 1.f / config_.fy;
   for (int v = 0; v < depth_image.rows; v++) {
+    const float* depth = depth_image.ptr<float>(v);
+    cv::Vec3f* vertex = vertex_map->ptr<cv::Vec3f>(v);  // x, y, z
     for (int u = 0; u < depth_image.cols; u++) {
-      cv::Vec3f& vertex = vertices.at<cv::Vec3f>(v, u);  // x, y, z
-      vertex[2] = depth_image.at<float>(v, u);
-      vertex[0] = (static_cast<float>(u) - config_.vx) * vertex[2] * fx_inv;
-      vertex[1] = (static_cast<float>(v) - config_.vy) * vertex[2] * fy_inv;
+      vertex[u][2] = depth[u];
+      vertex[u][0] = (static_cast<float>(u) - config_.vx) * depth[u] * fx_inv;
+      vertex[u][1] = (static_cast<float>(v) - config_.vy) * depth[u] * fy_inv;
     }
   }
-  return vertices;
 }
 
-cv::Mat Camera::computeValidityImage(const cv::Mat& depth_image) const {
+void Camera::computeValidityImage(const cv::Mat& depth_image,
+                                  cv::Mat* validity_image) const {
+  CHECK_NOTNULL(validity_image);
   // Check whether the depth image is valid. Currently just checks for min and
   // max range.
-  cv::Mat validity_image(depth_image.size(), CV_8UC1);
+  validity_image->create(depth_image.size(), CV_8UC1);
   for (int v = 0; v < depth_image.rows; v++) {
+    const float* depth = depth_image.ptr<float>(v);
+    uchar* valid = validity_image->ptr<uchar>(v);
     for (int u = 0; u < depth_image.cols; u++) {
-      float depth = depth_image.at<float>(v, u);
-      validity_image.at<uchar>(v, u) = static_cast<uchar>(
-          depth >= config_.min_range && depth <= config_.max_range);
+      valid[u] = static_cast<uchar>(depth[u] >= config_.min_range &&
+                                    depth[u] <= config_.max_range);
     }
   }
-  return validity_image;
+}
+
+float Camera::computeDerivedImages(const cv::Mat& depth_image,
+                                   cv::Mat* vertex_map,
+                                   cv::Mat* validity_image,
+                                   cv::Mat* range_image,
+                                   ThreadPool* thread_pool) const {
+  if (vertex_map) {
+    vertex_map->create(depth_image.size(), CV_32FC3);
+  }
+  if (validity_image) {
+    validity_image->create(depth_image.size(), CV_8UC1);
+  }
+  if (range_image) {
+    range_image->create(depth_image.size(), CV_32FC1);
+  }
+
+  // Process a band of rows [v_start, v_end). The inner loops only use row
+  // pointers such that they can be vectorized by the compiler.
+  const float fx_inv = 1.f / config_.fx;
+  const float fy_inv = 1.f / config_.fy;
+  const float min_range = config_.min_range;
+  const float max_range = config_.max_range;
+  auto process_band = [&](int v_start, int v_end) {
+    float band_max_range = 0.f;
+    for (int v = v_start; v < v_end; ++v) {
+      const float* depth = depth_image.ptr<float>(v);
+      const float y_factor = static_cast<float>(v) - config_.vy;
+      cv::Vec3f* vertex = vertex_map ? vertex_map->ptr<cv::Vec3f>(v) : nullptr;
+      uchar* valid = validity_image ? validity_image->ptr<uchar>(v) : nullptr;
+      float* range = range_image ? range_image->ptr<float>(v) : nullptr;
+      for (int u = 0; u < depth_image.cols; ++u) {
+        const float z = depth[u];
+        const float x = (static_cast<float>(u) - config_.vx) * z * fx_inv;
+        const float y = y_factor * z * fy_inv;
+        const float ray_length = std::sqrt(x * x + y * y + z * z);
+        if (vertex) {
+          vertex[u] = cv::Vec3f(x, y, z);
+        }
+        if (valid) {
+          valid[u] = static_cast<uchar>(z >= min_range && z <= max_range);
+        }
+        if (range) {
+          range[u] = ray_length;
+        }
+        if (ray_length >= min_range && ray_length <= max_range) {
+          band_max_range = std::max(band_max_range, ray_length);
+        }
+      }
+    }
+    return band_max_range;
+  };
+
+  const int rows = depth_image.rows;
+  const int num_bands =
+      thread_pool ? std::min(thread_pool->getNumThreads(), rows) : 1;
+  if (num_bands <= 1) {
+    return process_band(0, rows);
+  }
+  const int band_rows = (rows + num_bands - 1) / num_bands;
+  std::vector<std::future<float>> futures;
+  for (int v = 0; v < rows; v += band_rows) {
+    const int v_end = std::min(v + band_rows, rows);
+    futures.emplace_back(thread_pool->submit(
+        [&process_band, v, v_end]() { return process_band(v, v_end); }));
+  }
+  float max_range_in_image = 0.f;
+  for (auto& future : futures) {
+    max_range_in_image =
+        std::max(max_range_in_image, thread_pool->wait(&future));
+  }
+  return max_range_in_image;
 }
 
 }  // namespace panoptic_mapping
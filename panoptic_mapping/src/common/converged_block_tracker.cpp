@@ -0,0 +1,82 @@
+#include "panoptic_mapping/common/converged_block_tracker.h"
+
+#include <memory>
+
+namespace panoptic_mapping {
+
+void ConvergedBlockTracker::Config::checkParams() const {
+  checkParamGE(min_converged_updates, 0, "min_converged_updates");
+  checkParamGT(saturation_fraction, 0.f, "saturation_fraction");
+  checkParamLE(saturation_fraction, 1.f, "saturation_fraction");
+  checkParamGE(max_residual, 0.f, "max_residual");
+  checkParamGT(num_test_voxels, 0, "num_test_voxels");
+}
+
+void ConvergedBlockTracker::Config::setupParamsAndPrinting() {
+  setupParam("min_converged_updates", &min_converged_updates);
+  setupParam("saturation_fraction", &saturation_fraction);
+  setupParam("max_residual", &max_residual, "voxels");
+  setupParam("num_test_voxels", &num_test_voxels);
+}
+
+ConvergedBlockTracker::ConvergedBlockTracker(const Config& config)
+    : config_(config.checkValid()) {}
+
+void ConvergedBlockTracker::prepare(const SubmapCollection& submaps) {
+  for (auto it = submaps_.begin(); it != submaps_.end();) {
+    if (!submaps.submapIdExists(it->first) ||
+        !submaps.getSubmap(it->first).isActive()) {
+      it = submaps_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const Submap& submap : submaps) {
+    if (submap.isActive() && !submaps_.count(submap.getID())) {
+      submaps_.emplace(submap.getID(), std::make_unique<SubmapStates>());
+    }
+  }
+}
+
+bool ConvergedBlockTracker::isFrozen(int submap_id,
+                                     const BlockIndex& index) const {
+  auto it = submaps_.find(submap_id);
+  if (it == submaps_.end()) {
+    return false;
+  }
+  const SubmapStates& states = *it->second;
+  std::lock_guard<std::mutex> lock(states.mutex);
+  auto block_it = states.blocks.find(index);
+  return block_it != states.blocks.end() && block_it->second.is_frozen;
+}
+
+void ConvergedBlockTracker::unfreeze(int submap_id, const BlockIndex& index) {
+  auto it = submaps_.find(submap_id);
+  if (it == submaps_.end()) {
+    return;
+  }
+  SubmapStates& states = *it->second;
+  std::lock_guard<std::mutex> lock(states.mutex);
+  states.blocks.erase(index);
+}
+
+void ConvergedBlockTracker::recordUpdate(int submap_id,
+                                         const BlockIndex& index,
+                                         bool converged) {
+  auto it = submaps_.find(submap_id);
+  if (it == submaps_.end()) {
+    return;
+  }
+  SubmapStates& states = *it->second;
+  std::lock_guard<std::mutex> lock(states.mutex);
+  if (!converged) {
+    states.blocks.erase(index);
+    return;
+  }
+  BlockState& state = states.blocks[index];
+  state.num_converged_updates++;
+  state.is_frozen =
+      state.num_converged_updates >= config_.min_converged_updates;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,152 @@
+#include "panoptic_mapping/common/id_segments.h"
+
+#include <algorithm>
+#include <future>
+#include <unordered_map>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace panoptic_mapping {
+
+void IDSegments::build(const cv::Mat& id_image, const cv::Mat& depth_image,
+                       float min_range, float max_range,
+                       ThreadPool* thread_pool, int num_bands) {
+  CHECK_EQ(id_image.type(), CV_32SC1);
+  CHECK_EQ(depth_image.type(), CV_32FC1);
+  CHECK_EQ(id_image.size(), depth_image.size());
+  rows_ = id_image.rows;
+  cols_ = id_image.cols;
+  runs_.clear();
+  row_offsets_.assign(rows_ + 1, 0);
+  segments_.clear();
+  if (rows_ == 0 || cols_ == 0) {
+    rows_ = 0;
+    return;
+  }
+
+  // Compute the runs of a band of rows [v_start, v_end), the offsets are
+  // relative to the band.
+  auto build_band = [&](int v_start, int v_end, std::vector<Run>* runs) {
+    for (int v = v_start; v < v_end; ++v) {
+      const int* ids = id_image.ptr<int>(v);
+      const float* depths = depth_image.ptr<float>(v);
+      Run run;
+      for (int u = 0; u < cols_; ++u) {
+        const bool is_valid = depths[u] >= min_range && depths[u] <= max_range;
+        if (u == 0 || ids[u] != run.id || is_valid != run.is_valid) {
+          if (u > 0) {
+            run.u_end = u;
+            runs->push_back(run);
+          }
+          run.u_begin = u;
+          run.id = ids[u];
+          run.is_valid = is_valid;
+        }
+      }
+      run.u_end = cols_;
+      runs->push_back(run);
+      row_offsets_[v + 1] = runs->size();
+    }
+  };
+  if (!thread_pool || num_bands <= 1) {
+    build_band(0, rows_, &runs_);
+  } else {
+    const int band_rows = (rows_ + num_bands - 1) / num_bands;
+    std::vector<std::vector<Run>> band_runs((rows_ + band_rows - 1) /
+                                            band_rows);
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < band_runs.size(); ++i) {
+      futures.emplace_back(thread_pool->submit([&, i]() {
+        const int v_start = static_cast<int>(i) * band_rows;
+        build_band(v_start, std::min(v_start + band_rows, rows_),
+                   &band_runs[i]);
+      }));
+    }
+    thread_pool->waitAll(&futures);
+
+    // Concatenate the bands and make the offsets absolute.
+    for (size_t i = 0; i < band_runs.size(); ++i) {
+      const size_t offset = runs_.size();
+      const int v_start = static_cast<int>(i) * band_rows;
+      const int v_end = std::min(v_start + band_rows, rows_);
+      for (int v = v_start; v < v_end; ++v) {
+        row_offsets_[v + 1] += offset;
+      }
+      runs_.insert(runs_.end(), band_runs[i].begin(), band_runs[i].end());
+    }
+  }
+  computeSegments();
+}
+
+const IDSegments::Segment* IDSegments::getSegment(int id) const {
+  auto it = std::lower_bound(
+      segments_.begin(), segments_.end(), id,
+      [](const Segment& segment, int id) { return segment.id < id; });
+  if (it == segments_.end() || it->id != id) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+std::vector<int> IDSegments::getIDs() const {
+  std::vector<int> result;
+  result.reserve(segments_.size());
+  for (const Segment& segment : segments_) {
+    result.push_back(segment.id);
+  }
+  return result;
+}
+
+void IDSegments::mergeRuns() {
+  size_t num_runs = 0;
+  for (int v = 0; v < rows_; ++v) {
+    const size_t begin = row_offsets_[v];
+    const size_t end = row_offsets_[v + 1];
+    row_offsets_[v] = num_runs;
+    for (size_t i = begin; i < end; ++i) {
+      const Run& run = runs_[i];
+      if (i > begin && run.id == runs_[num_runs - 1].id &&
+          run.is_valid == runs_[num_runs - 1].is_valid) {
+        runs_[num_runs - 1].u_end = run.u_end;
+      } else {
+        runs_[num_runs++] = run;
+      }
+    }
+  }
+  row_offsets_[rows_] = num_runs;
+  runs_.resize(num_runs);
+}
+
+void IDSegments::computeSegments() {
+  segments_.clear();
+  std::unordered_map<int, size_t> indices;  // <id, segment index>
+  for (int v = 0; v < rows_; ++v) {
+    for (const Run* run = rowBegin(v); run != rowEnd(v); ++run) {
+      auto it = indices.find(run->id);
+      if (it == indices.end()) {
+        it = indices.emplace(run->id, segments_.size()).first;
+        Segment segment;
+        segment.id = run->id;
+        segment.u_min = run->u_begin;
+        segment.v_min = v;
+        segment.u_max = run->u_end - 1;
+        segment.v_max = v;
+        segments_.push_back(segment);
+      }
+      Segment& segment = segments_[it->second];
+      segment.u_min = std::min(segment.u_min, run->u_begin);
+      segment.u_max = std::max(segment.u_max, run->u_end - 1);
+      segment.v_max = v;
+      const int num_pixels = run->u_end - run->u_begin;
+      segment.num_pixels += num_pixels;
+      if (run->is_valid) {
+        segment.num_valid_pixels += num_pixels;
+      }
+    }
+  }
+  std::sort(segments_.begin(), segments_.end(),
+            [](const Segment& a, const Segment& b) { return a.id < b.id; });
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,99 @@
+#include "panoptic_mapping/common/id_tile_masks.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace panoptic_mapping {
+
+void IDTileMasks::build(const cv::Mat& id_image, const IDSegments* segments) {
+  CHECK_EQ(id_image.type(), CV_32SC1);
+  rows_ = id_image.rows;
+  cols_ = id_image.cols;
+  tile_rows_ = (rows_ + kTileSize - 1) / kTileSize;
+  tile_cols_ = (cols_ + kTileSize - 1) / kTileSize;
+  offsets_.clear();
+  integrals_.clear();
+  if (rows_ == 0 || cols_ == 0) {
+    rows_ = 0;
+    return;
+  }
+  const size_t stride = tile_cols_ + 1;
+  const size_t size = (tile_rows_ + 1) * stride;
+
+  // Mark the tiles containing each ID. The entry of tile (u, v) is stored at
+  // (u + 1, v + 1) such that the integral can be computed in place.
+  int last_id = 0;
+  int* last_mask = nullptr;
+  auto mark = [&](int id, int tile_v, int tile_u_begin, int tile_u_end) {
+    if (!last_mask || id != last_id) {
+      auto it = offsets_.find(id);
+      if (it == offsets_.end()) {
+        it = offsets_.emplace(id, integrals_.size()).first;
+        integrals_.resize(integrals_.size() + size, 0);
+      }
+      last_id = id;
+      last_mask = integrals_.data() + it->second;
+    }
+    int* row = last_mask + (tile_v + 1) * stride + 1;
+    std::fill(row + tile_u_begin, row + tile_u_end, 1);
+  };
+  if (segments && segments->rows() == rows_ && segments->cols() == cols_) {
+    for (int v = 0; v < rows_; ++v) {
+      for (const IDSegments::Run* run = segments->rowBegin(v);
+           run != segments->rowEnd(v); ++run) {
+        mark(run->id, v / kTileSize, run->u_begin / kTileSize,
+             (run->u_end - 1) / kTileSize + 1);
+      }
+    }
+  } else {
+    for (int v = 0; v < rows_; ++v) {
+      const int* ids = id_image.ptr<int>(v);
+      for (int u = 0; u < cols_; ++u) {
+        mark(ids[u], v / kTileSize, u / kTileSize, u / kTileSize + 1);
+      }
+    }
+  }
+
+  // Compute the integral images.
+  for (const auto& id_offset_pair : offsets_) {
+    int* integral = integrals_.data() + id_offset_pair.second;
+    for (int v = 1; v <= tile_rows_; ++v) {
+      int* row = integral + v * stride;
+      const int* previous_row = row - stride;
+      int row_sum = 0;
+      for (int u = 1; u <= tile_cols_; ++u) {
+        row_sum += row[u];
+        row[u] = row_sum + previous_row[u];
+      }
+    }
+  }
+}
+
+bool IDTileMasks::mayContain(int id, int u_min, int v_min, int u_max,
+                             int v_max) const {
+  u_min = std::max(u_min, 0);
+  v_min = std::max(v_min, 0);
+  u_max = std::min(u_max, cols_ - 1);
+  v_max = std::min(v_max, rows_ - 1);
+  if (u_min > u_max || v_min > v_max) {
+    return false;
+  }
+  auto it = offsets_.find(id);
+  if (it == offsets_.end()) {
+    return false;
+  }
+  const size_t stride = tile_cols_ + 1;
+  const int* integral = integrals_.data() + it->second;
+  const int tile_u_min = u_min / kTileSize;
+  const int tile_v_min = v_min / kTileSize;
+  const int tile_u_max = u_max / kTileSize + 1;
+  const int tile_v_max = v_max / kTileSize + 1;
+  return integral[tile_v_max * stride + tile_u_max] -
+             integral[tile_v_min * stride + tile_u_max] -
+             integral[tile_v_max * stride + tile_u_min] +
+             integral[tile_v_min * stride + tile_u_min] >
+         0;
+}
+
+}  // namespace panoptic_mapping
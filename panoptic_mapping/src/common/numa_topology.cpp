@@ -0,0 +1,112 @@
+#include "panoptic_mapping/common/numa_topology.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace panoptic_mapping {
+
+NumaTopology::NumaTopology(std::vector<std::vector<int>> node_cores)
+    : node_cores_(std::move(node_cores)) {
+  if (node_cores_.empty()) {
+    node_cores_.emplace_back();
+  }
+  for (size_t node = 0; node < node_cores_.size(); ++node) {
+    for (const int core : node_cores_[node]) {
+      if (core < 0) {
+        continue;
+      }
+      if (static_cast<size_t>(core) >= core_nodes_.size()) {
+        core_nodes_.resize(core + 1, -1);
+      }
+      core_nodes_[core] = static_cast<int>(node);
+    }
+  }
+}
+
+int NumaTopology::getNodeOfCore(int core) const {
+  if (core < 0 || static_cast<size_t>(core) >= core_nodes_.size() ||
+      core_nodes_[core] < 0) {
+    return 0;
+  }
+  return core_nodes_[core];
+}
+
+int NumaTopology::getCurrentNode() const {
+  if (getNumNodes() <= 1) {
+    return 0;
+  }
+#ifdef __linux__
+  return getNodeOfCore(sched_getcpu());
+#else
+  return 0;
+#endif
+}
+
+std::vector<int> NumaTopology::parseCpuList(const std::string& cpu_list) {
+  std::vector<int> result;
+  std::stringstream stream(cpu_list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace),
+                range.end());
+    if (range.empty()) {
+      continue;
+    }
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      if (first < 0 || last < first) {
+        return {};
+      }
+      for (int core = first; core <= last; ++core) {
+        result.push_back(core);
+      }
+    } catch (const std::exception&) {
+      return {};
+    }
+  }
+  return result;
+}
+
+NumaTopology NumaTopology::detect() {
+  std::vector<std::vector<int>> node_cores;
+#ifdef __linux__
+  // Nodes are numbered consecutively, nodes without cores are skipped.
+  for (int node = 0;; ++node) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    if (!file.is_open()) {
+      break;
+    }
+    std::string cpu_list;
+    std::getline(file, cpu_list);
+    std::vector<int> cores = parseCpuList(cpu_list);
+    if (!cores.empty()) {
+      node_cores.emplace_back(std::move(cores));
+    }
+  }
+#endif
+  if (node_cores.empty()) {
+    std::vector<int> cores(std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t i = 0; i < cores.size(); ++i) {
+      cores[i] = static_cast<int>(i);
+    }
+    node_cores.emplace_back(std::move(cores));
+  }
+  return NumaTopology(std::move(node_cores));
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,155 @@
+#include "panoptic_mapping/common/performance_counters.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <glog/logging.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace panoptic_mapping {
+namespace performance_counters {
+
+namespace {
+
+std::atomic<bool> enabled{false};
+
+#ifdef __linux__
+
+const uint64_t kEventConfigs[kNumEvents] = {
+    PERF_COUNT_HW_CPU_CYCLES,          PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_REFERENCES,    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+
+int openEvent(uint64_t config, int group_fd) {
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group_fd == -1 ? 1 : 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  // Count the calling thread on any CPU.
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+// Counters of one thread as a group led by the cycle counter, such that all
+// events are read atomically and scheduled together.
+class ThreadCounters {
+ public:
+  ThreadCounters() {
+    leader_ = openEvent(kEventConfigs[kCycles], -1);
+    if (leader_ < 0) {
+      LOG_FIRST_N(WARNING, 1)
+          << "Could not open hardware performance counters, check "
+             "'/proc/sys/kernel/perf_event_paranoid'.";
+      return;
+    }
+    events_[num_events_++] = kCycles;
+    for (int event = kCycles + 1; event < kNumEvents; ++event) {
+      const int fd = openEvent(kEventConfigs[event], leader_);
+      if (fd < 0) {
+        continue;  // Not supported, reads as zero.
+      }
+      fds_[num_events_] = fd;
+      events_[num_events_++] = static_cast<Event>(event);
+    }
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  ~ThreadCounters() {
+    for (int i = 1; i < num_events_; ++i) {
+      close(fds_[i]);
+    }
+    if (leader_ >= 0) {
+      close(leader_);
+    }
+  }
+
+  bool read(Values* values) const {
+    if (leader_ < 0) {
+      return false;
+    }
+    // Layout of PERF_FORMAT_GROUP: number of events followed by the values.
+    uint64_t buffer[kNumEvents + 1];
+    const ssize_t size = ::read(leader_, buffer, sizeof(buffer));
+    if (size < static_cast<ssize_t>(sizeof(uint64_t))) {
+      return false;
+    }
+    const int num_read = std::min(static_cast<int>(buffer[0]), num_events_);
+    for (int i = 0; i < num_read; ++i) {
+      values->counts[events_[i]] = buffer[i + 1];
+    }
+    return true;
+  }
+
+ private:
+  int leader_ = -1;
+  int fds_[kNumEvents] = {};
+  Event events_[kNumEvents] = {};
+  int num_events_ = 0;
+};
+
+#endif  // __linux__
+
+}  // namespace
+
+const char* eventToString(Event event) {
+  switch (event) {
+    case kCycles:
+      return "Cycles";
+    case kInstructions:
+      return "Instructions";
+    case kCacheReferences:
+      return "CacheReferences";
+    case kCacheMisses:
+      return "CacheMisses";
+    case kBranches:
+      return "Branches";
+    case kBranchMisses:
+      return "BranchMisses";
+    default:
+      return "Unknown";
+  }
+}
+
+bool enable() {
+#ifdef __linux__
+  // Check availability in the calling thread.
+  enabled = true;
+  Values values;
+  if (!readThreadCounters(&values)) {
+    enabled = false;
+    return false;
+  }
+  return true;
+#else
+  LOG(WARNING) << "Hardware performance counters are only supported on Linux.";
+  return false;
+#endif
+}
+
+bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+bool readThreadCounters(Values* values) {
+#ifdef __linux__
+  if (!isEnabled()) {
+    return false;
+  }
+  thread_local ThreadCounters counters;
+  return counters.read(values);
+#else
+  return false;
+#endif
+}
+
+}  // namespace performance_counters
+}  // namespace panoptic_mapping
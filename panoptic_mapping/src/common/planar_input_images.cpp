@@ -0,0 +1,108 @@
+#include "panoptic_mapping/common/planar_input_images.h"
+
+#include <algorithm>
+
+#include <opencv2/core/mat.hpp>
+
+namespace panoptic_mapping {
+
+namespace {
+
+// Write all values of a plane including the replicated border, the remaining
+// row padding is set to zero.
+template <typename T, typename PixelT>
+void fillPlane(int rows, int cols, int stride, PixelT get_pixel, T* plane) {
+  for (int v = 0; v <= rows; ++v) {
+    const int v_source = std::min(v, rows - 1);
+    T* row = plane + static_cast<size_t>(v) * stride;
+    for (int u = 0; u < cols; ++u) {
+      row[u] = get_pixel(u, v_source);
+    }
+    row[cols] = row[cols - 1];
+    std::fill(row + cols + 1, row + stride, T(0));
+  }
+}
+
+}  // namespace
+
+void PlanarInputImages::build(const Eigen::MatrixXf& range_image,
+                              const InputData& input) {
+  rows_ = range_image.rows();
+  cols_ = range_image.cols();
+  if (rows_ == 0 || cols_ == 0) {
+    rows_ = 0;
+    return;
+  }
+  stride_ = (cols_ + kStrideMultiple) / kStrideMultiple * kStrideMultiple;
+  const size_t size = static_cast<size_t>(rows_ + 1) * stride_;
+  if (size > capacity_) {
+    capacity_ = size;
+    range_.reset();
+    color_.reset();
+    ids_.reset();
+    uncertainty_.reset();
+  }
+
+  // Range.
+  allocate(&range_);
+  fillPlane(
+      rows_, cols_, stride_,
+      [&range_image](int u, int v) { return range_image(v, u); },
+      range_.get());
+
+  // Color, BGR (CV_8UC3).
+  has_color_ = input.has(InputData::InputType::kColorImage);
+  if (has_color_) {
+    const cv::Mat& image = input.colorImage();
+    CHECK_EQ(image.rows, rows_);
+    CHECK_EQ(image.cols, cols_);
+    allocate(&color_);
+    fillPlane(
+        rows_, cols_, stride_,
+        [&image](int u, int v) {
+          const cv::Vec3b& bgr = image.at<cv::Vec3b>(v, u);
+          return static_cast<uint32_t>(bgr[2]) |
+                 static_cast<uint32_t>(bgr[1]) << 8 |
+                 static_cast<uint32_t>(bgr[0]) << 16 | 0xFF000000u;
+        },
+        color_.get());
+  }
+
+  // IDs (CV_32SC1).
+  has_ids_ = input.has(InputData::InputType::kSegmentationImage);
+  if (has_ids_) {
+    const cv::Mat& image = input.idImage();
+    CHECK_EQ(image.rows, rows_);
+    CHECK_EQ(image.cols, cols_);
+    allocate(&ids_);
+    fillPlane(
+        rows_, cols_, stride_,
+        [&image](int u, int v) { return image.at<int>(v, u); }, ids_.get());
+  }
+
+  // Uncertainty (CV_32FC1).
+  has_uncertainty_ = input.has(InputData::InputType::kUncertaintyImage);
+  if (has_uncertainty_) {
+    const cv::Mat& image = input.uncertaintyImage();
+    CHECK_EQ(image.rows, rows_);
+    CHECK_EQ(image.cols, cols_);
+    allocate(&uncertainty_);
+    fillPlane(
+        rows_, cols_, stride_,
+        [&image](int u, int v) { return image.at<float>(v, u); },
+        uncertainty_.get());
+  }
+}
+
+template <typename T>
+void PlanarInputImages::allocate(Plane<T>* plane) const {
+  if (*plane) {
+    return;
+  }
+  // The stride is a multiple of the alignment, such that the size is too.
+  void* data = std::aligned_alloc(kAlignment, capacity_ * sizeof(T));
+  CHECK_NOTNULL(data);
+  plane->reset(static_cast<T*>(data));
+}
+
+}  // namespace panoptic_mapping
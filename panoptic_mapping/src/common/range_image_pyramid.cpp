@@ -0,0 +1,58 @@
+#include "panoptic_mapping/common/range_image_pyramid.h"
+
+#include <algorithm>
+
+namespace panoptic_mapping {
+
+void RangeImagePyramid::build(const Eigen::MatrixXf& range_image) {
+  levels_.clear();
+  levels_.emplace_back(range_image);
+  while (levels_.back().rows() > 1 || levels_.back().cols() > 1) {
+    const Eigen::MatrixXf& previous = levels_.back();
+    const int rows = (previous.rows() + 1) / 2;
+    const int cols = (previous.cols() + 1) / 2;
+    Eigen::MatrixXf level(rows, cols);
+    for (int u = 0; u < cols; ++u) {
+      const int u0 = 2 * u;
+      const int u1 = std::min<int>(u0 + 1, previous.cols() - 1);
+      for (int v = 0; v < rows; ++v) {
+        const int v0 = 2 * v;
+        const int v1 = std::min<int>(v0 + 1, previous.rows() - 1);
+        level(v, u) = std::max(std::max(previous(v0, u0), previous(v0, u1)),
+                               std::max(previous(v1, u0), previous(v1, u1)));
+      }
+    }
+    levels_.emplace_back(std::move(level));
+  }
+}
+
+float RangeImagePyramid::maxRange(int u_min, int v_min, int u_max,
+                                  int v_max) const {
+  if (levels_.empty()) {
+    return 0.f;
+  }
+  u_min = std::max(u_min, 0);
+  v_min = std::max(v_min, 0);
+  u_max = std::min<int>(u_max, levels_[0].cols() - 1);
+  v_max = std::min<int>(v_max, levels_[0].rows() - 1);
+  if (u_min > u_max || v_min > v_max) {
+    return 0.f;
+  }
+
+  // Select the finest level where the region spans at most 2x2 tiles.
+  const int extent = std::max(u_max - u_min, v_max - v_min) + 1;
+  size_t level = 0;
+  while ((1 << level) < extent && level + 1 < levels_.size()) {
+    ++level;
+  }
+  const Eigen::MatrixXf& image = levels_[level];
+  float result = 0.f;
+  for (int u = u_min >> level; u <= (u_max >> level); ++u) {
+    for (int v = v_min >> level; v <= (v_max >> level); ++v) {
+      result = std::max(result, image(v, u));
+    }
+  }
+  return result;
+}
+
+}  // namespace panoptic_mapping
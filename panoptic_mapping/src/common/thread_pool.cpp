@@ -0,0 +1,225 @@
+#include "panoptic_mapping/common/thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "panoptic_mapping/common/numa_topology.h"
+#include "panoptic_mapping/common/thread_scheduling.h"
+
+namespace panoptic_mapping {
+
+namespace {
+// Identifies the pool and queue of the worker executing on this thread.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int current_worker_index = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads) { startWorkers(num_threads); }
+
+ThreadPool::~ThreadPool() { stopWorkers(); }
+
+void ThreadPool::setNumThreads(int num_threads) {
+  if (num_threads == getNumThreads()) {
+    return;
+  }
+  CHECK(current_pool != this)
+      << "The thread pool can not be resized from one of its workers.";
+  stopWorkers();
+  startWorkers(num_threads);
+}
+
+void ThreadPool::startWorkers(int num_threads) {
+  num_threads = std::max(num_threads, 1);
+  stop_ = false;
+  queues_.clear();
+  for (int i = 0; i < num_threads; ++i) {
+    queues_.emplace_back(std::make_unique<WorkQueue>());
+  }
+  assignNodes(num_threads);
+  workers_.reserve(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+  applyScheduling();
+}
+
+void ThreadPool::setScheduling(const std::vector<int>& cores, int priority,
+                               bool numa_aware) {
+  cores_ = cores;
+  priority_ = priority;
+  if (numa_aware || numa_aware_) {
+    // The node assignment is read by the workers without synchronization.
+    CHECK(current_pool != this)
+        << "The thread pool can not be rescheduled from one of its workers.";
+    const int num_threads = getNumThreads();
+    stopWorkers();
+    numa_aware_ = numa_aware;
+    startWorkers(num_threads);
+    return;
+  }
+  for (size_t i = 0; i < worker_cores_.size(); ++i) {
+    worker_cores_[i].clear();
+    if (!cores_.empty()) {
+      worker_cores_[i].push_back(cores_[i % cores_.size()]);
+    }
+  }
+  applyScheduling();
+}
+
+void ThreadPool::assignNodes(int num_threads) {
+  worker_cores_.assign(num_threads, std::vector<int>());
+  worker_nodes_.assign(num_threads, 0);
+  node_workers_.clear();
+  const NumaTopology& topology = NumaTopology::get();
+  const bool use_nodes = numa_aware_ && topology.getNumNodes() > 1;
+  std::vector<int> machine_nodes(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    if (!cores_.empty()) {
+      const int core = cores_[i % cores_.size()];
+      worker_cores_[i].push_back(core);
+      machine_nodes[i] = use_nodes ? topology.getNodeOfCore(core) : 0;
+    } else if (use_nodes) {
+      machine_nodes[i] = i % topology.getNumNodes();
+      worker_cores_[i] = topology.getCores(machine_nodes[i]);
+    }
+  }
+
+  // Number the nodes that have workers consecutively.
+  std::vector<int> node_indices(topology.getNumNodes(), -1);
+  for (const int machine_node : machine_nodes) {
+    node_indices[machine_node] = 0;
+  }
+  int num_nodes = 0;
+  for (int& node : node_indices) {
+    if (node == 0) {
+      node = num_nodes++;
+    }
+  }
+  node_workers_.resize(std::max(num_nodes, 1));
+  for (int i = 0; i < num_threads; ++i) {
+    worker_nodes_[i] = node_indices[machine_nodes[i]];
+    node_workers_[worker_nodes_[i]].push_back(i);
+  }
+}
+
+int ThreadPool::getCurrentNode() const {
+  return current_pool == this ? worker_nodes_[current_worker_index] : 0;
+}
+
+void ThreadPool::applyScheduling() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    thread_scheduling::configureThread(&workers_[i], worker_cores_[i],
+                                       priority_,
+                                       "thread_pool_" + std::to_string(i));
+  }
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stop_ = true;
+  }
+  wake_condition_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void ThreadPool::pushTask(Task task, int node) {
+  // Workers keep their sub-tasks local, other threads distribute round robin.
+  // Tasks for a node are distributed over the workers of that node.
+  const bool has_node = node >= 0 && node < getNumNodes() &&
+                        !node_workers_[node].empty();
+  size_t queue_index;
+  if (current_pool == this &&
+      (!has_node || worker_nodes_[current_worker_index] == node)) {
+    queue_index = current_worker_index;
+  } else if (has_node) {
+    const std::vector<int>& workers = node_workers_[node];
+    queue_index = workers[next_queue_++ % workers.size()];
+  } else {
+    queue_index = next_queue_++ % queues_.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(queues_[queue_index]->mutex);
+    queues_[queue_index]->tasks.emplace_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    num_pending_tasks_++;
+  }
+  wake_condition_.notify_one();
+}
+
+bool ThreadPool::popTask(int worker_index, Task* task) {
+  // Check the own queue first, newest tasks are still hot in the cache.
+  if (worker_index >= 0) {
+    WorkQueue& queue = *queues_[worker_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      num_pending_tasks_--;
+      return true;
+    }
+  }
+
+  // Steal the oldest task from the other queues, workers of the same node
+  // first. Threads outside the pool steal from all queues alike.
+  const int num_queues = static_cast<int>(queues_.size());
+  const int node = worker_index >= 0 ? worker_nodes_[worker_index] : -1;
+  const int num_passes = node >= 0 && getNumNodes() > 1 ? 2 : 1;
+  for (int pass = 0; pass < num_passes; ++pass) {
+    for (int i = 1; i <= num_queues; ++i) {
+      const int index = (std::max(worker_index, 0) + i) % num_queues;
+      if (index == worker_index ||
+          (num_passes > 1 && (worker_nodes_[index] == node) != (pass == 0))) {
+        continue;
+      }
+      WorkQueue& queue = *queues_[index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        num_pending_tasks_--;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::runPendingTask() {
+  Task task;
+  if (!popTask(current_pool == this ? current_worker_index : -1, &task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+void ThreadPool::workerLoop(int worker_index) {
+  current_pool = this;
+  current_worker_index = worker_index;
+  Task task;
+  while (true) {
+    if (popTask(worker_index, &task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_condition_.wait(
+        lock, [this]() { return stop_ || num_pending_tasks_ > 0; });
+    if (stop_ && num_pending_tasks_ <= 0) {
+      return;
+    }
+  }
+}
+
+}  // namespace panoptic_mapping
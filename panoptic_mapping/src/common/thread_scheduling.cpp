@@ -0,0 +1,90 @@
+#include "panoptic_mapping/common/thread_scheduling.h"
+
+#include <cstring>
+
+#include <glog/logging.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace panoptic_mapping {
+namespace thread_scheduling {
+
+namespace {
+
+#ifdef __linux__
+
+bool configureHandle(pthread_t handle, const std::vector<int>& cores,
+                     int priority, const std::string& name) {
+  bool success = true;
+  if (!cores.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (const int core : cores) {
+      if (core < 0 || core >= CPU_SETSIZE) {
+        LOG(WARNING) << "Ignoring invalid core " << core << " for thread '"
+                     << name << "'.";
+        continue;
+      }
+      CPU_SET(core, &cpu_set);
+    }
+    const int error = pthread_setaffinity_np(handle, sizeof(cpu_set), &cpu_set);
+    if (error != 0) {
+      LOG(WARNING) << "Could not set the core affinity of thread '" << name
+                   << "': " << std::strerror(error) << ".";
+      success = false;
+    }
+  }
+  if (priority > 0) {
+    sched_param param{};
+    param.sched_priority = priority;
+    const int error = pthread_setschedparam(handle, SCHED_FIFO, &param);
+    if (error != 0) {
+      LOG(WARNING) << "Could not set the priority of thread '" << name
+                   << "' to " << priority << ": " << std::strerror(error)
+                   << ". Real-time priorities usually require CAP_SYS_NICE.";
+      success = false;
+    }
+  }
+  return success;
+}
+
+#endif  // __linux__
+
+bool isDefault(const std::vector<int>& cores, int priority) {
+  return cores.empty() && priority <= 0;
+}
+
+}  // namespace
+
+bool configureThread(std::thread* thread, const std::vector<int>& cores,
+                     int priority, const std::string& name) {
+  CHECK_NOTNULL(thread);
+  if (isDefault(cores, priority)) {
+    return true;
+  }
+#ifdef __linux__
+  return configureHandle(thread->native_handle(), cores, priority, name);
+#else
+  LOG(WARNING) << "Thread affinity and priority are only supported on Linux.";
+  return false;
+#endif
+}
+
+bool configureCurrentThread(const std::vector<int>& cores, int priority,
+                            const std::string& name) {
+  if (isDefault(cores, priority)) {
+    return true;
+  }
+#ifdef __linux__
+  return configureHandle(pthread_self(), cores, priority, name);
+#else
+  LOG(WARNING) << "Thread affinity and priority are only supported on Linux.";
+  return false;
+#endif
+}
+
+}  // namespace thread_scheduling
+}  // namespace panoptic_mapping
@@ -0,0 +1,545 @@
+#include "panoptic_mapping/common/timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <voxblox/utils/timing.h>
+
+#include "panoptic_mapping/common/allocation_tracking.h"
+#include "panoptic_mapping/common/tracing.h"
+
+namespace panoptic_mapping {
+namespace timing {
+
+namespace {
+
+constexpr size_t kMaxKeys = 1024;
+constexpr int64_t kNoMin = std::numeric_limits<int64_t>::max();
+
+// Statistics of one key in one thread. Only the owning thread writes, other
+// threads read them while aggregating.
+struct Accumulator {
+  std::atomic<uint64_t> count{0};
+  std::atomic<int64_t> total_ns{0};
+  std::atomic<double> sum_squares{0.0};  // s^2
+  std::atomic<int64_t> min_ns{kNoMin};
+  std::atomic<int64_t> max_ns{0};
+  std::atomic<uint64_t> num_allocations{0};
+  std::atomic<uint64_t> allocated_bytes{0};
+  std::atomic<int64_t> peak_bytes{0};
+  std::atomic<uint64_t> counter_samples{0};
+  std::atomic<uint64_t> counters[performance_counters::kNumEvents] = {};
+
+  void add(int64_t ns) {
+    const auto relaxed = std::memory_order_relaxed;
+    const double seconds = static_cast<double>(ns) * 1e-9;
+    count.store(count.load(relaxed) + 1, relaxed);
+    total_ns.store(total_ns.load(relaxed) + ns, relaxed);
+    sum_squares.store(sum_squares.load(relaxed) + seconds * seconds, relaxed);
+    if (ns < min_ns.load(relaxed)) {
+      min_ns.store(ns, relaxed);
+    }
+    if (ns > max_ns.load(relaxed)) {
+      max_ns.store(ns, relaxed);
+    }
+  }
+
+  void addAllocations(uint64_t count, uint64_t bytes, int64_t peak) {
+    const auto relaxed = std::memory_order_relaxed;
+    num_allocations.store(num_allocations.load(relaxed) + count, relaxed);
+    allocated_bytes.store(allocated_bytes.load(relaxed) + bytes, relaxed);
+    if (peak > peak_bytes.load(relaxed)) {
+      peak_bytes.store(peak, relaxed);
+    }
+  }
+
+  void addCounters(const performance_counters::Values& values) {
+    const auto relaxed = std::memory_order_relaxed;
+    counter_samples.store(counter_samples.load(relaxed) + 1, relaxed);
+    for (int i = 0; i < performance_counters::kNumEvents; ++i) {
+      counters[i].store(counters[i].load(relaxed) + values.counts[i],
+                        relaxed);
+    }
+  }
+
+  void reset() {
+    count = 0;
+    total_ns = 0;
+    sum_squares = 0.0;
+    min_ns = kNoMin;
+    max_ns = 0;
+    num_allocations = 0;
+    allocated_bytes = 0;
+    peak_bytes = 0;
+    counter_samples = 0;
+    for (auto& counter : counters) {
+      counter = 0;
+    }
+  }
+};
+
+struct ThreadStatistics {
+  Accumulator accumulators[kMaxKeys];
+};
+
+// Global registry of all keys and thread statistics.
+class Registry {
+ public:
+  static Registry& instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  size_t registerTag(const std::string& tag) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = indices_.find(tag);
+    if (it != indices_.end()) {
+      return it->second;
+    }
+    const size_t index = num_keys_.load(std::memory_order_relaxed);
+    CHECK_LT(index, kMaxKeys) << "Too many timer tags registered.";
+    tags_[index] = tag;
+    indices_[tag] = index;
+    num_keys_.store(index + 1, std::memory_order_release);
+    return index;
+  }
+
+  // Tags are never modified after registration, so they can be read
+  // without locking.
+  const std::string& getTag(size_t index) const { return tags_[index]; }
+  size_t getNumKeys() const {
+    return num_keys_.load(std::memory_order_acquire);
+  }
+
+  // Statistics of exited threads are reused by new threads, such that
+  // threads that are created repeatedly don't grow the memory.
+  ThreadStatistics* acquireThreadStatistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_threads_.empty()) {
+      ThreadStatistics* result = free_threads_.back();
+      free_threads_.pop_back();
+      return result;
+    }
+    threads_.emplace_back(std::make_unique<ThreadStatistics>());
+    return threads_.back().get();
+  }
+
+  void releaseThreadStatistics(ThreadStatistics* statistics) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_threads_.push_back(statistics);
+  }
+
+  template <typename FunctionT>
+  void forEachThread(const FunctionT& function) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& thread : threads_) {
+      function(thread.get());
+    }
+  }
+
+  bool findTag(const std::string& tag, size_t* index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = indices_.find(tag);
+    if (it == indices_.end()) {
+      return false;
+    }
+    *index = it->second;
+    return true;
+  }
+
+ private:
+  Registry() = default;
+
+  std::mutex mutex_;
+  std::string tags_[kMaxKeys];
+  std::atomic<size_t> num_keys_{0};
+  std::unordered_map<std::string, size_t> indices_;
+  std::vector<std::unique_ptr<ThreadStatistics>> threads_;
+  std::vector<ThreadStatistics*> free_threads_;
+};
+
+// Per thread state.
+struct ThreadState {
+  ThreadState()
+      : statistics(Registry::instance().acquireThreadStatistics()) {}
+  ~ThreadState() { Registry::instance().releaseThreadStatistics(statistics); }
+
+  ThreadStatistics* const statistics;
+  std::unordered_map<const char*, size_t> literal_indices;
+};
+
+ThreadState& threadState() {
+  thread_local ThreadState state;
+  return state;
+}
+
+size_t lookupLiteral(const char* tag) {
+  auto& indices = threadState().literal_indices;
+  auto it = indices.find(tag);
+  if (it != indices.end()) {
+    return it->second;
+  }
+  const size_t index = Registry::instance().registerTag(tag);
+  indices.emplace(tag, index);
+  return index;
+}
+
+std::string secondsToString(double seconds) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(6) << seconds;
+  return ss.str();
+}
+
+// Sums of the accumulators of one or more threads.
+class Aggregator {
+ public:
+  void add(const Accumulator& accumulator) {
+    const auto relaxed = std::memory_order_relaxed;
+    count_ += accumulator.count.load(relaxed);
+    total_ns_ += accumulator.total_ns.load(relaxed);
+    sum_squares_ += accumulator.sum_squares.load(relaxed);
+    min_ns_ = std::min(min_ns_, accumulator.min_ns.load(relaxed));
+    max_ns_ = std::max(max_ns_, accumulator.max_ns.load(relaxed));
+    result_.num_allocations += accumulator.num_allocations.load(relaxed);
+    result_.allocated_bytes += accumulator.allocated_bytes.load(relaxed);
+    result_.peak_bytes =
+        std::max(result_.peak_bytes, accumulator.peak_bytes.load(relaxed));
+    result_.counter_samples += accumulator.counter_samples.load(relaxed);
+    for (int i = 0; i < performance_counters::kNumEvents; ++i) {
+      result_.counters.counts[i] += accumulator.counters[i].load(relaxed);
+    }
+  }
+
+  Timing::Statistics getStatistics() const {
+    Timing::Statistics result = result_;
+    result.count = count_;
+    if (count_ == 0) {
+      return result;
+    }
+    const auto n = static_cast<double>(count_);
+    result.total = static_cast<double>(total_ns_) * 1e-9;
+    result.mean = result.total / n;
+    if (count_ > 1) {
+      result.stddev = std::sqrt(std::max(
+          (sum_squares_ - n * result.mean * result.mean) / (n - 1.0), 0.0));
+    }
+    result.min = static_cast<double>(min_ns_) * 1e-9;
+    result.max = static_cast<double>(max_ns_) * 1e-9;
+    return result;
+  }
+
+ private:
+  uint64_t count_ = 0;
+  int64_t total_ns_ = 0;
+  double sum_squares_ = 0.0;
+  int64_t min_ns_ = kNoMin;
+  int64_t max_ns_ = 0;
+  Timing::Statistics result_;
+};
+
+Timing::Statistics aggregate(size_t index) {
+  Aggregator aggregator;
+  Registry::instance().forEachThread([&](const ThreadStatistics* thread) {
+    aggregator.add(thread->accumulators[index]);
+  });
+  return aggregator.getStatistics();
+}
+
+double ratio(uint64_t numerator, uint64_t denominator) {
+  return denominator == 0 ? 0.0
+                          : static_cast<double>(numerator) /
+                                static_cast<double>(denominator);
+}
+
+}  // namespace
+
+Key::Key(const std::string& tag)
+    : index_(Registry::instance().registerTag(tag)) {}
+
+const std::string& Key::getTag() const {
+  return Registry::instance().getTag(index_);
+}
+
+Timer::Timer(const Key& key, bool construct_stopped) : index_(key.getIndex()) {
+  if (!construct_stopped) {
+    Start();
+  }
+}
+
+Timer::Timer(const char* tag, bool construct_stopped)
+    : index_(lookupLiteral(tag)) {
+  if (!construct_stopped) {
+    Start();
+  }
+}
+
+Timer::Timer(const std::string& tag, bool construct_stopped)
+    : index_(Registry::instance().registerTag(tag)) {
+  if (!construct_stopped) {
+    Start();
+  }
+}
+
+void Timer::Start() {
+  is_timing_ = true;
+  is_paused_ = false;
+  elapsed_ = Clock::duration::zero();
+  counters_ = performance_counters::Values();
+  if (allocation_tracking::isEnabled()) {
+    // Measure the peak of this scope, the outer peak is restored on Stop().
+    allocation_tracking::Counters& counters =
+        allocation_tracking::threadCounters();
+    num_allocations_ = 0;
+    allocated_bytes_ = 0;
+    live_bytes_start_ = counters.live_bytes;
+    outer_peak_bytes_ = counters.peak_live_bytes;
+    counters.peak_live_bytes = counters.live_bytes;
+  }
+  startSegment();
+}
+
+void Timer::Stop() {
+  if (!is_timing_) {
+    return;
+  }
+  if (!is_paused_) {
+    endSegment();
+  }
+  is_timing_ = false;
+  is_paused_ = false;
+  Accumulator& accumulator = threadState().statistics->accumulators[index_];
+  accumulator.add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed_).count());
+  if (allocation_tracking::isEnabled()) {
+    allocation_tracking::Counters& counters =
+        allocation_tracking::threadCounters();
+    accumulator.addAllocations(num_allocations_, allocated_bytes_,
+                               counters.peak_live_bytes - live_bytes_start_);
+    counters.peak_live_bytes =
+        std::max(counters.peak_live_bytes, outer_peak_bytes_);
+  }
+  if (has_counters_) {
+    accumulator.addCounters(counters_);
+  }
+}
+
+void Timer::Pause() {
+  if (is_timing_ && !is_paused_) {
+    endSegment();
+    is_paused_ = true;
+  }
+}
+
+void Timer::Unpause() {
+  if (is_timing_ && is_paused_) {
+    is_paused_ = false;
+    startSegment();
+  }
+}
+
+void Timer::startSegment() {
+  if (performance_counters::isEnabled()) {
+    has_counters_ = performance_counters::readThreadCounters(&counters_start_);
+  }
+  if (allocation_tracking::isEnabled()) {
+    const allocation_tracking::Counters& counters =
+        allocation_tracking::threadCounters();
+    allocations_start_ = counters.num_allocations;
+    bytes_start_ = counters.allocated_bytes;
+  }
+  start_ = Clock::now();
+}
+
+void Timer::endSegment() {
+  const Clock::time_point end = Clock::now();
+  elapsed_ += end - start_;
+  if (allocation_tracking::isEnabled()) {
+    const allocation_tracking::Counters& counters =
+        allocation_tracking::threadCounters();
+    num_allocations_ += counters.num_allocations - allocations_start_;
+    allocated_bytes_ += counters.allocated_bytes - bytes_start_;
+  }
+  performance_counters::Values counters_end;
+  if (has_counters_ &&
+      performance_counters::readThreadCounters(&counters_end)) {
+    for (int i = 0; i < performance_counters::kNumEvents; ++i) {
+      counters_.counts[i] +=
+          counters_end.counts[i] - counters_start_.counts[i];
+    }
+  }
+  Tracer* tracer = Tracer::getGlobalInstance();
+  if (tracer->isEnabled()) {
+    tracer->recordSpan(Registry::instance().getTag(index_), start_, end);
+  }
+}
+
+Timing::Statistics Timing::getStatistics(const std::string& tag) {
+  size_t index;
+  if (!Registry::instance().findTag(tag, &index)) {
+    return Statistics();
+  }
+  return aggregate(index);
+}
+
+double Timing::GetTotalSeconds(const std::string& tag) {
+  return getStatistics(tag).total;
+}
+
+double Timing::GetMeanSeconds(const std::string& tag) {
+  return getStatistics(tag).mean;
+}
+
+size_t Timing::GetNumSamples(const std::string& tag) {
+  return getStatistics(tag).count;
+}
+
+std::vector<Timing::Statistics> Timing::getThreadStatistics(
+    const std::string& tag) {
+  std::vector<Statistics> result;
+  size_t index;
+  if (!Registry::instance().findTag(tag, &index)) {
+    return result;
+  }
+  Registry::instance().forEachThread([&](const ThreadStatistics* thread) {
+    Aggregator aggregator;
+    aggregator.add(thread->accumulators[index]);
+    Statistics statistics = aggregator.getStatistics();
+    if (statistics.count > 0) {
+      result.push_back(statistics);
+    }
+  });
+  return result;
+}
+
+bool Timing::enablePerformanceCounters() {
+  return performance_counters::enable();
+}
+
+double Timing::Statistics::instructionsPerCycle() const {
+  return ratio(counters.counts[performance_counters::kInstructions],
+               counters.counts[performance_counters::kCycles]);
+}
+
+double Timing::Statistics::cacheMissRate() const {
+  return ratio(counters.counts[performance_counters::kCacheMisses],
+               counters.counts[performance_counters::kCacheReferences]);
+}
+
+double Timing::Statistics::branchMissRate() const {
+  return ratio(counters.counts[performance_counters::kBranchMisses],
+               counters.counts[performance_counters::kBranches]);
+}
+
+std::string Timing::Print() {
+  std::stringstream ss;
+  Print(ss);
+  return ss.str();
+}
+
+void Timing::Print(std::ostream& out) {
+  Registry& registry = Registry::instance();
+  const size_t num_keys = registry.getNumKeys();
+  std::vector<std::pair<std::string, size_t>> tags;
+  size_t max_tag_length = 0;
+  for (size_t i = 0; i < num_keys; ++i) {
+    tags.emplace_back(registry.getTag(i), i);
+    max_tag_length = std::max(max_tag_length, tags.back().first.size());
+  }
+  std::sort(tags.begin(), tags.end());
+
+  out << "SM Timing\n";
+  out << "-----------\n";
+  for (const auto& tag : tags) {
+    const Statistics statistics = aggregate(tag.second);
+    out.width(static_cast<std::streamsize>(max_tag_length));
+    out.setf(std::ios::left, std::ios::adjustfield);
+    out << tag.first << "\t";
+    out.width(7);
+    out.setf(std::ios::right, std::ios::adjustfield);
+    out << statistics.count << "\t";
+    if (statistics.count > 0) {
+      out << secondsToString(statistics.total) << "\t";
+      out << "(" << secondsToString(statistics.mean) << " +- "
+          << secondsToString(statistics.stddev) << ")\t";
+      out << "[" << secondsToString(statistics.min) << ","
+          << secondsToString(statistics.max) << "]";
+    }
+    out << "\n";
+  }
+
+  // Allocations per scope.
+  if (allocation_tracking::isEnabled()) {
+    out << "SM Allocations (per sample: allocations, KB; peak KB)\n";
+    out << "-----------\n";
+    for (const auto& tag : tags) {
+      const Statistics statistics = aggregate(tag.second);
+      if (statistics.count == 0) {
+        continue;
+      }
+      const auto n = static_cast<double>(statistics.count);
+      out.width(static_cast<std::streamsize>(max_tag_length));
+      out.setf(std::ios::left, std::ios::adjustfield);
+      out << tag.first << "\t";
+      out.width(7);
+      out.setf(std::ios::right, std::ios::adjustfield);
+      out << statistics.count << "\t" << std::fixed << std::setprecision(1)
+          << static_cast<double>(statistics.num_allocations) / n << "\t"
+          << static_cast<double>(statistics.allocated_bytes) / n / 1024.0
+          << "\t" << static_cast<double>(statistics.peak_bytes) / 1024.0
+          << "\n";
+      out.unsetf(std::ios::floatfield);
+    }
+  }
+
+  // Hardware counters per scope.
+  if (performance_counters::isEnabled()) {
+    out << "SM Hardware Counters (IPC, cache miss %, branch miss %, "
+           "Mcycles per sample)\n";
+    out << "-----------\n";
+    for (const auto& tag : tags) {
+      const Statistics statistics = aggregate(tag.second);
+      if (statistics.counter_samples == 0) {
+        continue;
+      }
+      out.width(static_cast<std::streamsize>(max_tag_length));
+      out.setf(std::ios::left, std::ios::adjustfield);
+      out << tag.first << "\t";
+      out.width(7);
+      out.setf(std::ios::right, std::ios::adjustfield);
+      out << statistics.counter_samples << "\t" << std::fixed
+          << std::setprecision(2) << statistics.instructionsPerCycle() << "\t"
+          << 100.0 * statistics.cacheMissRate() << "\t"
+          << 100.0 * statistics.branchMissRate() << "\t"
+          << ratio(statistics.counters.counts[performance_counters::kCycles],
+                   statistics.counter_samples) *
+                 1e-6
+          << "\n";
+      out.unsetf(std::ios::floatfield);
+    }
+  }
+
+  // Timers of voxblox itself.
+  out << voxblox::timing::Timing::Print();
+}
+
+void Timing::Reset() {
+  Registry::instance().forEachThread([](ThreadStatistics* thread) {
+    for (Accumulator& accumulator : thread->accumulators) {
+      accumulator.reset();
+    }
+  });
+}
+
+}  // namespace timing
+}  // namespace panoptic_mapping
@@ -0,0 +1,119 @@
+#include "panoptic_mapping/common/tracing.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <glog/logging.h>
+
+namespace panoptic_mapping {
+
+namespace {
+thread_local int64_t thread_frame = Tracer::kNoFrame;
+
+// Escape the characters that are not allowed in JSON strings.
+std::string escapeJson(const std::string& text) {
+  std::string result;
+  result.reserve(text.size());
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      result += ' ';
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+}  // namespace
+
+void Tracer::enable(size_t max_spans) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_spans_ = max_spans;
+  while (spans_.size() > max_spans_) {
+    spans_.pop_front();
+  }
+  enabled_ = max_spans_ > 0;
+}
+
+void Tracer::setThreadFrame(int64_t frame) { thread_frame = frame; }
+
+void Tracer::recordSpan(const std::string& name, Clock::time_point start,
+                        Clock::time_point end) {
+  if (!enabled_) {
+    return;
+  }
+  Span span;
+  span.name = name;
+  span.start_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(start - epoch_)
+          .count();
+  span.duration_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+  span.frame = thread_frame != kNoFrame ? thread_frame : frame_.load();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = thread_ids_.find(std::this_thread::get_id());
+  if (it == thread_ids_.end()) {
+    it = thread_ids_
+             .emplace(std::this_thread::get_id(),
+                      static_cast<int>(thread_ids_.size()))
+             .first;
+  }
+  span.thread = it->second;
+  if (spans_.size() >= max_spans_) {
+    spans_.pop_front();
+  }
+  spans_.emplace_back(std::move(span));
+}
+
+void Tracer::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  spans_.clear();
+}
+
+size_t Tracer::getNumberOfSpans() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return spans_.size();
+}
+
+std::string Tracer::toChromeTrace() const {
+  // Complete events ('X') with microsecond timestamps, see the Trace Event
+  // Format specification.
+  std::stringstream stream;
+  stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool first = true;
+  for (const Span& span : spans_) {
+    if (!first) {
+      stream << ",";
+    }
+    first = false;
+    stream << "\n{\"name\":\"" << escapeJson(span.name)
+           << "\",\"cat\":\"panoptic_mapping\",\"ph\":\"X\",\"ts\":"
+           << span.start_us << ",\"dur\":" << span.duration_us
+           << ",\"pid\":0,\"tid\":" << span.thread
+           << ",\"args\":{\"frame\":" << span.frame << "}}";
+  }
+  stream << "\n]}\n";
+  return stream.str();
+}
+
+bool Tracer::writeChromeTrace(const std::string& file_path) const {
+  std::ofstream file(file_path, std::ios::out | std::ios::trunc);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open trace file '" << file_path << "'.";
+    return false;
+  }
+  file << toChromeTrace();
+  if (!file.good()) {
+    LOG(ERROR) << "Could not write trace file '" << file_path << "'.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace panoptic_mapping
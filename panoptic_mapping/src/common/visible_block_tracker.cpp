@@ -0,0 +1,191 @@
+#include "panoptic_mapping/common/visible_block_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace panoptic_mapping {
+
+namespace {
+
+// Center of a block in submap frame, computed as for allocated blocks.
+Point blockCenter(const BlockIndex& index, float block_size) {
+  return voxblox::getOriginPointFromGridIndex(index, block_size) +
+         Point(1, 1, 1) * block_size / 2.0;
+}
+
+}  // namespace
+
+void VisibleBlockTracker::Config::checkParams() const {
+  checkParamGE(max_displacement, 0.f, "max_displacement");
+  checkParamGT(max_reuse_frames, 0, "max_reuse_frames");
+}
+
+void VisibleBlockTracker::Config::setupParamsAndPrinting() {
+  setupParam("max_displacement", &max_displacement, "m");
+  setupParam("max_reuse_frames", &max_reuse_frames);
+}
+
+VisibleBlockTracker::VisibleBlockTracker(const Config& config)
+    : config_(config.checkValid()) {}
+
+std::unordered_map<int, voxblox::BlockIndexList>
+VisibleBlockTracker::findVisibleBlocks(
+    const Camera& camera, const SubmapCollection& submaps,
+    const Transformation& T_M_C, bool only_active_submaps,
+    const RangeImagePyramid* range_pyramid,
+    const std::unordered_map<int, voxblox::IndexSet>* new_blocks) {
+  std::unordered_map<int, voxblox::BlockIndexList> result;
+  std::unordered_set<int> visited_submaps;
+  for (const int id : submaps.findSubmapsIntersecting(
+           T_M_C.getPosition(), camera.getConfig().max_range)) {
+    const Submap& submap = submaps.getSubmap(id);
+    if (!submap.isActive() && only_active_submaps) {
+      continue;
+    }
+    if (!camera.submapIsInViewFrustum(submap, T_M_C)) {
+      continue;
+    }
+    visited_submaps.insert(id);
+    const TsdfLayer& layer = submap.getTsdfLayer();
+    const Transformation T_C_S = T_M_C.inverse() * submap.getT_M_S();
+    const float block_size = layer.block_size();
+    const float block_diag_half = std::sqrt(3.0f) * block_size / 2.0f;
+    SubmapMargins& margins = submaps_[id];
+
+    // Register the blocks allocated since the last frame.
+    if (new_blocks) {
+      auto it = new_blocks->find(id);
+      if (it != new_blocks->end()) {
+        for (const BlockIndex& index : it->second) {
+          if (margins.reference_blocks.find(index) ==
+              margins.reference_blocks.end()) {
+            margins.new_blocks.insert(index);
+          }
+        }
+      }
+    }
+
+    // Find all blocks in the view frustum. If the stored margins can not be
+    // reused, e.g. because blocks were removed, re-test all blocks.
+    voxblox::BlockIndexList candidates;
+    const float bound = computeDisplacementBound(camera, margins.T_C_S, T_C_S,
+                                                 block_diag_half);
+    const bool reuse =
+        margins.num_frames > 0 &&
+        margins.num_frames < config_.max_reuse_frames &&
+        bound <= config_.max_displacement &&
+        layer.getNumberOfAllocatedBlocks() ==
+            margins.reference_blocks.size() + margins.new_blocks.size();
+    if (reuse) {
+      margins.num_frames++;
+      // Blocks with margins beyond the bound can not change their visibility.
+      auto lower = std::lower_bound(
+          margins.margins.begin(), margins.margins.end(), -bound,
+          [](const auto& entry, float value) { return entry.first < value; });
+      auto upper = std::upper_bound(
+          lower, margins.margins.end(), bound,
+          [](float value, const auto& entry) { return value < entry.first; });
+      for (auto it = lower; it != upper; ++it) {
+        if (camera.pointIsInViewFrustum(
+                T_C_S * blockCenter(it->second, block_size), block_diag_half)) {
+          candidates.push_back(it->second);
+        }
+      }
+      for (auto it = upper; it != margins.margins.end(); ++it) {
+        candidates.push_back(it->second);
+      }
+      for (const BlockIndex& index : margins.new_blocks) {
+        if (camera.pointIsInViewFrustum(T_C_S * blockCenter(index, block_size),
+                                        block_diag_half)) {
+          candidates.push_back(index);
+        }
+      }
+    } else {
+      resetMargins(camera, submap, T_C_S, &margins);
+      for (const auto& margin_index_pair : margins.margins) {
+        if (camera.pointIsInViewFrustum(
+                T_C_S * blockCenter(margin_index_pair.second, block_size),
+                block_diag_half)) {
+          candidates.push_back(margin_index_pair.second);
+        }
+      }
+    }
+
+    // Exclude blocks behind the observed surface.
+    voxblox::BlockIndexList& block_list = result[id];
+    const float truncation_distance = submap.getConfig().truncation_distance;
+    for (const BlockIndex& index : candidates) {
+      if (!layer.hasBlock(index)) {
+        continue;
+      }
+      if (range_pyramid &&
+          camera.sphereIsBehindSurface(T_C_S * blockCenter(index, block_size),
+                                       block_diag_half, *range_pyramid,
+                                       truncation_distance)) {
+        continue;
+      }
+      block_list.push_back(index);
+    }
+    if (block_list.empty()) {
+      result.erase(id);
+    }
+  }
+
+  // Submaps that are not visible need to be re-tested when they reappear.
+  for (auto it = submaps_.begin(); it != submaps_.end();) {
+    if (visited_submaps.find(it->first) == visited_submaps.end()) {
+      it = submaps_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return result;
+}
+
+void VisibleBlockTracker::resetMargins(const Camera& camera,
+                                       const Submap& submap,
+                                       const Transformation& T_C_S,
+                                       SubmapMargins* margins) const {
+  const TsdfLayer& layer = submap.getTsdfLayer();
+  const float block_size = layer.block_size();
+  const float block_diag_half = std::sqrt(3.0f) * block_size / 2.0f;
+  voxblox::BlockIndexList all_blocks;
+  layer.getAllAllocatedBlocks(&all_blocks);
+  margins->T_C_S = T_C_S;
+  margins->margins.clear();
+  margins->margins.reserve(all_blocks.size());
+  margins->reference_blocks.clear();
+  margins->new_blocks.clear();
+  margins->num_frames = 1;
+  for (const BlockIndex& index : all_blocks) {
+    margins->margins.emplace_back(
+        camera.viewFrustumMargin(T_C_S * blockCenter(index, block_size),
+                                 block_diag_half),
+        index);
+    margins->reference_blocks.insert(index);
+  }
+  std::sort(margins->margins.begin(), margins->margins.end(),
+            [](const auto& lhs, const auto& rhs) {
+              return lhs.first < rhs.first;
+            });
+}
+
+float VisibleBlockTracker::computeDisplacementBound(
+    const Camera& camera, const Transformation& T_C_S_reference,
+    const Transformation& T_C_S, float block_diag_half) const {
+  // Points move by at most the translation plus the chord of the rotation.
+  // Only blocks that can be in range matter, blocks further away are out of
+  // range since the range changes by at most the translation.
+  const Transformation T_delta = T_C_S * T_C_S_reference.inverse();
+  const float translation = T_delta.getPosition().norm();
+  const float angle =
+      Eigen::AngleAxisf(T_delta.getRotation().toImplementation()).angle();
+  return translation + 2.f * std::sin(angle / 2.f) *
+                           (camera.getConfig().max_range + block_diag_half +
+                            translation);
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,213 @@
+#include "panoptic_mapping/integration/cuda_projective_tsdf_integrator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/map/voxel_mask.h"
+
+namespace panoptic_mapping {
+
+static_assert(sizeof(cuda::TsdfVoxel) == sizeof(TsdfVoxel),
+              "The device voxels need to match the layout of TsdfVoxel.");
+
+config_utilities::Factory::RegistrationRos<
+    TsdfIntegratorBase, CudaProjectiveIntegrator, std::shared_ptr<Globals>>
+    CudaProjectiveIntegrator::registration_("cuda_projective");
+
+void CudaProjectiveIntegrator::Config::checkParams() const {
+  checkParamConfig(pi_config);
+  checkParamGT(max_blocks_per_batch, 0, "max_blocks_per_batch");
+  checkParamCond(pi_config.interpolation_method == "nearest" ||
+                     pi_config.interpolation_method == "bilinear",
+                 "The CUDA backend only supports the 'nearest' and "
+                 "'bilinear' interpolation methods.");
+}
+
+void CudaProjectiveIntegrator::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("max_blocks_per_batch", &max_blocks_per_batch);
+  setupParam("projective_integrator", &pi_config);
+}
+
+CudaProjectiveIntegrator::CudaProjectiveIntegrator(
+    const Config& config, std::shared_ptr<Globals> globals)
+    : config_(config.checkValid()),
+      ProjectiveIntegrator(config.pi_config, std::move(globals), false) {
+  LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
+  if (cuda::isDeviceAvailable()) {
+    device_ = std::make_unique<cuda::DeviceIntegrator>();
+  } else {
+    LOG_IF(WARNING, config_.verbosity >= 1)
+        << "No CUDA device found, integrating on the CPU.";
+  }
+
+  // The device update implements the rules of the projective integrator.
+  const ProjectiveIntegrator::Config& pi_config = config_.pi_config;
+  params_.use_bilinear_interpolation =
+      pi_config.interpolation_method == "bilinear";
+  params_.use_weight_dropoff = pi_config.use_weight_dropoff;
+  params_.weight_dropoff_epsilon = pi_config.weight_dropoff_epsilon;
+  params_.use_constant_weight = pi_config.use_constant_weight;
+  params_.max_weight = pi_config.max_weight;
+  params_.foreign_rays_clear = pi_config.foreign_rays_clear;
+  params_.all_rays_update = voxel_update_rules_.all_rays_update;
+  params_.update_free_space_surface =
+      voxel_update_rules_.update_free_space_surface;
+}
+
+void CudaProjectiveIntegrator::integrateBlocks(
+    SubmapCollection* submaps, const InputData& input,
+    std::vector<SubmapBlockIndex> work_items,
+    const std::unordered_map<int, Transformation>& T_C_S) {
+  if (!device_) {
+    ProjectiveIntegrator::integrateBlocks(submaps, input,
+                                          std::move(work_items), T_C_S);
+    return;
+  }
+  if (work_items.empty()) {
+    return;
+  }
+  if (!uploadImages(input)) {
+    LOG(WARNING) << device_->getLastError() << " Integrating on the CPU.";
+    device_.reset();
+    ProjectiveIntegrator::integrateBlocks(submaps, input,
+                                          std::move(work_items), T_C_S);
+    return;
+  }
+
+  // The work items are grouped by submap, so batches are split where the block
+  // layout changes.
+  Timer timer("tsdf_integration/cuda_integration");
+  size_t begin = 0;
+  while (begin < work_items.size()) {
+    const size_t voxels_per_side = submaps->getSubmap(work_items[begin].first)
+                                       .getTsdfLayer()
+                                       .voxels_per_side();
+    const size_t max_end = std::min(
+        work_items.size(),
+        begin + static_cast<size_t>(config_.max_blocks_per_batch));
+    size_t end = begin + 1;
+    while (end < max_end && submaps->getSubmap(work_items[end].first)
+                                    .getTsdfLayer()
+                                    .voxels_per_side() == voxels_per_side) {
+      ++end;
+    }
+    if (!integrateBatch(submaps, work_items, begin, end, T_C_S)) {
+      LOG(WARNING) << device_->getLastError() << " Integrating on the CPU.";
+      device_.reset();
+      ProjectiveIntegrator::integrateBlocks(
+          submaps, input,
+          std::vector<SubmapBlockIndex>(work_items.begin() + begin,
+                                        work_items.end()),
+          T_C_S);
+      return;
+    }
+    begin = end;
+  }
+}
+
+bool CudaProjectiveIntegrator::uploadImages(const InputData& input) {
+  Timer timer("tsdf_integration/cuda_upload_images");
+  params_.camera = {cam_config_->fx,        cam_config_->fy,
+                    cam_config_->vx,        cam_config_->vy,
+                    cam_config_->width,     cam_config_->height,
+                    cam_config_->min_range, cam_config_->max_range};
+  const cv::Mat& id_image = input.idImage();
+  CHECK_EQ(id_image.type(), CV_32SC1);
+  const bool use_color = voxel_update_rules_.update_color &&
+                         input.has(InputData::InputType::kColorImage);
+  const uint8_t* color_data = nullptr;
+  size_t color_step = 0;
+  if (use_color) {
+    const cv::Mat& color_image = input.colorImage();
+    CHECK_EQ(color_image.type(), CV_8UC3);
+    color_data = color_image.data;
+    color_step = color_image.step;
+  }
+  return device_->uploadImages(cam_config_->width, cam_config_->height,
+                               range_image_.data(), id_image.data,
+                               id_image.step, color_data, color_step);
+}
+
+bool CudaProjectiveIntegrator::integrateBatch(
+    SubmapCollection* submaps, const std::vector<SubmapBlockIndex>& work_items,
+    size_t begin, size_t end,
+    const std::unordered_map<int, Transformation>& T_C_S) {
+  // Gather the blocks. The layers were prepared for the update, so the blocks
+  // can be looked up directly.
+  blocks_.clear();
+  block_params_.clear();
+  int voxels_per_side = 0;
+  for (size_t i = begin; i < end; ++i) {
+    const SubmapBlockIndex& item = work_items[i];
+    Submap* submap = submaps->getSubmapPtr(item.first);
+    TsdfBlock::Ptr block = submap->getBlocks(item.second).tsdf;
+    if (!block) {
+      LOG_IF(WARNING, config_.verbosity >= 1)
+          << "Tried to access inexistent block '" << item.second.transpose()
+          << "' in submap " << submap->getID() << ".";
+      continue;
+    }
+    voxels_per_side = block->voxels_per_side();
+    const Transformation& T = T_C_S.at(item.first);
+    cuda::BlockParams& params = block_params_.emplace_back();
+    Eigen::Map<Eigen::Matrix<float, 3, 3, Eigen::RowMajor>>(params.rotation) =
+        T.getRotationMatrix();
+    Eigen::Map<Eigen::Vector3f>(params.translation) = T * block->origin();
+    params.submap_id = submap->getID();
+    params.voxel_size = block->voxel_size();
+    params.truncation_distance = submap->getConfig().truncation_distance;
+    params.weight_scale = static_cast<float>(getIntegrationPeriod(*submap));
+    params.is_free_space_submap =
+        submap->getLabel() == PanopticLabel::kFreeSpace;
+    params.store_color =
+        voxel_update_rules_.update_color && submap->getConfig().store_color;
+    blocks_.push_back({submap, item.second, std::move(block)});
+  }
+  if (blocks_.empty()) {
+    return true;
+  }
+
+  // Copy the voxels into the staging buffer and integrate them.
+  const size_t num_voxels = voxels_per_side * voxels_per_side * voxels_per_side;
+  voxels_.resize(blocks_.size() * num_voxels);
+  updated_.resize(voxels_.size());
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    std::memcpy(&voxels_[i * num_voxels],
+                &blocks_[i].block->getVoxelByLinearIndex(0),
+                num_voxels * sizeof(TsdfVoxel));
+  }
+  if (!device_->integrate(params_, block_params_.data(), blocks_.size(),
+                          voxels_per_side, voxels_.data(), updated_.data())) {
+    return false;
+  }
+
+  // Write the updated blocks back.
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    const uint8_t* updated = &updated_[i * num_voxels];
+    VoxelMask updated_voxels(num_voxels);
+    for (size_t j = 0; j < num_voxels; ++j) {
+      if (updated[j]) {
+        updated_voxels.set(j);
+      }
+    }
+    if (updated_voxels.none()) {
+      continue;
+    }
+    const BatchBlock& batch_block = blocks_[i];
+    TsdfBlock& block = *batch_block.block;
+    std::memcpy(&block.getVoxelByLinearIndex(0), &voxels_[i * num_voxels],
+                num_voxels * sizeof(TsdfVoxel));
+    block.setUpdatedAll();
+    batch_block.submap->recordChangedBlock(batch_block.index);
+    batch_block.submap->getVoxelMasksPtr()->update(batch_block.index, block,
+                                                   &updated_voxels);
+  }
+  return true;
+}
+
+}  // namespace panoptic_mapping
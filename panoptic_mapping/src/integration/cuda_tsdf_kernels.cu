@@ -0,0 +1,417 @@
+#include "panoptic_mapping/integration/cuda_tsdf_kernels.h"
+
+#include <string>
+
+#include <cuda_runtime.h>
+
+namespace panoptic_mapping {
+namespace cuda {
+
+namespace {
+
+constexpr int kThreadsPerBlock = 256;
+
+// Images of the current view on the device, stored without padding.
+struct DeviceImages {
+  const float* range;  // Column-major.
+  const int32_t* ids;
+  const uint8_t* color;  // BGR, nullptr if not uploaded.
+  int width;
+  int height;
+};
+
+// Pixel lookup, equivalent to the nearest and bilinear interpolators.
+struct PixelLookup {
+  int u;
+  int v;
+  int u1;  // Clamped neighbors for bilinear interpolation.
+  int v1;
+  float weight[4];
+  bool bilinear;
+};
+
+__device__ bool projectPointToImagePlane(const CameraParams& camera, float x,
+                                         float y, float z, float* u,
+                                         float* v) {
+  *u = x * camera.fx / z + camera.vx;
+  if (ceilf(*u) >= camera.width || floorf(*u) < 0.f) {
+    return false;
+  }
+  *v = y * camera.fy / z + camera.vy;
+  if (ceilf(*v) >= camera.height || floorf(*v) < 0.f) {
+    return false;
+  }
+  return true;
+}
+
+__device__ void computeWeights(const DeviceImages& images, bool bilinear,
+                               float u, float v, PixelLookup* lookup) {
+  lookup->bilinear = bilinear;
+  if (!bilinear) {
+    lookup->u = static_cast<int>(roundf(u));
+    lookup->v = static_cast<int>(roundf(v));
+    return;
+  }
+  lookup->u = static_cast<int>(floorf(u));
+  lookup->v = static_cast<int>(floorf(v));
+  // Neighbors outside the image only occur with zero weight.
+  lookup->u1 = min(lookup->u + 1, images.width - 1);
+  lookup->v1 = min(lookup->v + 1, images.height - 1);
+  const float du = u - static_cast<float>(lookup->u);
+  const float dv = v - static_cast<float>(lookup->v);
+  lookup->weight[0] = (1.f - du) * (1.f - dv);
+  lookup->weight[1] = (1.f - du) * dv;
+  lookup->weight[2] = du * (1.f - dv);
+  lookup->weight[3] = du * dv;
+}
+
+__device__ float interpolateRange(const DeviceImages& images,
+                                  const PixelLookup& lookup) {
+  const float* range = images.range;
+  const int h = images.height;
+  if (!lookup.bilinear) {
+    return range[lookup.u * h + lookup.v];
+  }
+  return range[lookup.u * h + lookup.v] * lookup.weight[0] +
+         range[lookup.u * h + lookup.v1] * lookup.weight[1] +
+         range[lookup.u1 * h + lookup.v] * lookup.weight[2] +
+         range[lookup.u1 * h + lookup.v1] * lookup.weight[3];
+}
+
+__device__ int interpolateID(const DeviceImages& images,
+                             const PixelLookup& lookup) {
+  const int32_t* ids = images.ids;
+  const int w = images.width;
+  if (!lookup.bilinear) {
+    return ids[lookup.v * w + lookup.u];
+  }
+  // IDs can not be interpolated, return the ID with the highest total weight.
+  const int corner_ids[4] = {
+      ids[lookup.v * w + lookup.u], ids[lookup.v1 * w + lookup.u],
+      ids[lookup.v * w + lookup.u1], ids[lookup.v1 * w + lookup.u1]};
+  int best_id = corner_ids[0];
+  float best_weight = -1.f;
+  for (int i = 0; i < 4; ++i) {
+    float weight = 0.f;
+    for (int j = 0; j < 4; ++j) {
+      if (corner_ids[j] == corner_ids[i]) {
+        weight += lookup.weight[j];
+      }
+    }
+    if (weight > best_weight) {
+      best_weight = weight;
+      best_id = corner_ids[i];
+    }
+  }
+  return best_id;
+}
+
+__device__ void interpolateColor(const DeviceImages& images,
+                                 const PixelLookup& lookup, uint8_t* r,
+                                 uint8_t* g, uint8_t* b) {
+  const uint8_t* color = images.color;
+  const int w = images.width;
+  if (!lookup.bilinear) {
+    const uint8_t* bgr = &color[3 * (lookup.v * w + lookup.u)];
+    *r = bgr[2];
+    *g = bgr[1];
+    *b = bgr[0];
+    return;
+  }
+  const uint8_t* corners[4] = {&color[3 * (lookup.v * w + lookup.u)],
+                               &color[3 * (lookup.v1 * w + lookup.u)],
+                               &color[3 * (lookup.v * w + lookup.u1)],
+                               &color[3 * (lookup.v1 * w + lookup.u1)]};
+  float bgr[3] = {0.f, 0.f, 0.f};
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      bgr[i] += corners[j][i] * lookup.weight[j];
+    }
+  }
+  *r = static_cast<uint8_t>(bgr[2]);
+  *g = static_cast<uint8_t>(bgr[1]);
+  *b = static_cast<uint8_t>(bgr[0]);
+}
+
+__device__ float computeWeight(const IntegrationParams& params, float z,
+                               float voxel_size, float truncation_distance,
+                               float sdf) {
+  // Same weighting as 'ProjectiveIntegrator::computeWeight()'.
+  const float ratio = voxel_size / z;
+  float weight = params.camera.fx * params.camera.fy * ratio * ratio;
+  if (!params.use_constant_weight) {
+    weight /= z * z;
+  }
+  if (params.use_weight_dropoff) {
+    const float dropoff_epsilon = params.weight_dropoff_epsilon > 0.f
+                                      ? params.weight_dropoff_epsilon
+                                      : params.weight_dropoff_epsilon *
+                                            -voxel_size;
+    if (sdf < -dropoff_epsilon) {
+      weight *=
+          (truncation_distance + sdf) / (truncation_distance - dropoff_epsilon);
+      weight = fmaxf(weight, 0.f);
+    }
+  }
+  return weight;
+}
+
+__device__ uint8_t blendChannel(uint8_t first, float first_weight,
+                                uint8_t second, float second_weight) {
+  return static_cast<uint8_t>(
+      roundf(first * first_weight + second * second_weight));
+}
+
+__device__ void updateVoxelValues(const IntegrationParams& params,
+                                  TsdfVoxel* voxel, float sdf, float weight,
+                                  const uint8_t* rgb) {
+  // Same weighted averaging as 'ProjectiveIntegrator::updateVoxelValues()'.
+  voxel->distance = (voxel->distance * voxel->weight + sdf * weight) /
+                    (voxel->weight + weight);
+  voxel->weight = fminf(voxel->weight + weight, params.max_weight);
+  if (rgb) {
+    const float total_weight = voxel->weight + weight;
+    const float first_weight = voxel->weight / total_weight;
+    const float second_weight = weight / total_weight;
+    voxel->r = blendChannel(voxel->r, first_weight, rgb[0], second_weight);
+    voxel->g = blendChannel(voxel->g, first_weight, rgb[1], second_weight);
+    voxel->b = blendChannel(voxel->b, first_weight, rgb[2], second_weight);
+    voxel->a = blendChannel(voxel->a, first_weight, 255u, second_weight);
+  }
+}
+
+// Device version of 'ProjectiveIntegrator::updateVoxelImpl()' for TSDF only
+// updates. Returns true if the voxel was updated.
+__device__ bool updateVoxel(const IntegrationParams& params,
+                            const BlockParams& block,
+                            const DeviceImages& images, int linear_index,
+                            int voxels_per_side, TsdfVoxel* voxel) {
+  // Voxel center in camera frame.
+  const int x = linear_index % voxels_per_side;
+  const int y = (linear_index / voxels_per_side) % voxels_per_side;
+  const int z = linear_index / (voxels_per_side * voxels_per_side);
+  const float o[3] = {(x + 0.5f) * block.voxel_size,
+                      (y + 0.5f) * block.voxel_size,
+                      (z + 0.5f) * block.voxel_size};
+  float p_C[3];
+  for (int i = 0; i < 3; ++i) {
+    p_C[i] = block.rotation[3 * i] * o[0] + block.rotation[3 * i + 1] * o[1] +
+             block.rotation[3 * i + 2] * o[2] + block.translation[i];
+  }
+
+  // Skip voxels that are too far or too close.
+  if (p_C[2] < 0.f) {
+    return false;
+  }
+  const float distance_to_voxel =
+      sqrtf(p_C[0] * p_C[0] + p_C[1] * p_C[1] + p_C[2] * p_C[2]);
+  if (distance_to_voxel < params.camera.min_range ||
+      distance_to_voxel > params.camera.max_range) {
+    return false;
+  }
+  float u, v;
+  if (!projectPointToImagePlane(params.camera, p_C[0], p_C[1], p_C[2], &u,
+                                &v)) {
+    return false;
+  }
+  PixelLookup lookup;
+  computeWeights(images, params.use_bilinear_interpolation, u, v, &lookup);
+  float sdf = interpolateRange(images, lookup) - distance_to_voxel;
+  const float truncation_distance = block.truncation_distance;
+  if (sdf < -truncation_distance) {
+    return false;
+  }
+
+  // Check whether this is a clearing or an updating measurement.
+  const bool point_belongs_to_this_submap =
+      params.all_rays_update ||
+      interpolateID(images, lookup) == block.submap_id;
+  if (!(point_belongs_to_this_submap || params.foreign_rays_clear ||
+        block.is_free_space_submap)) {
+    return false;
+  }
+  const float weight = computeWeight(params, p_C[2], block.voxel_size,
+                                     truncation_distance, sdf) *
+                       block.weight_scale;
+
+  // Apply distance, color, and weight.
+  if (point_belongs_to_this_submap || block.is_free_space_submap) {
+    sdf = fminf(sdf, truncation_distance);
+    const bool is_surface_update =
+        point_belongs_to_this_submap && fabsf(sdf) < truncation_distance &&
+        (!block.is_free_space_submap || params.update_free_space_surface);
+    if (is_surface_update && block.store_color && images.color) {
+      uint8_t rgb[3];
+      interpolateColor(images, lookup, &rgb[0], &rgb[1], &rgb[2]);
+      updateVoxelValues(params, voxel, sdf, weight, rgb);
+    } else {
+      updateVoxelValues(params, voxel, sdf, weight, nullptr);
+    }
+  } else if (sdf > 0.f) {
+    // Foreign rays clear voxels in front of the surface.
+    updateVoxelValues(params, voxel, truncation_distance, weight, nullptr);
+  }
+  return true;
+}
+
+// One CUDA block per TSDF block, the threads iterate over its voxels.
+__global__ void integrateBlocksKernel(IntegrationParams params,
+                                      const BlockParams* blocks,
+                                      int voxels_per_side, DeviceImages images,
+                                      TsdfVoxel* voxels, uint8_t* updated) {
+  const BlockParams& block = blocks[blockIdx.x];
+  const int num_voxels = voxels_per_side * voxels_per_side * voxels_per_side;
+  const size_t offset = static_cast<size_t>(blockIdx.x) * num_voxels;
+  for (int i = threadIdx.x; i < num_voxels; i += blockDim.x) {
+    updated[offset + i] = updateVoxel(params, block, images, i,
+                                      voxels_per_side, &voxels[offset + i]);
+  }
+}
+
+// Grow a device buffer to hold at least 'size' bytes.
+cudaError_t reserve(void** buffer, size_t* capacity, size_t size) {
+  if (size <= *capacity) {
+    return cudaSuccess;
+  }
+  cudaFree(*buffer);
+  *buffer = nullptr;
+  *capacity = 0;
+  const cudaError_t error = cudaMalloc(buffer, size);
+  if (error == cudaSuccess) {
+    *capacity = size;
+  }
+  return error;
+}
+
+}  // namespace
+
+struct DeviceIntegrator::Buffers {
+  void* range = nullptr;
+  void* ids = nullptr;
+  void* color = nullptr;
+  void* blocks = nullptr;
+  void* voxels = nullptr;
+  void* updated = nullptr;
+  size_t range_capacity = 0;
+  size_t ids_capacity = 0;
+  size_t color_capacity = 0;
+  size_t blocks_capacity = 0;
+  size_t voxels_capacity = 0;
+  size_t updated_capacity = 0;
+  int width = 0;
+  int height = 0;
+  bool has_color = false;
+
+  ~Buffers() {
+    cudaFree(range);
+    cudaFree(ids);
+    cudaFree(color);
+    cudaFree(blocks);
+    cudaFree(voxels);
+    cudaFree(updated);
+  }
+};
+
+DeviceIntegrator::DeviceIntegrator() : buffers_(new Buffers()) {}
+
+DeviceIntegrator::~DeviceIntegrator() = default;
+
+bool DeviceIntegrator::uploadImages(int width, int height,
+                                    const float* range_image,
+                                    const uint8_t* id_image, size_t id_step,
+                                    const uint8_t* color_image,
+                                    size_t color_step) {
+  Buffers& b = *buffers_;
+  const size_t num_pixels = static_cast<size_t>(width) * height;
+  cudaError_t error =
+      reserve(&b.range, &b.range_capacity, num_pixels * sizeof(float));
+  if (error == cudaSuccess) {
+    error = reserve(&b.ids, &b.ids_capacity, num_pixels * sizeof(int32_t));
+  }
+  if (error == cudaSuccess && color_image) {
+    error = reserve(&b.color, &b.color_capacity, num_pixels * 3u);
+  }
+  if (error == cudaSuccess) {
+    error = cudaMemcpy(b.range, range_image, num_pixels * sizeof(float),
+                       cudaMemcpyHostToDevice);
+  }
+  if (error == cudaSuccess) {
+    error = cudaMemcpy2D(b.ids, width * sizeof(int32_t), id_image, id_step,
+                         width * sizeof(int32_t), height,
+                         cudaMemcpyHostToDevice);
+  }
+  if (error == cudaSuccess && color_image) {
+    error = cudaMemcpy2D(b.color, width * 3u, color_image, color_step,
+                         width * 3u, height, cudaMemcpyHostToDevice);
+  }
+  if (error != cudaSuccess) {
+    last_error_ = std::string("Could not upload the images: ") +
+                  cudaGetErrorString(error);
+    return false;
+  }
+  b.width = width;
+  b.height = height;
+  b.has_color = color_image != nullptr;
+  return true;
+}
+
+bool DeviceIntegrator::integrate(const IntegrationParams& params,
+                                 const BlockParams* blocks, size_t num_blocks,
+                                 int voxels_per_side, TsdfVoxel* voxels,
+                                 uint8_t* updated) {
+  if (num_blocks == 0u) {
+    return true;
+  }
+  Buffers& b = *buffers_;
+  const size_t num_voxels =
+      num_blocks * voxels_per_side * voxels_per_side * voxels_per_side;
+  cudaError_t error = reserve(&b.blocks, &b.blocks_capacity,
+                              num_blocks * sizeof(BlockParams));
+  if (error == cudaSuccess) {
+    error = reserve(&b.voxels, &b.voxels_capacity,
+                    num_voxels * sizeof(TsdfVoxel));
+  }
+  if (error == cudaSuccess) {
+    error = reserve(&b.updated, &b.updated_capacity, num_voxels);
+  }
+  if (error == cudaSuccess) {
+    error = cudaMemcpy(b.blocks, blocks, num_blocks * sizeof(BlockParams),
+                       cudaMemcpyHostToDevice);
+  }
+  if (error == cudaSuccess) {
+    error = cudaMemcpy(b.voxels, voxels, num_voxels * sizeof(TsdfVoxel),
+                       cudaMemcpyHostToDevice);
+  }
+  if (error == cudaSuccess) {
+    const DeviceImages images{
+        static_cast<const float*>(b.range), static_cast<const int32_t*>(b.ids),
+        b.has_color ? static_cast<const uint8_t*>(b.color) : nullptr, b.width,
+        b.height};
+    integrateBlocksKernel<<<num_blocks, kThreadsPerBlock>>>(
+        params, static_cast<const BlockParams*>(b.blocks), voxels_per_side,
+        images, static_cast<TsdfVoxel*>(b.voxels),
+        static_cast<uint8_t*>(b.updated));
+    error = cudaGetLastError();
+  }
+  if (error == cudaSuccess) {
+    error = cudaMemcpy(voxels, b.voxels, num_voxels * sizeof(TsdfVoxel),
+                       cudaMemcpyDeviceToHost);
+  }
+  if (error == cudaSuccess) {
+    error = cudaMemcpy(updated, b.updated, num_voxels, cudaMemcpyDeviceToHost);
+  }
+  if (error != cudaSuccess) {
+    last_error_ = std::string("Could not integrate the blocks: ") +
+                  cudaGetErrorString(error);
+    return false;
+  }
+  return true;
+}
+
+bool isDeviceAvailable() {
+  int num_devices = 0;
+  return cudaGetDeviceCount(&num_devices) == cudaSuccess && num_devices > 0;
+}
+
+}  // namespace cuda
+}  // namespace panoptic_mapping
@@ -0,0 +1,109 @@
+#include "panoptic_mapping/integration/iso_surface_extractor.h"
+
+#include <vector>
+
+#include <voxblox/utils/meshing_utils.h>
+
+namespace panoptic_mapping {
+
+void IsoSurfaceExtractor::Config::checkParams() const {
+  checkParamGT(min_weight, 0.f, "min_weight");
+}
+
+void IsoSurfaceExtractor::Config::setupParamsAndPrinting() {
+  setupParam("extract_from_tsdf", &extract_from_tsdf);
+  setupParam("min_weight", &min_weight);
+}
+
+IsoSurfaceExtractor::IsoSurfaceExtractor(const Config& config)
+    : config_(config.checkValid()) {}
+
+void IsoSurfaceExtractor::extractBlock(
+    const TsdfLayer& tsdf_layer, const ClassLayer* class_layer,
+    const BlockIndex& block_index, std::vector<IsoSurfacePoint>* points) const {
+  CHECK_NOTNULL(points);
+  TsdfBlock::ConstPtr block = tsdf_layer.getBlockPtrByIndex(block_index);
+  if (!block) {
+    return;
+  }
+  ClassBlock::ConstPtr class_block;
+  if (class_layer) {
+    // Missing class blocks are unobserved, i.e. all voxels belong.
+    class_block = class_layer->getBlockConstPtrByIndex(block_index);
+  }
+
+  // Neighboring blocks in positive direction.
+  TsdfBlock::ConstPtr neighbors[3];
+  ClassBlock::ConstPtr class_neighbors[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    const BlockIndex neighbor_index = block_index + BlockIndex::Unit(axis);
+    neighbors[axis] = tsdf_layer.getBlockPtrByIndex(neighbor_index);
+    if (class_layer) {
+      class_neighbors[axis] =
+          class_layer->getBlockConstPtrByIndex(neighbor_index);
+    }
+  }
+
+  const voxblox::IndexElement vps = block->voxels_per_side();
+  const FloatingPoint voxel_size = block->voxel_size();
+  VoxelIndex index;
+  for (index.z() = 0; index.z() < vps; ++index.z()) {
+    for (index.y() = 0; index.y() < vps; ++index.y()) {
+      for (index.x() = 0; index.x() < vps; ++index.x()) {
+        const TsdfVoxel& voxel = block->getVoxelByVoxelIndex(index);
+        FloatingPoint sdf;
+        if (!voxblox::utils::getSdfIfValid(voxel, config_.min_weight, &sdf)) {
+          continue;
+        }
+        if (class_block &&
+            !class_block->getVoxelByVoxelIndex(index).belongsToSubmap()) {
+          continue;
+        }
+        const Point position = block->computeCoordinatesFromVoxelIndex(index);
+
+        for (int axis = 0; axis < 3; ++axis) {
+          // Look up the neighbor voxel.
+          VoxelIndex neighbor_index = index;
+          neighbor_index(axis)++;
+          const TsdfVoxel* neighbor = nullptr;
+          bool neighbor_belongs = true;
+          if (neighbor_index(axis) < vps) {
+            neighbor = &block->getVoxelByVoxelIndex(neighbor_index);
+            if (class_block) {
+              neighbor_belongs =
+                  class_block->getVoxelByVoxelIndex(neighbor_index)
+                      .belongsToSubmap();
+            }
+          } else if (neighbors[axis]) {
+            neighbor_index(axis) = 0;
+            neighbor = &neighbors[axis]->getVoxelByVoxelIndex(neighbor_index);
+            if (class_neighbors[axis]) {
+              neighbor_belongs = class_neighbors[axis]
+                                     ->getVoxelByVoxelIndex(neighbor_index)
+                                     .belongsToSubmap();
+            }
+          }
+          FloatingPoint neighbor_sdf;
+          if (!neighbor || !neighbor_belongs ||
+              !voxblox::utils::getSdfIfValid(*neighbor, config_.min_weight,
+                                             &neighbor_sdf)) {
+            continue;
+          }
+
+          // Interpolate the zero crossing.
+          if ((sdf < 0.f) == (neighbor_sdf < 0.f)) {
+            continue;
+          }
+          const FloatingPoint t = sdf / (sdf - neighbor_sdf);
+          Point point = position;
+          point(axis) += t * voxel_size;
+          points->emplace_back(point,
+                               voxel.weight + t * (neighbor->weight -
+                                                   voxel.weight));
+        }
+      }
+    }
+  }
+}
+
+}  // namespace panoptic_mapping
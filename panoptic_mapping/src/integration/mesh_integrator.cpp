@@ -1,5 +1,6 @@
 #include "panoptic_mapping/integration/mesh_integrator.h"
 
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <list>
@@ -11,7 +12,10 @@
 #include <voxblox/mesh/marching_cubes.h>
 #include <voxblox/utils/meshing_utils.h>
 
+#include "panoptic_mapping/common/block_layout.h"
 #include "panoptic_mapping/common/index_getter.h"
+#include "panoptic_mapping/common/morton_order.h"
+#include "panoptic_mapping/common/thread_pool.h"
 
 namespace panoptic_mapping {
 
@@ -27,6 +31,8 @@ void MeshIntegrator::Config::setupParamsAndPrinting() {
   setupParam("min_weight", &min_weight);
   setupParam("required_belonging_corners", &required_belonging_corners);
   setupParam("clear_foreign_voxels", &clear_foreign_voxels);
+  setupParam("use_batched_meshing", &use_batched_meshing);
+  setupParam("use_flat_block_map", &use_flat_block_map);
   setupParam("integrator_threads", &integrator_threads);
 }
 
@@ -34,11 +40,13 @@ MeshIntegrator::MeshIntegrator(const MeshIntegrator::Config& config,
                                std::shared_ptr<TsdfLayer> tsdf_layer,
                                std::shared_ptr<MeshLayer> mesh_layer,
                                std::shared_ptr<ClassLayer> class_layer,
-                               float truncation_distance)
+                               float truncation_distance,
+                               ThreadPool* thread_pool)
     : config_(config.checkValid()),
       tsdf_layer_(std::move(tsdf_layer)),
       mesh_layer_(std::move(mesh_layer)),
       class_layer_(std::move(class_layer)),
+      thread_pool_(CHECK_NOTNULL(thread_pool)),
       truncation_distance_(truncation_distance) {
   // Check input is valid (class layer can be null).
   if (!tsdf_layer_) {
@@ -75,6 +83,29 @@ MeshIntegrator::MeshIntegrator(const MeshIntegrator::Config& config,
 void MeshIntegrator::generateMesh(bool only_mesh_updated_blocks,
                                   bool clear_updated_flag,
                                   bool use_class_data) {
+  const voxblox::BlockIndexList tsdf_blocks =
+      prepareMeshGeneration(only_mesh_updated_blocks, use_class_data);
+
+  std::unique_ptr<voxblox::ThreadSafeIndex> index_getter(
+      new voxblox::MixedThreadSafeIndex(tsdf_blocks.size()));
+  if (config_.use_flat_block_map && !tsdf_blocks.empty()) {
+    flat_blocks_ = std::make_unique<FlatBlockMap<TsdfVoxel>>(*tsdf_layer_);
+  }
+
+  std::vector<std::future<void>> integration_threads;
+  for (size_t i = 0; i < config_.integrator_threads; ++i) {
+    integration_threads.emplace_back(thread_pool_->submit(
+        [this, &tsdf_blocks, clear_updated_flag, &index_getter]() {
+          generateMeshBlocksFunction(tsdf_blocks, clear_updated_flag,
+                                     index_getter.get());
+        }));
+  }
+  thread_pool_->waitAll(&integration_threads);
+  flat_blocks_.reset();
+}
+
+voxblox::BlockIndexList MeshIntegrator::prepareMeshGeneration(
+    bool only_mesh_updated_blocks, bool use_class_data) {
   use_class_layer_ = use_class_data;
   if (!class_layer_ && use_class_layer_) {
     use_class_layer_ = false;
@@ -87,25 +118,57 @@ void MeshIntegrator::generateMesh(bool only_mesh_updated_blocks,
   } else {
     tsdf_layer_->getAllAllocatedBlocks(&tsdf_blocks);
   }
+  // Mesh neighboring blocks consecutively, which share their border voxels.
+  sortMortonOrder(&tsdf_blocks);
+  allocateMeshes(tsdf_blocks);
+  return tsdf_blocks;
+}
 
-  // Allocate all the mesh memory.
-  for (const voxblox::BlockIndex& block_index : tsdf_blocks) {
-    mesh_layer_->allocateMeshPtrByIndex(block_index);
+voxblox::BlockIndexList MeshIntegrator::prepareMeshGeneration(
+    const voxblox::BlockIndexList& block_indices, bool use_class_data) {
+  use_class_layer_ = use_class_data;
+  if (!class_layer_ && use_class_layer_) {
+    use_class_layer_ = false;
+    LOG(WARNING) << "Tried to use un-initialized class layer, will be ignored.";
   }
+  voxblox::BlockIndexList tsdf_blocks;
+  for (const BlockIndex& block_index : block_indices) {
+    TsdfBlock::ConstPtr block = tsdf_layer_->getBlockPtrByIndex(block_index);
+    if (block && block->updated().test(voxblox::Update::Status::kMesh)) {
+      tsdf_blocks.emplace_back(block_index);
+    }
+  }
+  allocateMeshes(tsdf_blocks);
+  return tsdf_blocks;
+}
 
-  std::unique_ptr<voxblox::ThreadSafeIndex> index_getter(
-      new voxblox::MixedThreadSafeIndex(tsdf_blocks.size()));
+void MeshIntegrator::allocateMeshes(
+    const voxblox::BlockIndexList& block_indices) {
+  static std::atomic<uint64_t> next_generation(1);
+  const uint64_t generation = next_generation++;
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    mesh_layer_->allocateMeshPtrByIndex(block_index);
+    mesh_generations_[block_index] = generation;
+  }
+}
 
-  std::list<std::thread> integration_threads;
-  for (size_t i = 0; i < config_.integrator_threads; ++i) {
-    integration_threads.emplace_back(
-        &MeshIntegrator::generateMeshBlocksFunction, this, tsdf_blocks,
-        clear_updated_flag, index_getter.get());
+bool MeshIntegrator::generateMeshBlock(const BlockIndex& block_index,
+                                       bool clear_updated_flag) {
+  const bool success = updateMeshForBlock(block_index);
+  if (clear_updated_flag && success) {
+    tsdf_layer_->getBlockPtrByIndex(block_index)
+        ->setUpdated(voxblox::Update::Status::kMesh, false);
   }
+  return success;
+}
 
-  for (std::thread& thread : integration_threads) {
-    thread.join();
+uint64_t MeshIntegrator::getMeshGeneration(
+    const BlockIndex& block_index) const {
+  auto it = mesh_generations_.find(block_index);
+  if (it == mesh_generations_.end()) {
+    return 0u;
   }
+  return it->second;
 }
 
 void MeshIntegrator::generateMeshBlocksFunction(
@@ -115,12 +178,7 @@ void MeshIntegrator::generateMeshBlocksFunction(
 
   size_t list_idx;
   while (index_getter->getNextIndex(&list_idx)) {
-    const voxblox::BlockIndex& block_idx = tsdf_blocks[list_idx];
-    const bool success = updateMeshForBlock(block_idx);
-    if (clear_updated_flag && success) {
-      tsdf_layer_->getBlockPtrByIndex(block_idx)->setUpdated(
-          voxblox::Update::Status::kMesh, false);
-    }
+    generateMeshBlock(tsdf_blocks[list_idx], clear_updated_flag);
   }
 }
 
@@ -130,22 +188,19 @@ bool MeshIntegrator::updateMeshForBlock(
   mesh->clear();
   // This block should already exist, otherwise it makes no sense to update
   // the mesh for it. ;)
-  if (!tsdf_layer_->hasBlock(block_index)) {
+  const TsdfBlock* tsdf_block_ptr = getTsdfBlockPtr(block_index);
+  if (!tsdf_block_ptr) {
     LOG(WARNING) << "Trying to mesh a non-existent TSDF block at index: "
                  << block_index.transpose() << ", skipping block.";
     return false;
   }
-  const TsdfBlock& tsdf_block = tsdf_layer_->getBlockByIndex(block_index);
+  const TsdfBlock& tsdf_block = *tsdf_block_ptr;
   // The class is accessed by pointer since it's just a nullptr if the class
-  // info is not used.
+  // info is not used. Missing class blocks are unobserved, i.e. all voxels
+  // belong to the submap.
   ClassBlock::ConstPtr class_block;
   if (use_class_layer_) {
     class_block = class_layer_->getBlockConstPtrByIndex(block_index);
-    if (!class_block) {
-      LOG(WARNING) << "Trying to mesh a non-existent class block at index: "
-                   << block_index.transpose() << ", skipping block.";
-      return false;
-    }
   }
 
   extractBlockMesh(tsdf_block, class_block, mesh.get());
@@ -168,12 +223,19 @@ void MeshIntegrator::extractBlockMesh(const TsdfBlock& tsdf_block,
   voxblox::VertexIndex next_mesh_index = 0;
 
   voxblox::VoxelIndex voxel_index;
-  for (voxel_index.x() = 0; voxel_index.x() < vps - 1; ++voxel_index.x()) {
-    for (voxel_index.y() = 0; voxel_index.y() < vps - 1; ++voxel_index.y()) {
-      for (voxel_index.z() = 0; voxel_index.z() < vps - 1; ++voxel_index.z()) {
-        Point coords = tsdf_block.computeCoordinatesFromVoxelIndex(voxel_index);
-        extractMeshInsideBlock(tsdf_block, class_block, voxel_index, coords,
-                               &next_mesh_index, mesh);
+  if (config_.use_batched_meshing) {
+    extractMeshInsideBlockBatched(tsdf_block, class_block, &next_mesh_index,
+                                  mesh);
+  } else {
+    for (voxel_index.x() = 0; voxel_index.x() < vps - 1; ++voxel_index.x()) {
+      for (voxel_index.y() = 0; voxel_index.y() < vps - 1; ++voxel_index.y()) {
+        for (voxel_index.z() = 0; voxel_index.z() < vps - 1;
+             ++voxel_index.z()) {
+          Point coords =
+              tsdf_block.computeCoordinatesFromVoxelIndex(voxel_index);
+          extractMeshInsideBlock(tsdf_block, class_block, voxel_index, coords,
+                                 &next_mesh_index, mesh);
+        }
       }
     }
   }
@@ -213,6 +275,105 @@ void MeshIntegrator::extractBlockMesh(const TsdfBlock& tsdf_block,
   }
 }
 
+void MeshIntegrator::extractMeshInsideBlockBatched(
+    const TsdfBlock& tsdf_block, const ClassBlock::ConstPtr& class_block,
+    voxblox::VertexIndex* next_mesh_index, voxblox::Mesh* mesh) {
+  dispatchBlockLayout(voxels_per_side_, [&](const auto& layout) {
+    extractMeshInsideBlockBatchedImpl(layout, tsdf_block, class_block,
+                                      next_mesh_index, mesh);
+  });
+}
+
+template <typename LayoutT>
+void MeshIntegrator::extractMeshInsideBlockBatchedImpl(
+    const LayoutT& layout, const TsdfBlock& tsdf_block,
+    const ClassBlock::ConstPtr& class_block,
+    voxblox::VertexIndex* next_mesh_index, voxblox::Mesh* mesh) {
+  // Per voxel flags.
+  constexpr uint8_t kValid = 1u;
+  constexpr uint8_t kBelongs = 2u;
+  constexpr uint8_t kNegative = 4u;  // Sign as used for the cube index.
+  const size_t vps = layout.voxelsPerSide();
+  const size_t num_voxels = layout.numVoxels();
+  const bool use_class = class_block;
+  const bool clear_foreign = use_class && config_.clear_foreign_voxels;
+
+  // Gather the sdf values and flags of all voxels once, such that every voxel
+  // is looked up and classified once instead of once per adjacent cube.
+  thread_local std::vector<FloatingPoint> sdf;
+  thread_local std::vector<uint8_t> flags;
+  sdf.resize(num_voxels);
+  flags.assign(num_voxels, 0u);
+  for (size_t i = 0; i < num_voxels; ++i) {
+    if (!voxblox::utils::getSdfIfValid(tsdf_block.getVoxelByLinearIndex(i),
+                                       config_.min_weight, &sdf[i])) {
+      continue;
+    }
+    uint8_t flag = kValid;
+    if (use_class &&
+        class_block->getVoxelByLinearIndex(i).belongsToSubmap()) {
+      flag |= kBelongs;
+    }
+    if (clear_foreign && !(flag & kBelongs)) {
+      // Foreign voxels are set to truncation distance to close the mesh.
+      sdf[i] = truncation_distance_;
+    }
+    if (sdf[i] < 0.f) {
+      flag |= kNegative;
+    }
+    flags[i] = flag;
+  }
+
+  // Linear offsets of the cube corners, same order as 'cube_index_offsets_'.
+  size_t corner_offsets[8];
+  for (int i = 0; i < 8; ++i) {
+    corner_offsets[i] =
+        layout.linearIndex(cube_index_offsets_(0, i), cube_index_offsets_(1, i),
+                           cube_index_offsets_(2, i));
+  }
+  const Eigen::Matrix<FloatingPoint, 3, 8> cube_coord_offsets =
+      cube_index_offsets_.cast<FloatingPoint>() * voxel_size_;
+  Eigen::Matrix<FloatingPoint, 3, 8> corner_coords;
+  Eigen::Matrix<FloatingPoint, 8, 1> corner_sdf;
+
+  // Only cubes that are fully observed, belong to the submap and cross the
+  // surface are meshed. Iterate in the same order as the per cube path.
+  const voxblox::IndexElement max_index = vps - 1;
+  voxblox::VoxelIndex index;
+  for (index.x() = 0; index.x() < max_index; ++index.x()) {
+    for (index.y() = 0; index.y() < max_index; ++index.y()) {
+      for (index.z() = 0; index.z() < max_index; ++index.z()) {
+        const size_t linear_index =
+            layout.linearIndex(index.x(), index.y(), index.z());
+        uint8_t all_flags = kValid | kNegative;
+        uint8_t any_negative = 0u;
+        int belonging_corners = 0;
+        for (int i = 0; i < 8; ++i) {
+          const uint8_t flag = flags[linear_index + corner_offsets[i]];
+          all_flags &= flag;
+          any_negative |= flag & kNegative;
+          belonging_corners += (flag & kBelongs) ? 1 : 0;
+        }
+        if (!(all_flags & kValid) || !any_negative ||
+            (all_flags & kNegative)) {
+          continue;
+        }
+        if (use_class &&
+            belonging_corners <= config_.required_belonging_corners) {
+          continue;
+        }
+        const Point coords = tsdf_block.computeCoordinatesFromVoxelIndex(index);
+        for (int i = 0; i < 8; ++i) {
+          corner_sdf(i) = sdf[linear_index + corner_offsets[i]];
+          corner_coords.col(i) = coords + cube_coord_offsets.col(i);
+        }
+        voxblox::MarchingCubes::meshCube(corner_coords, corner_sdf,
+                                         next_mesh_index, mesh);
+      }
+    }
+  }
+}
+
 void MeshIntegrator::extractMeshInsideBlock(
     const TsdfBlock& tsdf_block, const ClassBlock::ConstPtr& class_block,
     const voxblox::VoxelIndex& index, const Point& coords,
@@ -318,13 +479,11 @@ void MeshIntegrator::extractMeshOnBorder(
       voxblox::BlockIndex neighbor_index =
           tsdf_block.block_index() + block_offset;
 
-      if (tsdf_layer_->hasBlock(neighbor_index)) {
-        const TsdfBlock& neighbor_block =
-            tsdf_layer_->getBlockByIndex(neighbor_index);
-
-        CHECK(neighbor_block.isValidVoxelIndex(corner_index));
+      const TsdfBlock* neighbor_block = getTsdfBlockPtr(neighbor_index);
+      if (neighbor_block) {
+        CHECK(neighbor_block->isValidVoxelIndex(corner_index));
         const TsdfVoxel& voxel =
-            neighbor_block.getVoxelByVoxelIndex(corner_index);
+            neighbor_block->getVoxelByVoxelIndex(corner_index);
 
         if (!voxblox::utils::getSdfIfValid(voxel, config_.min_weight,
                                            &(corner_sdf(i)))) {
@@ -389,18 +548,26 @@ void MeshIntegrator::updateMeshColor(const TsdfBlock& tsdf_block,
     } else {
       const voxblox::BlockIndex index =
           tsdf_layer_->computeBlockIndexFromCoordinates(vertex);
-      if (!tsdf_layer_->hasBlock(index)) {
+      const TsdfBlock* neighbor_block = getTsdfBlockPtr(index);
+      if (!neighbor_block) {
         // The vertices should never lie outside allocated blocks.
         LOG(WARNING)
             << "Tried to color a mesh vertex outside allocated blocks.";
         return;
       }
-      const TsdfBlock& neighbor_block = tsdf_layer_->getBlockByIndex(index);
-      const TsdfVoxel& voxel = neighbor_block.getVoxelByCoordinates(vertex);
+      const TsdfVoxel& voxel = neighbor_block->getVoxelByCoordinates(vertex);
       voxblox::utils::getColorIfValid(voxel, config_.min_weight,
                                       &(mesh->colors[i]));
     }
   }
 }
 
+const TsdfBlock* MeshIntegrator::getTsdfBlockPtr(
+    const BlockIndex& block_index) const {
+  if (flat_blocks_) {
+    return flat_blocks_->find(block_index);
+  }
+  return tsdf_layer_->getBlockPtrByIndex(block_index).get();
+}
+
 }  // namespace panoptic_mapping
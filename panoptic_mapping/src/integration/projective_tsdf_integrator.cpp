@@ -2,8 +2,11 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <future>
 #include <memory>
+#include <numeric>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -11,7 +14,10 @@
 
 #include <voxblox/integrator/merge_integration.h>
 
+#include "panoptic_mapping/common/block_layout.h"
 #include "panoptic_mapping/common/index_getter.h"
+#include "panoptic_mapping/common/morton_order.h"
+#include "panoptic_mapping/map/block_pool.h"
 
 namespace panoptic_mapping {
 
@@ -21,10 +27,24 @@ config_utilities::Factory::RegistrationRos<
 
 void ProjectiveIntegrator::Config::checkParams() const {
   checkParamGT(integration_threads, 0, "integration_threads");
+  checkParamGT(integration_chunk_size, 0, "integration_chunk_size");
+  checkParamGT(instance_integration_period, 0, "instance_integration_period");
+  checkParamGT(background_integration_period, 0,
+               "background_integration_period");
+  checkParamGT(unknown_integration_period, 0, "unknown_integration_period");
+  checkParamGT(free_space_integration_period, 0,
+               "free_space_integration_period");
+  checkParamGT(num_buffered_frames, 0, "num_buffered_frames");
+  checkParamLE(num_buffered_frames, static_cast<int>(kMaxViews),
+               "num_buffered_frames");
   checkParamGT(max_weight, 0.f, "max_weight");
+  checkParamGE(interpolation_max_depth_difference, 0.f,
+               "interpolation_max_depth_difference");
   if (use_weight_dropoff) {
     checkParamNE(weight_dropoff_epsilon, 0.f, "weight_dropoff_epsilon");
   }
+  checkParamConfig(visible_block_tracker);
+  checkParamConfig(converged_block_tracker);
 }
 
 void ProjectiveIntegrator::Config::setupParamsAndPrinting() {
@@ -35,9 +55,24 @@ void ProjectiveIntegrator::Config::setupParamsAndPrinting() {
   setupParam("foreign_rays_clear", &foreign_rays_clear);
   setupParam("max_weight", &max_weight);
   setupParam("interpolation_method", &interpolation_method);
+  setupParam("interpolation_max_depth_difference",
+             &interpolation_max_depth_difference, "m");
   setupParam("allocate_neighboring_blocks", &allocate_neighboring_blocks);
+  setupParam("use_depth_bounded_freespace_allocation",
+             &use_depth_bounded_freespace_allocation);
+  setupParam("use_depth_culling", &use_depth_culling);
   setupParam("use_longterm_fusion", &use_longterm_fusion);
   setupParam("integration_threads", &integration_threads);
+  setupParam("integration_chunk_size", &integration_chunk_size);
+  setupParam("instance_integration_period", &instance_integration_period);
+  setupParam("background_integration_period", &background_integration_period);
+  setupParam("unknown_integration_period", &unknown_integration_period);
+  setupParam("free_space_integration_period", &free_space_integration_period);
+  setupParam("num_buffered_frames", &num_buffered_frames);
+  setupParam("use_planar_images", &use_planar_images);
+  setupParam("use_segment_culling", &use_segment_culling);
+  setupParam("visible_block_tracker", &visible_block_tracker);
+  setupParam("converged_block_tracker", &converged_block_tracker);
 }
 
 ProjectiveIntegrator::ProjectiveIntegrator(const Config& config,
@@ -50,18 +85,44 @@ ProjectiveIntegrator::ProjectiveIntegrator(const Config& config,
   addRequiredInputs(
       {InputData::InputType::kColorImage, InputData::InputType::kDepthImage,
        InputData::InputType::kSegmentationImage,
-       InputData::InputType::kVertexMap, InputData::InputType::kValidityImage});
+       InputData::InputType::kVertexMap, InputData::InputType::kValidityImage,
+       InputData::InputType::kRangeImage});
 
   // Setup the interpolators (one for each thread).
+  if (config_.interpolation_method == "nearest") {
+    interpolator_type_ = InterpolatorType::kNearest;
+  } else if (config_.interpolation_method == "bilinear") {
+    interpolator_type_ = InterpolatorType::kBilinear;
+  } else if (config_.interpolation_method == "adaptive") {
+    interpolator_type_ = InterpolatorType::kAdaptive;
+  } else {
+    interpolator_type_ = InterpolatorType::kOther;
+  }
   for (int i = 0; i < config_.integration_threads; ++i) {
     interpolators_.emplace_back(
         config_utilities::Factory::create<InterpolatorBase>(
             config_.interpolation_method));
+    if (interpolator_type_ == InterpolatorType::kAdaptive) {
+      static_cast<InterpolatorAdaptive*>(interpolators_.back().get())
+          ->setMaxDepthDifference(config_.interpolation_max_depth_difference);
+    }
   }
 
   // Allocate range image.
   range_image_ = Eigen::MatrixXf(globals_->camera()->getConfig().height,
                                  globals_->camera()->getConfig().width);
+  if (interpolator_type_ == InterpolatorType::kAdaptive) {
+    interpolation_mask_.resize(range_image_.rows(), range_image_.cols());
+  }
+
+  if (config_.visible_block_tracker.max_displacement > 0.f) {
+    visible_block_tracker_ =
+        std::make_unique<VisibleBlockTracker>(config_.visible_block_tracker);
+  }
+  if (config_.converged_block_tracker.min_converged_updates > 0) {
+    converged_block_tracker_ = std::make_unique<ConvergedBlockTracker>(
+        config_.converged_block_tracker);
+  }
 }
 
 void ProjectiveIntegrator::processInput(SubmapCollection* submaps,
@@ -70,59 +131,361 @@ void ProjectiveIntegrator::processInput(SubmapCollection* submaps,
   CHECK_NOTNULL(input);
   CHECK_NOTNULL(globals_->camera().get());
   CHECK(inputIsValid(*input));
+  camera_ = globals_->camera().get();
+  cam_config_ = &(camera_->getConfig());
+  if (config_.num_buffered_frames > 1) {
+    frame_buffer_.emplace_back(std::make_shared<InputData>(*input));
+    if (frame_buffer_.size() >=
+        static_cast<size_t>(config_.num_buffered_frames)) {
+      integrateBufferedFrames(submaps);
+    }
+    return;
+  }
+  if (!input->additionalViews().empty()) {
+    views_.clear();
+    addViews(*input);
+    processViews(submaps);
+    return;
+  }
 
   // Allocate all blocks in corresponding submaps.
   Timer alloc_timer("tsdf_integration/allocate_blocks");
-  cam_config_ = &(globals_->camera()->getConfig());
   allocateNewBlocks(submaps, *input);
+  buildPlanarImages(*input);
+  buildIDMasks(*input);
   alloc_timer.Stop();
 
   // Find all active blocks that are in the field of view.
   // Note(schmluk): This could potentially also be included in the parallel part
   // but is already almost instantaneous.
   Timer find_timer("tsdf_integration/find_blocks");
-  std::unordered_map<int, voxblox::BlockIndexList> block_lists =
-      globals_->camera()->findVisibleBlocks(*submaps, input->T_M_C(),
-                                            max_range_in_image_, true);
-  std::vector<int> id_list;
-  id_list.reserve(block_lists.size());
-  for (const auto& id_blocklist_pair : block_lists) {
-    id_list.emplace_back(id_blocklist_pair.first);
+  if (config_.use_depth_culling) {
+    range_pyramid_.build(range_image_);
+  }
+  std::unordered_map<int, voxblox::BlockIndexList> block_lists;
+  if (visible_block_tracker_) {
+    block_lists = visible_block_tracker_->findVisibleBlocks(
+        *camera_, *submaps, input->T_M_C(), true,
+        config_.use_depth_culling ? &range_pyramid_ : nullptr,
+        &allocated_blocks_);
+  } else {
+    block_lists = camera_->findVisibleBlocks(
+        *submaps, input->T_M_C(), max_range_in_image_, true,
+        config_.use_depth_culling ? &range_pyramid_ : nullptr);
+  }
+
+  // Flatten the blocks of all submaps into individual work items so a single
+  // large submap can be spread over all threads. The blocks of each submap are
+  // in Morton order such that consecutive work items are close in space.
+  std::vector<SubmapBlockIndex> work_items;
+  std::unordered_map<int, Transformation> T_C_S;
+  for (auto& id_blocklist_pair : block_lists) {
+    const int submap_id = id_blocklist_pair.first;
+    if (!integratesSubmap(submaps->getSubmap(submap_id))) {
+      continue;
+    }
+    T_C_S[submap_id] = input->T_M_C().inverse() *
+                       submaps->getSubmapPtr(submap_id)->getT_M_S();
+    sortMortonOrder(&id_blocklist_pair.second);
+    for (const voxblox::BlockIndex& block_index : id_blocklist_pair.second) {
+      work_items.emplace_back(submap_id, block_index);
+    }
+  }
+  if (converged_block_tracker_) {
+    converged_block_tracker_->prepare(*submaps);
   }
   find_timer.Stop();
+  prepareSubmaps(submaps, block_lists);
 
   // Integrate in parallel.
   Timer int_timer("tsdf_integration/integration");
-  SubmapIndexGetter index_getter(id_list);
+  integrateBlocks(submaps, *input, std::move(work_items), T_C_S);
+  int_timer.Stop();
+  frame_index_++;
+}
+
+void ProjectiveIntegrator::finishIntegration(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  camera_ = globals_->camera().get();
+  cam_config_ = &(camera_->getConfig());
+  integrateBufferedFrames(submaps);
+}
+
+void ProjectiveIntegrator::integrateBufferedFrames(SubmapCollection* submaps) {
+  if (frame_buffer_.empty()) {
+    return;
+  }
+  views_.clear();
+  for (const std::shared_ptr<InputData>& frame : frame_buffer_) {
+    addViews(*frame);
+  }
+  processViews(submaps);
+  frame_buffer_.clear();
+}
+
+void ProjectiveIntegrator::addViews(const InputData& input) {
+  // The input itself is seen by the global camera.
+  ViewData& primary_view = views_.emplace_back();
+  primary_view.input = &input;
+  primary_view.camera = globals_->camera().get();
+  for (const InputData::AdditionalView& additional_view :
+       input.additionalViews()) {
+    CHECK_NOTNULL(additional_view.input.get());
+    CHECK_NOTNULL(additional_view.camera.get());
+    CHECK(inputIsValid(*additional_view.input));
+    ViewData& view = views_.emplace_back();
+    view.input = additional_view.input.get();
+    view.camera = additional_view.camera.get();
+  }
+}
+
+void ProjectiveIntegrator::processViews(SubmapCollection* submaps) {
+  CHECK(!views_.empty());
+  CHECK_LE(views_.size(), kMaxViews) << "Too many views to integrate at once.";
+
+  // Allocate the blocks of all views before finding the visible blocks, such
+  // that every view also updates the blocks allocated by the others.
+  Timer alloc_timer("tsdf_integration/allocate_blocks");
+  for (ViewData& view : views_) {
+    swapCurrentView(&view);
+    allocateNewBlocks(submaps, *view.input);
+    buildPlanarImages(*view.input);
+    buildIDMasks(*view.input);
+    swapCurrentView(&view);
+  }
+  alloc_timer.Stop();
+
+  // Find the visible blocks of all views. Each block is a single work item
+  // with a mask of the views that see it.
+  Timer find_timer("tsdf_integration/find_blocks");
+  std::unordered_map<int, voxblox::AnyIndexHashMapType<uint32_t>::type>
+      visible_blocks;
+  std::vector<std::unordered_map<int, Transformation>> T_C_S(views_.size());
+  for (size_t i = 0; i < views_.size(); ++i) {
+    ViewData& view = views_[i];
+    if (config_.use_depth_culling) {
+      view.range_pyramid.build(view.range_image);
+    }
+    const std::unordered_map<int, voxblox::BlockIndexList> block_lists =
+        view.camera->findVisibleBlocks(
+            *submaps, view.input->T_M_C(), view.max_range_in_image, true,
+            config_.use_depth_culling ? &view.range_pyramid : nullptr);
+    for (const auto& id_blocklist_pair : block_lists) {
+      const int submap_id = id_blocklist_pair.first;
+      if (!integratesSubmap(submaps->getSubmap(submap_id))) {
+        continue;
+      }
+      T_C_S[i][submap_id] = view.input->T_M_C().inverse() *
+                            submaps->getSubmapPtr(submap_id)->getT_M_S();
+      auto& view_masks = visible_blocks[submap_id];
+      for (const voxblox::BlockIndex& block_index : id_blocklist_pair.second) {
+        view_masks[block_index] |= 1u << i;
+      }
+    }
+  }
+  std::vector<SubmapBlockIndex> work_items;
+  std::vector<uint32_t> view_masks;
+  std::unordered_map<int, voxblox::BlockIndexList> block_lists;
+  std::vector<std::pair<BlockIndex, uint32_t>> submap_items;
+  for (const auto& id_blocks_pair : visible_blocks) {
+    submap_items.assign(id_blocks_pair.second.begin(),
+                        id_blocks_pair.second.end());
+    sortMortonOrder(
+        &submap_items,
+        [](const std::pair<BlockIndex, uint32_t>& item) { return item.first; });
+    voxblox::BlockIndexList& block_list = block_lists[id_blocks_pair.first];
+    for (const auto& index_mask_pair : submap_items) {
+      work_items.emplace_back(id_blocks_pair.first, index_mask_pair.first);
+      view_masks.push_back(index_mask_pair.second);
+      block_list.push_back(index_mask_pair.first);
+    }
+  }
+  if (converged_block_tracker_) {
+    converged_block_tracker_->prepare(*submaps);
+  }
+  find_timer.Stop();
+  prepareSubmaps(submaps, block_lists);
+
+  // Integrate in parallel.
+  Timer int_timer("tsdf_integration/integration");
+  if (fusesViewsPerBlock()) {
+    integrateViewBlocks(submaps, std::move(work_items), view_masks, T_C_S);
+  } else {
+    for (size_t i = 0; i < views_.size(); ++i) {
+      std::vector<SubmapBlockIndex> view_items;
+      for (size_t j = 0; j < work_items.size(); ++j) {
+        if (view_masks[j] & (1u << i)) {
+          view_items.push_back(work_items[j]);
+        }
+      }
+      swapCurrentView(&views_[i]);
+      integrateBlocks(submaps, *views_[i].input, std::move(view_items),
+                      T_C_S[i]);
+      swapCurrentView(&views_[i]);
+    }
+  }
+  int_timer.Stop();
+  frame_index_++;
+
+  // The first view remains the current one.
+  swapCurrentView(&views_[0]);
+}
+
+void ProjectiveIntegrator::swapCurrentView(ViewData* view) {
+  // Swapping the dynamic matrices only exchanges their buffers.
+  range_image_.swap(view->range_image);
+  interpolation_mask_.swap(view->interpolation_mask);
+  std::swap(planar_images_, view->planar_images);
+  std::swap(id_masks_, view->id_masks);
+  range_pyramid_.swap(view->range_pyramid);
+  std::swap(max_range_in_image_, view->max_range_in_image);
+  camera_ = view->camera;
+  cam_config_ = &(camera_->getConfig());
+  if (range_image_.rows() != cam_config_->height ||
+      range_image_.cols() != cam_config_->width) {
+    range_image_.resize(cam_config_->height, cam_config_->width);
+  }
+  if (interpolator_type_ == InterpolatorType::kAdaptive &&
+      (interpolation_mask_.rows() != cam_config_->height ||
+       interpolation_mask_.cols() != cam_config_->width)) {
+    interpolation_mask_.resize(cam_config_->height, cam_config_->width);
+  }
+}
+
+void ProjectiveIntegrator::prepareSubmaps(
+    SubmapCollection* submaps,
+    const std::unordered_map<int, voxblox::BlockIndexList>& block_lists) {
+  Timer timer("tsdf_integration/prepare_submaps");
+  ThreadPool* thread_pool = globals_->threadPool();
+  std::vector<std::future<void>> preparations;
+  for (const auto& id_blocklist_pair : block_lists) {
+    Submap* submap = submaps->getSubmapPtr(id_blocklist_pair.first);
+    if (!integratesSubmap(*submap)) {
+      continue;
+    }
+    const voxblox::BlockIndexList* block_indices = &id_blocklist_pair.second;
+    auto task = [this, submap, block_indices]() {
+      prepareSubmap(submap, *block_indices);
+    };
+    if (thread_pool->getNumNodes() > 1) {
+      preparations.emplace_back(
+          thread_pool->submitOnNode(submap->getHomeNode(), std::move(task)));
+    } else {
+      preparations.emplace_back(thread_pool->submit(std::move(task)));
+    }
+  }
+  thread_pool->waitAll(&preparations);
+}
+
+int ProjectiveIntegrator::numIntegrationThreads() const {
+  if (globals_->qualityController()) {
+    return globals_->qualityController()->getIntegrationThreads(
+        config_.integration_threads);
+  }
+  return config_.integration_threads;
+}
+
+void ProjectiveIntegrator::prepareSubmap(
+    Submap* submap, const voxblox::BlockIndexList& block_indices) const {
+  submap->prepareLayersForUpdate();
+}
+
+void ProjectiveIntegrator::integrateBlocks(
+    SubmapCollection* submaps, const InputData& input,
+    std::vector<SubmapBlockIndex> work_items,
+    const std::unordered_map<int, Transformation>& T_C_S) {
+  NodeLocalIndexGetter<size_t> index_getter =
+      groupByHomeNode(work_items, *submaps);
+  ThreadPool* thread_pool = globals_->threadPool();
   std::vector<std::future<void>> threads;
-  for (int i = 0; i < config_.integration_threads; ++i) {
-    threads.emplace_back(
-        std::async(std::launch::async,
-                   [this, &index_getter, &block_lists, submaps, input, i]() {
-                     int index;
-                     while (index_getter.getNextIndex(&index)) {
-                       this->updateSubmap(submaps->getSubmapPtr(index),
-                                          interpolators_[i].get(),
-                                          block_lists.at(index), *input);
-                     }
-                   }));
+  const int num_threads = numIntegrationThreads();
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submitOnNode(
+        i % thread_pool->getNumNodes(),
+        [this, &index_getter, &work_items, &T_C_S, &input, submaps,
+         thread_pool, i]() {
+          const int node = thread_pool->getCurrentNode();
+          const ChunkedIndexGetter<size_t>* getter;
+          size_t begin, end;
+          while (index_getter.getNextChunk(node, &getter, &begin, &end)) {
+            for (size_t j = begin; j < end; ++j) {
+              const SubmapBlockIndex& item = work_items[(*getter)[j]];
+              this->updateBlock(submaps->getSubmapPtr(item.first),
+                                interpolators_[i].get(), item.second,
+                                T_C_S.at(item.first), input);
+            }
+          }
+        }));
   }
 
   // Join all threads.
-  for (auto& thread : threads) {
-    thread.get();
+  globals_->threadPool()->waitAll(&threads);
+}
+
+void ProjectiveIntegrator::integrateViewBlocks(
+    SubmapCollection* submaps, std::vector<SubmapBlockIndex> work_items,
+    const std::vector<uint32_t>& view_masks,
+    const std::vector<std::unordered_map<int, Transformation>>& T_C_S) {
+  NodeLocalIndexGetter<size_t> index_getter =
+      groupByHomeNode(work_items, *submaps);
+  ThreadPool* thread_pool = globals_->threadPool();
+  std::vector<std::future<void>> threads;
+  const int num_threads = numIntegrationThreads();
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submitOnNode(
+        i % thread_pool->getNumNodes(),
+        [this, &index_getter, &work_items, &view_masks, &T_C_S, submaps,
+         thread_pool, i]() {
+          const int node = thread_pool->getCurrentNode();
+          const ChunkedIndexGetter<size_t>* getter;
+          std::vector<ViewUpdate> views;
+          views.reserve(views_.size());
+          size_t begin, end;
+          while (index_getter.getNextChunk(node, &getter, &begin, &end)) {
+            for (size_t j = begin; j < end; ++j) {
+              const size_t position = (*getter)[j];
+              const SubmapBlockIndex& item = work_items[position];
+              views.clear();
+              for (size_t k = 0; k < views_.size(); ++k) {
+                if (view_masks[position] & (1u << k)) {
+                  views.push_back(
+                      {views_[k].input, views_[k].camera,
+                       &views_[k].range_image,
+                       getInterpolationMask(views_[k].interpolation_mask),
+                       T_C_S[k].at(item.first),
+                       getPlanarImages(views_[k].planar_images),
+                       getIDMasks(views_[k].id_masks),
+                       getRangePyramid(views_[k].range_pyramid)});
+                }
+              }
+              this->updateBlockFromViews(submaps->getSubmapPtr(item.first),
+                                         interpolators_[i].get(), item.second,
+                                         views.data(), views.size());
+            }
+          }
+        }));
   }
-  int_timer.Stop();
+
+  // Join all threads.
+  globals_->threadPool()->waitAll(&threads);
 }
 
-void ProjectiveIntegrator::updateSubmap(
-    Submap* submap, InterpolatorBase* interpolator,
-    const voxblox::BlockIndexList& block_indices,
-    const InputData& input) const {
-  Transformation T_C_S = input.T_M_C().inverse() * submap->getT_M_S();
-  for (const auto& block_index : block_indices) {
-    updateBlock(submap, interpolator, block_index, T_C_S, input);
+NodeLocalIndexGetter<size_t> ProjectiveIntegrator::groupByHomeNode(
+    const std::vector<SubmapBlockIndex>& work_items,
+    const SubmapCollection& submaps) const {
+  const int num_nodes = globals_->threadPool()->getNumNodes();
+  std::vector<std::vector<size_t>> node_positions(num_nodes);
+  if (num_nodes == 1) {
+    node_positions[0].resize(work_items.size());
+    std::iota(node_positions[0].begin(), node_positions[0].end(), 0);
+  } else {
+    for (size_t i = 0; i < work_items.size(); ++i) {
+      const int node = submaps.getSubmap(work_items[i].first).getHomeNode();
+      node_positions[std::clamp(node, 0, num_nodes - 1)].push_back(i);
+    }
   }
+  return NodeLocalIndexGetter<size_t>(std::move(node_positions),
+                                      config_.integration_chunk_size);
 }
 
 void ProjectiveIntegrator::updateBlock(Submap* submap,
@@ -130,45 +493,532 @@ void ProjectiveIntegrator::updateBlock(Submap* submap,
                                        const voxblox::BlockIndex& block_index,
                                        const Transformation& T_C_S,
                                        const InputData& input) const {
+  const ViewUpdate view{&input,
+                        camera_,
+                        &range_image_,
+                        getInterpolationMask(interpolation_mask_),
+                        T_C_S,
+                        getPlanarImages(planar_images_),
+                        getIDMasks(id_masks_),
+                        getRangePyramid(range_pyramid_)};
+  updateBlockFromViews(submap, interpolator, block_index, &view, 1);
+}
+
+void ProjectiveIntegrator::updateBlockFromViews(
+    Submap* submap, InterpolatorBase* interpolator,
+    const voxblox::BlockIndex& block_index, const ViewUpdate* views,
+    size_t num_views) const {
+  // The interpolators are created by the factory based on the config, so the
+  // dynamic type is guaranteed to match.
+  switch (interpolator_type_) {
+    case InterpolatorType::kNearest:
+      updateBlockImpl(submap, static_cast<InterpolatorNearest*>(interpolator),
+                      block_index, views, num_views);
+      break;
+    case InterpolatorType::kBilinear:
+      updateBlockImpl(submap, static_cast<InterpolatorBilinear*>(interpolator),
+                      block_index, views, num_views);
+      break;
+    case InterpolatorType::kAdaptive:
+      updateBlockImpl(submap, static_cast<InterpolatorAdaptive*>(interpolator),
+                      block_index, views, num_views);
+      break;
+    default:
+      updateBlockImpl(submap, interpolator, block_index, views, num_views);
+  }
+}
+
+template <typename InterpolatorT>
+void ProjectiveIntegrator::updateBlockImpl(
+    Submap* submap, InterpolatorT* interpolator,
+    const voxblox::BlockIndex& block_index, const ViewUpdate* views,
+    size_t num_views) const {
   CHECK_NOTNULL(submap);
   // Set up preliminaries.
-  if (!submap->getTsdfLayer().hasBlock(block_index)) {
+  const SubmapBlocks blocks = submap->getBlocks(block_index);
+  if (!blocks) {
     LOG_IF(WARNING, config_.verbosity >= 1)
         << "Tried to access inexistent block '" << block_index.transpose()
         << "' in submap " << submap->getID() << ".";
     return;
   }
-  TsdfBlock& block = submap->getTsdfLayerPtr()->getBlockByIndex(block_index);
+  TsdfBlock& block = *blocks.tsdf;
   const float voxel_size = block.voxel_size();
   const float truncation_distance = submap->getConfig().truncation_distance;
   const int submap_id = submap->getID();
   const bool is_free_space_submap =
       submap->getLabel() == PanopticLabel::kFreeSpace;
+  const bool store_color =
+      voxel_update_rules_.update_color && submap->getConfig().store_color;
   bool was_updated = false;
 
-  // Update all voxels.
-  for (size_t i = 0; i < block.num_voxels(); ++i) {
-    TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
-    const Point p_C = T_C_S * block.computeCoordinatesFromLinearIndex(
-                                  i);  // Voxel center in camera frame.
-    if (updateVoxel(interpolator, &voxel, p_C, input, submap_id,
-                    is_free_space_submap, truncation_distance, voxel_size)) {
-      was_updated = true;
+  // The class blocks to update were allocated when preparing the submap.
+  ClassBlock* class_block =
+      updatesClassLayer(*submap) ? blocks.classification.get() : nullptr;
+  VoxelMask updated_voxels(block.num_voxels());
+
+  // Frozen blocks are skipped as long as the measurements agree with them.
+  // The virtual interface does not report residuals, so blocks are not frozen.
+  constexpr bool kTracksConvergence =
+      !std::is_same<InterpolatorT, InterpolatorBase>::value;
+  const bool track_convergence =
+      kTracksConvergence && converged_block_tracker_ != nullptr;
+  if (track_convergence &&
+      converged_block_tracker_->isFrozen(submap_id, block_index)) {
+    if (frozenBlockIsConsistent(*submap, interpolator, block_index, block,
+                                views, num_views)) {
+      return;
+    }
+    converged_block_tracker_->unfreeze(submap_id, block_index);
+  }
+  const float max_residual =
+      track_convergence
+          ? converged_block_tracker_->getConfig().max_residual * voxel_size
+          : 0.f;
+  const float saturated_weight =
+      track_convergence
+          ? converged_block_tracker_->getConfig().saturation_fraction *
+                config_.max_weight
+          : 0.f;
+  bool is_converged = true;
+  float residual = 0.f;
+
+  // Account for the frames in which the submap is not integrated.
+  const float weight_scale = static_cast<float>(getIntegrationPeriod(*submap));
+
+  // Fuse all views while the block is in cache. The projection buffers are
+  // reused for all blocks of a thread.
+  constexpr bool kIsBatched =
+      std::is_same<InterpolatorT, InterpolatorNearest>::value ||
+      std::is_same<InterpolatorT, InterpolatorBilinear>::value;
+  thread_local BlockProjection projection;
+  for (size_t k = 0; k < num_views; ++k) {
+    const ViewUpdate& view = views[k];
+
+    // If no pixel of the submap is near the block, it can only be updated
+    // by foreign rays. These don't update the block if they don't clear, and
+    // only clear the block if it is not entirely behind the surface.
+    bool clear_only = false;
+    if (view.id_masks && !is_free_space_submap &&
+        !voxel_update_rules_.all_rays_update &&
+        !blockMayContainID(block, view, submap_id)) {
+      if (!config_.foreign_rays_clear ||
+          (view.range_pyramid && blockIsBehindSurface(block, view))) {
+        continue;
+      }
+      clear_only = true;
+    }
+
+    // Transform and cull all voxels at once.
+    projectBlock(block, view.T_C_S, view.camera->getConfig(), &projection);
+
+    // The nearest and bilinear interpolators look up the ranges and fuse the
+    // distances of all voxels at once. Only the ID, color, and class lookups
+    // remain per voxel.
+    if constexpr (kIsBatched) {
+      interpolateBlock<InterpolatorT>(view, voxel_size, truncation_distance,
+                                      weight_scale, &projection);
+      projection.is_updated.setConstant(false);
+      projection.is_surface.setConstant(false);
+
+      // Select the measured distance of each voxel as in 'updateVoxelImpl()'
+      // and 'clearVoxelImpl()'. Voxels that are not fused get zero weight.
+      for (size_t i = 0; i < block.num_voxels(); ++i) {
+        const float sdf = projection.sdf[i];
+        float& weight = projection.weight[i];
+        float& measured_distance = projection.measured_distance[i];
+        if (!projection.is_visible[i] || sdf < -truncation_distance ||
+            (clear_only && sdf <= 0.f)) {
+          weight = 0.f;
+          continue;
+        }
+        if (clear_only) {
+          measured_distance = truncation_distance;
+          projection.is_updated[i] = true;
+          continue;
+        }
+        interpolator->computeWeights(projection.u[i], projection.v[i],
+                                     *view.range_image);
+        const bool point_belongs_to_this_submap =
+            voxel_update_rules_.all_rays_update ||
+            interpolateIDImpl(interpolator, view) == submap_id;
+        if (!(point_belongs_to_this_submap || config_.foreign_rays_clear ||
+              is_free_space_submap)) {
+          weight = 0.f;
+          continue;
+        }
+        projection.is_updated[i] = true;
+        if (point_belongs_to_this_submap || is_free_space_submap) {
+          measured_distance = std::min(sdf, truncation_distance);
+          const bool is_surface_update =
+              point_belongs_to_this_submap &&
+              std::abs(measured_distance) < truncation_distance &&
+              (!is_free_space_submap ||
+               voxel_update_rules_.update_free_space_surface);
+          if (is_surface_update && store_color) {
+            projection.is_surface[i] = true;
+            projection.colors[i] = interpolateColorImpl(interpolator, view);
+          }
+          if (is_surface_update && class_block) {
+            updateClassVoxel(interpolator, *view.input,
+                             interpolateIDImpl(interpolator, view), submap_id,
+                             &class_block->getVoxelByLinearIndex(i));
+          }
+        } else if (sdf > 0.f) {
+          measured_distance = truncation_distance;
+        } else {
+          // Foreign rays behind the surface count as update but don't change
+          // the voxel.
+          weight = 0.f;
+        }
+      }
+      fuseBlock(&block, &projection);
+
+      // Blend the colors with the fused weights and track the convergence.
+      for (size_t i = 0; i < block.num_voxels(); ++i) {
+        if (!projection.is_updated[i]) {
+          continue;
+        }
+        TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+        if (projection.is_surface[i]) {
+          voxel.color =
+              Color::blendTwoColors(voxel.color, voxel.weight,
+                                    projection.colors[i], projection.weight[i]);
+        }
+        was_updated = true;
+        updated_voxels.set(i);
+        if (track_convergence && is_converged) {
+          is_converged = voxel.weight >= saturated_weight &&
+                         projection.residual[i] <= max_residual;
+        }
+      }
+      continue;
+    }
+
+    // Update all voxels.
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      if (!projection.is_visible(i)) {
+        continue;
+      }
+      TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+      const Point p_C = projection.p_C.col(i);  // Voxel center in camera frame.
+      ClassVoxel* class_voxel =
+          class_block ? &class_block->getVoxelByLinearIndex(i) : nullptr;
+      bool voxel_was_updated;
+      if (clear_only) {
+        voxel_was_updated =
+            clearVoxelImpl(interpolator, &voxel, p_C, view, truncation_distance,
+                           voxel_size, weight_scale, &residual);
+      } else if constexpr (std::is_same<InterpolatorT,
+                                        InterpolatorBase>::value) {
+        // The virtual interface uses the current view.
+        voxel_was_updated = updateVoxel(
+            interpolator, &voxel, p_C, *view.input, submap_id,
+            is_free_space_submap, store_color, truncation_distance, voxel_size,
+            class_voxel, weight_scale);
+      } else {
+        voxel_was_updated = updateVoxelImpl(
+            interpolator, &voxel, p_C, view, submap_id, is_free_space_submap,
+            store_color, truncation_distance, voxel_size, class_voxel,
+            weight_scale, &residual);
+      }
+      if (voxel_was_updated) {
+        was_updated = true;
+        updated_voxels.set(i);
+        if (track_convergence && is_converged) {
+          is_converged =
+              voxel.weight >= saturated_weight && residual <= max_residual;
+        }
+      }
     }
   }
   if (was_updated) {
     block.setUpdatedAll();
+    submap->recordChangedBlock(block_index);
+    submap->getVoxelMasksPtr()->update(block_index, block, &updated_voxels);
+    if (track_convergence) {
+      converged_block_tracker_->recordUpdate(submap_id, block_index,
+                                             is_converged);
+    }
+  }
+}
+
+template <typename InterpolatorT>
+bool ProjectiveIntegrator::frozenBlockIsConsistent(
+    const Submap& submap, InterpolatorT* interpolator,
+    const voxblox::BlockIndex& block_index, const TsdfBlock& block,
+    const ViewUpdate* views, size_t num_views) const {
+  // Sample the near surface voxels, or all observed voxels if the block does
+  // not contain the surface.
+  std::vector<size_t> voxels;
+  submap.getVoxelMasks().forEachNearSurfaceVoxel(
+      block_index, block, [&voxels](size_t i) { voxels.push_back(i); });
+  if (voxels.empty()) {
+    submap.getVoxelMasks().forEachObservedVoxel(
+        block_index, block, [&voxels](size_t i) { voxels.push_back(i); });
+  }
+  if (voxels.empty()) {
+    return false;
+  }
+  const ConvergedBlockTracker::Config& config =
+      converged_block_tracker_->getConfig();
+  const size_t step = std::max<size_t>(
+      1, voxels.size() / static_cast<size_t>(config.num_test_voxels));
+  const float max_residual = config.max_residual * block.voxel_size();
+  const float truncation_distance = submap.getConfig().truncation_distance;
+  const bool is_free_space_submap =
+      submap.getLabel() == PanopticLabel::kFreeSpace;
+
+  // A tested voxel disagrees if the full update would set it to a distance
+  // that differs by more than the residual.
+  for (size_t k = 0; k < num_views; ++k) {
+    const ViewUpdate& view = views[k];
+    for (size_t j = step / 2; j < voxels.size(); j += step) {
+      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(voxels[j]);
+      const Point p_C =
+          view.T_C_S * block.computeCoordinatesFromLinearIndex(voxels[j]);
+      float sdf;
+      if (!computeSignedDistanceImpl(p_C, view, interpolator, &sdf) ||
+          sdf < -truncation_distance) {
+        continue;
+      }
+      float measured_distance;
+      if (is_free_space_submap || voxel_update_rules_.all_rays_update ||
+          interpolateIDImpl(interpolator, view) == submap.getID()) {
+        measured_distance = std::min(sdf, truncation_distance);
+      } else if (config_.foreign_rays_clear && sdf > 0.f) {
+        measured_distance = truncation_distance;
+      } else {
+        continue;
+      }
+      if (std::abs(measured_distance - voxel.distance) > max_residual) {
+        return false;
+      }
+    }
   }
+  return true;
+}
+
+void ProjectiveIntegrator::projectBlock(const TsdfBlock& block,
+                                        const Transformation& T_C_S,
+                                        BlockProjection* projection) const {
+  projectBlock(block, T_C_S, *cam_config_, projection);
+}
+
+void ProjectiveIntegrator::projectBlock(const TsdfBlock& block,
+                                        const Transformation& T_C_S,
+                                        const Camera::Config& camera,
+                                        BlockProjection* projection) const {
+  CHECK_NOTNULL(projection);
+  // Voxel centers relative to the block origin, in the linear index order of
+  // the block. These only depend on the layout and are computed once, the
+  // loops have constant bounds for the common block sizes.
+  const size_t num_voxels = block.num_voxels();
+  if (projection->voxels_per_side != block.voxels_per_side() ||
+      projection->voxel_size != block.voxel_size()) {
+    projection->voxels_per_side = block.voxels_per_side();
+    projection->voxel_size = block.voxel_size();
+    projection->offsets.resize(3, num_voxels);
+    projection->p_C.resize(3, num_voxels);
+    projection->distance.resize(num_voxels);
+    projection->u.resize(num_voxels);
+    projection->v.resize(num_voxels);
+    projection->is_visible.resize(num_voxels);
+    projection->sdf.resize(num_voxels);
+    projection->weight.resize(num_voxels);
+    projection->measured_distance.resize(num_voxels);
+    projection->residual.resize(num_voxels);
+    projection->is_updated.resize(num_voxels);
+    projection->is_surface.resize(num_voxels);
+    projection->pixels.resize(4, num_voxels);
+    projection->ranges.resize(4, num_voxels);
+    projection->colors.resize(num_voxels);
+    dispatchBlockLayout(block.voxels_per_side(), [&](const auto& layout) {
+      const int voxels_per_side = layout.voxelsPerSide();
+      int index = 0;
+      for (int z = 0; z < voxels_per_side; ++z) {
+        for (int y = 0; y < voxels_per_side; ++y) {
+          for (int x = 0; x < voxels_per_side; ++x) {
+            projection->offsets.col(index++) =
+                block.voxel_size() * (Point(x, y, z) + Point::Constant(0.5f));
+          }
+        }
+      }
+    });
+  }
+
+  // Batched transform and projection into the preallocated buffers.
+  projection->p_C.noalias() = T_C_S.getRotationMatrix() * projection->offsets;
+  projection->p_C.colwise() += T_C_S * block.origin();
+  const auto z = projection->p_C.row(2).array();
+  projection->distance = projection->p_C.colwise().norm().array();
+  projection->u = projection->p_C.row(0).array() * camera.fx / z + camera.vx;
+  projection->v = projection->p_C.row(1).array() * camera.fy / z + camera.vy;
+
+  // Conservative culling with a small margin, the exact checks are done per
+  // voxel in 'computeSignedDistance()'.
+  constexpr float kRangeMargin = 1e-3f;
+  constexpr float kPixelMargin = 1.f;
+  const auto& distance = projection->distance;
+  const auto& u = projection->u;
+  const auto& v = projection->v;
+  projection->is_visible =
+      (z >= 0.f) && (distance >= camera.min_range - kRangeMargin) &&
+      (distance <= camera.max_range + kRangeMargin) && (u >= -kPixelMargin) &&
+      (u < camera.width + kPixelMargin) && (v >= -kPixelMargin) &&
+      (v < camera.height + kPixelMargin);
+}
+
+template <typename InterpolatorT>
+void ProjectiveIntegrator::interpolateBlock(const ViewUpdate& view,
+                                            const float voxel_size,
+                                            const float truncation_distance,
+                                            const float weight_scale,
+                                            BlockProjection* projection) const {
+  static_assert(std::is_same<InterpolatorT, InterpolatorNearest>::value ||
+                    std::is_same<InterpolatorT, InterpolatorBilinear>::value,
+                "Batched lookups are only implemented for the nearest and "
+                "bilinear interpolators.");
+  CHECK_NOTNULL(projection);
+  BlockProjection& p = *projection;
+  const Camera::Config& camera = view.camera->getConfig();
+
+  // The exact checks of 'computeSignedDistanceImpl()'.
+  const auto z = p.p_C.row(2).array();
+  const float width = camera.width;
+  const float height = camera.height;
+  p.is_visible = p.is_visible && (z >= 0.f) &&
+                 (p.distance >= camera.min_range) &&
+                 (p.distance <= camera.max_range) && (p.u.floor() >= 0.f) &&
+                 (p.u.ceil() < width) && (p.v.floor() >= 0.f) &&
+                 (p.v.ceil() < height);
+
+  // Pixel (u, v) of both the planar and the (column major) range image is at
+  // range[u * u_step + v * v_step].
+  const float* range;
+  int u_step;
+  int v_step;
+  if (view.planar_images) {
+    range = view.planar_images->range();
+    u_step = 1;
+    v_step = view.planar_images->stride();
+  } else {
+    range = view.range_image->data();
+    u_step = view.range_image->rows();
+    v_step = 1;
+  }
+
+  // Invalid voxels are looked up at pixel (0, 0), such that the gathers don't
+  // need branches.
+  const auto u = p.is_visible.select(p.u, 0.f);
+  const auto v = p.is_visible.select(p.v, 0.f);
+  const Eigen::Index num_voxels = p.sdf.size();
+  if constexpr (std::is_same<InterpolatorT, InterpolatorNearest>::value) {
+    p.pixels.row(0) = u.round().cast<int>() * u_step +
+                      v.round().cast<int>() * v_step;
+    for (Eigen::Index i = 0; i < num_voxels; ++i) {
+      p.sdf[i] = range[p.pixels(0, i)];
+    }
+  } else {
+    // The neighbors in the last row and column have zero weight and are
+    // clamped to the image.
+    const auto u0 = u.floor().cast<int>();
+    const auto v0 = v.floor().cast<int>();
+    const auto u1 = (u0 + 1).min(camera.width - 1);
+    const auto v1 = (v0 + 1).min(camera.height - 1);
+    p.pixels.row(0) = u0 * u_step + v0 * v_step;
+    p.pixels.row(1) = u0 * u_step + v1 * v_step;
+    p.pixels.row(2) = u1 * u_step + v0 * v_step;
+    p.pixels.row(3) = u1 * u_step + v1 * v_step;
+    for (Eigen::Index i = 0; i < num_voxels; ++i) {
+      for (int k = 0; k < 4; ++k) {
+        p.ranges(k, i) = range[p.pixels(k, i)];
+      }
+    }
+    const auto du = u - u.floor();
+    const auto dv = v - v.floor();
+    p.sdf = p.ranges.row(0) * (1.f - du) * (1.f - dv) +
+            p.ranges.row(1) * (1.f - du) * dv +
+            p.ranges.row(2) * du * (1.f - dv) + p.ranges.row(3) * du * dv;
+  }
+  p.sdf -= p.distance;
+
+  // The weights as in 'computeWeightImpl()'.
+  const auto z_squared = z.square();
+  p.weight = camera.fx * camera.fy * voxel_size * voxel_size / z_squared;
+  if (!config_.use_constant_weight) {
+    p.weight /= z_squared;
+  }
+  if (config_.use_weight_dropoff) {
+    const float dropoff_epsilon =
+        config_.weight_dropoff_epsilon > 0.f
+            ? config_.weight_dropoff_epsilon
+            : config_.weight_dropoff_epsilon * -voxel_size;
+    p.weight = (p.sdf < -dropoff_epsilon)
+                   .select((p.weight * (truncation_distance + p.sdf) /
+                            (truncation_distance - dropoff_epsilon))
+                               .max(0.f),
+                           p.weight);
+  }
+  p.weight *= weight_scale;
+}
+
+void ProjectiveIntegrator::fuseBlock(TsdfBlock* block,
+                                     BlockProjection* projection) const {
+  CHECK_NOTNULL(block);
+  CHECK_NOTNULL(projection);
+  // The distances and weights of the voxels are viewed as strided arrays, such
+  // that the weighted averaging is a single vectorized expression.
+  static_assert(sizeof(TsdfVoxel) % sizeof(float) == 0,
+                "TsdfVoxel needs to be a multiple of floats.");
+  constexpr int kStride = sizeof(TsdfVoxel) / sizeof(float);
+  using VoxelValues = Eigen::Map<Eigen::Array<float, 1, Eigen::Dynamic>, 0,
+                                 Eigen::InnerStride<kStride>>;
+  TsdfVoxel* voxels = &block->getVoxelByLinearIndex(0);
+  const Eigen::Index num_voxels = block->num_voxels();
+  VoxelValues distance(&voxels->distance, num_voxels);
+  VoxelValues weight(&voxels->weight, num_voxels);
+  BlockProjection& p = *projection;
+  const auto is_fused = p.weight > 0.f;
+  p.residual = is_fused.select((p.measured_distance - distance).abs(), 0.f);
+  distance = is_fused.select(
+      (distance * weight + p.measured_distance * p.weight) /
+          (weight + p.weight),
+      distance);
+  weight = (weight + p.weight).min(config_.max_weight);
 }
 
 bool ProjectiveIntegrator::updateVoxel(
     InterpolatorBase* interpolator, TsdfVoxel* voxel, const Point& p_C,
     const InputData& input, const int submap_id,
-    const bool is_free_space_submap, const float truncation_distance,
-    const float voxel_size, ClassVoxel* class_voxel) const {
+    const bool is_free_space_submap, const bool store_color,
+    const float truncation_distance, const float voxel_size,
+    ClassVoxel* class_voxel, const float weight_scale) const {
+  const ViewUpdate view{&input, camera_, &range_image_,
+                        getInterpolationMask(interpolation_mask_),
+                        Transformation()};
+  return updateVoxelImpl(interpolator, voxel, p_C, view, submap_id,
+                         is_free_space_submap, store_color,
+                         truncation_distance, voxel_size, class_voxel,
+                         weight_scale);
+}
+
+template <typename InterpolatorT>
+bool ProjectiveIntegrator::updateVoxelImpl(
+    InterpolatorT* interpolator, TsdfVoxel* voxel, const Point& p_C,
+    const ViewUpdate& view, const int submap_id,
+    const bool is_free_space_submap, const bool store_color,
+    const float truncation_distance, const float voxel_size,
+    ClassVoxel* class_voxel, const float weight_scale, float* residual) const {
   // Compute the signed distance. This also sets up the interpolator.
   float sdf;
-  if (!computeSignedDistance(p_C, interpolator, &sdf)) {
+  bool is_valid;
+  if constexpr (std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    is_valid = computeSignedDistance(p_C, interpolator, &sdf);
+  } else {
+    is_valid = computeSignedDistanceImpl(p_C, view, interpolator, &sdf);
+  }
+  if (!is_valid) {
     return false;
   }
   if (sdf < -truncation_distance) {
@@ -177,74 +1027,197 @@ bool ProjectiveIntegrator::updateVoxel(
 
   // Check whether this is a clearing or an updating measurement.
   const bool point_belongs_to_this_submap =
-      interpolator->interpolateID(input.idImage()) == submap_id;
+      voxel_update_rules_.all_rays_update ||
+      interpolateIDImpl(interpolator, view) == submap_id;
   if (!(point_belongs_to_this_submap || config_.foreign_rays_clear ||
         is_free_space_submap)) {
     return false;
   }
 
   // Compute the weight of the measurement.
-  const float weight = computeWeight(p_C, voxel_size, truncation_distance, sdf);
+  float weight;
+  if constexpr (std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    weight = computeWeight(p_C, voxel_size, truncation_distance, sdf);
+  } else {
+    weight = computeWeightImpl(view.camera->getConfig(), p_C, voxel_size,
+                               truncation_distance, sdf);
+  }
+  weight *= weight_scale;
 
   // Apply distance, color, and weight.
+  if (residual) {
+    *residual = 0.f;
+  }
   if (point_belongs_to_this_submap || is_free_space_submap) {
     // Truncate the sdf to the truncation band.
     sdf = std::min(sdf, truncation_distance);
+    if (residual) {
+      *residual = std::abs(sdf - voxel->distance);
+    }
 
-    // Only merge color near the surface and if point belongs to the submap.
-    if (!point_belongs_to_this_submap || is_free_space_submap ||
-        std::abs(sdf) >= truncation_distance) {
-      updateVoxelValues(voxel, sdf, weight);
-    } else {
-      const Color color = interpolator->interpolateColor(input.colorImage());
+    // Only merge color and classification near the surface and if point
+    // belongs to the submap.
+    const bool is_surface_update =
+        point_belongs_to_this_submap && std::abs(sdf) < truncation_distance &&
+        (!is_free_space_submap ||
+         voxel_update_rules_.update_free_space_surface);
+    if (is_surface_update && store_color) {
+      const Color color = interpolateColorImpl(interpolator, view);
       updateVoxelValues(voxel, sdf, weight, &color);
+    } else {
+      updateVoxelValues(voxel, sdf, weight);
+    }
+    if (is_surface_update && class_voxel) {
+      updateClassVoxel(interpolator, *view.input,
+                       interpolateIDImpl(interpolator, view), submap_id,
+                       class_voxel);
     }
   } else {
     // Voxels that don't belong to the submap are 'cleared' if they are in
     // front of the surface. If the foreign_rays_clear flag is not set the
     // update step already returned before here.
     if (sdf > 0) {
+      if (residual) {
+        *residual = std::abs(truncation_distance - voxel->distance);
+      }
       updateVoxelValues(voxel, truncation_distance, weight);
     }
   }
   return true;
 }
 
+template <typename InterpolatorT>
+bool ProjectiveIntegrator::clearVoxelImpl(InterpolatorT* interpolator,
+                                          TsdfVoxel* voxel, const Point& p_C,
+                                          const ViewUpdate& view,
+                                          const float truncation_distance,
+                                          const float voxel_size,
+                                          const float weight_scale,
+                                          float* residual) const {
+  // Only the signed distance is needed to decide whether a voxel is cleared.
+  float sdf;
+  bool is_valid;
+  if constexpr (std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    is_valid = computeSignedDistance(p_C, interpolator, &sdf);
+  } else {
+    is_valid = computeSignedDistanceImpl(p_C, view, interpolator, &sdf);
+  }
+  if (!is_valid || sdf <= 0.f) {
+    return false;
+  }
+  float weight;
+  if constexpr (std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    weight = computeWeight(p_C, voxel_size, truncation_distance, sdf);
+  } else {
+    weight = computeWeightImpl(view.camera->getConfig(), p_C, voxel_size,
+                               truncation_distance, sdf);
+  }
+  weight *= weight_scale;
+  if (residual) {
+    *residual = std::abs(truncation_distance - voxel->distance);
+  }
+  updateVoxelValues(voxel, truncation_distance, weight);
+  return true;
+}
+
 bool ProjectiveIntegrator::computeSignedDistance(const Point& p_C,
                                                  InterpolatorBase* interpolator,
                                                  float* sdf) const {
+  const ViewUpdate view{nullptr, camera_, &range_image_,
+                        getInterpolationMask(interpolation_mask_),
+                        Transformation()};
+  return computeSignedDistanceImpl(p_C, view, interpolator, sdf);
+}
+
+template <typename InterpolatorT>
+bool ProjectiveIntegrator::computeSignedDistanceImpl(
+    const Point& p_C, const ViewUpdate& view, InterpolatorT* interpolator,
+    float* sdf) const {
   // Skip voxels that are too far or too close.
   if (p_C.z() < 0.0) {
     return false;
   }
+  const Camera::Config& camera = view.camera->getConfig();
   const float distance_to_voxel = p_C.norm();
-  if (distance_to_voxel < cam_config_->min_range ||
-      distance_to_voxel > cam_config_->max_range) {
+  if (distance_to_voxel < camera.min_range ||
+      distance_to_voxel > camera.max_range) {
     return false;
   }
 
   // Project the current voxel into the range image, only count points that fall
   // fully into the image.
   float u, v;
-  if (!globals_->camera()->projectPointToImagePlane(p_C, &u, &v)) {
+  if (!view.camera->projectPointToImagePlane(p_C, &u, &v)) {
     return false;
   }
 
-  // Set up the interpolator and compute the signed distance.
-  interpolator->computeWeights(u, v, range_image_);
-  const float distance_to_surface =
-      interpolator->interpolateRange(range_image_);
+  // Set up the interpolator and compute the signed distance. The mask is only
+  // set for adaptive interpolation, in which case the interpolators are
+  // guaranteed to be adaptive.
+  if constexpr (std::is_same<InterpolatorT, InterpolatorAdaptive>::value ||
+                std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    if (view.interpolation_mask) {
+      static_cast<InterpolatorAdaptive*>(interpolator)
+          ->computeWeights(u, v, *view.range_image, *view.interpolation_mask);
+    } else {
+      interpolator->computeWeights(u, v, *view.range_image);
+    }
+  } else {
+    interpolator->computeWeights(u, v, *view.range_image);
+  }
+  const float distance_to_surface = interpolateRangeImpl(interpolator, view);
   *sdf = distance_to_surface - distance_to_voxel;
   return true;
 }
 
+template <typename InterpolatorT>
+float ProjectiveIntegrator::interpolateRangeImpl(InterpolatorT* interpolator,
+                                                 const ViewUpdate& view) const {
+  if constexpr (!std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    if (view.planar_images) {
+      return interpolator->interpolateRange(*view.planar_images);
+    }
+  }
+  return interpolator->interpolateRange(*view.range_image);
+}
+
+template <typename InterpolatorT>
+int ProjectiveIntegrator::interpolateIDImpl(InterpolatorT* interpolator,
+                                            const ViewUpdate& view) const {
+  if constexpr (!std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    if (view.planar_images) {
+      return interpolator->interpolateID(*view.planar_images);
+    }
+  }
+  return interpolator->interpolateID(view.input->idImage());
+}
+
+template <typename InterpolatorT>
+Color ProjectiveIntegrator::interpolateColorImpl(InterpolatorT* interpolator,
+                                                 const ViewUpdate& view) const {
+  if constexpr (!std::is_same<InterpolatorT, InterpolatorBase>::value) {
+    if (view.planar_images) {
+      return interpolator->interpolateColor(*view.planar_images);
+    }
+  }
+  return interpolator->interpolateColor(view.input->colorImage());
+}
+
 float ProjectiveIntegrator::computeWeight(const Point& p_C,
                                           const float voxel_size,
                                           const float truncation_distance,
                                           const float sdf) const {
+  return computeWeightImpl(*cam_config_, p_C, voxel_size, truncation_distance,
+                           sdf);
+}
+
+float ProjectiveIntegrator::computeWeightImpl(const Camera::Config& camera,
+                                              const Point& p_C,
+                                              const float voxel_size,
+                                              const float truncation_distance,
+                                              const float sdf) const {
   // This approximates the number of rays that would hit this voxel.
-  float weight =
-      cam_config_->fx * cam_config_->fy * std::pow(voxel_size / p_C.z(), 2.f);
+  float weight = camera.fx * camera.fy * std::pow(voxel_size / p_C.z(), 2.f);
 
   // Weight reduction with distance squared (according to sensor noise models).
   if (!config_.use_constant_weight) {
@@ -279,99 +1252,398 @@ void ProjectiveIntegrator::updateVoxelValues(TsdfVoxel* voxel, const float sdf,
   }
 }  // namespace panoptic_mapping
 
+void ProjectiveIntegrator::buildPlanarImages(const InputData& input) {
+  if (!config_.use_planar_images) {
+    return;
+  }
+  Timer timer("tsdf_integration/build_planar_images");
+  planar_images_.build(range_image_, input);
+}
+
+void ProjectiveIntegrator::buildIDMasks(const InputData& input) {
+  if (!getIDMasks(id_masks_)) {
+    return;
+  }
+  Timer timer("tsdf_integration/build_id_masks");
+  id_masks_.build(input.idImage(),
+                  input.has(InputData::InputType::kIDSegments)
+                      ? &input.idSegments()
+                      : nullptr);
+}
+
+int ProjectiveIntegrator::getIntegrationPeriod(const Submap& submap) const {
+  switch (submap.getLabel()) {
+    case PanopticLabel::kInstance:
+      return config_.instance_integration_period;
+    case PanopticLabel::kBackground:
+      return config_.background_integration_period;
+    case PanopticLabel::kFreeSpace:
+      return config_.free_space_integration_period;
+    default:
+      return config_.unknown_integration_period;
+  }
+}
+
+bool ProjectiveIntegrator::blockMayContainID(const TsdfBlock& block,
+                                             const ViewUpdate& view,
+                                             int submap_id) const {
+  const float half_block_size = 0.5f * block.block_size();
+  const Point center_C =
+      view.T_C_S * (block.origin() + Point::Constant(half_block_size));
+  int u_min, v_min, u_max, v_max;
+  if (!view.camera->projectSphereToImagePlane(center_C,
+                                              std::sqrt(3.f) * half_block_size,
+                                              &u_min, &v_min, &u_max, &v_max)) {
+    // Blocks close to or behind the camera are not culled.
+    return true;
+  }
+  // Pad by one pixel to cover interpolation neighbors.
+  return view.id_masks->mayContain(submap_id, u_min - 1, v_min - 1, u_max + 1,
+                                   v_max + 1);
+}
+
+bool ProjectiveIntegrator::blockIsBehindSurface(const TsdfBlock& block,
+                                                const ViewUpdate& view) const {
+  const float half_block_size = 0.5f * block.block_size();
+  const Point center_C =
+      view.T_C_S * (block.origin() + Point::Constant(half_block_size));
+  // Foreign rays only clear voxels in front of the surface.
+  return view.camera->sphereIsBehindSurface(
+      center_C, std::sqrt(3.f) * half_block_size, *view.range_pyramid, 0.f);
+}
+
+void ProjectiveIntegrator::computeInterpolationMaskRow(const InputData& input,
+                                                       int v) {
+  if (interpolator_type_ != InterpolatorType::kAdaptive) {
+    return;
+  }
+  InterpolatorAdaptive::computeMaskRow(
+      input.rangeImage(), v, config_.interpolation_max_depth_difference,
+      &interpolation_mask_);
+}
+
 void ProjectiveIntegrator::allocateNewBlocks(SubmapCollection* submaps,
                                              const InputData& input) {
   // This method also resets the depth image.
   range_image_.setZero();
   max_range_in_image_ = 0.f;
 
-  // Parse through each point to allocate instance + background blocks.
-  std::unordered_set<Submap*> touched_submaps;
-  for (int v = 0; v < input.depthImage().rows; v++) {
-    for (int u = 0; u < input.depthImage().cols; u++) {
-      const cv::Vec3f& vertex = input.vertexMap().at<cv::Vec3f>(v, u);
-      const Point p_C(vertex[0], vertex[1], vertex[2]);
-      const float ray_distance = p_C.norm();
-      range_image_(v, u) = ray_distance;
-      if (ray_distance > cam_config_->max_range ||
-          ray_distance < cam_config_->min_range) {
-        continue;
-      }
-      max_range_in_image_ = std::max(max_range_in_image_, ray_distance);
-      const int id = input.idImage().at<int>(v, u);
-      if (submaps->submapIdExists(id)) {
-        Submap* submap = submaps->getSubmapPtr(id);
-        const int voxels_per_side = submap->getConfig().voxels_per_side;
-        const Point p_S = submap->getT_S_M() * input.T_M_C() * p_C;
-        const voxblox::BlockIndex block_index =
-            submap->getTsdfLayer().computeBlockIndexFromCoordinates(p_S);
-        const auto block =
-            submap->getTsdfLayerPtr()->allocateBlockPtrByIndex(block_index);
-        if (submap->hasClassLayer()) {
-          // NOTE(schmluk): The projective integrator does not use the class
-          // layer but was added here for simplicity.
-          submap->getClassLayerPtr()->allocateBlockPtrByIndex(block_index);
-        }
+  // Parse through each point to find all instance + background blocks. This is
+  // done in parallel over tiles of image rows, each thread collects the blocks
+  // it touches per submap.
+  constexpr int kAllocationRowsPerTile = 8;
+  struct TileAllocation {
+    float max_range = 0.f;
+    std::unordered_map<int, voxblox::IndexSet> block_indices;
+    // Class blocks within the truncation band, for submaps that allocate
+    // class blocks only near the surface.
+    std::unordered_map<int, voxblox::IndexSet> class_block_indices;
+  };
+  std::vector<int> rows(input.depthImage().rows);
+  std::iota(rows.begin(), rows.end(), 0);
+  ChunkedIndexGetter<int> row_getter(std::move(rows), kAllocationRowsPerTile);
+  std::vector<std::future<TileAllocation>> threads;
+  const int num_threads = numIntegrationThreads();
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back(globals_->threadPool()->submit([this, &row_getter,
+                                                         &input, submaps]() {
+      TileAllocation result;
+      std::unordered_map<int, Transformation> T_S_C;
+      size_t begin, end;
+      while (row_getter.getNextChunk(&begin, &end)) {
+        for (size_t j = begin; j < end; ++j) {
+          const int v = row_getter[j];
+          computeInterpolationMaskRow(input, v);
+          const cv::Vec3f* vertices = input.vertexMap().ptr<cv::Vec3f>(v);
+          const float* ranges = input.rangeImage().ptr<float>(v);
+          // Process the pixels [u_begin, u_end) of the same ID, such that the
+          // submap is only looked up once per span.
+          auto process_span = [&](int u_begin, int u_end, int id) {
+            const Submap* submap = submaps->submapIdExists(id)
+                                       ? &submaps->getSubmap(id)
+                                       : nullptr;
+            const Transformation* T_S_C_submap = nullptr;
+            voxblox::IndexSet* block_indices = nullptr;
+            voxblox::IndexSet* class_block_indices = nullptr;
+            const bool allocate_class_band =
+                submap && submap->hasClassLayer() &&
+                submap->getConfig().allocate_class_blocks_in_surface_band;
+            if (submap) {
+              auto it = T_S_C.find(id);
+              if (it == T_S_C.end()) {
+                it = T_S_C.emplace(id, submap->getT_S_M() * input.T_M_C())
+                         .first;
+              }
+              T_S_C_submap = &it->second;
+            }
+            for (int u = u_begin; u < u_end; u++) {
+              const float ray_distance = ranges[u];
+              range_image_(v, u) = ray_distance;
+              if (ray_distance > cam_config_->max_range ||
+                  ray_distance < cam_config_->min_range) {
+                continue;
+              }
+              result.max_range = std::max(result.max_range, ray_distance);
+              if (!submap) {
+                continue;
+              }
+              const cv::Vec3f& vertex = vertices[u];
+              const Point p_C(vertex[0], vertex[1], vertex[2]);
+              if (!block_indices) {
+                block_indices = &result.block_indices[id];
+              }
+              block_indices->insert(
+                  submap->getTsdfLayer().computeBlockIndexFromCoordinates(
+                      *T_S_C_submap * p_C));
 
-        // If required, check whether the point is on the boudnary of a block
-        // and allocate the neighboring blocks.
-        if (config_.allocate_neighboring_blocks) {
-          for (float sign : {-1.f, 1.f}) {
-            const Point p_neighbor_S =
-                submap->getT_S_M() * input.T_M_C() *
-                (p_C *
-                 (1.f + sign * submap->getConfig().voxel_size / p_C.norm()));
-            const voxblox::BlockIndex neighbor_index =
-                submap->getTsdfLayer().computeBlockIndexFromCoordinates(
-                    p_neighbor_S);
-            if (neighbor_index != block_index) {
-              const auto block =
-                  submap->getTsdfLayerPtr()->allocateBlockPtrByIndex(
-                      neighbor_index);
-              if (submap->hasClassLayer()) {
-                submap->getClassLayerPtr()->allocateBlockPtrByIndex(
-                    neighbor_index);
+              // Class updates only happen within the truncation band around
+              // the measured point along the ray, so the blocks of its end
+              // points cover all class blocks that can be updated.
+              if (allocate_class_band) {
+                if (!class_block_indices) {
+                  class_block_indices = &result.class_block_indices[id];
+                }
+                const float truncation_distance =
+                    submap->getConfig().truncation_distance;
+                for (float sign : {-1.f, 0.f, 1.f}) {
+                  class_block_indices->insert(
+                      submap->getTsdfLayer().computeBlockIndexFromCoordinates(
+                          *T_S_C_submap *
+                          (p_C * (1.f + sign * truncation_distance /
+                                            ray_distance))));
+                }
               }
+
+              // If required, check whether the point is on the boudnary of a
+              // block and allocate the neighboring blocks.
+              if (config_.allocate_neighboring_blocks) {
+                for (float sign : {-1.f, 1.f}) {
+                  const Point p_neighbor_S =
+                      *T_S_C_submap *
+                      (p_C * (1.f + sign * submap->getConfig().voxel_size /
+                                        ray_distance));
+                  block_indices->insert(
+                      submap->getTsdfLayer().computeBlockIndexFromCoordinates(
+                          p_neighbor_S));
+                }
+              }
+            }
+          };
+          if (input.has(InputData::InputType::kIDSegments)) {
+            const IDSegments& segments = input.idSegments();
+            for (const IDSegments::Run* run = segments.rowBegin(v);
+                 run != segments.rowEnd(v); ++run) {
+              process_span(run->u_begin, run->u_end, run->id);
+            }
+          } else {
+            const int* ids = input.idImage().ptr<int>(v);
+            for (int u = 0; u < input.depthImage().cols; u++) {
+              process_span(u, u + 1, ids[u]);
             }
           }
         }
-        touched_submaps.insert(submap);
       }
+      return result;
+    }));
+  }
+
+  // Collect the results of all threads, sharded by submap.
+  std::vector<TileAllocation> tiles;
+  tiles.reserve(threads.size());
+  std::unordered_map<int, voxblox::IndexSet> new_blocks;
+  for (auto& thread : threads) {
+    tiles.emplace_back(globals_->threadPool()->wait(&thread));
+    max_range_in_image_ = std::max(max_range_in_image_, tiles.back().max_range);
+    for (const auto& id_indices_pair : tiles.back().block_indices) {
+      new_blocks[id_indices_pair.first];
     }
   }
   max_range_in_image_ = std::min(max_range_in_image_, cam_config_->max_range);
 
-  // Allocate all potential free space blocks.
-  if (submaps->submapIdExists(submaps->getActiveFreeSpaceSubmapID())) {
-    Submap* space =
-        submaps->getSubmapPtr(submaps->getActiveFreeSpaceSubmapID());
-    const float block_size = space->getTsdfLayer().block_size();
-    const float block_diag_half = std::sqrt(3.f) * block_size / 2.f;
-    const Transformation T_C_S = input.T_M_C().inverse() * space->getT_M_S();
-    const Point camera_S = T_C_S.inverse().getPosition();  // T_S_C
-    const int max_steps = std::floor((max_range_in_image_ + block_diag_half) /
-                                     space->getTsdfLayer().block_size());
-    for (int x = -max_steps; x <= max_steps; ++x) {
-      for (int y = -max_steps; y <= max_steps; ++y) {
-        for (int z = -max_steps; z <= max_steps; ++z) {
-          const Point offset(x, y, z);
-          const Point candidate_S = camera_S + offset * block_size;
-          if (globals_->camera()->pointIsInViewFrustum(T_C_S * candidate_S,
-                                                       block_diag_half)) {
-            space->getTsdfLayerPtr()->allocateBlockPtrByCoordinates(
-                candidate_S);
-          }
+  // Each submap is merged and allocated by a single task, such that the
+  // layers are never inserted into concurrently but all submaps and the free
+  // space are allocated in parallel. On multiple NUMA nodes the blocks are
+  // allocated by the workers of the home node of each submap, such that their
+  // memory is first touched and thus placed on that node.
+  auto allocate_blocks = [submaps, &tiles](int submap_id,
+                                           voxblox::IndexSet* block_indices) {
+    voxblox::IndexSet class_block_indices;
+    for (const TileAllocation& tile : tiles) {
+      auto it = tile.block_indices.find(submap_id);
+      if (it != tile.block_indices.end()) {
+        block_indices->insert(it->second.begin(), it->second.end());
+      }
+      it = tile.class_block_indices.find(submap_id);
+      if (it != tile.class_block_indices.end()) {
+        class_block_indices.insert(it->second.begin(), it->second.end());
+      }
+    }
+    Submap* submap = submaps->getSubmapPtr(submap_id);
+    submap->expandCollapsedBlocks(*block_indices);
+    // NOTE(schmluk): The projective integrator does not use the class
+    // layer but it is allocated here for simplicity.
+    // Blocks are allocated in Morton order, such that blocks taken from the
+    // pool consecutively are also close in space.
+    voxblox::BlockIndexList sorted_indices(block_indices->begin(),
+                                           block_indices->end());
+    sortMortonOrder(&sorted_indices);
+    for (const voxblox::BlockIndex& block_index : sorted_indices) {
+      submap->allocateBlocks(block_index);
+    }
+    for (const voxblox::BlockIndex& block_index : class_block_indices) {
+      submap->allocateClassBlock(block_index);
+    }
+
+    // Expand the bounding volume by the touched blocks only, which does not
+    // visit all blocks of the submap.
+    submap->updateBoundingVolume(*block_indices);
+  };
+  ThreadPool* thread_pool = globals_->threadPool();
+  std::vector<std::future<void>> allocations;
+  for (auto& id_indices_pair : new_blocks) {
+    const int submap_id = id_indices_pair.first;
+    voxblox::IndexSet* block_indices = &id_indices_pair.second;
+    auto task = [&allocate_blocks, submap_id, block_indices]() {
+      allocate_blocks(submap_id, block_indices);
+    };
+    if (thread_pool->getNumNodes() > 1) {
+      allocations.emplace_back(thread_pool->submitOnNode(
+          submaps->getSubmap(submap_id).getHomeNode(), std::move(task)));
+    } else {
+      allocations.emplace_back(thread_pool->submit(std::move(task)));
+    }
+  }
+
+  // Allocate all potential free space blocks if the free space is integrated
+  // in this frame, concurrently with the other submaps.
+  Submap* space = nullptr;
+  voxblox::IndexSet space_blocks;
+  if (submaps->submapIdExists(submaps->getActiveFreeSpaceSubmapID()) &&
+      integratesSubmap(
+          submaps->getSubmap(submaps->getActiveFreeSpaceSubmapID()))) {
+    space = submaps->getSubmapPtr(submaps->getActiveFreeSpaceSubmapID());
+    auto allocate_space = [this, space, &input, &space_blocks]() {
+      allocateFreeSpaceBlocks(space, input, &space_blocks);
+      space->updateBoundingVolume(space_blocks);
+    };
+    if (new_blocks.find(space->getID()) == new_blocks.end()) {
+      allocations.emplace_back(thread_pool->submit(std::move(allocate_space)));
+    } else {
+      // The layer of a submap must not be allocated concurrently.
+      thread_pool->waitAll(&allocations);
+      allocations.clear();
+      allocate_space();
+    }
+  }
+  thread_pool->waitAll(&allocations);
+  allocated_blocks_ = std::move(new_blocks);
+  if (space) {
+    allocated_blocks_[space->getID()].insert(space_blocks.begin(),
+                                             space_blocks.end());
+  }
+}
+
+void ProjectiveIntegrator::allocateFreeSpaceBlocks(
+    Submap* space, const InputData& input,
+    voxblox::IndexSet* block_indices) const {
+  CHECK_NOTNULL(block_indices);
+  if (config_.use_depth_bounded_freespace_allocation) {
+    allocateFreeSpaceBlocksAlongRays(space, input, block_indices);
+    return;
+  }
+
+  // Allocate all blocks in the view frustum.
+  const float block_size = space->getTsdfLayer().block_size();
+  const float block_diag_half = std::sqrt(3.f) * block_size / 2.f;
+  const Transformation T_C_S = input.T_M_C().inverse() * space->getT_M_S();
+  const Point camera_S = T_C_S.inverse().getPosition();  // T_S_C
+  const int max_steps = std::floor((max_range_in_image_ + block_diag_half) /
+                                   space->getTsdfLayer().block_size());
+  for (int x = -max_steps; x <= max_steps; ++x) {
+    for (int y = -max_steps; y <= max_steps; ++y) {
+      for (int z = -max_steps; z <= max_steps; ++z) {
+        const Point offset(x, y, z);
+        const Point candidate_S = camera_S + offset * block_size;
+        if (camera_->pointIsInViewFrustum(T_C_S * candidate_S,
+                                          block_diag_half)) {
+          block_indices->insert(
+              space->getTsdfLayer().computeBlockIndexFromCoordinates(
+                  candidate_S));
         }
       }
     }
-    space->getBoundingVolumePtr()->update();
   }
 
-  // Update all bounding volumes. This is currently done in every integration
-  // step since it's not too expensive and won't do anything if no new block
-  // was allocated.
-  for (auto& submap : touched_submaps) {
-    submap->updateBoundingVolume();
+  // Allocate all blocks.
+  BlockPool<TsdfVoxel>* block_pool = BlockPool<TsdfVoxel>::getGlobalInstance();
+  space->expandCollapsedBlocks(*block_indices);
+  TsdfLayer* tsdf_layer = space->getTsdfLayerPtr().get();
+  const bool record_created_blocks = space->hasChangeFeed();
+  for (const voxblox::BlockIndex& block_index : *block_indices) {
+    if (record_created_blocks && !tsdf_layer->hasBlock(block_index)) {
+      space->recordCreatedBlock(block_index);
+    }
+    block_pool->allocateBlockPtrByIndex(block_index, tsdf_layer);
+  }
+}
+
+void ProjectiveIntegrator::allocateFreeSpaceBlocksAlongRays(
+    Submap* space, const InputData& input,
+    voxblox::IndexSet* block_indices) const {
+  const float block_size = space->getTsdfLayer().block_size();
+  const float truncation_distance = space->getConfig().truncation_distance;
+  const Transformation T_S_C = space->getT_S_M() * input.T_M_C();
+  if (max_range_in_image_ <= 0.f) {
+    return;
+  }
+
+  // Subsample the rays such that they are at most half a block apart at the
+  // maximum range.
+  const float focal_length = std::max(cam_config_->fx, cam_config_->fy);
+  const int pixel_step = std::max(
+      1, static_cast<int>(std::floor(0.5f * block_size * focal_length /
+                                     max_range_in_image_)));
+  const float step_length = 0.5f * block_size;
+
+  // March one ray through the center of each image tile.
+  const int rows = range_image_.rows();
+  const int cols = range_image_.cols();
+  for (int v0 = 0; v0 < rows; v0 += pixel_step) {
+    for (int u0 = 0; u0 < cols; u0 += pixel_step) {
+      // Free space can be observed up to the furthest depth in the tile.
+      const int v1 = std::min(v0 + pixel_step, rows);
+      const int u1 = std::min(u0 + pixel_step, cols);
+      const float tile_range =
+          range_image_.block(v0, u0, v1 - v0, u1 - u0).maxCoeff();
+      const float ray_length =
+          std::min(tile_range + truncation_distance, cam_config_->max_range);
+      if (ray_length <= 0.f) {
+        continue;
+      }
+      const float u = 0.5f * static_cast<float>(u0 + u1 - 1);
+      const float v = 0.5f * static_cast<float>(v0 + v1 - 1);
+      const Point direction_C =
+          Point((u - cam_config_->vx) / cam_config_->fx,
+                (v - cam_config_->vy) / cam_config_->fy, 1.f)
+              .normalized();
+      for (float t = 0.f; t < ray_length + step_length; t += step_length) {
+        const Point p_S = T_S_C * (direction_C * std::min(t, ray_length));
+        block_indices->insert(
+            space->getTsdfLayer().computeBlockIndexFromCoordinates(p_S));
+      }
+    }
+  }
+
+  // Allocate all blocks.
+  BlockPool<TsdfVoxel>* block_pool = BlockPool<TsdfVoxel>::getGlobalInstance();
+  space->expandCollapsedBlocks(*block_indices);
+  TsdfLayer* tsdf_layer = space->getTsdfLayerPtr().get();
+  const bool record_created_blocks = space->hasChangeFeed();
+  for (const voxblox::BlockIndex& block_index : *block_indices) {
+    if (record_created_blocks && !tsdf_layer->hasBlock(block_index)) {
+      space->recordCreatedBlock(block_index);
+    }
+    block_pool->allocateBlockPtrByIndex(block_index, tsdf_layer);
   }
 }
 
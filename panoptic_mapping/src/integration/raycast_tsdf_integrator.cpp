@@ -0,0 +1,361 @@
+#include "panoptic_mapping/integration/raycast_tsdf_integrator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <voxblox/integrator/integrator_utils.h>
+
+#include "panoptic_mapping/common/index_getter.h"
+
+namespace panoptic_mapping {
+
+config_utilities::Factory::RegistrationRos<
+    TsdfIntegratorBase, RaycastIntegrator, std::shared_ptr<Globals>>
+    RaycastIntegrator::registration_("raycast");
+
+void RaycastIntegrator::Config::checkParams() const {
+  checkParamGT(integration_threads, 0, "integration_threads");
+  checkParamGT(integration_chunk_size, 0, "integration_chunk_size");
+  checkParamGT(max_weight, 0.f, "max_weight");
+  if (use_weight_dropoff) {
+    checkParamNE(weight_dropoff_epsilon, 0.f, "weight_dropoff_epsilon");
+  }
+}
+
+void RaycastIntegrator::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("use_weight_dropoff", &use_weight_dropoff);
+  setupParam("weight_dropoff_epsilon", &weight_dropoff_epsilon);
+  setupParam("use_constant_weight", &use_constant_weight);
+  setupParam("max_weight", &max_weight);
+  setupParam("voxel_carving", &voxel_carving);
+  setupParam("integration_threads", &integration_threads);
+  setupParam("integration_chunk_size", &integration_chunk_size);
+}
+
+RaycastIntegrator::RaycastIntegrator(const Config& config,
+                                     std::shared_ptr<Globals> globals)
+    : config_(config.checkValid()), TsdfIntegratorBase(std::move(globals)) {
+  LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
+  addRequiredInputs(
+      {InputData::InputType::kColorImage, InputData::InputType::kDepthImage,
+       InputData::InputType::kSegmentationImage,
+       InputData::InputType::kVertexMap, InputData::InputType::kRangeImage});
+}
+
+void RaycastIntegrator::processInput(SubmapCollection* submaps,
+                                     InputData* input) {
+  CHECK_NOTNULL(submaps);
+  CHECK_NOTNULL(input);
+  CHECK_NOTNULL(globals_->camera().get());
+  CHECK(inputIsValid(*input));
+
+  // Group the points by submap and voxel.
+  Timer merge_timer("tsdf_integration/merge_points");
+  const std::unordered_map<int, MergedPoints> merged_points =
+      mergePoints(*submaps, *input);
+  std::vector<std::pair<int, const MergedPoint*>> rays;
+  std::unordered_map<int, Transformation> T_S_C;
+  for (const auto& id_points_pair : merged_points) {
+    const int submap_id = id_points_pair.first;
+    T_S_C[submap_id] =
+        submaps->getSubmap(submap_id).getT_S_M() * input->T_M_C();
+    for (const auto& index_point_pair : id_points_pair.second) {
+      rays.emplace_back(submap_id, &index_point_pair.second);
+    }
+  }
+  merge_timer.Stop();
+
+  // Cast all merged rays in parallel. The updates of each chunk are stored
+  // separately and merged in order, such that the result is deterministic.
+  Timer ray_timer("tsdf_integration/cast_rays");
+  const size_t chunk_size = config_.integration_chunk_size;
+  std::vector<std::unordered_map<int, BlockUpdates>> chunk_updates(
+      (rays.size() + chunk_size - 1) / chunk_size);
+  std::vector<size_t> ray_indices(rays.size());
+  std::iota(ray_indices.begin(), ray_indices.end(), 0);
+  ChunkedIndexGetter<size_t> ray_getter(std::move(ray_indices), chunk_size);
+  std::vector<std::future<void>> threads;
+  for (int i = 0; i < config_.integration_threads; ++i) {
+    threads.emplace_back(globals_->threadPool()->submit(
+        [this, &ray_getter, &rays, &T_S_C, &chunk_updates, chunk_size,
+         submaps]() {
+          size_t begin, end;
+          while (ray_getter.getNextChunk(&begin, &end)) {
+            std::unordered_map<int, BlockUpdates>& updates =
+                chunk_updates[begin / chunk_size];
+            for (size_t j = begin; j < end; ++j) {
+              const int submap_id = rays[ray_getter[j]].first;
+              const Submap& submap = submaps->getSubmap(submap_id);
+              castRay(submap, T_S_C.at(submap_id), *rays[ray_getter[j]].second,
+                      submap.getLabel() == PanopticLabel::kFreeSpace,
+                      &updates[submap_id]);
+            }
+          }
+        }));
+  }
+  globals_->threadPool()->waitAll(&threads);
+  threads.clear();
+  std::unordered_map<int, BlockUpdates> updates;
+  for (auto& chunk : chunk_updates) {
+    for (auto& id_updates_pair : chunk) {
+      BlockUpdates& submap_updates = updates[id_updates_pair.first];
+      for (auto& index_updates_pair : id_updates_pair.second) {
+        std::vector<VoxelUpdate>& block_updates =
+            submap_updates[index_updates_pair.first];
+        block_updates.insert(block_updates.end(),
+                             index_updates_pair.second.begin(),
+                             index_updates_pair.second.end());
+      }
+    }
+  }
+  chunk_updates.clear();
+  ray_timer.Stop();
+
+  // Allocate all touched blocks.
+  Timer alloc_timer("tsdf_integration/allocate_blocks");
+  std::vector<SubmapBlockIndex> work_items;
+  std::vector<const std::vector<VoxelUpdate>*> work_updates;
+  for (const auto& id_updates_pair : updates) {
+    Submap* submap = submaps->getSubmapPtr(id_updates_pair.first);
+    voxblox::IndexSet block_indices;
+    for (const auto& index_updates_pair : id_updates_pair.second) {
+      block_indices.insert(index_updates_pair.first);
+    }
+    submap->expandCollapsedBlocks(block_indices);
+    for (const auto& index_updates_pair : id_updates_pair.second) {
+      const BlockIndex& block_index = index_updates_pair.first;
+      submap->allocateBlocks(block_index);
+      work_items.emplace_back(id_updates_pair.first, block_index);
+      work_updates.push_back(&index_updates_pair.second);
+    }
+    submap->updateBoundingVolume(block_indices);
+  }
+  alloc_timer.Stop();
+
+  // Apply the updates block-parallel.
+  Timer int_timer("tsdf_integration/integration");
+  SubmapBlockIndexGetter index_getter(std::move(work_items),
+                                      config_.integration_chunk_size);
+  for (int i = 0; i < config_.integration_threads; ++i) {
+    threads.emplace_back(globals_->threadPool()->submit(
+        [this, &index_getter, &work_updates, submaps]() {
+          size_t begin, end;
+          while (index_getter.getNextChunk(&begin, &end)) {
+            for (size_t j = begin; j < end; ++j) {
+              const SubmapBlockIndex& item = index_getter[j];
+              Submap* submap = submaps->getSubmapPtr(item.first);
+              TsdfBlock& block = *submap->getBlocks(item.second).tsdf;
+              VoxelMask updated_voxels(block.num_voxels());
+              for (const VoxelUpdate& update : *work_updates[j]) {
+                updateVoxelValues(
+                    &block.getVoxelByLinearIndex(update.linear_index), update);
+                updated_voxels.set(update.linear_index);
+              }
+              block.setUpdatedAll();
+              submap->recordChangedBlock(item.second);
+              submap->getVoxelMasksPtr()->update(item.second, block,
+                                                 &updated_voxels);
+            }
+          }
+        }));
+  }
+  globals_->threadPool()->waitAll(&threads);
+  int_timer.Stop();
+
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Integrated " << rays.size() << " merged rays into "
+      << index_getter.size() << " blocks.";
+}
+
+std::unordered_map<int, RaycastIntegrator::MergedPoints>
+RaycastIntegrator::mergePoints(const SubmapCollection& submaps,
+                               const InputData& input) const {
+  // Merge tiles of image rows in parallel, the tiles are combined in order.
+  const Camera::Config& camera = globals_->camera()->getConfig();
+  const int free_space_id = submaps.getActiveFreeSpaceSubmapID();
+  const bool has_free_space = submaps.submapIdExists(free_space_id);
+  const size_t chunk_size = config_.integration_chunk_size;
+  const int num_rows = input.depthImage().rows;
+  std::vector<std::unordered_map<int, MergedPoints>> tiles(
+      (num_rows + chunk_size - 1) / chunk_size);
+  std::vector<int> rows(num_rows);
+  std::iota(rows.begin(), rows.end(), 0);
+  ChunkedIndexGetter<int> row_getter(std::move(rows), chunk_size);
+  std::vector<std::future<void>> threads;
+  for (int i = 0; i < config_.integration_threads; ++i) {
+    threads.emplace_back(globals_->threadPool()->submit(
+        [&row_getter, &tiles, &input, &submaps, &camera, chunk_size,
+         free_space_id, has_free_space]() {
+          std::unordered_map<int, Transformation> T_S_C;
+          size_t begin, end;
+          while (row_getter.getNextChunk(&begin, &end)) {
+            std::unordered_map<int, MergedPoints>& tile =
+                tiles[begin / chunk_size];
+            for (size_t j = begin; j < end; ++j) {
+              const int v = row_getter[j];
+              const cv::Vec3f* vertices = input.vertexMap().ptr<cv::Vec3f>(v);
+              const float* ranges = input.rangeImage().ptr<float>(v);
+              const int* ids = input.idImage().ptr<int>(v);
+              const cv::Vec3b* colors = input.colorImage().ptr<cv::Vec3b>(v);
+              for (int u = 0; u < input.depthImage().cols; ++u) {
+                if (ranges[u] > camera.max_range ||
+                    ranges[u] < camera.min_range) {
+                  continue;
+                }
+                const Point p_C(vertices[u][0], vertices[u][1],
+                                vertices[u][2]);
+                // Each ray updates its own submap and the free space.
+                for (const int id : {ids[u], free_space_id}) {
+                  if (id == free_space_id ? !has_free_space
+                                          : !submaps.submapIdExists(id)) {
+                    continue;
+                  }
+                  const Submap& submap = submaps.getSubmap(id);
+                  if (!submap.isActive() ||
+                      (id != free_space_id &&
+                       submap.getLabel() == PanopticLabel::kFreeSpace)) {
+                    continue;
+                  }
+                  auto it = T_S_C.find(id);
+                  if (it == T_S_C.end()) {
+                    it = T_S_C.emplace(id, submap.getT_S_M() * input.T_M_C())
+                             .first;
+                  }
+                  const voxblox::GlobalIndex voxel_index =
+                      voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(
+                          it->second * p_C,
+                          1.f / submap.getTsdfLayer().voxel_size());
+                  MergedPoint& point = tile[id][voxel_index];
+                  point.p_C_sum += p_C;
+                  point.color_sum +=
+                      Eigen::Vector3f(colors[u][2], colors[u][1], colors[u][0]);
+                  point.num_points++;
+                  if (id == free_space_id) {
+                    break;
+                  }
+                }
+              }
+            }
+          }
+        }));
+  }
+  globals_->threadPool()->waitAll(&threads);
+
+  std::unordered_map<int, MergedPoints> result;
+  for (const auto& tile : tiles) {
+    for (const auto& id_points_pair : tile) {
+      MergedPoints& points = result[id_points_pair.first];
+      for (const auto& index_point_pair : id_points_pair.second) {
+        MergedPoint& point = points[index_point_pair.first];
+        point.p_C_sum += index_point_pair.second.p_C_sum;
+        point.color_sum += index_point_pair.second.color_sum;
+        point.num_points += index_point_pair.second.num_points;
+      }
+    }
+  }
+  return result;
+}
+
+void RaycastIntegrator::castRay(const Submap& submap,
+                                const Transformation& T_S_C,
+                                const MergedPoint& point,
+                                bool is_free_space_submap,
+                                BlockUpdates* updates) const {
+  const TsdfLayer& layer = submap.getTsdfLayer();
+  const float voxel_size = layer.voxel_size();
+  const float truncation_distance = submap.getConfig().truncation_distance;
+  const int voxels_per_side = static_cast<int>(layer.voxels_per_side());
+  const Point p_C = point.p_C_sum / point.num_points;
+  const Point origin_S = T_S_C.getPosition();
+  const Point p_S = T_S_C * p_C;
+  const float distance = (p_S - origin_S).norm();
+  const Eigen::Vector3f mean_color = point.color_sum / point.num_points;
+  const Color color(static_cast<uint8_t>(mean_color.x()),
+                    static_cast<uint8_t>(mean_color.y()),
+                    static_cast<uint8_t>(mean_color.z()));
+  const bool store_color =
+      !is_free_space_submap && submap.getConfig().store_color;
+
+  // Only the free space submap is carved from the camera on.
+  const bool carve = is_free_space_submap && config_.voxel_carving;
+  voxblox::RayCaster ray_caster(origin_S, p_S, false, carve,
+                                globals_->camera()->getConfig().max_range,
+                                1.f / voxel_size, truncation_distance);
+  voxblox::GlobalIndex voxel_index;
+  while (ray_caster.nextRayIndex(&voxel_index)) {
+    // Signed distance along the ray, as in voxblox.
+    const Point voxel_center_S =
+        voxblox::getCenterPointFromGridIndex(voxel_index, voxel_size);
+    float sdf =
+        distance - (voxel_center_S - origin_S).dot(p_S - origin_S) / distance;
+    if (sdf < -truncation_distance) {
+      continue;
+    }
+    VoxelUpdate update;
+    update.weight =
+        point.num_points *
+        computeWeight(p_C.z(), voxel_size, truncation_distance, sdf);
+    if (update.weight <= 0.f) {
+      continue;
+    }
+    update.sdf = std::min(sdf, truncation_distance);
+    update.has_color =
+        store_color && std::abs(update.sdf) < truncation_distance;
+    update.color = color;
+    const voxblox::VoxelIndex local_index =
+        voxblox::getLocalFromGlobalVoxelIndex(voxel_index, voxels_per_side);
+    update.linear_index =
+        local_index.x() +
+        voxels_per_side * (local_index.y() + local_index.z() * voxels_per_side);
+    (*updates)[voxblox::getBlockIndexFromGlobalVoxelIndex(
+                   voxel_index, 1.f / voxels_per_side)]
+        .push_back(update);
+  }
+}
+
+float RaycastIntegrator::computeWeight(float z, float voxel_size,
+                                       float truncation_distance,
+                                       float sdf) const {
+  float weight = 1.f;
+
+  // Weight reduction with distance squared (according to sensor noise models).
+  if (!config_.use_constant_weight) {
+    weight /= std::pow(z, 2.f);
+  }
+
+  // Apply weight drop-off if appropriate.
+  if (config_.use_weight_dropoff) {
+    const float dropoff_epsilon =
+        config_.weight_dropoff_epsilon > 0.f
+            ? config_.weight_dropoff_epsilon
+            : config_.weight_dropoff_epsilon * -voxel_size;
+    if (sdf < -dropoff_epsilon) {
+      weight *=
+          (truncation_distance + sdf) / (truncation_distance - dropoff_epsilon);
+      weight = std::max(weight, 0.f);
+    }
+  }
+  return weight;
+}
+
+void RaycastIntegrator::updateVoxelValues(TsdfVoxel* voxel,
+                                          const VoxelUpdate& update) const {
+  // Weighted averaging fusion.
+  voxel->distance =
+      (voxel->distance * voxel->weight + update.sdf * update.weight) /
+      (voxel->weight + update.weight);
+  voxel->weight = std::min(voxel->weight + update.weight, config_.max_weight);
+  if (update.has_color) {
+    voxel->color = Color::blendTwoColors(voxel->color, voxel->weight,
+                                         update.color, update.weight);
+  }
+}
+
+}  // namespace panoptic_mapping
@@ -46,7 +46,8 @@ SingleTsdfIntegrator::SingleTsdfIntegrator(const Config& config,
   // Setup all needed inputs.
   setRequiredInputs({InputData::InputType::kDepthImage,
                      InputData::InputType::kVertexMap,
-                     InputData::InputType::kValidityImage});
+                     InputData::InputType::kValidityImage,
+                     InputData::InputType::kRangeImage});
   if (config_.use_color) {
     addRequiredInputs({InputData::InputType::kColorImage});
   }
@@ -56,6 +57,12 @@ SingleTsdfIntegrator::SingleTsdfIntegrator(const Config& config,
   if (config_.use_uncertainty) {
     addRequiredInputs({InputData::InputType::kUncertaintyImage});
   }
+
+  // There is only one map, which is updated by all rays and whose surface is
+  // colored and classified.
+  voxel_update_rules_.all_rays_update = true;
+  voxel_update_rules_.update_free_space_surface = true;
+  voxel_update_rules_.update_color = config_.use_color;
 }
 
 void SingleTsdfIntegrator::processInput(SubmapCollection* submaps,
@@ -65,7 +72,8 @@ void SingleTsdfIntegrator::processInput(SubmapCollection* submaps,
   CHECK_NOTNULL(globals_->camera().get());
   CHECK(inputIsValid(*input));
 
-  cam_config_ = &(globals_->camera()->getConfig());
+  camera_ = globals_->camera().get();
+  cam_config_ = &(camera_->getConfig());
   Submap* map = submaps->getSubmapPtr(submaps->getActiveFreeSpaceSubmapID());
   // Check classification layer matches the task.
   if (config_.use_uncertainty || config_.use_segmentation) {
@@ -85,36 +93,48 @@ void SingleTsdfIntegrator::processInput(SubmapCollection* submaps,
   // Allocate all blocks in the map.
   auto t1 = std::chrono::high_resolution_clock::now();
   allocateNewBlocks(map, input);
+  buildPlanarImages(*input);
   auto t2 = std::chrono::high_resolution_clock::now();
 
   // Find all active blocks that are in the field of view.
+  const bool use_depth_culling =
+      config_.projective_integrator.use_depth_culling;
+  if (use_depth_culling) {
+    range_pyramid_.build(range_image_);
+  }
   voxblox::BlockIndexList block_lists = globals_->camera()->findVisibleBlocks(
-      *map, input->T_M_C(), max_range_in_image_);
+      *map, input->T_M_C(), max_range_in_image_,
+      use_depth_culling ? &range_pyramid_ : nullptr);
   std::vector<voxblox::BlockIndex> indices;
   indices.resize(block_lists.size());
   for (size_t i = 0; i < indices.size(); ++i) {
     indices[i] = block_lists[i];
   }
-  IndexGetter<voxblox::BlockIndex> index_getter(indices);
+  ChunkedIndexGetter<voxblox::BlockIndex> index_getter(
+      std::move(indices), config_.projective_integrator.integration_chunk_size);
   const Transformation T_C_S = input->T_M_C().inverse() * map->getT_M_S();
+  if (converged_block_tracker_) {
+    converged_block_tracker_->prepare(*submaps);
+  }
 
   // Integrate in parallel.
   std::vector<std::future<void>> threads;
-  for (int i = 0; i < config_.projective_integrator.integration_threads; ++i) {
-    threads.emplace_back(std::async(
-        std::launch::async, [this, &index_getter, map, input, i, T_C_S]() {
-          voxblox::BlockIndex index;
-          while (index_getter.getNextIndex(&index)) {
-            this->updateBlock(map, interpolators_[i].get(), index, T_C_S,
-                              *input);
+  const int num_threads = numIntegrationThreads();
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back(globals_->threadPool()->submit(
+        [this, &index_getter, map, input, i, T_C_S]() {
+          size_t begin, end;
+          while (index_getter.getNextChunk(&begin, &end)) {
+            for (size_t j = begin; j < end; ++j) {
+              this->updateBlock(map, interpolators_[i].get(), index_getter[j],
+                                T_C_S, *input);
+            }
           }
         }));
   }
 
   // Join all threads.
-  for (auto& thread : threads) {
-    thread.get();
-  }
+  globals_->threadPool()->waitAll(&threads);
   auto t3 = std::chrono::high_resolution_clock::now();
 
   LOG_IF(INFO, config_.verbosity >= 3)
@@ -125,110 +145,24 @@ void SingleTsdfIntegrator::processInput(SubmapCollection* submaps,
       << "ms.";
 }
 
-void SingleTsdfIntegrator::updateBlock(Submap* submap,
-                                       InterpolatorBase* interpolator,
-                                       const voxblox::BlockIndex& block_index,
-                                       const Transformation& T_C_S,
-                                       const InputData& input) const {
-  // Set up preliminaries.
-  if (!submap->getTsdfLayer().hasBlock(block_index)) {
-    LOG_IF(WARNING, config_.verbosity >= 1)
-        << "Tried to access inexistent block '" << block_index.transpose()
-        << "' in submap " << submap->getID() << ".";
-    return;
-  }
-  TsdfBlock& block = submap->getTsdfLayerPtr()->getBlockByIndex(block_index);
-  bool was_updated = false;
-  const float voxel_size = block.voxel_size();
-  const float truncation_distance = submap->getConfig().truncation_distance;
-  const int submap_id = submap->getID();
-  ClassBlock::Ptr class_block;
-  const bool use_class_layer =
-      submap->hasClassLayer() && config_.use_segmentation;
-  if (use_class_layer) {
-    if (!submap->getClassLayer().hasBlock(block_index)) {
-      LOG_IF(WARNING, config_.verbosity >= 1)
-          << "Tried to access inexistent class block '"
-          << block_index.transpose() << "' in submap " << submap->getID()
-          << ".";
-      return;
-    }
-    class_block = submap->getClassLayerPtr()->getBlockPtrByIndex(block_index);
-  }
-
-  // Update all voxels.
-  for (size_t i = 0; i < block.num_voxels(); ++i) {
-    TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
-    ClassVoxel* class_voxel = nullptr;
-    if (use_class_layer) {
-      class_voxel = &class_block->getVoxelByLinearIndex(i);
-    }
-    const Point p_C = T_C_S * block.computeCoordinatesFromLinearIndex(
-                                  i);  // Voxel center in camera frame.
-    if (updateVoxel(interpolator, &voxel, p_C, input, submap_id, true,
-                    truncation_distance, voxel_size, class_voxel)) {
-      was_updated = true;
-    }
-  }
-
-  if (was_updated) {
-    block.setUpdatedAll();
-  }
-}
-
-bool SingleTsdfIntegrator::updateVoxel(
-    InterpolatorBase* interpolator, TsdfVoxel* voxel, const Point& p_C,
-    const InputData& input, const int submap_id,
-    const bool is_free_space_submap, const float truncation_distance,
-    const float voxel_size, ClassVoxel* class_voxel) const {
-  // Compute the signed distance. This also sets up the interpolator.
-  float sdf;
-  if (!computeSignedDistance(p_C, interpolator, &sdf)) {
-    return false;
-  }
-  if (sdf < -truncation_distance) {
-    return false;
-  }
-
-  // Compute the weight of the measurement.
-  const float weight = computeWeight(p_C, voxel_size, truncation_distance, sdf);
-
-  // Truncate the sdf to the truncation band.
-  sdf = std::min(truncation_distance, sdf);
-
-  // Only merge color and semantics near the surface.
-  if (std::abs(sdf) < truncation_distance) {
-    const Color color = interpolator->interpolateColor(input.colorImage());
-    updateVoxelValues(voxel, sdf, weight, &color);
-
-    // Update the semantic information if requested.
-    if (class_voxel) {
-      // Uncertainty voxels are handled differently.
-      if (config_.use_uncertainty &&
-          class_voxel->getVoxelType() == ClassVoxelType::kUncertainty) {
-        updateUncertaintyVoxel(interpolator, input,
-                               static_cast<UncertaintyVoxel*>(class_voxel));
-      } else {
-        updateClassVoxel(interpolator, input, class_voxel);
-      }
-    }
-  } else {
-    updateVoxelValues(voxel, sdf, weight);
-  }
-  return true;
-}
-
 void SingleTsdfIntegrator::updateClassVoxel(InterpolatorBase* interpolator,
                                             const InputData& input,
+                                            const int id, const int submap_id,
                                             ClassVoxel* class_voxel) const {
+  // Uncertainty voxels are handled differently.
+  if (config_.use_uncertainty &&
+      class_voxel->getVoxelType() == ClassVoxelType::kUncertainty) {
+    updateUncertaintyVoxel(interpolator, input, id,
+                           static_cast<UncertaintyVoxel*>(class_voxel));
+    return;
+  }
   // For the single TSDF case there is no belonging submap, just use the ID
   // directly.
-  const int id = interpolator->interpolateID(input.idImage());
   class_voxel->incrementCount(id);
 }
 
 void SingleTsdfIntegrator::updateUncertaintyVoxel(
-    InterpolatorBase* interpolator, const InputData& input,
+    InterpolatorBase* interpolator, const InputData& input, const int id,
     UncertaintyVoxel* class_voxel) const {
   // Do not update voxels which are assigned as groundtruth.
   if (class_voxel->is_ground_truth) {
@@ -243,8 +177,8 @@ void SingleTsdfIntegrator::updateUncertaintyVoxel(
   // TODO(zrene) find a better way to implement this.
   if (uncertainty == -1.0) {
     // Make sure GT voxels have zero uncertainty and entropy.
-    class_voxel->counts =
-        std::vector<ClassificationCount>(FixedCountVoxel::numCounts());
+    class_voxel->counts.assign(std::max<size_t>(class_voxel->counts.size(), 1u),
+                               0u);
     // Update classification part.
     class_voxel->is_ground_truth = true;
     class_voxel->uncertainty = 0.f;
@@ -254,8 +188,7 @@ void SingleTsdfIntegrator::updateUncertaintyVoxel(
         config_.uncertainty_decay_rate * uncertainty +
         (1.f - config_.uncertainty_decay_rate) * class_voxel->uncertainty;
   }
-
-  updateClassVoxel(interpolator, input, class_voxel);
+  class_voxel->incrementCount(id);
 }
 
 void SingleTsdfIntegrator::allocateNewBlocks(Submap* map, InputData* input) {
@@ -266,10 +199,10 @@ void SingleTsdfIntegrator::allocateNewBlocks(Submap* map, InputData* input) {
   const Transformation T_S_C = map->getT_S_M() * input->T_M_C();
   // Parse through each point to reset the depth image.
   for (int v = 0; v < input->depthImage().rows; v++) {
+    computeInterpolationMaskRow(*input, v);
+    const float* ranges = input->rangeImage().ptr<float>(v);
     for (int u = 0; u < input->depthImage().cols; u++) {
-      const cv::Vec3f& vertex = input->vertexMap().at<cv::Vec3f>(v, u);
-      const Point p_C(vertex[0], vertex[1], vertex[2]);
-      const float ray_distance = p_C.norm();
+      const float ray_distance = ranges[u];
       range_image_(v, u) = ray_distance;
       max_range_in_image_ = std::max(max_range_in_image_, ray_distance);
     }
@@ -283,6 +216,7 @@ void SingleTsdfIntegrator::allocateNewBlocks(Submap* map, InputData* input) {
   const Point camera_S = T_S_C.getPosition();  // T_S_C
   const int max_steps = std::floor((max_range_in_image_ + block_diag_half) /
                                    map->getTsdfLayer().block_size());
+  voxblox::IndexSet block_indices;
   for (int x = -max_steps; x <= max_steps; ++x) {
     for (int y = -max_steps; y <= max_steps; ++y) {
       for (int z = -max_steps; z <= max_steps; ++z) {
@@ -290,17 +224,21 @@ void SingleTsdfIntegrator::allocateNewBlocks(Submap* map, InputData* input) {
         const Point candidate_S = camera_S + offset * block_size;
         if (globals_->camera()->pointIsInViewFrustum(T_C_S * candidate_S,
                                                      block_diag_half)) {
-          map->getTsdfLayerPtr()->allocateBlockPtrByCoordinates(candidate_S);
-          if (map->hasClassLayer()) {
-            map->getClassLayerPtr()->allocateBlockPtrByCoordinates(candidate_S);
-          }
+          block_indices.insert(
+              map->getTsdfLayer().computeBlockIndexFromCoordinates(
+                  candidate_S));
         }
       }
     }
   }
+  map->expandCollapsedBlocks(block_indices);
+  map->prepareLayersForUpdate();
+  for (const BlockIndex& block_index : block_indices) {
+    map->allocateBlocks(block_index);
+  }
 
-  // Update the bounding volume.
-  map->updateBoundingVolume();
+  // Expand the bounding volume by the allocated blocks.
+  map->updateBoundingVolume(block_indices);
 }
 
 }  // namespace panoptic_mapping
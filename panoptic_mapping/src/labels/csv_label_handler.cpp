@@ -33,6 +33,7 @@ CsvLabelHandler::CsvLabelHandler(const Config& config, bool print_config)
                                                        << config_.toString();
   // Setup the labels from csv file.
   readLabelsFromFile();
+  buildLookupTable();
 }
 
 void CsvLabelHandler::readLabelsFromFile() {
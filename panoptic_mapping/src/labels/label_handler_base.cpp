@@ -1,55 +1,57 @@
 #include "panoptic_mapping/labels/label_handler_base.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
 
 namespace panoptic_mapping {
 
 bool LabelHandlerBase::segmentationIdExists(int segmentation_id) const {
-  return labels_.find(segmentation_id) != labels_.end();
+  return findLabel(segmentation_id) != nullptr;
 }
 
 int LabelHandlerBase::getClassID(int segmentation_id) const {
-  return labels_.at(segmentation_id)->class_id;
+  return lookupLabel(segmentation_id).class_id;
 }
 
 bool LabelHandlerBase::isBackgroundClass(int segmentation_id) const {
-  return labels_.at(segmentation_id)->label == PanopticLabel::kBackground;
+  return lookupLabel(segmentation_id).label == PanopticLabel::kBackground;
 }
 
 bool LabelHandlerBase::isInstanceClass(int segmentation_id) const {
-  return labels_.at(segmentation_id)->label == PanopticLabel::kInstance;
+  return lookupLabel(segmentation_id).label == PanopticLabel::kInstance;
 }
 
 bool LabelHandlerBase::isUnknownClass(int segmentation_id) const {
-  return labels_.at(segmentation_id)->label == PanopticLabel::kUnknown;
+  return lookupLabel(segmentation_id).label == PanopticLabel::kUnknown;
 }
 
 bool LabelHandlerBase::isSpaceClass(int segmentation_id) const {
-  return labels_.at(segmentation_id)->label == PanopticLabel::kFreeSpace;
+  return lookupLabel(segmentation_id).label == PanopticLabel::kFreeSpace;
 }
 
 PanopticLabel LabelHandlerBase::getPanopticLabel(int segmentation_id) const {
-  return labels_.at(segmentation_id)->label;
+  return lookupLabel(segmentation_id).label;
 }
 
 const voxblox::Color& LabelHandlerBase::getColor(int segmentation_id) const {
-  return labels_.at(segmentation_id)->color;
+  return lookupLabel(segmentation_id).color;
 }
 
 const std::string& LabelHandlerBase::getName(int segmentation_id) const {
-  return labels_.at(segmentation_id)->name;
+  return lookupLabel(segmentation_id).name;
 }
 
 const LabelEntry& LabelHandlerBase::getLabelEntry(int segmentation_id) const {
-  return *labels_.at(segmentation_id);
+  return lookupLabel(segmentation_id);
 }
 
 bool LabelHandlerBase::getLabelEntryIfExists(int segmentation_id,
                                              LabelEntry* label_entry) const {
-  auto it = labels_.find(segmentation_id);
-  if (it != labels_.end()) {
+  const LabelEntry* entry = findLabel(segmentation_id);
+  if (entry) {
     CHECK_NOTNULL(label_entry);
-    *label_entry = *it->second;
+    *label_entry = *entry;
     return true;
   }
   return false;
@@ -57,4 +59,48 @@ bool LabelHandlerBase::getLabelEntryIfExists(int segmentation_id,
 
 size_t LabelHandlerBase::numberOfLabels() const { return labels_.size(); }
 
+void LabelHandlerBase::buildLookupTable() {
+  use_lookup_table_ = false;
+  lookup_table_.clear();
+  if (labels_.empty()) {
+    return;
+  }
+  int min_id = labels_.begin()->first;
+  int max_id = min_id;
+  for (const auto& id_label : labels_) {
+    min_id = std::min(min_id, id_label.first);
+    max_id = std::max(max_id, id_label.first);
+  }
+  if (static_cast<int64_t>(max_id) - min_id + 1 > kMaxLookupTableSize) {
+    // Too sparse, keep using the hash map.
+    return;
+  }
+  min_id_ = min_id;
+  lookup_table_.assign(max_id - min_id + 1, nullptr);
+  for (const auto& id_label : labels_) {
+    lookup_table_[id_label.first - min_id_] = id_label.second.get();
+  }
+  use_lookup_table_ = true;
+}
+
+const LabelEntry* LabelHandlerBase::findLabel(int segmentation_id) const {
+  if (use_lookup_table_) {
+    const int64_t offset = static_cast<int64_t>(segmentation_id) - min_id_;
+    return offset >= 0 && offset < static_cast<int64_t>(lookup_table_.size())
+               ? lookup_table_[offset]
+               : nullptr;
+  }
+  auto it = labels_.find(segmentation_id);
+  return it == labels_.end() ? nullptr : it->second.get();
+}
+
+const LabelEntry& LabelHandlerBase::lookupLabel(int segmentation_id) const {
+  const LabelEntry* entry = findLabel(segmentation_id);
+  if (entry) {
+    return *entry;
+  }
+  // Keeps the previous behavior of throwing for unknown IDs.
+  return *labels_.at(segmentation_id);
+}
+
 }  // namespace panoptic_mapping
@@ -26,10 +26,11 @@ RangeLabelHandler::RangeLabelHandler(const Config& config, bool print_config)
                                                        << config_.toString();
   // Setup the labels from range.
   initialiseLabels();
+  buildLookupTable();
 }
 
 void RangeLabelHandler::initialiseLabels() {
-  for (int i; i < config_.num_labels; i++) {
+  for (int i = 0; i < config_.num_labels; i++) {
     LabelEntry label;
     label.segmentation_id = i;
     label.class_id = i;
@@ -0,0 +1,195 @@
+#include "panoptic_mapping/map/background_mesher.h"
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/map/layer_snapshot.h"
+
+namespace panoptic_mapping {
+
+void BackgroundMesher::Config::checkParams() const {}
+
+void BackgroundMesher::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("use_class_layer", &use_class_layer);
+}
+
+BackgroundMesher::BackgroundMesher(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+  thread_ = std::thread(&BackgroundMesher::meshingLoop, this);
+}
+
+BackgroundMesher::~BackgroundMesher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  condition_.notify_all();
+  thread_.join();
+}
+
+size_t BackgroundMesher::capture(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  synchronize(submaps);
+  Timer timer("background_mesher/capture");
+  std::vector<Capture> captures;
+  std::unordered_map<int, Snapshot> snapshots;
+  size_t num_blocks = 0;
+  for (Submap& submap : *submaps) {
+    if (!submap.isActive()) {
+      continue;
+    }
+    const int submap_id = submap.getID();
+    const TsdfLayer& tsdf_layer = submap.getTsdfLayer();
+    voxblox::BlockIndexList dirty_blocks;
+    tsdf_layer.getAllUpdatedBlocks(voxblox::Update::Status::kMesh,
+                                   &dirty_blocks);
+    auto previous_it = snapshots_.find(submap_id);
+    if (dirty_blocks.empty()) {
+      if (previous_it != snapshots_.end()) {
+        snapshots.emplace(submap_id, std::move(previous_it->second));
+      }
+      continue;
+    }
+
+    // Snapshot the layers, sharing all clean blocks with the previous one.
+    // All blocks that changed since the previous capture are flagged dirty.
+    const Snapshot previous = previous_it != snapshots_.end()
+                                  ? std::move(previous_it->second)
+                                  : Snapshot();
+    const voxblox::IndexSet changed_blocks(dirty_blocks.begin(),
+                                           dirty_blocks.end());
+    Snapshot& snapshot = snapshots[submap_id];
+    snapshot.tsdf = std::make_shared<TsdfLayer>(tsdf_layer.voxel_size(),
+                                                tsdf_layer.voxels_per_side());
+    snapshotLayer(tsdf_layer, previous.tsdf.get(), changed_blocks,
+                  snapshot.tsdf.get());
+    if (config_.use_class_layer && submap.hasClassLayer()) {
+      snapshot.classification = submap.getClassLayer().snapshot(
+          previous.classification.get(), changed_blocks);
+    }
+
+    Capture& capture = captures.emplace_back();
+    capture.submap_id = submap_id;
+    capture.snapshot = snapshot;
+    capture.mesh_config = submap.getConfig().mesh;
+    capture.truncation_distance = submap.getConfig().truncation_distance;
+    capture.generations.reserve(dirty_blocks.size());
+    for (const BlockIndex& index : dirty_blocks) {
+      capture.generations.push_back(submap.getMeshGeneration(index));
+    }
+    capture.blocks = std::move(dirty_blocks);
+
+    // Swap the dirty sets: blocks integrated from now on are flagged anew.
+    TsdfLayer& live_layer = *submap.getTsdfLayerPtr();
+    for (const BlockIndex& index : capture.blocks) {
+      live_layer.getBlockByIndex(index).setUpdated(
+          voxblox::Update::Status::kMesh, false);
+    }
+    num_blocks += capture.blocks.size();
+  }
+
+  // Snapshots of submaps that are no longer active are released.
+  snapshots_ = std::move(snapshots);
+  if (captures.empty()) {
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    captures_ = std::move(captures);
+    has_work_ = true;
+    ++sequence_;
+  }
+  condition_.notify_all();
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Captured " << num_blocks << " blocks for background meshing.";
+  return num_blocks;
+}
+
+size_t BackgroundMesher::synchronize(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  Timer timer("background_mesher/synchronize");
+  std::vector<Capture> captures;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]() { return !has_work_ && !is_meshing_; });
+    captures.swap(captures_);
+  }
+
+  size_t num_updated = 0;
+  for (Capture& capture : captures) {
+    if (!capture.meshes || !submaps->submapIdExists(capture.submap_id)) {
+      continue;
+    }
+    Submap* submap = submaps->getSubmapPtr(capture.submap_id);
+    const TsdfLayer& tsdf_layer = submap->getTsdfLayer();
+    voxblox::BlockIndexList blocks;
+    for (size_t i = 0; i < capture.blocks.size(); ++i) {
+      // Skip blocks that were removed or re-meshed since the capture.
+      const BlockIndex& index = capture.blocks[i];
+      if (tsdf_layer.hasBlock(index) &&
+          submap->getMeshGeneration(index) == capture.generations[i]) {
+        blocks.push_back(index);
+      }
+    }
+    num_updated += submap->setMeshBlocks(capture.meshes.get(), blocks);
+  }
+  LOG_IF(INFO, config_.verbosity >= 3 && !captures.empty())
+      << "Updated " << num_updated << " block meshes of capture " << sequence_
+      << ".";
+  return num_updated;
+}
+
+void BackgroundMesher::reset() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  condition_.wait(lock, [this]() { return !has_work_ && !is_meshing_; });
+  captures_.clear();
+  snapshots_.clear();
+}
+
+void BackgroundMesher::meshingLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    condition_.wait(lock, [this]() { return has_work_ || shutdown_; });
+    if (shutdown_) {
+      return;
+    }
+    has_work_ = false;
+    is_meshing_ = true;
+    std::vector<Capture> captures;
+    captures.swap(captures_);
+    lock.unlock();
+
+    {
+      Timer timer("background_mesher/meshing");
+      for (Capture& capture : captures) {
+        meshCapture(&capture);
+      }
+    }
+
+    lock.lock();
+    captures_ = std::move(captures);
+    is_meshing_ = false;
+    condition_.notify_all();
+  }
+}
+
+void BackgroundMesher::meshCapture(Capture* capture) const {
+  capture->meshes =
+      std::make_shared<MeshLayer>(capture->snapshot.tsdf->block_size());
+  MeshIntegrator mesh_integrator(
+      capture->mesh_config, capture->snapshot.tsdf, capture->meshes,
+      capture->snapshot.classification, capture->truncation_distance);
+  // The snapshot blocks are shared with later snapshots and thus keep their
+  // flags.
+  for (const BlockIndex& index : mesh_integrator.prepareMeshGeneration(
+           capture->blocks, capture->snapshot.classification != nullptr)) {
+    mesh_integrator.generateMeshBlock(index, false);
+  }
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,144 @@
+#include "panoptic_mapping/map/change_feed.h"
+
+#include <utility>
+
+namespace panoptic_mapping {
+
+namespace {
+
+void addBlockChange(const BlockIndex& index, ChangeFeed::BlockChange change,
+                    MapChangeSet::BlockChanges* blocks) {
+  switch (change) {
+    case ChangeFeed::BlockChange::kCreated:
+      // Blocks removed and created again within a change set were replaced.
+      if (blocks->removed.erase(index) == 0) {
+        blocks->created.insert(index);
+      } else {
+        blocks->updated.insert(index);
+      }
+      break;
+    case ChangeFeed::BlockChange::kUpdated:
+      blocks->updated.insert(index);
+      break;
+    case ChangeFeed::BlockChange::kRemoved:
+      // Blocks created and removed within a change set are not reported.
+      if (blocks->created.erase(index) == 0) {
+        blocks->removed.insert(index);
+      }
+      blocks->updated.erase(index);
+      break;
+  }
+}
+
+void addRemovedSubmap(int submap_id, MapChangeSet* changes) {
+  // Submaps created and removed within a change set are not reported.
+  if (changes->created_submaps.erase(submap_id) == 0) {
+    changes->removed_submaps.insert(submap_id);
+  }
+  changes->blocks.erase(submap_id);
+  changes->finished_submaps.erase(submap_id);
+  changes->moved_submaps.erase(submap_id);
+  changes->change_state_submaps.erase(submap_id);
+}
+
+}  // namespace
+
+bool MapChangeSet::empty() const {
+  return blocks.empty() && created_submaps.empty() &&
+         removed_submaps.empty() && finished_submaps.empty() &&
+         moved_submaps.empty() && change_state_submaps.empty();
+}
+
+void MapChangeSet::merge(const MapChangeSet& later) {
+  sequence_number = later.sequence_number;
+  for (const int submap_id : later.removed_submaps) {
+    addRemovedSubmap(submap_id, this);
+  }
+  created_submaps.insert(later.created_submaps.begin(),
+                         later.created_submaps.end());
+  for (const auto& id_blocks_pair : later.blocks) {
+    BlockChanges& blocks = this->blocks[id_blocks_pair.first];
+    for (const BlockIndex& index : id_blocks_pair.second.created) {
+      addBlockChange(index, ChangeFeed::BlockChange::kCreated, &blocks);
+    }
+    for (const BlockIndex& index : id_blocks_pair.second.updated) {
+      addBlockChange(index, ChangeFeed::BlockChange::kUpdated, &blocks);
+    }
+    for (const BlockIndex& index : id_blocks_pair.second.removed) {
+      addBlockChange(index, ChangeFeed::BlockChange::kRemoved, &blocks);
+    }
+  }
+  finished_submaps.insert(later.finished_submaps.begin(),
+                          later.finished_submaps.end());
+  moved_submaps.insert(later.moved_submaps.begin(),
+                       later.moved_submaps.end());
+  change_state_submaps.insert(later.change_state_submaps.begin(),
+                              later.change_state_submaps.end());
+}
+
+int ChangeFeed::subscribe(Callback callback) {
+  CHECK(callback);
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  const int id = next_subscription_id_++;
+  subscribers_[id] = std::move(callback);
+  has_subscribers_ = true;
+  return id;
+}
+
+void ChangeFeed::unsubscribe(int subscription_id) {
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  subscribers_.erase(subscription_id);
+  has_subscribers_ = !subscribers_.empty();
+}
+
+void ChangeFeed::recordBlock(int submap_id, const BlockIndex& index,
+                             BlockChange change) {
+  if (!has_subscribers_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  addBlockChange(index, change, &pending_.blocks[submap_id]);
+}
+
+void ChangeFeed::recordSubmap(int submap_id, SubmapChange change) {
+  if (!has_subscribers_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  switch (change) {
+    case SubmapChange::kCreated:
+      pending_.created_submaps.insert(submap_id);
+      break;
+    case SubmapChange::kRemoved:
+      addRemovedSubmap(submap_id, &pending_);
+      break;
+    case SubmapChange::kFinished:
+      pending_.finished_submaps.insert(submap_id);
+      break;
+    case SubmapChange::kMoved:
+      pending_.moved_submaps.insert(submap_id);
+      break;
+    case SubmapChange::kChangeState:
+      pending_.change_state_submaps.insert(submap_id);
+      break;
+  }
+}
+
+void ChangeFeed::publish() {
+  MapChangeSet changes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty()) {
+      return;
+    }
+    changes = std::move(pending_);
+    pending_ = MapChangeSet();
+    pending_.sequence_number = changes.sequence_number + 1;
+  }
+  std::lock_guard<std::mutex> lock(subscribers_mutex_);
+  for (const auto& id_callback_pair : subscribers_) {
+    id_callback_pair.second(changes);
+  }
+}
+
+}  // namespace panoptic_mapping
@@ -54,25 +54,32 @@ bool BinaryCountVoxel::mergeVoxel(const ClassVoxel& other) {
         << "Can not merge voxels that are not of same type (BinaryCountVoxel).";
     return false;
   }
+  return mergeVoxel(*voxel);
+}
+
+bool BinaryCountVoxel::mergeVoxel(const BinaryCountVoxel& other) {
   // No averaging is performed here. This inflates the number of total counts
   // but keeps the accuracy higher.
-  belongs_count += voxel->belongs_count;
-  foreign_count += voxel->foreign_count;
+  belongs_count += other.belongs_count;
+  foreign_count += other.foreign_count;
   return true;
 }
 
-std::vector<uint32_t> BinaryCountVoxel::serializeVoxelToInt() const {
+size_t BinaryCountVoxel::getSerializedSize() const { return 1u; }
+
+size_t BinaryCountVoxel::serializeVoxelToBuffer(uint32_t* data) const {
   // Assumes uint16 for counting data. Simply pack both values into a single
   // uint32 via bitshift.
-  return {int32FromTwoInt16(belongs_count, foreign_count)};
+  data[0] = int32FromTwoInt16(belongs_count, foreign_count);
+  return 1u;
 }
 
-bool BinaryCountVoxel::deseriliazeVoxelFromInt(
-    const std::vector<uint32_t>& data, size_t* data_index) {
-  if (*data_index >= data.size()) {
+bool BinaryCountVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
+  if (*data_index >= size) {
     LOG(WARNING)
         << "Can not deserialize voxel from integer data: Out of range (index: "
-        << *data_index << ", data: " << data.size() << ")";
+        << *data_index << ", data: " << size << ")";
     return false;
   }
   const std::pair<uint16_t, uint16_t> datum =
@@ -100,6 +107,11 @@ std::unique_ptr<ClassLayer> BinaryCountLayer::clone() const {
   return std::make_unique<BinaryCountLayer>(*this);
 }
 
+std::unique_ptr<ClassLayer> BinaryCountLayer::cloneEmpty() const {
+  return std::make_unique<BinaryCountLayer>(config_, voxel_size(),
+                                            voxels_per_side());
+}
+
 std::unique_ptr<ClassLayer> BinaryCountLayer::loadFromStream(
     const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
     uint64_t* /* tmp_byte_offset_ptr */) {
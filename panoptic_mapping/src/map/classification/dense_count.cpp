@@ -0,0 +1,679 @@
+#include "panoptic_mapping/map/classification/dense_count.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "panoptic_mapping/tools/serialization.h"
+
+namespace panoptic_mapping {
+
+namespace {
+
+// Number of counts stored per voxel, small label sets use fixed sizes such
+// that the reductions below are specialized at compile time.
+size_t paddedNumCounts(size_t num_counts) {
+  if (num_counts == 0u) {
+    return 0u;
+  } else if (num_counts <= 8u) {
+    return 8u;
+  } else if (num_counts <= 32u) {
+    return 32u;
+  } else if (num_counts <= 64u) {
+    return 64u;
+  }
+  return num_counts;
+}
+
+template <size_t kStride>
+void addCounts(const ClassificationCount* source, ClassificationCount* target,
+               size_t /* num_counts */) {
+  for (size_t i = 0; i < kStride; ++i) {
+    target[i] += source[i];
+  }
+}
+
+template <>
+void addCounts<0>(const ClassificationCount* source,
+                  ClassificationCount* target, size_t num_counts) {
+  for (size_t i = 0; i < num_counts; ++i) {
+    target[i] += source[i];
+  }
+}
+
+template <size_t kStride>
+void findMaxCount(const ClassificationCount* counts, size_t /* num_counts */,
+                  ClassificationCount* max_count, int* max_index) {
+  for (size_t i = 0; i < kStride; ++i) {
+    if (counts[i] > *max_count) {
+      *max_count = counts[i];
+      *max_index = i;
+    }
+  }
+}
+
+template <>
+void findMaxCount<0>(const ClassificationCount* counts, size_t num_counts,
+                     ClassificationCount* max_count, int* max_index) {
+  for (size_t i = 0; i < num_counts; ++i) {
+    if (counts[i] > *max_count) {
+      *max_count = counts[i];
+      *max_index = i;
+    }
+  }
+}
+
+}  // namespace
+
+ClassVoxelType DenseCountVoxel::getVoxelType() const {
+  return ClassVoxelType::kDenseCount;
+}
+
+bool DenseCountVoxel::isObserverd() const { return block_->isObserved(index_); }
+
+bool DenseCountVoxel::belongsToSubmap() const {
+  // The current index keeps track of the highest count, zero is usually
+  // reserved for the belonging submap.
+  return block_->getBelongingID(index_) == 0;
+}
+
+float DenseCountVoxel::getBelongingProbability() const {
+  if (!block_->isObserved(index_)) {
+    return 0.f;
+  }
+  return static_cast<float>(block_->getCount(index_, 0)) /
+         static_cast<float>(block_->getTotalCount(index_));
+}
+
+int DenseCountVoxel::getBelongingID() const {
+  return block_->getBelongingID(index_);
+}
+
+float DenseCountVoxel::getProbability(const int id) const {
+  if (id < 0 || id >= static_cast<int>(block_->numCounts()) ||
+      !block_->isObserved(index_)) {
+    return 0.f;
+  }
+  return static_cast<float>(block_->getCount(index_, id)) /
+         static_cast<float>(block_->getTotalCount(index_));
+}
+
+void DenseCountVoxel::incrementCount(const int id, const float weight) {
+  block_->incrementCount(index_, id);
+}
+
+bool DenseCountVoxel::mergeVoxel(const ClassVoxel& other) {
+  // Check type compatibility.
+  auto voxel = dynamic_cast<const DenseCountVoxel*>(&other);
+  if (!voxel) {
+    LOG(WARNING)
+        << "Can not merge voxels that are not of same type (DenseCountVoxel).";
+    return false;
+  }
+  return block_->mergeVoxel(index_, *voxel->block_, voxel->index_);
+}
+
+size_t DenseCountVoxel::getSerializedSize() const {
+  const size_t num_counts =
+      block_->isObserved(index_) ? block_->numCounts() : 0u;
+  return (num_counts + 3u) / 2u;
+}
+
+size_t DenseCountVoxel::serializeVoxelToBuffer(uint32_t* data) const {
+  // Same format as the FixedCountVoxel: The number of counts followed by all
+  // values, unobserved voxels store no counts.
+  const size_t num_counts =
+      block_->isObserved(index_) ? block_->numCounts() : 0u;
+  const size_t length = (num_counts + 3u) / 2u;
+  data[0] = num_counts;
+  for (size_t i = 1; i < num_counts; i += 2u) {
+    data[i / 2 + 1] = int32FromTwoInt16(block_->getCount(index_, i - 1),
+                                        block_->getCount(index_, i));
+  }
+  if (num_counts % 2 != 0) {
+    data[length - 1] =
+        int32FromTwoInt16(block_->getCount(index_, num_counts - 1), 0u);
+  }
+  return length;
+}
+
+bool DenseCountVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
+  if (*data_index >= size) {
+    LOG(WARNING)
+        << "Can not deserialize voxel from integer data: Out of range (index: "
+        << *data_index << ", data: " << size << ")";
+    return false;
+  }
+
+  // Check number of counts to load.
+  const size_t num_counts = data[*data_index];
+  const size_t length = (num_counts + 3u) / 2u;
+  if (*data_index + length > size) {
+    LOG(WARNING) << "Can not deserialize voxel from integer data: Not enough "
+                    "data (index: "
+                 << (*data_index + length - 1) << ", data: " << size << ")";
+    return false;
+  }
+  if (num_counts == 0u) {
+    // Unobserved voxel.
+    *data_index += length;
+    return true;
+  }
+  if (!block_->reserveCounts(num_counts)) {
+    LOG(WARNING) << "Can not deserialize DenseCountVoxel with " << num_counts
+                 << " counts into a block with " << block_->numCounts()
+                 << " counts.";
+    return false;
+  }
+
+  // Load data.
+  block_->allocateCounts();
+  ClassificationCount* counts = &block_->counts_[index_ * block_->stride_];
+  std::fill(counts, counts + block_->stride_, 0u);
+  ClassificationCount total_count = 0;
+  std::pair<uint16_t, uint16_t> datum;
+  for (size_t i = 0; i < num_counts; ++i) {
+    if (i % 2 == 0) {
+      datum = twoInt16FromInt32(data[*data_index + 1u + i / 2u]);
+      counts[i] = datum.first;
+    } else {
+      counts[i] = datum.second;
+    }
+    total_count += counts[i];
+  }
+  block_->total_counts_[index_] = total_count;
+  block_->updateCurrentCount(index_);
+  *data_index += length;
+  return true;
+}
+
+DenseCountBlock::DenseCountBlock(const Point& origin, size_t voxels_per_side,
+                                 FloatingPoint voxel_size, size_t num_counts)
+    : origin_(origin),
+      voxels_per_side_(voxels_per_side),
+      voxel_size_(voxel_size),
+      voxel_size_inv_(1.f / voxel_size),
+      fixed_num_counts_(num_counts),
+      num_counts_(num_counts),
+      stride_(paddedNumCounts(num_counts)) {
+  const size_t num_voxels =
+      voxels_per_side_ * voxels_per_side_ * voxels_per_side_;
+  voxels_.reserve(num_voxels);
+  for (size_t i = 0; i < num_voxels; ++i) {
+    voxels_.emplace_back(this, i);
+  }
+}
+
+DenseCountBlock::DenseCountBlock(const DenseCountBlock& other)
+    : DenseCountBlock(other.origin_, other.voxels_per_side_, other.voxel_size_,
+                      other.fixed_num_counts_) {
+  // The voxel handles need to refer to this block, so only the data is copied.
+  num_counts_ = other.num_counts_;
+  stride_ = other.stride_;
+  counts_ = other.counts_;
+  total_counts_ = other.total_counts_;
+  current_counts_ = other.current_counts_;
+  current_indices_ = other.current_indices_;
+  updated_ = other.updated_;
+}
+
+void DenseCountBlock::allocateCounts() {
+  if (hasData()) {
+    return;
+  }
+  // Allocate the full block at once so no re-allocation happens later.
+  counts_.assign(num_voxels() * stride_, 0u);
+  total_counts_.assign(num_voxels(), 0u);
+  current_counts_.assign(num_voxels(), 0u);
+  current_indices_.assign(num_voxels(), 0);
+}
+
+bool DenseCountBlock::reserveCounts(size_t num_counts) {
+  if (num_counts <= num_counts_) {
+    return true;
+  }
+  if (hasFixedNumCounts()) {
+    return false;
+  }
+  num_counts_ = num_counts;
+  const size_t stride = paddedNumCounts(num_counts);
+  if (stride == stride_) {
+    return true;
+  }
+  if (hasData()) {
+    // Copy the existing counts to the wider layout.
+    std::vector<ClassificationCount> counts(num_voxels() * stride, 0u);
+    for (size_t i = 0; i < num_voxels(); ++i) {
+      std::copy(counts_.begin() + i * stride_,
+                counts_.begin() + (i + 1) * stride_,
+                counts.begin() + i * stride);
+    }
+    counts_ = std::move(counts);
+  }
+  stride_ = stride;
+  return true;
+}
+
+void DenseCountBlock::incrementCount(size_t index, int id) {
+  if (id < 0 || !reserveCounts(id + 1)) {
+    LOG(WARNING) << "Tried to increment count for ID " << id
+                 << ", which is out of range [0-" << num_counts_ << "].";
+    return;
+  }
+  allocateCounts();
+  const ClassificationCount new_count = ++counts_[index * stride_ + id];
+  if (new_count > current_counts_[index]) {
+    current_indices_[index] = id;
+    current_counts_[index] = new_count;
+  }
+  ++total_counts_[index];
+}
+
+void DenseCountBlock::updateCurrentCount(size_t index) {
+  const ClassificationCount* counts = &counts_[index * stride_];
+  ClassificationCount* max_count = &current_counts_[index];
+  int* max_index = &current_indices_[index];
+  *max_index = -1;
+  *max_count = 0;
+  switch (stride_) {
+    case 8u:
+      findMaxCount<8>(counts, num_counts_, max_count, max_index);
+      break;
+    case 32u:
+      findMaxCount<32>(counts, num_counts_, max_count, max_index);
+      break;
+    case 64u:
+      findMaxCount<64>(counts, num_counts_, max_count, max_index);
+      break;
+    default:
+      findMaxCount<0>(counts, num_counts_, max_count, max_index);
+  }
+}
+
+bool DenseCountBlock::mergeBlock(const ClassBlock& other,
+                                 const VoxelMask& merge_voxels,
+                                 const VoxelMask& copy_voxels) {
+  const auto* other_block = dynamic_cast<const DenseCountBlock*>(&other);
+  if (!other_block) {
+    LOG(WARNING) << "Can not merge class blocks that are not of same type "
+                    "(DenseCountBlock).";
+    return false;
+  }
+  bool success = true;
+  merge_voxels.forEach([&](size_t i) {
+    success = mergeVoxel(i, *other_block, i) && success;
+  });
+  copy_voxels.forEach(
+      [&](size_t i) { success = copyVoxel(i, *other_block, i) && success; });
+  return success;
+}
+
+bool DenseCountBlock::mergeVoxel(size_t index, const DenseCountBlock& other,
+                                 size_t other_index) {
+  // Same as for the FixedCountVoxel the belonging submap is at index 0 for
+  // both voxels, so all counts are merged directly.
+  if (!other.isObserved(other_index)) {
+    return true;
+  }
+  if (!reserveCounts(other.numCounts())) {
+    LOG(WARNING) << "Can not merge DenseCount Voxels of different sizes ("
+                 << numCounts() << " vs " << other.numCounts() << ").";
+    return false;
+  }
+  allocateCounts();
+  const ClassificationCount* source =
+      &other.counts_[other_index * other.stride_];
+  ClassificationCount* target = &counts_[index * stride_];
+  switch (stride_ == other.stride_ ? stride_ : 0u) {
+    case 8u:
+      addCounts<8>(source, target, 8u);
+      break;
+    case 32u:
+      addCounts<32>(source, target, 32u);
+      break;
+    case 64u:
+      addCounts<64>(source, target, 64u);
+      break;
+    default:
+      addCounts<0>(source, target, other.numCounts());
+  }
+  total_counts_[index] += other.total_counts_[other_index];
+  updateCurrentCount(index);
+  return true;
+}
+
+bool DenseCountBlock::copyVoxel(size_t index, const DenseCountBlock& other,
+                                size_t other_index) {
+  if (!other.isObserved(other_index)) {
+    if (isObserved(index)) {
+      std::fill(counts_.begin() + index * stride_,
+                counts_.begin() + (index + 1) * stride_, 0u);
+      total_counts_[index] = 0u;
+      current_counts_[index] = 0u;
+      current_indices_[index] = 0;
+    }
+    return true;
+  }
+  if (!reserveCounts(other.numCounts())) {
+    LOG(WARNING) << "Can not copy DenseCount Voxels of different sizes ("
+                 << numCounts() << " vs " << other.numCounts() << ").";
+    return false;
+  }
+  allocateCounts();
+  ClassificationCount* target = &counts_[index * stride_];
+  std::fill(target, target + stride_, 0u);
+  std::copy_n(&other.counts_[other_index * other.stride_], other.numCounts(),
+              target);
+  total_counts_[index] = other.total_counts_[other_index];
+  current_counts_[index] = other.current_counts_[other_index];
+  current_indices_[index] = other.current_indices_[other_index];
+  return true;
+}
+
+size_t DenseCountBlock::getMemorySize() const {
+  return sizeof(DenseCountBlock) +
+         counts_.capacity() * sizeof(ClassificationCount) +
+         total_counts_.capacity() * sizeof(ClassificationCount) +
+         current_counts_.capacity() * sizeof(ClassificationCount) +
+         current_indices_.capacity() * sizeof(int) +
+         voxels_.capacity() * sizeof(DenseCountVoxel);
+}
+
+size_t DenseCountBlock::computeLinearIndex(const VoxelIndex& index) const {
+  return index.x() +
+         voxels_per_side_ * (index.y() + index.z() * voxels_per_side_);
+}
+
+size_t DenseCountBlock::computeLinearIndex(const Point& coords) const {
+  // Truncate to the block in case of numerical inaccuracies, as in voxblox.
+  const int max_value = voxels_per_side_ - 1;
+  const VoxelIndex index = voxblox::getGridIndexFromPoint<VoxelIndex>(
+      coords - origin_, voxel_size_inv_);
+  return computeLinearIndex(
+      VoxelIndex(std::max(std::min(index.x(), max_value), 0),
+                 std::max(std::min(index.y(), max_value), 0),
+                 std::max(std::min(index.z(), max_value), 0)));
+}
+
+config_utilities::Factory::RegistrationRos<ClassLayer, DenseCountLayer, float,
+                                           int>
+    DenseCountLayer::registration_("dense_count");
+
+void DenseCountLayer::Config::setupParamsAndPrinting() {
+  setupParam("num_counts", &num_counts);
+}
+
+void DenseCountLayer::Config::checkParams() const {
+  checkParamGE(num_counts, 0, "num_counts");
+}
+
+DenseCountLayer::DenseCountLayer(const Config& config, const float voxel_size,
+                                 const int voxels_per_side)
+    : config_(config.checkValid()),
+      voxel_size_(voxel_size),
+      voxels_per_side_(voxels_per_side),
+      block_size_(voxel_size * voxels_per_side),
+      block_size_inv_(1.f / block_size_) {}
+
+DenseCountLayer::DenseCountLayer(const DenseCountLayer& other)
+    : config_(other.config_),
+      voxel_size_(other.voxel_size_),
+      voxels_per_side_(other.voxels_per_side_),
+      block_size_(other.block_size_),
+      block_size_inv_(other.block_size_inv_) {
+  // Deep copy of all blocks.
+  for (const auto& index_block : other.blocks_) {
+    blocks_.emplace(index_block.first,
+                    std::make_shared<DenseCountBlock>(*index_block.second));
+  }
+}
+
+ClassVoxelType DenseCountLayer::getVoxelType() const {
+  return ClassVoxelType::kDenseCount;
+}
+
+std::shared_ptr<DenseCountBlock> DenseCountLayer::getDenseBlockPtrByIndex(
+    const BlockIndex& index) const {
+  auto it = blocks_.find(index);
+  if (it == blocks_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+BlockIndex DenseCountLayer::computeBlockIndex(const Point& coords) const {
+  return voxblox::getGridIndexFromPoint<BlockIndex>(coords, block_size_inv_);
+}
+
+std::shared_ptr<DenseCountBlock> DenseCountLayer::createBlock(
+    const BlockIndex& index) const {
+  return std::make_shared<DenseCountBlock>(
+      voxblox::getOriginPointFromGridIndex(index, block_size_),
+      voxels_per_side_, voxel_size_, config_.num_counts);
+}
+
+ClassBlock::ConstPtr DenseCountLayer::getBlockConstPtrByIndex(
+    const BlockIndex& index) const {
+  return ClassBlock::ConstPtr(getDenseBlockPtrByIndex(index));
+}
+
+ClassBlock::Ptr DenseCountLayer::getBlockPtrByIndex(const BlockIndex& index) {
+  return ClassBlock::Ptr(getDenseBlockPtrByIndex(index));
+}
+
+ClassBlock::Ptr DenseCountLayer::allocateBlockPtrByIndex(
+    const BlockIndex& index) {
+  auto it = blocks_.find(index);
+  if (it != blocks_.end()) {
+    return ClassBlock::Ptr(it->second);
+  }
+  return allocateNewBlock(index);
+}
+
+ClassBlock::ConstPtr DenseCountLayer::getBlockPtrByCoordinates(
+    const Point& coords) const {
+  return getBlockConstPtrByIndex(computeBlockIndex(coords));
+}
+
+ClassBlock::Ptr DenseCountLayer::getBlockPtrByCoordinates(
+    const Point& coords) {
+  return getBlockPtrByIndex(computeBlockIndex(coords));
+}
+
+ClassBlock::Ptr DenseCountLayer::allocateBlockPtrByCoordinates(
+    const Point& coords) {
+  return allocateBlockPtrByIndex(computeBlockIndex(coords));
+}
+
+ClassBlock::Ptr DenseCountLayer::allocateNewBlock(const BlockIndex& index) {
+  std::shared_ptr<DenseCountBlock> block = createBlock(index);
+  blocks_[index] = block;
+  return ClassBlock::Ptr(block);
+}
+
+ClassBlock::Ptr DenseCountLayer::allocateNewBlockByCoordinates(
+    const Point& coords) {
+  return allocateNewBlock(computeBlockIndex(coords));
+}
+
+void DenseCountLayer::removeBlock(const BlockIndex& index) {
+  blocks_.erase(index);
+}
+
+void DenseCountLayer::removeAllBlocks() { blocks_.clear(); }
+
+void DenseCountLayer::removeBlockByCoordinates(const Point& coords) {
+  removeBlock(computeBlockIndex(coords));
+}
+
+void DenseCountLayer::getAllAllocatedBlocks(
+    voxblox::BlockIndexList* blocks) const {
+  CHECK_NOTNULL(blocks);
+  blocks->clear();
+  blocks->reserve(blocks_.size());
+  for (const auto& index_block : blocks_) {
+    blocks->emplace_back(index_block.first);
+  }
+}
+
+void DenseCountLayer::getAllUpdatedBlocks(
+    voxblox::Update::Status bit, voxblox::BlockIndexList* blocks) const {
+  CHECK_NOTNULL(blocks);
+  blocks->clear();
+  for (const auto& index_block : blocks_) {
+    if (index_block.second->updated().test(bit)) {
+      blocks->emplace_back(index_block.first);
+    }
+  }
+}
+
+size_t DenseCountLayer::getNumberOfAllocatedBlocks() const {
+  return blocks_.size();
+}
+
+bool DenseCountLayer::hasBlock(const BlockIndex& block_index) const {
+  return blocks_.find(block_index) != blocks_.end();
+}
+
+size_t DenseCountLayer::getMemorySize() const {
+  size_t size = 0u;
+  for (const auto& index_block : blocks_) {
+    size += index_block.second->getMemorySize();
+  }
+  return size;
+}
+
+std::unique_ptr<ClassLayer> DenseCountLayer::clone() const {
+  return std::make_unique<DenseCountLayer>(*this);
+}
+
+std::unique_ptr<ClassLayer> DenseCountLayer::cloneEmpty() const {
+  return std::make_unique<DenseCountLayer>(config_, voxel_size_,
+                                           voxels_per_side_);
+}
+
+std::unique_ptr<ClassLayer> DenseCountLayer::snapshot(
+    const ClassLayer* previous, const voxblox::IndexSet& changed_blocks) const {
+  // Same as 'snapshotLayer()', blocks are only shared with previous snapshots
+  // of the same type.
+  auto result =
+      std::make_unique<DenseCountLayer>(config_, voxel_size_, voxels_per_side_);
+  const auto* previous_dense = dynamic_cast<const DenseCountLayer*>(previous);
+  for (const auto& index_block : blocks_) {
+    if (previous_dense &&
+        changed_blocks.find(index_block.first) == changed_blocks.end()) {
+      std::shared_ptr<DenseCountBlock> shared =
+          previous_dense->getDenseBlockPtrByIndex(index_block.first);
+      if (shared) {
+        result->blocks_.emplace(index_block.first, std::move(shared));
+        continue;
+      }
+    }
+    result->blocks_.emplace(
+        index_block.first,
+        std::make_shared<DenseCountBlock>(*index_block.second));
+  }
+  return result;
+}
+
+bool DenseCountLayer::saveBlockToStream(BlockIndex block_index,
+                                        std::fstream* outfile_ptr) const {
+  CHECK_NOTNULL(outfile_ptr);
+  std::shared_ptr<DenseCountBlock> block = getDenseBlockPtrByIndex(block_index);
+  if (!block) {
+    return false;
+  }
+
+  // Save data.
+  voxblox::BlockProto proto;
+  proto.set_has_data(block->hasData());
+  proto.set_voxels_per_side(block->voxels_per_side());
+  proto.set_voxel_size(block->voxel_size());
+  proto.set_origin_x(block->origin().x());
+  proto.set_origin_y(block->origin().y());
+  proto.set_origin_z(block->origin().z());
+  const size_t num_voxels = block->num_voxels();
+  proto.mutable_voxel_data()->Resize(
+      getSerializedClassBlockSize(*block, num_voxels), 0u);
+  serializeClassBlock(*block, num_voxels,
+                      proto.mutable_voxel_data()->mutable_data());
+  if (!voxblox::utils::writeProtoMsgToStream(proto, outfile_ptr)) {
+    LOG(ERROR) << "Could not write class block proto message to stream.";
+    return false;
+  }
+  return true;
+}
+
+bool DenseCountLayer::saveBlocksToStream(
+    bool include_all_blocks, voxblox::BlockIndexList blocks_to_include,
+    std::fstream* outfile_ptr) const {
+  CHECK_NOTNULL(outfile_ptr);
+  // Get blocks to write.
+  if (include_all_blocks) {
+    getAllAllocatedBlocks(&blocks_to_include);
+  }
+
+  // Write blocks.
+  for (const BlockIndex& index : blocks_to_include) {
+    if (!saveBlockToStream(index, outfile_ptr)) {
+      LOG(WARNING) << "Could not save block " << index.transpose()
+                   << " to stream.";
+    }
+  }
+  return true;
+}
+
+bool DenseCountLayer::addBlockFromProto(
+    const voxblox::BlockProto& block_proto) {
+  // Check compatibility.
+  if (!isCompatible(block_proto, *this)) {
+    return false;
+  }
+
+  // Add (potentially replace) the block.
+  const Point origin(block_proto.origin_x(), block_proto.origin_y(),
+                     block_proto.origin_z());
+  const BlockIndex block_index = computeBlockIndex(origin);
+  std::shared_ptr<DenseCountBlock> block = createBlock(block_index);
+  blocks_[block_index] = block;
+
+  // Load the voxels.
+  return deserializeClassBlock(block_proto.voxel_data().data(),
+                               block_proto.voxel_data_size(),
+                               block->num_voxels(), block.get());
+}
+
+std::unique_ptr<ClassLayer> DenseCountLayer::loadFromStream(
+    const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
+    uint64_t* /* tmp_byte_offset_ptr */) {
+  // The number of counts of every block is recovered from the serialized
+  // voxels.
+  return std::make_unique<DenseCountLayer>(DenseCountLayer::Config(),
+                                           submap_proto.voxel_size(),
+                                           submap_proto.voxels_per_side());
+}
+
+ClassVoxel* DenseCountLayer::getVoxelPtrByCoordinates(const Point& coords) {
+  std::shared_ptr<DenseCountBlock> block =
+      getDenseBlockPtrByIndex(computeBlockIndex(coords));
+  if (!block) {
+    return nullptr;
+  }
+  return block->getVoxelPtrByCoordinates(coords);
+}
+
+const ClassVoxel* DenseCountLayer::getVoxelPtrByCoordinates(
+    const Point& coords) const {
+  std::shared_ptr<const DenseCountBlock> block =
+      getDenseBlockPtrByIndex(computeBlockIndex(coords));
+  if (!block) {
+    return nullptr;
+  }
+  return block->getVoxelPtrByCoordinates(coords);
+}
+
+}  // namespace panoptic_mapping
@@ -1,6 +1,7 @@
 #include "panoptic_mapping/map/classification/fixed_count.h"
 
 #include <algorithm>
+#include <limits>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -13,24 +14,6 @@ ClassVoxelType FixedCountVoxel::getVoxelType() const {
   return ClassVoxelType::kFixedCount;
 }
 
-size_t FixedCountVoxel::kNumCounts = 0u;
-
-size_t FixedCountVoxel::numCounts() { return kNumCounts; }
-void FixedCountVoxel::setNumCounts(size_t num_counts) {
-  if (num_counts == kNumCounts) {
-    return;
-  }
-  if (kNumCounts != 0u) {
-    // This means the number of classes has already been initialized and since
-    // this is currently a global property raise a warning at least.
-    LOG(WARNING) << "The number of classes to be stored in FixedCountVoxels "
-                    "was already initialized to "
-                 << kNumCounts << ", now set to " << num_counts
-                 << ". This can cause undefined behavior.";
-  }
-  kNumCounts = num_counts;
-}
-
 bool FixedCountVoxel::isObserverd() const { return !counts.empty(); }
 
 bool FixedCountVoxel::belongsToSubmap() const {
@@ -49,22 +32,22 @@ float FixedCountVoxel::getBelongingProbability() const {
 int FixedCountVoxel::getBelongingID() const { return current_index; }
 
 float FixedCountVoxel::getProbability(const int id) const {
-  if (id < 0 || id >= kNumCounts || counts.empty()) {
+  if (id < 0 || static_cast<size_t>(id) >= counts.size()) {
     return 0.f;
   }
   return static_cast<float>(counts[id]) / static_cast<float>(total_count);
 }
 
 void FixedCountVoxel::incrementCount(const int id, const float weight) {
-  if (id < 0 || id >= kNumCounts) {
+  if (id < 0 || id > std::numeric_limits<int16_t>::max()) {
     LOG(WARNING) << "Tried to increment count for ID " << id
-                 << ", which is out of range [0-" << kNumCounts << "].";
+                 << ", which is out of range [0-"
+                 << std::numeric_limits<int16_t>::max() << "].";
     return;
   }
-  // Check initialization lazily allocate the counts but full memory so no
-  // re-allocation happens. resize value-initia
-  if (counts.empty()) {
-    counts.resize(kNumCounts, 0u);
+  // Lazily allocate the counts up to the largest observed ID.
+  if (static_cast<size_t>(id) >= counts.size()) {
+    counts.resize(id + 1, 0u);
   }
   const ClassificationCount new_count = ++counts[id];
   if (new_count > current_count) {
@@ -82,30 +65,35 @@ bool FixedCountVoxel::mergeVoxel(const ClassVoxel& other) {
         << "Can not merge voxels that are not of same type (FixedCountVoxel).";
     return false;
   }
+  return mergeVoxel(*voxel);
+}
+
+bool FixedCountVoxel::mergeVoxel(const FixedCountVoxel& other) {
   // Since in both cases the belonging submap is at index 0 we just merge the
   // full vector. Also works for semantic segmentation with consistent labels.
   // NOTE(schmluk): For inconsistent labels the belonging counts of other are
-  // somewhere in [1, kNumCounts], which is not corrected for here!
-  if (voxel->counts.empty()) {
+  // somewhere in [1, num_counts], which is not corrected for here!
+  if (other.counts.empty()) {
     return true;
   }
   if (counts.empty()) {
-    counts = voxel->counts;
-    current_count = voxel->current_count;
-    current_index = voxel->current_index;
-    total_count = voxel->total_count;
+    counts = other.counts;
+    current_count = other.current_count;
+    current_index = other.current_index;
+    total_count = other.total_count;
     return true;
   }
   current_index = -1;
   current_count = 0;
-  total_count += voxel->total_count;
-  if (counts.size() != voxel->counts.size()) {
-    LOG(WARNING) << "Can not merge FixedCount Voxels of different sizes ("
-                 << counts.size() << " vs " << voxel->counts.size() << ").";
-    return false;
+  total_count += other.total_count;
+  // Voxels only store counts up to their largest observed ID.
+  if (counts.size() < other.counts.size()) {
+    counts.resize(other.counts.size(), 0u);
   }
   for (size_t i = 0; i < counts.size(); ++i) {
-    counts[i] += voxel->counts[i];
+    if (i < other.counts.size()) {
+      counts[i] += other.counts[i];
+    }
     if (counts[i] > current_count) {
       current_count = counts[i];
       current_index = i;
@@ -114,37 +102,40 @@ bool FixedCountVoxel::mergeVoxel(const ClassVoxel& other) {
   return true;
 }
 
-std::vector<uint32_t> FixedCountVoxel::serializeVoxelToInt() const {
-  // Store the number of counts first followed by all the values.
+size_t FixedCountVoxel::getSerializedSize() const {
+  return (counts.size() + 3u) / 2u;
+}
+
+size_t FixedCountVoxel::serializeVoxelToBuffer(uint32_t* data) const {
+  // Store the number of counts first followed by all the values. The length
+  // is not taken from 'getSerializedSize()' since derived voxels extend it.
   const size_t length = (counts.size() + 3u) / 2u;
-  std::vector<uint32_t> result(length);
-  result[0] = counts.size();
+  data[0] = counts.size();
   for (size_t i = 1; i < counts.size(); i += 2u) {
-    result[i / 2 + 1] = int32FromTwoInt16(counts[i - 1], counts[i]);
+    data[i / 2 + 1] = int32FromTwoInt16(counts[i - 1], counts[i]);
   }
   if (counts.size() % 2 != 0) {
-    result[length - 1] = int32FromTwoInt16(counts.back(), 0u);
+    data[length - 1] = int32FromTwoInt16(counts.back(), 0u);
   }
-  return result;
+  return length;
 }
 
-bool FixedCountVoxel::deseriliazeVoxelFromInt(const std::vector<uint32_t>& data,
-                                              size_t* data_index) {
-  if (*data_index >= data.size()) {
+bool FixedCountVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
+  if (*data_index >= size) {
     LOG(WARNING)
         << "Can not deserialize voxel from integer data: Out of range (index: "
-        << *data_index << ", data: " << data.size() << ")";
+        << *data_index << ", data: " << size << ")";
     return false;
   }
 
   // Check number of counts to load.
   const size_t num_counts = data[*data_index];
   const size_t length = (num_counts + 3u) / 2u;
-  if (*data_index + length > data.size()) {
+  if (*data_index + length > size) {
     LOG(WARNING) << "Can not deserialize voxel from integer data: Not enough "
                     "data (index: "
-                 << (*data_index + length - 1) << ", data: " << data.size()
-                 << ")";
+                 << (*data_index + length - 1) << ", data: " << size << ")";
     return false;
   }
 
@@ -190,6 +181,11 @@ std::unique_ptr<ClassLayer> FixedCountLayer::clone() const {
   return std::make_unique<FixedCountLayer>(*this);
 }
 
+std::unique_ptr<ClassLayer> FixedCountLayer::cloneEmpty() const {
+  return std::make_unique<FixedCountLayer>(config_, voxel_size(),
+                                           voxels_per_side());
+}
+
 std::unique_ptr<ClassLayer> FixedCountLayer::loadFromStream(
     const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
     uint64_t* /* tmp_byte_offset_ptr */) {
@@ -62,10 +62,14 @@ bool MovingBinaryCountVoxel::mergeVoxel(const ClassVoxel& other) {
                     "(MovingBinaryCountVoxel).";
     return false;
   }
+  return mergeVoxel(*voxel);
+}
+
+bool MovingBinaryCountVoxel::mergeVoxel(const MovingBinaryCountVoxel& other) {
   const int new_belongs_count =
-      static_cast<int>(belongs_count) + static_cast<int>(voxel->belongs_count);
+      static_cast<int>(belongs_count) + static_cast<int>(other.belongs_count);
   const int new_foreign_count =
-      static_cast<int>(foreign_count) + static_cast<int>(voxel->foreign_count);
+      static_cast<int>(foreign_count) + static_cast<int>(other.foreign_count);
   const int normalization =
       (new_belongs_count > 255 || new_foreign_count > 255) ? 2 : 1;
   belongs_count =
@@ -75,19 +79,22 @@ bool MovingBinaryCountVoxel::mergeVoxel(const ClassVoxel& other) {
   return true;
 }
 
-std::vector<uint32_t> MovingBinaryCountVoxel::serializeVoxelToInt() const {
-  // Pack both values into an uint16 and return as uint32, will be further
+size_t MovingBinaryCountVoxel::getSerializedSize() const { return 1u; }
+
+size_t MovingBinaryCountVoxel::serializeVoxelToBuffer(uint32_t* data) const {
+  // Pack both values into an uint16 and store as uint32, will be further
   // packed by the layer.
-  return {int16FromTwoInt8(belongs_count, foreign_count)};
+  data[0] = int16FromTwoInt8(belongs_count, foreign_count);
+  return 1u;
 }
 
-bool MovingBinaryCountVoxel::deseriliazeVoxelFromInt(
-    const std::vector<uint32_t>& data, size_t* data_index) {
+bool MovingBinaryCountVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
   // Since the a voxel only needs half a word advance the index in half steps.
-  if (*data_index >= data.size()) {
+  if (*data_index >= size) {
     LOG(WARNING)
         << "Can not deserialize voxel from integer data: Out of range (index: "
-        << *data_index << ", data: " << data.size() << ")";
+        << *data_index << ", data: " << size << ")";
     return false;
   }
 
@@ -126,21 +133,16 @@ bool MovingBinaryCountLayer::saveBlockToStream(
   proto.set_origin_x(block->origin().x());
   proto.set_origin_y(block->origin().y());
   proto.set_origin_z(block->origin().z());
-  uint16_t tmp_data;
-  bool first_packet_half = true;
-  int test = 0;
-  for (size_t i = 0; i < block->num_voxels(); ++i) {
-    const uint16_t data = static_cast<uint16_t>(
-        block->getVoxelByLinearIndex(i).serializeVoxelToInt()[0]);
-    // Always combine two voxels into a word. The number of voxels is always a
-    // multiple of two.
-    if (first_packet_half) {
-      tmp_data = data;
-      first_packet_half = false;
-    } else {
-      proto.add_voxel_data(int32FromTwoInt16(tmp_data, data));
-      first_packet_half = true;
-    }
+  // Always combine two voxels into a word. The number of voxels is always a
+  // multiple of two.
+  proto.mutable_voxel_data()->Resize(block->num_voxels() / 2, 0u);
+  uint32_t* words = proto.mutable_voxel_data()->mutable_data();
+  uint32_t data[2];
+  for (size_t i = 0; i + 1 < block->num_voxels(); i += 2) {
+    block->getVoxelByLinearIndex(i).serializeVoxelToBuffer(&data[0]);
+    block->getVoxelByLinearIndex(i + 1).serializeVoxelToBuffer(&data[1]);
+    words[i / 2] = int32FromTwoInt16(static_cast<uint16_t>(data[0]),
+                                     static_cast<uint16_t>(data[1]));
   }
   if (!voxblox::utils::writeProtoMsgToStream(proto, outfile_ptr)) {
     LOG(ERROR) << "Could not write class block proto message to stream.";
@@ -162,24 +164,22 @@ bool MovingBinaryCountLayer::addBlockFromProto(
   layer_.removeBlockByCoordinates(origin);
   auto block = layer_.allocateNewBlockByCoordinates(origin);
 
-  // Read the data, where two voxels are unpacked from each word.
-  std::vector<uint32_t> data;
-  data.resize(block_proto.voxel_data_size() * 2);
-  size_t index = 0;
-  for (uint32_t word : block_proto.voxel_data()) {
-    const std::pair<uint16_t, uint16_t> datum = twoInt16FromInt32(word);
-    data[index] = datum.first;
-    data[index + 1] = datum.second;
-    index += 2;
+  // Load the voxels, where two voxels are unpacked from each word.
+  if (static_cast<size_t>(block_proto.voxel_data_size()) * 2 <
+      block->num_voxels()) {
+    LOG(WARNING) << "Could not serialize voxel from data.";
+    return false;
   }
-
-  // Load the voxels.
-  index = 0;
-  for (size_t i = 0; i < block->num_voxels(); ++i) {
-    if (!reinterpret_cast<ClassVoxel&>(block->getVoxelByLinearIndex(i))
-             .deseriliazeVoxelFromInt(data, &index)) {
-      LOG(WARNING) << "Could not serialize voxel from data.";
-      return false;
+  uint32_t data[2];
+  for (size_t i = 0; i + 1 < block->num_voxels(); i += 2) {
+    const std::pair<uint16_t, uint16_t> datum =
+        twoInt16FromInt32(block_proto.voxel_data(i / 2));
+    data[0] = datum.first;
+    data[1] = datum.second;
+    size_t index = 0;
+    for (size_t j = i; j < i + 2; ++j) {
+      block->getVoxelByLinearIndex(j).deserializeVoxelFromBuffer(data, 2,
+                                                                 &index);
     }
   }
   return true;
@@ -193,6 +193,11 @@ std::unique_ptr<ClassLayer> MovingBinaryCountLayer::clone() const {
   return std::make_unique<MovingBinaryCountLayer>(*this);
 }
 
+std::unique_ptr<ClassLayer> MovingBinaryCountLayer::cloneEmpty() const {
+  return std::make_unique<MovingBinaryCountLayer>(config_, voxel_size(),
+                                                  voxels_per_side());
+}
+
 std::unique_ptr<ClassLayer> MovingBinaryCountLayer::loadFromStream(
     const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
     uint64_t* /* tmp_byte_offset_ptr */) {
@@ -0,0 +1,176 @@
+#include "panoptic_mapping/map/classification/top_k_count.h"
+
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace panoptic_mapping {
+
+ClassVoxelType TopKCountVoxel::getVoxelType() const {
+  return ClassVoxelType::kTopKCount;
+}
+
+bool TopKCountVoxel::isObserverd() const { return num_entries > 0; }
+
+bool TopKCountVoxel::belongsToSubmap() const {
+  // In doubt we count the voxel as belonging. This also applies for unobserved
+  // voxels.
+  return current_index == 0;
+}
+
+float TopKCountVoxel::getBelongingProbability() const {
+  return getProbability(0);
+}
+
+int TopKCountVoxel::getBelongingID() const { return current_index; }
+
+float TopKCountVoxel::getProbability(const int id) const {
+  for (size_t i = 0; i < num_entries; ++i) {
+    if (ids[i] == id) {
+      return static_cast<float>(counts[i]) / static_cast<float>(total_count);
+    }
+  }
+  return 0.f;
+}
+
+void TopKCountVoxel::incrementCount(const int id, const float weight) {
+  addCount(id, 1u);
+}
+
+void TopKCountVoxel::addCount(int id, ClassificationCount count) {
+  // Find the entry of the ID or the least frequent entry.
+  size_t index = 0;
+  for (; index < num_entries; ++index) {
+    if (ids[index] == id) {
+      break;
+    }
+  }
+  if (index == num_entries) {
+    if (num_entries < kMaxEntries) {
+      ids[index] = id;
+      counts[index] = 0u;
+      ++num_entries;
+    } else {
+      // Evict the least frequent ID, the new ID inherits its count.
+      index = 0;
+      for (size_t i = 1; i < num_entries; ++i) {
+        if (counts[i] < counts[index]) {
+          index = i;
+        }
+      }
+      ids[index] = id;
+    }
+  }
+  counts[index] += count;
+  total_count += count;
+  if (counts[index] > current_count) {
+    current_index = id;
+    current_count = counts[index];
+  }
+}
+
+bool TopKCountVoxel::mergeVoxel(const ClassVoxel& other) {
+  // Check type compatibility.
+  auto voxel = dynamic_cast<const TopKCountVoxel*>(&other);
+  if (!voxel) {
+    LOG(WARNING) << "Can not merge voxels that are not of same type "
+                    "(TopKCountVoxel).";
+    return false;
+  }
+  return mergeVoxel(*voxel);
+}
+
+bool TopKCountVoxel::mergeVoxel(const TopKCountVoxel& other) {
+  // No averaging is performed here. This inflates the number of total counts
+  // but keeps the accuracy higher.
+  for (size_t i = 0; i < other.num_entries; ++i) {
+    addCount(other.ids[i], other.counts[i]);
+  }
+  return true;
+}
+
+size_t TopKCountVoxel::getSerializedSize() const { return num_entries + 1u; }
+
+size_t TopKCountVoxel::serializeVoxelToBuffer(uint32_t* data) const {
+  // Same format as the VariableCountVoxel, assuming IDs are in int_16 range.
+  data[0] = num_entries;
+  for (size_t i = 0; i < num_entries; ++i) {
+    if (ids[i] < std::numeric_limits<int16_t>::lowest() ||
+        ids[i] > std::numeric_limits<int16_t>::max()) {
+      LOG(WARNING) << "ID: '" << ids[i]
+                   << "' is out of Int16 range and will be ignored.";
+      data[i + 1] = 0u;
+      continue;
+    }
+    data[i + 1] = int32FromTwoInt16(static_cast<uint16_t>(ids[i]), counts[i]);
+  }
+  return num_entries + 1u;
+}
+
+bool TopKCountVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
+  if (*data_index >= size) {
+    LOG(WARNING)
+        << "Can not deserialize voxel from integer data: Out of range (index: "
+        << *data_index << ", data: " << size << ")";
+    return false;
+  }
+
+  // Check number of counts to load.
+  const size_t length = data[*data_index] + 1;
+  if (*data_index + length > size) {
+    LOG(WARNING) << "Can not deserialize voxel from integer data: Not enough "
+                    "data (index: "
+                 << *data_index << "-" << (*data_index + length)
+                 << ", data: " << size << ")";
+    return false;
+  }
+
+  // Get the data. Data of voxels with more IDs is reduced to the most frequent
+  // ones.
+  num_entries = 0;
+  total_count = 0;
+  current_index = 0;
+  current_count = 0;
+  for (size_t i = 1; i < length; ++i) {
+    std::pair<uint16_t, uint16_t> datum =
+        twoInt16FromInt32(data[*data_index + i]);
+    addCount(static_cast<int16_t>(datum.first), datum.second);
+  }
+  *data_index += length;
+  return true;
+}
+
+config_utilities::Factory::RegistrationRos<ClassLayer, TopKCountLayer, float,
+                                           int>
+    TopKCountLayer::registration_("top_k_count");
+
+TopKCountLayer::TopKCountLayer(const Config& config, const float voxel_size,
+                               const int voxels_per_side)
+    : config_(config.checkValid()),
+      ClassLayerImpl(voxel_size, voxels_per_side) {}
+
+ClassVoxelType TopKCountLayer::getVoxelType() const {
+  return ClassVoxelType::kTopKCount;
+}
+
+std::unique_ptr<ClassLayer> TopKCountLayer::clone() const {
+  return std::make_unique<TopKCountLayer>(*this);
+}
+
+std::unique_ptr<ClassLayer> TopKCountLayer::cloneEmpty() const {
+  return std::make_unique<TopKCountLayer>(config_, voxel_size(),
+                                          voxels_per_side());
+}
+
+std::unique_ptr<ClassLayer> TopKCountLayer::loadFromStream(
+    const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
+    uint64_t* /* tmp_byte_offset_ptr */) {
+  // Nothing special needed to configure for top-k counts.
+  return std::make_unique<TopKCountLayer>(TopKCountLayer::Config(),
+                                          submap_proto.voxel_size(),
+                                          submap_proto.voxels_per_side());
+}
+
+}  // namespace panoptic_mapping
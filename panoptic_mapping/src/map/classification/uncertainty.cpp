@@ -18,41 +18,51 @@ bool UncertaintyVoxel::mergeVoxel(const ClassVoxel& other) {
         << "Can not merge voxels that are not of same type (UncertaintyVoxel).";
     return false;
   }
+  return mergeVoxel(*voxel);
+}
+
+bool UncertaintyVoxel::mergeVoxel(const UncertaintyVoxel& other) {
   if (is_ground_truth) {
     return true;
   }
-  if (voxel->is_ground_truth) {
-    counts = voxel->counts;
-    current_index = voxel->current_index;
-    current_count = voxel->current_count;
-    uncertainty = voxel->uncertainty;
+  if (other.is_ground_truth) {
+    counts = other.counts;
+    current_index = other.current_index;
+    current_count = other.current_count;
+    uncertainty = other.uncertainty;
     is_ground_truth = true;
     return true;
   }
   FixedCountVoxel::mergeVoxel(other);
   // We assume that uncertainties can be averaged here.
-  uncertainty = (uncertainty + voxel->uncertainty) / 2.f;
+  uncertainty = (uncertainty + other.uncertainty) / 2.f;
   return true;
 }
 
-std::vector<uint32_t> UncertaintyVoxel::serializeVoxelToInt() const {
+size_t UncertaintyVoxel::getSerializedSize() const {
+  return FixedCountVoxel::getSerializedSize() + 2u;
+}
+
+size_t UncertaintyVoxel::serializeVoxelToBuffer(uint32_t* data) const {
   // Serialize the count data.
-  std::vector<uint32_t> result = FixedCountVoxel::serializeVoxelToInt();
+  const size_t length = FixedCountVoxel::serializeVoxelToBuffer(data);
 
   // Append the added data.
-  result.push_back(static_cast<uint32_t>(is_ground_truth));
-  result.push_back(int32FromX32<float>(uncertainty));
-  return result;
+  data[length] = static_cast<uint32_t>(is_ground_truth);
+  data[length + 1] = int32FromX32<float>(uncertainty);
+  return length + 2u;
 }
 
-bool UncertaintyVoxel::deseriliazeVoxelFromInt(
-    const std::vector<uint32_t>& data, size_t* data_index) {
+bool UncertaintyVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
   // De-serialize count data.
-  FixedCountVoxel::deseriliazeVoxelFromInt(data, data_index);
-  if (*data_index + 1 >= data.size()) {
+  if (!FixedCountVoxel::deserializeVoxelFromBuffer(data, size, data_index)) {
+    return false;
+  }
+  if (*data_index + 1 >= size) {
     LOG(WARNING)
         << "Can not deserialize voxel from integer data: Out of range (index: "
-        << *data_index << ", data: " << data.size() << ")";
+        << *data_index << ", data: " << size << ")";
     return false;
   }
 
@@ -80,6 +90,11 @@ std::unique_ptr<ClassLayer> UncertaintyLayer::clone() const {
   return std::make_unique<UncertaintyLayer>(*this);
 }
 
+std::unique_ptr<ClassLayer> UncertaintyLayer::cloneEmpty() const {
+  return std::make_unique<UncertaintyLayer>(config_, voxel_size(),
+                                            voxels_per_side());
+}
+
 std::unique_ptr<ClassLayer> UncertaintyLayer::loadFromStream(
     const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
     uint64_t* /* tmp_byte_offset_ptr */) {
@@ -51,9 +51,13 @@ bool VariableCountVoxel::mergeVoxel(const ClassVoxel& other) {
                     "(VariableCountVoxel).";
     return false;
   }
+  return mergeVoxel(*voxel);
+}
+
+bool VariableCountVoxel::mergeVoxel(const VariableCountVoxel& other) {
   // No averaging is performed here. This inflates the number of total counts
   // but keeps the accuracy higher.
-  for (const auto& id_count_pair : voxel->counts) {
+  for (const auto& id_count_pair : other.counts) {
     total_count += id_count_pair.second;
     counts[id_count_pair.first] += id_count_pair.second;
     if (counts[id_count_pair.first] > current_count) {
@@ -64,11 +68,14 @@ bool VariableCountVoxel::mergeVoxel(const ClassVoxel& other) {
   return true;
 }
 
-std::vector<uint32_t> VariableCountVoxel::serializeVoxelToInt() const {
+size_t VariableCountVoxel::getSerializedSize() const {
+  return counts.size() + 1u;
+}
+
+size_t VariableCountVoxel::serializeVoxelToBuffer(uint32_t* data) const {
   // To save memory, here we just assume that the IDs stored in the map are in
   // int_16 range (-32k:32k).
-  std::vector<uint32_t> result(counts.size() + 1);
-  result[0] = counts.size();
+  data[0] = counts.size();
 
   // Store all counts as id-value pair.
   size_t index = 0;
@@ -78,30 +85,31 @@ std::vector<uint32_t> VariableCountVoxel::serializeVoxelToInt() const {
         id_count_pair.first > std::numeric_limits<int16_t>::max()) {
       LOG(WARNING) << "ID: '" << id_count_pair.first
                    << "' is out of Int16 range and will be ignored.";
+      data[index] = 0u;
       continue;
     }
-    result[index] = int32FromTwoInt16(
-        static_cast<uint16_t>(id_count_pair.first), id_count_pair.second);
+    data[index] = int32FromTwoInt16(static_cast<uint16_t>(id_count_pair.first),
+                                    id_count_pair.second);
   }
-  return result;
+  return counts.size() + 1u;
 }
 
-bool VariableCountVoxel::deseriliazeVoxelFromInt(
-    const std::vector<uint32_t>& data, size_t* data_index) {
-  if (*data_index >= data.size()) {
+bool VariableCountVoxel::deserializeVoxelFromBuffer(
+    const uint32_t* data, size_t size, size_t* data_index) {
+  if (*data_index >= size) {
     LOG(WARNING)
         << "Can not deserialize voxel from integer data: Out of range (index: "
-        << *data_index << ", data: " << data.size() << ")";
+        << *data_index << ", data: " << size << ")";
     return false;
   }
 
   // Check number of counts to load.
   const size_t length = data[*data_index] + 1;
-  if (*data_index + length > data.size()) {
+  if (*data_index + length > size) {
     LOG(WARNING) << "Can not deserialize voxel from integer data: Not enough "
                     "data (index: "
                  << *data_index << "-" << (*data_index + length)
-                 << ", data: " << data.size() << ")";
+                 << ", data: " << size << ")";
     return false;
   }
 
@@ -142,6 +150,11 @@ std::unique_ptr<ClassLayer> VariableCountLayer::clone() const {
   return std::make_unique<VariableCountLayer>(*this);
 }
 
+std::unique_ptr<ClassLayer> VariableCountLayer::cloneEmpty() const {
+  return std::make_unique<VariableCountLayer>(config_, voxel_size(),
+                                              voxels_per_side());
+}
+
 std::unique_ptr<ClassLayer> VariableCountLayer::loadFromStream(
     const SubmapProto& submap_proto, std::istream* /* proto_file_ptr */,
     uint64_t* /* tmp_byte_offset_ptr */) {
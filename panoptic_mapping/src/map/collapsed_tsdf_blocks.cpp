@@ -0,0 +1,71 @@
+#include "panoptic_mapping/map/collapsed_tsdf_blocks.h"
+
+#include <utility>
+
+#include "panoptic_mapping/map/block_pool.h"
+
+namespace panoptic_mapping {
+
+void CollapsedTsdfBlocks::Config::checkParams() const {
+  checkParamGE(min_weight, 0.f, "min_weight");
+}
+
+void CollapsedTsdfBlocks::Config::setupParamsAndPrinting() {
+  setupParam("collapse_uniform_blocks", &collapse_uniform_blocks);
+  setupParam("min_weight", &min_weight);
+}
+
+CollapsedTsdfBlocks::CollapsedTsdfBlocks(BlockMap blocks)
+    : blocks_(std::move(blocks)) {}
+
+bool CollapsedTsdfBlocks::isCollapsible(const TsdfBlock& block,
+                                        float truncation_distance,
+                                        float min_weight, TsdfVoxel* value) {
+  CHECK_NOTNULL(value);
+  const TsdfVoxel& first = block.getVoxelByLinearIndex(0);
+  if (first.weight <= 0.f || first.weight < min_weight ||
+      first.distance < truncation_distance) {
+    return false;
+  }
+  for (size_t i = 1; i < block.num_voxels(); ++i) {
+    const TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+    if (voxel.distance != first.distance || voxel.weight != first.weight ||
+        voxel.color.r != first.color.r || voxel.color.g != first.color.g ||
+        voxel.color.b != first.color.b || voxel.color.a != first.color.a) {
+      return false;
+    }
+  }
+  *value = first;
+  return true;
+}
+
+void CollapsedTsdfBlocks::expandBlock(const BlockIndex& index,
+                                      const TsdfVoxel& value,
+                                      TsdfLayer* layer) {
+  CHECK_NOTNULL(layer);
+  TsdfBlock& block = *BlockPool<TsdfVoxel>::getGlobalInstance()
+                          ->allocateBlockPtrByIndex(index, layer);
+  for (size_t i = 0; i < block.num_voxels(); ++i) {
+    block.getVoxelByLinearIndex(i) = value;
+  }
+  block.has_data() = true;
+  block.setUpdatedAll();
+}
+
+const TsdfVoxel* CollapsedTsdfBlocks::getVoxel(const BlockIndex& index) const {
+  auto it = blocks_.find(index);
+  if (it == blocks_.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+size_t CollapsedTsdfBlocks::getMemorySize() const {
+  // Approximate the hash map by its nodes and buckets.
+  return sizeof(CollapsedTsdfBlocks) +
+         blocks_.size() * (sizeof(BlockIndex) + sizeof(TsdfVoxel) +
+                           2 * sizeof(void*)) +
+         blocks_.bucket_count() * sizeof(void*);
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,113 @@
+#include "panoptic_mapping/map/compact_iso_surface_points.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+namespace panoptic_mapping {
+
+namespace {
+
+constexpr float kMaxPosition = std::numeric_limits<uint16_t>::max();
+constexpr float kMaxWeight = std::numeric_limits<uint8_t>::max();
+
+}  // namespace
+
+void CompactIsoSurfacePoints::Config::checkParams() const {
+  checkParamGE(max_points, 0, "max_points");
+}
+
+void CompactIsoSurfacePoints::Config::setupParamsAndPrinting() {
+  setupParam("compact_inactive", &compact_inactive);
+  setupParam("max_points", &max_points);
+}
+
+CompactIsoSurfacePoints::CompactIsoSurfacePoints(
+    const std::vector<IsoSurfacePoint>& points, float block_size,
+    size_t max_points)
+    : block_size_(block_size), position_step_(block_size / kMaxPosition) {
+  // Subsample evenly over the points, which are ordered by block.
+  std::vector<size_t> selected;
+  const size_t num_points =
+      max_points > 0 ? std::min(max_points, points.size()) : points.size();
+  selected.reserve(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    selected.push_back(i * points.size() / num_points);
+  }
+
+  // Group the points by block.
+  float max_weight = 0.f;
+  const FloatingPoint block_size_inv = 1.f / block_size_;
+  voxblox::AnyIndexHashMapType<std::vector<size_t>>::type block_points;
+  voxblox::BlockIndexList block_order;
+  for (const size_t i : selected) {
+    const BlockIndex index = voxblox::getGridIndexFromPoint<BlockIndex>(
+        points[i].position, block_size_inv);
+    std::vector<size_t>& indices = block_points[index];
+    if (indices.empty()) {
+      block_order.push_back(index);
+    }
+    indices.push_back(i);
+    max_weight = std::max(max_weight, points[i].weight);
+  }
+  weight_step_ = max_weight / kMaxWeight;
+
+  // Quantize.
+  blocks_.reserve(block_order.size());
+  points_.reserve(selected.size());
+  for (const BlockIndex& index : block_order) {
+    blocks_.push_back({index, static_cast<uint32_t>(points_.size())});
+    const Point origin = index.cast<FloatingPoint>() * block_size_;
+    for (const size_t i : block_points[index]) {
+      CompactPoint point;
+      const Point offset = (points[i].position - origin) / position_step_;
+      for (int axis = 0; axis < 3; ++axis) {
+        point.position[axis] = static_cast<uint16_t>(
+            std::round(std::clamp(offset[axis], 0.f, kMaxPosition)));
+      }
+      point.weight =
+          weight_step_ > 0.f
+              ? static_cast<uint8_t>(std::round(std::clamp(
+                    points[i].weight / weight_step_, 0.f, kMaxWeight)))
+              : 0;
+      points_.push_back(point);
+    }
+  }
+}
+
+size_t CompactIsoSurfacePoints::findBlock(size_t point_index) const {
+  // The last block that begins at or before the point.
+  auto it = std::upper_bound(
+      blocks_.begin(), blocks_.end(), point_index,
+      [](size_t index, const Block& block) { return index < block.begin; });
+  return static_cast<size_t>(it - blocks_.begin()) - 1;
+}
+
+IsoSurfacePoint CompactIsoSurfacePoints::decode(
+    size_t block, const CompactPoint& point) const {
+  const Point origin = blocks_[block].index.cast<FloatingPoint>() * block_size_;
+  return IsoSurfacePoint(
+      origin + position_step_ * Point(point.position[0], point.position[1],
+                                      point.position[2]),
+      weight_step_ * point.weight);
+}
+
+std::vector<IsoSurfacePoint> CompactIsoSurfacePoints::decodeAll() const {
+  std::vector<IsoSurfacePoint> result;
+  result.reserve(points_.size());
+  forEachPoint(0, points_.size(), [&result](const IsoSurfacePoint& point) {
+    result.push_back(point);
+    return true;
+  });
+  return result;
+}
+
+size_t CompactIsoSurfacePoints::getMemorySize() const {
+  return sizeof(CompactIsoSurfacePoints) +
+         blocks_.capacity() * sizeof(Block) +
+         points_.capacity() * sizeof(CompactPoint);
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,142 @@
+#include "panoptic_mapping/map/compressed_tsdf_layer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "panoptic_mapping/map/block_pool.h"
+
+namespace panoptic_mapping {
+
+void CompressedTsdfLayer::Config::checkParams() const {
+  checkParamCond(distance_bits == 8 || distance_bits == 16,
+                 "'distance_bits' is required to be 8 or 16.");
+}
+
+void CompressedTsdfLayer::Config::setupParamsAndPrinting() {
+  setupParam("compress_inactive", &compress_inactive);
+  setupParam("distance_bits", &distance_bits);
+  setupParam("drop_color", &drop_color);
+}
+
+CompressedTsdfLayer::CompressedTsdfLayer(const Config& config,
+                                         const TsdfLayer& layer,
+                                         float truncation_distance)
+    : config_(config.checkValid()),
+      truncation_distance_(std::abs(truncation_distance)),
+      voxels_per_side_(layer.voxels_per_side()),
+      voxel_size_(layer.voxel_size()),
+      max_distance_code_(config_.distance_bits == 16 ? 65535.f : 255.f) {
+  voxblox::BlockIndexList block_indices;
+  layer.getAllAllocatedBlocks(&block_indices);
+
+  // Find the weight range to be covered by the logarithmic quantization.
+  float min_weight = std::numeric_limits<float>::max();
+  float max_weight = 0.f;
+  for (const BlockIndex& index : block_indices) {
+    const TsdfBlock& block = layer.getBlockByIndex(index);
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      const float weight = block.getVoxelByLinearIndex(i).weight;
+      if (weight > 0.f) {
+        min_weight = std::min(min_weight, weight);
+        max_weight = std::max(max_weight, weight);
+      }
+    }
+  }
+  if (max_weight > 0.f) {
+    // Code 0 is reserved for unobserved voxels.
+    min_log_weight_ = std::log(min_weight);
+    log_weight_step_ = (std::log(max_weight) - min_log_weight_) / 254.f;
+    if (log_weight_step_ <= 0.f) {
+      log_weight_step_ = 1.f;
+    }
+  }
+
+  // Compress all blocks.
+  const size_t distance_bytes = config_.distance_bits / 8;
+  const float distance_scale =
+      max_distance_code_ / (2.f * std::max(truncation_distance_, 1e-6f));
+  blocks_.reserve(block_indices.size());
+  for (const BlockIndex& index : block_indices) {
+    const TsdfBlock& block = layer.getBlockByIndex(index);
+    const size_t num_voxels = block.num_voxels();
+    CompressedBlock& compressed = blocks_.emplace_back();
+    compressed.index = index;
+    compressed.distances.resize(num_voxels * distance_bytes);
+    compressed.weights.resize(num_voxels);
+    if (!config_.drop_color) {
+      compressed.colors.resize(num_voxels);
+    }
+    for (size_t i = 0; i < num_voxels; ++i) {
+      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+      const float distance =
+          std::max(-truncation_distance_,
+                   std::min(truncation_distance_, voxel.distance));
+      const uint16_t code = static_cast<uint16_t>(
+          std::round((distance + truncation_distance_) * distance_scale));
+      compressed.distances[i * distance_bytes] = code & 0xFF;
+      if (distance_bytes == 2) {
+        compressed.distances[i * distance_bytes + 1] = code >> 8;
+      }
+      compressed.weights[i] = compressWeight(voxel.weight);
+      if (!config_.drop_color) {
+        compressed.colors[i] = voxel.color;
+      }
+    }
+  }
+}
+
+void CompressedTsdfLayer::decompress(TsdfLayer* layer) const {
+  CHECK_NOTNULL(layer);
+  CHECK_EQ(layer->voxels_per_side(), voxels_per_side_);
+  CHECK_EQ(layer->voxel_size(), voxel_size_);
+  const size_t distance_bytes = config_.distance_bits / 8;
+  const float distance_scale =
+      2.f * std::max(truncation_distance_, 1e-6f) / max_distance_code_;
+  const voxblox::Color gray(127, 127, 127);
+  BlockPool<TsdfVoxel>* block_pool = BlockPool<TsdfVoxel>::getGlobalInstance();
+  for (const CompressedBlock& compressed : blocks_) {
+    TsdfBlock& block =
+        *block_pool->allocateBlockPtrByIndex(compressed.index, layer);
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+      uint16_t code = compressed.distances[i * distance_bytes];
+      if (distance_bytes == 2) {
+        code |= compressed.distances[i * distance_bytes + 1] << 8;
+      }
+      voxel.distance = code * distance_scale - truncation_distance_;
+      voxel.weight = decompressWeight(compressed.weights[i]);
+      voxel.color = config_.drop_color ? gray : compressed.colors[i];
+    }
+    block.has_data() = true;
+  }
+}
+
+size_t CompressedTsdfLayer::getMemorySize() const {
+  size_t size = sizeof(CompressedTsdfLayer);
+  for (const CompressedBlock& block : blocks_) {
+    size += sizeof(CompressedBlock) + block.distances.capacity() +
+            block.weights.capacity() +
+            block.colors.capacity() * sizeof(voxblox::Color);
+  }
+  return size;
+}
+
+uint8_t CompressedTsdfLayer::compressWeight(float weight) const {
+  if (weight <= 0.f) {
+    return 0u;
+  }
+  const float code =
+      std::round((std::log(weight) - min_log_weight_) / log_weight_step_);
+  return static_cast<uint8_t>(std::max(0.f, std::min(254.f, code)) + 1.f);
+}
+
+float CompressedTsdfLayer::decompressWeight(uint8_t code) const {
+  if (code == 0u) {
+    return 0.f;
+  }
+  return std::exp(min_log_weight_ + (code - 1) * log_weight_step_);
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,414 @@
+#include "panoptic_mapping/map/indexed_mesh.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace panoptic_mapping {
+
+namespace {
+
+using Quadric = Eigen::Matrix4d;
+using QuadricVector = std::vector<Quadric, Eigen::aligned_allocator<Quadric>>;
+
+// Weight of the planes constraining the border edges of the mesh.
+constexpr double kBorderWeight = 1e3;
+
+Quadric planeQuadric(const Eigen::Vector3d& normal,
+                     const Eigen::Vector3d& point, double weight) {
+  Eigen::Vector4d plane;
+  plane << normal, -normal.dot(point);
+  return weight * plane * plane.transpose();
+}
+
+double quadricError(const Quadric& quadric, const Eigen::Vector3d& point) {
+  const Eigen::Vector4d p(point.x(), point.y(), point.z(), 1.0);
+  return p.dot(quadric * p);
+}
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+  if (a > b) {
+    std::swap(a, b);
+  }
+  return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+struct Collapse {
+  double cost = 0.0;
+  uint32_t keep = 0;
+  uint32_t remove = 0;
+  uint32_t keep_version = 0;
+  uint32_t remove_version = 0;
+  Eigen::Vector3d target;
+
+  bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+}  // namespace
+
+void IndexedMesh::Config::checkParams() const {
+  checkParamGE(weld_distance, 0.f, "weld_distance");
+  checkParamGT(target_ratio, 0.f, "target_ratio");
+  checkParamLE(target_ratio, 1.f, "target_ratio");
+  checkParamGE(max_error, 0.f, "max_error");
+}
+
+void IndexedMesh::Config::setupParamsAndPrinting() {
+  setupParam("weld_distance", &weld_distance, "voxels");
+  setupParam("decimate_inactive", &decimate_inactive);
+  setupParam("target_ratio", &target_ratio);
+  setupParam("max_error", &max_error, "voxels");
+}
+
+IndexedMesh::IndexedMesh(const MeshLayer& mesh_layer, float weld_distance) {
+  const float inv_weld_distance =
+      weld_distance > 0.f ? 1.f / weld_distance : 0.f;
+  voxblox::LongIndexHashMapType<uint32_t>::type welded_vertices;
+  voxblox::BlockIndexList mesh_indices;
+  mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  for (const BlockIndex& block_index : mesh_indices) {
+    const voxblox::Mesh& mesh = mesh_layer.getMeshByIndex(block_index);
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+      std::array<uint32_t, 3> triangle;
+      for (size_t k = 0; k < 3; ++k) {
+        const voxblox::VertexIndex vertex = mesh.indices[i + k];
+        const Point& position = mesh.vertices[vertex];
+        uint32_t index = static_cast<uint32_t>(vertices_.size());
+        if (inv_weld_distance > 0.f) {
+          auto it = welded_vertices.emplace(
+              weldKey(position, inv_weld_distance), index);
+          if (!it.second) {
+            triangle[k] = it.first->second;
+            continue;
+          }
+        }
+        vertices_.push_back(position);
+        colors_.push_back(mesh.hasColors() ? mesh.colors[vertex] : Color());
+        triangle[k] = index;
+      }
+      // Welding can collapse small triangles.
+      if (triangle[0] == triangle[1] || triangle[1] == triangle[2] ||
+          triangle[0] == triangle[2]) {
+        continue;
+      }
+      indices_.insert(indices_.end(), triangle.begin(), triangle.end());
+    }
+  }
+  computeNormals();
+}
+
+voxblox::LongIndex IndexedMesh::weldKey(const Point& position,
+                                        float inv_weld_distance) {
+  return (position * inv_weld_distance)
+      .array()
+      .round()
+      .cast<voxblox::LongIndexElement>();
+}
+
+void IndexedMesh::decimate(size_t target_triangles, float max_error) {
+  const size_t num_vertices = vertices_.size();
+  size_t num_triangles = getNumberOfTriangles();
+  if (num_triangles <= target_triangles) {
+    return;
+  }
+
+  // Setup the connectivity.
+  std::vector<Eigen::Vector3d> positions(num_vertices);
+  for (size_t i = 0; i < num_vertices; ++i) {
+    positions[i] = vertices_[i].cast<double>();
+  }
+  std::vector<std::array<uint32_t, 3>> triangles(num_triangles);
+  std::vector<bool> triangle_removed(num_triangles, false);
+  std::vector<std::vector<uint32_t>> vertex_triangles(num_vertices);
+  std::unordered_map<uint64_t, int> edge_counts;
+  for (size_t t = 0; t < num_triangles; ++t) {
+    for (size_t k = 0; k < 3; ++k) {
+      triangles[t][k] = indices_[3 * t + k];
+      vertex_triangles[triangles[t][k]].push_back(static_cast<uint32_t>(t));
+      edge_counts[edgeKey(indices_[3 * t + k],
+                          indices_[3 * t + (k + 1) % 3])]++;
+    }
+  }
+
+  // Accumulate the planes of all triangles at their vertices. Border edges are
+  // additionally constrained by a plane perpendicular to the triangle, such
+  // that the border of the mesh does not shrink.
+  QuadricVector quadrics(num_vertices, Quadric::Zero());
+  for (const std::array<uint32_t, 3>& triangle : triangles) {
+    const Eigen::Vector3d& p0 = positions[triangle[0]];
+    const Eigen::Vector3d cross =
+        (positions[triangle[1]] - p0).cross(positions[triangle[2]] - p0);
+    const double norm = cross.norm();
+    if (norm <= 0.0) {
+      continue;
+    }
+    const Eigen::Vector3d normal = cross / norm;
+    const Quadric quadric = planeQuadric(normal, p0, 1.0);
+    for (size_t k = 0; k < 3; ++k) {
+      const uint32_t a = triangle[k];
+      const uint32_t b = triangle[(k + 1) % 3];
+      quadrics[a] += quadric;
+      if (edge_counts[edgeKey(a, b)] != 1) {
+        continue;
+      }
+      const Eigen::Vector3d edge = positions[b] - positions[a];
+      const Eigen::Vector3d border_normal = edge.cross(normal);
+      if (border_normal.norm() <= 0.0) {
+        continue;
+      }
+      const Quadric border = planeQuadric(border_normal.normalized(),
+                                          positions[a], kBorderWeight);
+      quadrics[a] += border;
+      quadrics[b] += border;
+    }
+  }
+
+  // Find the best collapse of each edge.
+  std::vector<uint32_t> versions(num_vertices, 0);
+  std::vector<bool> vertex_removed(num_vertices, false);
+  auto computeCollapse = [&](uint32_t keep, uint32_t remove) {
+    Collapse collapse;
+    collapse.keep = keep;
+    collapse.remove = remove;
+    collapse.keep_version = versions[keep];
+    collapse.remove_version = versions[remove];
+    const Quadric quadric = quadrics[keep] + quadrics[remove];
+    const Eigen::Vector3d& a = positions[keep];
+    const Eigen::Vector3d& b = positions[remove];
+    std::vector<Eigen::Vector3d> candidates = {a, b, 0.5 * (a + b)};
+
+    // The optimal position is only used if it is well defined and close to
+    // the edge. The planes have unit normals, so the threshold is scale free.
+    const Eigen::Matrix3d system = quadric.topLeftCorner<3, 3>();
+    if (std::abs(system.determinant()) > 1e-6) {
+      const Eigen::Vector3d optimum =
+          system.inverse() * -quadric.topRightCorner<3, 1>();
+      if ((optimum - 0.5 * (a + b)).norm() <= (a - b).norm()) {
+        candidates.push_back(optimum);
+      }
+    }
+    collapse.cost = std::numeric_limits<double>::max();
+    for (const Eigen::Vector3d& candidate : candidates) {
+      const double cost = quadricError(quadric, candidate);
+      if (cost < collapse.cost) {
+        collapse.cost = cost;
+        collapse.target = candidate;
+      }
+    }
+    return collapse;
+  };
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>>
+      queue;
+  for (const auto& key_count_pair : edge_counts) {
+    queue.push(computeCollapse(key_count_pair.first >> 32,
+                               key_count_pair.first & 0xFFFFFFFF));
+  }
+
+  auto neighbors = [&](uint32_t vertex) {
+    std::vector<uint32_t> result;
+    for (uint32_t t : vertex_triangles[vertex]) {
+      if (triangle_removed[t]) {
+        continue;
+      }
+      for (uint32_t other : triangles[t]) {
+        if (other != vertex) {
+          result.push_back(other);
+        }
+      }
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  };
+
+  // Moving a vertex must not flip any of the triangles that remain.
+  auto flipsTriangles = [&](uint32_t vertex, uint32_t other,
+                            const Eigen::Vector3d& target) {
+    for (uint32_t t : vertex_triangles[vertex]) {
+      const std::array<uint32_t, 3>& triangle = triangles[t];
+      if (triangle_removed[t] ||
+          std::find(triangle.begin(), triangle.end(), other) !=
+              triangle.end()) {
+        continue;
+      }
+      std::array<Eigen::Vector3d, 3> before;
+      std::array<Eigen::Vector3d, 3> after;
+      for (size_t k = 0; k < 3; ++k) {
+        before[k] = positions[triangle[k]];
+        after[k] = triangle[k] == vertex ? target : before[k];
+      }
+      const Eigen::Vector3d normal_before =
+          (before[1] - before[0]).cross(before[2] - before[0]);
+      const Eigen::Vector3d normal_after =
+          (after[1] - after[0]).cross(after[2] - after[0]);
+      if (normal_before.dot(normal_after) <= 0.0) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Collapse the cheapest edges first.
+  const double max_cost = static_cast<double>(max_error) * max_error;
+  while (num_triangles > target_triangles && !queue.empty()) {
+    const Collapse collapse = queue.top();
+    queue.pop();
+    const uint32_t keep = collapse.keep;
+    const uint32_t remove = collapse.remove;
+    if (vertex_removed[keep] || vertex_removed[remove] ||
+        versions[keep] != collapse.keep_version ||
+        versions[remove] != collapse.remove_version) {
+      continue;  // Outdated.
+    }
+    if (collapse.cost > max_cost) {
+      break;
+    }
+
+    // Only collapse edges whose end points share no other neighbors than the
+    // opposite vertices of the edge's triangles, which keeps the mesh
+    // manifold.
+    const std::vector<uint32_t> keep_neighbors = neighbors(keep);
+    const std::vector<uint32_t> remove_neighbors = neighbors(remove);
+    std::vector<uint32_t> shared;
+    std::set_intersection(keep_neighbors.begin(), keep_neighbors.end(),
+                          remove_neighbors.begin(), remove_neighbors.end(),
+                          std::back_inserter(shared));
+    const std::vector<uint32_t>& keep_triangles = vertex_triangles[keep];
+    const size_t edge_triangles = std::count_if(
+        keep_triangles.begin(), keep_triangles.end(), [&](uint32_t t) {
+          return !triangle_removed[t] &&
+                 std::find(triangles[t].begin(), triangles[t].end(),
+                           remove) != triangles[t].end();
+        });
+    if (shared.size() > edge_triangles) {
+      continue;
+    }
+    if (flipsTriangles(keep, remove, collapse.target) ||
+        flipsTriangles(remove, keep, collapse.target)) {
+      continue;
+    }
+
+    // Merge 'remove' into 'keep'.
+    positions[keep] = collapse.target;
+    quadrics[keep] += quadrics[remove];
+    colors_[keep] =
+        Color::blendTwoColors(colors_[keep], 0.5f, colors_[remove], 0.5f);
+    for (uint32_t t : vertex_triangles[remove]) {
+      if (triangle_removed[t]) {
+        continue;
+      }
+      std::array<uint32_t, 3>& triangle = triangles[t];
+      if (std::find(triangle.begin(), triangle.end(), keep) !=
+          triangle.end()) {
+        triangle_removed[t] = true;
+        num_triangles--;
+        continue;
+      }
+      std::replace(triangle.begin(), triangle.end(), remove, keep);
+      vertex_triangles[keep].push_back(t);
+    }
+    vertex_removed[remove] = true;
+    vertex_triangles[remove].clear();
+    versions[keep]++;
+    std::vector<uint32_t>& merged_triangles = vertex_triangles[keep];
+    merged_triangles.erase(
+        std::remove_if(merged_triangles.begin(), merged_triangles.end(),
+                       [&](uint32_t t) { return triangle_removed[t]; }),
+        merged_triangles.end());
+
+    // Update the edges of the merged vertex.
+    for (uint32_t neighbor : neighbors(keep)) {
+      queue.push(computeCollapse(keep, neighbor));
+    }
+  }
+
+  // Compact the remaining vertices and triangles.
+  std::vector<uint32_t> new_index(num_vertices, 0);
+  std::vector<bool> is_used(num_vertices, false);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    if (!triangle_removed[t]) {
+      for (uint32_t vertex : triangles[t]) {
+        is_used[vertex] = true;
+      }
+    }
+  }
+  Pointcloud vertices;
+  voxblox::Colors colors;
+  for (size_t i = 0; i < num_vertices; ++i) {
+    if (is_used[i]) {
+      new_index[i] = static_cast<uint32_t>(vertices.size());
+      vertices.push_back(positions[i].cast<FloatingPoint>());
+      colors.push_back(colors_[i]);
+    }
+  }
+  std::vector<uint32_t> indices;
+  indices.reserve(3 * num_triangles);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    if (!triangle_removed[t]) {
+      for (uint32_t vertex : triangles[t]) {
+        indices.push_back(new_index[vertex]);
+      }
+    }
+  }
+  vertices_ = std::move(vertices);
+  colors_ = std::move(colors);
+  indices_ = std::move(indices);
+  computeNormals();
+}
+
+void IndexedMesh::computeNormals() {
+  normals_.assign(vertices_.size(), Point::Zero());
+  for (size_t i = 0; i + 2 < indices_.size(); i += 3) {
+    const Point& p0 = vertices_[indices_[i]];
+    // The cross product is proportional to the triangle area.
+    const Point normal = (vertices_[indices_[i + 1]] - p0)
+                             .cross(vertices_[indices_[i + 2]] - p0);
+    for (size_t k = 0; k < 3; ++k) {
+      normals_[indices_[i + k]] += normal;
+    }
+  }
+  for (Point& normal : normals_) {
+    const FloatingPoint norm = normal.norm();
+    if (norm > 0.f) {
+      normal /= norm;
+    }
+  }
+}
+
+void IndexedMesh::toMeshLayer(MeshLayer* mesh_layer) const {
+  CHECK_NOTNULL(mesh_layer);
+  const FloatingPoint block_size_inv = 1.f / mesh_layer->block_size();
+  for (size_t i = 0; i + 2 < indices_.size(); i += 3) {
+    const Point centroid = (vertices_[indices_[i]] +
+                            vertices_[indices_[i + 1]] +
+                            vertices_[indices_[i + 2]]) /
+                           3.f;
+    const BlockIndex block_index =
+        voxblox::getGridIndexFromPoint<BlockIndex>(centroid, block_size_inv);
+    voxblox::Mesh& mesh = *mesh_layer->allocateMeshPtrByIndex(block_index);
+    for (size_t k = 0; k < 3; ++k) {
+      const uint32_t vertex = indices_[i + k];
+      mesh.indices.push_back(mesh.vertices.size());
+      mesh.vertices.push_back(vertices_[vertex]);
+      mesh.normals.push_back(normals_[vertex]);
+      mesh.colors.push_back(colors_[vertex]);
+    }
+    mesh.updated = true;
+  }
+}
+
+size_t IndexedMesh::getMemorySize() const {
+  return sizeof(IndexedMesh) +
+         (vertices_.capacity() + normals_.capacity()) * sizeof(Point) +
+         colors_.capacity() * sizeof(Color) +
+         indices_.capacity() * sizeof(uint32_t);
+}
+
+}  // namespace panoptic_mapping
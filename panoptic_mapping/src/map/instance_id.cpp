@@ -9,13 +9,12 @@ InstanceID::InstanceID(InstanceIDManager* manager)
 InstanceID::~InstanceID() { manager_->releaseID(id_); }
 
 InstanceID::InstanceID(int id, InstanceIDManager* manager)
-    : manager_(manager_), id_(id) {
+    : manager_(manager), id_(id) {
   manager_->registerID(id);
 }
 
-InstanceID::InstanceID(const InstanceID& other) : manager_(other.manager_) {
-  manager_->releaseID(id_);
-  id_ = other.id_;
+InstanceID::InstanceID(const InstanceID& other)
+    : manager_(other.manager_), id_(other.id_) {
   manager_->registerID(id_);
 }
 
@@ -28,6 +27,22 @@ InstanceID& InstanceID::operator=(const int& id) {
 
 InstanceIDManager::InstanceIDManager() : current_id_(0) {}
 
+InstanceIDManager::InstanceIDManager(const InstanceIDManager& other) {
+  std::lock_guard<std::mutex> lock(other.mutex_);
+  current_id_ = other.current_id_;
+  used_ids_ = other.used_ids_;
+}
+
+InstanceIDManager& InstanceIDManager::operator=(
+    const InstanceIDManager& other) {
+  if (this != &other) {
+    std::scoped_lock lock(mutex_, other.mutex_);
+    current_id_ = other.current_id_;
+    used_ids_ = other.used_ids_;
+  }
+  return *this;
+}
+
 void InstanceIDManager::increment(int id) {
   auto it = used_ids_.find(id);
   if (it == used_ids_.end()) {
@@ -52,6 +67,7 @@ bool InstanceIDManager::decrement(int id) {
 }
 
 int InstanceIDManager::requestID() {
+  std::lock_guard<std::mutex> lock(mutex_);
   // Find the next higher unique ID.
   while (used_ids_.find(current_id_) != used_ids_.end()) {
     current_id_++;
@@ -60,9 +76,13 @@ int InstanceIDManager::requestID() {
   return current_id_;
 }
 
-void InstanceIDManager::registerID(int id) { increment(id); }
+void InstanceIDManager::registerID(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  increment(id);
+}
 
 void InstanceIDManager::releaseID(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
   const bool id_is_free = decrement(id);
   if (id_is_free && id < current_id_ && kAllowIDReuse) {
     current_id_ = id;
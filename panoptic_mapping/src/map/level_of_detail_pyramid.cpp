@@ -0,0 +1,136 @@
+#include "panoptic_mapping/map/level_of_detail_pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+
+namespace panoptic_mapping {
+
+namespace {
+
+// Average each 2x2x2 cube of voxels of a layer into a layer of half the voxels
+// per side and the same block layout.
+void downsampleLayer(const TsdfLayer& fine, TsdfLayer* coarse) {
+  const int voxels_per_side = static_cast<int>(coarse->voxels_per_side());
+  voxblox::BlockIndexList block_indices;
+  fine.getAllAllocatedBlocks(&block_indices);
+  for (const BlockIndex& block_index : block_indices) {
+    const TsdfBlock& fine_block = fine.getBlockByIndex(block_index);
+    TsdfBlock& coarse_block = *coarse->allocateBlockPtrByIndex(block_index);
+    bool has_data = false;
+    for (int x = 0; x < voxels_per_side; ++x) {
+      for (int y = 0; y < voxels_per_side; ++y) {
+        for (int z = 0; z < voxels_per_side; ++z) {
+          // Weighted average of all observed voxels of the cube.
+          float weight_sum = 0.f;
+          float distance_sum = 0.f;
+          Eigen::Vector3f color_sum = Eigen::Vector3f::Zero();
+          int num_observed = 0;
+          for (int i = 0; i < 8; ++i) {
+            const voxblox::VoxelIndex index(2 * x + (i & 1),
+                                            2 * y + ((i >> 1) & 1),
+                                            2 * z + ((i >> 2) & 1));
+            const TsdfVoxel& voxel = fine_block.getVoxelByVoxelIndex(index);
+            if (voxel.weight <= 0.f) {
+              continue;
+            }
+            weight_sum += voxel.weight;
+            distance_sum += voxel.weight * voxel.distance;
+            color_sum += voxel.weight * Eigen::Vector3f(voxel.color.r,
+                                                        voxel.color.g,
+                                                        voxel.color.b);
+            num_observed++;
+          }
+          if (num_observed == 0) {
+            continue;
+          }
+          TsdfVoxel& voxel = coarse_block.getVoxelByVoxelIndex(
+              voxblox::VoxelIndex(x, y, z));
+          voxel.distance = distance_sum / weight_sum;
+          voxel.weight = weight_sum / num_observed;
+          color_sum /= weight_sum;
+          voxel.color = Color(static_cast<uint8_t>(color_sum.x()),
+                              static_cast<uint8_t>(color_sum.y()),
+                              static_cast<uint8_t>(color_sum.z()));
+          has_data = true;
+        }
+      }
+    }
+    coarse_block.has_data() = has_data;
+  }
+}
+
+size_t meshMemorySize(const MeshLayer& mesh_layer) {
+  size_t result = 0;
+  voxblox::BlockIndexList mesh_indices;
+  mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+  for (const BlockIndex& index : mesh_indices) {
+    const voxblox::Mesh& mesh = mesh_layer.getMeshByIndex(index);
+    result += sizeof(voxblox::Mesh) +
+              (mesh.vertices.capacity() + mesh.normals.capacity()) *
+                  sizeof(Point) +
+              mesh.colors.capacity() * sizeof(voxblox::Color) +
+              mesh.indices.capacity() * sizeof(voxblox::VertexIndex);
+  }
+  return result;
+}
+
+}  // namespace
+
+void LevelOfDetailPyramid::Config::checkParams() const {
+  checkParamGE(num_levels, 0, "num_levels");
+  checkParamGT(max_pixels_per_voxel, 0.f, "max_pixels_per_voxel");
+}
+
+void LevelOfDetailPyramid::Config::setupParamsAndPrinting() {
+  setupParam("num_levels", &num_levels);
+  setupParam("max_pixels_per_voxel", &max_pixels_per_voxel);
+}
+
+LevelOfDetailPyramid::LevelOfDetailPyramid(
+    const Config& config, const TsdfLayer& layer,
+    const MeshIntegrator::Config& mesh_config, float truncation_distance)
+    : config_(config.checkValid()) {
+  const TsdfLayer* previous = &layer;
+  while (static_cast<int>(levels_.size()) < config_.num_levels &&
+         previous->voxels_per_side() % 2 == 0) {
+    Level level;
+    level.tsdf_layer = std::make_shared<TsdfLayer>(
+        previous->voxel_size() * 2.f, previous->voxels_per_side() / 2);
+    downsampleLayer(*previous, level.tsdf_layer.get());
+    level.mesh_layer = std::make_shared<MeshLayer>(layer.block_size());
+    MeshIntegrator mesh_integrator(mesh_config, level.tsdf_layer,
+                                   level.mesh_layer, nullptr,
+                                   truncation_distance);
+    mesh_integrator.generateMesh(false, false, false);
+    levels_.push_back(std::move(level));
+    previous = levels_.back().tsdf_layer.get();
+  }
+}
+
+int LevelOfDetailPyramid::selectLevel(float distance,
+                                      float focal_length) const {
+  int result = -1;
+  for (size_t i = 0; i < levels_.size(); ++i) {
+    const float pixels_per_voxel =
+        focal_length * levels_[i].tsdf_layer->voxel_size() /
+        std::max(distance, 1e-3f);
+    if (pixels_per_voxel > config_.max_pixels_per_voxel) {
+      break;
+    }
+    result = static_cast<int>(i);
+  }
+  return result;
+}
+
+size_t LevelOfDetailPyramid::getMemorySize() const {
+  size_t result = sizeof(LevelOfDetailPyramid);
+  for (const Level& level : levels_) {
+    result += level.tsdf_layer->getMemorySize() +
+              meshMemorySize(*level.mesh_layer);
+  }
+  return result;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,237 @@
+#include "panoptic_mapping/map/mapped_tsdf_layer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "panoptic_mapping/map/block_pool.h"
+
+namespace panoptic_mapping {
+
+namespace {
+
+static_assert(std::is_trivially_copyable<TsdfVoxel>::value,
+              "Raw block files require trivially copyable voxels.");
+
+constexpr char kMagic[8] = {'P', 'M', 'R', 'A', 'W', 'T', 'S', 'D'};
+constexpr uint32_t kVersion = 1u;
+constexpr uint64_t kDataAlignment = 64u;
+
+// File layout: FileHeader, num_blocks BlockEntries, aligned voxel data.
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t voxels_per_side;
+  float voxel_size;
+  uint32_t voxel_bytes;
+  uint64_t num_blocks;
+};
+
+struct BlockEntry {
+  int32_t index[3];
+  int32_t padding;
+  uint64_t byte_offset;  // Of the voxel data from the start of the file.
+};
+
+}  // namespace
+
+MappedTsdfLayer::~MappedTsdfLayer() { close(); }
+
+bool MappedTsdfLayer::saveToFile(const TsdfLayer& layer,
+                                 const std::string& file_path) {
+  std::ofstream outfile(file_path, std::ios::out | std::ios::binary);
+  if (!outfile.is_open()) {
+    LOG(ERROR) << "Could not open file '" << file_path
+               << "' to save the raw TSDF blocks.";
+    return false;
+  }
+  voxblox::BlockIndexList block_indices;
+  layer.getAllAllocatedBlocks(&block_indices);
+
+  FileHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.voxels_per_side = layer.voxels_per_side();
+  header.voxel_size = layer.voxel_size();
+  header.voxel_bytes = sizeof(TsdfVoxel);
+  header.num_blocks = block_indices.size();
+
+  // Compute the location of all blocks.
+  const uint64_t block_bytes =
+      layer.voxels_per_side() * layer.voxels_per_side() *
+      layer.voxels_per_side() * sizeof(TsdfVoxel);
+  const uint64_t table_end =
+      sizeof(FileHeader) + block_indices.size() * sizeof(BlockEntry);
+  const uint64_t data_offset =
+      (table_end + kDataAlignment - 1) / kDataAlignment * kDataAlignment;
+  std::vector<BlockEntry> entries(block_indices.size());
+  for (size_t i = 0; i < block_indices.size(); ++i) {
+    entries[i].index[0] = block_indices[i].x();
+    entries[i].index[1] = block_indices[i].y();
+    entries[i].index[2] = block_indices[i].z();
+    entries[i].padding = 0;
+    entries[i].byte_offset = data_offset + i * block_bytes;
+  }
+
+  // Write.
+  outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  outfile.write(reinterpret_cast<const char*>(entries.data()),
+                entries.size() * sizeof(BlockEntry));
+  const std::vector<char> padding(data_offset - table_end, 0);
+  outfile.write(padding.data(), padding.size());
+  for (const BlockIndex& index : block_indices) {
+    const voxblox::Block<TsdfVoxel>& block = layer.getBlockByIndex(index);
+    outfile.write(
+        reinterpret_cast<const char*>(&block.getVoxelByLinearIndex(0)),
+        block_bytes);
+  }
+  if (!outfile.good()) {
+    LOG(ERROR) << "Could not write the raw TSDF blocks to '" << file_path
+               << "'.";
+    return false;
+  }
+  return true;
+}
+
+bool MappedTsdfLayer::open(const std::string& file_path) {
+  close();
+  const int file_descriptor = ::open(file_path.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    LOG(ERROR) << "Could not open raw TSDF block file '" << file_path << "'.";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(file_descriptor, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(FileHeader)) {
+    LOG(ERROR) << "Invalid raw TSDF block file '" << file_path << "'.";
+    ::close(file_descriptor);
+    return false;
+  }
+  data_size_ = file_stat.st_size;
+  data_ = mmap(nullptr, data_size_, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  // The mapping stays valid after closing the file.
+  ::close(file_descriptor);
+  if (data_ == MAP_FAILED) {
+    LOG(ERROR) << "Could not map raw TSDF block file '" << file_path << "'.";
+    data_ = nullptr;
+    return false;
+  }
+
+  // Check the header.
+  const char* bytes = static_cast<const char*>(data_);
+  const auto* header = reinterpret_cast<const FileHeader*>(bytes);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion ||
+      header->voxel_bytes != sizeof(TsdfVoxel) ||
+      header->voxels_per_side == 0u ||
+      sizeof(FileHeader) + header->num_blocks * sizeof(BlockEntry) >
+          data_size_) {
+    LOG(ERROR) << "Raw TSDF block file '" << file_path
+               << "' has an incompatible format.";
+    close();
+    return false;
+  }
+  voxels_per_side_ = header->voxels_per_side;
+  voxel_size_ = header->voxel_size;
+  voxel_size_inv_ = 1.f / voxel_size_;
+  block_size_ = voxel_size_ * voxels_per_side_;
+  block_size_inv_ = 1.f / block_size_;
+
+  // Index the blocks, the voxels stay in the mapped memory.
+  const uint64_t block_bytes = voxels_per_side_ * voxels_per_side_ *
+                               voxels_per_side_ * sizeof(TsdfVoxel);
+  const auto* entries =
+      reinterpret_cast<const BlockEntry*>(bytes + sizeof(FileHeader));
+  blocks_.reserve(header->num_blocks);
+  for (uint64_t i = 0; i < header->num_blocks; ++i) {
+    const BlockEntry& entry = entries[i];
+    if (entry.byte_offset + block_bytes > data_size_) {
+      LOG(ERROR) << "Raw TSDF block file '" << file_path << "' is truncated.";
+      close();
+      return false;
+    }
+    blocks_[BlockIndex(entry.index[0], entry.index[1], entry.index[2])] =
+        reinterpret_cast<const TsdfVoxel*>(bytes + entry.byte_offset);
+  }
+  return true;
+}
+
+void MappedTsdfLayer::close() {
+  blocks_.clear();
+  if (data_) {
+    munmap(data_, data_size_);
+    data_ = nullptr;
+    data_size_ = 0;
+  }
+}
+
+bool MappedTsdfLayer::copyToLayer(TsdfLayer* layer) const {
+  CHECK_NOTNULL(layer);
+  if (layer->voxels_per_side() != voxels_per_side_ ||
+      layer->voxel_size() != voxel_size_) {
+    LOG(ERROR) << "Can not copy raw TSDF blocks into a layer of different "
+                  "layout.";
+    return false;
+  }
+  const size_t num_voxels =
+      voxels_per_side_ * voxels_per_side_ * voxels_per_side_;
+  BlockPool<TsdfVoxel>* block_pool = BlockPool<TsdfVoxel>::getGlobalInstance();
+  for (const auto& index_voxels_pair : blocks_) {
+    auto block =
+        block_pool->allocateBlockPtrByIndex(index_voxels_pair.first, layer);
+    std::memcpy(&block->getVoxelByLinearIndex(0), index_voxels_pair.second,
+                num_voxels * sizeof(TsdfVoxel));
+    block->has_data() = true;
+    block->updated().set();
+  }
+  return true;
+}
+
+const TsdfVoxel* MappedTsdfLayer::getBlockVoxels(
+    const BlockIndex& index) const {
+  auto it = blocks_.find(index);
+  if (it == blocks_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+const TsdfVoxel* MappedTsdfLayer::getVoxelPtrByCoordinates(
+    const Point& coords) const {
+  const BlockIndex block_index =
+      voxblox::getGridIndexFromPoint<BlockIndex>(coords, block_size_inv_);
+  const TsdfVoxel* voxels = getBlockVoxels(block_index);
+  if (!voxels) {
+    return nullptr;
+  }
+
+  // Truncate to the block in case of numerical inaccuracies, as in voxblox.
+  const int max_value = voxels_per_side_ - 1;
+  const VoxelIndex index = voxblox::getGridIndexFromPoint<VoxelIndex>(
+      coords - voxblox::getOriginPointFromGridIndex(block_index, block_size_),
+      voxel_size_inv_);
+  const size_t x = std::max(std::min(index.x(), max_value), 0);
+  const size_t y = std::max(std::min(index.y(), max_value), 0);
+  const size_t z = std::max(std::min(index.z(), max_value), 0);
+  return voxels + x + voxels_per_side_ * (y + z * voxels_per_side_);
+}
+
+void MappedTsdfLayer::getAllAllocatedBlocks(
+    voxblox::BlockIndexList* blocks) const {
+  CHECK_NOTNULL(blocks);
+  blocks->clear();
+  blocks->reserve(blocks_.size());
+  for (const auto& index_voxels_pair : blocks_) {
+    blocks->emplace_back(index_voxels_pair.first);
+  }
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,150 @@
+#include "panoptic_mapping/map/mesh_service.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/common/thread_pool.h"
+
+namespace panoptic_mapping {
+
+void MeshService::Config::checkParams() const {
+  checkParamGE(max_meshing_time_ms, 0.f, "max_meshing_time_ms");
+}
+
+void MeshService::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("max_meshing_time_ms", &max_meshing_time_ms);
+  setupParam("use_class_layer", &use_class_layer);
+}
+
+MeshService::MeshService(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+void MeshService::requestBlocks(int submap_id,
+                                const voxblox::BlockIndexList& block_indices) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  voxblox::IndexSet& requested = pending_set_[submap_id];
+  for (const BlockIndex& index : block_indices) {
+    if (requested.insert(index).second) {
+      pending_.emplace_back(submap_id, index);
+    }
+  }
+}
+
+void MeshService::requestSubmap(const Submap& submap) {
+  voxblox::BlockIndexList block_indices;
+  submap.getTsdfLayer().getAllUpdatedBlocks(voxblox::Update::Status::kMesh,
+                                            &block_indices);
+  requestBlocks(submap.getID(), block_indices);
+}
+
+void MeshService::requestVisibleBlocks(const SubmapCollection& submaps,
+                                       const std::vector<int>& submap_ids,
+                                       const Camera& camera,
+                                       const Transformation& T_M_C) {
+  for (const int submap_id : submap_ids) {
+    if (!submaps.submapIdExists(submap_id)) {
+      continue;
+    }
+    const Submap& submap = submaps.getSubmap(submap_id);
+    requestBlocks(submap_id, camera.findVisibleBlocks(submap, T_M_C));
+  }
+}
+
+size_t MeshService::processRequests(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  Timer timer("mesh_service/process_requests");
+  const auto t_start = std::chrono::steady_clock::now();
+  std::vector<std::pair<int, BlockIndex>> requests;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests.swap(pending_);
+    pending_set_.clear();
+  }
+  if (requests.empty()) {
+    return 0;
+  }
+
+  // Find the outdated blocks of each submap, in order of the requests.
+  std::vector<int> submap_order;
+  std::unordered_map<int, voxblox::BlockIndexList> submap_requests;
+  for (const auto& id_index_pair : requests) {
+    voxblox::BlockIndexList& indices = submap_requests[id_index_pair.first];
+    if (indices.empty()) {
+      submap_order.emplace_back(id_index_pair.first);
+    }
+    indices.emplace_back(id_index_pair.second);
+  }
+  std::vector<std::pair<Submap*, BlockIndex>> tasks;
+  for (const int submap_id : submap_order) {
+    if (!submaps->submapIdExists(submap_id)) {
+      continue;
+    }
+    Submap* submap = submaps->getSubmapPtr(submap_id);
+    for (const BlockIndex& index : submap->prepareMeshUpdate(
+             submap_requests[submap_id], config_.use_class_layer)) {
+      tasks.emplace_back(submap, index);
+    }
+  }
+
+  // Mesh the blocks on the thread pool until the budget is used up.
+  const bool use_budget = config_.max_meshing_time_ms > 0.f;
+  const auto deadline =
+      t_start + std::chrono::microseconds(
+                    static_cast<int64_t>(config_.max_meshing_time_ms * 1e3f));
+  std::atomic<size_t> next_task(0);
+  ThreadPool* thread_pool = submaps->getThreadPool();
+  const size_t num_threads =
+      std::min<size_t>(thread_pool->getNumThreads(), tasks.size());
+  std::vector<std::future<void>> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submit(
+        [&tasks, &next_task, use_budget, deadline]() {
+          while (!use_budget || std::chrono::steady_clock::now() < deadline) {
+            const size_t task_index = next_task++;
+            if (task_index >= tasks.size()) {
+              return;
+            }
+            tasks[task_index].first->updateMeshBlock(tasks[task_index].second);
+          }
+        }));
+  }
+  thread_pool->waitAll(&threads);
+  const size_t num_meshed = std::min(next_task.load(), tasks.size());
+
+  // Carry over the remaining blocks, before the newly requested ones.
+  size_t num_pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<int, BlockIndex>> pending;
+    pending.reserve(tasks.size() - num_meshed + pending_.size());
+    for (size_t i = num_meshed; i < tasks.size(); ++i) {
+      const int submap_id = tasks[i].first->getID();
+      if (pending_set_[submap_id].insert(tasks[i].second).second) {
+        pending.emplace_back(submap_id, tasks[i].second);
+      }
+    }
+    pending.insert(pending.end(), pending_.begin(), pending_.end());
+    pending_ = std::move(pending);
+    num_pending = pending_.size();
+  }
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Meshed " << num_meshed << " blocks, " << num_pending
+      << " requested blocks are pending.";
+  return num_meshed;
+}
+
+size_t MeshService::getNumberOfPendingBlocks() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.size();
+}
+
+}  // namespace panoptic_mapping
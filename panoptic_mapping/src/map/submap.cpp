@@ -1,18 +1,66 @@
 #include "panoptic_mapping/map/submap.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
 #include <memory>
 #include <sstream>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <cblox/QuatTransformation.pb.h>
 #include <cblox/utils/quat_transformation_protobuf_utils.h>
 #include <voxblox/io/layer_io.h>
 
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/map/block_pool.h"
+#include "panoptic_mapping/map/layer_snapshot.h"
 #include "panoptic_mapping/map_management/layer_manipulator.h"
 #include "panoptic_mapping/tools/serialization.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+// Incremental 64 bit FNV-1a hash.
+class ContentHash {
+ public:
+  template <typename T>
+  void add(const T& value) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+  void addBlockIndex(const BlockIndex& index) {
+    add(index.x());
+    add(index.y());
+    add(index.z());
+  }
+  void addVoxel(const TsdfVoxel& voxel) {
+    add(voxel.distance);
+    add(voxel.weight);
+    add(voxel.color.r);
+    add(voxel.color.g);
+    add(voxel.color.b);
+    add(voxel.color.a);
+  }
+  uint64_t get() const { return hash_; }
+
+ private:
+  uint64_t hash_ = 14695981039346656037ull;
+};
+
+// Number of iso-surface points stored per proto if they are not stored per
+// block.
+constexpr size_t kIsoSurfacePointsPerChunk = 100000;
+
+}  // namespace
+
+std::atomic<uint64_t> Submap::access_clock_(0);
+
 void Submap::Config::checkParams() const {
   checkParamGT(voxel_size, 0.f, "voxel_size");
   checkParamNE(truncation_distance, 0.f, "truncation_distance");
@@ -20,6 +68,13 @@ void Submap::Config::checkParams() const {
                  "voxels_per_side is required to be a multiple of 2.");
   checkParamGT(voxels_per_side, 0, "voxels_per_side");
   checkParamConfig(mesh);
+  checkParamConfig(iso_surface);
+  checkParamConfig(tsdf_compression);
+  checkParamConfig(block_collapsing);
+  checkParamConfig(bounding_volume);
+  checkParamConfig(level_of_detail);
+  checkParamConfig(mesh_decimation);
+  checkParamConfig(iso_surface_compaction);
   if (classification.isSetup()) {
     checkParamConfig(classification);
   }
@@ -29,6 +84,10 @@ void Submap::Config::initializeDependentVariableDefaults() {
   if (truncation_distance < 0.f) {
     truncation_distance *= -voxel_size;
   }
+  if (!store_color) {
+    mesh.use_color = false;
+    tsdf_compression.drop_color = true;
+  }
 }
 
 void Submap::Config::setupParamsAndPrinting() {
@@ -36,7 +95,18 @@ void Submap::Config::setupParamsAndPrinting() {
   setupParam("truncation_distance", &truncation_distance);
   setupParam("voxels_per_side", &voxels_per_side);
   setupParam("classification", &classification, "classification");
+  setupParam("allocate_class_blocks_in_surface_band",
+             &allocate_class_blocks_in_surface_band);
+  setupParam("store_color", &store_color);
   setupParam("mesh", &mesh, "mesh");
+  setupParam("iso_surface", &iso_surface, "iso_surface");
+  setupParam("tsdf_compression", &tsdf_compression, "tsdf_compression");
+  setupParam("block_collapsing", &block_collapsing, "block_collapsing");
+  setupParam("bounding_volume", &bounding_volume, "bounding_volume");
+  setupParam("level_of_detail", &level_of_detail, "level_of_detail");
+  setupParam("mesh_decimation", &mesh_decimation, "mesh_decimation");
+  setupParam("iso_surface_compaction", &iso_surface_compaction,
+             "iso_surface_compaction");
 }
 
 bool Submap::Config::useClassLayer() const {
@@ -45,20 +115,39 @@ bool Submap::Config::useClassLayer() const {
 
 Submap::Submap(const Config& config, SubmapIDManager* submap_id_manager,
                InstanceIDManager* instance_id_manager)
-    : config_(config.checkValid()),
+    : Submap(std::make_shared<const Config>(config.checkValid()),
+             submap_id_manager, instance_id_manager) {}
+
+Submap::Submap(std::shared_ptr<const Config> config,
+               SubmapIDManager* submap_id_manager,
+               InstanceIDManager* instance_id_manager)
+    : config_(std::move(config)),
       bounding_volume_(*this),
+      voxel_masks_(config_->voxel_size * std::sqrt(3.f)),
       id_(submap_id_manager),
       instance_id_(instance_id_manager) {
+  CHECK(config_);
   initialize();
 }
 
-Submap::Submap(const Config& config, SubmapIDManager* submap_id_manager,
+Submap::Submap(std::shared_ptr<const Config> config,
+               SubmapIDManager* submap_id_manager,
                InstanceIDManager* instance_id_manager, int submap_id)
-    : config_(config.checkValid()),
+    : config_(std::move(config)),
       bounding_volume_(*this),
+      voxel_masks_(config_->voxel_size * std::sqrt(3.f)),
       id_(submap_id, submap_id_manager),
+      instance_id_(instance_id_manager) {}
+
+Submap::Submap(std::shared_ptr<const Config> config,
+               SubmapIDManager* submap_id_manager,
+               InstanceIDManager* instance_id_manager, DeferInitialization)
+    : config_(std::move(config)),
+      bounding_volume_(*this),
+      voxel_masks_(config_->voxel_size * std::sqrt(3.f)),
+      id_(submap_id_manager),
       instance_id_(instance_id_manager) {
-  initialize();
+  CHECK(config_);
 }
 
 void Submap::initialize() {
@@ -71,26 +160,107 @@ void Submap::initialize() {
   T_M_S_.setIdentity();
   T_M_S_inv_.setIdentity();
 
-  // Setup layers.
-  tsdf_layer_ =
-      std::make_shared<TsdfLayer>(config_.voxel_size, config_.voxels_per_side);
-  mesh_layer_ =
-      std::make_shared<MeshLayer>(config_.voxel_size * config_.voxels_per_side);
-  if (config_.useClassLayer()) {
-    class_layer_ = config_.classification.create(config_.voxel_size,
-                                                 config_.voxels_per_side);
+  // Setup layers. The mesh is set up on first use.
+  tsdf_layer_ = std::make_shared<TsdfLayer>(config_->voxel_size,
+                                           config_->voxels_per_side);
+  if (config_->useClassLayer()) {
+    class_layer_ = config_->classification.create(config_->voxel_size,
+                                                  config_->voxels_per_side);
     has_class_layer_ = true;
   }
+}
 
-  // Setup tools.
+void Submap::initializeMeshing() const {
+  if (has_meshing_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(meshing_mutex_);
+  if (has_meshing_) {
+    return;
+  }
+  mesh_layer_ = std::make_shared<MeshLayer>(config_->voxel_size *
+                                            config_->voxels_per_side);
   mesh_integrator_ = std::make_unique<MeshIntegrator>(
-      config_.mesh, tsdf_layer_, mesh_layer_, class_layer_,
-      config_.truncation_distance);
+      config_->mesh, tsdf_layer_, mesh_layer_, class_layer_,
+      config_->truncation_distance, thread_pool_);
+  has_meshing_ = true;
+}
+
+void Submap::copyMeshTo(Submap* other, const Submap* previous) const {
+  CHECK_NOTNULL(other);
+  if (!has_meshing_) {
+    return;
+  }
+  // The meshes of this submap are updated in place, so they are copied unless
+  // the previous copy holds the same generation of a block, which is shared.
+  const bool use_previous = previous && previous->has_meshing_;
+  other->mesh_layer_ =
+      use_previous ? std::make_shared<MeshLayer>(*previous->mesh_layer_)
+                   : std::make_shared<MeshLayer>(mesh_layer_->block_size());
+  voxblox::BlockIndexList previous_indices;
+  other->mesh_layer_->getAllAllocatedMeshes(&previous_indices);
+  for (const BlockIndex& index : previous_indices) {
+    if (!mesh_layer_->hasMesh(index)) {
+      other->mesh_layer_->removeMesh(index);
+    }
+  }
+  voxblox::BlockIndexList mesh_indices;
+  mesh_layer_->getAllAllocatedMeshes(&mesh_indices);
+  for (const BlockIndex& index : mesh_indices) {
+    const uint64_t generation = mesh_integrator_->getMeshGeneration(index);
+    if (use_previous && generation != 0u &&
+        other->mesh_layer_->hasMesh(index) &&
+        previous->mesh_integrator_->getMeshGeneration(index) == generation) {
+      continue;
+    }
+    other->mesh_layer_->removeMesh(index);
+    *other->mesh_layer_->allocateMeshPtrByIndex(index) =
+        mesh_layer_->getMeshByIndex(index);
+  }
+  other->mesh_integrator_ = std::make_unique<MeshIntegrator>(
+      other->config_->mesh, other->tsdf_layer_, other->mesh_layer_,
+      other->class_layer_, other->config_->truncation_distance,
+      other->thread_pool_);
+  other->mesh_integrator_->copyMeshGenerationsFrom(*mesh_integrator_);
+  other->has_meshing_ = true;
+}
+
+void Submap::setThreadPool(ThreadPool* thread_pool) {
+  thread_pool_ = CHECK_NOTNULL(thread_pool);
+  std::lock_guard<std::mutex> lock(meshing_mutex_);
+  if (mesh_integrator_) {
+    mesh_integrator_->setThreadPool(thread_pool_);
+  }
 }
 
 void Submap::setT_M_S(const Transformation& T_M_S) {
   T_M_S_ = T_M_S;
   T_M_S_inv_ = T_M_S_.inverse();
+  updateSpatialIndex();
+  if (change_feed_) {
+    change_feed_->recordSubmap(getID(), ChangeFeed::SubmapChange::kMoved);
+  }
+}
+
+void Submap::setChangeState(ChangeState state) {
+  if (change_feed_ && state != change_state_) {
+    change_feed_->recordSubmap(getID(), ChangeFeed::SubmapChange::kChangeState);
+  }
+  change_state_ = state;
+}
+
+void Submap::setInstanceID(int id) {
+  if (label_table_) {
+    label_table_->setInstanceID(getID(), instance_id_, id);
+  }
+  instance_id_ = id;
+}
+
+void Submap::setClassID(int id) {
+  if (label_table_) {
+    label_table_->setClassID(getID(), id);
+  }
+  class_id_ = id;
 }
 
 void Submap::getProto(SubmapProto* proto) const {
@@ -104,14 +274,16 @@ void Submap::getProto(SubmapProto* proto) const {
 
   // Store TSDF data.
   proto->set_num_blocks(tsdf_layer_->getNumberOfAllocatedBlocks());
-  proto->set_voxel_size(config_.voxel_size);
-  proto->set_voxels_per_side(config_.voxels_per_side);
-  proto->set_truncation_distance(config_.truncation_distance);
+  proto->set_voxel_size(config_->voxel_size);
+  proto->set_voxels_per_side(config_->voxels_per_side);
+  proto->set_truncation_distance(config_->truncation_distance);
 
   // Store classification data.
   if (has_class_layer_) {
     proto->set_class_voxel_type(static_cast<int>(class_layer_->getVoxelType()));
     proto->set_num_class_blocks(class_layer_->getNumberOfAllocatedBlocks());
+    proto->set_class_block_encoding(
+        static_cast<uint32_t>(ClassBlockEncoding::kRunLength));
   } else {
     proto->set_num_class_blocks(0);
   }
@@ -123,11 +295,15 @@ void Submap::getProto(SubmapProto* proto) const {
   proto->set_frame_name(frame_name_);
 }
 
-bool Submap::saveToStream(std::fstream* outfile_ptr) const {
+bool Submap::saveToStream(std::fstream* outfile_ptr,
+                          bool include_derived_data) const {
   CHECK_NOTNULL(outfile_ptr);
   // Saving the submap header.
   SubmapProto submap_proto;
   getProto(&submap_proto);
+  include_derived_data = include_derived_data && hasUpToDateDerivedData();
+  submap_proto.set_has_derived_data(include_derived_data);
+  submap_proto.set_num_blocks(getNumberOfTsdfBlocks());
   if (!voxblox::utils::writeProtoMsgToStream(submap_proto, outfile_ptr)) {
     LOG(ERROR) << "Could not write submap proto message.";
     outfile_ptr->close();
@@ -136,7 +312,7 @@ bool Submap::saveToStream(std::fstream* outfile_ptr) const {
 
   // TSDF Layer.
   constexpr bool kIncludeAllBlocks = true;
-  const TsdfLayer& tsdf_layer = *tsdf_layer_;
+  const TsdfLayer& tsdf_layer = getTsdfLayer();
   if (!tsdf_layer.saveBlocksToStream(kIncludeAllBlocks,
                                      voxblox::BlockIndexList(), outfile_ptr)) {
     LOG(ERROR) << "Could not write submap tsdf blocks to stream.";
@@ -144,21 +320,343 @@ bool Submap::saveToStream(std::fstream* outfile_ptr) const {
     return false;
   }
 
+  // Collapsed blocks are stored expanded.
+  if (collapsed_blocks_) {
+    for (const auto& index_voxel_pair : collapsed_blocks_->getBlocks()) {
+      TsdfBlock block(tsdf_layer.voxels_per_side(), tsdf_layer.voxel_size(),
+                      voxblox::getOriginPointFromGridIndex(
+                          index_voxel_pair.first, tsdf_layer.block_size()));
+      for (size_t i = 0; i < block.num_voxels(); ++i) {
+        block.getVoxelByLinearIndex(i) = index_voxel_pair.second;
+      }
+      block.has_data() = true;
+      voxblox::BlockProto block_proto;
+      block.getProto(&block_proto);
+      if (!voxblox::utils::writeProtoMsgToStream(block_proto, outfile_ptr)) {
+        LOG(ERROR) << "Could not write submap tsdf blocks to stream.";
+        outfile_ptr->close();
+        return false;
+      }
+    }
+  }
+
   // Class Layer.
   if (has_class_layer_) {
-    if (!class_layer_->saveBlocksToStream(
-            kIncludeAllBlocks, voxblox::BlockIndexList(), outfile_ptr)) {
+    voxblox::BlockIndexList class_block_indices;
+    class_layer_->getAllAllocatedBlocks(&class_block_indices);
+    if (!saveClassBlocksToStream(*class_layer_, class_block_indices,
+                                 outfile_ptr)) {
       LOG(ERROR) << "Could not write submap classification blocks to stream.";
       outfile_ptr->close();
       return false;
     }
   }
+
+  // Derived data.
+  if (include_derived_data && !saveDerivedDataToStream(outfile_ptr)) {
+    LOG(ERROR) << "Could not write submap derived data to stream.";
+    outfile_ptr->close();
+    return false;
+  }
+  return true;
+}
+
+uint64_t Submap::computeContentHash() const {
+  // The blocks are hashed individually and summed such that the result does
+  // not depend on the order of the blocks.
+  ContentHash layout_hash;
+  layout_hash.add(config_->voxel_size);
+  layout_hash.add(config_->voxels_per_side);
+  layout_hash.add(config_->truncation_distance);
+  uint64_t result = layout_hash.get();
+
+  const TsdfLayer& tsdf_layer = getTsdfLayer();
+  voxblox::BlockIndexList block_indices;
+  tsdf_layer.getAllAllocatedBlocks(&block_indices);
+  for (const BlockIndex& index : block_indices) {
+    const TsdfBlock& block = tsdf_layer.getBlockByIndex(index);
+    ContentHash hash;
+    hash.add('t');
+    hash.addBlockIndex(index);
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      hash.addVoxel(block.getVoxelByLinearIndex(i));
+    }
+    result += hash.get();
+  }
+  // Collapsed blocks are stored expanded, so they are hashed the same way.
+  if (collapsed_blocks_) {
+    const size_t num_voxels = std::pow(config_->voxels_per_side, 3);
+    for (const auto& index_voxel_pair : collapsed_blocks_->getBlocks()) {
+      ContentHash hash;
+      hash.add('t');
+      hash.addBlockIndex(index_voxel_pair.first);
+      for (size_t i = 0; i < num_voxels; ++i) {
+        hash.addVoxel(index_voxel_pair.second);
+      }
+      result += hash.get();
+    }
+  }
+  if (has_class_layer_) {
+    block_indices.clear();
+    class_layer_->getAllAllocatedBlocks(&block_indices);
+    const size_t num_voxels = std::pow(class_layer_->voxels_per_side(), 3);
+    std::vector<uint32_t> words;
+    for (const BlockIndex& index : block_indices) {
+      ClassBlock::ConstPtr block = class_layer_->getBlockConstPtrByIndex(index);
+      ContentHash hash;
+      hash.add('c');
+      hash.addBlockIndex(index);
+      words.resize(getSerializedClassBlockSize(*block, num_voxels));
+      serializeClassBlock(*block, num_voxels, words.data());
+      for (const uint32_t word : words) {
+        hash.add(word);
+      }
+      result += hash.get();
+    }
+  }
+  return result;
+}
+
+bool Submap::hasUpToDateDerivedData() const {
+  // Derived data is up to date if no block is flagged for an update.
+  if (!has_meshing_) {
+    return false;
+  }
+  const TsdfLayer& tsdf_layer = getTsdfLayer();
+  voxblox::BlockIndexList updated_blocks;
+  tsdf_layer.getAllUpdatedBlocks(voxblox::Update::kMesh, &updated_blocks);
+  if (!updated_blocks.empty()) {
+    return false;
+  }
+  if (config_->iso_surface.extract_from_tsdf) {
+    tsdf_layer.getAllUpdatedBlocks(kIsoSurfaceUpdateFlag, &updated_blocks);
+  }
+  return updated_blocks.empty();
+}
+
+bool Submap::saveDerivedDataToStream(std::ostream* outfile_ptr) const {
+  CHECK_NOTNULL(outfile_ptr);
+  SubmapDerivedDataProto derived_proto;
+  derived_proto.set_content_hash(computeContentHash());
+  derived_proto.set_center_x(bounding_volume_.getCenter().x());
+  derived_proto.set_center_y(bounding_volume_.getCenter().y());
+  derived_proto.set_center_z(bounding_volume_.getCenter().z());
+  derived_proto.set_radius(bounding_volume_.getRadius());
+  derived_proto.set_center_radius(bounding_volume_.getCenterRadius());
+
+  // Iso-surface points are stored per block if they were extracted per block.
+  // Compacted points are stored decoded.
+  const std::vector<IsoSurfacePoint> decoded_points =
+      compact_iso_surface_points_ ? compact_iso_surface_points_->decodeAll()
+                                  : std::vector<IsoSurfacePoint>();
+  const std::vector<IsoSurfacePoint>& points =
+      compact_iso_surface_points_ ? decoded_points : iso_surface_points_;
+  const bool points_per_block = !iso_surface_blocks_.empty();
+  const size_t num_chunks =
+      points_per_block ? iso_surface_blocks_.size()
+                       : (points.size() + kIsoSurfacePointsPerChunk - 1) /
+                             kIsoSurfacePointsPerChunk;
+  derived_proto.set_num_iso_surface_chunks(num_chunks);
+  voxblox::BlockIndexList mesh_indices;
+  mesh_layer_->getAllAllocatedMeshes(&mesh_indices);
+  derived_proto.set_num_mesh_blocks(mesh_indices.size());
+  if (!writeProtoMsgToStream(derived_proto, outfile_ptr)) {
+    return false;
+  }
+
+  // Iso-surface points.
+  auto add_points = [](const IsoSurfacePoint* begin, size_t num_points,
+                       IsoSurfacePointsProto* proto) {
+    proto->mutable_points()->Reserve(4 * num_points);
+    for (size_t i = 0; i < num_points; ++i) {
+      const IsoSurfacePoint& point = begin[i];
+      proto->add_points(point.position.x());
+      proto->add_points(point.position.y());
+      proto->add_points(point.position.z());
+      proto->add_points(point.weight);
+    }
+  };
+  if (points_per_block) {
+    for (const auto& index_points_pair : iso_surface_blocks_) {
+      IsoSurfacePointsProto proto;
+      proto.set_has_block_index(true);
+      proto.set_index_x(index_points_pair.first.x());
+      proto.set_index_y(index_points_pair.first.y());
+      proto.set_index_z(index_points_pair.first.z());
+      add_points(index_points_pair.second.data(),
+                 index_points_pair.second.size(), &proto);
+      if (!writeProtoMsgToStream(proto, outfile_ptr)) {
+        return false;
+      }
+    }
+  } else {
+    for (size_t i = 0; i < num_chunks; ++i) {
+      const size_t begin = i * kIsoSurfacePointsPerChunk;
+      IsoSurfacePointsProto proto;
+      add_points(points.data() + begin,
+                 std::min(kIsoSurfacePointsPerChunk, points.size() - begin),
+                 &proto);
+      if (!writeProtoMsgToStream(proto, outfile_ptr)) {
+        return false;
+      }
+    }
+  }
+
+  // Mesh.
+  for (const BlockIndex& index : mesh_indices) {
+    const voxblox::Mesh& mesh = mesh_layer_->getMeshByIndex(index);
+    MeshBlockProto proto;
+    proto.set_index_x(index.x());
+    proto.set_index_y(index.y());
+    proto.set_index_z(index.z());
+    proto.mutable_vertices()->Reserve(3 * mesh.vertices.size());
+    for (const Point& vertex : mesh.vertices) {
+      proto.add_vertices(vertex.x());
+      proto.add_vertices(vertex.y());
+      proto.add_vertices(vertex.z());
+    }
+    for (const Point& normal : mesh.normals) {
+      proto.add_normals(normal.x());
+      proto.add_normals(normal.y());
+      proto.add_normals(normal.z());
+    }
+    for (const Color& color : mesh.colors) {
+      proto.add_colors(static_cast<uint32_t>(color.r) << 24 |
+                       static_cast<uint32_t>(color.g) << 16 |
+                       static_cast<uint32_t>(color.b) << 8 | color.a);
+    }
+    for (const voxblox::VertexIndex vertex_index : mesh.indices) {
+      proto.add_indices(vertex_index);
+    }
+    if (!writeProtoMsgToStream(proto, outfile_ptr)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Submap::loadDerivedDataFromStream(std::istream* proto_file_ptr,
+                                       uint64_t* tmp_byte_offset_ptr,
+                                       bool* applied) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  CHECK_NOTNULL(applied);
+  *applied = false;
+  SubmapDerivedDataProto derived_proto;
+  if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &derived_proto,
+                                              tmp_byte_offset_ptr)) {
+    return false;
+  }
+  std::vector<IsoSurfacePointsProto> point_protos(
+      derived_proto.num_iso_surface_chunks());
+  for (IsoSurfacePointsProto& proto : point_protos) {
+    if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &proto,
+                                                tmp_byte_offset_ptr)) {
+      return false;
+    }
+  }
+  std::vector<MeshBlockProto> mesh_protos(derived_proto.num_mesh_blocks());
+  for (MeshBlockProto& proto : mesh_protos) {
+    if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &proto,
+                                                tmp_byte_offset_ptr)) {
+      return false;
+    }
+  }
+
+  // The data is only used if it was computed from the loaded layers.
+  if (derived_proto.content_hash() != computeContentHash()) {
+    LOG(WARNING) << "The stored derived data of submap " << getID()
+                 << " does not match its layers and is recomputed.";
+    return true;
+  }
+  bounding_volume_.set(Point(derived_proto.center_x(), derived_proto.center_y(),
+                             derived_proto.center_z()),
+                       derived_proto.radius(), derived_proto.center_radius());
+  updateSpatialIndex();
+
+  // Iso-surface points.
+  iso_surface_points_.clear();
+  iso_surface_blocks_.clear();
+  compact_iso_surface_points_.reset();
+  for (const IsoSurfacePointsProto& proto : point_protos) {
+    std::vector<IsoSurfacePoint> points;
+    points.reserve(proto.points_size() / 4);
+    for (int i = 0; i + 3 < proto.points_size(); i += 4) {
+      points.emplace_back(
+          Point(proto.points(i), proto.points(i + 1), proto.points(i + 2)),
+          proto.points(i + 3));
+    }
+    iso_surface_points_.insert(iso_surface_points_.end(), points.begin(),
+                               points.end());
+    if (proto.has_block_index()) {
+      iso_surface_blocks_[BlockIndex(proto.index_x(), proto.index_y(),
+                                     proto.index_z())] = std::move(points);
+    }
+  }
+  if (!is_active_ && config_->iso_surface_compaction.compact_inactive) {
+    compactIsoSurfacePoints();
+  }
+
+  // Mesh.
+  initializeMeshing();
+  voxblox::BlockIndexList mesh_indices;
+  for (const MeshBlockProto& proto : mesh_protos) {
+    const BlockIndex index(proto.index_x(), proto.index_y(), proto.index_z());
+    voxblox::Mesh::Ptr mesh = mesh_layer_->allocateMeshPtrByIndex(index);
+    mesh->clear();
+    for (int i = 0; i + 2 < proto.vertices_size(); i += 3) {
+      mesh->vertices.emplace_back(proto.vertices(i), proto.vertices(i + 1),
+                                  proto.vertices(i + 2));
+    }
+    for (int i = 0; i + 2 < proto.normals_size(); i += 3) {
+      mesh->normals.emplace_back(proto.normals(i), proto.normals(i + 1),
+                                 proto.normals(i + 2));
+    }
+    for (const uint32_t color : proto.colors()) {
+      mesh->colors.emplace_back(color >> 24, (color >> 16) & 0xFF,
+                                (color >> 8) & 0xFF, color & 0xFF);
+    }
+    mesh->indices.assign(proto.indices().begin(), proto.indices().end());
+    mesh->updated = true;
+    mesh_indices.push_back(index);
+  }
+  mesh_integrator_->setMeshesGenerated(mesh_indices);
+
+  // Nothing needs to be recomputed.
+  voxblox::BlockIndexList block_indices;
+  tsdf_layer_->getAllAllocatedBlocks(&block_indices);
+  for (const BlockIndex& index : block_indices) {
+    TsdfBlock& block = tsdf_layer_->getBlockByIndex(index);
+    block.setUpdated(voxblox::Update::kMesh, false);
+    block.setUpdated(kIsoSurfaceUpdateFlag, false);
+  }
+  *applied = true;
+  return true;
+}
+
+bool Submap::skipDerivedDataFromStream(std::istream* proto_file_ptr,
+                                       uint64_t* tmp_byte_offset_ptr) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  SubmapDerivedDataProto derived_proto;
+  if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &derived_proto,
+                                              tmp_byte_offset_ptr)) {
+    return false;
+  }
+  const uint32_t num_messages =
+      derived_proto.num_iso_surface_chunks() + derived_proto.num_mesh_blocks();
+  for (uint32_t i = 0u; i < num_messages; ++i) {
+    if (!skipProtoMsgFromStream(proto_file_ptr, tmp_byte_offset_ptr)) {
+      return false;
+    }
+  }
   return true;
 }
 
 std::unique_ptr<Submap> Submap::loadFromStream(
     std::istream* proto_file_ptr, uint64_t* tmp_byte_offset_ptr,
-    SubmapIDManager* id_manager, InstanceIDManager* instance_manager) {
+    SubmapIDManager* id_manager, InstanceIDManager* instance_manager,
+    bool* loaded_derived_data, const SubmapLoadOptions& options) {
   CHECK_NOTNULL(proto_file_ptr);
   CHECK_NOTNULL(tmp_byte_offset_ptr);
 
@@ -169,75 +667,695 @@ std::unique_ptr<Submap> Submap::loadFromStream(
     LOG(ERROR) << "Could not read tsdf submap protobuf message.";
     return nullptr;
   }
+  auto submap = createFromProto(submap_proto, id_manager, instance_manager);
+  if (!submap->loadLayersFromStream(submap_proto, proto_file_ptr,
+                                    tmp_byte_offset_ptr, loaded_derived_data,
+                                    options)) {
+    return nullptr;
+  }
+  return submap;
+}
 
+std::unique_ptr<Submap> Submap::createFromProto(
+    const SubmapProto& submap_proto, SubmapIDManager* id_manager,
+    InstanceIDManager* instance_manager) {
   // Creating a new submap to hold the data.
   Config cfg;
   cfg.voxel_size = submap_proto.voxel_size();
   cfg.voxels_per_side = submap_proto.voxels_per_side();
   cfg.truncation_distance = submap_proto.truncation_distance();
   auto submap = std::make_unique<Submap>(cfg, id_manager, instance_manager);
+  submap->has_class_layer_ = submap_proto.num_class_blocks() > 0;
+  submap->applyProto(submap_proto);
+  return submap;
+}
 
+void Submap::applyProto(const SubmapProto& submap_proto) {
   // Load the submap data.
-  submap->has_class_layer_ = submap_proto.num_class_blocks() > 0;
-  submap->setInstanceID(submap_proto.instance_id());
-  submap->setClassID(submap_proto.class_id());
-  submap->setLabel(static_cast<PanopticLabel>(submap_proto.panoptic_label()));
-  submap->setName(submap_proto.name());
-  submap->setChangeState(static_cast<ChangeState>(submap_proto.change_state()));
+  setInstanceID(submap_proto.instance_id());
+  setClassID(submap_proto.class_id());
+  setLabel(static_cast<PanopticLabel>(submap_proto.panoptic_label()));
+  setName(submap_proto.name());
+  setChangeState(static_cast<ChangeState>(submap_proto.change_state()));
+
+  // Load the transformation.
+  Transformation T_M_S;
+  cblox::QuatTransformationProto transformation_proto =
+      submap_proto.transform();
+  cblox::conversions::transformProtoToKindr(transformation_proto, &T_M_S);
+  setT_M_S(T_M_S);
+  setFrameName(submap_proto.frame_name());
+}
+
+bool Submap::saveBlocksToStream(const voxblox::BlockIndexList& block_indices,
+                                std::ostream* outfile_ptr,
+                                const TsdfQuantization* quantization) const {
+  CHECK_NOTNULL(outfile_ptr);
+  const TsdfLayer& tsdf_layer = getTsdfLayer();
+  voxblox::BlockIndexList class_block_indices;
+  if (has_class_layer_) {
+    for (const BlockIndex& index : block_indices) {
+      if (class_layer_->hasBlock(index)) {
+        class_block_indices.push_back(index);
+      }
+    }
+  }
+
+  // Collapsed blocks are stored expanded.
+  voxblox::BlockIndexList tsdf_block_indices;
+  voxblox::BlockIndexList collapsed_block_indices;
+  for (const BlockIndex& index : block_indices) {
+    if (collapsed_blocks_ && collapsed_blocks_->getVoxel(index)) {
+      collapsed_block_indices.push_back(index);
+    } else {
+      tsdf_block_indices.push_back(index);
+    }
+  }
+
+  // Submaps without color never write colors.
+  TsdfQuantization colorless_quantization;
+  if (quantization && !config_->store_color) {
+    colorless_quantization = *quantization;
+    colorless_quantization.drop_color = true;
+    quantization = &colorless_quantization;
+  }
+
+  // Saving the submap header.
+  SubmapProto submap_proto;
+  getProto(&submap_proto);
+  submap_proto.set_num_blocks(block_indices.size());
+  submap_proto.set_num_class_blocks(class_block_indices.size());
+  submap_proto.set_tsdf_block_encoding(static_cast<uint32_t>(
+      quantization ? TsdfBlockEncoding::kQuantized
+                   : TsdfBlockEncoding::kVoxbloxBlock));
+  if (!writeProtoMsgToStream(submap_proto, outfile_ptr)) {
+    LOG(ERROR) << "Could not write submap proto message.";
+    return false;
+  }
+
+  // Blocks.
+  if (!saveTsdfBlocksToStream(tsdf_layer, tsdf_block_indices,
+                              config_->truncation_distance, quantization,
+                              outfile_ptr)) {
+    LOG(ERROR) << "Could not write submap tsdf blocks to stream.";
+    return false;
+  }
+  if (!collapsed_block_indices.empty()) {
+    // Expand one block at a time to not expand all collapsed blocks at once.
+    TsdfLayer expanded_layer(tsdf_layer.voxel_size(),
+                             tsdf_layer.voxels_per_side());
+    for (const BlockIndex& index : collapsed_block_indices) {
+      CollapsedTsdfBlocks::expandBlock(
+          index, *collapsed_blocks_->getVoxel(index), &expanded_layer);
+      if (!saveTsdfBlocksToStream(expanded_layer, {index},
+                                  config_->truncation_distance, quantization,
+                                  outfile_ptr)) {
+        LOG(ERROR) << "Could not write submap tsdf blocks to stream.";
+        return false;
+      }
+      BlockPool<TsdfVoxel>::getGlobalInstance()->removeBlock(index,
+                                                             &expanded_layer);
+    }
+  }
+  if (!class_block_indices.empty() &&
+      !saveClassBlocksToStream(*class_layer_, class_block_indices,
+                               outfile_ptr)) {
+    LOG(ERROR) << "Could not write submap classification blocks to stream.";
+    return false;
+  }
+  return true;
+}
+
+bool Submap::applyUpdateFromStream(const SubmapProto& submap_proto,
+                                   std::istream* proto_file_ptr,
+                                   uint64_t* tmp_byte_offset_ptr,
+                                   voxblox::BlockIndexList* updated_blocks) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  restoreLayers();
+  applyProto(submap_proto);
+  if (!loadTsdfBlocksFromStream(submap_proto, proto_file_ptr,
+                                tmp_byte_offset_ptr, tsdf_layer_.get(),
+                                updated_blocks)) {
+    LOG(ERROR) << "Could not load the tsdf blocks from stream.";
+    return false;
+  }
+  if (submap_proto.num_class_blocks() == 0) {
+    return true;
+  }
+  if (class_layer_) {
+    return loadClassBlocksFromStream(submap_proto, proto_file_ptr,
+                                     tmp_byte_offset_ptr, class_layer_.get());
+  }
+  class_layer_ = loadClassLayerFromStream(submap_proto, proto_file_ptr,
+                                          tmp_byte_offset_ptr);
+  has_class_layer_ = static_cast<bool>(class_layer_);
+  return has_class_layer_;
+}
+
+bool Submap::sharesDataWith(const Submap& other) const {
+  if (tsdf_layer_ == other.tsdf_layer_) {
+    return class_layer_ == other.class_layer_ &&
+           collapsed_blocks_ == other.collapsed_blocks_;
+  }
+  if (compressed_tsdf_layer_ &&
+      compressed_tsdf_layer_ == other.compressed_tsdf_layer_) {
+    return true;
+  }
+  return spill_file_ && spill_file_ == other.spill_file_ &&
+         spill_offset_ == other.spill_offset_;
+}
+
+bool Submap::loadLayersFromStream(const SubmapProto& submap_proto,
+                                  std::istream* proto_file_ptr,
+                                  uint64_t* tmp_byte_offset_ptr,
+                                  bool* loaded_derived_data,
+                                  const SubmapLoadOptions& options) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  if (loaded_derived_data) {
+    *loaded_derived_data = false;
+  }
+
+  // Only keep blocks whose bounding sphere intersects the box.
+  BlockFilter block_filter;
+  size_t num_dropped_blocks = 0;
+  if (options.use_bounding_box) {
+    const FloatingPoint block_size = tsdf_layer_->block_size();
+    const FloatingPoint block_radius = std::sqrt(3.f) * 0.5f * block_size;
+    block_filter = [&](const BlockIndex& index) {
+      const Point center_S =
+          (index.cast<FloatingPoint>() + Point::Constant(0.5f)) * block_size;
+      const Point center_M = T_M_S_ * center_S;
+      const Point closest = center_M.cwiseMax(options.box_min_M)
+                                .cwiseMin(options.box_max_M);
+      if ((center_M - closest).norm() <= block_radius) {
+        return true;
+      }
+      ++num_dropped_blocks;
+      return false;
+    };
+  }
 
   // Load the TSDF layer.
-  if (!voxblox::io::LoadBlocksFromStream(
-          submap_proto.num_blocks(), TsdfLayer::BlockMergingStrategy::kReplace,
-          proto_file_ptr, submap->tsdf_layer_.get(), tmp_byte_offset_ptr)) {
+  if (!loadTsdfBlocksFromStream(submap_proto, proto_file_ptr,
+                                tmp_byte_offset_ptr, tsdf_layer_.get(),
+                                nullptr, block_filter)) {
     LOG(ERROR) << "Could not load the tsdf blocks from stream.";
-    return nullptr;
+    return false;
   }
 
   // Load the classification layer.
-  if (submap_proto.num_class_blocks() > 0) {
-    submap->class_layer_ = loadClassLayerFromStream(
-        submap_proto, proto_file_ptr, tmp_byte_offset_ptr);
-    if (!submap->class_layer_) {
+  if (submap_proto.num_class_blocks() > 0 && !options.load_class_layer) {
+    for (uint32_t i = 0u; i < submap_proto.num_class_blocks(); ++i) {
+      if (!skipProtoMsgFromStream(proto_file_ptr, tmp_byte_offset_ptr)) {
+        LOG(ERROR) << "Could not skip the classification layer in stream.";
+        return false;
+      }
+    }
+    has_class_layer_ = false;
+  } else if (submap_proto.num_class_blocks() > 0) {
+    class_layer_ = loadClassLayerFromStream(submap_proto, proto_file_ptr,
+                                            tmp_byte_offset_ptr);
+    if (!class_layer_) {
       LOG(ERROR) << "Could not load the classification layer from stream.";
-      return nullptr;
+      return false;
+    }
+    if (num_dropped_blocks > 0) {
+      voxblox::BlockIndexList class_blocks;
+      class_layer_->getAllAllocatedBlocks(&class_blocks);
+      for (const BlockIndex& index : class_blocks) {
+        if (!tsdf_layer_->hasBlock(index)) {
+          class_layer_->removeBlock(index);
+        }
+      }
     }
   }
 
-  // Load the transformation.
-  Transformation T_M_S;
-  cblox::QuatTransformationProto transformation_proto =
-      submap_proto.transform();
-  cblox::conversions::transformProtoToKindr(transformation_proto, &T_M_S);
-  submap->setT_M_S(T_M_S);
-  submap->setFrameName(submap_proto.frame_name());
-
-  return submap;
+  // Load the derived data. It does not match partially loaded layers.
+  if (submap_proto.has_derived_data() && num_dropped_blocks > 0) {
+    if (!skipDerivedDataFromStream(proto_file_ptr, tmp_byte_offset_ptr)) {
+      LOG(ERROR) << "Could not skip the derived data in stream.";
+      return false;
+    }
+  } else if (submap_proto.has_derived_data()) {
+    bool applied;
+    if (!loadDerivedDataFromStream(proto_file_ptr, tmp_byte_offset_ptr,
+                                   &applied)) {
+      LOG(ERROR) << "Could not load the derived data from stream.";
+      return false;
+    }
+    if (loaded_derived_data) {
+      *loaded_derived_data = applied;
+    }
+  }
+  return true;
 }
 
-void Submap::finishActivePeriod() {
+void Submap::finishActivePeriod(bool defer_finishing) {
   if (!is_active_) {
     return;
   }
   is_active_ = false;
   // Since the submap was active just before we assume it still exists.
   change_state_ = ChangeState::kPersistent;
+  if (defer_finishing) {
+    is_finishing_ = true;
+    return;
+  }
+  finishDeactivation();
+}
+
+void Submap::finishDeactivation() {
+  is_finishing_ = false;
   updateEverything();
+  if (change_feed_) {
+    change_feed_->recordSubmap(getID(), ChangeFeed::SubmapChange::kFinished);
+  }
+  if (config_->level_of_detail.num_levels > 0 && !level_of_detail_) {
+    level_of_detail_ = std::make_shared<const LevelOfDetailPyramid>(
+        config_->level_of_detail, *tsdf_layer_, config_->mesh,
+        config_->truncation_distance);
+  }
+  if (config_->mesh_decimation.decimate_inactive && has_meshing_ &&
+      !decimated_mesh_) {
+    const IndexedMesh::Config& decimation = config_->mesh_decimation;
+    auto mesh = std::make_shared<IndexedMesh>(
+        *mesh_layer_, decimation.weld_distance * config_->voxel_size);
+    mesh->decimate(static_cast<size_t>(decimation.target_ratio *
+                                       mesh->getNumberOfTriangles()),
+                   decimation.max_error * config_->voxel_size);
+    decimated_mesh_ = std::move(mesh);
+  }
+  if (config_->iso_surface_compaction.compact_inactive) {
+    compactIsoSurfacePoints();
+  }
+  if (config_->tsdf_compression.compress_inactive) {
+    compressTsdfLayer();
+  }
+}
+
+void Submap::adoptFinishedClone(Submap* finished) {
+  CHECK_NOTNULL(finished);
+  CHECK_EQ(finished->getID(), getID());
+  {
+    std::lock_guard<std::mutex> layer_lock(layer_mutex_);
+    std::lock_guard<std::mutex> meshing_lock(meshing_mutex_);
+    // The mesh integrator refers to the layers, so they are swapped jointly.
+    // The clone may have been re-voxelized.
+    config_ = finished->config_;
+    tsdf_layer_.swap(finished->tsdf_layer_);
+    class_layer_.swap(finished->class_layer_);
+    has_class_layer_ = finished->has_class_layer_;
+    mesh_layer_.swap(finished->mesh_layer_);
+    mesh_integrator_.swap(finished->mesh_integrator_);
+    has_meshing_ = static_cast<bool>(finished->has_meshing_);
+    compressed_tsdf_layer_ = std::move(finished->compressed_tsdf_layer_);
+    tsdf_is_compressed_.store(finished->isTsdfLayerCompressed(),
+                              std::memory_order_release);
+    collapsed_blocks_ = std::move(finished->collapsed_blocks_);
+  }
+  iso_surface_points_.swap(finished->iso_surface_points_);
+  iso_surface_blocks_.swap(finished->iso_surface_blocks_);
+  compact_iso_surface_points_ =
+      std::move(finished->compact_iso_surface_points_);
+  level_of_detail_ = std::move(finished->level_of_detail_);
+  decimated_mesh_ = std::move(finished->decimated_mesh_);
+  bounding_volume_.copyFrom(finished->bounding_volume_);
+  voxel_masks_.copyFrom(finished->voxel_masks_);
+  is_finishing_ = false;
+  updateSpatialIndex();
+  if (change_feed_) {
+    change_feed_->recordSubmap(getID(), ChangeFeed::SubmapChange::kFinished);
+  }
+}
+
+void Submap::compactIsoSurfacePoints() {
+  if (compact_iso_surface_points_) {
+    return;
+  }
+  compact_iso_surface_points_ = std::make_shared<const CompactIsoSurfacePoints>(
+      iso_surface_points_, config_->voxel_size * config_->voxels_per_side,
+      config_->iso_surface_compaction.max_points);
+  iso_surface_points_ = std::vector<IsoSurfacePoint>();
+  iso_surface_blocks_.clear();
+}
+
+void Submap::compressTsdfLayer() {
+  if (isTsdfLayerCompressed() || isEvicted()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(layer_mutex_);
+  if (!compressed_tsdf_layer_) {
+    compressed_tsdf_layer_ = std::make_shared<const CompressedTsdfLayer>(
+        config_->tsdf_compression, *tsdf_layer_, config_->truncation_distance);
+  }
+  // Keep the layer object since it is shared with the mesh integrator.
+  tsdf_layer_->removeAllBlocks();
+  tsdf_is_compressed_.store(true, std::memory_order_release);
+}
+
+bool Submap::evictLayers(const std::shared_ptr<SubmapSpillFile>& spill_file) {
+  CHECK_NOTNULL(spill_file.get());
+  if (isEvicted()) {
+    return true;
+  }
+  restoreLayers();
+
+  // Append the submap to the spill file.
+  {
+    std::lock_guard<std::mutex> file_lock(spill_file->mutex());
+    std::fstream* stream = spill_file->stream();
+    if (!spill_file->isOpen()) {
+      return false;
+    }
+    stream->clear();
+    stream->seekp(0, std::ios::end);
+    const uint64_t offset = stream->tellp();
+    if (!saveToStream(stream)) {
+      LOG(ERROR) << "Could not evict submap " << static_cast<int>(id_)
+                 << " to '" << spill_file->getFilePath() << "'.";
+      return false;
+    }
+    stream->flush();
+    spill_offset_ = offset;
+  }
+
+  // Release the layers, the objects are kept since they are shared with the
+  // mesh integrator.
+  std::lock_guard<std::mutex> lock(layer_mutex_);
+  tsdf_layer_->removeAllBlocks();
+  if (class_layer_) {
+    class_layer_->removeAllBlocks();
+  }
+  if (has_meshing_) {
+    mesh_layer_->clearMeshes();
+  }
+  compressed_tsdf_layer_.reset();
+  tsdf_is_compressed_.store(false, std::memory_order_release);
+  collapsed_blocks_.reset();  // Stored expanded in the spill file.
+  spill_file_ = spill_file;
+  is_evicted_.store(true, std::memory_order_release);
+  return true;
+}
+
+size_t Submap::collapseUniformBlocks() {
+  if (!config_->block_collapsing.collapse_uniform_blocks || isEvicted() ||
+      isTsdfLayerCompressed()) {
+    return 0;
+  }
+  // Blocks that changed since the last call are likely to change again.
+  const voxblox::IndexSet changed_blocks =
+      takeChangedBlocks(ChangeConsumer::kBlockCollapsing);
+  voxblox::BlockIndexList block_indices;
+  tsdf_layer_->getAllAllocatedBlocks(&block_indices);
+  CollapsedTsdfBlocks::BlockMap new_blocks;
+  TsdfVoxel value;
+  for (const BlockIndex& index : block_indices) {
+    if (changed_blocks.find(index) != changed_blocks.end() ||
+        (has_class_layer_ && class_layer_->hasBlock(index))) {
+      continue;
+    }
+    if (CollapsedTsdfBlocks::isCollapsible(
+            tsdf_layer_->getBlockByIndex(index), config_->truncation_distance,
+            config_->block_collapsing.min_weight, &value)) {
+      new_blocks.emplace(index, value);
+    }
+  }
+  if (new_blocks.empty()) {
+    return 0;
+  }
+
+  // Remove the blocks from the layers.
+  BlockPool<TsdfVoxel>* block_pool = BlockPool<TsdfVoxel>::getGlobalInstance();
+  for (const auto& index_voxel_pair : new_blocks) {
+    block_pool->removeBlock(index_voxel_pair.first, tsdf_layer_.get());
+    voxel_masks_.remove(index_voxel_pair.first);
+    if (has_meshing_) {
+      mesh_layer_->removeMesh(index_voxel_pair.first);
+    }
+  }
+  const size_t num_collapsed = new_blocks.size();
+  if (collapsed_blocks_) {
+    new_blocks.insert(collapsed_blocks_->getBlocks().begin(),
+                      collapsed_blocks_->getBlocks().end());
+  }
+  collapsed_blocks_ =
+      std::make_shared<const CollapsedTsdfBlocks>(std::move(new_blocks));
+  return num_collapsed;
+}
+
+void Submap::expandCollapsedBlocks(const voxblox::IndexSet& block_indices) {
+  if (!collapsed_blocks_) {
+    return;
+  }
+  voxblox::BlockIndexList expanded;
+  for (const BlockIndex& index : block_indices) {
+    const TsdfVoxel* value = collapsed_blocks_->getVoxel(index);
+    if (value) {
+      CollapsedTsdfBlocks::expandBlock(index, *value, tsdf_layer_.get());
+      voxel_masks_.update(index, tsdf_layer_->getBlockByIndex(index));
+      expanded.push_back(index);
+    }
+  }
+  if (expanded.empty()) {
+    return;
+  }
+  if (expanded.size() == collapsed_blocks_->size()) {
+    collapsed_blocks_.reset();
+    return;
+  }
+  CollapsedTsdfBlocks::BlockMap remaining = collapsed_blocks_->getBlocks();
+  for (const BlockIndex& index : expanded) {
+    remaining.erase(index);
+  }
+  collapsed_blocks_ =
+      std::make_shared<const CollapsedTsdfBlocks>(std::move(remaining));
+}
+
+void Submap::expandAllCollapsedBlocks() {
+  if (!collapsed_blocks_) {
+    return;
+  }
+  for (const auto& index_voxel_pair : collapsed_blocks_->getBlocks()) {
+    CollapsedTsdfBlocks::expandBlock(index_voxel_pair.first,
+                                     index_voxel_pair.second,
+                                     tsdf_layer_.get());
+    voxel_masks_.update(index_voxel_pair.first,
+                        tsdf_layer_->getBlockByIndex(index_voxel_pair.first));
+  }
+  collapsed_blocks_.reset();
+}
+
+size_t Submap::getNumberOfTsdfBlocks() const {
+  return getTsdfLayer().getNumberOfAllocatedBlocks() +
+         (collapsed_blocks_ ? collapsed_blocks_->size() : 0u);
+}
+
+void Submap::loadLayers() const {
+  std::lock_guard<std::mutex> lock(layer_mutex_);
+  if (is_evicted_.load(std::memory_order_acquire)) {
+    // Read the submap header and blocks written in 'evictLayers()'.
+    std::lock_guard<std::mutex> file_lock(spill_file_->mutex());
+    std::fstream* stream = spill_file_->stream();
+    uint64_t offset = spill_offset_;
+    SubmapProto submap_proto;
+    bool success =
+        voxblox::utils::readProtoMsgFromStream(stream, &submap_proto,
+                                               &offset) &&
+        voxblox::io::LoadBlocksFromStream(
+            submap_proto.num_blocks(),
+            TsdfLayer::BlockMergingStrategy::kReplace, stream,
+            tsdf_layer_.get(), &offset);
+    if (success && class_layer_ && submap_proto.num_class_blocks() > 0) {
+      success = loadClassBlocksFromStream(submap_proto, stream, &offset,
+                                          class_layer_.get());
+    }
+    LOG_IF(ERROR, !success)
+        << "Could not load evicted submap " << static_cast<int>(id_)
+        << " from '" << spill_file_->getFilePath() << "'.";
+    if (has_meshing_) {
+      mesh_integrator_->generateMesh(false, true, has_class_layer_);
+    }
+    is_evicted_.store(false, std::memory_order_release);
+  }
+  if (tsdf_is_compressed_.load(std::memory_order_acquire)) {
+    compressed_tsdf_layer_->decompress(tsdf_layer_.get());
+    tsdf_is_compressed_.store(false, std::memory_order_release);
+  }
+}
+
+SubmapMemoryUsage& SubmapMemoryUsage::operator+=(
+    const SubmapMemoryUsage& rhs) {
+  tsdf += rhs.tsdf;
+  classification += rhs.classification;
+  mesh += rhs.mesh;
+  iso_surface_points += rhs.iso_surface_points;
+  overhead += rhs.overhead;
+  return *this;
+}
+
+SubmapMemoryUsage Submap::getMemoryUsage() const {
+  // NOTE(schmluk): This only inspects the layers and does not restore evicted
+  // or compressed data.
+  SubmapMemoryUsage usage;
+  usage.overhead = sizeof(Submap) + voxel_masks_.getMemorySize();
+  usage.tsdf = tsdf_layer_->getMemorySize();
+  if (compressed_tsdf_layer_) {
+    usage.tsdf += compressed_tsdf_layer_->getMemorySize();
+  }
+  if (level_of_detail_) {
+    usage.tsdf += level_of_detail_->getMemorySize();
+  }
+  if (collapsed_blocks_) {
+    usage.tsdf += collapsed_blocks_->getMemorySize();
+  }
+  if (class_layer_) {
+    usage.classification = class_layer_->getMemorySize();
+  }
+  usage.iso_surface_points =
+      iso_surface_points_.capacity() * sizeof(IsoSurfacePoint);
+  for (const auto& index_points_pair : iso_surface_blocks_) {
+    usage.iso_surface_points +=
+        index_points_pair.second.capacity() * sizeof(IsoSurfacePoint);
+  }
+  if (compact_iso_surface_points_) {
+    usage.iso_surface_points += compact_iso_surface_points_->getMemorySize();
+  }
+  voxblox::BlockIndexList mesh_indices;
+  if (has_meshing_) {
+    mesh_layer_->getAllAllocatedMeshes(&mesh_indices);
+  }
+  for (const BlockIndex& index : mesh_indices) {
+    const voxblox::Mesh& mesh = mesh_layer_->getMeshByIndex(index);
+    usage.mesh += sizeof(voxblox::Mesh) +
+                  (mesh.vertices.capacity() + mesh.normals.capacity()) *
+                      sizeof(Point) +
+                  mesh.colors.capacity() * sizeof(voxblox::Color) +
+                  mesh.indices.capacity() * sizeof(voxblox::VertexIndex);
+  }
+  if (decimated_mesh_) {
+    usage.mesh += decimated_mesh_->getMemorySize();
+  }
+  return usage;
+}
+
+std::shared_ptr<TsdfLayer>& Submap::getTsdfLayerPtr() {
+  prepareLayersForUpdate();
+  return tsdf_layer_;
+}
+
+void Submap::prepareLayersForUpdate() {
+  restoreLayers();
+  compressed_tsdf_layer_.reset();
+  level_of_detail_.reset();
+  decimated_mesh_.reset();
+}
+
+SubmapBlocks Submap::getBlocks(const BlockIndex& block_index) {
+  SubmapBlocks blocks;
+  blocks.tsdf = tsdf_layer_->getBlockPtrByIndex(block_index);
+  if (blocks.tsdf && has_class_layer_) {
+    blocks.classification = class_layer_->getBlockPtrByIndex(block_index);
+  }
+  return blocks;
+}
+
+SubmapBlocks Submap::allocateBlocks(const BlockIndex& block_index) {
+  if (hasChangeFeed() && !tsdf_layer_->hasBlock(block_index)) {
+    recordCreatedBlock(block_index);
+  }
+  SubmapBlocks blocks;
+  blocks.tsdf = BlockPool<TsdfVoxel>::getGlobalInstance()
+                    ->allocateBlockPtrByIndex(block_index,
+                                              getTsdfLayerPtr().get());
+  if (has_class_layer_) {
+    blocks.classification =
+        config_->allocate_class_blocks_in_surface_band
+            ? class_layer_->getBlockPtrByIndex(block_index)
+            : class_layer_->allocateBlockPtrByIndex(block_index);
+  }
+  return blocks;
+}
+
+ClassBlock::Ptr Submap::allocateClassBlock(const BlockIndex& block_index) {
+  if (!has_class_layer_ || !tsdf_layer_->hasBlock(block_index)) {
+    return nullptr;
+  }
+  return class_layer_->allocateBlockPtrByIndex(block_index);
 }
 
 void Submap::updateEverything(bool only_updated_blocks) {
+  restoreLayers();
   updateBoundingVolume();
   updateMesh(only_updated_blocks);
-  computeIsoSurfacePoints();
+  if (config_->iso_surface.extract_from_tsdf) {
+    updateIsoSurfacePoints(only_updated_blocks);
+  } else {
+    computeIsoSurfacePoints();
+  }
 }
 
 void Submap::updateMesh(bool only_updated_blocks, bool use_class_layer) {
+  restoreLayers();
+  initializeMeshing();
   // Use the default integrator config to have color always available.
   mesh_integrator_->generateMesh(only_updated_blocks, true,
                                  has_class_layer_ && use_class_layer);
 }
 
+voxblox::BlockIndexList Submap::prepareMeshUpdate(bool only_updated_blocks,
+                                                  bool use_class_layer) {
+  restoreLayers();
+  initializeMeshing();
+  return mesh_integrator_->prepareMeshGeneration(
+      only_updated_blocks, has_class_layer_ && use_class_layer);
+}
+
+voxblox::BlockIndexList Submap::prepareMeshUpdate(
+    const voxblox::BlockIndexList& block_indices, bool use_class_layer) {
+  restoreLayers();
+  initializeMeshing();
+  return mesh_integrator_->prepareMeshGeneration(
+      block_indices, has_class_layer_ && use_class_layer);
+}
+
+bool Submap::updateMeshBlock(const BlockIndex& block_index) {
+  initializeMeshing();
+  return mesh_integrator_->generateMeshBlock(block_index);
+}
+
+size_t Submap::setMeshBlocks(MeshLayer* meshes,
+                             const voxblox::BlockIndexList& block_indices) {
+  CHECK_NOTNULL(meshes);
+  initializeMeshing();
+  voxblox::BlockIndexList updated_blocks;
+  for (const BlockIndex& index : block_indices) {
+    voxblox::Mesh::Ptr source = meshes->getMeshPtrByIndex(index);
+    if (!source) {
+      continue;
+    }
+    voxblox::Mesh::Ptr mesh = mesh_layer_->allocateMeshPtrByIndex(index);
+    mesh->vertices.swap(source->vertices);
+    mesh->normals.swap(source->normals);
+    mesh->colors.swap(source->colors);
+    mesh->indices.swap(source->indices);
+    mesh->updated = true;
+    updated_blocks.push_back(index);
+  }
+  mesh_integrator_->setMeshesGenerated(updated_blocks);
+  return updated_blocks.size();
+}
+
 void Submap::computeIsoSurfacePoints() {
+  if (config_->iso_surface.extract_from_tsdf) {
+    updateIsoSurfacePoints(false);
+    return;
+  }
   iso_surface_points_ = std::vector<IsoSurfacePoint>();
+  compact_iso_surface_points_.reset();
+  restoreLayers();
+  updateMesh();
 
   // Create an interpolator to interpolate the vertex weights from the TSDF.
   voxblox::Interpolator<TsdfVoxel> interpolator(tsdf_layer_.get());
@@ -246,14 +1364,27 @@ void Submap::computeIsoSurfacePoints() {
   voxblox::BlockIndexList index_list;
   mesh_layer_->getAllAllocatedMeshes(&index_list);
   int ignored_points = 0;
+  // Every triangle of the mesh has its own vertices, so coincident vertices
+  // are only extracted once.
+  const float weld_distance =
+      config_->mesh_decimation.weld_distance * config_->voxel_size;
+  const float inv_weld_distance =
+      weld_distance > 0.f ? 1.f / weld_distance : 0.f;
+  voxblox::LongIndexSet extracted_vertices;
   for (const voxblox::BlockIndex& index : index_list) {
     const Pointcloud& vertices = mesh_layer_->getMeshByIndex(index).vertices;
     iso_surface_points_.reserve(iso_surface_points_.size() + vertices.size());
     for (const Point& vertex : vertices) {
+      if (inv_weld_distance > 0.f &&
+          !extracted_vertices
+               .insert(IndexedMesh::weldKey(vertex, inv_weld_distance))
+               .second) {
+        continue;
+      }
       // Try to interpolate the voxel weight and verify the distance.
       TsdfVoxel voxel;
       if (interpolator.getVoxel(vertex, &voxel, true)) {
-        // if (voxel.distance > 0.1 * config_.voxel_size) {
+        // if (voxel.distance > 0.1 * config_->voxel_size) {
         //   ignored_points++;
         // } else {
         iso_surface_points_.emplace_back(vertex, voxel.weight);
@@ -265,62 +1396,372 @@ void Submap::computeIsoSurfacePoints() {
     LOG(WARNING) << "Submap " << static_cast<int>(id_) << " (" << name_
                  << ") has " << ignored_points
                  << " iso-surface points with a distance > "
-                 << 0.1 * config_.voxel_size << ", these will be ignored.";
+                 << 0.1 * config_->voxel_size << ", these will be ignored.";
+  }
+}
+
+void Submap::updateIsoSurfacePoints(bool only_updated_blocks) {
+  restoreLayers();
+  if (compact_iso_surface_points_) {
+    // The points per block were released when compacting.
+    compact_iso_surface_points_.reset();
+    only_updated_blocks = false;
+  }
+  const ClassLayer* class_layer =
+      has_class_layer_ ? class_layer_.get() : nullptr;
+
+  // Find the blocks to extract. Since points are extracted on the edges to the
+  // neighbors in positive direction, the neighbors in negative direction of
+  // updated blocks are also affected.
+  voxblox::BlockIndexList updated_blocks;
+  voxblox::BlockIndexList blocks;
+  if (only_updated_blocks) {
+    tsdf_layer_->getAllUpdatedBlocks(kIsoSurfaceUpdateFlag, &updated_blocks);
+    voxblox::IndexSet block_set;
+    for (const BlockIndex& index : updated_blocks) {
+      block_set.insert(index);
+      for (int axis = 0; axis < 3; ++axis) {
+        const BlockIndex neighbor = index - BlockIndex::Unit(axis);
+        if (tsdf_layer_->hasBlock(neighbor)) {
+          block_set.insert(neighbor);
+        }
+      }
+    }
+    blocks.insert(blocks.end(), block_set.begin(), block_set.end());
+
+    // Remove the points of deleted blocks.
+    for (auto it = iso_surface_blocks_.begin();
+         it != iso_surface_blocks_.end();) {
+      if (tsdf_layer_->hasBlock(it->first)) {
+        ++it;
+      } else {
+        it = iso_surface_blocks_.erase(it);
+      }
+    }
+  } else {
+    tsdf_layer_->getAllAllocatedBlocks(&blocks);
+    updated_blocks = blocks;
+    iso_surface_blocks_.clear();
+  }
+
+  // Extract all blocks in parallel.
+  const IsoSurfaceExtractor extractor(config_->iso_surface);
+  std::vector<std::vector<IsoSurfacePoint>> block_points(blocks.size());
+  std::atomic<size_t> next_block(0);
+  const size_t num_threads =
+      std::min<size_t>(thread_pool_->getNumThreads(), blocks.size());
+  std::vector<std::future<void>> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool_->submit([&]() {
+      size_t block_index;
+      while ((block_index = next_block++) < blocks.size()) {
+        extractor.extractBlock(*tsdf_layer_, class_layer, blocks[block_index],
+                               &block_points[block_index]);
+      }
+    }));
+  }
+  thread_pool_->waitAll(&threads);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    iso_surface_blocks_[blocks[i]] = std::move(block_points[i]);
+  }
+  for (const BlockIndex& index : updated_blocks) {
+    tsdf_layer_->getBlockByIndex(index).setUpdated(kIsoSurfaceUpdateFlag,
+                                                   false);
+  }
+
+  // Collect the points of all blocks.
+  size_t num_points = 0;
+  for (const auto& index_points_pair : iso_surface_blocks_) {
+    num_points += index_points_pair.second.size();
+  }
+  iso_surface_points_ = std::vector<IsoSurfacePoint>();
+  iso_surface_points_.reserve(num_points);
+  for (const auto& index_points_pair : iso_surface_blocks_) {
+    iso_surface_points_.insert(iso_surface_points_.end(),
+                               index_points_pair.second.begin(),
+                               index_points_pair.second.end());
+  }
+}
+
+void Submap::recordChangedBlock(const BlockIndex& index) {
+  {
+    std::lock_guard<std::mutex> lock(changed_blocks_mutex_);
+    for (voxblox::IndexSet& changed_blocks : changed_blocks_) {
+      changed_blocks.insert(index);
+    }
+  }
+  if (change_feed_) {
+    change_feed_->recordBlock(getID(), index,
+                              ChangeFeed::BlockChange::kUpdated);
+  }
+}
+
+void Submap::recordCreatedBlock(const BlockIndex& index) {
+  if (change_feed_) {
+    change_feed_->recordBlock(getID(), index,
+                              ChangeFeed::BlockChange::kCreated);
+  }
+}
+
+void Submap::recordRemovedBlock(const BlockIndex& index) {
+  if (change_feed_) {
+    change_feed_->recordBlock(getID(), index,
+                              ChangeFeed::BlockChange::kRemoved);
   }
 }
 
-void Submap::updateBoundingVolume() { bounding_volume_.update(); }
+voxblox::IndexSet Submap::takeChangedBlocks(ChangeConsumer consumer) {
+  std::lock_guard<std::mutex> lock(changed_blocks_mutex_);
+  voxblox::IndexSet result;
+  result.swap(changed_blocks_[static_cast<size_t>(consumer)]);
+  return result;
+}
+
+void Submap::updateBoundingVolume() {
+  bounding_volume_.update();
+  updateSpatialIndex();
+}
+
+void Submap::updateBoundingVolume(const voxblox::IndexSet& new_blocks) {
+  bounding_volume_.expand(new_blocks);
+  updateSpatialIndex();
+}
+
+void Submap::updateSpatialIndex() const {
+  if (spatial_index_) {
+    spatial_index_->update(getID(), T_M_S_ * bounding_volume_.getCenter(),
+                           bounding_volume_.getRadius());
+  }
+}
 
 bool Submap::applyClassLayer(const LayerManipulator& manipulator,
-                             bool clear_class_layer) {
+                             bool clear_class_layer, bool update_submap) {
   if (!has_class_layer_) {
     return true;
   }
-  manipulator.applyClassificationLayer(tsdf_layer_.get(), *class_layer_,
-                                       config_.truncation_distance);
+  voxblox::BlockIndexList removed_blocks;
+  manipulator.applyClassificationLayer(
+      getTsdfLayerPtr().get(), *class_layer_, config_->truncation_distance,
+      thread_pool_, &voxel_masks_,
+      hasChangeFeed() ? &removed_blocks : nullptr);
+  for (const BlockIndex& index : removed_blocks) {
+    recordRemovedBlock(index);
+  }
   if (clear_class_layer) {
     class_layer_.reset();
     has_class_layer_ = false;
   }
-  updateEverything();
+  if (update_submap) {
+    updateEverything();
+  }
   return tsdf_layer_->getNumberOfAllocatedBlocks() != 0;
 }
 
+bool Submap::revoxelize(const LayerManipulator& manipulator, float voxel_size,
+                        bool update_submap) {
+  CHECK_GT(voxel_size, 0.f);
+  if (voxel_size == config_->voxel_size) {
+    return false;
+  }
+  restoreLayers();
+  expandAllCollapsedBlocks();
+
+  // Interpolate the layers into an empty submap of the new resolution, which
+  // is not part of any collection.
+  auto config = std::make_shared<Config>(*config_);
+  config->truncation_distance *= voxel_size / config_->voxel_size;
+  config->voxel_size = voxel_size;
+  SubmapIDManager submap_id_manager;
+  InstanceIDManager instance_id_manager;
+  Submap resampled(config, &submap_id_manager, &instance_id_manager);
+  resampled.setT_M_S(T_M_S_);
+  if (!has_class_layer_) {
+    // The class layer was already applied.
+    resampled.class_layer_.reset();
+    resampled.has_class_layer_ = false;
+  }
+  manipulator.mergeSubmapAintoB(*this, &resampled);
+
+  // All blocks are replaced.
+  voxblox::BlockIndexList old_blocks;
+  tsdf_layer_->getAllAllocatedBlocks(&old_blocks);
+  voxblox::BlockIndexList new_blocks;
+  resampled.tsdf_layer_->getAllAllocatedBlocks(&new_blocks);
+  const voxblox::IndexSet new_block_set(new_blocks.begin(), new_blocks.end());
+  for (const BlockIndex& index : old_blocks) {
+    if (new_block_set.find(index) == new_block_set.end()) {
+      recordRemovedBlock(index);
+    }
+  }
+  for (const BlockIndex& index : new_blocks) {
+    if (!tsdf_layer_->hasBlock(index)) {
+      recordCreatedBlock(index);
+    }
+    recordChangedBlock(index);
+  }
+
+  // Adopt the layers and drop all derived data.
+  {
+    std::lock_guard<std::mutex> layer_lock(layer_mutex_);
+    std::lock_guard<std::mutex> meshing_lock(meshing_mutex_);
+    config_ = config;
+    tsdf_layer_ = std::move(resampled.tsdf_layer_);
+    class_layer_ = std::move(resampled.class_layer_);
+    has_class_layer_ = resampled.has_class_layer_;
+    mesh_layer_.reset();
+    mesh_integrator_.reset();
+    has_meshing_ = false;
+    compressed_tsdf_layer_.reset();
+  }
+  voxel_masks_.copyFrom(resampled.voxel_masks_);
+  iso_surface_points_.clear();
+  iso_surface_blocks_.clear();
+  compact_iso_surface_points_.reset();
+  level_of_detail_.reset();
+  decimated_mesh_.reset();
+  if (update_submap) {
+    updateEverything();
+  }
+  return true;
+}
+
 std::unique_ptr<Submap> Submap::clone(
     SubmapIDManager* submap_id_manager,
     InstanceIDManager* instance_id_manager) const {
   auto result = std::unique_ptr<Submap>(
       new Submap(config_, submap_id_manager, instance_id_manager, getID()));
+  copyMembersTo(result.get());
 
-  // Copy all members.
-  result->instance_id_ = static_cast<int>(instance_id_);
-  result->class_id_ = class_id_;
-  result->label_ = label_;
-  result->name_ = name_;
-  result->is_active_ = is_active_;
-  result->was_tracked_ = was_tracked_;
-  result->has_class_layer_ = has_class_layer_;
-  result->change_state_ = change_state_;
-  result->frame_name_ = frame_name_;
-  result->T_M_S_ = T_M_S_;
-  result->T_M_S_inv_ = T_M_S_inv_;
-  result->iso_surface_points_ = iso_surface_points_;
-
-  // Deep copy all pointers.
+  // Deep copy all pointers. Compressed and evicted data is shared.
+  std::lock_guard<std::mutex> lock(layer_mutex_);
   result->tsdf_layer_ = std::make_shared<TsdfLayer>(*tsdf_layer_);
-  result->mesh_layer_ = std::make_shared<MeshLayer>(*mesh_layer_);
+  result->compressed_tsdf_layer_ = compressed_tsdf_layer_;
+  result->tsdf_is_compressed_.store(isTsdfLayerCompressed(),
+                                    std::memory_order_release);
+  result->spill_file_ = spill_file_;
+  result->spill_offset_ = spill_offset_;
+  result->is_evicted_.store(isEvicted(), std::memory_order_release);
   if (class_layer_) {
     result->class_layer_ = class_layer_->clone();
   }
-  result->mesh_integrator_ = std::make_unique<MeshIntegrator>(
-      result->config_.mesh, result->tsdf_layer_, result->mesh_layer_,
-      result->class_layer_, result->config_.truncation_distance);
+  copyMeshTo(result.get());
+
+  // The blocks are identical so the bounding volume and masks can be copied.
+  result->bounding_volume_.copyFrom(bounding_volume_);
+  result->voxel_masks_.copyFrom(voxel_masks_);
+
+  return result;
+}
+
+std::unique_ptr<Submap> Submap::snapshot(
+    const Submap* previous, SubmapIDManager* submap_id_manager,
+    InstanceIDManager* instance_id_manager) {
+  auto result = std::unique_ptr<Submap>(
+      new Submap(config_, submap_id_manager, instance_id_manager, getID()));
+  copyMembersTo(result.get());
+  result->snapshot_source_ = tsdf_layer_;
+
+  // Compressed and evicted submaps are not modified, so the snapshot shares
+  // their data and loads it into its own layers on access.
+  if (isTsdfLayerCompressed() || isEvicted()) {
+    result->tsdf_layer_ = std::make_shared<TsdfLayer>(
+        tsdf_layer_->voxel_size(), tsdf_layer_->voxels_per_side());
+    result->compressed_tsdf_layer_ = compressed_tsdf_layer_;
+    result->tsdf_is_compressed_.store(isTsdfLayerCompressed(),
+                                      std::memory_order_release);
+    result->spill_file_ = spill_file_;
+    result->spill_offset_ = spill_offset_;
+    result->is_evicted_.store(isEvicted(), std::memory_order_release);
+    if (isEvicted()) {
+      // The class layer is loaded from the spill file with the TSDF layer.
+      if (class_layer_) {
+        result->class_layer_ = class_layer_->cloneEmpty();
+      }
+    } else if (previous && previous->isTsdfLayerCompressed() &&
+               previous->compressed_tsdf_layer_ == compressed_tsdf_layer_ &&
+               previous->has_class_layer_ == has_class_layer_) {
+      result->class_layer_ = previous->class_layer_;
+    } else if (class_layer_) {
+      result->class_layer_ = class_layer_->snapshot(nullptr, {});
+    }
+    copyMeshTo(result.get(), previous);
+    result->bounding_volume_.copyFrom(bounding_volume_);
+    return result;
+  }
+
+  // Data can only be reused if the previous snapshot was taken of this submap.
+  if (previous && (previous->snapshot_source_.lock() != tsdf_layer_ ||
+                   previous->has_class_layer_ != has_class_layer_)) {
+    previous = nullptr;
+  }
 
-  // The bounding volume can not completely be copied so it's just updated,
-  // which should be identical.
-  result->bounding_volume_.update();
+  // Get all blocks that changed since the previous snapshot.
+  voxblox::BlockIndexList changed_list;
+  tsdf_layer_->getAllUpdatedBlocks(voxblox::Update::kMap, &changed_list);
+  const voxblox::IndexSet changed_blocks(changed_list.begin(),
+                                         changed_list.end());
 
+  // If nothing changed, the layers of the previous snapshot are shared.
+  bool is_unchanged =
+      previous && changed_blocks.empty() &&
+      previous->tsdf_layer_->getNumberOfAllocatedBlocks() ==
+          tsdf_layer_->getNumberOfAllocatedBlocks();
+  if (is_unchanged) {
+    voxblox::BlockIndexList block_indices;
+    tsdf_layer_->getAllAllocatedBlocks(&block_indices);
+    for (const BlockIndex& index : block_indices) {
+      if (!previous->tsdf_layer_->hasBlock(index)) {
+        is_unchanged = false;
+        break;
+      }
+    }
+  }
+  if (is_unchanged) {
+    result->tsdf_layer_ = previous->tsdf_layer_;
+    result->class_layer_ = previous->class_layer_;
+  } else {
+    result->tsdf_layer_ = std::make_shared<TsdfLayer>(
+        tsdf_layer_->voxel_size(), tsdf_layer_->voxels_per_side());
+    snapshotLayer(*tsdf_layer_,
+                  previous ? previous->tsdf_layer_.get() : nullptr,
+                  changed_blocks, result->tsdf_layer_.get());
+    if (class_layer_) {
+      result->class_layer_ = class_layer_->snapshot(
+          previous ? previous->class_layer_.get() : nullptr, changed_blocks);
+    }
+  }
+  copyMeshTo(result.get(), previous);
+  result->bounding_volume_.copyFrom(bounding_volume_);
+
+  // Mark all changes as contained in the snapshot.
+  for (const BlockIndex& index : changed_list) {
+    tsdf_layer_->getBlockByIndex(index).setUpdated(voxblox::Update::kMap,
+                                                   false);
+  }
   return result;
 }
 
+void Submap::copyMembersTo(Submap* other) const {
+  CHECK_NOTNULL(other);
+  other->instance_id_ = static_cast<int>(instance_id_);
+  other->class_id_ = class_id_;
+  other->label_ = label_;
+  other->name_ = name_;
+  other->is_active_ = is_active_;
+  other->is_finishing_ = is_finishing_;
+  other->was_tracked_ = was_tracked_;
+  other->home_node_ = home_node_;
+  other->has_class_layer_ = has_class_layer_;
+  other->change_state_ = change_state_;
+  other->frame_name_ = frame_name_;
+  other->T_M_S_ = T_M_S_;
+  other->T_M_S_inv_ = T_M_S_inv_;
+  other->iso_surface_points_ = iso_surface_points_;
+  other->iso_surface_blocks_ = iso_surface_blocks_;
+  other->compact_iso_surface_points_ = compact_iso_surface_points_;
+  other->level_of_detail_ = level_of_detail_;
+  other->decimated_mesh_ = decimated_mesh_;
+  other->collapsed_blocks_ = collapsed_blocks_;
+}
+
 }  // namespace panoptic_mapping
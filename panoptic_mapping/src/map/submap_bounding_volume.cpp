@@ -1,64 +1,258 @@
 #include "panoptic_mapping/map/submap_bounding_volume.h"
 
 #include <algorithm>
-#include <limits>
+#include <cmath>
+#include <random>
 #include <vector>
 
 #include "panoptic_mapping/map/submap.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+// Sphere given by its center and squared radius.
+struct Ball {
+  Point center = Point::Zero();
+  FloatingPoint radius_squared = -1.f;
+
+  bool contains(const Point& point) const {
+    // Relative tolerance to be robust to rounding on the boundary.
+    return (point - center).squaredNorm() <=
+           radius_squared * (1.f + 1e-5f) + 1e-10f;
+  }
+};
+
+Ball ballFromTwo(const Point& p0, const Point& p1) {
+  Ball ball;
+  ball.center = (p0 + p1) / 2.f;
+  ball.radius_squared = (p1 - p0).squaredNorm() / 4.f;
+  return ball;
+}
+
+// Smallest ball with the three points on its boundary.
+Ball ballFromThree(const Point& p0, const Point& p1, const Point& p2) {
+  const Point a = p1 - p0;
+  const Point b = p2 - p0;
+  const Point axb = a.cross(b);
+  const FloatingPoint denominator = 2.f * axb.squaredNorm();
+  if (denominator <= 1e-12f * a.squaredNorm() * b.squaredNorm()) {
+    // Collinear points are spanned by the farthest pair.
+    Ball ball = ballFromTwo(p0, p1);
+    for (const Ball& candidate : {ballFromTwo(p0, p2), ballFromTwo(p1, p2)}) {
+      if (candidate.radius_squared > ball.radius_squared) {
+        ball = candidate;
+      }
+    }
+    return ball;
+  }
+  Ball ball;
+  const Point offset =
+      (a.squaredNorm() * b - b.squaredNorm() * a).cross(axb) / denominator;
+  ball.center = p0 + offset;
+  ball.radius_squared = offset.squaredNorm();
+  return ball;
+}
+
+// Smallest ball with the four points on its boundary.
+Ball ballFromFour(const Point& p0, const Point& p1, const Point& p2,
+                  const Point& p3) {
+  Eigen::Matrix<FloatingPoint, 3, 3> A;
+  A.row(0) = (p1 - p0).transpose();
+  A.row(1) = (p2 - p0).transpose();
+  A.row(2) = (p3 - p0).transpose();
+  const FloatingPoint scale = A.cwiseAbs().maxCoeff();
+  if (std::abs(A.determinant()) <= 1e-6f * scale * scale * scale) {
+    // Coplanar points are spanned by the smallest enclosing triple.
+    const Point points[4] = {p0, p1, p2, p3};
+    Ball best = ballFromThree(p0, p1, p2);
+    best.radius_squared =
+        std::max(best.radius_squared, (p3 - best.center).squaredNorm());
+    for (int skipped = 0; skipped < 4; ++skipped) {
+      const Point& q0 = points[skipped == 0 ? 1 : 0];
+      const Point& q1 = points[skipped <= 1 ? 2 : 1];
+      const Point& q2 = points[skipped <= 2 ? 3 : 2];
+      const Ball candidate = ballFromThree(q0, q1, q2);
+      if (candidate.radius_squared < best.radius_squared &&
+          candidate.contains(points[skipped])) {
+        best = candidate;
+      }
+    }
+    return best;
+  }
+  const Point b(A.row(0).squaredNorm(), A.row(1).squaredNorm(),
+                A.row(2).squaredNorm());
+  const Point offset = A.fullPivLu().solve(b / 2.f);
+  Ball ball;
+  ball.center = p0 + offset;
+  ball.radius_squared = offset.squaredNorm();
+  return ball;
+}
+
+// Exact minimum enclosing ball of the points using Welzl's algorithm in its
+// iterative move-to-front form, which runs in expected linear time.
+Ball computeMiniball(std::vector<Point>* points) {
+  Ball ball;
+  if (points->empty()) {
+    return ball;
+  }
+  // A fixed seed keeps the computation reproducible.
+  std::shuffle(points->begin(), points->end(), std::mt19937(0));
+  const std::vector<Point>& p = *points;
+  ball.center = p[0];
+  ball.radius_squared = 0.f;
+  for (size_t i = 1; i < p.size(); ++i) {
+    if (ball.contains(p[i])) {
+      continue;
+    }
+    ball.center = p[i];
+    ball.radius_squared = 0.f;
+    for (size_t j = 0; j < i; ++j) {
+      if (ball.contains(p[j])) {
+        continue;
+      }
+      ball = ballFromTwo(p[i], p[j]);
+      for (size_t k = 0; k < j; ++k) {
+        if (ball.contains(p[k])) {
+          continue;
+        }
+        ball = ballFromThree(p[i], p[j], p[k]);
+        for (size_t l = 0; l < k; ++l) {
+          if (!ball.contains(p[l])) {
+            ball = ballFromFour(p[i], p[j], p[k], p[l]);
+          }
+        }
+      }
+    }
+  }
+  return ball;
+}
+
+}  // namespace
+
+void SubmapBoundingVolume::Config::setupParamsAndPrinting() {
+  setupParam("use_miniball", &use_miniball);
+}
+
 SubmapBoundingVolume::SubmapBoundingVolume(const Submap& submap)
     : submap_(&submap),
       center_(0.f, 0.f, 0.f),
       radius_(0.f),
-      num_previous_blocks_(0) {}
+      center_radius_(0.f),
+      num_previous_blocks_(0),
+      num_recomputed_blocks_(0) {}
 
-void SubmapBoundingVolume::update() {
-  // A conservative approximation that computes the centroid from the
-  // grid-aligned bounding box and then shrinks a sphere on it. This is
-  // generally a significant over-estimation of the sphere, could use an exact
-  // algorithm here if required (e.g. https://github.com/hbf/miniball or
-  // https://people.inf.ethz.ch/gaertner/subdir/software/miniball.html).
+void SubmapBoundingVolume::copyFrom(const SubmapBoundingVolume& other) {
+  center_ = other.center_;
+  radius_ = other.radius_;
+  center_radius_ = other.center_radius_;
+  num_previous_blocks_ = other.num_previous_blocks_;
+  num_recomputed_blocks_ = other.num_recomputed_blocks_;
+}
+
+void SubmapBoundingVolume::set(const Point& center, FloatingPoint radius,
+                               FloatingPoint center_radius) {
+  center_ = center;
+  radius_ = radius;
+  center_radius_ = center_radius;
+  num_previous_blocks_ = submap_->getNumberOfTsdfBlocks();
+  num_recomputed_blocks_ = num_previous_blocks_;
+}
 
+void SubmapBoundingVolume::update() {
   // Prevent redundant updates.
-  if (submap_->getTsdfLayer().getNumberOfAllocatedBlocks() ==
-      num_previous_blocks_) {
+  const size_t num_blocks = submap_->getNumberOfTsdfBlocks();
+  if (num_blocks == num_previous_blocks_) {
+    return;
+  }
+  if (num_blocks > num_previous_blocks_) {
+    // The new blocks are unknown.
+    recompute();
+    return;
+  }
+
+  // Removed blocks leave the volume conservative, so it is only shrunk once it
+  // became loose.
+  num_previous_blocks_ = num_blocks;
+  if (num_blocks == 0 || 4 * num_blocks < 3 * num_recomputed_blocks_) {
+    recompute();
+  }
+}
+
+void SubmapBoundingVolume::expand(const voxblox::IndexSet& block_indices) {
+  const size_t num_blocks = submap_->getNumberOfTsdfBlocks();
+  if (num_previous_blocks_ == 0 || num_blocks >= 2 * num_recomputed_blocks_) {
+    // Tighten the volume again after it grew significantly.
+    recompute();
+    return;
+  }
+  const FloatingPoint grid_size = submap_->getTsdfLayer().block_size();
+  for (const BlockIndex& index : block_indices) {
+    addBlockCenter(voxblox::getCenterPointFromGridIndex(index, grid_size));
+  }
+  radius_ = center_radius_ + std::sqrt(3.f) * grid_size / 2.f;
+  num_previous_blocks_ = num_blocks;
+}
+
+void SubmapBoundingVolume::addBlockCenter(const Point& block_center) {
+  // Grow to the smallest sphere containing the current sphere and the point.
+  const Point offset = block_center - center_;
+  const FloatingPoint distance = offset.norm();
+  if (distance <= center_radius_) {
     return;
-  } else {
-    num_previous_blocks_ = submap_->getTsdfLayer().getNumberOfAllocatedBlocks();
   }
+  const FloatingPoint new_radius = (center_radius_ + distance) / 2.f;
+  center_ += offset * ((new_radius - center_radius_) / distance);
+  center_radius_ = new_radius;
+}
 
+void SubmapBoundingVolume::recompute() {
   // Setup.
   voxblox::BlockIndexList block_indices;
   submap_->getTsdfLayer().getAllAllocatedBlocks(&block_indices);
+  if (submap_->getCollapsedBlocks()) {
+    for (const auto& index_voxel_pair :
+         submap_->getCollapsedBlocks()->getBlocks()) {
+      block_indices.push_back(index_voxel_pair.first);
+    }
+  }
+  num_previous_blocks_ = block_indices.size();
+  num_recomputed_blocks_ = block_indices.size();
   if (block_indices.empty()) {
     radius_ = 0.f;
-    center_ = Point();
+    center_radius_ = 0.f;
+    center_ = Point::Zero();
     return;
   }
   std::vector<Point> block_centers;
   block_centers.reserve(block_indices.size());
   const FloatingPoint grid_size = submap_->getTsdfLayer().block_size();
-  Point min_dimension =
-      voxblox::getCenterPointFromGridIndex(block_indices.front(), grid_size);
-  Point max_dimension = min_dimension;
-
-  // Get centers and grid aligned bounding box.
-  for (size_t i = 1; i < block_indices.size(); ++i) {
+  for (const BlockIndex& index : block_indices) {
     block_centers.emplace_back(
-        voxblox::getCenterPointFromGridIndex(block_indices[i], grid_size));
-    min_dimension = min_dimension.cwiseMin(block_centers.back());
-    max_dimension = max_dimension.cwiseMax(block_centers.back());
+        voxblox::getCenterPointFromGridIndex(index, grid_size));
+  }
+
+  if (submap_->getConfig().bounding_volume.use_miniball) {
+    center_ = computeMiniball(&block_centers).center;
+  } else {
+    // A conservative approximation that computes the centroid from the
+    // grid-aligned bounding box and then shrinks a sphere on it.
+    Point min_dimension = block_centers.front();
+    Point max_dimension = min_dimension;
+    for (const Point& center : block_centers) {
+      min_dimension = min_dimension.cwiseMin(center);
+      max_dimension = max_dimension.cwiseMax(center);
+    }
+    center_ = (min_dimension + max_dimension) / 2.f;
   }
 
-  // Compute bounding sphere center and radius.
-  center_ = (min_dimension + max_dimension) / 2.f;
-  radius_ = 0.f;
+  // The radius is computed explicitly such that all blocks are contained
+  // regardless of numerical inaccuracies.
+  center_radius_ = 0.f;
   for (const Point& center : block_centers) {
-    radius_ = std::max(radius_, (center - center_).norm());
+    center_radius_ = std::max(center_radius_, (center - center_).norm());
   }
-  radius_ += std::sqrt(3.f) * grid_size / 2.f;  // outermost voxel.
+  radius_ = center_radius_ + std::sqrt(3.f) * grid_size / 2.f;  // outermost.
 }
 
 bool SubmapBoundingVolume::contains_S(const Point& point_S) const {
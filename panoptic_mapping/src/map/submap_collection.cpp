@@ -2,7 +2,13 @@
 
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <map>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -10,33 +16,297 @@
 #include <vector>
 
 #include "panoptic_mapping/SubmapCollection.pb.h"
+#include "panoptic_mapping/common/index_getter.h"
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/tools/serialization.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+// Read the index at the end of a map file, see 'saveToFile()'.
+bool readIndex(std::istream* proto_file, SubmapCollectionIndexProto* index) {
+  uint64_t index_offset = 0u;
+  proto_file->clear();
+  proto_file->seekg(-static_cast<std::streamoff>(sizeof(index_offset)),
+                    std::ios_base::end);
+  const std::streamoff trailer_offset = proto_file->tellg();
+  if (trailer_offset < 0 ||
+      !proto_file->read(reinterpret_cast<char*>(&index_offset),
+                        sizeof(index_offset)) ||
+      index_offset >= static_cast<uint64_t>(trailer_offset)) {
+    return false;
+  }
+  return voxblox::utils::readProtoMsgFromStream(proto_file, index,
+                                                &index_offset);
+}
+
+bool tsdfVoxelsEqual(const TsdfVoxel& v1, const TsdfVoxel& v2) {
+  return v1.distance == v2.distance && v1.weight == v2.weight &&
+         v1.color.r == v2.color.r && v1.color.g == v2.color.g &&
+         v1.color.b == v2.color.b && v1.color.a == v2.color.a;
+}
+
+// Find the TSDF blocks of a snapshot that differ from the previous snapshot of
+// the same submap, including collapsed blocks. Returns false if blocks were
+// removed.
+bool findChangedBlocks(const Submap& previous, const Submap& current,
+                       voxblox::BlockIndexList* changed_blocks) {
+  const TsdfLayer& layer = current.getTsdfLayer();
+  const TsdfLayer& previous_layer = previous.getTsdfLayer();
+  voxblox::BlockIndexList block_indices;
+  layer.getAllAllocatedBlocks(&block_indices);
+  size_t num_new_blocks = 0;
+  for (const BlockIndex& index : block_indices) {
+    auto previous_block = previous_layer.getBlockPtrByIndex(index);
+    if (!previous_block) {
+      num_new_blocks++;
+      changed_blocks->push_back(index);
+    } else if (previous_block != layer.getBlockPtrByIndex(index)) {
+      changed_blocks->push_back(index);
+    }
+  }
+  bool only_added_blocks =
+      previous_layer.getNumberOfAllocatedBlocks() + num_new_blocks ==
+      block_indices.size();
+
+  // Collapsed blocks are written expanded, so they are compared by value.
+  const CollapsedTsdfBlocks* collapsed = current.getCollapsedBlocks();
+  const CollapsedTsdfBlocks* previous_collapsed = previous.getCollapsedBlocks();
+  if (collapsed == previous_collapsed) {
+    return only_added_blocks;
+  }
+  if (collapsed) {
+    for (const auto& index_voxel_pair : collapsed->getBlocks()) {
+      const TsdfVoxel* previous_value =
+          previous_collapsed
+              ? previous_collapsed->getVoxel(index_voxel_pair.first)
+              : nullptr;
+      if (!previous_value ||
+          !tsdfVoxelsEqual(*previous_value, index_voxel_pair.second)) {
+        changed_blocks->push_back(index_voxel_pair.first);
+      }
+    }
+  }
+  if (previous_collapsed) {
+    for (const auto& index_voxel_pair : previous_collapsed->getBlocks()) {
+      const BlockIndex& index = index_voxel_pair.first;
+      if (!layer.hasBlock(index) &&
+          !(collapsed && collapsed->getVoxel(index))) {
+        only_added_blocks = false;
+      }
+    }
+  }
+  return only_added_blocks;
+}
+
+}  // namespace
+
 Submap* SubmapCollection::createSubmap(const Submap::Config& config) {
-  submaps_.emplace_back(std::make_unique<Submap>(config, &submap_id_manager_,
-                                                 &instance_id_manager_));
-  Submap* new_submap = submaps_.back().get();
-  id_to_index_[new_submap->getID()] = submaps_.size() - 1;
+  return appendSubmap(std::make_unique<Submap>(config, &submap_id_manager_,
+                                               &instance_id_manager_));
+}
+
+Submap* SubmapCollection::createSubmap(
+    std::shared_ptr<const Submap::Config> config) {
+  return appendSubmap(std::make_unique<Submap>(
+      std::move(config), &submap_id_manager_, &instance_id_manager_));
+}
+
+std::vector<Submap*> SubmapCollection::createSubmaps(
+    const std::vector<std::shared_ptr<const Submap::Config>>& configs) {
+  // Assign the IDs sequentially to keep them deterministic.
+  std::vector<std::unique_ptr<Submap>> new_submaps;
+  new_submaps.reserve(configs.size());
+  for (const auto& config : configs) {
+    new_submaps.emplace_back(new Submap(config, &submap_id_manager_,
+                                        &instance_id_manager_,
+                                        Submap::DeferInitialization()));
+  }
+
+  // Set up the layers in parallel, on the home node of each submap.
+  for (const std::unique_ptr<Submap>& submap : new_submaps) {
+    assignHomeNode(submap.get());
+  }
+  if (new_submaps.size() > 1) {
+    std::vector<std::future<void>> threads;
+    threads.reserve(new_submaps.size());
+    for (const std::unique_ptr<Submap>& submap : new_submaps) {
+      Submap* submap_ptr = submap.get();
+      threads.emplace_back(thread_pool_->submitOnNode(
+          submap_ptr->getHomeNode(),
+          [submap_ptr]() { submap_ptr->initialize(); }));
+    }
+    thread_pool_->waitAll(&threads);
+  } else {
+    for (const std::unique_ptr<Submap>& submap : new_submaps) {
+      submap->initialize();
+    }
+  }
+
+  // Add them to the collection.
+  reserve(num_submaps_ + new_submaps.size());
+  std::vector<Submap*> result;
+  result.reserve(new_submaps.size());
+  for (std::unique_ptr<Submap>& submap : new_submaps) {
+    result.push_back(appendSubmap(std::move(submap)));
+  }
+  return result;
+}
+
+void SubmapCollection::reserve(size_t num_submaps) {
+  // Slots of removed submaps are only freed on compaction.
+  const size_t num_slots = submaps_.size() - num_submaps_ + num_submaps;
+  submaps_.reserve(num_slots);
+  id_to_index_.reserve(num_submaps);
+}
+
+void SubmapCollection::assignHomeNode(Submap* submap) const {
+  // Distribute the submaps round robin over the nodes of the thread pool.
+  submap->setHomeNode(submap->getID() % thread_pool_->getNumNodes());
+}
+
+Submap* SubmapCollection::appendSubmap(std::unique_ptr<Submap> submap) {
+  Submap* new_submap = submap.get();
+  new_submap->setThreadPool(thread_pool_);
+  assignHomeNode(new_submap);
+  id_to_index_[new_submap->getID()] = submaps_.size();
+  submaps_.emplace_back(std::move(submap));
+  num_submaps_++;
+  new_submap->label_table_ = label_table_.get();
+  label_table_->add(new_submap->getID(), new_submap->getInstanceID(),
+                    new_submap->getClassID());
+  addToSpatialIndex(new_submap);
+  new_submap->change_feed_ = change_feed_.get();
+  if (change_feed_) {
+    change_feed_->recordSubmap(new_submap->getID(),
+                               ChangeFeed::SubmapChange::kCreated);
+  }
   return new_submap;
 }
 
+void SubmapCollection::setChangeFeed(std::shared_ptr<ChangeFeed> change_feed) {
+  change_feed_ = std::move(change_feed);
+  for (Submap& submap : *this) {
+    submap.change_feed_ = change_feed_.get();
+    if (change_feed_) {
+      change_feed_->recordSubmap(submap.getID(),
+                                 ChangeFeed::SubmapChange::kCreated);
+    }
+  }
+}
+
+void SubmapCollection::setThreadPool(ThreadPool* thread_pool) {
+  thread_pool_ = CHECK_NOTNULL(thread_pool);
+  for (Submap& submap : *this) {
+    submap.setThreadPool(thread_pool_);
+    assignHomeNode(&submap);
+  }
+}
+
+void SubmapCollection::addToSpatialIndex(Submap* submap) {
+  submap->spatial_index_ = spatial_index_.get();
+  submap->updateSpatialIndex();
+}
+
 bool SubmapCollection::removeSubmap(int id) {
+  if (!releaseSubmap(id)) {
+    return false;
+  }
+  // Compact once more than half of the slots are free, such that removal is
+  // constant in amortized time.
+  if (submaps_.size() > 2 * num_submaps_) {
+    compact();
+  }
+  return true;
+}
+
+size_t SubmapCollection::removeSubmaps(const std::vector<int>& ids) {
+  size_t num_removed = 0;
+  for (const int id : ids) {
+    if (releaseSubmap(id)) {
+      num_removed++;
+    }
+  }
+  if (num_removed > 0) {
+    compact();
+  }
+  return num_removed;
+}
+
+size_t SubmapCollection::setSubmapPoses(
+    const std::unordered_map<int, Transformation>& T_M_S) {
+  std::vector<SubmapSpatialIndex::Sphere> spheres;
+  spheres.reserve(T_M_S.size());
+  for (const auto& id_pose_pair : T_M_S) {
+    auto it = id_to_index_.find(id_pose_pair.first);
+    if (it == id_to_index_.end()) {
+      continue;
+    }
+    Submap* submap = submaps_[it->second].get();
+    if (submap->T_M_S_.getTransformationMatrix() ==
+        id_pose_pair.second.getTransformationMatrix()) {
+      continue;
+    }
+    // Set the pose directly to only update the spatial index once.
+    submap->T_M_S_ = id_pose_pair.second;
+    submap->T_M_S_inv_ = submap->T_M_S_.inverse();
+    const SubmapBoundingVolume& volume = submap->getBoundingVolume();
+    spheres.push_back({submap->getID(), submap->T_M_S_ * volume.getCenter(),
+                       volume.getRadius()});
+    if (change_feed_) {
+      change_feed_->recordSubmap(submap->getID(),
+                                 ChangeFeed::SubmapChange::kMoved);
+    }
+  }
+  spatial_index_->update(spheres);
+  return spheres.size();
+}
+
+bool SubmapCollection::releaseSubmap(int id) {
   auto it = id_to_index_.find(id);
   if (it == id_to_index_.end()) {
     // Submap does not exist.
     return false;
   }
-  size_t previous_index = it->second;
-  submaps_.erase(submaps_.begin() + it->second);
+  spatial_index_->remove(id);
+  label_table_->remove(id, submaps_[it->second]->getInstanceID());
+  if (change_feed_) {
+    change_feed_->recordSubmap(id, ChangeFeed::SubmapChange::kRemoved);
+  }
+  submaps_[it->second].reset();
   id_to_index_.erase(it);
-  // correct the index table
-  for (auto& id_index_pair : id_to_index_) {
-    if (id_index_pair.second > previous_index) {
-      id_index_pair.second -= 1;
+  num_submaps_--;
+  return true;
+}
+
+void SubmapCollection::compact() {
+  size_t next_index = 0;
+  for (size_t index = 0; index < submaps_.size(); ++index) {
+    if (!submaps_[index]) {
+      continue;
+    }
+    if (index != next_index) {
+      id_to_index_[submaps_[index]->getID()] = next_index;
+      submaps_[next_index] = std::move(submaps_[index]);
     }
+    next_index++;
   }
-  return true;
+  submaps_.resize(next_index);
+}
+
+void SubmapCollection::clearSubmaps() {
+  if (change_feed_) {
+    for (const Submap& submap : *this) {
+      change_feed_->recordSubmap(submap.getID(),
+                                 ChangeFeed::SubmapChange::kRemoved);
+    }
+  }
+  submaps_.clear();
+  num_submaps_ = 0;
+  spatial_index_->clear();
+  label_table_->clear();
+  id_to_index_.clear();
 }
 
 bool SubmapCollection::submapIdExists(int id) const {
@@ -58,14 +328,22 @@ Submap* SubmapCollection::getSubmapPtr(int id) {
 }
 
 void SubmapCollection::clear() {
-  submaps_.clear();
-  id_to_index_.clear();
+  clearSubmaps();
   instance_id_manager_ = InstanceIDManager();
   submap_id_manager_ = SubmapIDManager();
-  instance_to_submap_ids_.clear();
   active_freespace_submap_id_ = -1;
 }
 
+std::vector<int> SubmapCollection::findSubmapsIntersecting(
+    const Point& center_M, FloatingPoint radius) const {
+  std::vector<int> result = spatial_index_->findIntersecting(center_M, radius);
+  // Keep the iteration order of the collection for reproducible results.
+  std::sort(result.begin(), result.end(), [this](int lhs, int rhs) {
+    return id_to_index_.at(lhs) < id_to_index_.at(rhs);
+  });
+  return result;
+}
+
 void SubmapCollection::updateIDList(const std::vector<int>& id_list,
                                     std::vector<int>* new_ids,
                                     std::vector<int>* deleted_ids) const {
@@ -86,16 +364,9 @@ void SubmapCollection::updateIDList(const std::vector<int>& id_list,
   }
 }
 
-void SubmapCollection::updateInstanceToSubmapIDTable() {
-  // Clear the table and add all new elements.
-  instance_to_submap_ids_ = std::unordered_map<int, std::unordered_set<int>>();
-  for (const Submap& submap : *this) {
-    instance_to_submap_ids_[submap.getInstanceID()].emplace(submap.getID());
-  }
-}
-
 // Save load functionality was heavily adapted from cblox.
-bool SubmapCollection::saveToFile(const std::string& file_path) const {
+bool SubmapCollection::saveToFile(const std::string& file_path,
+                                  bool include_derived_data) const {
   CHECK(!file_path.empty());
 
   // Check for proper extensions.
@@ -112,9 +383,10 @@ bool SubmapCollection::saveToFile(const std::string& file_path) const {
 
   // Saving the submap collection header object.
   SubmapCollectionProto submap_collection_proto;
-  submap_collection_proto.set_num_submaps(submaps_.size());
+  submap_collection_proto.set_num_submaps(size());
   submap_collection_proto.set_active_freespace_submap_id(
       active_freespace_submap_id_);
+  submap_collection_proto.set_version(kMapFileVersion);
   if (!voxblox::utils::writeProtoMsgToStream(submap_collection_proto,
                                              &outfile)) {
     LOG(ERROR) << "Could not write submap collection header message.";
@@ -122,21 +394,88 @@ bool SubmapCollection::saveToFile(const std::string& file_path) const {
     return false;
   }
 
-  // Saving the submaps.
+  // Saving the submaps and where they are located in the file.
+  SubmapCollectionIndexProto index_proto;
   for (const auto& submap : submaps_) {
-    if (!submap->saveToStream(&outfile)) {
+    if (!submap) {
+      continue;
+    }
+    const uint64_t byte_offset = outfile.tellp();
+    if (!submap->saveToStream(&outfile, include_derived_data)) {
       LOG(WARNING) << "Failed to save submap with ID '" << submap->getID()
                    << "'.";
       outfile.close();
       return false;
     }
+    SubmapIndexEntryProto* entry = index_proto.add_submaps();
+    entry->set_submap_id(submap->getID());
+    entry->set_byte_offset(byte_offset);
+    entry->set_byte_size(static_cast<uint64_t>(outfile.tellp()) - byte_offset);
+    entry->set_instance_id(submap->getInstanceID());
+    entry->set_panoptic_label(static_cast<int>(submap->getLabel()));
+    const Point center_M =
+        submap->getT_M_S() * submap->getBoundingVolume().getCenter();
+    entry->set_center_x(center_M.x());
+    entry->set_center_y(center_M.y());
+    entry->set_center_z(center_M.z());
+    entry->set_radius(submap->getBoundingVolume().getRadius());
   }
+
+  // Saving the index followed by its offset.
+  const uint64_t index_offset = outfile.tellp();
+  if (!voxblox::utils::writeProtoMsgToStream(index_proto, &outfile)) {
+    LOG(ERROR) << "Could not write submap collection index message.";
+    outfile.close();
+    return false;
+  }
+  outfile.write(reinterpret_cast<const char*>(&index_offset),
+                sizeof(index_offset));
   outfile.close();
   return true;
 }
 
 bool SubmapCollection::loadFromFile(const std::string& file_path,
                                     bool recompute_data) {
+  MapLoadOptions options;
+  options.recompute_data = recompute_data;
+  return loadFromFileImpl(file_path, options, IndexFilter());
+}
+
+bool SubmapCollection::loadFromFile(const std::string& file_path,
+                                    const MapLoadOptions& options) {
+  return loadFromFileImpl(file_path, options, IndexFilter());
+}
+
+bool SubmapCollection::loadSubmapsFromFile(const std::string& file_path,
+                                           const std::vector<int>& submap_ids,
+                                           bool recompute_data) {
+  const std::unordered_set<int> ids(submap_ids.begin(), submap_ids.end());
+  MapLoadOptions options;
+  options.recompute_data = recompute_data;
+  return loadFromFileImpl(file_path, options,
+                          [&ids](const SubmapIndexEntryProto& entry) {
+                            return ids.find(entry.submap_id()) != ids.end();
+                          });
+}
+
+bool SubmapCollection::loadSubmapsInRegionFromFile(const std::string& file_path,
+                                                   const Point& center_M,
+                                                   FloatingPoint radius,
+                                                   bool recompute_data) {
+  MapLoadOptions options;
+  options.recompute_data = recompute_data;
+  return loadFromFileImpl(
+      file_path, options,
+      [&center_M, radius](const SubmapIndexEntryProto& entry) {
+        const Point center(entry.center_x(), entry.center_y(),
+                           entry.center_z());
+        return (center - center_M).norm() <= radius + entry.radius();
+      });
+}
+
+bool SubmapCollection::loadFromFileImpl(const std::string& file_path,
+                                        const MapLoadOptions& options,
+                                        const IndexFilter& filter) {
   CHECK(!file_path.empty());
   const std::string file_name = checkMapFileExtension(file_path);
 
@@ -148,55 +487,607 @@ bool SubmapCollection::loadFromFile(const std::string& file_path,
   }
 
   // Clear the current maps.
-  submaps_.clear();
+  clearSubmaps();
 
   // Open and check the file.
   std::ifstream proto_file;
-  proto_file.open(file_name, std::fstream::in);
+  proto_file.open(file_name, std::fstream::in | std::fstream::binary);
   if (!proto_file.is_open()) {
     LOG(ERROR) << "Could not open protobuf file '" << file_name << "'.";
     return false;
   }
 
-  // Unused byte offset result.
-  uint64_t tmp_byte_offset = 0u;
+  uint64_t byte_offset = 0u;
   SubmapCollectionProto submap_collection_proto;
   if (!voxblox::utils::readProtoMsgFromStream(
-          &proto_file, &submap_collection_proto, &tmp_byte_offset)) {
+          &proto_file, &submap_collection_proto, &byte_offset)) {
     LOG(ERROR) << "Could not read the protobuf message.";
     return false;
   }
 
+  // Files of version 2 and later can be loaded by index.
+  SubmapCollectionIndexProto index_proto;
+  bool has_index = false;
+  if (submap_collection_proto.version() >= 2u) {
+    has_index = readIndex(&proto_file, &index_proto);
+    LOG_IF(WARNING, !has_index) << "Could not read the submap index of '"
+                                << file_name << "', loading sequentially.";
+  }
+  const bool filters_submaps =
+      filter || !options.labels.empty() || !options.class_ids.empty();
+  if (!has_index && filters_submaps) {
+    LOG(ERROR) << "Loading selected submaps requires an indexed map file, "
+                  "resave '"
+               << file_name << "' to add the index.";
+    return false;
+  }
+
+  bool success;
+  std::vector<Submap*> submaps_to_recompute;
+  if (has_index) {
+    proto_file.close();
+    const SubmapLoadOptions& layers = options.layers;
+    std::vector<SubmapIndexEntryProto> entries;
+    for (const SubmapIndexEntryProto& entry : index_proto.submaps()) {
+      if (filter && !filter(entry)) {
+        continue;
+      }
+      const auto label = static_cast<PanopticLabel>(entry.panoptic_label());
+      if (!options.labels.empty() &&
+          std::find(options.labels.begin(), options.labels.end(), label) ==
+              options.labels.end()) {
+        continue;
+      }
+      if (layers.use_bounding_box) {
+        // Distance of the bounding sphere to the box.
+        const Point center(entry.center_x(), entry.center_y(),
+                           entry.center_z());
+        const Point closest =
+            center.cwiseMax(layers.box_min_M).cwiseMin(layers.box_max_M);
+        if ((center - closest).norm() > entry.radius()) {
+          continue;
+        }
+      }
+      entries.push_back(entry);
+    }
+    success = loadIndexed(file_name, entries, options, &submaps_to_recompute);
+  } else {
+    success =
+        loadSequentially(&proto_file, &byte_offset,
+                         submap_collection_proto.num_submaps(), options.layers,
+                         &submaps_to_recompute);
+    proto_file.close();
+  }
+  if (!success) {
+    return false;
+  }
+  active_freespace_submap_id_ =
+      submap_collection_proto.active_freespace_submap_id();
+
+  // Recompute data that is not stored with the submap.
+  if (options.recompute_data) {
+    recomputeData(submaps_to_recompute, options.recompute_meshes);
+  }
+  return true;
+}
+
+bool SubmapCollection::saveCheckpointToStream(
+    const SubmapCollection* previous, uint64_t sequence_number,
+    std::ostream* outfile_ptr, const TsdfQuantization* quantization,
+    const CheckpointSelection* selection) const {
+  CHECK_NOTNULL(outfile_ptr);
+  struct SubmapUpdate {
+    const Submap* submap;
+    bool replace;
+    voxblox::BlockIndexList blocks;
+  };
+
+  // Find all submaps and blocks that changed.
+  MapCheckpointProto checkpoint_proto;
+  checkpoint_proto.set_sequence_number(sequence_number);
+  checkpoint_proto.set_active_freespace_submap_id(active_freespace_submap_id_);
+  checkpoint_proto.set_is_full(previous == nullptr);
+  std::vector<SubmapUpdate> updates;
+  for (const auto& submap : submaps_) {
+    if (!submap) {
+      continue;
+    }
+    if (selection && selection->submap_ids.find(submap->getID()) ==
+                         selection->submap_ids.end()) {
+      continue;
+    }
+    checkpoint_proto.add_submap_ids(submap->getID());
+    SubmapUpdate update{submap.get(), true, {}};
+    if (previous && previous->submapIdExists(submap->getID()) &&
+        (!selection || selection->previous_submap_ids.find(submap->getID()) !=
+                           selection->previous_submap_ids.end())) {
+      const Submap& previous_submap = previous->getSubmap(submap->getID());
+      update.replace =
+          !submap->sharesDataWith(previous_submap) &&
+          !findChangedBlocks(previous_submap, *submap, &update.blocks);
+      if (!update.replace && update.blocks.empty()) {
+        // Only write the header if the meta data changed.
+        SubmapProto proto;
+        SubmapProto previous_proto;
+        submap->getProto(&proto);
+        previous_submap.getProto(&previous_proto);
+        proto.clear_num_blocks();
+        previous_proto.clear_num_blocks();
+        proto.clear_num_class_blocks();
+        previous_proto.clear_num_class_blocks();
+        if (proto.SerializeAsString() == previous_proto.SerializeAsString()) {
+          continue;
+        }
+      }
+    }
+    if (update.replace) {
+      update.blocks.clear();
+      submap->getTsdfLayer().getAllAllocatedBlocks(&update.blocks);
+      if (submap->getCollapsedBlocks()) {
+        for (const auto& index_voxel_pair :
+             submap->getCollapsedBlocks()->getBlocks()) {
+          update.blocks.push_back(index_voxel_pair.first);
+        }
+      }
+    }
+    updates.push_back(std::move(update));
+  }
+
+  // Write the checkpoint.
+  checkpoint_proto.set_num_submap_updates(updates.size());
+  if (!writeProtoMsgToStream(checkpoint_proto, outfile_ptr)) {
+    LOG(ERROR) << "Could not write map checkpoint message.";
+    return false;
+  }
+  for (const SubmapUpdate& update : updates) {
+    SubmapUpdateProto update_proto;
+    update_proto.set_submap_id(update.submap->getID());
+    update_proto.set_replace(update.replace);
+    if (!writeProtoMsgToStream(update_proto, outfile_ptr) ||
+        !update.submap->saveBlocksToStream(update.blocks, outfile_ptr,
+                                           quantization)) {
+      LOG(ERROR) << "Failed to save checkpoint of submap with ID '"
+                 << update.submap->getID() << "'.";
+      return false;
+    }
+  }
+  outfile_ptr->flush();
+  return true;
+}
+
+bool SubmapCollection::loadFromCheckpointFile(const std::string& file_path,
+                                              bool recompute_data) {
+  CHECK(!file_path.empty());
+  std::ifstream proto_file(file_path, std::fstream::in | std::fstream::binary);
+  if (!proto_file.is_open()) {
+    LOG(ERROR) << "Could not open checkpoint file '" << file_path << "'.";
+    return false;
+  }
+
+  // Clear the current maps.
+  clearSubmaps();
+  active_freespace_submap_id_ = -1;
+
+  // Replay all checkpoints. Submaps are tracked by their saved ID, which also
+  // preserves their order.
+  std::map<int, std::unique_ptr<Submap>> loaded_submaps;
+  int active_freespace_id = -1;
+  int num_checkpoints = 0;
+  uint64_t byte_offset = 0u;
+  MapCheckpointProto checkpoint_proto;
+  while (voxblox::utils::readProtoMsgFromStream(&proto_file, &checkpoint_proto,
+                                                &byte_offset)) {
+    bool success = true;
+    for (uint32_t i = 0; success && i < checkpoint_proto.num_submap_updates();
+         ++i) {
+      SubmapUpdateProto update_proto;
+      SubmapProto submap_proto;
+      if (!voxblox::utils::readProtoMsgFromStream(&proto_file, &update_proto,
+                                                  &byte_offset) ||
+          !voxblox::utils::readProtoMsgFromStream(&proto_file, &submap_proto,
+                                                  &byte_offset)) {
+        success = false;
+        break;
+      }
+      auto it = loaded_submaps.find(update_proto.submap_id());
+      if (it == loaded_submaps.end() || update_proto.replace()) {
+        std::unique_ptr<Submap> submap = Submap::createFromProto(
+            submap_proto, &submap_id_manager_, &instance_id_manager_);
+        success = submap->loadLayersFromStream(submap_proto, &proto_file,
+                                               &byte_offset);
+        loaded_submaps[update_proto.submap_id()] = std::move(submap);
+      } else {
+        success = it->second->applyUpdateFromStream(submap_proto, &proto_file,
+                                                    &byte_offset);
+      }
+    }
+    if (!success) {
+      LOG(WARNING) << "Checkpoint " << checkpoint_proto.sequence_number()
+                   << " of '" << file_path
+                   << "' is incomplete, only its complete submap updates "
+                      "were applied.";
+      break;
+    }
+
+    // Remove all submaps that were deleted until this checkpoint.
+    const std::unordered_set<int> ids(checkpoint_proto.submap_ids().begin(),
+                                      checkpoint_proto.submap_ids().end());
+    for (auto it = loaded_submaps.begin(); it != loaded_submaps.end();) {
+      if (ids.find(it->first) == ids.end()) {
+        it = loaded_submaps.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    active_freespace_id = checkpoint_proto.active_freespace_submap_id();
+    num_checkpoints++;
+  }
+  proto_file.close();
+  if (num_checkpoints == 0) {
+    LOG(ERROR) << "No complete checkpoint found in '" << file_path << "'.";
+    return false;
+  }
+
+  // Add to the collection.
+  for (auto& id_submap_pair : loaded_submaps) {
+    if (id_submap_pair.first == active_freespace_id) {
+      active_freespace_submap_id_ = id_submap_pair.second->getID();
+    }
+    appendSubmap(std::move(id_submap_pair.second));
+  }
+  if (recompute_data) {
+    std::vector<Submap*> submaps;
+    for (Submap& submap : *this) {
+      submaps.emplace_back(&submap);
+    }
+    recomputeData(submaps);
+  }
+  return true;
+}
+
+bool SubmapCollection::applyCheckpointFromStream(
+    const MapCheckpointProto& checkpoint_proto, std::istream* proto_file_ptr,
+    uint64_t* tmp_byte_offset_ptr, SourceIDMap* id_map,
+    std::unordered_map<int, voxblox::BlockIndexList>* updated_blocks) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  CHECK_NOTNULL(id_map);
+
+  // Instances of the source get their own InstanceIDs in this collection.
+  auto map_instance_id = [this, id_map](Submap* submap) {
+    const int source_id = submap->getInstanceID();
+    if (source_id < 0) {
+      return;
+    }
+    auto it = id_map->instance_ids.find(source_id);
+    if (it == id_map->instance_ids.end()) {
+      const InstanceID new_id(&instance_id_manager_);
+      it = id_map->instance_ids.emplace(source_id, new_id).first;
+    }
+    submap->setInstanceID(it->second);
+  };
+
+  for (uint32_t i = 0; i < checkpoint_proto.num_submap_updates(); ++i) {
+    SubmapUpdateProto update_proto;
+    SubmapProto submap_proto;
+    if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &update_proto,
+                                                tmp_byte_offset_ptr) ||
+        !voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &submap_proto,
+                                                tmp_byte_offset_ptr)) {
+      LOG(ERROR) << "Could not read submap update " << i << " of checkpoint "
+                 << checkpoint_proto.sequence_number() << ".";
+      return false;
+    }
+    auto it = id_map->submap_ids.find(update_proto.submap_id());
+    const bool exists =
+        it != id_map->submap_ids.end() && submapIdExists(it->second);
+
+    // Update the blocks of existing submaps in place.
+    if (exists && !update_proto.replace()) {
+      Submap* submap = getSubmapPtr(it->second);
+      voxblox::BlockIndexList blocks;
+      if (!submap->applyUpdateFromStream(submap_proto, proto_file_ptr,
+                                         tmp_byte_offset_ptr, &blocks)) {
+        LOG(ERROR) << "Could not update submap " << it->second << ".";
+        return false;
+      }
+      map_instance_id(submap);
+      if (updated_blocks) {
+        voxblox::BlockIndexList& result = (*updated_blocks)[submap->getID()];
+        result.insert(result.end(), blocks.begin(), blocks.end());
+      }
+      continue;
+    }
+    if (!update_proto.replace()) {
+      LOG(WARNING) << "Received an update of unknown source submap "
+                   << update_proto.submap_id() << ".";
+      return false;
+    }
+
+    // Replace or add the submap.
+    if (exists) {
+      removeSubmap(it->second);
+      if (updated_blocks) {
+        updated_blocks->erase(it->second);
+      }
+    }
+    std::unique_ptr<Submap> submap = Submap::createFromProto(
+        submap_proto, &submap_id_manager_, &instance_id_manager_);
+    if (!submap->loadLayersFromStream(submap_proto, proto_file_ptr,
+                                      tmp_byte_offset_ptr)) {
+      LOG(ERROR) << "Could not load source submap "
+                 << update_proto.submap_id() << ".";
+      id_map->submap_ids.erase(update_proto.submap_id());
+      return false;
+    }
+    Submap* new_submap = appendSubmap(std::move(submap));
+    map_instance_id(new_submap);
+    id_map->submap_ids[update_proto.submap_id()] = new_submap->getID();
+    if (updated_blocks) {
+      new_submap->getTsdfLayer().getAllAllocatedBlocks(
+          &(*updated_blocks)[new_submap->getID()]);
+    }
+  }
+
+  // Remove all submaps that no longer exist at the source.
+  const std::unordered_set<int> ids(checkpoint_proto.submap_ids().begin(),
+                                    checkpoint_proto.submap_ids().end());
+  std::vector<int> removed_ids;
+  for (auto it = id_map->submap_ids.begin();
+       it != id_map->submap_ids.end();) {
+    if (ids.find(it->first) == ids.end()) {
+      removed_ids.push_back(it->second);
+      if (updated_blocks) {
+        updated_blocks->erase(it->second);
+      }
+      it = id_map->submap_ids.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  removeSubmaps(removed_ids);
+  return true;
+}
+
+void SubmapCollection::recomputeData(const std::vector<Submap*>& submaps,
+                                     bool recompute_meshes) {
+  // Same as 'Submap::updateEverything(false)' but meshing all submaps jointly.
+  if (submaps.empty()) {
+    return;
+  }
+  std::vector<std::future<void>> threads;
+  for (Submap* submap : submaps) {
+    threads.emplace_back(thread_pool_->submitOnNode(
+        submap->getHomeNode(), [submap]() { submap->updateBoundingVolume(); }));
+  }
+  thread_pool_->waitAll(&threads);
+  threads.clear();
+  if (!recompute_meshes) {
+    return;
+  }
+  updateMeshes(submaps, thread_pool_, false);
+  for (Submap* submap : submaps) {
+    threads.emplace_back(
+        thread_pool_->submitOnNode(submap->getHomeNode(), [submap]() {
+          submap->computeIsoSurfacePoints();
+        }));
+  }
+  thread_pool_->waitAll(&threads);
+}
+
+void SubmapCollection::updateMeshes(const std::vector<Submap*>& submaps,
+                                    ThreadPool* thread_pool,
+                                    bool only_updated_blocks,
+                                    bool use_class_layer) {
+  CHECK_NOTNULL(thread_pool);
+  Timer timer("map/update_meshes");
+  // Gather the blocks of all submaps.
+  std::vector<std::pair<Submap*, BlockIndex>> tasks;
+  for (Submap* submap : submaps) {
+    CHECK_NOTNULL(submap);
+    for (const BlockIndex& index :
+         submap->prepareMeshUpdate(only_updated_blocks, use_class_layer)) {
+      tasks.emplace_back(submap, index);
+    }
+  }
+  if (tasks.empty()) {
+    return;
+  }
+
+  // Mesh all blocks on the thread pool, preferably by the workers of the
+  // home node of their submap.
+  const int num_nodes = thread_pool->getNumNodes();
+  std::vector<std::vector<size_t>> node_tasks(num_nodes);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    const int node = tasks[i].first->getHomeNode();
+    node_tasks[std::clamp(node, 0, num_nodes - 1)].push_back(i);
+  }
+  NodeLocalIndexGetter<size_t> index_getter(std::move(node_tasks));
+  const size_t num_threads =
+      std::min<size_t>(thread_pool->getNumThreads(), tasks.size());
+  std::vector<std::future<void>> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submitOnNode(
+        i % num_nodes, [&tasks, &index_getter, thread_pool]() {
+          const int node = thread_pool->getCurrentNode();
+          const ChunkedIndexGetter<size_t>* getter;
+          size_t begin, end;
+          while (index_getter.getNextChunk(node, &getter, &begin, &end)) {
+            for (size_t j = begin; j < end; ++j) {
+              const auto& task = tasks[(*getter)[j]];
+              task.first->updateMeshBlock(task.second);
+            }
+          }
+        }));
+  }
+  thread_pool->waitAll(&threads);
+}
+
+void SubmapCollection::updateMeshes(bool only_updated_blocks,
+                                    bool use_class_layer) {
+  std::vector<Submap*> submaps;
+  submaps.reserve(size());
+  for (Submap& submap : *this) {
+    submaps.emplace_back(&submap);
+  }
+  updateMeshes(submaps, thread_pool_, only_updated_blocks, use_class_layer);
+}
+
+bool SubmapCollection::loadSequentially(
+    std::istream* proto_file, uint64_t* byte_offset, size_t num_submaps,
+    const SubmapLoadOptions& options,
+    std::vector<Submap*>* submaps_to_recompute) {
+  CHECK_NOTNULL(submaps_to_recompute);
   // Loading each of the submaps.
-  for (size_t sub_map_index = 0u;
-       sub_map_index < submap_collection_proto.num_submaps(); ++sub_map_index) {
-    std::unique_ptr<Submap> submap_ptr =
-        Submap::loadFromStream(&proto_file, &tmp_byte_offset,
-                               &submap_id_manager_, &instance_id_manager_);
+  for (size_t sub_map_index = 0u; sub_map_index < num_submaps;
+       ++sub_map_index) {
+    bool loaded_derived_data;
+    std::unique_ptr<Submap> submap_ptr = Submap::loadFromStream(
+        proto_file, byte_offset, &submap_id_manager_, &instance_id_manager_,
+        &loaded_derived_data, options);
     if (submap_ptr == nullptr) {
       LOG(ERROR) << "Failed to load submap '" << sub_map_index
                  << "' from stream.";
-      proto_file.close();
       return false;
     }
+    if (!keepLoadedSubmap(*submap_ptr, options)) {
+      continue;
+    }
 
     // Add to the collection.
-    id_to_index_[submap_ptr->getID()] = submaps_.size();
-    submaps_.emplace_back(std::move(submap_ptr));
+    Submap* submap = appendSubmap(std::move(submap_ptr));
+    if (!loaded_derived_data) {
+      submaps_to_recompute->push_back(submap);
+    }
+  }
+  return true;
+}
+
+bool SubmapCollection::loadIndexed(
+    const std::string& file_name,
+    const std::vector<SubmapIndexEntryProto>& entries,
+    const MapLoadOptions& options,
+    std::vector<Submap*>* submaps_to_recompute) {
+  CHECK_NOTNULL(submaps_to_recompute);
+  // Create the submaps in file order since this assigns the IDs. Only the
+  // headers are read here, the ClassIDs are only stored in the headers.
+  std::vector<SubmapProto> headers;
+  std::vector<uint64_t> layer_offsets;
+  std::vector<int> source_ids;
+  std::vector<std::unique_ptr<Submap>> submaps;
+  std::ifstream proto_file(file_name, std::fstream::in | std::fstream::binary);
+  for (const SubmapIndexEntryProto& entry : entries) {
+    SubmapProto header;
+    uint64_t byte_offset = entry.byte_offset();
+    if (!voxblox::utils::readProtoMsgFromStream(&proto_file, &header,
+                                                &byte_offset)) {
+      LOG(ERROR) << "Could not read the header of submap '"
+                 << entry.submap_id() << "'.";
+      return false;
+    }
+    if (!options.class_ids.empty() &&
+        std::find(options.class_ids.begin(), options.class_ids.end(),
+                  header.class_id()) == options.class_ids.end()) {
+      continue;
+    }
+    submaps.emplace_back(Submap::createFromProto(header, &submap_id_manager_,
+                                                 &instance_id_manager_));
+    headers.push_back(std::move(header));
+    layer_offsets.push_back(byte_offset);
+    source_ids.push_back(entry.submap_id());
   }
-  active_freespace_submap_id_ =
-      submap_collection_proto.active_freespace_submap_id();
   proto_file.close();
 
-  // Recompute data that is not stored with the submap.
-  if (recompute_data) {
-    for (Submap& submap : *this) {
-      submap.updateEverything(false);
+  // Load the layers in parallel, every task reads from its own stream.
+  std::vector<std::future<bool>> threads;
+  std::vector<char> loaded_derived_data(submaps.size(), false);
+  for (size_t i = 0; i < submaps.size(); ++i) {
+    threads.emplace_back(thread_pool_->submit([&, i]() {
+      std::ifstream stream(file_name, std::fstream::in | std::fstream::binary);
+      uint64_t byte_offset = layer_offsets[i];
+      bool loaded = false;
+      const bool success =
+          stream.is_open() &&
+          submaps[i]->loadLayersFromStream(headers[i], &stream, &byte_offset,
+                                           &loaded, options.layers);
+      loaded_derived_data[i] = loaded;
+      return success;
+    }));
+  }
+  bool success = true;
+  for (size_t i = 0; i < threads.size(); ++i) {
+    if (!thread_pool_->wait(&threads[i])) {
+      LOG(ERROR) << "Failed to load submap '" << source_ids[i]
+                 << "' from stream.";
+      success = false;
+    }
+  }
+  if (!success) {
+    return false;
+  }
+
+  // Add to the collection.
+  for (size_t i = 0; i < submaps.size(); ++i) {
+    if (!keepLoadedSubmap(*submaps[i], options.layers)) {
+      continue;
+    }
+    Submap* submap = appendSubmap(std::move(submaps[i]));
+    if (!loaded_derived_data[i]) {
+      submaps_to_recompute->push_back(submap);
     }
   }
   return true;
 }
 
+bool SubmapCollection::keepLoadedSubmap(const Submap& submap,
+                                        const SubmapLoadOptions& options) {
+  // The bounding sphere of a submap can intersect the box without any block.
+  return !options.use_bounding_box ||
+         submap.getTsdfLayer().getNumberOfAllocatedBlocks() > 0;
+}
+
+CollectionMemoryUsage SubmapCollection::computeMemoryUsage() const {
+  CollectionMemoryUsage result;
+  for (const Submap& submap : *this) {
+    const SubmapMemoryUsage usage = submap.getMemoryUsage();
+    result.total += usage;
+    result.per_label[submap.getLabel()] += usage;
+    result.per_submap[submap.getID()] = usage;
+    result.num_submaps++;
+    if (submap.isEvicted()) {
+      result.num_evicted_submaps++;
+    }
+  }
+  return result;
+}
+
+std::string CollectionMemoryUsage::toString() const {
+  auto to_mb = [](size_t bytes) {
+    return static_cast<float>(bytes) / (1024.f * 1024.f);
+  };
+  auto print_row = [&to_mb](std::stringstream* ss, const std::string& name,
+                            const SubmapMemoryUsage& usage) {
+    *ss << "\n"
+        << std::left << std::setw(14) << name << std::right << std::fixed
+        << std::setprecision(2) << std::setw(10) << to_mb(usage.tsdf)
+        << std::setw(10) << to_mb(usage.classification) << std::setw(10)
+        << to_mb(usage.mesh) << std::setw(10) << to_mb(usage.iso_surface_points)
+        << std::setw(10) << to_mb(usage.total());
+  };
+  std::stringstream ss;
+  ss << "Memory usage of " << num_submaps << " submaps ("
+     << num_evicted_submaps << " evicted) [MB]:\n"
+     << std::left << std::setw(14) << "Label" << std::right << std::setw(10)
+     << "TSDF" << std::setw(10) << "Class" << std::setw(10) << "Mesh"
+     << std::setw(10) << "IsoPoints" << std::setw(10) << "Total";
+  for (const auto& label_usage : per_label) {
+    print_row(&ss, panopticLabelToString(label_usage.first),
+              label_usage.second);
+  }
+  print_row(&ss, "All", total);
+  return ss.str();
+}
+
 std::string SubmapCollection::checkMapFileExtension(const std::string& file) {
   const std::string extension = ".panmap";
   if (!(file.size() >= extension.size() &&
@@ -214,14 +1105,38 @@ std::unique_ptr<SubmapCollection> SubmapCollection::clone() const {
   // Copy all the meta data.
   result->submap_id_manager_ = submap_id_manager_;
   result->instance_id_manager_ = instance_id_manager_;
-  result->id_to_index_ = id_to_index_;
-  result->instance_to_submap_ids_ = instance_to_submap_ids_;
   result->active_freespace_submap_id_ = active_freespace_submap_id_;
+  result->thread_pool_ = thread_pool_;
 
   // Deep copy all the submaps to the new managers.
   for (const Submap& submap : *this) {
-    result->submaps_.emplace_back(submap.clone(&result->submap_id_manager_,
-                                               &result->instance_id_manager_));
+    result->appendSubmap(submap.clone(&result->submap_id_manager_,
+                                      &result->instance_id_manager_));
+  }
+
+  return result;
+}
+
+std::unique_ptr<SubmapCollection> SubmapCollection::snapshot(
+    const SubmapCollection* previous) {
+  std::unique_ptr<SubmapCollection> result =
+      std::make_unique<SubmapCollection>();
+
+  // Copy all the meta data.
+  result->submap_id_manager_ = submap_id_manager_;
+  result->instance_id_manager_ = instance_id_manager_;
+  result->active_freespace_submap_id_ = active_freespace_submap_id_;
+  result->thread_pool_ = thread_pool_;
+
+  // Snapshot all submaps, reusing the previous snapshot where possible.
+  for (Submap& submap : *this) {
+    const Submap* previous_submap = nullptr;
+    if (previous && previous->submapIdExists(submap.getID())) {
+      previous_submap = &previous->getSubmap(submap.getID());
+    }
+    result->appendSubmap(
+        submap.snapshot(previous_submap, &result->submap_id_manager_,
+                        &result->instance_id_manager_));
   }
 
   return result;
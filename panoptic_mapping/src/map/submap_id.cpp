@@ -12,7 +12,23 @@ SubmapID::~SubmapID() { manager_->releaseID(id_); }
 
 SubmapIDManager::SubmapIDManager() : current_id_(0) {}
 
+SubmapIDManager::SubmapIDManager(const SubmapIDManager& other) {
+  std::lock_guard<std::mutex> lock(other.mutex_);
+  current_id_ = other.current_id_;
+  vacant_ids_ = other.vacant_ids_;
+}
+
+SubmapIDManager& SubmapIDManager::operator=(const SubmapIDManager& other) {
+  if (this != &other) {
+    std::scoped_lock lock(mutex_, other.mutex_);
+    current_id_ = other.current_id_;
+    vacant_ids_ = other.vacant_ids_;
+  }
+  return *this;
+}
+
 int SubmapIDManager::requestID() {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (vacant_ids_.empty()) {
     return current_id_++;
   } else {
@@ -24,6 +40,7 @@ int SubmapIDManager::requestID() {
 
 void SubmapIDManager::releaseID(int id) {
   if (kAllowIDReuse) {
+    std::lock_guard<std::mutex> lock(mutex_);
     vacant_ids_.push(id);
   }
 }
@@ -0,0 +1,54 @@
+#include "panoptic_mapping/map/submap_label_table.h"
+
+#include <glog/logging.h>
+
+namespace panoptic_mapping {
+
+void SubmapLabelTable::add(int submap_id, int instance_id, int class_id) {
+  CHECK_GE(submap_id, 0);
+  if (static_cast<size_t>(submap_id) >= submap_to_class_.size()) {
+    submap_to_class_.resize(submap_id + 1, kNoClassID);
+  }
+  submap_to_class_[submap_id] = class_id;
+  instance_to_submap_ids_[instance_id].insert(submap_id);
+}
+
+void SubmapLabelTable::remove(int submap_id, int instance_id) {
+  if (submap_id >= 0 &&
+      static_cast<size_t>(submap_id) < submap_to_class_.size()) {
+    submap_to_class_[submap_id] = kNoClassID;
+  }
+  auto it = instance_to_submap_ids_.find(instance_id);
+  if (it != instance_to_submap_ids_.end()) {
+    it->second.erase(submap_id);
+    if (it->second.empty()) {
+      instance_to_submap_ids_.erase(it);
+    }
+  }
+}
+
+void SubmapLabelTable::setInstanceID(int submap_id, int previous_instance_id,
+                                     int instance_id) {
+  auto it = instance_to_submap_ids_.find(previous_instance_id);
+  if (it != instance_to_submap_ids_.end()) {
+    it->second.erase(submap_id);
+    if (it->second.empty()) {
+      instance_to_submap_ids_.erase(it);
+    }
+  }
+  instance_to_submap_ids_[instance_id].insert(submap_id);
+}
+
+void SubmapLabelTable::setClassID(int submap_id, int class_id) {
+  if (submap_id >= 0 &&
+      static_cast<size_t>(submap_id) < submap_to_class_.size()) {
+    submap_to_class_[submap_id] = class_id;
+  }
+}
+
+void SubmapLabelTable::clear() {
+  submap_to_class_.clear();
+  instance_to_submap_ids_.clear();
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,169 @@
+#include "panoptic_mapping/map/submap_spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace panoptic_mapping {
+
+SubmapSpatialIndex::SubmapSpatialIndex(float min_cell_size)
+    : min_cell_size_(min_cell_size) {
+  CHECK_GT(min_cell_size_, 0.f);
+}
+
+float SubmapSpatialIndex::cellSize(int level) const {
+  return min_cell_size_ * static_cast<float>(1 << level);
+}
+
+voxblox::BlockIndex SubmapSpatialIndex::cellIndex(const Point& point,
+                                                  int level) const {
+  return voxblox::getGridIndexFromPoint<voxblox::BlockIndex>(
+      point, 1.f / cellSize(level));
+}
+
+void SubmapSpatialIndex::update(int submap_id, const Point& center_M,
+                                float radius) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (updateLocked(submap_id, center_M, radius)) {
+    generation_++;
+  }
+}
+
+void SubmapSpatialIndex::update(const std::vector<Sphere>& spheres) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool changed = false;
+  for (const Sphere& sphere : spheres) {
+    changed |= updateLocked(sphere.submap_id, sphere.center_M, sphere.radius);
+  }
+  if (changed) {
+    generation_++;
+  }
+}
+
+bool SubmapSpatialIndex::updateLocked(int submap_id, const Point& center_M,
+                                      float radius) {
+  auto it = entries_.find(submap_id);
+  if (it != entries_.end() && it->second.center == center_M &&
+      it->second.radius == radius) {
+    return false;
+  }
+
+  // Find the finest level whose cells fit the sphere.
+  int level = 0;
+  while (cellSize(level) < 2.f * radius && level < 30) {
+    ++level;
+  }
+  const voxblox::BlockIndex cell = cellIndex(center_M, level);
+  if (it != entries_.end()) {
+    if (it->second.level == level && it->second.cell == cell) {
+      it->second.center = center_M;
+      it->second.radius = radius;
+      return true;
+    }
+    removeFromCell(submap_id, it->second);
+  }
+  if (static_cast<int>(levels_.size()) <= level) {
+    levels_.resize(level + 1);
+  }
+  levels_[level][cell].push_back(submap_id);
+  entries_[submap_id] = Entry{center_M, radius, level, cell};
+  return true;
+}
+
+void SubmapSpatialIndex::remove(int submap_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(submap_id);
+  if (it == entries_.end()) {
+    return;
+  }
+  generation_++;
+  removeFromCell(submap_id, it->second);
+  entries_.erase(it);
+}
+
+void SubmapSpatialIndex::removeFromCell(int submap_id, const Entry& entry) {
+  Level& level = levels_[entry.level];
+  auto cell_it = level.find(entry.cell);
+  if (cell_it == level.end()) {
+    return;
+  }
+  std::vector<int>& ids = cell_it->second;
+  ids.erase(std::remove(ids.begin(), ids.end(), submap_id), ids.end());
+  if (ids.empty()) {
+    level.erase(cell_it);
+  }
+}
+
+void SubmapSpatialIndex::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation_++;
+  entries_.clear();
+  levels_.clear();
+}
+
+size_t SubmapSpatialIndex::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+std::vector<int> SubmapSpatialIndex::findIntersecting(const Point& center_M,
+                                                      float radius) const {
+  // Small tolerance since the spheres are compared in mission frame.
+  constexpr float kEpsilon = 1e-4f;
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<int> result;
+  auto check_cell = [&](const std::vector<int>& ids) {
+    for (const int id : ids) {
+      const Entry& entry = entries_.at(id);
+      if ((entry.center - center_M).norm() <=
+          entry.radius + radius + kEpsilon) {
+        result.push_back(id);
+      }
+    }
+  };
+
+  for (size_t level = 0; level < levels_.size(); ++level) {
+    const Level& cells = levels_[level];
+    if (cells.empty()) {
+      continue;
+    }
+    // Spheres of this level lie within half a cell around their cell.
+    const float cell_size = cellSize(level);
+    const float reach = radius + 0.5f * cell_size + kEpsilon;
+    const voxblox::BlockIndex min_cell =
+        cellIndex(center_M - Point::Constant(reach), level);
+    const voxblox::BlockIndex max_cell =
+        cellIndex(center_M + Point::Constant(reach), level);
+    const voxblox::BlockIndex extent = max_cell - min_cell;
+    const double num_query_cells = static_cast<double>(extent.x() + 1) *
+                                   (extent.y() + 1) * (extent.z() + 1);
+
+    // Visit whichever is fewer: the cells overlapping the query or all
+    // occupied cells of the level.
+    if (num_query_cells > static_cast<double>(cells.size())) {
+      for (const auto& cell_ids_pair : cells) {
+        const voxblox::BlockIndex& cell = cell_ids_pair.first;
+        if ((cell.array() >= min_cell.array()).all() &&
+            (cell.array() <= max_cell.array()).all()) {
+          check_cell(cell_ids_pair.second);
+        }
+      }
+    } else {
+      voxblox::BlockIndex cell;
+      for (cell.x() = min_cell.x(); cell.x() <= max_cell.x(); ++cell.x()) {
+        for (cell.y() = min_cell.y(); cell.y() <= max_cell.y(); ++cell.y()) {
+          for (cell.z() = min_cell.z(); cell.z() <= max_cell.z();
+               ++cell.z()) {
+            auto it = cells.find(cell);
+            if (it != cells.end()) {
+              check_cell(it->second);
+            }
+          }
+        }
+      }
+    }
+  }
+  return result;
+}
+
+}  // namespace panoptic_mapping
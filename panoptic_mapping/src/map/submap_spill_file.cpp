@@ -0,0 +1,25 @@
+#include "panoptic_mapping/map/submap_spill_file.h"
+
+#include <cstdio>
+#include <string>
+
+#include <glog/logging.h>
+
+namespace panoptic_mapping {
+
+SubmapSpillFile::SubmapSpillFile(const std::string& file_path)
+    : file_path_(file_path) {
+  stream_.open(file_path_, std::fstream::in | std::fstream::out |
+                               std::fstream::binary | std::fstream::trunc);
+  LOG_IF(ERROR, !stream_.is_open())
+      << "Could not open submap spill file '" << file_path_ << "'.";
+}
+
+SubmapSpillFile::~SubmapSpillFile() {
+  if (stream_.is_open()) {
+    stream_.close();
+    std::remove(file_path_.c_str());
+  }
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,82 @@
+#include "panoptic_mapping/map/voxel_mask.h"
+
+namespace panoptic_mapping {
+
+void SubmapVoxelMasks::copyFrom(const SubmapVoxelMasks& other) {
+  std::lock_guard<std::mutex> other_lock(other.mutex_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  masks_ = other.masks_;
+  near_surface_distance_ = other.near_surface_distance_;
+}
+
+void SubmapVoxelMasks::update(const BlockIndex& index, const TsdfBlock& block,
+                              const VoxelMask* voxels) {
+  // Blocks are only looked up or inserted under the lock. The masks of
+  // different blocks are independent and references to them remain valid.
+  BlockMasks* masks;
+  bool is_new = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = masks_.find(index);
+    if (it == masks_.end()) {
+      it = masks_.emplace(index, BlockMasks{VoxelMask(block.num_voxels()),
+                                            VoxelMask(block.num_voxels())})
+               .first;
+      is_new = true;
+    }
+    masks = &it->second;
+  }
+  if (is_new || !voxels) {
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      updateVoxel(block.getVoxelByLinearIndex(i), i, masks);
+    }
+    return;
+  }
+  voxels->forEach([&](size_t i) {
+    updateVoxel(block.getVoxelByLinearIndex(i), i, masks);
+  });
+}
+
+void SubmapVoxelMasks::updateVoxel(const TsdfVoxel& voxel, size_t linear_index,
+                                   BlockMasks* masks) const {
+  if (isObserved(voxel)) {
+    masks->observed.set(linear_index);
+  } else {
+    masks->observed.reset(linear_index);
+  }
+  if (isNearSurface(voxel)) {
+    masks->near_surface.set(linear_index);
+  } else {
+    masks->near_surface.reset(linear_index);
+  }
+}
+
+void SubmapVoxelMasks::remove(const BlockIndex& index) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  masks_.erase(index);
+}
+
+void SubmapVoxelMasks::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  masks_.clear();
+}
+
+const SubmapVoxelMasks::BlockMasks* SubmapVoxelMasks::get(
+    const BlockIndex& index) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = masks_.find(index);
+  return it == masks_.end() ? nullptr : &it->second;
+}
+
+size_t SubmapVoxelMasks::getMemorySize() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t result = sizeof(SubmapVoxelMasks);
+  for (const auto& index_masks_pair : masks_) {
+    result += sizeof(index_masks_pair) +
+              index_masks_pair.second.observed.getMemorySize() +
+              index_masks_pair.second.near_surface.getMemorySize();
+  }
+  return result;
+}
+
+}  // namespace panoptic_mapping
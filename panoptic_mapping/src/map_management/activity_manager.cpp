@@ -1,11 +1,15 @@
 #include "panoptic_mapping/map_management/activity_manager.h"
 
-#include <unordered_set>
+#include <algorithm>
+#include <tuple>
+#include <vector>
 
 namespace panoptic_mapping {
 
 void ActivityManager::Config::checkParams() const {
   //  checkParamNE(error_threshold, 0.f, "error_threshold");
+  checkParamGE(max_active_submaps, 0, "max_active_submaps");
+  checkParamGE(max_active_volume, 0.f, "max_active_volume");
 }
 
 void ActivityManager::Config::setupParamsAndPrinting() {
@@ -13,6 +17,8 @@ void ActivityManager::Config::setupParamsAndPrinting() {
   setupParam("required_reobservations", &required_reobservations);
   setupParam("deactivate_after_missed_detections",
              &deactivate_after_missed_detections);
+  setupParam("max_active_submaps", &max_active_submaps);
+  setupParam("max_active_volume", &max_active_volume, "m^3");
 }
 
 ActivityManager::ActivityManager(const Config& config)
@@ -20,9 +26,11 @@ ActivityManager::ActivityManager(const Config& config)
   LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
 }
 
-void ActivityManager::processSubmaps(SubmapCollection* submaps) {
+void ActivityManager::processSubmaps(SubmapCollection* submaps,
+                                     std::vector<int>* deactivated_submaps) {
   CHECK_NOTNULL(submaps);
-  std::unordered_set<int> submaps_to_delete;
+  frame_index_++;
+  std::vector<int> submaps_to_delete;
   for (Submap& submap : *submaps) {
     // Parse only active object maps.
     // NOTE(schmluk): Could be extended to free space for global consistency.
@@ -32,18 +40,20 @@ void ActivityManager::processSubmaps(SubmapCollection* submaps) {
 
     // Check for re-detections of new submaps.
     if (!checkRequiredRedetection(&submap)) {
-      submaps_to_delete.insert(submap.getID());
+      submaps_to_delete.emplace_back(submap.getID());
+      submap_last_tracked_frames_.erase(submap.getID());
       continue;
     }
 
     // Check tracking for active submaps.
-    checkMissedDetections(&submap);
+    checkMissedDetections(&submap, deactivated_submaps);
   }
 
   // Remove requested submaps.
-  for (const int id : submaps_to_delete) {
-    submaps->removeSubmap(id);
-  }
+  submaps->removeSubmaps(submaps_to_delete);
+
+  // Bound the active set.
+  enforceActiveSetCaps(submaps, deactivated_submaps);
 
   // Reset.
   for (Submap& submap : *submaps) {
@@ -76,7 +86,8 @@ bool ActivityManager::checkRequiredRedetection(Submap* submap) {
   return false;
 }
 
-void ActivityManager::checkMissedDetections(Submap* submap) {
+void ActivityManager::checkMissedDetections(
+    Submap* submap, std::vector<int>* deactivated_submaps) {
   // Check whether a submap was not detected for X consecutive frames.
   if (config_.deactivate_after_missed_detections <= 0) {
     return;
@@ -95,8 +106,79 @@ void ActivityManager::checkMissedDetections(Submap* submap) {
     }
     it->second--;
     if (it->second <= 0) {
-      submap->finishActivePeriod();
+      deactivate(submap, deactivated_submaps);
+    }
+  }
+}
+
+void ActivityManager::enforceActiveSetCaps(
+    SubmapCollection* submaps, std::vector<int>* deactivated_submaps) {
+  if (config_.max_active_submaps <= 0 && config_.max_active_volume <= 0.f) {
+    return;
+  }
+
+  // Collect the active object submaps by the frame they were last tracked in.
+  // New submaps count as tracked when first seen.
+  std::vector<std::tuple<int, int, float>> candidates;  // Frame, ID, volume.
+  int num_active = 0;
+  float active_volume = 0.f;
+  for (Submap& submap : *submaps) {
+    if (!submap.isActive() || submap.getLabel() == PanopticLabel::kFreeSpace) {
+      continue;
     }
+    auto it = submap_last_tracked_frames_
+                  .emplace(submap.getID(), frame_index_)
+                  .first;
+    if (submap.wasTracked()) {
+      it->second = frame_index_;
+    }
+    const float block_size = submap.getTsdfLayer().block_size();
+    const float volume = submap.getTsdfLayer().getNumberOfAllocatedBlocks() *
+                         block_size * block_size * block_size;
+    num_active++;
+    active_volume += volume;
+    if (it->second < frame_index_) {
+      candidates.emplace_back(it->second, submap.getID(), volume);
+    }
+  }
+  auto exceeds_caps = [&]() {
+    return (config_.max_active_submaps > 0 &&
+            num_active > config_.max_active_submaps) ||
+           (config_.max_active_volume > 0.f &&
+            active_volume > config_.max_active_volume);
+  };
+  if (!exceeds_caps()) {
+    return;
+  }
+
+  // Deactivate the least recently tracked submaps first.
+  std::sort(candidates.begin(), candidates.end());
+  int num_deactivated = 0;
+  for (const auto& candidate : candidates) {
+    if (!exceeds_caps()) {
+      break;
+    }
+    const int submap_id = std::get<1>(candidate);
+    deactivate(submaps->getSubmapPtr(submap_id), deactivated_submaps);
+    submap_missed_detection_counts_.erase(submap_id);
+    num_active--;
+    active_volume -= std::get<2>(candidate);
+    num_deactivated++;
+  }
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Deactivated " << num_deactivated
+      << " least recently tracked submaps to bound the active set ("
+      << num_active << " submaps, " << active_volume << "m^3 active).";
+}
+
+void ActivityManager::deactivate(Submap* submap,
+                                 std::vector<int>* deactivated_submaps) {
+  submap_last_tracked_frames_.erase(submap->getID());
+  if (deactivated_submaps) {
+    submap->finishActivePeriod(true);
+    deactivated_submaps->push_back(submap->getID());
+  } else {
+    submap->finishActivePeriod();
   }
 }
 
@@ -1,12 +1,93 @@
 #include "panoptic_mapping/map_management/layer_manipulator.h"
 
 #include <algorithm>
+#include <atomic>
+#include <future>
+#include <limits>
+#include <vector>
 
 #include <voxblox/integrator/esdf_integrator.h>
 #include <voxblox/integrator/merge_integration.h>
+#include <voxblox/interpolator/interpolator.h>
+
+#include "panoptic_mapping/common/block_layout.h"
+#include "panoptic_mapping/common/morton_order.h"
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/map/block_pool.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+// Call function(i) for all i in [0, num_items) in parallel on the thread
+// pool. Items are claimed in small chunks of consecutive indices, such that
+// each thread processes neighboring blocks of Morton ordered lists.
+template <typename FunctionT>
+void parallelFor(ThreadPool* thread_pool, size_t num_items,
+                 const FunctionT& function) {
+  CHECK_NOTNULL(thread_pool);
+  constexpr size_t kChunkSize = 4;
+  std::atomic<size_t> next_item(0);
+  const size_t num_threads =
+      std::min<size_t>(thread_pool->getNumThreads(), num_items);
+  std::vector<std::future<void>> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submit([&]() {
+      size_t begin;
+      while ((begin = next_item.fetch_add(kChunkSize)) < num_items) {
+        const size_t end = std::min(begin + kChunkSize, num_items);
+        for (size_t item = begin; item < end; ++item) {
+          function(item);
+        }
+      }
+    }));
+  }
+  thread_pool->waitAll(&threads);
+}
+
+// How the class voxel of B is updated when merging a voxel of A into B.
+enum class ClassUpdate { kNone, kMerge, kCopy };
+
+// Merge a TSDF voxel of A into the corresponding voxel of B depending on
+// whether they belong to their submaps.
+ClassUpdate mergeTsdfVoxelAintoB(const TsdfVoxel& tsdf_voxel_A, bool belongs_A,
+                                 TsdfVoxel* tsdf_voxel_B, bool belongs_B) {
+  if (belongs_A && belongs_B) {
+    // Voxels that belong to A and B are merged.
+    voxblox::mergeVoxelAIntoVoxelB(tsdf_voxel_A, tsdf_voxel_B);
+    return ClassUpdate::kMerge;
+  } else if (belongs_A) {
+    // If it only belongs to A but not to B overwrite B.
+    tsdf_voxel_B->distance = tsdf_voxel_A.distance;
+    tsdf_voxel_B->weight = tsdf_voxel_A.weight;
+    tsdf_voxel_B->color = tsdf_voxel_A.color;
+    return ClassUpdate::kCopy;
+  }
+  // If it does not belong to A or neither then no action is required.
+  return ClassUpdate::kNone;
+}
+
+// Merge a voxel of A into the corresponding voxel of B.
+void mergeVoxelAintoB(const TsdfVoxel& tsdf_voxel_A,
+                      const ClassVoxel* class_voxel_A, TsdfVoxel* tsdf_voxel_B,
+                      ClassVoxel* class_voxel_B) {
+  const ClassUpdate update = mergeTsdfVoxelAintoB(
+      tsdf_voxel_A, !class_voxel_A || class_voxel_A->belongsToSubmap(),
+      tsdf_voxel_B, !class_voxel_B || class_voxel_B->belongsToSubmap());
+  if (!class_voxel_A || !class_voxel_B) {
+    return;
+  }
+  if (update == ClassUpdate::kMerge) {
+    class_voxel_B->mergeVoxel(*class_voxel_A);
+  } else if (update == ClassUpdate::kCopy) {
+    // NOTE: Assigning through the interface does not copy the voxel data,
+    // the aligned case copies typed blocks via 'ClassBlock::mergeBlock()'.
+    *class_voxel_B = *class_voxel_A;
+  }
+}
+
+}  // namespace
+
 void LayerManipulator::Config::checkParams() const {
   //  checkParamNE(error_threshold, 0.f, "error_threshold");
 }
@@ -23,7 +104,9 @@ LayerManipulator::LayerManipulator(const Config& config)
 
 void LayerManipulator::applyClassificationLayer(
     TsdfLayer* tsdf_layer, const ClassLayer& class_layer,
-    float truncation_distance) const {
+    float truncation_distance, ThreadPool* thread_pool,
+    SubmapVoxelMasks* voxel_masks,
+    voxblox::BlockIndexList* removed_blocks) const {
   // Check inputs.
   CHECK_NOTNULL(tsdf_layer);
   if (tsdf_layer->voxel_size() != class_layer.voxel_size() ||
@@ -33,125 +116,258 @@ void LayerManipulator::applyClassificationLayer(
     return;
   }
 
-  // Parse the tsdf layer.
+  // Parse the tsdf layer in parallel. Blocks are only removed afterwards since
+  // the layer can not be modified concurrently.
   voxblox::BlockIndexList block_indices;
   tsdf_layer->getAllAllocatedBlocks(&block_indices);
-  for (auto& block_index : block_indices) {
+  sortMortonOrder(&block_indices);
+  std::vector<char> remove_block(block_indices.size(), false);
+  parallelFor(thread_pool, block_indices.size(), [&](size_t index) {
+    const BlockIndex& block_index = block_indices[index];
     TsdfBlock& tsdf_block = tsdf_layer->getBlockByIndex(block_index);
     const ClassBlock::ConstPtr class_block =
         class_layer.getBlockConstPtrByIndex(block_index);
     if (!class_block) {
-      continue;
+      return;
     }
 
-    // Apply the voxel data.
+    // Apply the voxel data. Only observed voxels are visited.
     float min_distance = truncation_distance;
+    VoxelMask updated_voxels(tsdf_block.num_voxels());
     bool was_updated = false;
-    for (size_t i = 0; i < tsdf_block.num_voxels(); ++i) {
+    auto apply_voxel = [&](size_t i) {
       TsdfVoxel& tsdf_voxel = tsdf_block.getVoxelByLinearIndex(i);
       if (tsdf_voxel.weight <= 1.0e-6) {
-        continue;
+        return;
       }
       if (!class_block->getVoxelByLinearIndex(i).belongsToSubmap()) {
         // TODO(schmluk): Could get proper distance by looking up the surface.
         // TODO(schmluk): Could use probability to change the weights?
         tsdf_voxel.distance = truncation_distance;
+        updated_voxels.set(i);
         was_updated = true;
       } else {
         min_distance = std::min(tsdf_voxel.distance, min_distance);
       }
+    };
+    if (voxel_masks) {
+      voxel_masks->forEachObservedVoxel(block_index, tsdf_block, apply_voxel);
+    } else {
+      for (size_t i = 0; i < tsdf_block.num_voxels(); ++i) {
+        apply_voxel(i);
+      }
     }
     if (min_distance == truncation_distance) {
       // This block does not contain useful data anymore.
-      tsdf_layer->removeBlock(block_index);
+      remove_block[index] = true;
     } else if (was_updated) {
       tsdf_block.setUpdatedAll();
+      if (voxel_masks) {
+        voxel_masks->update(block_index, tsdf_block, &updated_voxels);
+      }
+    }
+  });
+  for (size_t i = 0; i < block_indices.size(); ++i) {
+    if (remove_block[i]) {
+      BlockPool<TsdfVoxel>::getGlobalInstance()->removeBlock(block_indices[i],
+                                                             tsdf_layer);
+      if (voxel_masks) {
+        voxel_masks->remove(block_indices[i]);
+      }
+      if (removed_blocks) {
+        removed_blocks->push_back(block_indices[i]);
+      }
     }
   }
 }
 
 void LayerManipulator::mergeSubmapAintoB(const Submap& A, Submap* B) const {
-  // TODO(schmluk): At the moment abuses the fact that all transforms are the
-  //  identity and that equal classes have equal layer layout!
-
+  CHECK_NOTNULL(B);
   if (A.hasClassLayer() != B->hasClassLayer()) {
     LOG(WARNING)
         << "Submap merging currently can only fuse submaps with class layers.";
     return;
   }
   const bool use_class_layer = A.hasClassLayer();
+  const TsdfLayer& layer_A = A.getTsdfLayer();
+  TsdfLayer* layer_B = B->getTsdfLayerPtr().get();
+
+  // If both submaps have the same pose and layout, which is the common case,
+  // voxels are merged directly. Otherwise B is interpolated from A.
+  const Transformation T_A_B = A.getT_S_M() * B->getT_M_S();
+  const bool is_aligned =
+      A.getT_M_S().getTransformationMatrix() ==
+          B->getT_M_S().getTransformationMatrix() &&
+      layer_A.voxel_size() == layer_B->voxel_size() &&
+      layer_A.voxels_per_side() == layer_B->voxels_per_side();
 
-  // Currently just use the voxels...
+  // Allocate all target blocks in B, which can not be done concurrently.
+  voxblox::BlockIndexList block_indices_A;
+  layer_A.getAllAllocatedBlocks(&block_indices_A);
   voxblox::BlockIndexList block_indices;
-  A.getTsdfLayer().getAllAllocatedBlocks(&block_indices);
-  for (const auto& block_index : block_indices) {
-    TsdfBlock::Ptr tsdf_block_B =
-        B->getTsdfLayerPtr()->allocateBlockPtrByIndex(block_index);
-    tsdf_block_B->setUpdatedAll();
-    const TsdfBlock::ConstPtr tsdf_block_A =
-        A.getTsdfLayer().getBlockPtrByIndex(block_index);
-    ClassBlock::ConstPtr class_block_A;
-    ClassBlock::Ptr class_block_B;
+  if (is_aligned) {
+    block_indices = block_indices_A;
+  } else {
+    // Find all blocks of B overlapped by the blocks of A.
+    const Transformation T_B_A = T_A_B.inverse();
+    const FloatingPoint block_size_A = layer_A.block_size();
+    voxblox::IndexSet block_set;
+    for (const BlockIndex& index : block_indices_A) {
+      const Point origin =
+          voxblox::getOriginPointFromGridIndex(index, block_size_A);
+      BlockIndex min_index = BlockIndex::Constant(
+          std::numeric_limits<voxblox::IndexElement>::max());
+      BlockIndex max_index = BlockIndex::Constant(
+          std::numeric_limits<voxblox::IndexElement>::lowest());
+      for (int corner = 0; corner < 8; ++corner) {
+        const Point offset(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+        const BlockIndex corner_index =
+            layer_B->computeBlockIndexFromCoordinates(
+                T_B_A * (origin + offset * block_size_A));
+        min_index = min_index.cwiseMin(corner_index);
+        max_index = max_index.cwiseMax(corner_index);
+      }
+      for (int x = min_index.x(); x <= max_index.x(); ++x) {
+        for (int y = min_index.y(); y <= max_index.y(); ++y) {
+          for (int z = min_index.z(); z <= max_index.z(); ++z) {
+            block_set.insert(BlockIndex(x, y, z));
+          }
+        }
+      }
+    }
+    block_indices.insert(block_indices.end(), block_set.begin(),
+                         block_set.end());
+  }
+  std::vector<TsdfBlock::Ptr> tsdf_blocks_B;
+  std::vector<ClassBlock::Ptr> class_blocks_B;
+  tsdf_blocks_B.reserve(block_indices.size());
+  const bool record_created_blocks = B->hasChangeFeed();
+  for (const BlockIndex& index : block_indices) {
+    if (record_created_blocks && !layer_B->hasBlock(index)) {
+      B->recordCreatedBlock(index);
+    }
+    tsdf_blocks_B.emplace_back(
+        BlockPool<TsdfVoxel>::getGlobalInstance()->allocateBlockPtrByIndex(
+            index, layer_B));
+    tsdf_blocks_B.back()->setUpdatedAll();
+    B->recordChangedBlock(index);
     if (use_class_layer) {
-      class_block_A = A.getClassLayer().getBlockConstPtrByIndex(block_index);
-      class_block_B =
-          B->getClassLayerPtr()->allocateBlockPtrByIndex(block_index);
+      class_blocks_B.emplace_back(
+          B->getClassLayerPtr()->allocateBlockPtrByIndex(index));
     }
+  }
 
-    for (size_t i = 0; i < tsdf_block_B->num_voxels(); ++i) {
-      // Get the voxels and meta data.
-      const TsdfVoxel& tsdf_voxel_A = tsdf_block_A->getVoxelByLinearIndex(i);
-      TsdfVoxel& tsdf_voxel_B = tsdf_block_B->getVoxelByLinearIndex(i);
-      const ClassVoxel* class_voxel_A = nullptr;
-      ClassVoxel* class_voxel_B = nullptr;
-      bool belongs_A = true;
-      if (class_block_A) {
-        class_voxel_A = &class_block_A->getVoxelByLinearIndex(i);
-        belongs_A = class_voxel_A->belongsToSubmap();
-      }
-      bool belongs_B = true;
-      if (class_block_B) {
-        class_voxel_B = &class_block_B->getVoxelByLinearIndex(i);
-        belongs_B = class_voxel_B->belongsToSubmap();
+  // Aligned class layers of the same type are merged block by block, which
+  // checks the voxel type once per block instead of once per voxel.
+  const bool merge_class_blocks =
+      is_aligned && use_class_layer &&
+      A.getClassLayer().getVoxelType() == B->getClassLayer().getVoxelType();
+
+  // Merge all blocks in parallel.
+  const voxblox::Interpolator<TsdfVoxel> interpolator(&layer_A);
+  parallelFor(B->getThreadPool(), block_indices.size(), [&](size_t index) {
+    TsdfBlock& tsdf_block_B = *tsdf_blocks_B[index];
+    ClassBlock* class_block_B =
+        use_class_layer ? class_blocks_B[index].get() : nullptr;
+    const TsdfBlock::ConstPtr tsdf_block_A =
+        is_aligned ? layer_A.getBlockPtrByIndex(block_indices[index]) : nullptr;
+    const ClassBlock::ConstPtr class_block_A =
+        is_aligned && use_class_layer
+            ? A.getClassLayer().getBlockConstPtrByIndex(block_indices[index])
+            : nullptr;
+
+    if (merge_class_blocks && class_block_A && class_block_B) {
+      VoxelMask merge_voxels(tsdf_block_B.num_voxels());
+      VoxelMask copy_voxels(tsdf_block_B.num_voxels());
+      for (size_t i = 0; i < tsdf_block_B.num_voxels(); ++i) {
+        const ClassUpdate update = mergeTsdfVoxelAintoB(
+            tsdf_block_A->getVoxelByLinearIndex(i),
+            class_block_A->getVoxelByLinearIndex(i).belongsToSubmap(),
+            &tsdf_block_B.getVoxelByLinearIndex(i),
+            class_block_B->getVoxelByLinearIndex(i).belongsToSubmap());
+        if (update == ClassUpdate::kMerge) {
+          merge_voxels.set(i);
+        } else if (update == ClassUpdate::kCopy) {
+          copy_voxels.set(i);
+        }
       }
-      if (belongs_A && belongs_B) {
-        voxblox::mergeVoxelAIntoVoxelB(tsdf_voxel_A, &tsdf_voxel_B);
-        if (class_voxel_A && class_voxel_B) {
-          // Voxels that belong to A and B are merged.
-          class_voxel_B->mergeVoxel(*class_voxel_A);
+      class_block_B->mergeBlock(*class_block_A, merge_voxels, copy_voxels);
+      B->getVoxelMasksPtr()->update(block_indices[index], tsdf_block_B);
+      return;
+    }
+
+    // The voxel centers are computed with the constant layout of the block.
+    auto merge_block = [&](const auto& layout) {
+      for (size_t i = 0; i < layout.numVoxels(); ++i) {
+        TsdfVoxel& tsdf_voxel_B = tsdf_block_B.getVoxelByLinearIndex(i);
+        ClassVoxel* class_voxel_B =
+            class_block_B ? &class_block_B->getVoxelByLinearIndex(i) : nullptr;
+        if (is_aligned) {
+          mergeVoxelAintoB(tsdf_block_A->getVoxelByLinearIndex(i),
+                           class_block_A
+                               ? &class_block_A->getVoxelByLinearIndex(i)
+                               : nullptr,
+                           &tsdf_voxel_B, class_voxel_B);
+          continue;
         }
-      } else if (belongs_A) {
-        // If it only belongs to A but not to B overwrite B.
-        tsdf_voxel_B.distance = tsdf_voxel_A.distance;
-        tsdf_voxel_B.weight = tsdf_voxel_A.weight;
-        tsdf_voxel_B.color = tsdf_voxel_A.color;
-        if (class_voxel_A && class_voxel_B) {
-          *class_voxel_B = *class_voxel_A;
+
+        // Interpolate A at the voxel center of B.
+        const Point position_A = T_A_B * layout.voxelCenter(tsdf_block_B, i);
+        TsdfVoxel tsdf_voxel_A;
+        if (!interpolator.getVoxel(position_A, &tsdf_voxel_A, true) &&
+            !interpolator.getVoxel(position_A, &tsdf_voxel_A, false)) {
+          continue;
+        }
+        if (tsdf_voxel_A.weight <= 1.0e-6) {
+          continue;
         }
+        const ClassVoxel* class_voxel_A =
+            use_class_layer
+                ? A.getClassLayer().getVoxelPtrByCoordinates(position_A)
+                : nullptr;
+        mergeVoxelAintoB(tsdf_voxel_A, class_voxel_A, &tsdf_voxel_B,
+                         class_voxel_B);
       }
-      // If it does not belong to A or neither then no action is required.
-    }
-  }
+    };
+    dispatchBlockLayout(tsdf_block_B.voxels_per_side(), merge_block);
+    B->getVoxelMasksPtr()->update(block_indices[index], tsdf_block_B);
+  });
 }
 
-void LayerManipulator::unprojectTsdfLayer(TsdfLayer* tsdf_layer) const {
+void LayerManipulator::unprojectTsdfLayer(
+    TsdfLayer* tsdf_layer, ThreadPool* thread_pool,
+    SubmapVoxelMasks* voxel_masks) const {
   CHECK_NOTNULL(tsdf_layer);
   voxblox::EsdfIntegrator::Config config;
   voxblox::Layer<voxblox::EsdfVoxel> esdf_layer(tsdf_layer->voxel_size(),
                                                 tsdf_layer->voxels_per_side());
   voxblox::EsdfIntegrator integrator(config, tsdf_layer, &esdf_layer);
   integrator.updateFromTsdfLayerBatch();
+
+  // Copy the distances back in parallel. If masks are given only the observed
+  // voxels are copied and their near-surface masks are updated.
   voxblox::BlockIndexList block_indices;
   tsdf_layer->getAllAllocatedBlocks(&block_indices);
-  for (const auto& block_index : block_indices) {
+  parallelFor(thread_pool, block_indices.size(), [&](size_t index) {
+    const BlockIndex& block_index = block_indices[index];
     TsdfBlock& tsdf_block = tsdf_layer->getBlockByIndex(block_index);
     const voxblox::Block<voxblox::EsdfVoxel>& esdf_block =
         esdf_layer.getBlockByIndex(block_index);
-    for (size_t i = 0; i < tsdf_block.num_voxels(); ++i) {
+    if (!voxel_masks) {
+      for (size_t i = 0; i < tsdf_block.num_voxels(); ++i) {
+        tsdf_block.getVoxelByLinearIndex(i).distance =
+            esdf_block.getVoxelByLinearIndex(i).distance;
+      }
+      return;
+    }
+    VoxelMask updated_voxels(tsdf_block.num_voxels());
+    voxel_masks->forEachObservedVoxel(block_index, tsdf_block, [&](size_t i) {
       tsdf_block.getVoxelByLinearIndex(i).distance =
           esdf_block.getVoxelByLinearIndex(i).distance;
-    }
-  }
+      updated_voxels.set(i);
+    });
+    voxel_masks->update(block_index, tsdf_block, &updated_voxels);
+  });
 }
 
 }  // namespace panoptic_mapping
@@ -1,12 +1,22 @@
 #include "panoptic_mapping/map_management/map_manager.h"
 
 #include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <string>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "panoptic_mapping/common/block_layout.h"
+#include "panoptic_mapping/common/morton_order.h"
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/map/block_pool.h"
+
 namespace panoptic_mapping {
 
 config_utilities::Factory::RegistrationRos<MapManagerBase, MapManager>
@@ -16,17 +26,57 @@ void MapManager::Config::checkParams() const {
   checkParamConfig(activity_manager_config);
   checkParamConfig(tsdf_registrator_config);
   checkParamConfig(layer_manipulator_config);
+  checkParamGE(max_pruned_blocks_per_tick, 0, "max_pruned_blocks_per_tick");
+  checkParamGE(max_pruning_time_ms, 0.f, "max_pruning_time_ms");
+  checkParamGE(memory_budget, 0.f, "memory_budget");
+  checkParamGE(min_eviction_age, 0, "min_eviction_age");
+  checkParamGE(collapse_uniform_blocks_frequency, 0,
+               "collapse_uniform_blocks_frequency");
+  checkParamGT(num_finishing_threads, 0, "num_finishing_threads");
+  checkParamGT(revoxelization_surface_voxels, 0,
+               "revoxelization_surface_voxels");
+  checkParamGT(revoxelization_min_voxels_across, 0,
+               "revoxelization_min_voxels_across");
+  checkParamGT(revoxelization_min_voxel_size, 0.f,
+               "revoxelization_min_voxel_size");
+  checkParamGE(revoxelization_max_voxel_size, revoxelization_min_voxel_size,
+               "revoxelization_max_voxel_size");
+  checkParamGE(revoxelization_min_change, 0.f, "revoxelization_min_change");
+  if (memory_budget > 0.f) {
+    checkParamCond(!spill_file_path.empty(),
+                   "'spill_file_path' may not be empty.");
+  }
 }
 
 void MapManager::Config::setupParamsAndPrinting() {
   setupParam("verbosity", &verbosity);
   setupParam("prune_active_blocks_frequency", &prune_active_blocks_frequency);
+  setupParam("max_pruned_blocks_per_tick", &max_pruned_blocks_per_tick);
+  setupParam("max_pruning_time_ms", &max_pruning_time_ms, "ms");
   setupParam("activity_management_frequency", &activity_management_frequency);
   setupParam("change_detection_frequency", &change_detection_frequency);
+  setupParam("collapse_uniform_blocks_frequency",
+             &collapse_uniform_blocks_frequency);
   setupParam("merge_deactivated_submaps_if_possible",
              &merge_deactivated_submaps_if_possible);
   setupParam("apply_class_layer_when_deactivating_submaps",
              &apply_class_layer_when_deactivating_submaps);
+  setupParam("revoxelize_deactivated_submaps",
+             &revoxelize_deactivated_submaps);
+  setupParam("revoxelization_surface_voxels", &revoxelization_surface_voxels);
+  setupParam("revoxelization_min_voxels_across",
+             &revoxelization_min_voxels_across);
+  setupParam("revoxelization_min_voxel_size", &revoxelization_min_voxel_size,
+             "m");
+  setupParam("revoxelization_max_voxel_size", &revoxelization_max_voxel_size,
+             "m");
+  setupParam("revoxelization_min_change", &revoxelization_min_change);
+  setupParam("memory_budget", &memory_budget, "MB");
+  setupParam("min_eviction_age", &min_eviction_age);
+  setupParam("spill_file_path", &spill_file_path);
+  setupParam("use_background_thread", &use_background_thread);
+  setupParam("defer_submap_finishing", &defer_submap_finishing);
+  setupParam("num_finishing_threads", &num_finishing_threads);
   setupParam("activity_manager_config", &activity_manager_config,
              "activity_manager");
   setupParam("tsdf_registrator_config", &tsdf_registrator_config,
@@ -46,11 +96,21 @@ MapManager::MapManager(const Config& config) : config_(config.checkValid()) {
   layer_manipulator_ =
       std::make_shared<LayerManipulator>(config_.layer_manipulator_config);
 
-  // Add all requested tasks.
+  // Add all requested tasks. Activity management itself is cheap and always
+  // performed in the frame loop.
   if (config_.prune_active_blocks_frequency > 0) {
-    tickers_.emplace_back(
-        config_.prune_active_blocks_frequency,
-        [this](SubmapCollection* submaps) { pruneActiveBlocks(submaps); });
+    tickers_.emplace_back(config_.prune_active_blocks_frequency,
+                          [this](SubmapCollection* submaps) {
+                            if (config_.use_background_thread) {
+                              scheduleBackgroundTask(kPruneActiveBlocks);
+                            } else if (config_.max_pruned_blocks_per_tick > 0 ||
+                                       config_.max_pruning_time_ms > 0.f) {
+                              pruneActiveBlocksAmortized(submaps);
+                            } else {
+                              pruneActiveBlocks(submaps);
+                            }
+                          },
+                          true);
   }
   if (config_.activity_management_frequency > 0) {
     tickers_.emplace_back(
@@ -58,17 +118,128 @@ MapManager::MapManager(const Config& config) : config_(config.checkValid()) {
         [this](SubmapCollection* submaps) { manageSubmapActivity(submaps); });
   }
   if (config_.change_detection_frequency > 0) {
+    tickers_.emplace_back(config_.change_detection_frequency,
+                          [this](SubmapCollection* submaps) {
+                            if (config_.use_background_thread) {
+                              scheduleBackgroundTask(kChangeDetection);
+                            } else {
+                              performChangeDetection(submaps);
+                            }
+                          },
+                          true);
+  }
+  if (config_.collapse_uniform_blocks_frequency > 0) {
     tickers_.emplace_back(
-        config_.change_detection_frequency,
-        [this](SubmapCollection* submaps) { performChangeDetection(submaps); });
+        config_.collapse_uniform_blocks_frequency,
+        [this](SubmapCollection* submaps) { collapseUniformBlocks(submaps); },
+        true);
   }
 }
 
 void MapManager::tick(SubmapCollection* submaps) {
+  access_time_ = Submap::tickAccessClock();
+
+  // Apply the results of finished background tasks at the frame boundary.
+  if (background_tasks_.valid()) {
+    if (background_tasks_.wait_for(std::chrono::seconds(0)) ==
+        std::future_status::ready) {
+      applyBackgroundResult(submaps, background_tasks_.get());
+    } else {
+      background_ticks_++;
+    }
+  }
+  if (config_.defer_submap_finishing) {
+    adoptFinishedSubmaps(submaps, false);
+  }
+
   // Increment counts for all tickers, which execute the requested actions.
+  const unsigned int interval_factor =
+      quality_controller_
+          ? quality_controller_->getMapManagementIntervalFactor()
+          : 1u;
   for (Ticker& ticker : tickers_) {
-    ticker.tick(submaps);
+    ticker.tick(submaps, interval_factor);
+  }
+
+  if (config_.use_background_thread) {
+    processBackgroundTasks(submaps);
+  }
+  if (config_.defer_submap_finishing) {
+    startFinishingSubmaps(submaps);
+  }
+
+  // Release TSDF layers of inactive submaps that were decompressed on access.
+  for (Submap& submap : *submaps) {
+    if (!submap.isActive() && !submap.isFinishing() &&
+        submap.getConfig().tsdf_compression.compress_inactive) {
+      submap.compressTsdfLayer();
+    }
   }
+
+  if (config_.memory_budget > 0.f) {
+    enforceMemoryBudget(submaps);
+  }
+
+  // Blocks may have been removed or released, invalidate cached lookups.
+  submaps->incrementGeneration();
+}
+
+void MapManager::collapseUniformBlocks(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  Timer timer("map_management/collapse_uniform_blocks");
+  size_t num_collapsed = 0;
+  for (Submap& submap : *submaps) {
+    if (!submap.isFinishing()) {
+      num_collapsed += submap.collapseUniformBlocks();
+    }
+  }
+  LOG_IF(INFO, config_.verbosity >= 3 && num_collapsed > 0)
+      << "Collapsed " << num_collapsed << " uniform blocks.";
+}
+
+void MapManager::enforceMemoryBudget(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  Timer timer("map_management/enforce_memory_budget");
+
+  // Find the resident memory and all submaps that could be evicted.
+  size_t total_memory = 0;
+  std::vector<std::pair<uint64_t, Submap*>> candidates;
+  for (Submap& submap : *submaps) {
+    total_memory += submap.getMemorySize();
+    if (!submap.isActive() && !submap.isFinishing() && !submap.isEvicted() &&
+        submap.getLabel() != PanopticLabel::kFreeSpace &&
+        submap.getLastAccess() + config_.min_eviction_age <= access_time_) {
+      candidates.emplace_back(submap.getLastAccess(), &submap);
+    }
+  }
+  const size_t budget = static_cast<size_t>(config_.memory_budget * 1e6);
+  if (total_memory <= budget || candidates.empty()) {
+    return;
+  }
+
+  // Evict the least recently used submaps until the budget is met.
+  if (!spill_file_) {
+    spill_file_ = std::make_shared<SubmapSpillFile>(config_.spill_file_path);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const auto& lhs, const auto& rhs) {
+              return lhs.first < rhs.first;
+            });
+  int num_evicted = 0;
+  for (const auto& access_submap : candidates) {
+    if (total_memory <= budget) {
+      break;
+    }
+    Submap* submap = access_submap.second;
+    const size_t submap_memory = submap->getMemorySize();
+    if (submap->evictLayers(spill_file_)) {
+      total_memory -= submap_memory - submap->getMemorySize();
+      num_evicted++;
+    }
+  }
+  LOG_IF(INFO, config_.verbosity >= 3 && num_evicted > 0)
+      << "Evicted " << num_evicted << " submaps to meet the memory budget, "
+      << total_memory / 1e6 << "MB remain in memory.";
 }
 
 void MapManager::pruneActiveBlocks(SubmapCollection* submaps) {
@@ -93,9 +264,7 @@ void MapManager::pruneActiveBlocks(SubmapCollection* submaps) {
   }
 
   // Remove submaps.
-  for (int id : submaps_to_remove) {
-    submaps->removeSubmap(id);
-  }
+  submaps->removeSubmaps(submaps_to_remove);
   auto t2 = std::chrono::high_resolution_clock::now();
   timer.Stop();
   LOG_IF(INFO, config_.verbosity >= 2)
@@ -104,8 +273,92 @@ void MapManager::pruneActiveBlocks(SubmapCollection* submaps) {
       << "ms." << info.str();
 }
 
+void MapManager::pruneActiveBlocksAmortized(SubmapCollection* submaps) {
+  // Check blocks of the active submaps in round-robin order until the budget
+  // is used up, continuing where the previous call stopped.
+  CHECK_NOTNULL(submaps);
+  Timer timer("map_management/prune_active_blocks_amortized");
+  const auto t_start = std::chrono::steady_clock::now();
+  int num_checked = 0;
+  int num_pruned = 0;
+  bool started_pass = false;
+  while (
+      (config_.max_pruned_blocks_per_tick <= 0 ||
+       num_checked < config_.max_pruned_blocks_per_tick) &&
+      (config_.max_pruning_time_ms <= 0.f ||
+       std::chrono::duration<float, std::milli>(
+           std::chrono::steady_clock::now() - t_start)
+               .count() < config_.max_pruning_time_ms)) {
+    // Continue with the current submap.
+    Submap* submap = submaps->submapIdExists(pruning_submap_id_)
+                         ? submaps->getSubmapPtr(pruning_submap_id_)
+                         : nullptr;
+    if (submap && !submap->isActive()) {
+      submap = nullptr;
+    }
+    if (submap && next_pruning_block_ < pruning_blocks_.size()) {
+      if (pruneBlock(submap, pruning_blocks_[next_pruning_block_])) {
+        num_pruned++;
+      }
+      next_pruning_block_++;
+      num_checked++;
+      continue;
+    }
+
+    // If a finished submap does not contain data anymore it can be removed.
+    if (submap && submap->getTsdfLayer().getNumberOfAllocatedBlocks() == 0) {
+      submaps->removeSubmap(pruning_submap_id_);
+      LOG_IF(INFO, config_.verbosity >= 4)
+          << "Removed submap " << pruning_submap_id_ << " which was empty.";
+    }
+    pruning_blocks_.clear();
+    next_pruning_block_ = 0;
+
+    // Get the next submap, starting a new pass once all were processed. Each
+    // call performs at most one new pass.
+    if (pruning_queue_.empty()) {
+      if (started_pass) {
+        break;
+      }
+      started_pass = true;
+      for (const Submap& candidate : *submaps) {
+        if (candidate.getLabel() != PanopticLabel::kFreeSpace &&
+            candidate.isActive()) {
+          pruning_queue_.push_back(candidate.getID());
+        }
+      }
+      if (pruning_queue_.empty()) {
+        pruning_submap_id_ = -1;
+        break;
+      }
+    }
+    pruning_submap_id_ = pruning_queue_.front();
+    pruning_queue_.pop_front();
+    if (submaps->submapIdExists(pruning_submap_id_)) {
+      submaps->getSubmap(pruning_submap_id_)
+          .getTsdfLayer()
+          .getAllAllocatedBlocks(&pruning_blocks_);
+      sortMortonOrder(&pruning_blocks_);
+    }
+  }
+  LOG_IF(INFO, config_.verbosity >= 4 && num_pruned > 0)
+      << "Pruned " << num_pruned << " of " << num_checked
+      << " checked active blocks.";
+}
+
 void MapManager::manageSubmapActivity(SubmapCollection* submaps) {
   CHECK_NOTNULL(submaps);
+
+  // Deactivated submaps are finished and post-processed in the background.
+  if (config_.defer_submap_finishing) {
+    std::vector<int> deactivated_submaps;
+    activity_manager_->processSubmaps(submaps, &deactivated_submaps);
+    finishing_queue_.insert(finishing_queue_.end(),
+                            deactivated_submaps.begin(),
+                            deactivated_submaps.end());
+    return;
+  }
+
   std::unordered_set<int> active_submaps;
   if (config_.merge_deactivated_submaps_if_possible) {
     // Track de-activated submaps if requested.
@@ -121,12 +374,13 @@ void MapManager::manageSubmapActivity(SubmapCollection* submaps) {
 
   // Process de-activated submaps if requested.
   if (config_.merge_deactivated_submaps_if_possible ||
-      config_.apply_class_layer_when_deactivating_submaps) {
-    std::unordered_set<int> deactivated_submaps;
+      config_.apply_class_layer_when_deactivating_submaps ||
+      config_.revoxelize_deactivated_submaps) {
+    std::vector<int> deactivated_submaps;
     for (Submap& submap : *submaps) {
       if (!submap.isActive() &&
           active_submaps.find(submap.getID()) != active_submaps.end()) {
-        deactivated_submaps.insert(submap.getID());
+        deactivated_submaps.push_back(submap.getID());
       }
     }
 
@@ -138,21 +392,116 @@ void MapManager::manageSubmapActivity(SubmapCollection* submaps) {
       }
     }
 
-    // Try to merge the submaps.
-    if (config_.merge_deactivated_submaps_if_possible) {
+    // The submaps were finished when deactivated, so re-voxelized submaps
+    // are finished again.
+    if (config_.revoxelize_deactivated_submaps) {
       for (int id : deactivated_submaps) {
-        int merged_id;
-        int current_id = id;
-        while (mergeSubmapIfPossible(submaps, current_id, &merged_id)) {
-          current_id = merged_id;
-        }
-        if (current_id == id) {
-          LOG_IF(INFO, config_.verbosity >= 4)
-              << "Submap " << id << " was deactivated, could not be matched."
-              << std::endl;
+        Submap* submap = submaps->getSubmapPtr(id);
+        if (revoxelizeSubmap(submap)) {
+          submap->finishDeactivation();
         }
       }
     }
+
+    // Try to merge the submaps.
+    if (config_.merge_deactivated_submaps_if_possible) {
+      mergeDeactivatedSubmaps(submaps, deactivated_submaps);
+    }
+  }
+}
+
+void MapManager::mergeDeactivatedSubmaps(SubmapCollection* submaps,
+                                         const std::vector<int>& submap_ids) {
+  if (config_.use_background_thread) {
+    // Search for merge candidates in the background.
+    merge_candidates_.insert(merge_candidates_.end(), submap_ids.begin(),
+                             submap_ids.end());
+    if (!submap_ids.empty()) {
+      scheduleBackgroundTask(kMergeDeactivatedSubmaps);
+    }
+    return;
+  }
+  for (int id : submap_ids) {
+    int merged_id;
+    int current_id = id;
+    while (mergeSubmapIfPossible(submaps, current_id, &merged_id)) {
+      current_id = merged_id;
+    }
+    if (current_id == id) {
+      LOG_IF(INFO, config_.verbosity >= 4)
+          << "Submap " << id << " was deactivated, could not be matched."
+          << std::endl;
+    }
+  }
+}
+
+void MapManager::startFinishingSubmaps(SubmapCollection* submaps) {
+  while (!finishing_queue_.empty() &&
+         finishing_submaps_.size() <
+             static_cast<size_t>(config_.num_finishing_threads)) {
+    const int id = finishing_queue_.front();
+    finishing_queue_.pop_front();
+    if (!submaps->submapIdExists(id) ||
+        !submaps->getSubmap(id).isFinishing()) {
+      continue;
+    }
+
+    // The clone is finished on its own, the submap remains usable meanwhile.
+    std::unique_ptr<Submap> clone = submaps->getSubmap(id).clone(
+        &finishing_submap_id_manager_, &finishing_instance_id_manager_);
+    FinishingSubmap& finishing = finishing_submaps_.emplace_back();
+    finishing.submap_id = id;
+    finishing.finished = std::async(
+        std::launch::async, [this, submap = std::move(clone)]() mutable {
+          Timer timer("map_management/finish_submap");
+          if (config_.apply_class_layer_when_deactivating_submaps) {
+            // The submap is updated once when finishing.
+            submap->applyClassLayer(*layer_manipulator_, true, false);
+          }
+          revoxelizeSubmap(submap.get());
+          submap->finishDeactivation();
+          return std::move(submap);
+        });
+  }
+}
+
+void MapManager::adoptFinishedSubmaps(SubmapCollection* submaps, bool wait) {
+  std::vector<int> finished_submaps;
+  for (auto it = finishing_submaps_.begin(); it != finishing_submaps_.end();) {
+    if (!wait && it->finished.wait_for(std::chrono::seconds(0)) !=
+                     std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    std::unique_ptr<Submap> finished = it->finished.get();
+    const int id = it->submap_id;
+    it = finishing_submaps_.erase(it);
+    if (!submaps->submapIdExists(id)) {
+      continue;
+    }
+    Submap* submap = submaps->getSubmapPtr(id);
+    if (!submap->isFinishing()) {
+      continue;
+    }
+    submap->adoptFinishedClone(finished.get());
+    finished_submaps.push_back(id);
+  }
+  if (finished_submaps.empty()) {
+    return;
+  }
+  LOG_IF(INFO, config_.verbosity >= 4)
+      << "Finished " << finished_submaps.size() << " deactivated submaps, "
+      << finishing_submaps_.size() + finishing_queue_.size()
+      << " are remaining.";
+  if (config_.merge_deactivated_submaps_if_possible) {
+    mergeDeactivatedSubmaps(submaps, finished_submaps);
+  }
+}
+
+void MapManager::waitForFinishingSubmaps(SubmapCollection* submaps) {
+  while (!finishing_queue_.empty() || !finishing_submaps_.empty()) {
+    startFinishingSubmaps(submaps);
+    adoptFinishedSubmaps(submaps, true);
   }
 }
 
@@ -161,20 +510,48 @@ void MapManager::performChangeDetection(SubmapCollection* submaps) {
 }
 
 void MapManager::finishMapping(SubmapCollection* submaps) {
+  // Complete all background tasks, all deferred tasks are covered below.
+  waitForFinishingSubmaps(submaps);
+  waitForBackgroundTasks(submaps);
+  due_tasks_ = 0;
+  merge_candidates_.clear();
+  Timer timer("map_management/finish_mapping");
+
   // Remove all empty blocks.
+  std::vector<Submap*> all_submaps;
+  for (Submap& submap : *submaps) {
+    all_submaps.push_back(&submap);
+  }
+  std::vector<std::string> pruning_info(all_submaps.size());
+  processSubmapsInParallel(all_submaps, submaps->getThreadPool(),
+                           "Pruning blocks",
+                           [this, &pruning_info](size_t i, Submap* submap) {
+                             pruning_info[i] = pruneBlocks(submap);
+                           });
   std::stringstream info;
   info << "Finished mapping: ";
-  for (Submap& submap : *submaps) {
-    info << pruneBlocks(&submap);
+  for (const std::string& submap_info : pruning_info) {
+    info << submap_info;
   }
   LOG_IF(INFO, config_.verbosity >= 3) << info.str();
 
   // Deactivate last submaps.
+  std::vector<Submap*> active_submaps;
   for (Submap& submap : *submaps) {
     if (submap.isActive()) {
       LOG_IF(INFO, config_.verbosity >= 3)
           << "Deactivating submap " << submap.getID();
-      submap.finishActivePeriod();
+      active_submaps.push_back(&submap);
+    }
+  }
+  processSubmapsInParallel(
+      active_submaps, submaps->getThreadPool(), "Deactivating submaps",
+      [](size_t, Submap* submap) { submap->finishActivePeriod(); });
+  if (config_.revoxelize_deactivated_submaps) {
+    for (Submap* submap : active_submaps) {
+      if (revoxelizeSubmap(submap)) {
+        submap->finishDeactivation();
+      }
     }
   }
   LOG_IF(INFO, config_.verbosity >= 3) << "Merging Submaps:";
@@ -193,22 +570,148 @@ void MapManager::finishMapping(SubmapCollection* submaps) {
   // Finish submaps.
   if (config_.apply_class_layer_when_deactivating_submaps) {
     LOG_IF(INFO, config_.verbosity >= 3) << "Applying class layers:";
-    std::vector<int> empty_submaps;
+    std::vector<Submap*> class_submaps;
     for (Submap& submap : *submaps) {
       if (submap.hasClassLayer()) {
-        if (!submap.applyClassLayer(*layer_manipulator_)) {
-          empty_submaps.emplace_back(submap.getID());
-        }
+        class_submaps.push_back(&submap);
+      }
+    }
+    std::vector<char> is_empty(class_submaps.size(), false);
+    processSubmapsInParallel(
+        class_submaps, submaps->getThreadPool(), "Applying class layers",
+        [this, &is_empty](size_t i, Submap* submap) {
+          is_empty[i] = !submap->applyClassLayer(*layer_manipulator_, true,
+                                                 false);
+        });
+    std::vector<int> empty_submaps;
+    std::vector<Submap*> updated_submaps;
+    for (size_t i = 0; i < class_submaps.size(); ++i) {
+      if (is_empty[i]) {
+        empty_submaps.emplace_back(class_submaps[i]->getID());
+      } else {
+        updated_submaps.emplace_back(class_submaps[i]);
       }
     }
+    submaps->removeSubmaps(empty_submaps);
     for (const int id : empty_submaps) {
-      submaps->removeSubmap(id);
       LOG_IF(INFO, config_.verbosity >= 3)
           << "Removed submap " << id << " which was empty.";
     }
+
+    // Update the remaining submaps, meshing them jointly.
+    for (Submap* submap : updated_submaps) {
+      submap->updateBoundingVolume();
+    }
+    SubmapCollection::updateMeshes(updated_submaps, submaps->getThreadPool());
+    processSubmapsInParallel(
+        updated_submaps, submaps->getThreadPool(),
+        "Computing iso-surface points",
+        [](size_t, Submap* submap) { submap->computeIsoSurfacePoints(); });
   }
 }
 
+void MapManager::processSubmapsInParallel(
+    const std::vector<Submap*>& submaps, ThreadPool* thread_pool,
+    const std::string& name,
+    const std::function<void(size_t, Submap*)>& function) const {
+  CHECK_NOTNULL(thread_pool);
+  if (submaps.empty()) {
+    return;
+  }
+  const auto t_start = std::chrono::steady_clock::now();
+  std::vector<std::future<void>> threads;
+  threads.reserve(submaps.size());
+  for (size_t i = 0; i < submaps.size(); ++i) {
+    threads.emplace_back(
+        thread_pool->submitOnNode(submaps[i]->getHomeNode(),
+                                  [&function, &submaps, i]() {
+                                    function(i, submaps[i]);
+                                  }));
+  }
+
+  // Report the progress in steps of 10 percent.
+  constexpr size_t kNumReports = 10;
+  size_t next_report = 1;
+  for (size_t i = 0; i < threads.size(); ++i) {
+    thread_pool->wait(&threads[i]);
+    const size_t num_done = i + 1;
+    if (config_.verbosity < 2 ||
+        num_done * kNumReports < next_report * threads.size()) {
+      continue;
+    }
+    while (next_report * threads.size() <= num_done * kNumReports) {
+      next_report++;
+    }
+    LOG(INFO) << name << ": " << num_done << "/" << threads.size()
+              << " submaps ("
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - t_start)
+                     .count()
+              << "ms).";
+  }
+}
+
+float MapManager::computeRevoxelizationVoxelSize(const Submap& submap) const {
+  // Estimate the observed surface area and extent from the voxels within half
+  // a voxel of the surface.
+  const TsdfLayer& layer = submap.getTsdfLayer();
+  const float voxel_size = layer.voxel_size();
+  voxblox::BlockIndexList block_indices;
+  layer.getAllAllocatedBlocks(&block_indices);
+  size_t num_surface_voxels = 0;
+  Point min_S = Point::Constant(std::numeric_limits<float>::max());
+  Point max_S = Point::Constant(std::numeric_limits<float>::lowest());
+  for (const BlockIndex& index : block_indices) {
+    const TsdfBlock& block = layer.getBlockByIndex(index);
+    dispatchBlockLayout(block.voxels_per_side(), [&](const auto& layout) {
+      for (size_t i = 0; i < layout.numVoxels(); ++i) {
+        const TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+        if (voxel.weight > 1e-6f &&
+            std::abs(voxel.distance) <= 0.5f * voxel_size) {
+          const Point center = layout.voxelCenter(block, i);
+          min_S = min_S.cwiseMin(center);
+          max_S = max_S.cwiseMax(center);
+          ++num_surface_voxels;
+        }
+      }
+    });
+  }
+  if (num_surface_voxels == 0) {
+    return voxel_size;
+  }
+
+  // Bound the number of surface voxels, but resolve the extent finely enough.
+  const float surface_area = num_surface_voxels * voxel_size * voxel_size;
+  const float extent = (max_S - min_S).maxCoeff() + voxel_size;
+  float result = std::min(
+      std::sqrt(surface_area / config_.revoxelization_surface_voxels),
+      extent / config_.revoxelization_min_voxels_across);
+  result = std::clamp(result, config_.revoxelization_min_voxel_size,
+                      config_.revoxelization_max_voxel_size);
+  if (std::abs(result - voxel_size) <=
+      config_.revoxelization_min_change * voxel_size) {
+    return voxel_size;
+  }
+  return result;
+}
+
+bool MapManager::revoxelizeSubmap(Submap* submap) const {
+  CHECK_NOTNULL(submap);
+  if (!config_.revoxelize_deactivated_submaps ||
+      submap->getLabel() != PanopticLabel::kInstance) {
+    return false;
+  }
+  const float previous_voxel_size = submap->getConfig().voxel_size;
+  const float voxel_size = computeRevoxelizationVoxelSize(*submap);
+  if (!submap->revoxelize(*layer_manipulator_, voxel_size, false)) {
+    return false;
+  }
+  LOG_IF(INFO, config_.verbosity >= 4)
+      << "Re-voxelized submap " << submap->getID() << " from "
+      << previous_voxel_size << " to " << voxel_size << " m voxels.";
+  return true;
+}
+
 bool MapManager::mergeSubmapIfPossible(SubmapCollection* submaps, int submap_id,
                                        int* merged_id) {
   // Use on inactive submaps, checks for possible matches with other inactive
@@ -222,92 +725,381 @@ bool MapManager::mergeSubmapIfPossible(SubmapCollection* submaps, int submap_id,
   if (submap->isActive()) {
     // Active submaps need first to be de-activated.
     submap->finishActivePeriod();
-  } else if (submap->getChangeState() == ChangeState::kAbsent) {
+  } else if (submap->isFinishing() ||
+             submap->getChangeState() == ChangeState::kAbsent) {
+    return false;
+  }
+
+  // Merge the submap into the first match if there is one.
+  const int target_id = findMergeTarget(*submaps, *submap);
+  if (target_id < 0) {
     return false;
   }
+  mergeSubmaps(submaps, submap_id, target_id);
+  if (merged_id) {
+    *merged_id = target_id;
+  }
+  return true;
+}
 
+int MapManager::findMergeTarget(const SubmapCollection& submaps,
+                                const Submap& submap) const {
   // Find all potential matches.
-  for (Submap& other : *submaps) {
-    if (other.isActive() || other.getClassID() != submap->getClassID() ||
-        other.getID() == submap->getID() ||
-        !submap->getBoundingVolume().intersects(other.getBoundingVolume())) {
+  for (const Submap& other : submaps) {
+    if (other.isActive() || other.isFinishing() ||
+        other.getClassID() != submap.getClassID() ||
+        other.getID() == submap.getID() ||
+        !submap.getBoundingVolume().intersects(other.getBoundingVolume())) {
       continue;
     }
 
     bool submaps_match;
-    if (!tsdf_registrator_->submapsConflict(*submap, other, &submaps_match)) {
-      if (submaps_match) {
-        // It's a match, merge the submap into the candidate.
-
-        // Make sure both maps have or don't have class layers.
-        if (!(submap->hasClassLayer() && other.hasClassLayer())) {
-          submap->applyClassLayer(*layer_manipulator_);
-          other.applyClassLayer(*layer_manipulator_);
-        }
-        layer_manipulator_->mergeSubmapAintoB(*submap, &other);
-        LOG_IF(INFO, config_.verbosity >= 4)
-            << "Merged Submap " << submap->getID() << " into " << other.getID()
-            << ".";
-        other.setChangeState(ChangeState::kPersistent);
-        submaps->removeSubmap(submap_id);
-        if (merged_id) {
-          *merged_id = other.getID();
+    if (!tsdf_registrator_->submapsConflict(submap, other, &submaps_match) &&
+        submaps_match) {
+      return other.getID();
+    }
+  }
+  return -1;
+}
+
+void MapManager::mergeSubmaps(SubmapCollection* submaps, int submap_id,
+                              int target_id) {
+  // It's a match, merge the submap into the candidate.
+  Submap* submap = submaps->getSubmapPtr(submap_id);
+  Submap* other = submaps->getSubmapPtr(target_id);
+
+  // Make sure both maps have or don't have class layers.
+  if (!(submap->hasClassLayer() && other->hasClassLayer())) {
+    submap->applyClassLayer(*layer_manipulator_);
+    other->applyClassLayer(*layer_manipulator_);
+  }
+  layer_manipulator_->mergeSubmapAintoB(*submap, other);
+  LOG_IF(INFO, config_.verbosity >= 4)
+      << "Merged Submap " << submap_id << " into " << target_id << ".";
+  other->setChangeState(ChangeState::kPersistent);
+  submaps->removeSubmap(submap_id);
+}
+
+size_t MapManager::mergeSubmapCollection(const SubmapCollection& other,
+                                         SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  Timer timer("map_management/merge_submap_collection");
+  // Merging modifies the submaps, so no other work may be running on them.
+  waitForBackgroundTasks(submaps);
+  waitForFinishingSubmaps(submaps);
+
+  // Find the candidates of every submap of other via the spatial index.
+  std::vector<const Submap*> sources;
+  std::vector<std::vector<Submap*>> candidates;
+  const Submap* other_freespace = nullptr;
+  for (const Submap& source : other) {
+    if (source.getLabel() == PanopticLabel::kFreeSpace) {
+      other_freespace = &source;
+      continue;
+    }
+    sources.push_back(&source);
+    candidates.emplace_back();
+    const SubmapBoundingVolume& volume = source.getBoundingVolume();
+    for (const int id : submaps->findSubmapsIntersecting(
+             source.getT_M_S() * volume.getCenter(), volume.getRadius())) {
+      Submap* target = submaps->getSubmapPtr(id);
+      if (target->isActive() || target->isFinishing() ||
+          target->getLabel() == PanopticLabel::kFreeSpace ||
+          target->getClassID() != source.getClassID() ||
+          target->hasClassLayer() != source.hasClassLayer() ||
+          !volume.intersects(target->getBoundingVolume())) {
+        continue;
+      }
+      candidates.back().push_back(target);
+    }
+  }
+
+  // Verify the candidates in parallel, the first match is merged into.
+  std::vector<Submap*> matches(sources.size(), nullptr);
+  ThreadPool* thread_pool = submaps->getThreadPool();
+  std::vector<std::future<void>> threads;
+  threads.reserve(sources.size());
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (candidates[i].empty()) {
+      continue;
+    }
+    threads.emplace_back(thread_pool->submit([&, i]() {
+      for (Submap* target : candidates[i]) {
+        bool submaps_match;
+        if (!tsdf_registrator_->submapsConflict(*sources[i], *target,
+                                                &submaps_match) &&
+            submaps_match) {
+          matches[i] = target;
+          return;
         }
-        return true;
       }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread_pool->wait(&thread);
+  }
+
+  // Fuse the matches and add all other submaps.
+  std::unordered_set<Submap*> updated_submaps;
+  size_t num_merged = 0;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    const Submap& source = *sources[i];
+    Submap* target = matches[i];
+    if (target) {
+      target->setChangeState(ChangeState::kPersistent);
+      num_merged++;
+    } else {
+      target = submaps->createSubmap(source.getSharedConfig());
+      target->setT_M_S(source.getT_M_S());
+      target->setClassID(source.getClassID());
+      target->setLabel(source.getLabel());
+      target->setName(source.getName());
+      target->setFrameName(source.getFrameName());
+      target->setChangeState(source.getChangeState());
+      target->setIsActive(false);
     }
+    layer_manipulator_->mergeSubmapAintoB(source, target);
+    updated_submaps.insert(target);
+  }
+  if (other_freespace &&
+      submaps->submapIdExists(submaps->getActiveFreeSpaceSubmapID())) {
+    Submap* freespace =
+        submaps->getSubmapPtr(submaps->getActiveFreeSpaceSubmapID());
+    layer_manipulator_->mergeSubmapAintoB(*other_freespace, freespace);
+    updated_submaps.insert(freespace);
   }
-  return false;
+
+  // Recompute the derived data of all changed submaps.
+  processSubmapsInParallel(
+      {updated_submaps.begin(), updated_submaps.end()},
+      submaps->getThreadPool(), "Updating merged submaps",
+      [](size_t, Submap* submap) { submap->updateEverything(false); });
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Merged " << num_merged << " of " << sources.size()
+      << " submaps into the map, added " << (sources.size() - num_merged)
+      << " new submaps.";
+  return num_merged;
 }
 
-std::string MapManager::pruneBlocks(Submap* submap) const {
-  auto t1 = std::chrono::high_resolution_clock::now();
-  // Setup.
-  ClassLayer* class_layer = nullptr;
-  if (submap->hasClassLayer()) {
-    class_layer = submap->getClassLayerPtr().get();
+void MapManager::setThreadSafeSubmapCollection(
+    std::shared_ptr<ThreadSafeSubmapCollection> submaps) {
+  // Results of running tasks refer to the previous collection.
+  discardBackgroundTasks();
+  thread_safe_submaps_ = std::move(submaps);
+}
+
+void MapManager::setQualityController(
+    std::shared_ptr<const QualityController> quality_controller) {
+  quality_controller_ = std::move(quality_controller);
+}
+
+void MapManager::scheduleBackgroundTask(BackgroundTask task) {
+  if (background_tasks_.valid()) {
+    num_deferred_tasks_++;
   }
-  TsdfLayer* tsdf_layer = submap->getTsdfLayerPtr().get();
-  MeshLayer* mesh_layer = submap->getMeshLayerPtr().get();
-  const int voxel_indices = std::pow(submap->getConfig().voxels_per_side, 3);
-  int count = 0;
+  due_tasks_ |= task;
+}
 
-  // Remove all blocks that don't have any belonging voxels.
-  voxblox::BlockIndexList block_indices;
-  tsdf_layer->getAllAllocatedBlocks(&block_indices);
-  for (const auto& block_index : block_indices) {
-    ClassBlock::Ptr class_block;
-    if (class_layer) {
-      if (class_layer->hasBlock(block_index)) {
-        class_block = class_layer->getBlockPtrByIndex(block_index);
-      }
+void MapManager::processBackgroundTasks(SubmapCollection* submaps) {
+  if (due_tasks_ == 0 || background_tasks_.valid()) {
+    return;
+  }
+  Timer timer("map_management/start_background_tasks");
+
+  // Take a snapshot of the map, through the thread-safe collection if set
+  // since snapshots track their changes relative to the previous one.
+  std::shared_ptr<const SubmapCollection> snapshot;
+  if (thread_safe_submaps_) {
+    snapshot = thread_safe_submaps_->update();
+  } else {
+    snapshot_ = submaps->snapshot(snapshot_.get());
+    snapshot = snapshot_;
+  }
+
+  // The changes since the last change detection are taken from the map.
+  std::unordered_map<int, voxblox::IndexSet> changed_blocks;
+  if ((due_tasks_ & kChangeDetection) &&
+      config_.tsdf_registrator_config.use_incremental_change_detection) {
+    for (Submap& submap : *submaps) {
+      changed_blocks[submap.getID()] = submap.takeChangedBlocks();
     }
-    const TsdfBlock& tsdf_block = tsdf_layer->getBlockByIndex(block_index);
-    bool has_beloning_voxels = false;
-
-    // Check all voxels.
-    for (int voxel_index = 0; voxel_index < voxel_indices; ++voxel_index) {
-      if (tsdf_block.getVoxelByLinearIndex(voxel_index).weight >= 1e-6) {
-        if (class_block) {
-          if (class_block->getVoxelByLinearIndex(voxel_index)
-                  .belongsToSubmap()) {
-            has_beloning_voxels = true;
-            break;
-          }
-        } else {
-          has_beloning_voxels = true;
-          break;
+  }
+  background_tasks_ = std::async(
+      std::launch::async,
+      [this, snapshot, tasks = due_tasks_,
+       changed_blocks = std::move(changed_blocks),
+       merge_candidates = std::move(merge_candidates_)]() {
+        return runBackgroundTasks(*snapshot, tasks, changed_blocks,
+                                  merge_candidates);
+      });
+  due_tasks_ = 0;
+  merge_candidates_.clear();
+  background_ticks_ = 0;
+}
+
+MapManager::BackgroundResult MapManager::runBackgroundTasks(
+    const SubmapCollection& submaps, unsigned int tasks,
+    const std::unordered_map<int, voxblox::IndexSet>& changed_blocks,
+    const std::vector<int>& merge_candidates) const {
+  BackgroundResult result;
+  auto t_start = std::chrono::steady_clock::now();
+  auto record_time = [&result, &t_start](const std::string& name) {
+    const auto t_end = std::chrono::steady_clock::now();
+    result.task_times.emplace_back(
+        name,
+        std::chrono::duration<double, std::milli>(t_end - t_start).count());
+    t_start = t_end;
+  };
+
+  // Find the empty blocks of all active submaps.
+  if (tasks & kPruneActiveBlocks) {
+    for (const Submap& submap : submaps) {
+      if (submap.getLabel() == PanopticLabel::kFreeSpace ||
+          !submap.isActive()) {
+        continue;
+      }
+      voxblox::BlockIndexList block_indices;
+      submap.getTsdfLayer().getAllAllocatedBlocks(&block_indices);
+      for (const BlockIndex& index : block_indices) {
+        if (!hasBelongingVoxels(submap, index)) {
+          result.prunable_blocks[submap.getID()].push_back(index);
         }
       }
     }
+    record_time("prune_active_blocks");
+  }
 
-    // Prune blocks.
-    if (!has_beloning_voxels) {
-      if (class_layer) {
-        class_layer->removeBlock(block_index);
+  // Change detection.
+  if (tasks & kChangeDetection) {
+    tsdf_registrator_->detectChanges(submaps, changed_blocks,
+                                     &result.change_states);
+    record_time("change_detection");
+  }
+
+  // Find the merge targets of deactivated submaps.
+  if (tasks & kMergeDeactivatedSubmaps) {
+    for (const int id : merge_candidates) {
+      if (!submaps.submapIdExists(id)) {
+        continue;
+      }
+      const Submap& submap = submaps.getSubmap(id);
+      if (submap.isActive() || submap.isFinishing() ||
+          submap.getChangeState() == ChangeState::kAbsent) {
+        continue;
+      }
+      const int target_id = findMergeTarget(submaps, submap);
+      if (target_id >= 0) {
+        result.merges.emplace_back(id, target_id);
       }
-      tsdf_layer->removeBlock(block_index);
-      mesh_layer->removeMesh(block_index);
+    }
+    record_time("merge_deactivated_submaps");
+  }
+  return result;
+}
+
+void MapManager::applyBackgroundResult(SubmapCollection* submaps,
+                                       const BackgroundResult& result) {
+  Timer timer("map_management/apply_background_tasks");
+  std::stringstream info;
+
+  // Prune the blocks that are still empty.
+  std::vector<int> submaps_to_remove;
+  for (const auto& id_blocks_pair : result.prunable_blocks) {
+    if (!submaps->submapIdExists(id_blocks_pair.first)) {
+      continue;
+    }
+    Submap* submap = submaps->getSubmapPtr(id_blocks_pair.first);
+    if (!submap->isActive()) {
+      continue;
+    }
+    info << pruneBlocks(submap, &id_blocks_pair.second);
+    if (submap->getTsdfLayer().getNumberOfAllocatedBlocks() == 0) {
+      submaps_to_remove.emplace_back(submap->getID());
+    }
+  }
+  submaps->removeSubmaps(submaps_to_remove);
+
+  // Update the change states of submaps that are still inactive.
+  for (const auto& id_state_pair : result.change_states) {
+    if (!submaps->submapIdExists(id_state_pair.first)) {
+      continue;
+    }
+    Submap* submap = submaps->getSubmapPtr(id_state_pair.first);
+    if (!submap->isActive() && !submap->isFinishing() &&
+        submap->getChangeState() != id_state_pair.second) {
+      submap->setChangeState(id_state_pair.second);
+    }
+  }
+
+  // Merge submaps. Merged submaps are searched for further matches.
+  for (const auto& id_target_pair : result.merges) {
+    const int id = id_target_pair.first;
+    const int target_id = id_target_pair.second;
+    if (!submaps->submapIdExists(id) || !submaps->submapIdExists(target_id)) {
+      continue;
+    }
+    const Submap& submap = submaps->getSubmap(id);
+    const Submap& target = submaps->getSubmap(target_id);
+    if (submap.isActive() || submap.isFinishing() || target.isActive() ||
+        target.isFinishing() ||
+        submap.getChangeState() == ChangeState::kAbsent) {
+      continue;
+    }
+    mergeSubmaps(submaps, id, target_id);
+    merge_candidates_.push_back(target_id);
+    scheduleBackgroundTask(kMergeDeactivatedSubmaps);
+  }
+
+  // Report the latency and backlog.
+  if (config_.verbosity >= 2) {
+    std::stringstream report;
+    report << "Applied background map management after " << background_ticks_
+           << " ticks (";
+    for (size_t i = 0; i < result.task_times.size(); ++i) {
+      report << (i == 0 ? "" : ", ") << result.task_times[i].first << ": "
+             << static_cast<int>(result.task_times[i].second) << "ms";
+    }
+    report << "), " << num_deferred_tasks_ << " tasks were deferred, "
+           << std::bitset<3>(due_tasks_).count() << " are due.";
+    LOG(INFO) << report.str() << info.str();
+  }
+  num_deferred_tasks_ = 0;
+}
+
+void MapManager::waitForBackgroundTasks(SubmapCollection* submaps) {
+  if (background_tasks_.valid()) {
+    applyBackgroundResult(submaps, background_tasks_.get());
+  }
+}
+
+void MapManager::discardBackgroundTasks() {
+  if (background_tasks_.valid()) {
+    background_tasks_.get();
+  }
+  for (FinishingSubmap& finishing : finishing_submaps_) {
+    finishing.finished.get();
+  }
+  finishing_submaps_.clear();
+  finishing_queue_.clear();
+  snapshot_.reset();
+  due_tasks_ = 0;
+  merge_candidates_.clear();
+  num_deferred_tasks_ = 0;
+}
+
+std::string MapManager::pruneBlocks(
+    Submap* submap, const voxblox::BlockIndexList* block_indices) const {
+  auto t1 = std::chrono::high_resolution_clock::now();
+  int count = 0;
+
+  // Remove all blocks that don't have any belonging voxels.
+  voxblox::BlockIndexList all_block_indices;
+  if (!block_indices) {
+    submap->getTsdfLayer().getAllAllocatedBlocks(&all_block_indices);
+    block_indices = &all_block_indices;
+  }
+  for (const auto& block_index : *block_indices) {
+    if (pruneBlock(submap, block_index)) {
       count++;
     }
   }
@@ -322,10 +1114,49 @@ std::string MapManager::pruneBlocks(Submap* submap) const {
   return ss.str();
 }
 
-void MapManager::Ticker::tick(SubmapCollection* submaps) {
-  // Perform 'action' every 'max_ticks' ticks.
+bool MapManager::pruneBlock(Submap* submap, const BlockIndex& index) const {
+  TsdfLayer* tsdf_layer = submap->getTsdfLayerPtr().get();
+  if (!tsdf_layer->hasBlock(index) || hasBelongingVoxels(*submap, index)) {
+    return false;
+  }
+  if (submap->hasClassLayer()) {
+    submap->getClassLayerPtr()->removeBlock(index);
+  }
+  BlockPool<TsdfVoxel>::getGlobalInstance()->removeBlock(index, tsdf_layer);
+  submap->getVoxelMasksPtr()->remove(index);
+  submap->getMeshLayerPtr()->removeMesh(index);
+  submap->recordRemovedBlock(index);
+  return true;
+}
+
+bool MapManager::hasBelongingVoxels(const Submap& submap,
+                                    const BlockIndex& index) const {
+  ClassBlock::ConstPtr class_block;
+  if (submap.hasClassLayer()) {
+    class_block = submap.getClassLayer().getBlockConstPtrByIndex(index);
+  }
+  const TsdfBlock& tsdf_block = submap.getTsdfLayer().getBlockByIndex(index);
+
+  // Check all observed voxels.
+  bool result = false;
+  submap.getVoxelMasks().forEachObservedVoxel(index, tsdf_block, [&](size_t i) {
+    if (!result && tsdf_block.getVoxelByLinearIndex(i).weight >= 1e-6) {
+      if (!class_block || class_block->getVoxelByLinearIndex(i)
+                              .belongsToSubmap()) {
+        result = true;
+      }
+    }
+  });
+  return result;
+}
+
+void MapManager::Ticker::tick(SubmapCollection* submaps,
+                              unsigned int interval_factor) {
+  // Perform 'action' every 'max_ticks' ticks, stretched by the interval factor
+  // for deferrable tasks.
   current_tick_++;
-  if (current_tick_ >= max_ticks_) {
+  if (current_tick_ >= (is_deferrable_ ? max_ticks_ * interval_factor
+                                       : max_ticks_)) {
     action_(submaps);
     current_tick_ = 0;
   }
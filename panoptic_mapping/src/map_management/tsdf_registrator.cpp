@@ -1,9 +1,20 @@
 #include "panoptic_mapping/map_management/tsdf_registrator.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <future>
 #include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -11,6 +22,7 @@
 #include <voxblox/mesh/mesh_integrator.h>
 
 #include "panoptic_mapping/common/index_getter.h"
+#include "panoptic_mapping/common/thread_pool.h"
 #include "panoptic_mapping/map/submap.h"
 #include "panoptic_mapping/map/submap_collection.h"
 
@@ -29,6 +41,8 @@ void TsdfRegistrator::Config::checkParams() const {
     checkParamGT(normalization_max_weight, 0.f, "normalization_max_weight");
   }
   checkParamGT(integration_threads, 0, "integration_threads");
+  checkParamGT(points_per_task, 0, "points_per_task");
+  checkParamGT(signature_cell_blocks, 0, "signature_cell_blocks");
 }
 
 void TsdfRegistrator::Config::setupParamsAndPrinting() {
@@ -42,6 +56,12 @@ void TsdfRegistrator::Config::setupParamsAndPrinting() {
   setupParam("normalize_by_voxel_weight", &normalize_by_voxel_weight);
   setupParam("normalization_max_weight", &normalization_max_weight);
   setupParam("integration_threads", &integration_threads);
+  setupParam("points_per_task", &points_per_task);
+  setupParam("use_incremental_change_detection",
+             &use_incremental_change_detection);
+  setupParam("use_flat_block_maps", &use_flat_block_maps);
+  setupParam("use_occupancy_signatures", &use_occupancy_signatures);
+  setupParam("signature_cell_blocks", &signature_cell_blocks, "blocks");
 }
 
 TsdfRegistrator::TsdfRegistrator(const Config& config)
@@ -49,159 +69,725 @@ TsdfRegistrator::TsdfRegistrator(const Config& config)
   LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
 }
 
+namespace {
+
+/**
+ * Trilinear interpolation of TSDF distances and weights as in
+ * 'voxblox::Interpolator'. Neighbouring iso-surface points mostly interpolate
+ * voxels of the same blocks, so the blocks of recent lookups are cached and
+ * most points need no hash lookups. Cache misses are looked up in the flat
+ * block map if set.
+ */
+class CachedTsdfInterpolator {
+ public:
+  CachedTsdfInterpolator(const TsdfLayer& layer, float min_voxel_weight,
+                         const FlatBlockMap<TsdfVoxel>* blocks = nullptr)
+      : layer_(layer),
+        blocks_(blocks),
+        min_voxel_weight_(min_voxel_weight),
+        voxels_per_side_(layer.voxels_per_side()),
+        voxels_per_side_inv_(1.f / layer.voxels_per_side()),
+        voxel_size_inv_(layer.voxel_size_inv()) {}
+
+  bool getDistanceAndWeight(const Point& position, float* distance,
+                            float* weight) {
+    // Lower corner voxel and offset of the position from its center.
+    const Point scaled = position * voxel_size_inv_;
+    const voxblox::GlobalIndex corner =
+        (scaled.array() - 0.5f).floor().cast<voxblox::LongIndexElement>();
+    const Point offset = scaled - (corner.cast<FloatingPoint>().array() + 0.5f)
+                                      .matrix();
+
+    // Interpolate all 8 neighbours, all of which need to be observed.
+    float interpolated_distance = 0.f;
+    float interpolated_weight = 0.f;
+    for (int i = 0; i < 8; ++i) {
+      const voxblox::GlobalIndex index =
+          corner + voxblox::GlobalIndex(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+      const TsdfBlock* block =
+          getBlock(voxblox::getBlockIndexFromGlobalVoxelIndex(
+              index, voxels_per_side_inv_));
+      if (!block) {
+        return false;
+      }
+      const TsdfVoxel& voxel = block->getVoxelByVoxelIndex(
+          voxblox::getLocalFromGlobalVoxelIndex(index, voxels_per_side_));
+      if (voxel.weight <= kMinObservedWeight) {
+        return false;
+      }
+      const float factor = (i & 1 ? offset.x() : 1.f - offset.x()) *
+                           (i & 2 ? offset.y() : 1.f - offset.y()) *
+                           (i & 4 ? offset.z() : 1.f - offset.z());
+      interpolated_distance += factor * voxel.distance;
+      interpolated_weight += factor * voxel.weight;
+    }
+    if (interpolated_weight < min_voxel_weight_) {
+      return false;
+    }
+    *distance = interpolated_distance;
+    *weight = interpolated_weight;
+    return true;
+  }
+
+ private:
+  // Voxels with lower weight are unobserved, as in voxblox.
+  static constexpr float kMinObservedWeight = 1e-6f;
+  static constexpr size_t kCacheSize = 8;
+
+  const TsdfBlock* getBlock(const BlockIndex& index) {
+    for (size_t i = 0; i < num_cached_; ++i) {
+      if (cached_indices_[i] == index) {
+        return cached_blocks_[i];
+      }
+    }
+    const TsdfBlock* block = blocks_ ? blocks_->find(index)
+                                     : layer_.getBlockPtrByIndex(index).get();
+    cached_indices_[next_cached_] = index;
+    cached_blocks_[next_cached_] = block;
+    next_cached_ = (next_cached_ + 1) % kCacheSize;
+    num_cached_ = std::min(num_cached_ + 1, kCacheSize);
+    return block;
+  }
+
+  const TsdfLayer& layer_;
+  const FlatBlockMap<TsdfVoxel>* const blocks_;
+  const float min_voxel_weight_;
+  const int voxels_per_side_;
+  const FloatingPoint voxels_per_side_inv_;
+  const FloatingPoint voxel_size_inv_;
+
+  // Recently looked up blocks, including unallocated ones as nullptr.
+  std::array<BlockIndex, kCacheSize> cached_indices_;
+  std::array<const TsdfBlock*, kCacheSize> cached_blocks_;
+  size_t num_cached_ = 0;
+  size_t next_cached_ = 0;
+};
+
+/**
+ * Coarse occupancy of a submap as the set of cells of several blocks per side
+ * that contain allocated TSDF blocks. Interpolating the TSDF at a point
+ * requires the block containing the point, so points in empty cells can not
+ * interact with the submap.
+ */
+class OccupancySignature {
+ public:
+  OccupancySignature(const TsdfLayer& layer, int cell_blocks)
+      : cell_blocks_(cell_blocks), block_size_inv_(layer.block_size_inv()) {
+    voxblox::BlockIndexList blocks;
+    layer.getAllAllocatedBlocks(&blocks);
+    for (const BlockIndex& index : blocks) {
+      cells_.insert(toCell(index));
+    }
+  }
+
+  // Whether any cell overlapping the box in the frame of the submap is
+  // occupied.
+  bool overlaps(const Point& min_corner, const Point& max_corner) const {
+    using voxblox::getGridIndexFromPoint;
+    const BlockIndex min_cell =
+        toCell(getGridIndexFromPoint<BlockIndex>(min_corner, block_size_inv_));
+    const BlockIndex max_cell =
+        toCell(getGridIndexFromPoint<BlockIndex>(max_corner, block_size_inv_));
+    const BlockIndex extent = max_cell - min_cell + BlockIndex::Ones();
+    const size_t num_cells =
+        static_cast<size_t>(extent.x()) * extent.y() * extent.z();
+    if (num_cells > cells_.size()) {
+      // Large boxes are checked against all occupied cells.
+      for (const BlockIndex& cell : cells_) {
+        if ((cell.array() >= min_cell.array()).all() &&
+            (cell.array() <= max_cell.array()).all()) {
+          return true;
+        }
+      }
+      return false;
+    }
+    BlockIndex cell;
+    for (cell.x() = min_cell.x(); cell.x() <= max_cell.x(); ++cell.x()) {
+      for (cell.y() = min_cell.y(); cell.y() <= max_cell.y(); ++cell.y()) {
+        for (cell.z() = min_cell.z(); cell.z() <= max_cell.z(); ++cell.z()) {
+          if (cells_.count(cell)) {
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+ private:
+  BlockIndex toCell(const BlockIndex& index) const {
+    BlockIndex cell;
+    for (int i = 0; i < 3; ++i) {
+      // Round towards negative infinity.
+      cell[i] = index[i] >= 0 ? index[i] / cell_blocks_
+                              : -((-index[i] - 1) / cell_blocks_) - 1;
+    }
+    return cell;
+  }
+
+  const int cell_blocks_;
+  const FloatingPoint block_size_inv_;
+  voxblox::IndexSet cells_;
+};
+
+// Axis aligned bounding box of a chunk of iso-surface points in the frame of
+// their submap.
+struct PointBounds {
+  Point min_corner = Point::Constant(std::numeric_limits<float>::max());
+  Point max_corner = Point::Constant(std::numeric_limits<float>::lowest());
+
+  bool empty() const { return (min_corner.array() > max_corner.array()).any(); }
+  void add(const Point& point) {
+    min_corner = min_corner.cwiseMin(point);
+    max_corner = max_corner.cwiseMax(point);
+  }
+
+  // Bounding box of the transformed box, padded by 'padding'.
+  PointBounds transform(const Transformation& T, float padding) const {
+    const Point center = 0.5f * (min_corner + max_corner);
+    const Point half_extent = 0.5f * (max_corner - min_corner);
+    const Point transformed_center = T * center;
+    const Point transformed_extent =
+        T.getRotationMatrix().cwiseAbs() * half_extent +
+        Point::Constant(padding);
+    PointBounds result;
+    result.min_corner = transformed_center - transformed_extent;
+    result.max_corner = transformed_center + transformed_extent;
+    return result;
+  }
+};
+
+// Bounds of the points [begin, end) of a submap that are compared, i.e. have
+// at least the minimum weight.
+PointBounds computePointBounds(const Submap& submap, size_t begin, size_t end,
+                               float min_weight) {
+  PointBounds bounds;
+  auto add_point = [&](const IsoSurfacePoint& point) {
+    if (point.weight >= min_weight) {
+      bounds.add(point.position);
+    }
+    return true;
+  };
+  const CompactIsoSurfacePoints* compact = submap.getCompactIsoSurfacePoints();
+  if (compact) {
+    compact->forEachPoint(begin, end, add_point);
+    return bounds;
+  }
+  const std::vector<IsoSurfacePoint>& points = submap.getIsoSurfacePoints();
+  for (size_t i = begin; i < end; ++i) {
+    add_point(points[i]);
+  }
+  return bounds;
+}
+
+}  // namespace
+
+void TsdfRegistrator::ComparisonStats::add(const ComparisonStats& other) {
+  conflicting_points += other.conflicting_points;
+  matched_points += other.matched_points;
+  total_weight += other.total_weight;
+  rejected = rejected || other.rejected;
+}
+
 void TsdfRegistrator::checkSubmapCollectionForChange(
-    SubmapCollection* submaps) const {
+    SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  std::unordered_map<int, voxblox::IndexSet> changed_blocks;
+  if (config_.use_incremental_change_detection) {
+    for (Submap& submap : *submaps) {
+      changed_blocks[submap.getID()] = submap.takeChangedBlocks();
+    }
+  }
+  std::unordered_map<int, ChangeState> change_states;
+  detectChanges(*submaps, changed_blocks, &change_states);
+  for (const auto& id_state_pair : change_states) {
+    Submap* submap = submaps->getSubmapPtr(id_state_pair.first);
+    if (submap->getChangeState() != id_state_pair.second) {
+      submap->setChangeState(id_state_pair.second);
+    }
+  }
+}
+
+void TsdfRegistrator::detectChanges(
+    const SubmapCollection& submaps,
+    const std::unordered_map<int, voxblox::IndexSet>& changed_blocks,
+    std::unordered_map<int, ChangeState>* change_states) {
+  CHECK_NOTNULL(change_states);
   auto t_start = std::chrono::high_resolution_clock::now();
   std::string info;
 
   // Check all inactive maps for alignment with the currently active ones.
-  std::vector<int> id_list;
-  for (const Submap& submap : *submaps) {
-    if (!submap.isActive() && submap.getLabel() != PanopticLabel::kFreeSpace &&
-        !submap.getIsoSurfacePoints().empty()) {
-      id_list.emplace_back(submap.getID());
+  // Every pair of submaps is split into tasks of the reference iso-surface
+  // points, such that large submaps are processed in parallel. In incremental
+  // mode the tasks only cover the points near changed blocks.
+  struct Comparison {
+    const Submap* reference;
+    const Submap* other;
+    const FlatBlockMap<TsdfVoxel>* other_blocks = nullptr;
+    PairState* state = nullptr;  // Only set in incremental mode.
+    std::deque<ComparisonStats> task_stats;
+    std::atomic<bool> rejected{false};
+  };
+  struct Task {
+    size_t comparison;
+    const std::vector<uint32_t>* point_indices;
+    size_t begin;
+    size_t end;
+    ComparisonStats* stats;
+  };
+  const bool incremental = config_.use_incremental_change_detection;
+  const voxblox::IndexSet no_changed_blocks;
+  std::deque<Comparison> comparisons;
+  std::vector<Task> tasks;
+  std::set<std::pair<int, int>> visited_pairs;
+  std::unordered_map<int, std::unique_ptr<FlatBlockMap<TsdfVoxel>>>
+      flat_block_maps;
+  const size_t points_per_task = config_.points_per_task;
+  ThreadPool* thread_pool = submaps.getThreadPool();
+
+  // Inactive reference submaps and the active submaps they are compared to.
+  std::vector<std::pair<const Submap*, std::vector<int>>> references;
+  for (const Submap& submap : submaps) {
+    if (submap.isActive() || submap.isFinishing() ||
+        submap.getLabel() == PanopticLabel::kFreeSpace ||
+        submap.getNumberOfIsoSurfacePoints() == 0) {
+      continue;
+    }
+    std::vector<int> compared = getComparedSubmaps(submaps, submap);
+    if (!compared.empty()) {
+      references.emplace_back(&submap, std::move(compared));
     }
   }
 
-  // Perform change detection in parallel.
-  SubmapIndexGetter index_getter(id_list);
-  std::vector<std::future<std::string>> threads;
+  // Compute the occupancy signatures of the compared submaps and the bounds
+  // of the reference point chunks in parallel.
+  const bool use_signatures = config_.use_occupancy_signatures && !incremental;
+  std::vector<std::vector<PointBounds>> chunk_bounds(references.size());
+  std::unordered_map<int, std::unique_ptr<OccupancySignature>> signatures;
+  size_t num_skipped_tasks = 0;
+  if (use_signatures) {
+    std::vector<std::function<void()>> jobs;
+    for (size_t i = 0; i < references.size(); ++i) {
+      const Submap& reference = *references[i].first;
+      const size_t num_points = reference.getNumberOfIsoSurfacePoints();
+      chunk_bounds[i].resize((num_points + points_per_task - 1) /
+                             points_per_task);
+      for (size_t chunk = 0; chunk < chunk_bounds[i].size(); ++chunk) {
+        jobs.emplace_back([&, i, chunk, num_points]() {
+          const size_t begin = chunk * points_per_task;
+          chunk_bounds[i][chunk] =
+              computePointBounds(*references[i].first, begin,
+                                 std::min(begin + points_per_task, num_points),
+                                 config_.min_voxel_weight);
+        });
+      }
+      for (const int id : references[i].second) {
+        // Entries are inserted here such that the jobs only write their own.
+        auto it_inserted = signatures.emplace(id, nullptr);
+        if (!it_inserted.second) {
+          continue;
+        }
+        std::unique_ptr<OccupancySignature>* signature =
+            &it_inserted.first->second;
+        jobs.emplace_back([&, id, signature]() {
+          *signature = std::make_unique<OccupancySignature>(
+              submaps.getSubmap(id).getTsdfLayer(),
+              config_.signature_cell_blocks);
+        });
+      }
+    }
+    std::atomic<size_t> next_job(0);
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < config_.integration_threads; ++i) {
+      futures.emplace_back(thread_pool->submit([&]() {
+        size_t job;
+        while ((job = next_job.fetch_add(1, std::memory_order_relaxed)) <
+               jobs.size()) {
+          jobs[job]();
+        }
+      }));
+    }
+    thread_pool->waitAll(&futures);
+  }
+
+  for (size_t reference_index = 0; reference_index < references.size();
+       ++reference_index) {
+    const Submap& submap = *references[reference_index].first;
+    const size_t num_points = submap.getNumberOfIsoSurfacePoints();
+    for (const int id : references[reference_index].second) {
+      Comparison& comparison = comparisons.emplace_back();
+      comparison.reference = &submap;
+      comparison.other = &submaps.getSubmap(id);
+      if (config_.use_flat_block_maps) {
+        std::unique_ptr<FlatBlockMap<TsdfVoxel>>& blocks = flat_block_maps[id];
+        if (!blocks) {
+          blocks = std::make_unique<FlatBlockMap<TsdfVoxel>>(
+              comparison.other->getTsdfLayer());
+        }
+        comparison.other_blocks = blocks.get();
+      }
+      const size_t comparison_index = comparisons.size() - 1;
+      if (!incremental) {
+        // Skip chunks whose points can not fall into blocks of the compared
+        // submap. The bounds are padded to be conservative w.r.t. rounding.
+        const OccupancySignature* signature =
+            use_signatures ? signatures.at(id).get() : nullptr;
+        const Transformation T_O_R =
+            comparison.other->getT_S_M() * submap.getT_M_S();
+        const float padding = comparison.other->getTsdfLayer().voxel_size();
+        size_t chunk = 0;
+        for (size_t begin = 0; begin < num_points;
+             begin += points_per_task, ++chunk) {
+          if (signature) {
+            const PointBounds& bounds = chunk_bounds[reference_index][chunk];
+            if (bounds.empty()) {
+              num_skipped_tasks++;
+              continue;
+            }
+            const PointBounds bounds_O = bounds.transform(T_O_R, padding);
+            if (!signature->overlaps(bounds_O.min_corner,
+                                     bounds_O.max_corner)) {
+              num_skipped_tasks++;
+              continue;
+            }
+          }
+          tasks.push_back({comparison_index, nullptr, begin,
+                           std::min(begin + points_per_task, num_points),
+                           &comparison.task_stats.emplace_back()});
+        }
+        continue;
+      }
+
+      // Incremental: Re-evaluate the points of all blocks of the compared
+      // submap whose interpolation is affected by the changed blocks.
+      const std::pair<int, int> key(submap.getID(), id);
+      visited_pairs.insert(key);
+      PairState& state = pair_states_[key];
+      comparison.state = &state;
+      const Transformation T_O_R =
+          comparison.other->getT_S_M() * submap.getT_M_S();
+      std::vector<BlockIndex> blocks;
+      // Pose corrections that move both submaps alike keep their relative
+      // pose up to rounding, in which case the state is kept. The points are
+      // only bucketed by block and affected neighbors are re-evaluated anyway.
+      if (state.num_reference_points != num_points ||
+          !state.T_O_R.getTransformationMatrix().isApprox(
+              T_O_R.getTransformationMatrix(), 1e-5f)) {
+        resetPairState(submap, *comparison.other, T_O_R, &state);
+        for (const auto& index_points_pair : state.block_points) {
+          blocks.push_back(index_points_pair.first);
+        }
+      } else {
+        auto it = changed_blocks.find(id);
+        voxblox::IndexSet affected_blocks;
+        for (const BlockIndex& index :
+             it == changed_blocks.end() ? no_changed_blocks : it->second) {
+          for (int x = -1; x <= 1; ++x) {
+            for (int y = -1; y <= 1; ++y) {
+              for (int z = -1; z <= 1; ++z) {
+                const BlockIndex neighbor = index + BlockIndex(x, y, z);
+                if (state.block_points.count(neighbor)) {
+                  affected_blocks.insert(neighbor);
+                }
+              }
+            }
+          }
+        }
+        blocks.insert(blocks.end(), affected_blocks.begin(),
+                      affected_blocks.end());
+      }
+      for (const BlockIndex& index : blocks) {
+        const std::vector<uint32_t>& points = state.block_points.at(index);
+        ComparisonStats* stats = &state.block_stats[index];
+        *stats = ComparisonStats();
+        tasks.push_back({comparison_index, &points, 0, points.size(), stats});
+      }
+    }
+  }
+
+  // Forget the state of pairs that are no longer compared.
+  for (auto it = pair_states_.begin(); it != pair_states_.end();) {
+    if (visited_pairs.count(it->first)) {
+      ++it;
+    } else {
+      it = pair_states_.erase(it);
+    }
+  }
+
+  // Perform change detection in parallel. Each task writes its own stats.
+  // Tasks are preferably run on the home node of the compared submap, whose
+  // TSDF is looked up for every point.
+  const int num_nodes = thread_pool->getNumNodes();
+  std::vector<std::vector<int>> node_tasks(num_nodes);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    const int node = comparisons[tasks[i].comparison].other->getHomeNode();
+    node_tasks[std::clamp(node, 0, num_nodes - 1)].push_back(i);
+  }
+  NodeLocalIndexGetter<int> index_getter(std::move(node_tasks));
+  std::vector<std::future<void>> threads;
   for (int i = 0; i < config_.integration_threads; ++i) {
-    threads.emplace_back(
-        std::async(std::launch::async, [this, &index_getter, submaps]() {
-          int index;
-          std::string info;
-          while (index_getter.getNextIndex(&index)) {
-            info += this->checkSubmapForChange(*submaps,
-                                               submaps->getSubmapPtr(index));
+    threads.emplace_back(thread_pool->submitOnNode(
+        i % num_nodes,
+        [this, &index_getter, &tasks, &comparisons, incremental,
+         thread_pool]() {
+          const int node = thread_pool->getCurrentNode();
+          const ChunkedIndexGetter<int>* getter;
+          size_t begin, end;
+          while (index_getter.getNextChunk(node, &getter, &begin, &end)) {
+            const Task& task = tasks[(*getter)[begin]];
+            Comparison& comparison = comparisons[task.comparison];
+            if (comparison.rejected.load(std::memory_order_relaxed)) {
+              continue;
+            }
+            // The accumulated stats need to be exact in incremental mode.
+            this->compareIsoSurfacePoints(
+                *comparison.reference, *comparison.other, task.point_indices,
+                task.begin, task.end, !incremental, task.stats,
+                comparison.other_blocks);
+            if (task.stats->rejected) {
+              comparison.rejected = true;
+            }
           }
-          return info;
         }));
   }
 
   // Join all threads.
   for (auto& thread : threads) {
-    info += thread.get();
+    thread_pool->wait(&thread);
+  }
+
+  // Reduce the stats of all pairs and update the submaps in the order of the
+  // compared submaps, where the first conflict decides.
+  std::unordered_set<int> conflicting_submaps;
+  for (const Comparison& comparison : comparisons) {
+    const Submap* submap = comparison.reference;
+    const Submap& other = *comparison.other;
+    if (conflicting_submaps.count(submap->getID())) {
+      continue;
+    }
+    ComparisonStats stats;
+    if (comparison.state) {
+      for (const auto& index_stats_pair : comparison.state->block_stats) {
+        stats.add(index_stats_pair.second);
+      }
+    } else {
+      for (const ComparisonStats& task_stats : comparison.task_stats) {
+        stats.add(task_stats);
+      }
+    }
+    bool submaps_match;
+    if (evaluateComparison(*submap, stats, &submaps_match)) {
+      // No conflicts allowed.
+      (*change_states)[submap->getID()] = ChangeState::kAbsent;
+      conflicting_submaps.insert(submap->getID());
+      std::stringstream ss;
+      ss << "\nSubmap " << submap->getID() << " (" << submap->getName()
+         << ") conflicts with submap " << other.getID() << " ("
+         << other.getName() << ").";
+      info += ss.str();
+    } else if (submap->getClassID() == other.getClassID() && submaps_match) {
+      // Semantically and geometrically match.
+      (*change_states)[submap->getID()] = ChangeState::kPersistent;
+    }
   }
   auto t_end = std::chrono::high_resolution_clock::now();
 
   LOG_IF(INFO, config_.verbosity >= 2)
-      << "Performed change detection in "
+      << "Performed " << (incremental ? "incremental " : "")
+      << "change detection (" << tasks.size() << " tasks"
+      << (use_signatures
+              ? ", " + std::to_string(num_skipped_tasks) + " skipped"
+              : std::string())
+      << ") in "
       << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start)
              .count()
       << (config_.verbosity < 3 || info.empty() ? "ms." : "ms:" + info);
 }
 
-std::string TsdfRegistrator::checkSubmapForChange(
-    const SubmapCollection& submaps, Submap* submap) const {
+void TsdfRegistrator::resetPairState(const Submap& reference,
+                                     const Submap& other,
+                                     const Transformation& T_O_R,
+                                     PairState* state) const {
+  // Group the reference points by the block of the compared submap they fall
+  // into.
+  state->T_O_R = T_O_R;
+  state->num_reference_points = reference.getNumberOfIsoSurfacePoints();
+  state->block_points.clear();
+  state->block_stats.clear();
+  const FloatingPoint block_size_inv = other.getTsdfLayer().block_size_inv();
+  auto add_point = [&](uint32_t index, const IsoSurfacePoint& point) {
+    state->block_points[voxblox::getGridIndexFromPoint<BlockIndex>(
+                            T_O_R * point.position, block_size_inv)]
+        .push_back(index);
+  };
+  const CompactIsoSurfacePoints* compact =
+      reference.getCompactIsoSurfacePoints();
+  if (compact) {
+    uint32_t index = 0;
+    compact->forEachPoint(0, compact->size(),
+                          [&](const IsoSurfacePoint& point) {
+                            add_point(index++, point);
+                            return true;
+                          });
+    return;
+  }
+  const std::vector<IsoSurfacePoint>& points = reference.getIsoSurfacePoints();
+  for (size_t i = 0; i < points.size(); ++i) {
+    add_point(i, points[i]);
+  }
+}
+
+std::vector<int> TsdfRegistrator::getComparedSubmaps(
+    const SubmapCollection& submaps, const Submap& reference) const {
   // Check overlapping submaps for conflicts or matches.
-  for (const Submap& other : submaps) {
-    if (!other.isActive() ||
-        !submap->getBoundingVolume().intersects(other.getBoundingVolume())) {
+  std::vector<int> result;
+  const SubmapBoundingVolume& volume = reference.getBoundingVolume();
+  for (const int id : submaps.findSubmapsIntersecting(
+           reference.getT_M_S() * volume.getCenter(), volume.getRadius())) {
+    const Submap& other = submaps.getSubmap(id);
+    if (!other.isActive() || !volume.intersects(other.getBoundingVolume())) {
       continue;
     }
 
     // Note(schmluk): Exclude free space for thin structures. Although there's
     // potentially a nicer way of solving this.
     if (other.getLabel() == PanopticLabel::kFreeSpace &&
-        submap->getConfig().voxel_size < other.getConfig().voxel_size * 0.5) {
+        reference.getConfig().voxel_size < other.getConfig().voxel_size * 0.5) {
       continue;
     }
-
-    bool submaps_match;
-    if (submapsConflict(*submap, other, &submaps_match)) {
-      // No conflicts allowed.
-      if (submap->getChangeState() != ChangeState::kAbsent) {
-        submap->setChangeState(ChangeState::kAbsent);
-      }
-      std::stringstream info;
-      info << "\nSubmap " << submap->getID() << " (" << submap->getName()
-           << ") conflicts with submap " << other.getID() << " ("
-           << other.getName() << ").";
-      return info.str();
-    } else if (submap->getClassID() == other.getClassID() && submaps_match) {
-      // Semantically and geometrically match.
-      submap->setChangeState(ChangeState::kPersistent);
-    }
+    result.push_back(id);
   }
-  return "";
+  return result;
 }
 
 bool TsdfRegistrator::submapsConflict(const Submap& reference,
                                       const Submap& other,
                                       bool* submaps_match) const {
+  ComparisonStats stats;
+  compareIsoSurfacePoints(reference, other, nullptr, 0,
+                          reference.getNumberOfIsoSurfacePoints(), true,
+                          &stats);
+  return evaluateComparison(reference, stats, submaps_match);
+}
+
+float TsdfRegistrator::computeRejectionCount(const Submap& reference) const {
+  return config_.normalize_by_voxel_weight
+             ? std::numeric_limits<float>::max()
+             : std::max(static_cast<float>(config_.match_rejection_points),
+                        config_.match_rejection_percentage *
+                            reference.getNumberOfIsoSurfacePoints());
+}
+
+void TsdfRegistrator::compareIsoSurfacePoints(
+    const Submap& reference, const Submap& other,
+    const std::vector<uint32_t>* point_indices, size_t begin, size_t end,
+    bool allow_early_rejection, ComparisonStats* stats,
+    const FlatBlockMap<TsdfVoxel>* other_blocks) const {
   // Reference is the finished submap (with Iso-surfce-points) that is
   // compared to the active submap other.
-  Transformation T_O_R = other.getT_S_M() * reference.getT_M_S();
-  const float rejection_count =
-      config_.normalize_by_voxel_weight
-          ? std::numeric_limits<float>::max()
-          : std::max(static_cast<float>(config_.match_rejection_points),
-                     config_.match_rejection_percentage *
-                         reference.getIsoSurfacePoints().size());
+  const Transformation T_O_R = other.getT_S_M() * reference.getT_M_S();
+  const float rejection_count = allow_early_rejection
+                                    ? computeRejectionCount(reference)
+                                    : std::numeric_limits<float>::max();
   const float rejection_distance =
       config_.error_threshold > 0.f
           ? config_.error_threshold
           : config_.error_threshold * -other.getTsdfLayer().voxel_size();
-  float conflicting_points = 0.f;
-  float matched_points = 0.f;
-  float total_weight = 0.f;
-  voxblox::Interpolator<TsdfVoxel> interpolator(&(other.getTsdfLayer()));
+  CachedTsdfInterpolator interpolator(other.getTsdfLayer(),
+                                      config_.min_voxel_weight, other_blocks);
 
-  // Check for disagreement.
+  // Check for disagreement. Returns false once the submaps are rejected.
   float distance, weight;
-  for (const auto& point : reference.getIsoSurfacePoints()) {
-    if (getDistanceAndWeightAtPoint(&distance, &weight, point, T_O_R,
-                                    interpolator)) {
-      // Compute the weight to be used for counting.
-      if (config_.normalize_by_voxel_weight) {
-        weight = computeCombinedWeight(weight, point.weight);
-        total_weight += weight;
-      } else {
-        weight = 1.f;
-      }
+  auto compare_point = [&](const IsoSurfacePoint& point) {
+    if (point.weight < config_.min_voxel_weight ||
+        !interpolator.getDistanceAndWeight(T_O_R * point.position, &distance,
+                                           &weight)) {
+      return true;
+    }
 
-      // Count.
-      if (other.getLabel() == PanopticLabel::kFreeSpace) {
-        if (distance >= rejection_distance) {
-          conflicting_points += weight;
-        }
-      } else {
-        // Check for class belonging.
-
-        if (other.hasClassLayer()) {
-          const ClassVoxel* class_voxel =
-              other.getClassLayer().getVoxelPtrByCoordinates(point.position);
-          if (class_voxel) {
-            if (!class_voxel->belongsToSubmap()) {
-              distance = other.getConfig().truncation_distance;
-            }
+    // Compute the weight to be used for counting.
+    if (config_.normalize_by_voxel_weight) {
+      weight = computeCombinedWeight(weight, point.weight);
+      stats->total_weight += weight;
+    } else {
+      weight = 1.f;
+    }
+
+    // Count.
+    if (other.getLabel() == PanopticLabel::kFreeSpace) {
+      if (distance >= rejection_distance) {
+        stats->conflicting_points += weight;
+      }
+    } else {
+      // Check for class belonging.
+      if (other.hasClassLayer()) {
+        const ClassVoxel* class_voxel =
+            other.getClassLayer().getVoxelPtrByCoordinates(point.position);
+        if (class_voxel) {
+          if (!class_voxel->belongsToSubmap()) {
+            distance = other.getConfig().truncation_distance;
           }
         }
-        if (distance <= -rejection_distance) {
-          conflicting_points += weight;
-        } else if (distance <= rejection_distance) {
-          matched_points += weight;
-        }
       }
+      if (distance <= -rejection_distance) {
+        stats->conflicting_points += weight;
+      } else if (distance <= rejection_distance) {
+        stats->matched_points += weight;
+      }
+    }
 
-      if (conflicting_points > rejection_count) {
-        // If the rejection count is known and reached submaps conflict.
-        if (submaps_match) {
-          *submaps_match = false;
-        }
-        return true;
+    if (stats->conflicting_points > rejection_count) {
+      // If the rejection count is known and reached submaps conflict. Since
+      // all counts are positive this also holds for the summed stats.
+      stats->rejected = true;
+      return false;
+    }
+    return true;
+  };
+
+  // Compacted points are decoded block by block.
+  const CompactIsoSurfacePoints* compact =
+      reference.getCompactIsoSurfacePoints();
+  if (compact) {
+    if (!point_indices) {
+      compact->forEachPoint(begin, end, compare_point);
+      return;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      if (!compare_point(compact->getPoint((*point_indices)[i]))) {
+        return;
       }
     }
+    return;
+  }
+  const std::vector<IsoSurfacePoint>& points = reference.getIsoSurfacePoints();
+  for (size_t i = begin; i < end; ++i) {
+    if (!compare_point(points[point_indices ? (*point_indices)[i] : i])) {
+      return;
+    }
+  }
+}
+
+bool TsdfRegistrator::evaluateComparison(const Submap& reference,
+                                         const ComparisonStats& stats,
+                                         bool* submaps_match) const {
+  if (stats.rejected ||
+      stats.conflicting_points > computeRejectionCount(reference)) {
+    if (submaps_match) {
+      *submaps_match = false;
+    }
+    return true;
   }
+
   // Evaluate the result.
+  const float num_points = reference.getNumberOfIsoSurfacePoints();
   if (config_.normalize_by_voxel_weight) {
     const float rejection_weight =
         std::max(static_cast<float>(config_.match_rejection_points) /
-                     reference.getIsoSurfacePoints().size(),
+                     num_points,
                  config_.match_rejection_percentage) *
-        total_weight;
-    if (conflicting_points > rejection_weight) {
+        stats.total_weight;
+    if (stats.conflicting_points > rejection_weight) {
       if (submaps_match) {
         *submaps_match = false;
       }
@@ -209,51 +795,18 @@ bool TsdfRegistrator::submapsConflict(const Submap& reference,
     } else if (submaps_match) {
       const float acceptance_weight =
           std::max(static_cast<float>(config_.match_acceptance_points) /
-                       reference.getIsoSurfacePoints().size(),
+                       num_points,
                    config_.match_acceptance_percentage) *
-          total_weight;
-      if (matched_points > acceptance_weight) {
-        *submaps_match = true;
-      } else {
-        *submaps_match = false;
-      }
-    }
-  } else {
-    if (submaps_match) {
-      const float acceptance_count =
-          std::max(static_cast<float>(config_.match_acceptance_points),
-                   config_.match_acceptance_percentage *
-                       reference.getIsoSurfacePoints().size());
-      *submaps_match = matched_points > acceptance_count;
+          stats.total_weight;
+      *submaps_match = stats.matched_points > acceptance_weight;
     }
+  } else if (submaps_match) {
+    const float acceptance_count =
+        std::max(static_cast<float>(config_.match_acceptance_points),
+                 config_.match_acceptance_percentage * num_points);
+    *submaps_match = stats.matched_points > acceptance_count;
   }
   return false;
-}  // namespace panoptic_mapping
-
-bool TsdfRegistrator::getDistanceAndWeightAtPoint(
-    float* distance, float* weight, const IsoSurfacePoint& point,
-    const Transformation& T_P_S,
-    const voxblox::Interpolator<TsdfVoxel>& interpolator) const {
-  // Check minimum input point weight.
-  if (point.weight < config_.min_voxel_weight) {
-    return false;
-  }
-
-  // Try to interpolate the voxel in the  map.
-  // NOTE(Schmluk): This also interpolates color etc, but otherwise the
-  // interpolation lookup has to be done twice. Getting only what we want is
-  // also in voxblox::interpolator but private, atm not performance critical.
-  TsdfVoxel voxel;
-  const Point position = T_P_S * point.position;
-  if (!interpolator.getVoxel(position, &voxel, true)) {
-    return false;
-  }
-  if (voxel.weight < config_.min_voxel_weight) {
-    return false;
-  }
-  *distance = voxel.distance;
-  *weight = voxel.weight;
-  return true;
 }
 
 float TsdfRegistrator::computeCombinedWeight(float w1, float w2) const {
@@ -272,9 +825,11 @@ void TsdfRegistrator::mergeMatchingSubmaps(SubmapCollection* submaps) {
   // Merge all submaps of identical Instance ID into one.
   // TODO(schmluk): This is a preliminary function for prototyping, update
   // this.
-  submaps->updateInstanceToSubmapIDTable();
+  // The table is copied since removing submaps updates it.
+  const std::unordered_map<int, std::unordered_set<int>> instance_table =
+      submaps->getInstanceToSubmapIDTable();
   int merged_maps = 0;
-  for (const auto& instance_submaps : submaps->getInstanceToSubmapIDTable()) {
+  for (const auto& instance_submaps : instance_table) {
     const auto& ids = instance_submaps.second;
     Submap* target;
     for (auto it = ids.begin(); it != ids.end(); ++it) {
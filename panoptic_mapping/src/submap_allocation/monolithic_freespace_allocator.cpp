@@ -1,5 +1,17 @@
 #include "panoptic_mapping/submap_allocation/monolithic_freespace_allocator.h"
 
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include <voxblox/Block.pb.h>
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "panoptic_mapping/common/input_data.h"
+#include "panoptic_mapping/map/block_pool.h"
+#include "panoptic_mapping/tools/serialization.h"
+
 namespace panoptic_mapping {
 
 config_utilities::Factory::RegistrationRos<FreespaceAllocatorBase,
@@ -8,11 +20,24 @@ config_utilities::Factory::RegistrationRos<FreespaceAllocatorBase,
 
 void MonolithicFreespaceAllocator::Config::checkParams() const {
   checkParamConfig(submap);
+  checkParamGE(rolling_window_update_distance, 0.f,
+               "rolling_window_update_distance");
+}
+
+void MonolithicFreespaceAllocator::Config::
+    initializeDependentVariableDefaults() {
+  // Colors are never fused into the free space submap.
+  submap.store_color = false;
 }
 
 void MonolithicFreespaceAllocator::Config::setupParamsAndPrinting() {
   setupParam("verbosity", &verbosity);
   setupParam("submap", &submap);
+  setupParam("rolling_window_radius", &rolling_window_radius, "m");
+  setupParam("rolling_window_update_distance", &rolling_window_update_distance,
+             "m");
+  setupParam("rolling_window_spill_file_path",
+             &rolling_window_spill_file_path);
 }
 
 MonolithicFreespaceAllocator::MonolithicFreespaceAllocator(const Config& config,
@@ -20,12 +45,23 @@ MonolithicFreespaceAllocator::MonolithicFreespaceAllocator(const Config& config,
     : config_(config.checkValid()) {
   LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
                                                        << config_.toString();
+  if (config_.rolling_window_radius > 0.f &&
+      !config_.rolling_window_spill_file_path.empty()) {
+    spill_file_ = std::make_unique<SubmapSpillFile>(
+        config_.rolling_window_spill_file_path);
+  }
 }
 
 Submap* MonolithicFreespaceAllocator::allocateSubmap(SubmapCollection* submaps,
-                                                     InputData* /*input*/) {
+                                                     InputData* input) {
   if (submaps->getActiveFreeSpaceSubmapID() >= 0) {
     // Allocate one free space submap in the beginning.
+    if (config_.rolling_window_radius > 0.f && input &&
+        submaps->submapIdExists(submaps->getActiveFreeSpaceSubmapID())) {
+      updateRollingWindow(
+          submaps->getSubmapPtr(submaps->getActiveFreeSpaceSubmapID()),
+          input->T_M_C().getPosition());
+    }
     return nullptr;
   }
 
@@ -38,4 +74,130 @@ Submap* MonolithicFreespaceAllocator::allocateSubmap(SubmapCollection* submaps,
   return space_submap;
 }
 
+void MonolithicFreespaceAllocator::updateRollingWindow(
+    Submap* submap, const Point& position_M) {
+  // Spilled blocks belong to the previous freespace submap.
+  if (submap->getID() != window_submap_id_) {
+    window_submap_id_ = submap->getID();
+    spilled_blocks_.clear();
+  } else if ((position_M - last_window_position_M_).norm() <
+             config_.rolling_window_update_distance) {
+    return;
+  }
+  last_window_position_M_ = position_M;
+  Timer timer("freespace_allocation/rolling_window");
+  TsdfLayer* layer = submap->getTsdfLayerPtr().get();
+  const Point position_S = submap->getT_S_M() * position_M;
+  const FloatingPoint block_size = layer->block_size();
+  const Point half_block = Point::Constant(block_size / 2.f);
+  const FloatingPoint radius = config_.rolling_window_radius;
+
+  // Remove all blocks outside the window.
+  voxblox::BlockIndexList block_indices;
+  layer->getAllAllocatedBlocks(&block_indices);
+  int num_removed = 0;
+  for (const BlockIndex& index : block_indices) {
+    const Point center =
+        voxblox::getOriginPointFromGridIndex(index, block_size) + half_block;
+    if ((center - position_S).norm() <= radius) {
+      continue;
+    }
+    if (spill_file_) {
+      // Blocks that were spilled before and allocated again are combined.
+      if (spilled_blocks_.find(index) != spilled_blocks_.end()) {
+        restoreBlock(index, layer, TsdfLayer::BlockMergingStrategy::kCombine);
+      }
+      if (!spillBlock(*layer, index)) {
+        continue;
+      }
+    }
+    BlockPool<TsdfVoxel>::getGlobalInstance()->removeBlock(index, layer);
+    submap->getVoxelMasksPtr()->remove(index);
+    if (submap->hasClassLayer()) {
+      submap->getClassLayerPtr()->removeBlock(index);
+    }
+    submap->getMeshLayerPtr()->removeMesh(index);
+    submap->recordRemovedBlock(index);
+    num_removed++;
+  }
+
+  // Restore spilled blocks inside the window.
+  int num_restored = 0;
+  if (!spilled_blocks_.empty()) {
+    const int radius_in_blocks = std::ceil(radius / block_size);
+    const BlockIndex center_index =
+        voxblox::getGridIndexFromPoint<BlockIndex>(position_S,
+                                                   1.f / block_size);
+    BlockIndex index;
+    for (int x = -radius_in_blocks; x <= radius_in_blocks; ++x) {
+      for (int y = -radius_in_blocks; y <= radius_in_blocks; ++y) {
+        for (int z = -radius_in_blocks; z <= radius_in_blocks; ++z) {
+          index = center_index + BlockIndex(x, y, z);
+          const Point center =
+              voxblox::getOriginPointFromGridIndex(index, block_size) +
+              half_block;
+          if ((center - position_S).norm() <= radius &&
+              spilled_blocks_.find(index) != spilled_blocks_.end() &&
+              restoreBlock(index, layer,
+                           TsdfLayer::BlockMergingStrategy::kCombine)) {
+            spilled_blocks_.erase(index);
+            num_restored++;
+          }
+        }
+      }
+    }
+  }
+  if (num_removed > 0 || num_restored > 0) {
+    submap->updateBoundingVolume();
+  }
+  LOG_IF(INFO, config_.verbosity >= 3 && (num_removed > 0 || num_restored > 0))
+      << "Rolling freespace window removed " << num_removed
+      << " and restored " << num_restored << " blocks ("
+      << layer->getNumberOfAllocatedBlocks() << " blocks in the window, "
+      << spilled_blocks_.size() << " spilled).";
+}
+
+bool MonolithicFreespaceAllocator::spillBlock(const TsdfLayer& layer,
+                                              const BlockIndex& index) {
+  std::lock_guard<std::mutex> lock(spill_file_->mutex());
+  std::fstream* stream = spill_file_->stream();
+  if (!spill_file_->isOpen()) {
+    return false;
+  }
+  voxblox::BlockProto proto;
+  layer.getBlockByIndex(index).getProto(&proto);
+  stream->clear();
+  stream->seekp(0, std::ios::end);
+  const uint64_t offset = stream->tellp();
+  if (!writeProtoMsgToStream(proto, stream)) {
+    LOG(ERROR) << "Could not spill freespace block to '"
+               << spill_file_->getFilePath() << "'.";
+    return false;
+  }
+  spilled_blocks_[index] = offset;
+  return true;
+}
+
+bool MonolithicFreespaceAllocator::restoreBlock(
+    const BlockIndex& index, TsdfLayer* layer,
+    TsdfLayer::BlockMergingStrategy strategy) {
+  auto it = spilled_blocks_.find(index);
+  if (it == spilled_blocks_.end()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(spill_file_->mutex());
+  std::fstream* stream = spill_file_->stream();
+  stream->clear();
+  uint64_t offset = it->second;
+  voxblox::BlockProto proto;
+  if (!voxblox::utils::readProtoMsgFromStream(stream, &proto, &offset) ||
+      !layer->addBlockFromProto(proto, strategy)) {
+    LOG(ERROR) << "Could not restore freespace block from '"
+               << spill_file_->getFilePath() << "'.";
+    return false;
+  }
+  layer->getBlockByIndex(index).setUpdatedAll();
+  return true;
+}
+
 }  // namespace panoptic_mapping
@@ -1,5 +1,9 @@
 #include "panoptic_mapping/submap_allocation/semantic_submap_allocator.h"
 
+#include <memory>
+#include <utility>
+#include <vector>
+
 namespace panoptic_mapping {
 
 config_utilities::Factory::RegistrationRos<SubmapAllocatorBase,
@@ -25,6 +29,9 @@ void SemanticSubmapAllocator::Config::setupParamsAndPrinting() {
   setupParam("background_voxel_size", &background_voxel_size);
   setupParam("unknown_voxel_size", &unknown_voxel_size);
   setupParam("truncation_distance", &truncation_distance);
+  setupParam("store_instance_color", &store_instance_color);
+  setupParam("store_background_color", &store_background_color);
+  setupParam("store_unknown_color", &store_unknown_color);
 }
 
 SemanticSubmapAllocator::SemanticSubmapAllocator(const Config& config,
@@ -38,42 +45,86 @@ Submap* SemanticSubmapAllocator::allocateSubmap(SubmapCollection* submaps,
                                                 InputData* /* input */,
                                                 int input_id,
                                                 const LabelEntry& label) {
-  Submap::Config config = config_.submap;
+  Submap* new_submap = submaps->createSubmap(getSubmapConfig(label));
+  setLabel(label, new_submap);
+  return new_submap;
+}
 
-  // Setup the voxel size.
+std::vector<Submap*> SemanticSubmapAllocator::allocateSubmaps(
+    SubmapCollection* submaps, InputData* /* input */,
+    const std::vector<int>& input_ids, const std::vector<LabelEntry>& labels) {
+  CHECK_EQ(input_ids.size(), labels.size());
+  std::vector<std::shared_ptr<const Submap::Config>> configs;
+  configs.reserve(labels.size());
+  for (const LabelEntry& label : labels) {
+    configs.push_back(getSubmapConfig(label));
+  }
+  std::vector<Submap*> new_submaps = submaps->createSubmaps(configs);
+  for (size_t i = 0; i < new_submaps.size(); ++i) {
+    setLabel(labels[i], new_submaps[i]);
+  }
+  return new_submaps;
+}
+
+float SemanticSubmapAllocator::getVoxelSize(const LabelEntry& label) const {
   switch (label.label) {
     case PanopticLabel::kInstance: {
       if (label.size == "L") {
-        config.voxel_size = config_.large_instance_voxel_size;
+        return config_.large_instance_voxel_size;
       } else if (label.size == "S") {
-        config.voxel_size = config_.small_instance_voxel_size;
-      } else {
-        config.voxel_size = config_.medium_instance_voxel_size;
+        return config_.small_instance_voxel_size;
       }
-      break;
+      return config_.medium_instance_voxel_size;
     }
     case PanopticLabel::kBackground: {
-      config.voxel_size = config_.background_voxel_size;
-      break;
+      return config_.background_voxel_size;
     }
     default: {
-      config.voxel_size = config_.unknown_voxel_size;
-      break;
+      return config_.unknown_voxel_size;
     }
   }
+}
 
-  // Set the truncation distance.
-  config.truncation_distance = config_.truncation_distance;
-  if (config.truncation_distance < 0.f) {
-    config.truncation_distance *= -config.voxel_size;
+bool SemanticSubmapAllocator::storesColor(const LabelEntry& label) const {
+  switch (label.label) {
+    case PanopticLabel::kInstance: {
+      return config_.store_instance_color;
+    }
+    case PanopticLabel::kBackground: {
+      return config_.store_background_color;
+    }
+    default: {
+      return config_.store_unknown_color;
+    }
   }
+}
 
-  // Create the submap.
-  Submap* new_submap = submaps->createSubmap(config);
-  new_submap->setClassID(label.class_id);
-  new_submap->setLabel(label.label);
-  new_submap->setName(label.name);
-  return new_submap;
+void SemanticSubmapAllocator::setLabel(const LabelEntry& label,
+                                       Submap* submap) {
+  submap->setClassID(label.class_id);
+  submap->setLabel(label.label);
+  submap->setName(label.name);
+}
+
+const std::shared_ptr<const Submap::Config>&
+SemanticSubmapAllocator::getSubmapConfig(const LabelEntry& label) {
+  const float voxel_size = getVoxelSize(label);
+  const bool store_color = storesColor(label);
+  std::shared_ptr<const Submap::Config>& result =
+      submap_configs_[std::make_pair(voxel_size, store_color)];
+  if (!result) {
+    Submap::Config config = config_.submap;
+    config.voxel_size = voxel_size;
+    config.store_color = store_color;
+
+    // Set the truncation distance.
+    config.truncation_distance = config_.truncation_distance;
+    if (config.truncation_distance < 0.f) {
+      config.truncation_distance *= -config.voxel_size;
+    }
+    result = std::make_shared<const Submap::Config>(config.checkValid());
+  }
+  return result;
 }
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,166 @@
+#include "panoptic_mapping/tools/esdf_map.h"
+
+#include <chrono>
+#include <memory>
+
+#include <voxblox/integrator/esdf_integrator.h>
+#include <voxblox/interpolator/interpolator.h>
+
+namespace panoptic_mapping {
+
+void EsdfMap::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("max_distance", &max_distance, "m");
+  setupParam("default_distance", &default_distance, "m");
+  setupParam("min_distance", &min_distance, "m");
+  setupParam("min_weight", &min_weight);
+  setupParam("full_euclidean_distance", &full_euclidean_distance);
+}
+
+void EsdfMap::Config::checkParams() const {
+  checkParamGT(max_distance, 0.f, "max_distance");
+  checkParamGE(default_distance, max_distance, "default_distance");
+  checkParamGE(min_distance, 0.f, "min_distance");
+  checkParamGE(min_weight, 0.f, "min_weight");
+}
+
+EsdfMap::EsdfMap(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+void EsdfMap::update(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  const voxblox::IndexSet changed_blocks = takeChangedBlocks(submaps);
+  update(*submaps, changed_blocks);
+}
+
+voxblox::IndexSet EsdfMap::takeChangedBlocks(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  const int id = submaps->getActiveFreeSpaceSubmapID();
+  if (!submaps->submapIdExists(id)) {
+    return voxblox::IndexSet();
+  }
+  return submaps->getSubmapPtr(id)->takeChangedBlocks(
+      Submap::ChangeConsumer::kEsdf);
+}
+
+void EsdfMap::update(const SubmapCollection& submaps,
+                     const voxblox::IndexSet& changed_blocks) {
+  Timer timer("tools/esdf_map/update");
+  auto t_start = std::chrono::high_resolution_clock::now();
+  const int id = submaps.getActiveFreeSpaceSubmapID();
+  if (!submaps.submapIdExists(id)) {
+    esdf_layer_.reset();
+    submap_id_ = -1;
+    return;
+  }
+  const Submap& submap = submaps.getSubmap(id);
+  const TsdfLayer& tsdf_layer = submap.getTsdfLayer();
+  const CollapsedTsdfBlocks* collapsed = submap.getCollapsedBlocks();
+
+  // Start over if the free space submap changed. The ESDF is stored in submap
+  // frame, so pose corrections of the submap only change the lookups.
+  T_M_S_ = submap.getT_M_S();
+  const bool reset =
+      !esdf_layer_ || id != submap_id_ ||
+      esdf_layer_->voxel_size() != tsdf_layer.voxel_size() ||
+      esdf_layer_->voxels_per_side() != tsdf_layer.voxels_per_side();
+  voxblox::BlockIndexList blocks;
+  size_t num_collapsed_blocks = 0;
+  if (reset) {
+    esdf_layer_ = std::make_unique<EsdfLayer>(tsdf_layer.voxel_size(),
+                                              tsdf_layer.voxels_per_side());
+    submap_id_ = id;
+    tsdf_layer.getAllAllocatedBlocks(&blocks);
+    if (collapsed) {
+      for (const auto& index_voxel_pair : collapsed->getBlocks()) {
+        blocks.push_back(index_voxel_pair.first);
+      }
+      num_collapsed_blocks = collapsed->size();
+    }
+  } else {
+    for (const BlockIndex& index : changed_blocks) {
+      if (tsdf_layer.hasBlock(index)) {
+        blocks.push_back(index);
+      } else if (collapsed && collapsed->getVoxel(index)) {
+        blocks.push_back(index);
+        num_collapsed_blocks++;
+      } else {
+        // The block was removed from the map, so its space is unknown.
+        esdf_layer_->removeBlock(index);
+      }
+    }
+  }
+  if (blocks.empty()) {
+    return;
+  }
+
+  // Collapsed blocks are not part of the TSDF layer. If any are updated, the
+  // integrator reads from a layer that shares the allocated blocks and holds
+  // the collapsed blocks expanded. The ESDF integrator only reads the TSDF.
+  std::unique_ptr<TsdfLayer> expanded_layer;
+  TsdfLayer* input_layer = const_cast<TsdfLayer*>(&tsdf_layer);
+  if (num_collapsed_blocks > 0) {
+    expanded_layer = std::make_unique<TsdfLayer>(tsdf_layer.voxel_size(),
+                                                 tsdf_layer.voxels_per_side());
+    for (const BlockIndex& index : blocks) {
+      TsdfBlock::ConstPtr block = tsdf_layer.getBlockPtrByIndex(index);
+      if (block) {
+        expanded_layer->insertBlock(
+            {index, std::const_pointer_cast<TsdfBlock>(block)});
+      } else {
+        CollapsedTsdfBlocks::expandBlock(index, *collapsed->getVoxel(index),
+                                         expanded_layer.get());
+      }
+    }
+    input_layer = expanded_layer.get();
+  }
+
+  // Propagate the distances.
+  voxblox::EsdfIntegrator::Config integrator_config;
+  integrator_config.max_distance_m = config_.max_distance;
+  integrator_config.default_distance_m = config_.default_distance;
+  integrator_config.min_distance_m = config_.min_distance;
+  integrator_config.min_weight = config_.min_weight;
+  integrator_config.full_euclidean_distance = config_.full_euclidean_distance;
+  voxblox::EsdfIntegrator integrator(integrator_config, input_layer,
+                                     esdf_layer_.get());
+  integrator.updateFromTsdfBlocks(blocks, !reset);
+  auto t_end = std::chrono::high_resolution_clock::now();
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << (reset ? "Computed" : "Updated") << " the ESDF from " << blocks.size()
+      << " blocks in "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start)
+             .count()
+      << "ms.";
+}
+
+bool EsdfMap::getDistance(const Point& position, float* distance) const {
+  CHECK_NOTNULL(distance);
+  if (!esdf_layer_) {
+    return false;
+  }
+  const voxblox::Interpolator<EsdfVoxel> interpolator(esdf_layer_.get());
+  return interpolator.getDistance(T_M_S_.inverse() * position, distance, true);
+}
+
+bool EsdfMap::getDistanceAndGradient(const Point& position, float* distance,
+                                     Point* gradient) const {
+  CHECK_NOTNULL(distance);
+  CHECK_NOTNULL(gradient);
+  if (!esdf_layer_) {
+    return false;
+  }
+  const voxblox::Interpolator<EsdfVoxel> interpolator(esdf_layer_.get());
+  Point gradient_S;
+  if (!interpolator.getAdaptiveDistanceAndGradient(T_M_S_.inverse() * position,
+                                                   distance, &gradient_S)) {
+    return false;
+  }
+  *gradient = T_M_S_.getRotation().rotate(gradient_S);
+  return true;
+}
+
+}  // namespace panoptic_mapping
@@ -4,6 +4,7 @@
 
 #include <fstream>
 #include <iomanip>
+#include <memory>
 #include <string>
 #include <unordered_set>
 
@@ -45,14 +46,7 @@ void EvaluationDataWriter::setupLogFile() {
     outfile_name_ = output_path_ + "/" +
                     (config_.log_data_writer_config.file_name.empty()
                          ? "log"
-                         : config_.log_data_writer_config.file_name) +
-                    ".csv";
-    // Setup output file.
-    outfile_.open(outfile_name_);
-    if (!outfile_.is_open()) {
-      LOG(ERROR) << "Could not open data output file '" << outfile_name_
-                 << "'.";
-    }
+                         : config_.log_data_writer_config.file_name);
   } else {
     // Setup the standard log file.
     LogDataWriter::setupLogFile();
@@ -63,25 +57,36 @@ void EvaluationDataWriter::setupEvaluations() {
   LogDataWriter::setupEvaluations();
   // Additional evaluations of the evaluation writer.
   if (config_.store_map_every_n_frames > 0) {
-    writeEntry("SavedMapName [-]");
-    evaluations_.emplace_back([this](const SubmapCollection& submaps) {
-      this->storeSubmaps(submaps);
-    });
+    addColumn("SavedMapName [-]", ColumnType::kText);
+    evaluations_.emplace_back(
+        [this](const SubmapCollection& submaps, Entry* entry) {
+          this->storeSubmaps(submaps, entry);
+        });
   }
 }
 
-void EvaluationDataWriter::storeSubmaps(const SubmapCollection& submaps) {
+void EvaluationDataWriter::storeSubmaps(const SubmapCollection& submaps,
+                                        Entry* entry) {
   store_submap_frame_++;
   if (store_submap_frame_ < config_.store_map_every_n_frames) {
-    writeEntry("");
+    entry->values.emplace_back(std::string());
     return;
   }
   store_submap_frame_ = 0;
   std::stringstream ss;
   ss << std::setw(6) << std::setfill('0') << store_submap_counter_;
   store_submap_counter_++;
-  submaps.saveToFile(output_path_ + "/" + ss.str());
-  writeEntry(ss.str());
+  const std::string file_name = output_path_ + "/" + ss.str();
+  if (isAsynchronous()) {
+    // Copy the map such that it can be saved on the writer thread.
+    std::shared_ptr<const SubmapCollection> copy = submaps.clone();
+    entry->jobs.emplace_back([copy, file_name]() {
+      copy->saveToFile(file_name);
+    });
+  } else {
+    submaps.saveToFile(file_name);
+  }
+  entry->values.emplace_back(ss.str());
 }
 
 }  // namespace panoptic_mapping
@@ -0,0 +1,117 @@
+#include "panoptic_mapping/tools/flat_dataset_reader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace panoptic_mapping {
+
+void FlatDatasetReader::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("data_path", &data_path);
+  setupParam("max_frames", &max_frames);
+}
+
+void FlatDatasetReader::Config::checkParams() const {
+  checkParamCond(!data_path.empty(), "'data_path' must be set.");
+  checkParamGE(max_frames, 0, "max_frames");
+}
+
+FlatDatasetReader::FlatDatasetReader(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+  // Read all frame IDs and timestamps.
+  const std::string stamps_file = config_.data_path + "/timestamps.csv";
+  std::ifstream file(stamps_file);
+  if (!file.is_open()) {
+    LOG(ERROR) << "No timestamp file '" << stamps_file << "' found.";
+    return;
+  }
+  std::vector<std::string> ids;
+  std::vector<double> times;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::stringstream ss(line);
+    std::string id, time;
+    if (!std::getline(ss, id, ',') || !std::getline(ss, time, ',') ||
+        id == "ImageID") {
+      continue;
+    }
+    ids.push_back(id);
+    times.push_back(std::stod(time) / 1e9);
+  }
+
+  // Sort the frames by time.
+  std::vector<size_t> order(ids.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&times](size_t a, size_t b) {
+    return times[a] < times[b];
+  });
+  size_t num_frames = order.size();
+  if (config_.max_frames > 0) {
+    num_frames = std::min(num_frames, static_cast<size_t>(config_.max_frames));
+  }
+  for (size_t i = 0; i < num_frames; ++i) {
+    frame_ids_.push_back(ids[order[i]]);
+    timestamps_.push_back(times[order[i]]);
+  }
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Found " << frame_ids_.size() << " frames in '" << config_.data_path
+      << "'.";
+}
+
+bool FlatDatasetReader::readFrame(size_t index, InputData* input) const {
+  CHECK_NOTNULL(input);
+  CHECK_LT(index, frame_ids_.size());
+  const std::string file_id = config_.data_path + "/" + frame_ids_[index];
+
+  // Images.
+  const cv::Mat depth_image =
+      cv::imread(file_id + "_depth.tiff", cv::IMREAD_UNCHANGED);
+  const cv::Mat color_image =
+      cv::imread(file_id + "_color.png", cv::IMREAD_COLOR);
+  const cv::Mat segmentation_image =
+      cv::imread(file_id + "_segmentation.png", cv::IMREAD_COLOR);
+  if (depth_image.empty() || depth_image.type() != CV_32FC1 ||
+      color_image.empty() || segmentation_image.empty()) {
+    LOG_IF(WARNING, config_.verbosity >= 1)
+        << "Could not read the images of frame '" << file_id << "'.";
+    return false;
+  }
+
+  // The IDs are stored in the first channel of the segmentation image.
+  cv::Mat id_image;
+  cv::extractChannel(segmentation_image, id_image, 0);
+  id_image.convertTo(id_image, CV_32SC1);
+
+  // Pose as row-major 4x4 matrix T_M_C.
+  std::ifstream pose_file(file_id + "_pose.txt");
+  Eigen::Matrix<FloatingPoint, 4, 4> T;
+  for (int i = 0; i < 16; ++i) {
+    if (!(pose_file >> T(i / 4, i % 4))) {
+      LOG_IF(WARNING, config_.verbosity >= 1)
+          << "Could not read the pose of frame '" << file_id << "'.";
+      return false;
+    }
+  }
+  const Transformation T_M_C(
+      Transformation::Rotation::fromApproximateRotationMatrix(
+          T.topLeftCorner<3, 3>()),
+      T.topRightCorner<3, 1>());
+
+  input->setDepthImage(depth_image);
+  input->setColorImage(color_image);
+  input->setIdImage(id_image);
+  input->setT_M_C(T_M_C);
+  input->setTimeStamp(timestamps_[index]);
+  return true;
+}
+
+}  // namespace panoptic_mapping
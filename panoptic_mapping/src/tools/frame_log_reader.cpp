@@ -0,0 +1,181 @@
+#include "panoptic_mapping/tools/frame_log_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <opencv2/core.hpp>
+
+namespace panoptic_mapping {
+
+using frame_log::FileHeader;
+using frame_log::FrameHeader;
+using frame_log::ImageRecord;
+using frame_log::LabelRecord;
+
+void FrameLogReader::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("file_path", &file_path);
+  setupParam("max_frames", &max_frames);
+}
+
+void FrameLogReader::Config::checkParams() const {
+  checkParamCond(!file_path.empty(), "'file_path' must be set.");
+  checkParamGE(max_frames, 0, "max_frames");
+}
+
+FrameLogReader::Mapping::~Mapping() {
+  if (data) {
+    munmap(const_cast<char*>(data), size);
+  }
+}
+
+FrameLogReader::FrameLogReader(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+  // Map the log.
+  const int fd = open(config_.file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open frame log '" << config_.file_path
+               << "': " << std::strerror(errno);
+    return;
+  }
+  struct stat file_stat;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 &&
+      static_cast<size_t>(file_stat.st_size) >= frame_log::framesOffset()) {
+    data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Could not map frame log '" << config_.file_path << "'.";
+    return;
+  }
+  auto mapping = std::make_shared<Mapping>();
+  mapping->data = static_cast<const char*>(data);
+  mapping->size = file_stat.st_size;
+  madvise(data, mapping->size, MADV_SEQUENTIAL);
+  const auto file_header = reinterpret_cast<const FileHeader*>(mapping->data);
+  if (file_header->magic != frame_log::kMagic ||
+      file_header->version != frame_log::kVersion) {
+    LOG(ERROR) << "'" << config_.file_path
+               << "' is not a frame log of version " << frame_log::kVersion
+               << ".";
+    return;
+  }
+  mapping_ = std::move(mapping);
+
+  // Find all complete frames.
+  size_t offset = frame_log::framesOffset();
+  while (offset + sizeof(FrameHeader) <= mapping_->size) {
+    const auto header =
+        reinterpret_cast<const FrameHeader*>(mapping_->data + offset);
+    if (header->size < sizeof(FrameHeader) ||
+        header->size > mapping_->size - offset) {
+      break;
+    }
+    frame_offsets_.push_back(offset);
+    if (config_.max_frames > 0 &&
+        frame_offsets_.size() >= static_cast<size_t>(config_.max_frames)) {
+      break;
+    }
+    offset += header->size;
+  }
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Found " << frame_offsets_.size() << " frames in '"
+      << config_.file_path << "'.";
+}
+
+bool FrameLogReader::readFrame(size_t index, InputData* input) const {
+  CHECK_NOTNULL(input);
+  CHECK_LT(index, frame_offsets_.size());
+  const char* frame = mapping_->data + frame_offsets_[index];
+  const auto header = reinterpret_cast<const FrameHeader*>(frame);
+  const size_t records_size = header->num_images * sizeof(ImageRecord) +
+                              header->num_labels * sizeof(LabelRecord) +
+                              header->frame_name_size;
+  if (records_size > header->size - sizeof(FrameHeader)) {
+    LOG_IF(WARNING, config_.verbosity >= 1)
+        << "Frame " << index << " of the frame log is invalid.";
+    return false;
+  }
+
+  // Images, which need to be within the frame.
+  const auto records =
+      reinterpret_cast<const ImageRecord*>(frame + sizeof(FrameHeader));
+  for (uint32_t i = 0; i < header->num_images; ++i) {
+    const ImageRecord& record = records[i];
+    const size_t image_size = static_cast<size_t>(record.rows) * record.cols *
+                              CV_ELEM_SIZE(record.cv_type);
+    if (record.rows < 0 || record.cols < 0 ||
+        record.data_offset > header->size ||
+        image_size > header->size - record.data_offset) {
+      LOG_IF(WARNING, config_.verbosity >= 1)
+          << "Image " << i << " of frame " << index
+          << " of the frame log is invalid.";
+      return false;
+    }
+    const cv::Mat image(record.rows, record.cols, record.cv_type,
+                        const_cast<char*>(frame + record.data_offset));
+    switch (static_cast<InputData::InputType>(record.input_type)) {
+      case InputData::InputType::kDepthImage:
+        input->setDepthImage(image);
+        break;
+      case InputData::InputType::kColorImage:
+        input->setColorImage(image);
+        break;
+      case InputData::InputType::kSegmentationImage:
+        input->setIdImage(image.clone());
+        break;
+      case InputData::InputType::kUncertaintyImage:
+        input->setUncertaintyImage(image);
+        break;
+      default:
+        LOG_IF(WARNING, config_.verbosity >= 1)
+            << "Skipping image of unsupported type " << record.input_type
+            << " in frame " << index << ".";
+    }
+  }
+  input->addBufferOwner(mapping_);
+
+  // Labels and frame name.
+  const auto labels = reinterpret_cast<const LabelRecord*>(
+      frame + sizeof(FrameHeader) + header->num_images * sizeof(ImageRecord));
+  if (header->num_labels > 0) {
+    DetectronLabels detectron_labels;
+    for (uint32_t i = 0; i < header->num_labels; ++i) {
+      DetectronLabel& label = detectron_labels[labels[i].id];
+      label.id = labels[i].id;
+      label.is_thing = labels[i].is_thing;
+      label.category_id = labels[i].category_id;
+      label.instance_id = labels[i].instance_id;
+      label.score = labels[i].score;
+    }
+    input->setDetectronLabels(detectron_labels);
+  }
+  const char* frame_name =
+      reinterpret_cast<const char*>(labels + header->num_labels);
+  input->setFrameName(std::string(frame_name, header->frame_name_size));
+
+  // Pose and time.
+  const Transformation T_M_C(
+      Transformation::Rotation(
+          header->T_M_C_rotation[0], header->T_M_C_rotation[1],
+          header->T_M_C_rotation[2], header->T_M_C_rotation[3]),
+      Transformation::Position(header->T_M_C_position[0],
+                               header->T_M_C_position[1],
+                               header->T_M_C_position[2]));
+  input->setT_M_C(T_M_C);
+  input->setTimeStamp(header->timestamp);
+  return true;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,146 @@
+#include "panoptic_mapping/tools/frame_log_writer.h"
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace panoptic_mapping {
+
+using frame_log::FileHeader;
+using frame_log::FrameHeader;
+using frame_log::ImageRecord;
+using frame_log::LabelRecord;
+
+void FrameLogWriter::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("file_path", &file_path);
+  setupParam("max_frames", &max_frames);
+}
+
+void FrameLogWriter::Config::checkParams() const {
+  checkParamCond(!file_path.empty(), "'file_path' must be set.");
+  checkParamGE(max_frames, 0, "max_frames");
+}
+
+FrameLogWriter::FrameLogWriter(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+  file_.open(config_.file_path,
+             std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file_.is_open()) {
+    LOG(ERROR) << "Could not open frame log '" << config_.file_path
+               << "' for writing.";
+    return;
+  }
+  std::vector<char> header(frame_log::framesOffset(), 0);
+  FileHeader file_header;
+  file_header.magic = frame_log::kMagic;
+  file_header.version = frame_log::kVersion;
+  file_header.padding = 0;
+  std::memcpy(header.data(), &file_header, sizeof(FileHeader));
+  file_.write(header.data(), header.size());
+}
+
+bool FrameLogWriter::writeFrame(const InputData& input) {
+  if (!file_.is_open() ||
+      (config_.max_frames > 0 &&
+       num_frames_ >= static_cast<size_t>(config_.max_frames))) {
+    return false;
+  }
+  Timer timer("frame_log/write");
+
+  // Recorded images. Non-continuous images are copied.
+  std::vector<std::pair<InputData::InputType, cv::Mat>> images;
+  const std::vector<std::pair<InputData::InputType, const cv::Mat*>>
+      candidates = {
+          {InputData::InputType::kDepthImage, &input.depthImage()},
+          {InputData::InputType::kColorImage, &input.colorImage()},
+          {InputData::InputType::kSegmentationImage, &input.idImage()},
+          {InputData::InputType::kUncertaintyImage,
+           &input.uncertaintyImage()}};
+  for (const auto& type_image : candidates) {
+    if (input.has(type_image.first) && !type_image.second->empty()) {
+      images.emplace_back(type_image.first,
+                          type_image.second->isContinuous()
+                              ? *type_image.second
+                              : type_image.second->clone());
+    }
+  }
+  const DetectronLabels& labels = input.detectronLabels();
+  const std::string& frame_name = input.sensorFrameName();
+
+  // Compute the layout of the frame.
+  size_t size = sizeof(FrameHeader) + images.size() * sizeof(ImageRecord) +
+                labels.size() * sizeof(LabelRecord) + frame_name.size();
+  std::vector<ImageRecord> records(images.size());
+  for (size_t i = 0; i < images.size(); ++i) {
+    const cv::Mat& image = images[i].second;
+    records[i].input_type = static_cast<uint32_t>(images[i].first);
+    records[i].rows = image.rows;
+    records[i].cols = image.cols;
+    records[i].cv_type = image.type();
+    records[i].data_offset = frame_log::alignUp(size);
+    size = records[i].data_offset + image.total() * image.elemSize();
+  }
+  size = frame_log::alignUp(size);
+
+  // Serialize the frame.
+  buffer_.assign(size, 0);
+  FrameHeader header;
+  header.size = size;
+  header.timestamp = input.timestamp();
+  const Transformation& T_M_C = input.T_M_C();
+  for (int i = 0; i < 3; ++i) {
+    header.T_M_C_position[i] = T_M_C.getPosition()[i];
+  }
+  header.T_M_C_rotation[0] = T_M_C.getRotation().w();
+  header.T_M_C_rotation[1] = T_M_C.getRotation().x();
+  header.T_M_C_rotation[2] = T_M_C.getRotation().y();
+  header.T_M_C_rotation[3] = T_M_C.getRotation().z();
+  header.num_images = images.size();
+  header.num_labels = labels.size();
+  header.frame_name_size = frame_name.size();
+  header.padding = 0;
+  char* data = buffer_.data();
+  std::memcpy(data, &header, sizeof(FrameHeader));
+  size_t offset = sizeof(FrameHeader);
+  std::memcpy(data + offset, records.data(),
+              records.size() * sizeof(ImageRecord));
+  offset += records.size() * sizeof(ImageRecord);
+  for (const auto& id_label : labels) {
+    const DetectronLabel& label = id_label.second;
+    LabelRecord record;
+    record.id = label.id;
+    record.is_thing = label.is_thing;
+    record.category_id = label.category_id;
+    record.instance_id = label.instance_id;
+    record.score = label.score;
+    std::memcpy(data + offset, &record, sizeof(LabelRecord));
+    offset += sizeof(LabelRecord);
+  }
+  std::memcpy(data + offset, frame_name.data(), frame_name.size());
+  for (size_t i = 0; i < images.size(); ++i) {
+    const cv::Mat& image = images[i].second;
+    std::memcpy(data + records[i].data_offset, image.data,
+                image.total() * image.elemSize());
+  }
+
+  // Write the frame. Each frame is flushed so interrupted recordings stay
+  // readable up to the last complete frame.
+  file_.write(buffer_.data(), buffer_.size());
+  file_.flush();
+  if (!file_.good()) {
+    LOG(ERROR) << "Could not write frame " << num_frames_ << " to frame log '"
+               << config_.file_path << "'.";
+    file_.close();
+    return false;
+  }
+  num_frames_++;
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Recorded frame " << num_frames_ << " (" << (size >> 10) << "kB).";
+  return true;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,144 @@
+#include "panoptic_mapping/tools/keyframe_selector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+namespace panoptic_mapping {
+
+void KeyframeSelector::Config::checkParams() const {
+  checkParamGE(min_translation, 0.f, "min_translation");
+  checkParamGE(min_rotation, 0.f, "min_rotation");
+  checkParamGE(min_segmentation_change, 0.f, "min_segmentation_change");
+  checkParamGT(segmentation_stride, 0, "segmentation_stride");
+  checkParamGE(max_frames_between_keyframes, 0,
+               "max_frames_between_keyframes");
+  checkParamGE(max_backlog, 0, "max_backlog");
+}
+
+void KeyframeSelector::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("min_translation", &min_translation, "m");
+  setupParam("min_rotation", &min_rotation, "deg");
+  setupParam("min_segmentation_change", &min_segmentation_change);
+  setupParam("segmentation_stride", &segmentation_stride, "px");
+  setupParam("max_frames_between_keyframes", &max_frames_between_keyframes);
+  setupParam("track_skipped_frames", &track_skipped_frames);
+  setupParam("max_backlog", &max_backlog);
+}
+
+KeyframeSelector::KeyframeSelector(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+KeyframeSelector::Decision KeyframeSelector::processInput(
+    const InputData& input, size_t backlog) {
+  if (isKeyframe(input, backlog)) {
+    has_keyframe_ = true;
+    T_M_C_keyframe_ = input.T_M_C();
+    if (input.has(InputData::InputType::kSegmentationImage)) {
+      sampled_ids_keyframe_ = sampleIdImage(input.idImage());
+    } else {
+      sampled_ids_keyframe_ = cv::Mat();
+    }
+    frames_since_keyframe_ = 0;
+    return Decision::kKeyframe;
+  }
+  frames_since_keyframe_++;
+  const bool overloaded = config_.max_backlog > 0 &&
+                          backlog > static_cast<size_t>(config_.max_backlog);
+  Decision decision = config_.track_skipped_frames && !overloaded
+                          ? Decision::kTrackOnly
+                          : Decision::kSkip;
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Frame is no keyframe (" << decisionToString(decision)
+      << ", backlog: " << backlog << ").";
+  return decision;
+}
+
+void KeyframeSelector::reset() {
+  has_keyframe_ = false;
+  sampled_ids_keyframe_ = cv::Mat();
+  frames_since_keyframe_ = 0;
+}
+
+bool KeyframeSelector::isKeyframe(const InputData& input,
+                                  size_t backlog) const {
+  if (!has_keyframe_) {
+    return true;
+  }
+  if (config_.max_frames_between_keyframes > 0 &&
+      frames_since_keyframe_ >= config_.max_frames_between_keyframes) {
+    return true;
+  }
+
+  // Frames waiting beyond the allowed backlog raise all thresholds.
+  float scale = 1.f;
+  if (config_.max_backlog > 0 &&
+      backlog > static_cast<size_t>(config_.max_backlog)) {
+    scale += static_cast<float>(backlog) - config_.max_backlog;
+  }
+
+  // Camera motion.
+  const Transformation T_K_C = T_M_C_keyframe_.inverse() * input.T_M_C();
+  if (T_K_C.getPosition().norm() >= scale * config_.min_translation) {
+    return true;
+  }
+  const float angle =
+      Eigen::AngleAxisf(T_K_C.getRotation().toImplementation()).angle();
+  if (angle * 180.f / M_PI >= scale * config_.min_rotation) {
+    return true;
+  }
+
+  // Segmentation change.
+  if (!sampled_ids_keyframe_.empty() &&
+      input.has(InputData::InputType::kSegmentationImage) &&
+      computeSegmentationChange(input.idImage()) >=
+          scale * config_.min_segmentation_change) {
+    return true;
+  }
+  return false;
+}
+
+float KeyframeSelector::computeSegmentationChange(
+    const cv::Mat& id_image) const {
+  const cv::Mat sampled_ids = sampleIdImage(id_image);
+  if (sampled_ids.size() != sampled_ids_keyframe_.size()) {
+    return 1.f;
+  }
+  const int num_changed =
+      cv::countNonZero(sampled_ids != sampled_ids_keyframe_);
+  return static_cast<float>(num_changed) /
+         static_cast<float>(std::max(sampled_ids.total(), size_t(1)));
+}
+
+cv::Mat KeyframeSelector::sampleIdImage(const cv::Mat& id_image) const {
+  // Copy the samples since trackers modify the segmentation in place.
+  const int stride = config_.segmentation_stride;
+  cv::Mat result((id_image.rows + stride - 1) / stride,
+                 (id_image.cols + stride - 1) / stride, CV_32SC1);
+  for (int v = 0; v < result.rows; ++v) {
+    for (int u = 0; u < result.cols; ++u) {
+      result.at<int>(v, u) = id_image.at<int>(v * stride, u * stride);
+    }
+  }
+  return result;
+}
+
+std::string KeyframeSelector::decisionToString(Decision decision) {
+  switch (decision) {
+    case Decision::kKeyframe:
+      return "keyframe";
+    case Decision::kTrackOnly:
+      return "track only";
+    case Decision::kSkip:
+      return "skip";
+  }
+  return "unknown decision";
+}
+
+}  // namespace panoptic_mapping
@@ -6,11 +6,30 @@
 #include <iomanip>
 #include <string>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <experimental/filesystem>
 
 namespace panoptic_mapping {
 
+namespace {
+
+constexpr uint32_t kBinaryLogMagic = 0x474c4d50;  // "PMLG"
+constexpr uint32_t kBinaryLogVersion = 1;
+
+template <typename T>
+void writeBinaryValue(const T& value, std::ofstream* stream) {
+  stream->write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void writeBinaryText(const std::string& text, std::ofstream* stream) {
+  writeBinaryValue(static_cast<uint32_t>(text.size()), stream);
+  stream->write(text.data(), text.size());
+}
+
+}  // namespace
+
 config_utilities::Factory::RegistrationRos<DataWriterBase, LogDataWriter>
     LogDataWriter::registration_("log");
 
@@ -19,7 +38,13 @@ void LogDataWriter::Config::setupParamsAndPrinting() {
   setupParam("output_directory", &output_directory);
   setupParam("file_name", &file_name);
   setupParam("evaluate_number_of_submaps", &evaluate_number_of_submaps);
+  setupParam("evaluate_number_of_active_submaps",
+             &evaluate_number_of_active_submaps);
   setupParam("evaluate_number_of_objects", &evaluate_number_of_objects);
+  setupParam("evaluate_memory_usage", &evaluate_memory_usage);
+  setupParam("asynchronous", &asynchronous);
+  setupParam("max_queued_entries", &max_queued_entries);
+  setupParam("binary_output", &binary_output);
 }
 
 void LogDataWriter::Config::checkParams() const {
@@ -28,6 +53,7 @@ void LogDataWriter::Config::checkParams() const {
   checkParamCond(
       stat(output_directory.c_str(), &buffer) == 0,
       "'output_directory' '" + output_directory + "' does not exist.");
+  checkParamGE(max_queued_entries, 0, "max_queued_entries");
 }
 
 LogDataWriter::LogDataWriter(const Config& config, bool print_config)
@@ -38,6 +64,14 @@ LogDataWriter::LogDataWriter(const Config& config, bool print_config)
 
 LogDataWriter::~LogDataWriter() {
   // NOTE(schmluk): Apparently the destructor doesn't get called from ROS usage.
+  if (writer_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      stop_writer_ = true;
+    }
+    queue_condition_.notify_all();
+    writer_thread_.join();
+  }
   if (outfile_.is_open()) {
     outfile_.close();
     LOG_IF(INFO, config_.verbosity >= 1)
@@ -51,11 +85,21 @@ void LogDataWriter::setup() {
   }
   // Setup the output file.
   setupLogFile();
+  outfile_name_.append(config_.binary_output ? ".panlog" : ".csv");
+  outfile_.open(outfile_name_, std::ios::out | std::ios::binary);
+  if (!outfile_.is_open()) {
+    LOG(ERROR) << "Could not open data output file '" << outfile_name_ << "'.";
+  }
 
   // Setup what to evaluate and log headers.
-  outfile_ << "Timestamp [s]";
+  addColumn("Timestamp [s]", ColumnType::kFloat);
   setupEvaluations();
-  outfile_ << std::endl;
+  writeHeader();
+
+  // Start the writer.
+  if (config_.asynchronous) {
+    writer_thread_ = std::thread(&LogDataWriter::writerLoop, this);
+  }
 
   // Finish.
   LOG_IF(INFO, config_.verbosity >= 1)
@@ -77,40 +121,49 @@ void LogDataWriter::setupLogFile() {
     outfile_name_.append("_");
   }
   outfile_name_.append(timestamp.str());
-  outfile_name_ = config_.output_directory + "/" + outfile_name_ + ".csv";
-
-  // Setup output file.
-  outfile_.open(outfile_name_);
-  if (!outfile_.is_open()) {
-    LOG(ERROR) << "Could not open data output file '" << outfile_name_ << "'.";
-  }
+  outfile_name_ = config_.output_directory + "/" + outfile_name_;
 }
 
 void LogDataWriter::setupEvaluations() {
   // Setup all data headers [with units] and evaluation functions to be used.
   if (config_.evaluate_number_of_submaps) {
-    writeEntry("NoSubmaps [1]");
-    evaluations_.emplace_back([this](const SubmapCollection& submaps) {
-      this->evaluateNumberOfSubmaps(submaps);
-    });
+    addColumn("NoSubmaps [1]", ColumnType::kInteger);
+    evaluations_.emplace_back(
+        [this](const SubmapCollection& submaps, Entry* entry) {
+          this->evaluateNumberOfSubmaps(submaps, entry);
+        });
   }
   if (config_.evaluate_number_of_active_submaps) {
-    writeEntry("NoActiveSubmaps [1]");
-    evaluations_.emplace_back([this](const SubmapCollection& submaps) {
-      this->evaluateNumberOfActiveSubmaps(submaps);
-    });
+    addColumn("NoActiveSubmaps [1]", ColumnType::kInteger);
+    evaluations_.emplace_back(
+        [this](const SubmapCollection& submaps, Entry* entry) {
+          this->evaluateNumberOfActiveSubmaps(submaps, entry);
+        });
   }
   if (config_.evaluate_number_of_objects) {
-    writeEntry("NoObjects [1]");
-    evaluations_.emplace_back([this](const SubmapCollection& submaps) {
-      this->evaluateNumberOfObjects(submaps);
-    });
+    addColumn("NoObjects [1]", ColumnType::kInteger);
+    evaluations_.emplace_back(
+        [this](const SubmapCollection& submaps, Entry* entry) {
+          this->evaluateNumberOfObjects(submaps, entry);
+        });
+  }
+  if (config_.evaluate_memory_usage) {
+    addColumn("TsdfMemory [MB]", ColumnType::kFloat);
+    addColumn("ClassMemory [MB]", ColumnType::kFloat);
+    addColumn("MeshMemory [MB]", ColumnType::kFloat);
+    addColumn("IsoSurfacePointMemory [MB]", ColumnType::kFloat);
+    addColumn("TotalMemory [MB]", ColumnType::kFloat);
+    addColumn("NoEvictedSubmaps [1]", ColumnType::kInteger);
+    evaluations_.emplace_back(
+        [this](const SubmapCollection& submaps, Entry* entry) {
+          this->evaluateMemoryUsage(submaps, entry);
+        });
   }
 }
 
-void LogDataWriter::writeEntry(const std::string& value) {
-  // Include leading separators (commas) here after timestamp.
-  outfile_ << "," << value;
+void LogDataWriter::addColumn(const std::string& name, ColumnType type) {
+  column_names_.push_back(name);
+  column_types_.push_back(type);
 }
 
 void LogDataWriter::writeData(double time_stamp,
@@ -120,36 +173,162 @@ void LogDataWriter::writeData(double time_stamp,
     setup();
   }
 
-  // Log the timestamp.
-  outfile_ << std::to_string(time_stamp);
-
-  // Perform all evaluations.
+  // Perform all evaluations. Only this part accesses the map.
+  Entry entry;
+  entry.time_stamp = time_stamp;
+  entry.values.reserve(column_names_.size() - 1);
   for (const auto& evaluation : evaluations_) {
-    evaluation(submaps);
+    evaluation(submaps, &entry);
+  }
+  CHECK_EQ(entry.values.size() + 1, column_names_.size())
+      << "Evaluations need to produce one value per column.";
+
+  if (!config_.asynchronous) {
+    std::vector<Entry> entries;
+    entries.emplace_back(std::move(entry));
+    writeEntries(&entries);
+    return;
+  }
+
+  // Hand the entry to the writer thread.
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (config_.max_queued_entries > 0 &&
+        queue_.size() >= static_cast<size_t>(config_.max_queued_entries)) {
+      num_dropped_entries_++;
+      LOG_EVERY_N(WARNING, 100)
+          << "The data writer can not keep up, dropped "
+          << num_dropped_entries_ << " entries so far.";
+      return;
+    }
+    queue_.emplace_back(std::move(entry));
+  }
+  queue_condition_.notify_one();
+}
+
+void LogDataWriter::writerLoop() {
+  std::vector<Entry> entries;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_condition_.wait(
+          lock, [this]() { return stop_writer_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;  // Stopped and all entries are written.
+      }
+      // Take all queued entries to write and flush them at once.
+      entries.reserve(queue_.size());
+      for (Entry& entry : queue_) {
+        entries.emplace_back(std::move(entry));
+      }
+      queue_.clear();
+    }
+    writeEntries(&entries);
+    entries.clear();
   }
+}
 
-  // Finish. This flushes the file buffer.
-  outfile_ << std::endl;
-  LOG_IF(INFO, config_.verbosity >= 2)
-      << "Wrote data entry for time '" << time_stamp << "'.";
+void LogDataWriter::writeHeader() {
+  if (config_.binary_output) {
+    writeBinaryValue(kBinaryLogMagic, &outfile_);
+    writeBinaryValue(kBinaryLogVersion, &outfile_);
+    writeBinaryValue(static_cast<uint32_t>(column_names_.size()), &outfile_);
+    for (size_t i = 0; i < column_names_.size(); ++i) {
+      writeBinaryValue(static_cast<uint8_t>(column_types_[i]), &outfile_);
+      writeBinaryText(column_names_[i], &outfile_);
+    }
+  } else {
+    for (size_t i = 0; i < column_names_.size(); ++i) {
+      outfile_ << (i == 0 ? "" : ",") << column_names_[i];
+    }
+    outfile_ << "\n";
+  }
+  outfile_.flush();
 }
 
-void LogDataWriter::evaluateNumberOfSubmaps(const SubmapCollection& submaps) {
-  writeEntry(std::to_string(submaps.size()));
+void LogDataWriter::writeEntries(std::vector<Entry>* entries) {
+  for (Entry& entry : *entries) {
+    for (const auto& job : entry.jobs) {
+      job();
+    }
+    entry.jobs.clear();
+  }
+  if (config_.binary_output) {
+    writeBinary(*entries);
+  } else {
+    for (const Entry& entry : *entries) {
+      writeText(entry);
+    }
+  }
+
+  // Flush once per batch of entries.
+  outfile_.flush();
+  LOG_IF(INFO, config_.verbosity >= 2 && !entries->empty())
+      << "Wrote " << entries->size() << " data entries up to time '"
+      << entries->back().time_stamp << "'.";
+}
+
+void LogDataWriter::writeText(const Entry& entry) {
+  std::string line = std::to_string(entry.time_stamp);
+  for (const Value& value : entry.values) {
+    // Include leading separators (commas) after the timestamp.
+    line.append(",");
+    if (const auto* integer = std::get_if<int64_t>(&value)) {
+      line.append(std::to_string(*integer));
+    } else if (const auto* number = std::get_if<double>(&value)) {
+      line.append(std::to_string(*number));
+    } else {
+      line.append(std::get<std::string>(value));
+    }
+  }
+  line.append("\n");
+  outfile_ << line;
+}
+
+void LogDataWriter::writeBinary(const std::vector<Entry>& entries) {
+  if (entries.empty()) {
+    return;
+  }
+  writeBinaryValue(static_cast<uint32_t>(entries.size()), &outfile_);
+  for (const Entry& entry : entries) {
+    writeBinaryValue(entry.time_stamp, &outfile_);
+  }
+  for (size_t column = 1; column < column_types_.size(); ++column) {
+    for (const Entry& entry : entries) {
+      const Value& value = entry.values[column - 1];
+      switch (column_types_[column]) {
+        case ColumnType::kInteger:
+          writeBinaryValue(std::get<int64_t>(value), &outfile_);
+          break;
+        case ColumnType::kFloat:
+          writeBinaryValue(std::get<double>(value), &outfile_);
+          break;
+        case ColumnType::kText:
+          writeBinaryText(std::get<std::string>(value), &outfile_);
+          break;
+      }
+    }
+  }
+}
+
+void LogDataWriter::evaluateNumberOfSubmaps(const SubmapCollection& submaps,
+                                            Entry* entry) {
+  entry->values.emplace_back(static_cast<int64_t>(submaps.size()));
 }
 
 void LogDataWriter::evaluateNumberOfActiveSubmaps(
-    const SubmapCollection& submaps) {
+    const SubmapCollection& submaps, Entry* entry) {
   int active_submaps = 0;
   for (const Submap& submap : submaps) {
     if (submap.isActive()) {
       active_submaps++;
     }
   }
-  writeEntry(std::to_string(active_submaps));
+  entry->values.emplace_back(static_cast<int64_t>(active_submaps));
 }
 
-void LogDataWriter::evaluateNumberOfObjects(const SubmapCollection& submaps) {
+void LogDataWriter::evaluateNumberOfObjects(const SubmapCollection& submaps,
+                                            Entry* entry) {
   std::unordered_set<int> instance_ids;
   for (const Submap& submap : submaps) {
     // Only count ids > 0 since -1 and similar is used for invalid or other
@@ -163,7 +342,21 @@ void LogDataWriter::evaluateNumberOfObjects(const SubmapCollection& submaps) {
     }
     instance_ids.insert(submap.getInstanceID());
   }
-  writeEntry(std::to_string(instance_ids.size()));
+  entry->values.emplace_back(static_cast<int64_t>(instance_ids.size()));
+}
+
+void LogDataWriter::evaluateMemoryUsage(const SubmapCollection& submaps,
+                                        Entry* entry) {
+  const CollectionMemoryUsage usage = submaps.computeMemoryUsage();
+  auto to_mb = [](size_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+  };
+  entry->values.emplace_back(to_mb(usage.total.tsdf));
+  entry->values.emplace_back(to_mb(usage.total.classification));
+  entry->values.emplace_back(to_mb(usage.total.mesh));
+  entry->values.emplace_back(to_mb(usage.total.iso_surface_points));
+  entry->values.emplace_back(to_mb(usage.total.total()));
+  entry->values.emplace_back(static_cast<int64_t>(usage.num_evicted_submaps));
 }
 
 }  // namespace panoptic_mapping
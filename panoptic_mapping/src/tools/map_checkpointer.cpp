@@ -0,0 +1,130 @@
+#include "panoptic_mapping/tools/map_checkpointer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace panoptic_mapping {
+
+void MapCheckpointer::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("file_path", &file_path);
+  setupParam("max_incremental_checkpoints", &max_incremental_checkpoints);
+}
+
+void MapCheckpointer::Config::checkParams() const {
+  checkParamCond(!file_path.empty(), "'file_path' must be set.");
+  checkParamGE(max_incremental_checkpoints, 0, "max_incremental_checkpoints");
+}
+
+MapCheckpointer::MapCheckpointer(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+MapCheckpointer::~MapCheckpointer() { wait(); }
+
+bool MapCheckpointer::writeCheckpointAsync(
+    std::shared_ptr<const SubmapCollection> snapshot) {
+  CHECK_NOTNULL(snapshot.get());
+  if (isBusy()) {
+    LOG_IF(WARNING, config_.verbosity >= 2)
+        << "Skipping checkpoint, the previous one is still being written.";
+    return false;
+  }
+  wait();
+  pending_ = std::async(std::launch::async, [this, snapshot]() {
+    return this->write(snapshot);
+  });
+  return true;
+}
+
+bool MapCheckpointer::writeCheckpoint(
+    std::shared_ptr<const SubmapCollection> snapshot) {
+  CHECK_NOTNULL(snapshot.get());
+  wait();
+  return write(snapshot);
+}
+
+bool MapCheckpointer::isBusy() const {
+  return pending_.valid() && pending_.wait_for(std::chrono::seconds(0)) !=
+                                 std::future_status::ready;
+}
+
+void MapCheckpointer::wait() {
+  if (pending_.valid()) {
+    pending_.get();
+  }
+}
+
+bool MapCheckpointer::write(
+    const std::shared_ptr<const SubmapCollection>& snapshot) {
+  Timer timer("tools/map_checkpointer/write");
+
+  // Periodically start over with a full checkpoint. These are written to a
+  // temporary file first such that the previous checkpoints stay valid.
+  const bool write_full =
+      !file_.is_open() || !previous_ ||
+      (config_.max_incremental_checkpoints > 0 &&
+       num_incremental_checkpoints_ >= config_.max_incremental_checkpoints);
+  const std::string tmp_file_path = config_.file_path + ".tmp";
+  if (write_full) {
+    file_.close();
+    file_.open(tmp_file_path,
+               std::fstream::out | std::fstream::binary | std::fstream::trunc);
+    sequence_number_ = 0;
+  }
+  if (!file_.is_open()) {
+    LOG(ERROR) << "Could not open checkpoint file '"
+               << (write_full ? tmp_file_path : config_.file_path) << "'.";
+    return false;
+  }
+
+  const bool success = snapshot->saveCheckpointToStream(
+      write_full ? nullptr : previous_.get(), sequence_number_, &file_);
+  if (!success) {
+    // Start over with a full checkpoint next time.
+    file_.close();
+    previous_.reset();
+    return false;
+  }
+  sequence_number_++;
+
+  if (write_full) {
+    file_.close();
+    if (std::rename(tmp_file_path.c_str(), config_.file_path.c_str()) != 0) {
+      LOG(ERROR) << "Could not move checkpoint file '" << tmp_file_path
+                 << "' to '" << config_.file_path << "'.";
+      previous_.reset();
+      return false;
+    }
+    file_.open(config_.file_path, std::fstream::out | std::fstream::binary |
+                                      std::fstream::app);
+    num_incremental_checkpoints_ = 0;
+  } else {
+    num_incremental_checkpoints_++;
+  }
+  previous_ = snapshot;
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Wrote " << (write_full ? "full" : "incremental") << " checkpoint "
+      << sequence_number_ - 1 << " to '" << config_.file_path << "'.";
+  return true;
+}
+
+bool MapCheckpointer::compact(const std::string& checkpoint_file,
+                              const std::string& map_file) {
+  SubmapCollection submaps;
+  if (!submaps.loadFromCheckpointFile(checkpoint_file, false)) {
+    return false;
+  }
+  // The bounding volumes are required for the index of the map file.
+  for (Submap& submap : submaps) {
+    submap.updateBoundingVolume();
+  }
+  return submaps.saveToFile(map_file);
+}
+
+}  // namespace panoptic_mapping
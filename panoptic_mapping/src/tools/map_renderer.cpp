@@ -1,7 +1,12 @@
 #include "panoptic_mapping/tools/map_renderer.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <future>
 #include <string>
+#include <vector>
+
+#include "panoptic_mapping/common/thread_pool.h"
 
 namespace panoptic_mapping {
 
@@ -9,6 +14,7 @@ void MapRenderer::Config::checkParams() const {}
 
 void MapRenderer::Config::setupParamsAndPrinting() {
   setupParam("verbosity", &verbosity);
+  setupParam("use_rasterization", &use_rasterization);
   setupParam("impaint_voxel_size", &impaint_voxel_size);
 }
 
@@ -17,25 +23,56 @@ MapRenderer::MapRenderer(const Config& config, const Camera::Config& camera,
     : config_(config.checkValid()), camera_(camera) {
   LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
                                                        << config_.toString();
+}
+
+void MapRenderer::render(const SubmapCollection& submaps,
+                         const Transformation& T_M_C, bool only_active_submaps,
+                         cv::Mat* id_image, cv::Mat* class_image,
+                         cv::Mat* depth_image) const {
+  Timer timer("tools/map_renderer/render");
+  const Camera::Config& cam_config = camera_.getConfig();
+  const std::vector<VisibleSubmap> visible_submaps =
+      findVisibleSubmaps(submaps, T_M_C, only_active_submaps);
+  cv::Mat index_image(cam_config.height, cam_config.width, CV_32SC1,
+                      cv::Scalar(-1));
+  cv::Mat depths(cam_config.height, cam_config.width, CV_32FC1,
+                 cv::Scalar(0.f));
+  if (config_.use_rasterization) {
+    rasterize(visible_submaps, submaps.getThreadPool(), &index_image,
+              &depths);
+  } else {
+    splat(visible_submaps, &index_image, &depths);
+  }
 
-  // Allocate range image.
-  range_image_ = Eigen::MatrixXf(camera.height, camera.width);
+  // Look up the requested properties of the rendered submaps.
+  if (id_image) {
+    *id_image = cv::Mat(cam_config.height, cam_config.width, CV_32SC1);
+  }
+  if (class_image) {
+    *class_image = cv::Mat(cam_config.height, cam_config.width, CV_32SC1);
+  }
+  for (int v = 0; v < cam_config.height; ++v) {
+    for (int u = 0; u < cam_config.width; ++u) {
+      const int index = index_image.at<int>(v, u);
+      const Submap* submap =
+          index < 0 ? nullptr : visible_submaps[index].submap;
+      if (id_image) {
+        id_image->at<int>(v, u) = submap ? submap->getID() : -1;
+      }
+      if (class_image) {
+        class_image->at<int>(v, u) = submap ? submap->getClassID() : -1;
+      }
+    }
+  }
+  if (depth_image) {
+    *depth_image = depths;
+  }
 }
 
-cv::Mat MapRenderer::render(const SubmapCollection& submaps,
-                            const Transformation& T_M_C,
-                            bool only_active_submaps,
-                            int (*paint)(const Submap&)) {
-  // Use the mesh vertices as an approximation to render active submaps.
-  // Assumes that all active submap meshes are up to date and does not perform
-  // a meshing step of its own. Very inefficient due to pixel duplicates.
-  range_image_.setOnes();
-  range_image_ *= camera_.getConfig().max_range;
-  cv::Mat result = cv::Mat::ones(camera_.getConfig().height,
-                                 camera_.getConfig().width, CV_32SC1) *
-                   -1;
-
-  // Parse all submaps.
+std::vector<MapRenderer::VisibleSubmap> MapRenderer::findVisibleSubmaps(
+    const SubmapCollection& submaps, const Transformation& T_M_C,
+    bool only_active_submaps) const {
+  std::vector<VisibleSubmap> result;
   for (const Submap& submap : submaps) {
     // Filter out submaps.
     if (!submap.isActive() && only_active_submaps) {
@@ -48,70 +85,246 @@ cv::Mat MapRenderer::render(const SubmapCollection& submaps,
       continue;
     }
 
-    // Project all surface points.
-    const Transformation T_C_S = T_M_C.inverse() * submap.getT_M_S();
-    const float size_factor_x =
-        camera_.getConfig().fx * submap.getTsdfLayer().voxel_size() / 2.f;
-    const float size_factor_y =
-        camera_.getConfig().fy * submap.getTsdfLayer().voxel_size() / 2.f;
+    // Distant inactive submaps are rendered from a coarser level of detail if
+    // the finer details would not be visible.
+    VisibleSubmap visible;
+    visible.submap = &submap;
+    visible.T_C_S = T_M_C.inverse() * submap.getT_M_S();
+    visible.mesh_layer = nullptr;
+    visible.voxel_size = submap.getConfig().voxel_size;
+    const LevelOfDetailPyramid* level_of_detail = submap.getLevelOfDetail();
+    if (!submap.isActive() && level_of_detail) {
+      const float distance = std::max(
+          (visible.T_C_S * submap.getBoundingVolume().getCenter()).norm() -
+              submap.getBoundingVolume().getRadius(),
+          0.f);
+      const int level =
+          level_of_detail->selectLevel(distance, camera_.getConfig().fx);
+      if (level >= 0) {
+        visible.mesh_layer = level_of_detail->getLevel(level).mesh_layer.get();
+        visible.voxel_size =
+            level_of_detail->getLevel(level).tsdf_layer->voxel_size();
+      }
+    }
+    if (!visible.mesh_layer) {
+      visible.mesh_layer = &submap.getMeshLayer();
+    }
+    result.push_back(visible);
+  }
+  return result;
+}
+
+void MapRenderer::rasterize(const std::vector<VisibleSubmap>& visible_submaps,
+                            ThreadPool* thread_pool, cv::Mat* index_image,
+                            cv::Mat* depth_image) const {
+  CHECK_NOTNULL(thread_pool);
+  // Project all triangles per submap in parallel, sorted into tiles of rows.
+  const int num_tiles =
+      (camera_.getConfig().height + kRowsPerTile_ - 1) / kRowsPerTile_;
+  std::vector<std::future<std::vector<std::vector<ProjectedTriangle>>>>
+      projections;
+  projections.reserve(visible_submaps.size());
+  for (size_t i = 0; i < visible_submaps.size(); ++i) {
+    projections.emplace_back(thread_pool->submit([&, i]() {
+      std::vector<std::vector<ProjectedTriangle>> tiles(num_tiles);
+      projectTriangles(visible_submaps[i], i, &tiles);
+      return tiles;
+    }));
+  }
+  std::vector<std::vector<std::vector<ProjectedTriangle>>> triangles;
+  triangles.reserve(projections.size());
+  for (auto& projection : projections) {
+    triangles.emplace_back(thread_pool->wait(&projection));
+  }
+
+  // Rasterize each tile in parallel. The tiles do not overlap and the
+  // triangles of each tile are processed in a fixed order, so the result is
+  // deterministic. The inverse depth is interpolated, which is linear in image
+  // space, and 0 marks empty pixels.
+  cv::Mat inv_depth_image(depth_image->rows, depth_image->cols, CV_32FC1,
+                          cv::Scalar(0.f));
+  std::vector<std::future<void>> tiles;
+  tiles.reserve(num_tiles);
+  for (int tile = 0; tile < num_tiles; ++tile) {
+    tiles.emplace_back(thread_pool->submit([&, tile]() {
+      const int v_begin = tile * kRowsPerTile_;
+      const int v_end = std::min(v_begin + kRowsPerTile_, index_image->rows);
+      for (const std::vector<std::vector<ProjectedTriangle>>& submap_tiles :
+           triangles) {
+        for (const ProjectedTriangle& triangle : submap_tiles[tile]) {
+          rasterizeTriangle(triangle, v_begin, v_end, index_image,
+                            &inv_depth_image);
+        }
+      }
+      for (int v = v_begin; v < v_end; ++v) {
+        for (int u = 0; u < depth_image->cols; ++u) {
+          const float inv_depth = inv_depth_image.at<float>(v, u);
+          if (inv_depth > 0.f) {
+            depth_image->at<float>(v, u) = 1.f / inv_depth;
+          }
+        }
+      }
+    }));
+  }
+  thread_pool->waitAll(&tiles);
+}
+
+void MapRenderer::projectTriangles(
+    const VisibleSubmap& visible_submap, int index,
+    std::vector<std::vector<ProjectedTriangle>>* tiles) const {
+  const Camera::Config& cam_config = camera_.getConfig();
+  voxblox::BlockIndexList index_list;
+  visible_submap.mesh_layer->getAllAllocatedMeshes(&index_list);
+  for (const voxblox::BlockIndex& block_index : index_list) {
+    const voxblox::Mesh& mesh =
+        visible_submap.mesh_layer->getMeshByIndex(block_index);
+    const bool has_indices = !mesh.indices.empty();
+    const size_t num_vertices =
+        has_indices ? mesh.indices.size() : mesh.vertices.size();
+    for (size_t i = 0; i + 2 < num_vertices; i += 3) {
+      ProjectedTriangle triangle;
+      triangle.index = index;
+      bool is_valid = true;
+      bool is_in_range = false;
+      for (int j = 0; j < 3; ++j) {
+        const Point p_C =
+            visible_submap.T_C_S *
+            mesh.vertices[has_indices ? mesh.indices[i + j] : i + j];
+        // Triangles crossing the near plane are skipped rather than clipped,
+        // since meshes consist of voxel sized triangles.
+        if (p_C.z() < cam_config.min_range) {
+          is_valid = false;
+          break;
+        }
+        is_in_range |= p_C.z() <= cam_config.max_range;
+        triangle.inv_depth[j] = 1.f / p_C.z();
+        triangle.u[j] = p_C.x() * cam_config.fx * triangle.inv_depth[j] +
+                        cam_config.vx;
+        triangle.v[j] = p_C.y() * cam_config.fy * triangle.inv_depth[j] +
+                        cam_config.vy;
+      }
+      if (!is_valid || !is_in_range) {
+        continue;
+      }
+
+      // Pixels are sampled at their integer coordinates.
+      const auto u_range =
+          std::minmax({triangle.u[0], triangle.u[1], triangle.u[2]});
+      const auto v_range =
+          std::minmax({triangle.v[0], triangle.v[1], triangle.v[2]});
+      triangle.u_min = std::max(static_cast<int>(std::ceil(u_range.first)), 0);
+      triangle.u_max = std::min(static_cast<int>(std::floor(u_range.second)),
+                                cam_config.width - 1);
+      triangle.v_min = std::max(static_cast<int>(std::ceil(v_range.first)), 0);
+      triangle.v_max = std::min(static_cast<int>(std::floor(v_range.second)),
+                                cam_config.height - 1);
+      if (triangle.u_min > triangle.u_max || triangle.v_min > triangle.v_max) {
+        continue;
+      }
+      for (int tile = triangle.v_min / kRowsPerTile_;
+           tile <= triangle.v_max / kRowsPerTile_; ++tile) {
+        (*tiles)[tile].push_back(triangle);
+      }
+    }
+  }
+}
+
+void MapRenderer::rasterizeTriangle(const ProjectedTriangle& triangle,
+                                    int v_begin, int v_end,
+                                    cv::Mat* index_image,
+                                    cv::Mat* inv_depth_image) {
+  // Edge functions, normalized by the signed area such that both windings are
+  // rendered.
+  const float area =
+      (triangle.u[1] - triangle.u[0]) * (triangle.v[2] - triangle.v[0]) -
+      (triangle.v[1] - triangle.v[0]) * (triangle.u[2] - triangle.u[0]);
+  if (std::abs(area) < 1e-8f) {
+    return;
+  }
+  const float inv_area = 1.f / area;
+  const auto edge = [&triangle, inv_area](int a, int b, float u, float v) {
+    return ((triangle.u[b] - triangle.u[a]) * (v - triangle.v[a]) -
+            (triangle.v[b] - triangle.v[a]) * (u - triangle.u[a])) *
+           inv_area;
+  };
+  for (int v = std::max(triangle.v_min, v_begin);
+       v <= std::min(triangle.v_max, v_end - 1); ++v) {
+    for (int u = triangle.u_min; u <= triangle.u_max; ++u) {
+      const float w0 = edge(1, 2, u, v);
+      const float w1 = edge(2, 0, u, v);
+      const float w2 = edge(0, 1, u, v);
+      if (w0 < 0.f || w1 < 0.f || w2 < 0.f) {
+        continue;
+      }
+      const float inv_depth = w0 * triangle.inv_depth[0] +
+                              w1 * triangle.inv_depth[1] +
+                              w2 * triangle.inv_depth[2];
+      float& closest = inv_depth_image->at<float>(v, u);
+      if (inv_depth > closest) {
+        closest = inv_depth;
+        index_image->at<int>(v, u) = triangle.index;
+      }
+    }
+  }
+}
+
+void MapRenderer::splat(const std::vector<VisibleSubmap>& visible_submaps,
+                        cv::Mat* index_image, cv::Mat* depth_image) const {
+  // Use the mesh vertices as an approximation of the surface. Inefficient due
+  // to pixel duplicates.
+  const Camera::Config& cam_config = camera_.getConfig();
+  for (size_t i = 0; i < visible_submaps.size(); ++i) {
+    const VisibleSubmap& visible = visible_submaps[i];
+    const float size_factor_x = cam_config.fx * visible.voxel_size / 2.f;
+    const float size_factor_y = cam_config.fy * visible.voxel_size / 2.f;
 
     voxblox::BlockIndexList index_list;
-    submap.getMeshLayer().getAllAllocatedMeshes(&index_list);
+    visible.mesh_layer->getAllAllocatedMeshes(&index_list);
     for (const voxblox::BlockIndex& index : index_list) {
       for (const Point& vertex :
-           submap.getMeshLayer().getMeshByIndex(index).vertices) {
-        const Point p_C = T_C_S * vertex;
+           visible.mesh_layer->getMeshByIndex(index).vertices) {
+        const Point p_C = visible.T_C_S * vertex;
         int u, v;
-        if (camera_.projectPointToImagePlane(p_C, &u, &v)) {
-          const float range = p_C.norm();
-
-          if (config_.impaint_voxel_size) {
-            // Compensate for vertex sparsity.
-            const int size_x = std::ceil(size_factor_x / p_C.z());
-            const int size_y = std::ceil(size_factor_y / p_C.z());
-            for (int dx = -size_x; dx <= size_x; ++dx) {
-              const int u_new = u + dx;
-              if (u_new < 0 || u_new >= camera_.getConfig().width) {
-                continue;
-              }
-              for (int dy = -size_y; dy <= size_y; ++dy) {
-                const int v_new = v + dy;
-                if (v_new < 0 || v_new >= camera_.getConfig().height) {
-                  continue;
-                }
-                if (range < range_image_(v_new, u_new)) {
-                  range_image_(v_new, u_new) = range;
-                  result.at<int>(v_new, u_new) = (*paint)(submap);
-                }
-              }
-            }
-          } else {
-            if (range < range_image_(v, u)) {
-              range_image_(v, u) = range;
-              result.at<int>(v, u) = (*paint)(submap);
+        if (p_C.z() > cam_config.max_range ||
+            !camera_.projectPointToImagePlane(p_C, &u, &v)) {
+          continue;
+        }
+
+        // Compensate for vertex sparsity if requested.
+        int size_x = 0;
+        int size_y = 0;
+        if (config_.impaint_voxel_size) {
+          size_x = std::ceil(size_factor_x / p_C.z());
+          size_y = std::ceil(size_factor_y / p_C.z());
+        }
+        for (int v_new = std::max(v - size_y, 0);
+             v_new <= std::min(v + size_y, cam_config.height - 1); ++v_new) {
+          for (int u_new = std::max(u - size_x, 0);
+               u_new <= std::min(u + size_x, cam_config.width - 1); ++u_new) {
+            float& depth = depth_image->at<float>(v_new, u_new);
+            if (depth == 0.f || p_C.z() < depth) {
+              depth = p_C.z();
+              index_image->at<int>(v_new, u_new) = i;
             }
           }
         }
       }
     }
   }
-  return result;
-}
-
-int MapRenderer::paintSubmapID(const Submap& submap) { return submap.getID(); }
-
-int MapRenderer::paintClass(const Submap& submap) {
-  return submap.getClassID();
 }
 
 cv::Mat MapRenderer::renderActiveSubmapIDs(const SubmapCollection& submaps,
                                            const Transformation& T_M_C) {
-  return render(submaps, T_M_C, true, paintSubmapID);
+  cv::Mat result;
+  render(submaps, T_M_C, true, &result);
+  return result;
 }
 
 cv::Mat MapRenderer::renderActiveSubmapClasses(const SubmapCollection& submaps,
                                                const Transformation& T_M_C) {
-  return render(submaps, T_M_C, true, paintClass);
+  cv::Mat result;
+  render(submaps, T_M_C, true, nullptr, &result);
+  return result;
 }
 
 cv::Mat MapRenderer::colorIdImage(const cv::Mat& id_image,
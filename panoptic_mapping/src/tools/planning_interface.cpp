@@ -1,6 +1,9 @@
 #include "panoptic_mapping/tools/planning_interface.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -8,6 +11,9 @@
 
 #include <voxblox/interpolator/interpolator.h>
 
+#include "panoptic_mapping/common/thread_pool.h"
+#include "panoptic_mapping/tools/voxel_state_map.h"
+
 namespace panoptic_mapping {
 
 PlanningInterface::PlanningInterface(
@@ -17,18 +23,34 @@ PlanningInterface::PlanningInterface(
 bool PlanningInterface::isObserved(const Point& position,
                                    bool include_inactive_maps) const {
   Timer timer("planning_interface/is_observed");
+  // Only submaps whose bounding volume contains the point are looked up.
+  return isObserved(position, submaps_->findSubmapsIntersecting(position, 0.f),
+                    include_inactive_maps);
+}
+
+bool PlanningInterface::isObserved(const Point& position,
+                                   QueryContext* context,
+                                   bool include_inactive_maps) const {
+  CHECK_NOTNULL(context);
+  updateContext(position, context);
+  return isObserved(position, context->submap_ids, include_inactive_maps,
+                    context);
+}
+
+bool PlanningInterface::isObserved(const Point& position,
+                                   const std::vector<int>& submap_ids,
+                                   bool include_inactive_maps,
+                                   QueryContext* context) const {
   // TODO(schmluk): Update this to latest convetions.
-  for (const Submap& submap : *submaps_) {
+  for (size_t i = 0; i < submap_ids.size(); ++i) {
+    const Submap& submap = submaps_->getSubmap(submap_ids[i]);
     if (include_inactive_maps || submap.isActive()) {
       const Point position_S = submap.getT_S_M() * position;
       if (submap.getBoundingVolume().contains_S(position_S)) {
-        auto block_ptr =
-            submap.getTsdfLayer().getBlockPtrByCoordinates(position_S);
-        if (block_ptr) {
-          const TsdfVoxel& voxel = block_ptr->getVoxelByCoordinates(position_S);
-          if (voxel.weight >= kObservedMinWeight_) {
-            return true;
-          }
+        const TsdfVoxel* voxel = lookupVoxel(
+            submap, position_S, context ? &context->blocks[i] : nullptr);
+        if (voxel && voxel->weight >= kObservedMinWeight_) {
+          return true;
         }
       }
     }
@@ -39,11 +61,37 @@ bool PlanningInterface::isObserved(const Point& position,
 PlanningInterface::VoxelState PlanningInterface::getVoxelState(
     const Point& position) const {
   Timer timer("planning_interface/get_voxel_state");
+  if (voxel_state_map_) {
+    return voxel_state_map_->getVoxelState(position);
+  }
+  return getVoxelState(position,
+                       submaps_->findSubmapsIntersecting(position, 0.f));
+}
+
+PlanningInterface::VoxelState PlanningInterface::getVoxelState(
+    const Point& position, QueryContext* context) const {
+  if (voxel_state_map_) {
+    return voxel_state_map_->getVoxelState(position);
+  }
+  return computeVoxelState(position, context);
+}
+
+PlanningInterface::VoxelState PlanningInterface::computeVoxelState(
+    const Point& position, QueryContext* context) const {
+  CHECK_NOTNULL(context);
+  updateContext(position, context);
+  return getVoxelState(position, context->submap_ids, context);
+}
+
+PlanningInterface::VoxelState PlanningInterface::getVoxelState(
+    const Point& position, const std::vector<int>& submap_ids,
+    QueryContext* context) const {
   bool is_known_free = false;
   bool is_expected_free = false;
   bool is_expected_occupied = false;
   bool is_persistent_occupied = false;
-  for (const auto& submap : *submaps_) {
+  for (size_t i = 0; i < submap_ids.size(); ++i) {
+    const Submap& submap = submaps_->getSubmap(submap_ids[i]);
     // Filter out irrelevant submaps.
     if (submap.getChangeState() == ChangeState::kAbsent) {
       continue;
@@ -67,11 +115,12 @@ PlanningInterface::VoxelState PlanningInterface::getVoxelState(
     if (!submap.getBoundingVolume().contains_S(position_S)) {
       continue;
     }
-    auto block_ptr = submap.getTsdfLayer().getBlockPtrByCoordinates(position_S);
-    if (!block_ptr) {
+    const TsdfVoxel* voxel_ptr = lookupVoxel(
+        submap, position_S, context ? &context->blocks[i] : nullptr);
+    if (!voxel_ptr) {
       continue;
     }
-    const TsdfVoxel& voxel = block_ptr->getVoxelByCoordinates(position_S);
+    const TsdfVoxel& voxel = *voxel_ptr;
     if (voxel.weight <= kObservedMinWeight_) {
       continue;
     }
@@ -120,6 +169,24 @@ bool PlanningInterface::getDistance(const Point& position, float* distance,
                                     bool consider_change_state,
                                     bool include_free_space) const {
   Timer timer("planning_interface/get_distance");
+  return getDistance(position, submaps_->findSubmapsIntersecting(position, 0.f),
+                     distance, consider_change_state, include_free_space);
+}
+
+bool PlanningInterface::getDistance(const Point& position,
+                                    QueryContext* context, float* distance,
+                                    bool consider_change_state,
+                                    bool include_free_space) const {
+  CHECK_NOTNULL(context);
+  updateContext(position, context);
+  return getDistance(position, context->submap_ids, distance,
+                     consider_change_state, include_free_space);
+}
+
+bool PlanningInterface::getDistance(const Point& position,
+                                    const std::vector<int>& submap_ids,
+                                    float* distance, bool consider_change_state,
+                                    bool include_free_space) const {
   // Get the Tsdf distance. Return whether the point was observed.
   CHECK_NOTNULL(distance);
   constexpr float max = std::numeric_limits<float>::max();
@@ -129,7 +196,8 @@ bool PlanningInterface::getDistance(const Point& position, float* distance,
   std::vector<bool> observed(3, false);
   float current_resolution = max;
 
-  for (const auto& submap : *submaps_) {
+  for (const int id : submap_ids) {
+    const Submap& submap = submaps_->getSubmap(id);
     // Only include submaps considered present.
     if (consider_change_state &&
         (submap.getChangeState() == ChangeState::kAbsent ||
@@ -177,7 +245,18 @@ bool PlanningInterface::getDistance(const Point& position, float* distance,
       }
       float sdf;
       voxblox::Interpolator<TsdfVoxel> interpolator(&(submap.getTsdfLayer()));
-      if (interpolator.getDistance(position_S, &sdf, true)) {
+      bool is_observed = interpolator.getDistance(position_S, &sdf, true);
+      if (!is_observed && submap.getCollapsedBlocks()) {
+        // Collapsed blocks are uniform, so their value is used directly.
+        const TsdfVoxel* voxel = submap.getCollapsedBlocks()->getVoxel(
+            submap.getTsdfLayer().computeBlockIndexFromCoordinates(
+                position_S));
+        if (voxel) {
+          sdf = voxel->distance;
+          is_observed = true;
+        }
+      }
+      if (is_observed) {
         if (is_free_space) {
           current_distance[2] = std::min(current_distance[2], sdf);
           observed[2] = true;
@@ -206,4 +285,201 @@ bool PlanningInterface::getDistance(const Point& position, float* distance,
   return false;
 }
 
+bool PlanningInterface::getEsdfDistance(const Point& position, float* distance,
+                                        Point* gradient) const {
+  CHECK_NOTNULL(distance);
+  if (!esdf_map_) {
+    return false;
+  }
+  if (gradient) {
+    return esdf_map_->getDistanceAndGradient(position, distance, gradient);
+  }
+  return esdf_map_->getDistance(position, distance);
+}
+
+const TsdfBlock* PlanningInterface::lookupBlock(
+    const Submap& submap, const Point& position_S,
+    QueryContext::CachedBlock* cache) {
+  const TsdfLayer& layer = submap.getTsdfLayer();
+  if (!cache) {
+    return layer.getBlockPtrByCoordinates(position_S).get();
+  }
+  // Missing blocks are not cached since they may be allocated any time.
+  const BlockIndex index = layer.computeBlockIndexFromCoordinates(position_S);
+  if (!cache->block || cache->index != index) {
+    cache->block = layer.getBlockPtrByIndex(index);
+    cache->index = index;
+  }
+  return cache->block.get();
+}
+
+const TsdfVoxel* PlanningInterface::lookupVoxel(
+    const Submap& submap, const Point& position_S,
+    QueryContext::CachedBlock* cache) {
+  const TsdfBlock* block = lookupBlock(submap, position_S, cache);
+  if (block) {
+    return &block->getVoxelByCoordinates(position_S);
+  }
+  if (!submap.getCollapsedBlocks()) {
+    return nullptr;
+  }
+  return submap.getCollapsedBlocks()->getVoxel(
+      submap.getTsdfLayer().computeBlockIndexFromCoordinates(position_S));
+}
+
+void PlanningInterface::updateContext(const Point& position,
+                                      QueryContext* context) const {
+  const uint64_t generation = submaps_->getGeneration();
+  if (!context->is_valid || context->generation != generation) {
+    context->generation = generation;
+    context->cell_size = computeCellSize();
+  } else if (voxblox::getGridIndexFromPoint<BlockIndex>(
+                 position, 1.f / context->cell_size) == context->region) {
+    return;
+  }
+
+  // Look up the candidate submaps of the region containing the position.
+  context->is_valid = true;
+  context->region = voxblox::getGridIndexFromPoint<BlockIndex>(
+      position, 1.f / context->cell_size);
+  const Point center =
+      (context->region.cast<FloatingPoint>().array() + 0.5f).matrix() *
+      context->cell_size;
+  context->submap_ids = submaps_->findSubmapsIntersecting(
+      center, std::sqrt(3.f) * 0.5f * context->cell_size);
+  context->blocks.assign(context->submap_ids.size(),
+                         QueryContext::CachedBlock());
+}
+
+FloatingPoint PlanningInterface::computeCellSize() const {
+  FloatingPoint cell_size = std::numeric_limits<FloatingPoint>::max();
+  for (const Submap& submap : *submaps_) {
+    cell_size = std::min(cell_size, submap.getConfig().voxel_size *
+                                        submap.getConfig().voxels_per_side);
+  }
+  if (cell_size == std::numeric_limits<FloatingPoint>::max()) {
+    return 1.f;
+  }
+  return cell_size;
+}
+
+template <typename FunctionT>
+void PlanningInterface::processBatch(const Pointcloud& positions,
+                                     const FunctionT& function) const {
+  if (positions.empty()) {
+    return;
+  }
+
+  // Sort the queries by block of the finest submap resolution, such that
+  // queries of a group access the same submaps and blocks.
+  const FloatingPoint block_size = computeCellSize();
+  const FloatingPoint block_size_inv = 1.f / block_size;
+  std::vector<std::pair<BlockIndex, size_t>> queries;
+  queries.reserve(positions.size());
+  for (size_t i = 0; i < positions.size(); ++i) {
+    queries.emplace_back(
+        voxblox::getGridIndexFromPoint<BlockIndex>(positions[i],
+                                                   block_size_inv),
+        i);
+  }
+  std::sort(queries.begin(), queries.end(),
+            [](const auto& lhs, const auto& rhs) {
+              const BlockIndex& a = lhs.first;
+              const BlockIndex& b = rhs.first;
+              if (a.x() != b.x()) {
+                return a.x() < b.x();
+              } else if (a.y() != b.y()) {
+                return a.y() < b.y();
+              } else if (a.z() != b.z()) {
+                return a.z() < b.z();
+              }
+              return lhs.second < rhs.second;
+            });
+  std::vector<size_t> group_starts;
+  for (size_t i = 0; i < queries.size(); ++i) {
+    if (i == 0 || queries[i].first != queries[i - 1].first) {
+      group_starts.push_back(i);
+    }
+  }
+  group_starts.push_back(queries.size());
+
+  // Process all groups in parallel. The candidate submaps of a group are all
+  // submaps intersecting the bounding sphere of its block.
+  const FloatingPoint radius = std::sqrt(3.f) * 0.5f * block_size;
+  const size_t num_groups = group_starts.size() - 1;
+  ThreadPool* thread_pool = submaps_->getThreadPool();
+  std::atomic<size_t> next_group(0);
+  const size_t num_threads =
+      std::min<size_t>(thread_pool->getNumThreads(), num_groups);
+  std::vector<std::future<void>> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submit([&]() {
+      size_t group;
+      while ((group = next_group++) < num_groups) {
+        const Point center =
+            (queries[group_starts[group]].first.cast<FloatingPoint>().array() +
+             0.5f)
+                .matrix() *
+            block_size;
+        const std::vector<int> submap_ids =
+            submaps_->findSubmapsIntersecting(center, radius);
+        for (size_t j = group_starts[group]; j < group_starts[group + 1];
+             ++j) {
+          function(queries[j].second, submap_ids);
+        }
+      }
+    }));
+  }
+  thread_pool->waitAll(&threads);
+}
+
+void PlanningInterface::isObserved(const Pointcloud& positions,
+                                   std::vector<uint8_t>* observed,
+                                   bool include_inactive_maps) const {
+  CHECK_NOTNULL(observed);
+  Timer timer("planning_interface/batch_is_observed");
+  observed->resize(positions.size());
+  processBatch(positions,
+               [&](size_t index, const std::vector<int>& submap_ids) {
+                 (*observed)[index] = isObserved(positions[index], submap_ids,
+                                                 include_inactive_maps);
+               });
+}
+
+void PlanningInterface::getVoxelStates(const Pointcloud& positions,
+                                       std::vector<VoxelState>* states) const {
+  CHECK_NOTNULL(states);
+  Timer timer("planning_interface/batch_get_voxel_state");
+  states->resize(positions.size());
+  if (voxel_state_map_) {
+    for (size_t i = 0; i < positions.size(); ++i) {
+      (*states)[i] = voxel_state_map_->getVoxelState(positions[i]);
+    }
+    return;
+  }
+  processBatch(positions,
+               [&](size_t index, const std::vector<int>& submap_ids) {
+                 (*states)[index] =
+                     getVoxelState(positions[index], submap_ids);
+               });
+}
+
+void PlanningInterface::getDistances(const Pointcloud& positions,
+                                     std::vector<float>* distances,
+                                     std::vector<uint8_t>* observed,
+                                     bool consider_change_state,
+                                     bool include_free_space) const {
+  CHECK_NOTNULL(distances);
+  CHECK_NOTNULL(observed);
+  Timer timer("planning_interface/batch_get_distance");
+  distances->assign(positions.size(), 0.f);
+  observed->resize(positions.size());
+  processBatch(positions, [&](size_t index,
+                              const std::vector<int>& submap_ids) {
+    (*observed)[index] =
+        getDistance(positions[index], submap_ids, &(*distances)[index],
+                    consider_change_state, include_free_space);
+  });
+}
+
 }  // namespace panoptic_mapping
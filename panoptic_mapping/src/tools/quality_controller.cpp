@@ -0,0 +1,190 @@
+#include "panoptic_mapping/tools/quality_controller.h"
+
+#include <string>
+
+namespace panoptic_mapping {
+
+void QualityController::Config::checkParams() const {
+  checkParamGE(frame_deadline, 0.f, "frame_deadline");
+  checkParamGT(upper_load, 0.f, "upper_load");
+  checkParamGE(lower_load, 0.f, "lower_load");
+  checkParamCond(lower_load < upper_load,
+                 "'lower_load' must be smaller than 'upper_load'.");
+  checkParamGT(smoothing, 0.f, "smoothing");
+  checkParamLE(smoothing, 1.f, "smoothing");
+  checkParamGT(adjustment_interval, 0, "adjustment_interval");
+  checkParamGE(max_rendering_subsampling_factor, 1,
+               "max_rendering_subsampling_factor");
+  checkParamGE(max_map_management_interval_factor, 1,
+               "max_map_management_interval_factor");
+  checkParamGE(max_integration_threads_divisor, 1,
+               "max_integration_threads_divisor");
+}
+
+void QualityController::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("frame_deadline", &frame_deadline, "ms");
+  setupParam("upper_load", &upper_load);
+  setupParam("lower_load", &lower_load);
+  setupParam("smoothing", &smoothing);
+  setupParam("adjustment_interval", &adjustment_interval, "frames");
+  setupParam("max_rendering_subsampling_factor",
+             &max_rendering_subsampling_factor);
+  setupParam("max_map_management_interval_factor",
+             &max_map_management_interval_factor);
+  setupParam("max_integration_threads_divisor",
+             &max_integration_threads_divisor);
+  setupParam("allow_approximate_rendering", &allow_approximate_rendering);
+}
+
+QualityController::QualityController(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+void QualityController::recordFrame(float tracking, float integration,
+                                    float management) {
+  if (config_.frame_deadline <= 0.f) {
+    return;
+  }
+  if (has_times_) {
+    const float w = config_.smoothing;
+    tracking_ = w * tracking + (1.f - w) * tracking_;
+    integration_ = w * integration + (1.f - w) * integration_;
+    management_ = w * management + (1.f - w) * management_;
+  } else {
+    tracking_ = tracking;
+    integration_ = integration;
+    management_ = management;
+    has_times_ = true;
+  }
+
+  // Give every adjustment time to take effect.
+  frames_since_adjustment_++;
+  if (frames_since_adjustment_ < config_.adjustment_interval) {
+    return;
+  }
+  const float load =
+      (tracking_ + integration_ + management_) / config_.frame_deadline;
+  bool adjusted = false;
+  if (load > config_.upper_load) {
+    adjusted = reduceQuality();
+  } else {
+    is_saturated_ = false;
+    if (load < config_.lower_load) {
+      adjusted = restoreQuality() || yieldThreads();
+    }
+  }
+  if (adjusted) {
+    frames_since_adjustment_ = 0;
+  }
+}
+
+bool QualityController::reduceQuality() {
+  // Reclaim yielded threads first, since they do not reduce the quality.
+  const int threads_divisor = integration_threads_divisor_;
+  if (threads_divisor > 1) {
+    integration_threads_divisor_ = threads_divisor / 2;
+    logAdjustment("Reclaimed integration threads");
+    return true;
+  }
+
+  // Reduce the work of the more expensive stage first. Integration is not
+  // adjusted since it determines the map quality directly.
+  const int tracking_factor = rendering_subsampling_factor_;
+  const int management_factor = map_management_interval_factor_;
+  const bool can_approximate =
+      config_.allow_approximate_rendering && !use_approximate_rendering_;
+  const bool can_coarsen_tracking =
+      tracking_factor * 2 <= config_.max_rendering_subsampling_factor;
+  const bool can_defer_management =
+      management_factor * 2 <= config_.max_map_management_interval_factor;
+  if ((can_approximate || can_coarsen_tracking) &&
+      (tracking_ >= management_ || !can_defer_management)) {
+    if (can_approximate) {
+      use_approximate_rendering_ = true;
+      logAdjustment("Switched the tracking to approximate rendering");
+    } else {
+      rendering_subsampling_factor_ = tracking_factor * 2;
+      logAdjustment("Coarsened the tracking resolution");
+    }
+    return true;
+  }
+  if (can_defer_management) {
+    map_management_interval_factor_ = management_factor * 2;
+    logAdjustment("Deferred map management");
+    return true;
+  }
+  if (!is_saturated_) {
+    is_saturated_ = true;
+    LOG_IF(WARNING, config_.verbosity >= 1)
+        << "All quality reductions are exhausted but the frame time ("
+        << static_cast<int>(tracking_ + integration_ + management_)
+        << "ms) still exceeds the deadline (" << config_.frame_deadline
+        << "ms).";
+  }
+  return false;
+}
+
+bool QualityController::restoreQuality() {
+  // Restore the cheaper stage first, which adds the least load. Within the
+  // tracking the reductions are undone in reverse order.
+  const int tracking_factor = rendering_subsampling_factor_;
+  const int management_factor = map_management_interval_factor_;
+  const bool is_tracking_reduced =
+      tracking_factor > 1 || use_approximate_rendering_;
+  if (management_factor > 1 &&
+      (management_ <= tracking_ || !is_tracking_reduced)) {
+    map_management_interval_factor_ = management_factor / 2;
+    logAdjustment("Restored map management");
+    return true;
+  }
+  if (tracking_factor > 1) {
+    rendering_subsampling_factor_ = tracking_factor / 2;
+    logAdjustment("Restored the tracking resolution");
+    return true;
+  }
+  if (use_approximate_rendering_) {
+    use_approximate_rendering_ = false;
+    logAdjustment("Restored the exact tracking rendering");
+    return true;
+  }
+  return false;
+}
+
+bool QualityController::yieldThreads() {
+  // Only yield threads if the integration would still meet the deadline when
+  // running at half the speed, to avoid oscillating.
+  const int threads_divisor = integration_threads_divisor_;
+  if (threads_divisor * 2 > config_.max_integration_threads_divisor) {
+    return false;
+  }
+  const float load = (tracking_ + 2.f * integration_ + management_) /
+                     config_.frame_deadline;
+  if (load >= config_.upper_load) {
+    return false;
+  }
+  integration_threads_divisor_ = threads_divisor * 2;
+  logAdjustment("Yielded integration threads");
+  return true;
+}
+
+void QualityController::logAdjustment(const std::string& action) const {
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << action << " (frame time "
+      << static_cast<int>(tracking_ + integration_ + management_) << "/"
+      << config_.frame_deadline << "ms, tracking: "
+      << static_cast<int>(tracking_)
+      << "ms, integration: " << static_cast<int>(integration_)
+      << "ms, management: " << static_cast<int>(management_)
+      << "ms). Rendering subsampling factor: " << rendering_subsampling_factor_
+      << ", approximate rendering: "
+      << (use_approximate_rendering_ ? "on" : "off")
+      << ", map management interval factor: "
+      << map_management_interval_factor_
+      << ", integration threads divisor: " << integration_threads_divisor_
+      << ".";
+}
+
+}  // namespace panoptic_mapping
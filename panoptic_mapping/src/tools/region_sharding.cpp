@@ -0,0 +1,106 @@
+#include "panoptic_mapping/tools/region_sharding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+namespace panoptic_mapping {
+
+void RegionSharding::Config::setupParamsAndPrinting() {
+  setupParam("num_shards", &num_shards);
+  setupParam("region_size", &region_size, "m");
+}
+
+void RegionSharding::Config::checkParams() const {
+  checkParamGT(num_shards, 0, "num_shards");
+  checkParamGT(region_size, 0.f, "region_size");
+}
+
+RegionSharding::RegionSharding(const Config& config)
+    : config_(config.checkValid()) {}
+
+int RegionSharding::getShard(const Point& position_M) const {
+  const BlockIndex region =
+      (position_M / config_.region_size).array().floor().cast<int>();
+  return getShard(region);
+}
+
+int RegionSharding::getShard(const BlockIndex& region) const {
+  if (config_.num_shards == 1) {
+    return 0;
+  }
+  return static_cast<int>(voxblox::AnyIndexHash()(region) %
+                          static_cast<size_t>(config_.num_shards));
+}
+
+std::vector<int> RegionSharding::getShards(const Point& center_M,
+                                           FloatingPoint radius) const {
+  if (config_.num_shards == 1) {
+    return {0};
+  }
+  // Conservatively use all regions overlapping the bounding box of the sphere.
+  const Point extent = Point::Constant(radius);
+  const BlockIndex min_region =
+      ((center_M - extent) / config_.region_size).array().floor().cast<int>();
+  const BlockIndex max_region =
+      ((center_M + extent) / config_.region_size).array().floor().cast<int>();
+  std::vector<bool> is_in_shard(config_.num_shards, false);
+  int num_found = 0;
+  BlockIndex region;
+  for (region.x() = min_region.x(); region.x() <= max_region.x();
+       ++region.x()) {
+    for (region.y() = min_region.y(); region.y() <= max_region.y();
+         ++region.y()) {
+      for (region.z() = min_region.z(); region.z() <= max_region.z();
+           ++region.z()) {
+        const int shard = getShard(region);
+        if (!is_in_shard[shard]) {
+          is_in_shard[shard] = true;
+          if (++num_found == config_.num_shards) {
+            break;
+          }
+        }
+      }
+      if (num_found == config_.num_shards) {
+        break;
+      }
+    }
+    if (num_found == config_.num_shards) {
+      break;
+    }
+  }
+  std::vector<int> result;
+  result.reserve(num_found);
+  for (int shard = 0; shard < config_.num_shards; ++shard) {
+    if (is_in_shard[shard]) {
+      result.push_back(shard);
+    }
+  }
+  return result;
+}
+
+std::vector<int> RegionSharding::getShards(const Submap& submap) const {
+  const Point center_M =
+      submap.getT_M_S() * submap.getBoundingVolume().getCenter();
+  return getShards(center_M, submap.getBoundingVolume().getRadius());
+}
+
+bool RegionSharding::submapIsInShard(const Submap& submap, int shard) const {
+  const std::vector<int> shards = getShards(submap);
+  return std::binary_search(shards.begin(), shards.end(), shard);
+}
+
+void RegionSharding::splitByShard(
+    const Pointcloud& positions,
+    std::vector<std::vector<size_t>>* indices) const {
+  CHECK_NOTNULL(indices);
+  indices->clear();
+  indices->resize(config_.num_shards);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    (*indices)[getShard(positions[i])].push_back(i);
+  }
+}
+
+}  // namespace panoptic_mapping
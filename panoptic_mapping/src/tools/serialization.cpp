@@ -1,22 +1,66 @@
 #include "panoptic_mapping/tools/serialization.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <memory>
 #include <queue>
+#include <string>
 #include <vector>
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <voxblox/Block.pb.h>
 #include <voxblox/io/layer_io.h>
 
 #include "panoptic_mapping/map/classification/binary_count.h"
+#include "panoptic_mapping/map/classification/dense_count.h"
 #include "panoptic_mapping/map/classification/fixed_count.h"
 #include "panoptic_mapping/map/classification/moving_binary_count.h"
+#include "panoptic_mapping/map/classification/top_k_count.h"
 #include "panoptic_mapping/map/classification/uncertainty.h"
 #include "panoptic_mapping/map/classification/variable_count.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+void appendVarint(uint32_t value, std::string* data) {
+  while (value >= 0x80u) {
+    data->push_back(static_cast<char>((value & 0x7Fu) | 0x80u));
+    value >>= 7;
+  }
+  data->push_back(static_cast<char>(value));
+}
+
+bool readVarint(const std::string& data, size_t* position, uint32_t* value) {
+  *value = 0u;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*position >= data.size()) {
+      return false;
+    }
+    const uint8_t byte = static_cast<uint8_t>(data[(*position)++]);
+    *value |= static_cast<uint32_t>(byte & 0x7Fu) << shift;
+    if (!(byte & 0x80u)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Map signed deltas to small unsigned values.
+inline uint32_t zigzagEncode(uint32_t delta) {
+  const int32_t value = static_cast<int32_t>(delta);
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+inline uint32_t zigzagDecode(uint32_t value) {
+  return (value >> 1) ^ (~(value & 1u) + 1u);
+}
+
+}  // namespace
+
 std::unique_ptr<ClassLayer> loadClassLayerFromStream(
     const SubmapProto& submap_proto, std::istream* proto_file_ptr,
     uint64_t* tmp_byte_offset_ptr) {
@@ -54,6 +98,16 @@ std::unique_ptr<ClassLayer> loadClassLayerFromStream(
                                                 tmp_byte_offset_ptr);
       break;
     }
+    case ClassVoxelType::kDenseCount: {
+      result = DenseCountLayer::loadFromStream(submap_proto, proto_file_ptr,
+                                               tmp_byte_offset_ptr);
+      break;
+    }
+    case ClassVoxelType::kTopKCount: {
+      result = TopKCountLayer::loadFromStream(submap_proto, proto_file_ptr,
+                                              tmp_byte_offset_ptr);
+      break;
+    }
   }
   if (!result) {
     LOG(ERROR) << "Couldn't read class layer type from stream.";
@@ -82,6 +136,25 @@ bool loadClassBlocksFromStream(const SubmapProto& submap_proto,
   CHECK_NOTNULL(proto_file_ptr);
   CHECK_NOTNULL(tmp_byte_offset_ptr);
   CHECK_NOTNULL(layer);
+  if (static_cast<ClassBlockEncoding>(submap_proto.class_block_encoding()) ==
+      ClassBlockEncoding::kRunLength) {
+    for (uint32_t block_idx = 0u; block_idx < submap_proto.num_class_blocks();
+         ++block_idx) {
+      ClassBlockProto block_proto;
+      if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &block_proto,
+                                                  tmp_byte_offset_ptr)) {
+        LOG(ERROR) << "Could not read block protobuf message number "
+                   << block_idx;
+        return false;
+      }
+      if (!decodeClassBlock(block_proto, layer)) {
+        LOG(ERROR) << "Could not decode the class block protobuf message.";
+        return false;
+      }
+    }
+    return true;
+  }
+
   // Read all blocks and add them to the layer.
   for (uint32_t block_idx = 0u; block_idx < submap_proto.num_class_blocks();
        ++block_idx) {
@@ -122,4 +195,497 @@ bool isCompatible(const voxblox::BlockProto& block_proto,
   return true;
 }
 
+size_t getSerializedClassBlockSize(const ClassBlock& block, size_t num_voxels) {
+  size_t size = 0;
+  for (size_t i = 0; i < num_voxels; ++i) {
+    size += block.getVoxelByLinearIndex(i).getSerializedSize();
+  }
+  return size;
+}
+
+size_t serializeClassBlock(const ClassBlock& block, size_t num_voxels,
+                           uint32_t* data, size_t* offsets) {
+  CHECK_NOTNULL(data);
+  size_t size = 0;
+  for (size_t i = 0; i < num_voxels; ++i) {
+    if (offsets) {
+      offsets[i] = size;
+    }
+    size += block.getVoxelByLinearIndex(i).serializeVoxelToBuffer(data + size);
+  }
+  if (offsets) {
+    offsets[num_voxels] = size;
+  }
+  return size;
+}
+
+bool deserializeClassBlock(const uint32_t* data, size_t size,
+                           size_t num_voxels, ClassBlock* block) {
+  CHECK_NOTNULL(block);
+  size_t index = 0;
+  for (size_t i = 0; i < num_voxels; ++i) {
+    if (!block->getVoxelByLinearIndex(i).deserializeVoxelFromBuffer(data, size,
+                                                                    &index)) {
+      LOG(WARNING) << "Could not serialize voxel from data.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool encodeClassBlock(const ClassLayer& layer, const BlockIndex& index,
+                      ClassBlockProto* proto) {
+  CHECK_NOTNULL(proto);
+  ClassBlock::ConstPtr block = layer.getBlockConstPtrByIndex(index);
+  if (!block) {
+    return false;
+  }
+  const size_t num_voxels = layer.voxels_per_side() * layer.voxels_per_side() *
+                            layer.voxels_per_side();
+  proto->set_index_x(index.x());
+  proto->set_index_y(index.y());
+  proto->set_index_z(index.z());
+  proto->set_num_voxels(num_voxels);
+
+  // Each entry starts with a header of (run length << 1 | 1) for repetitions
+  // of the previous voxel or (number of words << 1) for a new voxel.
+  // Serialize all voxels into one buffer to compare them in place.
+  std::vector<uint32_t> words(getSerializedClassBlockSize(*block, num_voxels));
+  std::vector<size_t> offsets(num_voxels + 1);
+  serializeClassBlock(*block, num_voxels, words.data(), offsets.data());
+  std::string* data = proto->mutable_voxel_data();
+  const uint32_t* previous = nullptr;
+  size_t previous_size = 0;
+  uint32_t run_length = 0u;
+  for (size_t i = 0; i < num_voxels; ++i) {
+    const uint32_t* voxel = words.data() + offsets[i];
+    const size_t voxel_size = offsets[i + 1] - offsets[i];
+    if (i > 0 && voxel_size == previous_size &&
+        std::equal(voxel, voxel + voxel_size, previous)) {
+      run_length++;
+      continue;
+    }
+    if (run_length > 0u) {
+      appendVarint(run_length << 1 | 1u, data);
+      run_length = 0u;
+    }
+    appendVarint(static_cast<uint32_t>(voxel_size) << 1, data);
+    for (size_t j = 0; j < voxel_size; ++j) {
+      appendVarint(j < previous_size ? zigzagEncode(voxel[j] - previous[j])
+                                     : voxel[j],
+                   data);
+    }
+    previous = voxel;
+    previous_size = voxel_size;
+  }
+  if (run_length > 0u) {
+    appendVarint(run_length << 1 | 1u, data);
+  }
+  return true;
+}
+
+bool decodeClassBlock(const ClassBlockProto& proto, ClassLayer* layer) {
+  CHECK_NOTNULL(layer);
+  const size_t num_voxels = layer->voxels_per_side() *
+                            layer->voxels_per_side() * layer->voxels_per_side();
+  if (proto.num_voxels() != num_voxels) {
+    LOG(ERROR) << "Class block proto to be loaded has " << proto.num_voxels()
+               << " voxels but the layer blocks have " << num_voxels << ".";
+    return false;
+  }
+
+  // Restore the serialized words of all voxels. Previous voxels are referred
+  // to by their position in words, which stays valid when words grows.
+  const std::string& data = proto.voxel_data();
+  std::vector<uint32_t> words;
+  words.reserve(num_voxels);
+  size_t previous_begin = 0;
+  size_t previous_size = 0;
+  size_t position = 0;
+  size_t num_decoded = 0;
+  while (num_decoded < num_voxels) {
+    uint32_t header;
+    if (!readVarint(data, &position, &header)) {
+      return false;
+    }
+    if (header & 1u) {
+      const uint32_t run_length = header >> 1;
+      for (uint32_t i = 0; i < run_length; ++i) {
+        const size_t begin = words.size();
+        words.resize(begin + previous_size);
+        std::copy_n(words.begin() + previous_begin, previous_size,
+                    words.begin() + begin);
+      }
+      num_decoded += run_length;
+      continue;
+    }
+    const size_t begin = words.size();
+    const size_t voxel_size = header >> 1;
+    words.resize(begin + voxel_size);
+    for (size_t j = 0; j < voxel_size; ++j) {
+      uint32_t word;
+      if (!readVarint(data, &position, &word)) {
+        return false;
+      }
+      if (j < previous_size) {
+        word = words[previous_begin + j] + zigzagDecode(word);
+      }
+      words[begin + j] = word;
+    }
+    previous_begin = begin;
+    previous_size = voxel_size;
+    num_decoded++;
+  }
+  if (num_decoded != num_voxels) {
+    return false;
+  }
+
+  // Add (potentially replace) the block.
+  const BlockIndex index(proto.index_x(), proto.index_y(), proto.index_z());
+  layer->removeBlock(index);
+  ClassBlock::Ptr block = layer->allocateNewBlock(index);
+  return deserializeClassBlock(words.data(), words.size(), num_voxels,
+                               block.get());
+}
+
+bool saveClassBlocksToStream(const ClassLayer& layer,
+                             const voxblox::BlockIndexList& block_indices,
+                             std::ostream* outfile_ptr) {
+  CHECK_NOTNULL(outfile_ptr);
+  for (const BlockIndex& index : block_indices) {
+    ClassBlockProto proto;
+    if (!encodeClassBlock(layer, index, &proto)) {
+      LOG(ERROR) << "Could not encode class block " << index.transpose()
+                 << ".";
+      return false;
+    }
+    if (!writeProtoMsgToStream(proto, outfile_ptr)) {
+      LOG(ERROR) << "Could not write class block proto message to stream.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool writeProtoMsgToStream(const google::protobuf::Message& message,
+                           std::ostream* stream_out) {
+  CHECK_NOTNULL(stream_out);
+  if (!stream_out->good()) {
+    return false;
+  }
+  {
+    google::protobuf::io::OstreamOutputStream raw_out(stream_out);
+    google::protobuf::io::CodedOutputStream coded_out(&raw_out);
+    coded_out.WriteVarint32(static_cast<uint32_t>(message.ByteSizeLong()));
+    if (!message.SerializeToCodedStream(&coded_out)) {
+      return false;
+    }
+  }
+  return stream_out->good();
+}
+
+bool encodeTsdfBlock(const TsdfLayer& layer, const BlockIndex& index,
+                     float truncation_distance,
+                     const TsdfQuantization& quantization,
+                     TsdfBlockProto* proto) {
+  CHECK_NOTNULL(proto);
+  CHECK(quantization.distance_bits == 8 || quantization.distance_bits == 16);
+  TsdfBlock::ConstPtr block = layer.getBlockPtrByIndex(index);
+  if (!block) {
+    return false;
+  }
+  const size_t num_voxels = block->num_voxels();
+  const size_t distance_bytes = quantization.distance_bits / 8;
+  const bool has_color = !quantization.drop_color;
+  proto->set_index_x(index.x());
+  proto->set_index_y(index.y());
+  proto->set_index_z(index.z());
+  proto->set_num_voxels(num_voxels);
+  proto->set_distance_bits(quantization.distance_bits);
+  proto->set_has_color(has_color);
+
+  // Find the weight range of the block, code 0 is reserved for unobserved
+  // voxels.
+  float min_weight = std::numeric_limits<float>::max();
+  float max_weight = 0.f;
+  for (size_t i = 0; i < num_voxels; ++i) {
+    const float weight = block->getVoxelByLinearIndex(i).weight;
+    if (weight > 0.f) {
+      min_weight = std::min(min_weight, weight);
+      max_weight = std::max(max_weight, weight);
+    }
+  }
+  float min_log_weight = 0.f;
+  float log_weight_step = 1.f;
+  if (max_weight > 0.f) {
+    min_log_weight = std::log(min_weight);
+    log_weight_step = (std::log(max_weight) - min_log_weight) / 254.f;
+    if (log_weight_step <= 0.f) {
+      log_weight_step = 1.f;
+    }
+  }
+  proto->set_min_log_weight(min_log_weight);
+  proto->set_log_weight_step(log_weight_step);
+
+  // Each entry starts with a header of (run length << 1 | 1) for repetitions
+  // of the previous voxel or (number of voxels << 1) for new voxels, which
+  // follow as (distance, weight, [r, g, b]) bytes.
+  const float truncation = std::max(std::abs(truncation_distance), 1e-6f);
+  const float max_distance_code =
+      quantization.distance_bits == 16 ? 65535.f : 255.f;
+  const float distance_scale = max_distance_code / (2.f * truncation);
+  const size_t voxel_bytes = distance_bytes + 1 + (has_color ? 3 : 0);
+  std::string* data = proto->mutable_voxel_data();
+  std::string literals;
+  std::string voxel_data(voxel_bytes, '\0');
+  std::string previous;
+  uint32_t num_literals = 0u;
+  uint32_t run_length = 0u;
+  for (size_t i = 0; i < num_voxels; ++i) {
+    const TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+    std::fill(voxel_data.begin(), voxel_data.end(), '\0');
+    if (voxel.weight > 0.f) {
+      const float distance =
+          std::max(-truncation, std::min(truncation, voxel.distance));
+      const uint16_t code = static_cast<uint16_t>(
+          std::round((distance + truncation) * distance_scale));
+      voxel_data[0] = static_cast<char>(code & 0xFF);
+      if (distance_bytes == 2) {
+        voxel_data[1] = static_cast<char>(code >> 8);
+      }
+      const float weight_code = std::round(
+          (std::log(voxel.weight) - min_log_weight) / log_weight_step);
+      voxel_data[distance_bytes] = static_cast<char>(
+          static_cast<uint8_t>(std::max(0.f, std::min(254.f, weight_code))) +
+          1u);
+      if (has_color) {
+        voxel_data[distance_bytes + 1] = static_cast<char>(voxel.color.r);
+        voxel_data[distance_bytes + 2] = static_cast<char>(voxel.color.g);
+        voxel_data[distance_bytes + 3] = static_cast<char>(voxel.color.b);
+      }
+    }
+    if (i > 0 && voxel_data == previous) {
+      if (num_literals > 0u) {
+        appendVarint(num_literals << 1, data);
+        data->append(literals);
+        literals.clear();
+        num_literals = 0u;
+      }
+      run_length++;
+      continue;
+    }
+    if (run_length > 0u) {
+      appendVarint(run_length << 1 | 1u, data);
+      run_length = 0u;
+    }
+    literals.append(voxel_data);
+    num_literals++;
+    previous = voxel_data;
+  }
+  if (num_literals > 0u) {
+    appendVarint(num_literals << 1, data);
+    data->append(literals);
+  }
+  if (run_length > 0u) {
+    appendVarint(run_length << 1 | 1u, data);
+  }
+  return true;
+}
+
+bool decodeTsdfBlock(const TsdfBlockProto& proto, float truncation_distance,
+                     TsdfLayer* layer, BlockIndex* index) {
+  CHECK_NOTNULL(layer);
+  const size_t num_voxels = layer->voxels_per_side() *
+                            layer->voxels_per_side() * layer->voxels_per_side();
+  if (proto.num_voxels() != num_voxels) {
+    LOG(ERROR) << "TSDF block proto to be loaded has " << proto.num_voxels()
+               << " voxels but the layer blocks have " << num_voxels << ".";
+    return false;
+  }
+  if (proto.distance_bits() != 8u && proto.distance_bits() != 16u) {
+    LOG(ERROR) << "TSDF block proto to be loaded has unsupported "
+                  "'distance_bits': "
+               << proto.distance_bits() << ".";
+    return false;
+  }
+
+  // Restore the quantized voxels.
+  const size_t distance_bytes = proto.distance_bits() / 8;
+  const bool has_color = proto.has_color();
+  const size_t voxel_bytes = distance_bytes + 1 + (has_color ? 3 : 0);
+  const std::string& data = proto.voxel_data();
+  std::vector<const char*> voxels;
+  voxels.reserve(num_voxels);
+  size_t position = 0;
+  while (voxels.size() < num_voxels) {
+    uint32_t header;
+    if (!readVarint(data, &position, &header)) {
+      return false;
+    }
+    const uint32_t count = header >> 1;
+    if (count > num_voxels - voxels.size()) {
+      return false;
+    }
+    if (header & 1u) {
+      if (voxels.empty()) {
+        return false;
+      }
+      const char* previous = voxels.back();
+      voxels.insert(voxels.end(), count, previous);
+      continue;
+    }
+    if (position + count * voxel_bytes > data.size()) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      voxels.push_back(data.data() + position);
+      position += voxel_bytes;
+    }
+  }
+
+  // Write (potentially replace) the block.
+  const BlockIndex block_index(proto.index_x(), proto.index_y(),
+                               proto.index_z());
+  const float truncation = std::max(std::abs(truncation_distance), 1e-6f);
+  const float max_distance_code = distance_bytes == 2 ? 65535.f : 255.f;
+  const float distance_scale = 2.f * truncation / max_distance_code;
+  const voxblox::Color gray(127, 127, 127);
+  TsdfBlock& block = *layer->allocateBlockPtrByIndex(block_index);
+  for (size_t i = 0; i < num_voxels; ++i) {
+    const uint8_t* voxel_data = reinterpret_cast<const uint8_t*>(voxels[i]);
+    TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+    const uint8_t weight_code = voxel_data[distance_bytes];
+    if (weight_code == 0u) {
+      voxel = TsdfVoxel();
+      continue;
+    }
+    uint16_t code = voxel_data[0];
+    if (distance_bytes == 2) {
+      code |= static_cast<uint16_t>(voxel_data[1]) << 8;
+    }
+    voxel.distance = code * distance_scale - truncation;
+    voxel.weight = std::exp(proto.min_log_weight() +
+                            (weight_code - 1) * proto.log_weight_step());
+    voxel.color = has_color ? voxblox::Color(voxel_data[distance_bytes + 1],
+                                             voxel_data[distance_bytes + 2],
+                                             voxel_data[distance_bytes + 3])
+                            : gray;
+  }
+  block.has_data() = true;
+  if (index) {
+    *index = block_index;
+  }
+  return true;
+}
+
+bool saveTsdfBlocksToStream(const TsdfLayer& layer,
+                            const voxblox::BlockIndexList& block_indices,
+                            float truncation_distance,
+                            const TsdfQuantization* quantization,
+                            std::ostream* outfile_ptr) {
+  CHECK_NOTNULL(outfile_ptr);
+  for (const BlockIndex& index : block_indices) {
+    bool success;
+    if (quantization) {
+      TsdfBlockProto proto;
+      success = encodeTsdfBlock(layer, index, truncation_distance,
+                                *quantization, &proto) &&
+                writeProtoMsgToStream(proto, outfile_ptr);
+    } else {
+      TsdfBlock::ConstPtr block = layer.getBlockPtrByIndex(index);
+      voxblox::BlockProto proto;
+      success = static_cast<bool>(block);
+      if (success) {
+        block->getProto(&proto);
+        success = writeProtoMsgToStream(proto, outfile_ptr);
+      }
+    }
+    if (!success) {
+      LOG(ERROR) << "Could not write TSDF block " << index.transpose()
+                 << " to stream.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool loadTsdfBlocksFromStream(const SubmapProto& submap_proto,
+                              std::istream* proto_file_ptr,
+                              uint64_t* tmp_byte_offset_ptr, TsdfLayer* layer,
+                              voxblox::BlockIndexList* loaded_blocks,
+                              const BlockFilter& block_filter) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  CHECK_NOTNULL(layer);
+  const auto encoding =
+      static_cast<TsdfBlockEncoding>(submap_proto.tsdf_block_encoding());
+  if (encoding != TsdfBlockEncoding::kVoxbloxBlock &&
+      encoding != TsdfBlockEncoding::kQuantized) {
+    LOG(ERROR) << "Unknown TSDF block encoding '"
+               << submap_proto.tsdf_block_encoding() << "'.";
+    return false;
+  }
+  for (uint32_t block_idx = 0u; block_idx < submap_proto.num_blocks();
+       ++block_idx) {
+    BlockIndex index;
+    bool success = true;
+    if (encoding == TsdfBlockEncoding::kQuantized) {
+      TsdfBlockProto block_proto;
+      if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &block_proto,
+                                                  tmp_byte_offset_ptr)) {
+        success = false;
+      } else {
+        index = BlockIndex(block_proto.index_x(), block_proto.index_y(),
+                           block_proto.index_z());
+        if (block_filter && !block_filter(index)) {
+          continue;
+        }
+        success = decodeTsdfBlock(block_proto,
+                                  submap_proto.truncation_distance(), layer);
+      }
+    } else {
+      voxblox::BlockProto block_proto;
+      if (!voxblox::utils::readProtoMsgFromStream(proto_file_ptr, &block_proto,
+                                                  tmp_byte_offset_ptr)) {
+        success = false;
+      } else {
+        index = voxblox::getGridIndexFromOriginPoint<BlockIndex>(
+            Point(block_proto.origin_x(), block_proto.origin_y(),
+                  block_proto.origin_z()),
+            layer->block_size_inv());
+        if (block_filter && !block_filter(index)) {
+          continue;
+        }
+        success = layer->addBlockFromProto(
+            block_proto, TsdfLayer::BlockMergingStrategy::kReplace);
+      }
+    }
+    if (!success) {
+      LOG(ERROR) << "Could not load TSDF block number " << block_idx
+                 << " from stream.";
+      return false;
+    }
+    if (loaded_blocks) {
+      loaded_blocks->push_back(index);
+    }
+  }
+  return true;
+}
+
+bool skipProtoMsgFromStream(std::istream* proto_file_ptr,
+                            uint64_t* tmp_byte_offset_ptr) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  proto_file_ptr->clear();
+  proto_file_ptr->seekg(*tmp_byte_offset_ptr, std::ios_base::beg);
+  google::protobuf::io::IstreamInputStream raw_input(proto_file_ptr);
+  google::protobuf::io::CodedInputStream coded_input(&raw_input);
+  uint32_t message_size;
+  if (!coded_input.ReadVarint32(&message_size)) {
+    return false;
+  }
+  *tmp_byte_offset_ptr += coded_input.CurrentPosition() + message_size;
+  return true;
+}
+
 }  // namespace panoptic_mapping
@@ -0,0 +1,505 @@
+#include "panoptic_mapping/tools/shared_map_client.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <string>
+#include <utility>
+
+namespace panoptic_mapping {
+
+using shared_map::BlockEntry;
+using shared_map::SegmentHeader;
+using shared_map::SlotHeader;
+using shared_map::SubmapRecord;
+using shared_map::Voxel;
+
+namespace {
+
+// Upper bound of the voxels per side, such that voxel offsets cannot overflow.
+constexpr int kMaxVoxelsPerSide = 256;
+
+bool isFreeSpace(const SubmapRecord& record) {
+  return record.label == static_cast<int32_t>(PanopticLabel::kFreeSpace);
+}
+
+bool hasChangeState(const SubmapRecord& record, ChangeState state) {
+  return record.change_state == static_cast<int32_t>(state);
+}
+
+// Whether 'count' elements of 'element_size' bytes at 'offset' are in a slot.
+bool isInSlot(uint64_t offset, uint64_t count, size_t element_size,
+              size_t slot_size) {
+  return offset <= slot_size && count <= (slot_size - offset) / element_size;
+}
+
+}  // namespace
+
+SharedMapClient::SharedMapClient(const std::string& segment_name) {
+  connect(segment_name);
+}
+
+SharedMapClient::~SharedMapClient() { disconnect(); }
+
+bool SharedMapClient::connect(const std::string& segment_name) {
+  disconnect();
+  const int fd = shm_open(segment_name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    LOG(WARNING) << "Shared map segment '" << segment_name
+                 << "' does not exist.";
+    return false;
+  }
+  struct stat stats;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &stats) == 0 &&
+      static_cast<size_t>(stats.st_size) >= sizeof(SegmentHeader)) {
+    data = mmap(nullptr, stats.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(WARNING) << "Could not map shared map segment '" << segment_name
+                 << "'.";
+    return false;
+  }
+
+  // Check the segment was initialized by a compatible exporter.
+  const auto header = static_cast<const SegmentHeader*>(data);
+  const size_t size = stats.st_size;
+  const bool is_valid =
+      header->magic == shared_map::kMagic &&
+      header->version == shared_map::kVersion &&
+      header->slot_size <= size &&
+      shared_map::slotsOffset() + shared_map::kNumSlots * header->slot_size <=
+          size;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!is_valid) {
+    LOG(WARNING) << "Shared map segment '" << segment_name
+                 << "' is not a compatible map segment.";
+    munmap(data, size);
+    return false;
+  }
+  header_ = header;
+  segment_size_ = size;
+  return true;
+}
+
+void SharedMapClient::disconnect() {
+  if (header_) {
+    munmap(const_cast<SegmentHeader*>(header_), segment_size_);
+    header_ = nullptr;
+    segment_size_ = 0;
+  }
+}
+
+uint64_t SharedMapClient::getGeneration() const {
+  if (!header_) {
+    return 0;
+  }
+  return header_->generation.load(std::memory_order_acquire);
+}
+
+template <typename ResultT, typename QueryT>
+bool SharedMapClient::evaluate(QueryT query, ResultT* result) const {
+  if (!header_ || header_->generation.load(std::memory_order_acquire) == 0) {
+    return false;
+  }
+  for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    const uint64_t slot_index =
+        header_->current_slot.load(std::memory_order_acquire);
+    if (slot_index >= shared_map::kNumSlots) {
+      return false;
+    }
+    const SlotHeader& slot_header = header_->slots[slot_index];
+    const uint64_t sequence =
+        slot_header.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      // The slot is being rewritten, the current slot changes shortly.
+      continue;
+    }
+    Slot slot;
+    slot.data = reinterpret_cast<const char*>(header_) +
+                shared_map::slotsOffset() + slot_index * header_->slot_size;
+    slot.size = std::min<uint64_t>(slot_header.used_bytes, header_->slot_size);
+    slot.num_submaps = std::min<uint64_t>(slot_header.num_submaps,
+                                          slot.size / sizeof(SubmapRecord));
+    ResultT candidate = query(slot);
+
+    // The result is only valid if the slot did not change meanwhile.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot_header.sequence.load(std::memory_order_relaxed) == sequence) {
+      *result = std::move(candidate);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SharedMapClient::isObserved(const Point& position,
+                                 bool include_inactive_maps) const {
+  bool result = false;
+  evaluate(
+      [&](const Slot& slot) {
+        return isObserved(slot, position, include_inactive_maps);
+      },
+      &result);
+  return result;
+}
+
+SharedMapClient::VoxelState SharedMapClient::getVoxelState(
+    const Point& position) const {
+  VoxelState result = VoxelState::kUnknown;
+  evaluate([&](const Slot& slot) { return getVoxelState(slot, position); },
+           &result);
+  return result;
+}
+
+bool SharedMapClient::getDistance(const Point& position, float* distance,
+                                  bool consider_change_state,
+                                  bool include_free_space) const {
+  CHECK_NOTNULL(distance);
+  std::pair<bool, float> result(false, 0.f);
+  evaluate(
+      [&](const Slot& slot) {
+        std::pair<bool, float> observed_distance(false, 0.f);
+        observed_distance.first =
+            getDistance(slot, position, &observed_distance.second,
+                        consider_change_state, include_free_space);
+        return observed_distance;
+      },
+      &result);
+  if (result.first) {
+    *distance = result.second;
+  }
+  return result.first;
+}
+
+const SubmapRecord* SharedMapClient::getRecord(const Slot& slot,
+                                               uint32_t index) {
+  if (index >= slot.num_submaps) {
+    return nullptr;
+  }
+  const SubmapRecord* record =
+      reinterpret_cast<const SubmapRecord*>(slot.data) + index;
+  const int vps = record->voxels_per_side;
+  if (vps <= 0 || vps > kMaxVoxelsPerSide || (vps & (vps - 1)) != 0 ||
+      !(record->voxel_size > 0.f)) {
+    return nullptr;
+  }
+  return record;
+}
+
+const BlockEntry* SharedMapClient::findBlock(const Slot& slot,
+                                             const SubmapRecord& record,
+                                             const BlockIndex& index) {
+  const uint64_t capacity = record.blocks_capacity;
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+      !isInSlot(record.blocks_offset, capacity, sizeof(BlockEntry),
+                slot.size)) {
+    return nullptr;
+  }
+  const auto table =
+      reinterpret_cast<const BlockEntry*>(slot.data + record.blocks_offset);
+  uint64_t bucket = shared_map::blockHash(index.x(), index.y(), index.z());
+  for (uint64_t i = 0; i < capacity; ++i, ++bucket) {
+    const BlockEntry& entry = table[bucket & (capacity - 1)];
+    if (!(entry.flags & BlockEntry::kOccupied)) {
+      return nullptr;
+    }
+    if (entry.x == index.x() && entry.y == index.y() && entry.z == index.z()) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const Voxel* SharedMapClient::lookupVoxel(
+    const Slot& slot, const SubmapRecord& record,
+    const voxblox::GlobalIndex& voxel_index) {
+  const int vps = record.voxels_per_side;
+  const BlockEntry* entry = findBlock(
+      slot, record,
+      voxblox::getBlockIndexFromGlobalVoxelIndex(voxel_index, 1.f / vps));
+  if (!entry) {
+    return nullptr;
+  }
+  size_t linear_index = 0;
+  size_t num_voxels = 1;
+  if (!(entry->flags & BlockEntry::kUniform)) {
+    const VoxelIndex local_index =
+        voxblox::getLocalFromGlobalVoxelIndex(voxel_index, vps);
+    linear_index =
+        local_index.x() + vps * (local_index.y() + vps * local_index.z());
+    num_voxels = static_cast<size_t>(vps) * vps * vps;
+  }
+  if (!isInSlot(entry->voxels_offset, num_voxels, sizeof(Voxel), slot.size)) {
+    return nullptr;
+  }
+  return reinterpret_cast<const Voxel*>(slot.data + entry->voxels_offset) +
+         linear_index;
+}
+
+bool SharedMapClient::transformToSubmap(const SubmapRecord& record,
+                                        const Point& position,
+                                        Point* position_S) {
+  const float* T = record.T_S_M;
+  for (int row = 0; row < 3; ++row) {
+    (*position_S)[row] = T[row * 4] * position.x() +
+                         T[row * 4 + 1] * position.y() +
+                         T[row * 4 + 2] * position.z() + T[row * 4 + 3];
+  }
+  const Point center(record.bounding_center[0], record.bounding_center[1],
+                     record.bounding_center[2]);
+  return (center - *position_S).norm() <= record.bounding_radius;
+}
+
+bool SharedMapClient::belongsToSubmap(const Slot& slot,
+                                      const SubmapRecord& record,
+                                      const Point& position_S) {
+  const int vps = record.voxels_per_side;
+  const voxblox::GlobalIndex voxel_index =
+      voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(
+          position_S, 1.f / record.voxel_size);
+  const BlockEntry* entry = findBlock(
+      slot, record,
+      voxblox::getBlockIndexFromGlobalVoxelIndex(voxel_index, 1.f / vps));
+  // Blocks without class block have no class voxels.
+  if (!entry || entry->class_mask_offset == 0) {
+    return false;
+  }
+  const size_t num_voxels = static_cast<size_t>(vps) * vps * vps;
+  if (!isInSlot(entry->class_mask_offset, 1,
+                shared_map::classMaskSize(num_voxels), slot.size)) {
+    return false;
+  }
+  const VoxelIndex local_index =
+      voxblox::getLocalFromGlobalVoxelIndex(voxel_index, vps);
+  const size_t linear_index =
+      local_index.x() + vps * (local_index.y() + vps * local_index.z());
+  const auto mask =
+      reinterpret_cast<const uint64_t*>(slot.data + entry->class_mask_offset);
+  return (mask[linear_index / 64] >> (linear_index % 64)) & 1;
+}
+
+bool SharedMapClient::interpolateDistance(const Slot& slot,
+                                          const SubmapRecord& record,
+                                          const Point& position_S,
+                                          float* distance) {
+  // Interpolate between the centers of the 8 surrounding voxels, which all
+  // need to be observed.
+  const Point q = position_S / record.voxel_size - Point::Constant(0.5f);
+  const Point base = q.array().floor();
+  const Point weights = q - base;
+  const voxblox::GlobalIndex base_index =
+      base.cast<voxblox::LongIndexElement>();
+  float sdf = 0.f;
+  bool is_observed = true;
+  for (int i = 0; i < 8 && is_observed; ++i) {
+    const voxblox::GlobalIndex offset(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+    const Voxel* voxel = lookupVoxel(slot, record, base_index + offset);
+    if (!voxel || voxel->weight < kObservedMinWeight_) {
+      is_observed = false;
+      break;
+    }
+    float weight = 1.f;
+    for (int dim = 0; dim < 3; ++dim) {
+      weight *= offset[dim] ? weights[dim] : 1.f - weights[dim];
+    }
+    sdf += weight * voxel->distance;
+  }
+  if (is_observed) {
+    *distance = sdf;
+    return true;
+  }
+
+  // Collapsed blocks are uniform, so their value is used directly.
+  const voxblox::GlobalIndex voxel_index =
+      voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(
+          position_S, 1.f / record.voxel_size);
+  const BlockEntry* entry =
+      findBlock(slot, record,
+                voxblox::getBlockIndexFromGlobalVoxelIndex(
+                    voxel_index, 1.f / record.voxels_per_side));
+  if (!entry || !(entry->flags & BlockEntry::kUniform)) {
+    return false;
+  }
+  const Voxel* voxel = lookupVoxel(slot, record, voxel_index);
+  if (!voxel) {
+    return false;
+  }
+  *distance = voxel->distance;
+  return true;
+}
+
+bool SharedMapClient::isObserved(const Slot& slot, const Point& position,
+                                 bool include_inactive_maps) const {
+  for (uint32_t i = 0; i < slot.num_submaps; ++i) {
+    const SubmapRecord* record = getRecord(slot, i);
+    if (!record || (!include_inactive_maps && !record->is_active)) {
+      continue;
+    }
+    Point position_S;
+    if (!transformToSubmap(*record, position, &position_S)) {
+      continue;
+    }
+    const Voxel* voxel = lookupVoxel(
+        slot, *record,
+        voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(
+            position_S, 1.f / record->voxel_size));
+    if (voxel && voxel->weight >= kObservedMinWeight_) {
+      return true;
+    }
+  }
+  return false;
+}
+
+SharedMapClient::VoxelState SharedMapClient::getVoxelState(
+    const Slot& slot, const Point& position) const {
+  // See 'PlanningInterface::getVoxelState()'.
+  bool is_known_free = false;
+  bool is_expected_free = false;
+  bool is_expected_occupied = false;
+  bool is_persistent_occupied = false;
+  for (uint32_t i = 0; i < slot.num_submaps; ++i) {
+    const SubmapRecord* record = getRecord(slot, i);
+    if (!record || hasChangeState(*record, ChangeState::kAbsent)) {
+      continue;
+    }
+    const bool is_free_space = isFreeSpace(*record);
+    if (is_free_space) {
+      if (is_known_free || (is_expected_free && !record->is_active)) {
+        continue;
+      }
+    } else if (!record->is_active) {
+      if (is_persistent_occupied) {
+        continue;
+      }
+      if (hasChangeState(*record, ChangeState::kUnobserved) &&
+          is_expected_occupied) {
+        continue;
+      }
+    }
+
+    // Check the state.
+    Point position_S;
+    if (!transformToSubmap(*record, position, &position_S)) {
+      continue;
+    }
+    const Voxel* voxel = lookupVoxel(
+        slot, *record,
+        voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(
+            position_S, 1.f / record->voxel_size));
+    if (!voxel || voxel->weight <= kObservedMinWeight_) {
+      continue;
+    }
+    if (!is_free_space && voxel->distance <= record->voxel_size) {
+      if (record->is_active) {
+        return VoxelState::kKnownOccupied;
+      } else if (hasChangeState(*record, ChangeState::kPersistent)) {
+        is_persistent_occupied = true;
+      } else if (hasChangeState(*record, ChangeState::kUnobserved)) {
+        is_expected_occupied = true;
+      }
+    } else if (!is_free_space || voxel->distance > record->voxel_size) {
+      if (record->is_active) {
+        is_known_free = true;
+      } else {
+        is_expected_free = true;
+      }
+    }
+  }
+
+  // Aggregate result.
+  if (is_known_free) {
+    return VoxelState::kKnownFree;
+  } else if (is_persistent_occupied) {
+    return VoxelState::kPersistentOccupied;
+  } else if (is_expected_occupied) {
+    return VoxelState::kExpectedOccupied;
+  } else if (is_expected_free) {
+    return VoxelState::kExpectedFree;
+  }
+  return VoxelState::kUnknown;
+}
+
+bool SharedMapClient::getDistance(const Slot& slot, const Point& position,
+                                  float* distance, bool consider_change_state,
+                                  bool include_free_space) const {
+  // See 'PlanningInterface::getDistance()'. Distances and observedness in
+  // order of priority: [active obj (max res), persistent obj (min sdf), free
+  // space (fallback)]
+  constexpr float max = std::numeric_limits<float>::max();
+  float current_distance[3] = {max, max, max};
+  bool observed[3] = {false, false, false};
+  float current_resolution = max;
+
+  for (uint32_t i = 0; i < slot.num_submaps; ++i) {
+    const SubmapRecord* record = getRecord(slot, i);
+    if (!record) {
+      continue;
+    }
+    // Only include submaps considered present.
+    if (consider_change_state &&
+        (hasChangeState(*record, ChangeState::kAbsent) ||
+         hasChangeState(*record, ChangeState::kUnobserved))) {
+      continue;
+    }
+
+    // Check priority ordering to avoid duplicate lookups.
+    const bool is_free_space = isFreeSpace(*record);
+    if (is_free_space && !include_free_space) {
+      continue;
+    }
+    if (is_free_space) {
+      if (observed[0] || observed[1]) {
+        continue;
+      }
+    } else if (record->is_active) {
+      if (record->voxel_size >= current_resolution) {
+        continue;
+      }
+    } else if (observed[0]) {
+      continue;
+    }
+
+    // Look up the distance if it is observed.
+    Point position_S;
+    if (!transformToSubmap(*record, position, &position_S)) {
+      continue;
+    }
+    if (record->has_class_masks && !record->is_active &&
+        belongsToSubmap(slot, *record, position_S)) {
+      continue;
+    }
+    float sdf;
+    if (!interpolateDistance(slot, *record, position_S, &sdf)) {
+      continue;
+    }
+    if (is_free_space) {
+      current_distance[2] = std::min(current_distance[2], sdf);
+      observed[2] = true;
+    } else if (record->is_active) {
+      current_distance[0] = sdf;
+      current_resolution = record->voxel_size;
+      observed[0] = true;
+    } else {
+      current_distance[1] = std::min(current_distance[1], sdf);
+      observed[1] = true;
+    }
+  }
+
+  // Aggregate result.
+  for (size_t i = 0; i < 3; ++i) {
+    if (observed[i]) {
+      *distance = current_distance[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,310 @@
+#include "panoptic_mapping/tools/shared_map_exporter.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace panoptic_mapping {
+
+using shared_map::BlockEntry;
+using shared_map::SegmentHeader;
+using shared_map::SlotHeader;
+using shared_map::SubmapRecord;
+using shared_map::Voxel;
+
+namespace {
+
+uint64_t tableCapacity(size_t num_blocks) {
+  // Keep the load factor at most 0.5.
+  uint64_t capacity = 1;
+  while (capacity < 2 * num_blocks) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+// Collapsed blocks that are not also allocated in the layer.
+std::vector<BlockIndex> getCollapsedOnly(const Submap& submap) {
+  std::vector<BlockIndex> result;
+  if (!submap.getCollapsedBlocks()) {
+    return result;
+  }
+  for (const auto& index_voxel : submap.getCollapsedBlocks()->getBlocks()) {
+    if (!submap.getTsdfLayer().hasBlock(index_voxel.first)) {
+      result.push_back(index_voxel.first);
+    }
+  }
+  return result;
+}
+
+bool storesClassMasks(const Submap& submap) {
+  // Class masks are only used for inactive submaps, see 'PlanningInterface'.
+  return submap.hasClassLayer() && !submap.isActive();
+}
+
+}  // namespace
+
+void SharedMapExporter::Config::checkParams() const {
+  checkParamCond(segment_name.size() > 1 && segment_name[0] == '/',
+                 "'segment_name' must start with '/'.");
+  checkParamGT(slot_size_mb, 0, "slot_size_mb");
+}
+
+void SharedMapExporter::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("segment_name", &segment_name);
+  setupParam("slot_size_mb", &slot_size_mb, "MB");
+  setupParam("include_inactive_submaps", &include_inactive_submaps);
+  setupParam("include_free_space", &include_free_space);
+}
+
+SharedMapExporter::SharedMapExporter(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+  const size_t slot_size = static_cast<size_t>(config_.slot_size_mb) << 20;
+  segment_size_ = shared_map::slotsOffset() + shared_map::kNumSlots * slot_size;
+
+  // Create the segment. Pages are only backed by memory once written.
+  const int fd = shm_open(config_.segment_name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not create shared memory segment '"
+               << config_.segment_name << "': " << std::strerror(errno);
+    return;
+  }
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, segment_size_) == 0) {
+    data = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Could not map shared memory segment '"
+               << config_.segment_name << "': " << std::strerror(errno);
+    shm_unlink(config_.segment_name.c_str());
+    return;
+  }
+
+  // Initialize the header. The magic is written last, such that clients only
+  // accept initialized segments.
+  header_ = new (data) SegmentHeader();
+  header_->version = shared_map::kVersion;
+  header_->slot_size = slot_size;
+  header_->generation.store(0, std::memory_order_relaxed);
+  header_->current_slot.store(0, std::memory_order_relaxed);
+  for (SlotHeader& slot : header_->slots) {
+    slot.sequence.store(0, std::memory_order_relaxed);
+    slot.generation = 0;
+    slot.used_bytes = 0;
+    slot.num_submaps = 0;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = shared_map::kMagic;
+}
+
+SharedMapExporter::~SharedMapExporter() {
+  if (header_) {
+    munmap(header_, segment_size_);
+    shm_unlink(config_.segment_name.c_str());
+  }
+}
+
+uint64_t SharedMapExporter::getGeneration() const {
+  if (!header_) {
+    return 0;
+  }
+  return header_->generation.load(std::memory_order_relaxed);
+}
+
+bool SharedMapExporter::exportSnapshot(const SubmapCollection& submaps) {
+  if (!header_) {
+    return false;
+  }
+  Timer timer("shared_map_exporter/export");
+  std::vector<const Submap*> exported;
+  size_t size = 0;
+  for (const Submap& submap : submaps) {
+    if ((!submap.isActive() && !config_.include_inactive_submaps) ||
+        (submap.getLabel() == PanopticLabel::kFreeSpace &&
+         !config_.include_free_space)) {
+      continue;
+    }
+    exported.push_back(&submap);
+    size += computeSubmapSize(submap);
+  }
+  size += shared_map::alignUp(exported.size() * sizeof(SubmapRecord));
+  if (size > header_->slot_size) {
+    LOG_IF(WARNING, config_.verbosity >= 1)
+        << "Skipping shared map export, the snapshot (" << (size >> 20)
+        << "MB) does not fit into the slot (" << (header_->slot_size >> 20)
+        << "MB).";
+    return false;
+  }
+
+  // Write the slot that is not current under its sequence lock.
+  const uint64_t slot_index =
+      1 - header_->current_slot.load(std::memory_order_relaxed);
+  SlotHeader& slot = header_->slots[slot_index];
+  char* data = reinterpret_cast<char*>(header_) + shared_map::slotsOffset() +
+               slot_index * header_->slot_size;
+  const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  auto records = reinterpret_cast<SubmapRecord*>(data);
+  size_t offset = shared_map::alignUp(exported.size() * sizeof(SubmapRecord));
+  for (size_t i = 0; i < exported.size(); ++i) {
+    offset = writeSubmap(*exported[i], data, offset, &records[i]);
+  }
+  const uint64_t generation =
+      header_->generation.load(std::memory_order_relaxed) + 1;
+  slot.generation = generation;
+  slot.used_bytes = offset;
+  slot.num_submaps = exported.size();
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+
+  // Publish the slot.
+  header_->current_slot.store(slot_index, std::memory_order_release);
+  header_->generation.store(generation, std::memory_order_release);
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Exported generation " << generation << " with " << exported.size()
+      << " submaps (" << (offset >> 10) << "kB).";
+  return true;
+}
+
+size_t SharedMapExporter::computeSubmapSize(const Submap& submap) {
+  const TsdfLayer& layer = submap.getTsdfLayer();
+  const size_t num_blocks = layer.getNumberOfAllocatedBlocks();
+  const size_t num_collapsed = getCollapsedOnly(submap).size();
+  const size_t num_voxels = layer.voxels_per_side() *
+                            layer.voxels_per_side() * layer.voxels_per_side();
+  size_t size = shared_map::alignUp(tableCapacity(num_blocks + num_collapsed) *
+                                    sizeof(BlockEntry));
+  size += shared_map::alignUp(num_blocks * num_voxels * sizeof(Voxel));
+  size += shared_map::alignUp(num_collapsed * sizeof(Voxel));
+  if (storesClassMasks(submap)) {
+    size += shared_map::alignUp(num_blocks *
+                                shared_map::classMaskSize(num_voxels));
+  }
+  return size;
+}
+
+size_t SharedMapExporter::writeSubmap(const Submap& submap, char* slot,
+                                      size_t offset, SubmapRecord* record) {
+  const TsdfLayer& layer = submap.getTsdfLayer();
+  const int voxels_per_side = layer.voxels_per_side();
+  const size_t num_voxels = voxels_per_side * voxels_per_side * voxels_per_side;
+  const bool store_class_masks = storesClassMasks(submap);
+
+  // Metadata.
+  record->id = submap.getID();
+  record->class_id = submap.getClassID();
+  record->label = static_cast<int32_t>(submap.getLabel());
+  record->change_state = static_cast<int32_t>(submap.getChangeState());
+  record->is_active = submap.isActive();
+  record->has_class_masks = store_class_masks;
+  record->padding = 0;
+  record->voxels_per_side = voxels_per_side;
+  record->voxel_size = layer.voxel_size();
+  record->truncation_distance = submap.getConfig().truncation_distance;
+  const Eigen::Matrix<FloatingPoint, 4, 4> T_S_M =
+      submap.getT_S_M().getTransformationMatrix();
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 4; ++col) {
+      record->T_S_M[row * 4 + col] = T_S_M(row, col);
+    }
+  }
+  const Point& center = submap.getBoundingVolume().getCenter();
+  for (int i = 0; i < 3; ++i) {
+    record->bounding_center[i] = center[i];
+  }
+  record->bounding_radius = submap.getBoundingVolume().getRadius();
+
+  // Block table.
+  voxblox::BlockIndexList block_indices;
+  layer.getAllAllocatedBlocks(&block_indices);
+  const std::vector<BlockIndex> collapsed = getCollapsedOnly(submap);
+  const uint64_t capacity =
+      tableCapacity(block_indices.size() + collapsed.size());
+  record->blocks_offset = offset;
+  record->blocks_capacity = capacity;
+  auto table = reinterpret_cast<BlockEntry*>(slot + offset);
+  std::memset(table, 0, capacity * sizeof(BlockEntry));
+  offset += shared_map::alignUp(capacity * sizeof(BlockEntry));
+  auto insert = [&](const BlockIndex& index) -> BlockEntry& {
+    uint64_t bucket = shared_map::blockHash(index.x(), index.y(), index.z());
+    while (table[bucket & (capacity - 1)].flags & BlockEntry::kOccupied) {
+      ++bucket;
+    }
+    BlockEntry& entry = table[bucket & (capacity - 1)];
+    entry.x = index.x();
+    entry.y = index.y();
+    entry.z = index.z();
+    entry.flags = BlockEntry::kOccupied;
+    return entry;
+  };
+
+  // Voxels of the allocated blocks.
+  std::vector<BlockEntry*> entries;
+  entries.reserve(block_indices.size());
+  for (const BlockIndex& index : block_indices) {
+    const TsdfBlock& block = layer.getBlockByIndex(index);
+    BlockEntry& entry = insert(index);
+    entries.push_back(&entry);
+    entry.voxels_offset = offset;
+    auto voxels = reinterpret_cast<Voxel*>(slot + offset);
+    for (size_t i = 0; i < num_voxels; ++i) {
+      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+      voxels[i].distance = voxel.distance;
+      voxels[i].weight = voxel.weight;
+    }
+    offset += num_voxels * sizeof(Voxel);
+  }
+  offset = shared_map::alignUp(offset);
+
+  // Collapsed blocks store their uniform value.
+  for (const BlockIndex& index : collapsed) {
+    const TsdfVoxel& voxel = *submap.getCollapsedBlocks()->getVoxel(index);
+    BlockEntry& entry = insert(index);
+    entry.flags |= BlockEntry::kUniform;
+    entry.voxels_offset = offset;
+    auto value = reinterpret_cast<Voxel*>(slot + offset);
+    value->distance = voxel.distance;
+    value->weight = voxel.weight;
+    offset += sizeof(Voxel);
+  }
+  offset = shared_map::alignUp(offset);
+
+  // Class masks.
+  if (store_class_masks) {
+    const ClassLayer& class_layer = submap.getClassLayer();
+    const size_t mask_size = shared_map::classMaskSize(num_voxels);
+    for (size_t block = 0; block < block_indices.size(); ++block) {
+      const ClassBlock::ConstPtr class_block =
+          class_layer.getBlockConstPtrByIndex(block_indices[block]);
+      if (!class_block) {
+        continue;
+      }
+      auto mask = reinterpret_cast<uint64_t*>(slot + offset);
+      std::memset(mask, 0, mask_size);
+      for (size_t i = 0; i < num_voxels; ++i) {
+        if (class_block->getVoxelByLinearIndex(i).belongsToSubmap()) {
+          mask[i / 64] |= uint64_t(1) << (i % 64);
+        }
+      }
+      entries[block]->class_mask_offset = offset;
+      offset += mask_size;
+    }
+    offset = shared_map::alignUp(offset);
+  }
+  return offset;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,112 @@
+#include "panoptic_mapping/tools/submap_stream_receiver.h"
+
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "panoptic_mapping/SubmapCollection.pb.h"
+
+namespace panoptic_mapping {
+
+void SubmapStreamReceiver::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("update_meshes", &update_meshes);
+  setupParam("deactivate_submaps", &deactivate_submaps);
+}
+
+void SubmapStreamReceiver::Config::checkParams() const {}
+
+SubmapStreamReceiver::SubmapStreamReceiver(const Config& config,
+                                           bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+bool SubmapStreamReceiver::applyMessage(const std::string& message,
+                                        SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  Timer timer("tools/submap_stream_receiver/apply");
+  std::istringstream stream(message,
+                            std::ios_base::in | std::ios_base::binary);
+  uint64_t byte_offset = 0u;
+  MapCheckpointProto header;
+  if (!voxblox::utils::readProtoMsgFromStream(&stream, &header,
+                                              &byte_offset)) {
+    LOG(WARNING) << "Could not read submap stream message header.";
+    return false;
+  }
+
+  // Incremental messages only apply on top of their predecessor.
+  if (!header.is_full() &&
+      (!is_synchronized_ ||
+       header.sequence_number() != next_sequence_number_)) {
+    LOG_IF(WARNING, config_.verbosity >= 2 && is_synchronized_)
+        << "Missed submap stream messages " << next_sequence_number_ << " to "
+        << header.sequence_number() - 1
+        << ", waiting for the next full message.";
+    is_synchronized_ = false;
+    return false;
+  }
+  std::unordered_map<int, voxblox::BlockIndexList> updated_blocks;
+  is_synchronized_ = submaps->applyCheckpointFromStream(
+      header, &stream, &byte_offset, &id_map_, &updated_blocks);
+  next_sequence_number_ = header.sequence_number() + 1;
+  LOG_IF(WARNING, !is_synchronized_)
+      << "Submap stream message " << header.sequence_number()
+      << " was only partially applied, waiting for the next full message.";
+
+  // Update the data derived from the received blocks, also after partial
+  // updates.
+  std::vector<Submap*> updated_submaps;
+  for (const auto& id_blocks_pair : updated_blocks) {
+    if (!submaps->submapIdExists(id_blocks_pair.first)) {
+      continue;
+    }
+    Submap* submap = submaps->getSubmapPtr(id_blocks_pair.first);
+    if (config_.deactivate_submaps) {
+      submap->setIsActive(false);
+    }
+    TsdfLayer& layer = *submap->getTsdfLayerPtr();
+    voxblox::IndexSet blocks;
+    for (const BlockIndex& index : id_blocks_pair.second) {
+      TsdfBlock::Ptr block = layer.getBlockPtrByIndex(index);
+      if (block) {
+        block->setUpdatedAll();
+        blocks.insert(index);
+      }
+    }
+    submap->updateBoundingVolume(blocks);
+    updated_submaps.push_back(submap);
+  }
+  if (config_.update_meshes) {
+    SubmapCollection::updateMeshes(updated_submaps, submaps->getThreadPool());
+  }
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Applied " << (header.is_full() ? "full" : "incremental")
+      << " submap message " << header.sequence_number() << " ("
+      << message.size() << " bytes), updated " << updated_submaps.size()
+      << " submaps.";
+  return is_synchronized_;
+}
+
+void SubmapStreamReceiver::reset(SubmapCollection* submaps) {
+  CHECK_NOTNULL(submaps);
+  submaps->removeSubmaps(getSubmapIDs());
+  id_map_ = SourceIDMap();
+  is_synchronized_ = false;
+}
+
+std::vector<int> SubmapStreamReceiver::getSubmapIDs() const {
+  std::vector<int> result;
+  result.reserve(id_map_.submap_ids.size());
+  for (const auto& source_local_pair : id_map_.submap_ids) {
+    result.push_back(source_local_pair.second);
+  }
+  return result;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,104 @@
+#include "panoptic_mapping/tools/submap_streamer.h"
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "panoptic_mapping/SubmapCollection.pb.h"
+#include "panoptic_mapping/tools/serialization.h"
+
+namespace panoptic_mapping {
+
+void SubmapStreamer::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("max_incremental_messages", &max_incremental_messages);
+  setupParam("quantize_tsdf", &quantize_tsdf);
+  setupParam("distance_bits", &distance_bits);
+  setupParam("drop_color", &drop_color);
+}
+
+void SubmapStreamer::Config::checkParams() const {
+  checkParamGE(max_incremental_messages, 0, "max_incremental_messages");
+  checkParamCond(distance_bits == 8 || distance_bits == 16,
+                 "'distance_bits' is required to be 8 or 16.");
+}
+
+SubmapStreamer::SubmapStreamer(const Config& config, bool print_config)
+    : config_(config.checkValid()) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+bool SubmapStreamer::encodeMessage(
+    std::shared_ptr<const SubmapCollection> snapshot, std::string* message) {
+  CHECK_NOTNULL(snapshot.get());
+  CHECK_NOTNULL(message);
+  Timer timer("tools/submap_streamer/encode");
+
+  // Periodically send all submaps such that receivers can resynchronize.
+  const bool requested = full_message_requested_.exchange(false);
+  const bool full =
+      requested || !previous_ ||
+      (config_.max_incremental_messages > 0 &&
+       num_incremental_messages_ >= config_.max_incremental_messages);
+  TsdfQuantization quantization;
+  quantization.distance_bits = config_.distance_bits;
+  quantization.drop_color = config_.drop_color;
+  CheckpointSelection selection;
+  if (submap_filter_) {
+    for (const Submap& submap : *snapshot) {
+      if (submap_filter_(submap)) {
+        selection.submap_ids.insert(submap.getID());
+      }
+    }
+    selection.previous_submap_ids = previous_ids_;
+  }
+  std::ostringstream stream(std::ios_base::out | std::ios_base::binary);
+  if (!snapshot->saveCheckpointToStream(
+          full ? nullptr : previous_.get(), sequence_number_, &stream,
+          config_.quantize_tsdf ? &quantization : nullptr,
+          submap_filter_ ? &selection : nullptr)) {
+    LOG(ERROR) << "Could not encode submap stream message "
+               << sequence_number_ << ".";
+    // Start over with a full message next time.
+    previous_.reset();
+    return false;
+  }
+  *message = stream.str();
+
+  // Read back the header to skip messages without any changes.
+  MapCheckpointProto header;
+  std::istringstream header_stream(*message, std::ios_base::in |
+                                                 std::ios_base::binary);
+  uint64_t byte_offset = 0u;
+  if (!voxblox::utils::readProtoMsgFromStream(&header_stream, &header,
+                                              &byte_offset)) {
+    LOG(ERROR) << "Could not read back submap stream message header.";
+    previous_.reset();
+    return false;
+  }
+  std::unordered_set<int> ids(header.submap_ids().begin(),
+                              header.submap_ids().end());
+  previous_ = std::move(snapshot);
+  if (!full && header.num_submap_updates() == 0 && ids == previous_ids_) {
+    message->clear();
+    return false;
+  }
+  previous_ids_ = std::move(ids);
+  if (full) {
+    num_incremental_messages_ = 0;
+  } else {
+    num_incremental_messages_++;
+  }
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Encoded " << (full ? "full" : "incremental") << " submap message "
+      << sequence_number_ << " with " << header.num_submap_updates()
+      << " submap updates (" << message->size() << " bytes).";
+  sequence_number_++;
+  return true;
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,243 @@
+#include "panoptic_mapping/tools/voxel_state_map.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "panoptic_mapping/common/thread_pool.h"
+
+namespace panoptic_mapping {
+
+void VoxelStateMap::Config::checkParams() const {
+  checkParamGT(voxel_size, 0.f, "voxel_size");
+  checkParamGT(voxels_per_side, 0, "voxels_per_side");
+}
+
+void VoxelStateMap::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("voxel_size", &voxel_size, "m");
+  setupParam("voxels_per_side", &voxels_per_side);
+}
+
+VoxelStateMap::VoxelStateMap(const Config& config, bool print_config)
+    : config_(config.checkValid()),
+      block_size_(config_.voxel_size * config_.voxels_per_side),
+      block_size_inv_(1.f / block_size_),
+      num_cells_(static_cast<size_t>(config_.voxels_per_side) *
+                 config_.voxels_per_side * config_.voxels_per_side) {
+  LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
+                                                       << config_.toString();
+}
+
+void VoxelStateMap::processChanges(const MapChangeSet& changes,
+                                   const SubmapCollection& submaps) {
+  // Missed change sets require a full recomputation.
+  const bool is_consecutive =
+      !has_sequence_number_ ||
+      changes.sequence_number == next_sequence_number_;
+  has_sequence_number_ = true;
+  next_sequence_number_ = changes.sequence_number + 1;
+  if (!is_initialized_) {
+    return;
+  }
+  if (!is_consecutive) {
+    LOG_IF(WARNING, config_.verbosity >= 2)
+        << "Missed map changes, recomputing all voxel states.";
+    markAll(submaps);
+    return;
+  }
+
+  // Submaps whose whole extent changed.
+  for (const int submap_id : changes.removed_submaps) {
+    markSubmap(submap_id);
+  }
+  for (const auto* submap_ids :
+       {&changes.created_submaps, &changes.moved_submaps,
+        &changes.finished_submaps, &changes.change_state_submaps}) {
+    for (const int submap_id : *submap_ids) {
+      markSubmap(submap_id);
+      if (submaps.submapIdExists(submap_id)) {
+        markBoundingVolume(submaps.getSubmap(submap_id));
+      }
+    }
+  }
+
+  // Changed blocks.
+  for (const auto& id_blocks_pair : changes.blocks) {
+    if (!submaps.submapIdExists(id_blocks_pair.first)) {
+      continue;
+    }
+    const Submap& submap = submaps.getSubmap(id_blocks_pair.first);
+    voxblox::IndexSet& covered_blocks = submap_blocks_[submap.getID()];
+    const FloatingPoint submap_block_size =
+        submap.getConfig().voxel_size * submap.getConfig().voxels_per_side;
+    for (const auto* indices :
+         {&id_blocks_pair.second.created, &id_blocks_pair.second.updated,
+          &id_blocks_pair.second.removed}) {
+      for (const BlockIndex& index : *indices) {
+        // Box of the transformed block corners.
+        const Point origin_S =
+            index.cast<FloatingPoint>() * submap_block_size;
+        Point min_M = Point::Constant(std::numeric_limits<float>::max());
+        Point max_M = Point::Constant(std::numeric_limits<float>::lowest());
+        for (int corner = 0; corner < 8; ++corner) {
+          const Point offset(corner & 1, (corner >> 1) & 1, corner >> 2);
+          const Point corner_M =
+              submap.getT_M_S() * (origin_S + offset * submap_block_size);
+          min_M = min_M.cwiseMin(corner_M);
+          max_M = max_M.cwiseMax(corner_M);
+        }
+        addBlocksInBox(min_M, max_M, &covered_blocks);
+      }
+    }
+  }
+}
+
+void VoxelStateMap::update(const PlanningInterface& planning_interface) {
+  Timer timer("voxel_state_map/update");
+  if (!is_initialized_) {
+    markAll(planning_interface.getSubmapCollection());
+    is_initialized_ = true;
+  }
+  if (dirty_blocks_.empty()) {
+    return;
+  }
+  const std::vector<BlockIndex> indices(dirty_blocks_.begin(),
+                                        dirty_blocks_.end());
+  dirty_blocks_.clear();
+
+  // Recompute the blocks in parallel.
+  std::vector<StateBlock> results(indices.size());
+  std::vector<uint8_t> has_states(indices.size(), 0);
+  std::atomic<size_t> next_index(0);
+  ThreadPool* thread_pool =
+      planning_interface.getSubmapCollection().getThreadPool();
+  const size_t num_threads =
+      std::min<size_t>(thread_pool->getNumThreads(), indices.size());
+  std::vector<std::future<void>> threads;
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(thread_pool->submit([&]() {
+      size_t index;
+      while ((index = next_index++) < indices.size()) {
+        has_states[index] = computeBlock(planning_interface, indices[index],
+                                         &results[index]);
+      }
+    }));
+  }
+  thread_pool->waitAll(&threads);
+
+  // Store the blocks, entirely unknown blocks are dropped.
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (has_states[i]) {
+      blocks_[indices[i]] = std::move(results[i]);
+    } else {
+      blocks_.erase(indices[i]);
+    }
+  }
+  LOG_IF(INFO, config_.verbosity >= 3)
+      << "Updated " << indices.size() << " voxel state blocks, "
+      << blocks_.size() << " blocks are stored.";
+}
+
+VoxelStateMap::VoxelState VoxelStateMap::getVoxelState(
+    const Point& position) const {
+  const BlockIndex block_index =
+      voxblox::getGridIndexFromPoint<BlockIndex>(position, block_size_inv_);
+  const auto it = blocks_.find(block_index);
+  if (it == blocks_.end()) {
+    return VoxelState::kUnknown;
+  }
+  const Point offset =
+      (position - block_index.cast<FloatingPoint>() * block_size_) /
+      config_.voxel_size;
+  const int max_index = config_.voxels_per_side - 1;
+  size_t linear_index = 0;
+  for (int axis = 2; axis >= 0; --axis) {
+    const int index = std::clamp(
+        static_cast<int>(std::floor(offset[axis])), 0, max_index);
+    linear_index = linear_index * config_.voxels_per_side + index;
+  }
+  const uint8_t cells = it->second[linear_index / 2];
+  return static_cast<VoxelState>((cells >> ((linear_index & 1) * 4)) & 0xF);
+}
+
+size_t VoxelStateMap::getMemorySize() const {
+  size_t result = sizeof(VoxelStateMap);
+  for (const auto& index_block_pair : blocks_) {
+    result += sizeof(index_block_pair) + index_block_pair.second.capacity();
+  }
+  return result;
+}
+
+void VoxelStateMap::addBlocksInBox(const Point& min_M, const Point& max_M,
+                                   voxblox::IndexSet* blocks) {
+  const BlockIndex min_index =
+      voxblox::getGridIndexFromPoint<BlockIndex>(min_M, block_size_inv_);
+  const BlockIndex max_index =
+      voxblox::getGridIndexFromPoint<BlockIndex>(max_M, block_size_inv_);
+  BlockIndex index;
+  for (index.x() = min_index.x(); index.x() <= max_index.x(); ++index.x()) {
+    for (index.y() = min_index.y(); index.y() <= max_index.y(); ++index.y()) {
+      for (index.z() = min_index.z(); index.z() <= max_index.z();
+           ++index.z()) {
+        blocks->insert(index);
+        dirty_blocks_.insert(index);
+      }
+    }
+  }
+}
+
+void VoxelStateMap::markSubmap(int submap_id) {
+  auto it = submap_blocks_.find(submap_id);
+  if (it == submap_blocks_.end()) {
+    return;
+  }
+  dirty_blocks_.insert(it->second.begin(), it->second.end());
+  submap_blocks_.erase(it);
+}
+
+void VoxelStateMap::markBoundingVolume(const Submap& submap) {
+  const SubmapBoundingVolume& volume = submap.getBoundingVolume();
+  const Point center_M = submap.getT_M_S() * volume.getCenter();
+  const Point radius = Point::Constant(volume.getRadius());
+  addBlocksInBox(center_M - radius, center_M + radius,
+                 &submap_blocks_[submap.getID()]);
+}
+
+void VoxelStateMap::markAll(const SubmapCollection& submaps) {
+  for (const auto& index_block_pair : blocks_) {
+    dirty_blocks_.insert(index_block_pair.first);
+  }
+  submap_blocks_.clear();
+  for (const Submap& submap : submaps) {
+    markBoundingVolume(submap);
+  }
+}
+
+bool VoxelStateMap::computeBlock(const PlanningInterface& planning_interface,
+                                 const BlockIndex& index,
+                                 StateBlock* block) const {
+  block->assign((num_cells_ + 1) / 2, 0);
+  bool has_state = false;
+  PlanningInterface::QueryContext context;
+  const Point origin = index.cast<FloatingPoint>() * block_size_;
+  const int num_per_side = config_.voxels_per_side;
+  for (size_t i = 0; i < num_cells_; ++i) {
+    const Point cell(i % num_per_side, (i / num_per_side) % num_per_side,
+                     i / (num_per_side * num_per_side));
+    const VoxelState state = planning_interface.computeVoxelState(
+        origin + (cell.array() + 0.5f).matrix() * config_.voxel_size,
+        &context);
+    if (state != VoxelState::kUnknown) {
+      (*block)[i / 2] |= static_cast<uint8_t>(state) << ((i & 1) * 4);
+      has_state = true;
+    }
+  }
+  return has_state;
+}
+
+}  // namespace panoptic_mapping
@@ -3,6 +3,7 @@
 #include <memory>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "panoptic_mapping/common/index_getter.h"
 
@@ -42,40 +43,59 @@ void DetectronIDTracker::processInput(SubmapCollection* submaps,
   ProjectiveIDTracker::processInput(submaps, input);
 }
 
-Submap* DetectronIDTracker::allocateSubmap(int input_id,
-                                           SubmapCollection* submaps,
-                                           InputData* input) {
-  if (input_id == 0) {
-    // The id 0 is used for no-predictions in detectron.
-    return nullptr;
-  }
+std::vector<Submap*> DetectronIDTracker::allocateSubmaps(
+    const std::vector<int>& input_ids, SubmapCollection* submaps,
+    InputData* input) {
+  // Parse the detectron labels of all known instance codes.
+  std::vector<Submap*> result(input_ids.size(), nullptr);
+  std::vector<int> valid_ids;
+  std::vector<LabelEntry> labels;
+  std::vector<size_t> result_indices;
+  for (size_t i = 0; i < input_ids.size(); ++i) {
+    const int input_id = input_ids[i];
+    if (input_id == 0) {
+      // The id 0 is used for no-predictions in detectron.
+      continue;
+    }
 
-  // Check whether the instance code is known.
-  auto it = labels_->find(input_id);
-  if (it == labels_->end()) {
-    return nullptr;
-  }
+    // Check whether the instance code is known.
+    auto it = labels_->find(input_id);
+    if (it == labels_->end()) {
+      continue;
+    }
 
-  // Parse detectron label.
-  LabelEntry label;
-  const int class_id = it->second.category_id;
-  if (globals_->labelHandler()->segmentationIdExists(class_id)) {
-    label = globals_->labelHandler()->getLabelEntry(input_id);
-  }
-  if (it->second.is_thing) {
-    label.label = PanopticLabel::kInstance;
-  } else {
-    label.label = PanopticLabel::kBackground;
+    // Parse detectron label.
+    LabelEntry label;
+    const int class_id = it->second.category_id;
+    if (globals_->labelHandler()->segmentationIdExists(class_id)) {
+      label = globals_->labelHandler()->getLabelEntry(input_id);
+    }
+    if (it->second.is_thing) {
+      label.label = PanopticLabel::kInstance;
+    } else {
+      label.label = PanopticLabel::kBackground;
+    }
+    valid_ids.push_back(input_id);
+    labels.push_back(label);
+    result_indices.push_back(i);
   }
 
-  // Allocate new submap.
-  Submap* new_submap =
-      submap_allocator_->allocateSubmap(submaps, input, input_id, label);
-  new_submap->setClassID(class_id);
-  if (globals_->labelHandler()->segmentationIdExists(class_id)) {
-    new_submap->setName(globals_->labelHandler()->getName(class_id));
+  // Allocate new submaps.
+  const std::vector<Submap*> new_submaps =
+      submap_allocator_->allocateSubmaps(submaps, input, valid_ids, labels);
+  for (size_t i = 0; i < new_submaps.size(); ++i) {
+    Submap* new_submap = new_submaps[i];
+    result[result_indices[i]] = new_submap;
+    if (!new_submap) {
+      continue;
+    }
+    const int class_id = labels_->at(valid_ids[i]).category_id;
+    new_submap->setClassID(class_id);
+    if (globals_->labelHandler()->segmentationIdExists(class_id)) {
+      new_submap->setName(globals_->labelHandler()->getName(class_id));
+    }
   }
-  return new_submap;
+  return result;
 }
 
 bool DetectronIDTracker::classesMatch(int input_id, int submap_class_id) {
@@ -1,13 +1,17 @@
 #include "panoptic_mapping/tracking/projective_id_tracker.h"
 
+#include <algorithm>
 #include <future>
+#include <limits>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "panoptic_mapping/common/index_getter.h"
+#include "panoptic_mapping/tracking/sparse_assignment.h"
 
 namespace panoptic_mapping {
 
@@ -19,7 +23,15 @@ void ProjectiveIDTracker::Config::checkParams() const {
   checkParamGT(rendering_threads, 0, "rendering_threads");
   checkParamNE(depth_tolerance, 0.f, "depth_tolerance");
   checkParamGT(rendering_subsampling, 0, "rendering_subsampling");
+  checkParamGT(coarse_rendering_subsampling, 0,
+               "coarse_rendering_subsampling");
+  checkParamGE(coarse_to_fine_margin, 0.f, "coarse_to_fine_margin");
+  checkParamGE(projection_cache_max_pixel_shift, 0.f,
+               "projection_cache_max_pixel_shift");
+  checkParamGE(projection_cache_max_depth_change, 0.f,
+               "projection_cache_max_depth_change");
   checkParamConfig(renderer);
+  checkParamConfig(raycaster);
 }
 
 void ProjectiveIDTracker::Config::setupParamsAndPrinting() {
@@ -28,7 +40,21 @@ void ProjectiveIDTracker::Config::setupParamsAndPrinting() {
   setupParam("tracking_metric", &tracking_metric);
   setupParam("match_acceptance_threshold", &match_acceptance_threshold);
   setupParam("use_class_data_for_matching", &use_class_data_for_matching);
+  setupParam("use_global_matching", &use_global_matching);
+  setupParam("use_coarse_to_fine_rendering", &use_coarse_to_fine_rendering);
+  setupParam("coarse_rendering_subsampling", &coarse_rendering_subsampling);
+  setupParam("coarse_to_fine_margin", &coarse_to_fine_margin);
   setupParam("use_approximate_rendering", &use_approximate_rendering);
+  setupParam("use_depth_buffer", &use_depth_buffer);
+  setupParam("use_raycast_rendering", &use_raycast_rendering);
+  setupParam("raycaster", &raycaster);
+  setupParam("use_compact_counting", &use_compact_counting);
+  setupParam("use_id_segments", &use_id_segments);
+  setupParam("use_projection_cache", &use_projection_cache);
+  setupParam("projection_cache_max_pixel_shift",
+             &projection_cache_max_pixel_shift);
+  setupParam("projection_cache_max_depth_change",
+             &projection_cache_max_depth_change);
   setupParam("rendering_subsampling", &rendering_subsampling);
   setupParam("min_allocation_size", &min_allocation_size);
   setupParam("rendering_threads", &rendering_threads);
@@ -40,7 +66,8 @@ ProjectiveIDTracker::ProjectiveIDTracker(const Config& config,
                                          bool print_config)
     : IDTrackerBase(std::move(globals)),
       config_(config.checkValid()),
-      renderer_(config.renderer, globals_->camera()->getConfig(), false) {
+      renderer_(config.renderer, globals_->camera()->getConfig(), false),
+      raycast_renderer_(config.raycaster) {
   LOG_IF(INFO, config_.verbosity >= 1 && print_config) << "\n"
                                                        << config_.toString();
   addRequiredInputs({InputData::InputType::kColorImage,
@@ -54,11 +81,21 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
   CHECK_NOTNULL(submaps);
   CHECK_NOTNULL(input);
   CHECK(inputIsValid(*input));
-  // Visualization.
+  // Visualization. Only the requested images are computed.
+  const bool visualize_input = visualizationIsRequested("input");
+  const bool visualize_color = visualizationIsRequested("color");
+  const bool visualize_tracked = visualizationIsRequested("tracked");
+  visualize_rendered_ = visualizationIsRequested("rendered");
+  const bool visualize = visualize_input || visualize_color ||
+                         visualize_tracked || visualize_rendered_;
   cv::Mat input_vis;
   std::unique_ptr<Timer> vis_timer;
-  if (visualizationIsOn()) {
+  if (visualize) {
     vis_timer = std::make_unique<Timer>("visualization/tracking");
+    vis_timer->Pause();
+  }
+  if (visualize_input) {
+    vis_timer->Unpause();
     Timer timer("visualization/tracking/input_image");
     input_vis = renderer_.colorIdImage(input->idImage());
     vis_timer->Pause();
@@ -66,7 +103,25 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
 
   // Render all submaps.
   Timer timer("tracking");
+  rendering_subsampling_ = config_.rendering_subsampling;
+  if (globals_->qualityController()) {
+    rendering_subsampling_ *=
+        globals_->qualityController()->getRenderingSubsamplingFactor();
+  }
+  use_approximate_rendering_ =
+      config_.use_approximate_rendering ||
+      (globals_->qualityController() &&
+       globals_->qualityController()->useApproximateRendering());
   auto t0 = std::chrono::high_resolution_clock::now();
+  if (config_.use_id_segments) {
+    Timer segments_timer("tracking/compute_id_segments");
+    const Camera::Config& camera = globals_->camera()->getConfig();
+    IDSegments segments;
+    segments.build(input->idImage(), input->depthImage(), camera.min_range,
+                   camera.max_range, globals_->threadPool(),
+                   config_.rendering_threads);
+    input->setIDSegments(std::move(segments));
+  }
   Timer detail_timer("tracking/compute_tracking_data");
   TrackingInfoAggregator tracking_data = computeTrackingData(submaps, input);
 
@@ -78,6 +133,14 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
   int n_new = 0;
   Timer alloc_timer("tracking/allocate_submaps");
   alloc_timer.Pause();
+  // Unmatched input IDs to allocate new submaps for and their logging info.
+  std::vector<int> new_input_ids;
+  std::vector<std::string> new_logs;
+  std::unordered_map<int, std::pair<int, float>> global_matches;
+  if (config_.use_global_matching) {
+    Timer matching_timer("tracking/global_matching");
+    global_matches = computeGlobalMatches(tracking_data, *submaps);
+  }
   for (const int input_id : tracking_data.getInputIDs()) {
     int submap_id;
     bool matched = false;
@@ -86,7 +149,15 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
     std::stringstream logging_details;
 
     // Find matches.
-    if (config_.use_class_data_for_matching || config_.verbosity >= 4) {
+    if (config_.use_global_matching) {
+      auto it = global_matches.find(input_id);
+      any_overlap = it != global_matches.end();
+      if (any_overlap) {
+        matched = true;
+        submap_id = it->second.first;
+        value = it->second.second;
+      }
+    } else if (config_.use_class_data_for_matching || config_.verbosity >= 4) {
       std::vector<std::pair<int, float>> ids_values;
       any_overlap = tracking_data.getAllMetrics(input_id, &ids_values,
                                                 config_.tracking_metric);
@@ -133,8 +204,7 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
       }
     }
 
-    // Allocate new submap if necessary and store tracking info.
-    alloc_timer.Unpause();
+    // Store the tracking info. New submaps are allocated jointly below.
     bool allocate_new_submap = tracking_data.getNumberOfInputPixels(input_id) >=
                                config_.min_allocation_size;
     if (matched) {
@@ -142,45 +212,51 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
       input_to_output[input_id] = submap_id;
       submaps->getSubmapPtr(submap_id)->setWasTracked(true);
     } else if (allocate_new_submap) {
-      n_new++;
-      Submap* new_submap = allocateSubmap(input_id, submaps, input);
-      if (new_submap) {
-        input_to_output[input_id] = new_submap->getID();
-      } else {
-        input_to_output[input_id] = -1;
-      }
+      new_input_ids.push_back(input_id);
     } else {
       // Ignore these.
       input_to_output[input_id] = -1;
     }
-    alloc_timer.Pause();
 
-    // Logging.
+    // Logging. New submaps are logged once allocated.
     if (config_.verbosity >= 3) {
+      std::stringstream log;
+      if (matched || any_overlap) {
+        log << " (" << std::fixed << std::setprecision(2) << value << ")";
+      }
+      log << logging_details.str();
       if (matched) {
-        info << "\n  " << input_id << "->" << submap_id << " (" << std::fixed
-             << std::setprecision(2) << value << ")";
+        info << "\n  " << input_id << "->" << submap_id << log.str();
+      } else if (allocate_new_submap) {
+        new_logs.push_back(log.str());
       } else {
-        if (allocate_new_submap) {
-          info << "\n  " << input_id << "->" << input_to_output[input_id]
-               << " [new]";
-        } else {
-          info << "\n  " << input_id << " [ignored]";
-        }
-        if (any_overlap) {
-          info << " (" << std::fixed << std::setprecision(2) << value << ")";
-        }
+        info << "\n  " << input_id << " [ignored]" << log.str();
+      }
+    }
+  }
+
+  // Allocate new submaps for all unmatched segments.
+  alloc_timer.Unpause();
+  n_new = new_input_ids.size();
+  if (!new_input_ids.empty()) {
+    const std::vector<Submap*> new_submaps =
+        allocateSubmaps(new_input_ids, submaps, input);
+    for (size_t i = 0; i < new_input_ids.size(); ++i) {
+      const int input_id = new_input_ids[i];
+      input_to_output[input_id] = new_submaps[i] ? new_submaps[i]->getID() : -1;
+      if (config_.verbosity >= 3) {
+        info << "\n  " << input_id << "->" << input_to_output[input_id]
+             << " [new]" << new_logs[i];
       }
-      info << logging_details.str();
     }
   }
+  alloc_timer.Pause();
   detail_timer.Stop();
 
   // Translate the id image.
-  for (auto it = input->idImagePtr()->begin<int>();
-       it != input->idImagePtr()->end<int>(); ++it) {
-    *it = input_to_output[*it];
-  }
+  detail_timer = Timer("tracking/translate_ids");
+  translateIDImage(input_to_output, input);
+  detail_timer.Stop();
 
   // Allocate free space map if required.
   alloc_timer.Unpause();
@@ -199,32 +275,161 @@ void ProjectiveIDTracker::processInput(SubmapCollection* submaps,
   }
 
   // Publish Visualization if requested.
-  if (visualizationIsOn()) {
+  if (visualize) {
     vis_timer->Unpause();
-    Timer timer("visualization/tracking/rendered");
-    if (config_.use_approximate_rendering) {
-      rendered_vis_ = renderer_.colorIdImage(
-          renderer_.renderActiveSubmapIDs(*submaps, input->T_M_C()));
+    if (visualize_rendered_) {
+      Timer timer("visualization/tracking/rendered");
+      if (use_approximate_rendering_ && !config_.use_depth_buffer &&
+          !config_.use_raycast_rendering) {
+        rendered_vis_ = renderer_.colorIdImage(
+            renderer_.renderActiveSubmapIDs(*submaps, input->T_M_C()));
+      }
+      visualize(rendered_vis_, "rendered");
+    }
+    if (visualize_input) {
+      visualize(input_vis, "input");
+    }
+    if (visualize_color) {
+      visualize(input->colorImage(), "color");
+    }
+    if (visualize_tracked) {
+      Timer timer("visualization/tracking/tracked");
+      cv::Mat tracked_vis = renderer_.colorIdImage(input->idImage());
+      timer.Stop();
+      visualize(tracked_vis, "tracked");
     }
-    timer = Timer("visualization/tracking/tracked");
-    cv::Mat tracked_vis = renderer_.colorIdImage(input->idImage());
-    timer.Stop();
-    visualize(input_vis, "input");
-    visualize(rendered_vis_, "rendered");
-    visualize(input->colorImage(), "color");
-    visualize(tracked_vis, "tracked");
     vis_timer->Stop();
   }
 }
 
-Submap* ProjectiveIDTracker::allocateSubmap(int input_id,
-                                            SubmapCollection* submaps,
-                                            InputData* input) {
-  LabelEntry label;
-  if (globals_->labelHandler()->segmentationIdExists(input_id)) {
-    label = globals_->labelHandler()->getLabelEntry(input_id);
+std::vector<Submap*> ProjectiveIDTracker::allocateSubmaps(
+    const std::vector<int>& input_ids, SubmapCollection* submaps,
+    InputData* input) {
+  std::vector<LabelEntry> labels(input_ids.size());
+  for (size_t i = 0; i < input_ids.size(); ++i) {
+    if (globals_->labelHandler()->segmentationIdExists(input_ids[i])) {
+      labels[i] = globals_->labelHandler()->getLabelEntry(input_ids[i]);
+    }
+  }
+  return submap_allocator_->allocateSubmaps(submaps, input, input_ids, labels);
+}
+
+void ProjectiveIDTracker::translateIDImage(
+    const std::unordered_map<int, int>& input_to_output,
+    InputData* input) const {
+  CHECK_NOTNULL(input);
+  cv::Mat* id_image = input->idImagePtr();
+  // Dense lookup table from input to output IDs. IDs that were not assigned,
+  // e.g. segments without valid depth, are mapped to -1.
+  std::vector<int> input_ids;
+  input_ids.reserve(input_to_output.size());
+  for (const auto& input_output : input_to_output) {
+    input_ids.push_back(input_output.first);
+  }
+  const DenseIDMap id_map(input_ids);
+  std::vector<int> output_ids(id_map.size());
+  for (size_t i = 0; i < id_map.size(); ++i) {
+    output_ids[i] = input_to_output.at(id_map.getID(i));
+  }
+
+  auto translate = [&id_map, &output_ids](int id) {
+    const int index = id_map.getIndex(id);
+    return index < 0 ? -1 : output_ids[index];
+  };
+
+  // With segments, each run is translated with a single lookup.
+  if (input->has(InputData::InputType::kIDSegments)) {
+    const IDSegments& segments = input->idSegments();
+    for (int v = 0; v < segments.rows(); ++v) {
+      int* ids = id_image->ptr<int>(v);
+      for (const IDSegments::Run* run = segments.rowBegin(v);
+           run != segments.rowEnd(v); ++run) {
+        std::fill(ids + run->u_begin, ids + run->u_end, translate(run->id));
+      }
+    }
+    input->idSegmentsPtr()->relabel(translate);
+    return;
+  }
+
+  // Translate bands of rows in parallel.
+  const int rows = id_image->rows;
+  const int band_rows =
+      (rows + config_.rendering_threads - 1) / config_.rendering_threads;
+  std::vector<std::future<void>> futures;
+  for (int v_start = 0; v_start < rows; v_start += band_rows) {
+    futures.emplace_back(globals_->threadPool()->submit([&, v_start]() {
+      const int v_end = std::min(v_start + band_rows, rows);
+      for (int v = v_start; v < v_end; ++v) {
+        int* ids = id_image->ptr<int>(v);
+        for (int u = 0; u < id_image->cols; ++u) {
+          ids[u] = translate(ids[u]);
+        }
+      }
+    }));
+  }
+  globals_->threadPool()->waitAll(&futures);
+}
+
+std::unique_ptr<DenseIDMap> ProjectiveIDTracker::computeInputIDMap(
+    const InputData& input) const {
+  if (!config_.use_compact_counting) {
+    return nullptr;
+  }
+  if (input.has(InputData::InputType::kIDSegments)) {
+    return std::make_unique<DenseIDMap>(input.idSegments().getIDs());
   }
-  return submap_allocator_->allocateSubmap(submaps, input, input_id, label);
+  return std::make_unique<DenseIDMap>(input.idImage());
+}
+
+void ProjectiveIDTracker::insertInputData(const InputData& input,
+                                          TrackingInfoAggregator* tracking_data,
+                                          const DenseIDMap* input_ids) const {
+  if (input.has(InputData::InputType::kIDSegments)) {
+    tracking_data->insertInputSegments(input.idSegments(),
+                                       rendering_subsampling_, input_ids);
+    return;
+  }
+  tracking_data->insertInputImage(input.idImage(), input.depthImage(),
+                                  globals_->camera()->getConfig(),
+                                  rendering_subsampling_, input_ids,
+                                  globals_->threadPool(),
+                                  config_.rendering_threads);
+}
+
+std::unordered_map<int, std::pair<int, float>>
+ProjectiveIDTracker::computeGlobalMatches(
+    const TrackingInfoAggregator& tracking_data,
+    const SubmapCollection& submaps) {
+  // Collect all acceptable matches as sparse candidates.
+  std::vector<AssignmentCandidate> candidates;
+  std::vector<std::pair<int, float>> ids_values;
+  for (const int input_id : tracking_data.getInputIDs()) {
+    if (!tracking_data.getAllMetrics(input_id, &ids_values,
+                                     config_.tracking_metric)) {
+      continue;
+    }
+    for (const auto& id_value : ids_values) {
+      if (id_value.second < config_.match_acceptance_threshold) {
+        // These are ordered in decreasing overlap metric.
+        break;
+      }
+      if (config_.use_class_data_for_matching &&
+          !classesMatch(input_id,
+                        submaps.getSubmap(id_value.first).getClassID())) {
+        continue;
+      }
+      candidates.push_back(
+          {input_id, id_value.first, std::max(id_value.second, 0.f)});
+    }
+  }
+
+  // Solve the assignment.
+  std::unordered_map<int, std::pair<int, float>> result;
+  for (const size_t index : solveSparseAssignment(candidates)) {
+    const AssignmentCandidate& match = candidates[index];
+    result[match.row] = {match.col, match.value};
+  }
+  return result;
 }
 
 bool ProjectiveIDTracker::classesMatch(int input_id, int submap_class_id) {
@@ -237,31 +442,82 @@ bool ProjectiveIDTracker::classesMatch(int input_id, int submap_class_id) {
 
 TrackingInfoAggregator ProjectiveIDTracker::computeTrackingData(
     SubmapCollection* submaps, InputData* input) {
+  if (config_.use_raycast_rendering) {
+    return computeTrackingDataRaycast(submaps, input);
+  }
+  if (use_approximate_rendering_ && config_.use_depth_buffer) {
+    return computeTrackingDataDepthBuffered(submaps, input);
+  }
+
   // Render each active submap in parallel to collect overlap statistics.
-  SubmapIndexGetter index_getter(
-      globals_->camera()->findVisibleSubmapIDs(*submaps, input->T_M_C()));
-  std::vector<std::future<std::vector<TrackingInfo>>> threads;
+  const std::vector<int> visible_ids =
+      globals_->camera()->findVisibleSubmapIDs(*submaps, input->T_M_C());
+  if (use_approximate_rendering_) {
+    updateVisibleMeshes(visible_ids, input->T_M_C(), submaps);
+    updateProjectionCache(visible_ids);
+  }
   TrackingInfoAggregator tracking_data;
+  const std::unique_ptr<DenseIDMap> input_ids = computeInputIDMap(*input);
+
+  // Process the input image.
+  std::future<void> input_future = globals_->threadPool()->submit(
+      [this, &tracking_data, &input_ids, input]() {
+        insertInputData(*input, &tracking_data, input_ids.get());
+      });
+
+  // Render all submaps, coarsely first if requested.
+  const bool coarse_to_fine = use_approximate_rendering_ &&
+                              config_.use_coarse_to_fine_rendering &&
+                              config_.coarse_rendering_subsampling > 1;
+  std::vector<TrackingInfo> infos = renderTrackingInfos(
+      visible_ids, *submaps, *input, input_ids.get(),
+      coarse_to_fine ? config_.coarse_rendering_subsampling : 1);
+  globals_->threadPool()->wait(&input_future);
+  if (coarse_to_fine) {
+    refineTrackingInfos(tracking_data, *submaps, *input, input_ids.get(),
+                        &infos);
+  }
+  tracking_data.insertTrackingInfos(infos);
+
+  // Render the data if required.
+  if (visualize_rendered_ && !use_approximate_rendering_) {
+    Timer timer("visualization/tracking/rendered");
+    cv::Mat vis =
+        cv::Mat::ones(globals_->camera()->getConfig().height,
+                      globals_->camera()->getConfig().width, CV_32SC1) *
+        -1;
+    for (const TrackingInfo& info : infos) {
+      for (const Eigen::Vector2i& point : info.getPoints()) {
+        vis.at<int>(point.y(), point.x()) = info.getSubmapID();
+      }
+    }
+    rendered_vis_ = renderer_.colorIdImage(vis);
+  }
+  return tracking_data;
+}
+
+std::vector<TrackingInfo> ProjectiveIDTracker::renderTrackingInfos(
+    const std::vector<int>& submap_ids, const SubmapCollection& submaps,
+    const InputData& input, const DenseIDMap* input_ids, int subsampling) {
+  // Render each submap in parallel.
+  SubmapIndexGetter index_getter(submap_ids);
+  std::vector<std::future<std::vector<TrackingInfo>>> threads;
+  render_scratch_.resize(config_.rendering_threads);
   for (int i = 0; i < config_.rendering_threads; ++i) {
-    threads.emplace_back(std::async(
-        std::launch::async,
-        [this, i, &tracking_data, &index_getter, submaps,
-         input]() -> std::vector<TrackingInfo> {
-          // Also process the input image.
-          if (i == 0) {
-            tracking_data.insertInputImage(
-                input->idImage(), input->depthImage(),
-                globals_->camera()->getConfig(), config_.rendering_subsampling);
-          }
+    threads.emplace_back(globals_->threadPool()->submit(
+        [this, i, &index_getter, &submaps, &input, input_ids,
+         subsampling]() -> std::vector<TrackingInfo> {
           std::vector<TrackingInfo> result;
           int index;
           while (index_getter.getNextIndex(&index)) {
-            if (config_.use_approximate_rendering) {
+            if (use_approximate_rendering_) {
               result.emplace_back(this->renderTrackingInfoApproximate(
-                  submaps->getSubmap(index), *input));
+                  submaps.getSubmap(index), input, input_ids,
+                  getProjectionCache(index), &render_scratch_[i],
+                  subsampling));
             } else {
               result.emplace_back(this->renderTrackingInfoVertices(
-                  submaps->getSubmap(index), *input));
+                  submaps.getSubmap(index), input));
             }
           }
           return result;
@@ -271,43 +527,71 @@ TrackingInfoAggregator ProjectiveIDTracker::computeTrackingData(
   // Join all threads.
   std::vector<TrackingInfo> infos;
   for (auto& thread : threads) {
-    for (const TrackingInfo& info : thread.get()) {
+    for (TrackingInfo& info : globals_->threadPool()->wait(&thread)) {
       infos.emplace_back(std::move(info));
     }
   }
-  tracking_data.insertTrackingInfos(infos);
+  return infos;
+}
 
-  // Render the data if required.
-  if (visualizationIsOn() && !config_.use_approximate_rendering) {
-    Timer timer("visualization/tracking/rendered");
-    cv::Mat vis =
-        cv::Mat::ones(globals_->camera()->getConfig().height,
-                      globals_->camera()->getConfig().width, CV_32SC1) *
-        -1;
-    for (const TrackingInfo& info : infos) {
-      for (const Eigen::Vector2i& point : info.getPoints()) {
-        vis.at<int>(point.y(), point.x()) = info.getSubmapID();
+void ProjectiveIDTracker::refineTrackingInfos(
+    const TrackingInfoAggregator& input_data, const SubmapCollection& submaps,
+    const InputData& input, const DenseIDMap* input_ids,
+    std::vector<TrackingInfo>* infos) {
+  // Estimate the metrics from the coarse renderings.
+  TrackingInfoAggregator coarse_data = input_data;
+  coarse_data.insertTrackingInfos(*infos);
+
+  // Submaps are ambiguous if the decision to match them could change at full
+  // resolution, i.e. if their metric is close to the acceptance threshold or
+  // to the best candidate of an input segment.
+  const float margin = config_.coarse_to_fine_margin;
+  const float threshold = config_.match_acceptance_threshold;
+  std::unordered_set<int> ambiguous_ids;
+  std::vector<std::pair<int, float>> ids_values;
+  for (const int input_id : coarse_data.getInputIDs()) {
+    if (!coarse_data.getAllMetrics(input_id, &ids_values,
+                                   config_.tracking_metric)) {
+      continue;
+    }
+    const float best_value = ids_values.front().second;
+    for (const auto& id_value : ids_values) {
+      if (std::abs(id_value.second - threshold) <= margin ||
+          (best_value >= threshold - margin &&
+           best_value - id_value.second <= margin)) {
+        ambiguous_ids.insert(id_value.first);
       }
     }
-    rendered_vis_ = renderer_.colorIdImage(vis);
   }
-  return tracking_data;
+  if (ambiguous_ids.empty()) {
+    return;
+  }
+
+  // Re-render the ambiguous submaps at full resolution.
+  std::vector<TrackingInfo> refined_infos = renderTrackingInfos(
+      std::vector<int>(ambiguous_ids.begin(), ambiguous_ids.end()), submaps,
+      input, input_ids, 1);
+  for (TrackingInfo& info : *infos) {
+    if (ambiguous_ids.find(info.getSubmapID()) == ambiguous_ids.end()) {
+      refined_infos.emplace_back(std::move(info));
+    }
+  }
+  infos->swap(refined_infos);
 }
 
 TrackingInfo ProjectiveIDTracker::renderTrackingInfoApproximate(
-    const Submap& submap, const InputData& input) const {
+    const Submap& submap, const InputData& input, const DenseIDMap* input_ids,
+    SubmapProjectionCache* cache, RenderScratch* scratch,
+    int subsampling) const {
   // Approximate rendering by projecting the surface points of the submap into
   // the camera and fill in a patch of the size a voxel has (since there is 1
   // vertex per voxel).
 
   // Setup.
   const Camera& camera = *globals_->camera();
-  TrackingInfo result(submap.getID(), camera.getConfig());
+  TrackingInfo result(submap.getID(), camera.getConfig(),
+                      scratch ? &scratch->buffer : nullptr);
   const Transformation T_C_S = input.T_M_C().inverse() * submap.getT_M_S();
-  const float size_factor_x =
-      camera.getConfig().fx * submap.getTsdfLayer().voxel_size() / 2.f;
-  const float size_factor_y =
-      camera.getConfig().fy * submap.getTsdfLayer().voxel_size() / 2.f;
   const float block_size = submap.getTsdfLayer().block_size();
   const FloatingPoint block_diag_half = std::sqrt(3.0f) * block_size / 2.0f;
   const float depth_tolerance =
@@ -319,60 +603,474 @@ TrackingInfo ProjectiveIDTracker::renderTrackingInfoApproximate(
   // Parse all blocks.
   voxblox::BlockIndexList index_list;
   submap.getMeshLayer().getAllAllocatedMeshes(&index_list);
+  std::vector<ProjectedVertex> local_vertices;
+  std::vector<ProjectedVertex>* vertices =
+      scratch ? &scratch->vertices : &local_vertices;
   for (const voxblox::BlockIndex& index : index_list) {
     if (!camera.blockIsInViewFrustum(submap, index, T_C_S, block_size,
                                      block_diag_half)) {
       continue;
     }
-    for (const Point& vertex :
-         submap.getMeshLayer().getMeshByIndex(index).vertices) {
-      // Project vertex and check depth value.
-      const Point p_C = T_C_S * vertex;
-      int u, v;
-      if (!camera.projectPointToImagePlane(p_C, &u, &v)) {
+    for (const ProjectedVertex& vertex :
+         projectMeshBlock(submap, index, T_C_S, cache, vertices)) {
+      // Check the depth value.
+      if (std::abs(depth_image.at<float>(vertex.v, vertex.u) - vertex.depth) >=
+          depth_tolerance) {
         continue;
       }
-      if (std::abs(depth_image.at<float>(v, u) - p_C.z()) >= depth_tolerance) {
+      result.insertRenderedPoint(vertex.u, vertex.v, vertex.size_x,
+                                 vertex.size_y);
+    }
+  }
+  if (input.has(InputData::InputType::kIDSegments)) {
+    result.evaluate(input.idSegments(), input_ids, subsampling);
+  } else {
+    result.evaluate(input.idImage(), depth_image, input_ids, subsampling);
+  }
+  return result;
+}
+
+void ProjectiveIDTracker::updateVisibleMeshes(
+    const std::vector<int>& visible_submap_ids, const Transformation& T_M_C,
+    SubmapCollection* submaps) {
+  MeshService* mesh_service = globals_->meshService().get();
+  if (!mesh_service) {
+    return;
+  }
+  Timer timer("tracking/update_meshes");
+  mesh_service->requestVisibleBlocks(*submaps, visible_submap_ids,
+                                     *globals_->camera(), T_M_C);
+  mesh_service->processRequests(submaps);
+}
+
+void ProjectiveIDTracker::updateProjectionCache(
+    const std::vector<int>& visible_submap_ids) {
+  if (!config_.use_projection_cache) {
+    return;
+  }
+  // Only keep the caches of visible submaps. The entries of the last frame
+  // become candidates for reuse in the current frame. Entries must exist
+  // before rendering such that the submaps can be processed in parallel.
+  std::unordered_map<int, SubmapProjectionCache> cache;
+  for (const int submap_id : visible_submap_ids) {
+    SubmapProjectionCache& submap_cache = cache[submap_id];
+    auto it = projection_cache_.find(submap_id);
+    if (it != projection_cache_.end()) {
+      submap_cache.previous = std::move(it->second.current);
+    }
+  }
+  projection_cache_ = std::move(cache);
+}
+
+ProjectiveIDTracker::SubmapProjectionCache*
+ProjectiveIDTracker::getProjectionCache(int submap_id) {
+  if (!config_.use_projection_cache) {
+    return nullptr;
+  }
+  return &projection_cache_.at(submap_id);
+}
+
+const std::vector<ProjectiveIDTracker::ProjectedVertex>&
+ProjectiveIDTracker::projectMeshBlock(
+    const Submap& submap, const voxblox::BlockIndex& block_index,
+    const Transformation& T_C_S, SubmapProjectionCache* cache,
+    std::vector<ProjectedVertex>* buffer) const {
+  CHECK_NOTNULL(buffer);
+  const Camera::Config& cam_config = globals_->camera()->getConfig();
+  std::vector<ProjectedVertex>* result = buffer;
+  if (cache) {
+    // Blocks can be rendered multiple times per frame, all current entries
+    // were created in this frame.
+    auto current_it = cache->current.find(block_index);
+    if (current_it != cache->current.end()) {
+      return current_it->second.vertices;
+    }
+    const uint64_t generation = submap.getMeshGeneration(block_index);
+    BlockProjectionCache& entry = cache->current[block_index];
+
+    // Reuse the cached projection if the mesh is identical and the block
+    // center moved less than the thresholds.
+    auto it = cache->previous.find(block_index);
+    if (it != cache->previous.end() &&
+        it->second.mesh_generation == generation) {
+      const Point center_S = voxblox::getCenterPointFromGridIndex(
+          block_index, submap.getTsdfLayer().block_size());
+      const Point previous_C = it->second.T_C_S * center_S;
+      const Point current_C = T_C_S * center_S;
+      if (previous_C.z() > 0.f && current_C.z() > 0.f &&
+          std::abs(previous_C.z() - current_C.z()) <=
+              config_.projection_cache_max_depth_change) {
+        const float du = cam_config.fx * (previous_C.x() / previous_C.z() -
+                                          current_C.x() / current_C.z());
+        const float dv = cam_config.fy * (previous_C.y() / previous_C.z() -
+                                          current_C.y() / current_C.z());
+        if (du * du + dv * dv <= config_.projection_cache_max_pixel_shift *
+                                     config_.projection_cache_max_pixel_shift) {
+          entry = std::move(it->second);
+          cache->previous.erase(it);
+          return entry.vertices;
+        }
+      }
+    }
+    entry.mesh_generation = generation;
+    entry.T_C_S = T_C_S;
+    result = &entry.vertices;
+  }
+
+  // Project all vertices and compensate for vertex sparsity by the voxel size.
+  const float size_factor_x =
+      cam_config.fx * submap.getTsdfLayer().voxel_size() / 2.f;
+  const float size_factor_y =
+      cam_config.fy * submap.getTsdfLayer().voxel_size() / 2.f;
+  const std::vector<Point>& vertices =
+      submap.getMeshLayer().getMeshByIndex(block_index).vertices;
+  result->clear();
+  result->reserve(vertices.size());
+  for (const Point& vertex : vertices) {
+    const Point p_C = T_C_S * vertex;
+    ProjectedVertex projected;
+    if (!globals_->camera()->projectPointToImagePlane(p_C, &projected.u,
+                                                      &projected.v)) {
+      continue;
+    }
+    projected.depth = p_C.z();
+    projected.size_x = std::ceil(size_factor_x / p_C.z());
+    projected.size_y = std::ceil(size_factor_y / p_C.z());
+    result->push_back(projected);
+  }
+  return *result;
+}
+
+TrackingInfoAggregator ProjectiveIDTracker::computeTrackingDataDepthBuffered(
+    SubmapCollection* submaps, InputData* input) {
+  // Rasterize the surface points of all visible submaps into a shared depth
+  // and ID buffer, such that occluded submaps are not counted. The image is
+  // split into row tiles that are rasterized independently.
+  constexpr int kRenderingRowsPerTile = 16;
+  const Camera& camera = *globals_->camera();
+  const Camera::Config& cam_config = camera.getConfig();
+  const int num_tiles =
+      (cam_config.height + kRenderingRowsPerTile - 1) / kRenderingRowsPerTile;
+  ThreadPool* thread_pool = globals_->threadPool();
+
+  // In compact mode all IDs are mapped to dense indices for counting.
+  const std::vector<int> visible_ids =
+      camera.findVisibleSubmapIDs(*submaps, input->T_M_C());
+  const std::unique_ptr<DenseIDMap> input_ids = computeInputIDMap(*input);
+  std::unique_ptr<DenseIDMap> submap_ids;
+  if (config_.use_compact_counting) {
+    submap_ids = std::make_unique<DenseIDMap>(visible_ids);
+  }
+
+  // Process the input image.
+  TrackingInfoAggregator tracking_data;
+  std::future<void> input_future = thread_pool->submit(
+      [&]() { insertInputData(*input, &tracking_data, input_ids.get()); });
+
+  // Project all submaps in parallel and sort the splats into tiles.
+  updateVisibleMeshes(visible_ids, input->T_M_C(), submaps);
+  updateProjectionCache(visible_ids);
+  SubmapIndexGetter index_getter(visible_ids);
+  std::vector<std::future<std::vector<std::vector<Splat>>>> projections;
+  for (int i = 0; i < config_.rendering_threads; ++i) {
+    projections.emplace_back(thread_pool->submit([&]() {
+      std::vector<std::vector<Splat>> tiles(num_tiles);
+      int submap_id;
+      while (index_getter.getNextIndex(&submap_id)) {
+        projectSubmapSplats(submaps->getSubmap(submap_id), *input,
+                            kRenderingRowsPerTile, &tiles,
+                            getProjectionCache(submap_id));
+      }
+      return tiles;
+    }));
+  }
+  std::vector<std::vector<std::vector<Splat>>> splats;
+  splats.reserve(projections.size());
+  for (auto& projection : projections) {
+    splats.emplace_back(thread_pool->wait(&projection));
+  }
+
+  // Rasterize and count each tile in parallel.
+  cv::Mat depth_buffer(cam_config.height, cam_config.width, CV_32FC1,
+                       cv::Scalar(std::numeric_limits<float>::max()));
+  cv::Mat id_buffer(cam_config.height, cam_config.width, CV_32SC1,
+                    cv::Scalar(-1));
+  std::vector<std::future<TileCounts>> tile_counts;
+  for (int tile = 0; tile < num_tiles; ++tile) {
+    tile_counts.emplace_back(thread_pool->submit([&, tile]() {
+      const int v_begin = tile * kRenderingRowsPerTile;
+      const int v_end =
+          std::min(v_begin + kRenderingRowsPerTile, cam_config.height);
+      for (const std::vector<std::vector<Splat>>& tiles : splats) {
+        for (const Splat& splat : tiles[tile]) {
+          for (int v = std::max(splat.v_min, v_begin);
+               v <= std::min(splat.v_max, v_end - 1); ++v) {
+            for (int u = splat.u_min; u <= splat.u_max; ++u) {
+              // Ties are resolved by ID to be independent of the order.
+              float& depth = depth_buffer.at<float>(v, u);
+              int& id = id_buffer.at<int>(v, u);
+              if (splat.depth < depth ||
+                  (splat.depth == depth && splat.submap_id < id)) {
+                depth = splat.depth;
+                id = splat.submap_id;
+              }
+            }
+          }
+        }
+      }
+      TileCounts counts;
+      countTileOverlaps(id_buffer, *input, v_begin, v_end, 1,
+                        submap_ids.get(), input_ids.get(), &counts);
+      return counts;
+    }));
+  }
+
+  // Merge the counts of all tiles.
+  std::vector<TileCounts> counts;
+  counts.reserve(tile_counts.size());
+  for (auto& tile_count : tile_counts) {
+    counts.emplace_back(thread_pool->wait(&tile_count));
+  }
+  thread_pool->wait(&input_future);
+  tracking_data.insertTrackingInfos(
+      mergeTileCounts(counts, submap_ids.get(), input_ids.get()));
+
+  // The ID buffer directly serves as visualization.
+  if (visualize_rendered_) {
+    Timer timer("visualization/tracking/rendered");
+    rendered_vis_ = renderer_.colorIdImage(id_buffer);
+  }
+  return tracking_data;
+}
+
+TrackingInfoAggregator ProjectiveIDTracker::computeTrackingDataRaycast(
+    SubmapCollection* submaps, InputData* input) {
+  // Raycast the TSDF layers of all visible submaps into a shared depth and ID
+  // buffer and count the overlaps per tile of rows.
+  constexpr int kCountingRowsPerTile = 16;
+  const Camera& camera = *globals_->camera();
+  const Camera::Config& cam_config = camera.getConfig();
+  ThreadPool* thread_pool = globals_->threadPool();
+  const std::vector<int> visible_ids =
+      camera.findVisibleSubmapIDs(*submaps, input->T_M_C());
+  const std::unique_ptr<DenseIDMap> input_ids = computeInputIDMap(*input);
+  std::unique_ptr<DenseIDMap> submap_ids;
+  if (config_.use_compact_counting) {
+    submap_ids = std::make_unique<DenseIDMap>(visible_ids);
+  }
+
+  // Process the input image.
+  TrackingInfoAggregator tracking_data;
+  std::future<void> input_future = thread_pool->submit(
+      [&]() { insertInputData(*input, &tracking_data, input_ids.get()); });
+
+  // Render.
+  Timer render_timer("tracking/raycast_submaps");
+  cv::Mat depth_buffer;
+  cv::Mat id_buffer;
+  raycast_renderer_.render(*submaps, visible_ids, camera, input->T_M_C(),
+                           input->depthImage(), config_.depth_tolerance,
+                           rendering_subsampling_, thread_pool,
+                           config_.rendering_threads, &depth_buffer,
+                           &id_buffer);
+  render_timer.Stop();
+
+  // Count each tile in parallel on the same sampling grid as the input.
+  const int band_rows =
+      (kCountingRowsPerTile + rendering_subsampling_ - 1) /
+      rendering_subsampling_ * rendering_subsampling_;
+  std::vector<std::future<TileCounts>> tile_counts;
+  for (int v_begin = 0; v_begin < cam_config.height; v_begin += band_rows) {
+    tile_counts.emplace_back(thread_pool->submit([&, v_begin]() {
+      TileCounts counts;
+      countTileOverlaps(id_buffer, *input, v_begin,
+                        std::min(v_begin + band_rows, cam_config.height),
+                        rendering_subsampling_, submap_ids.get(),
+                        input_ids.get(), &counts);
+      return counts;
+    }));
+  }
+  std::vector<TileCounts> counts;
+  counts.reserve(tile_counts.size());
+  for (auto& tile_count : tile_counts) {
+    counts.emplace_back(thread_pool->wait(&tile_count));
+  }
+  thread_pool->wait(&input_future);
+  tracking_data.insertTrackingInfos(
+      mergeTileCounts(counts, submap_ids.get(), input_ids.get()));
+
+  // The ID buffer directly serves as visualization.
+  if (visualize_rendered_) {
+    Timer timer("visualization/tracking/rendered");
+    rendered_vis_ = renderer_.colorIdImage(id_buffer);
+  }
+  return tracking_data;
+}
+
+void ProjectiveIDTracker::countTileOverlaps(const cv::Mat& id_buffer,
+                                            const InputData& input,
+                                            int v_begin, int v_end,
+                                            int subsampling,
+                                            const DenseIDMap* submap_ids,
+                                            const DenseIDMap* input_ids,
+                                            TileCounts* counts) const {
+  CHECK_NOTNULL(counts);
+  const Camera::Config& cam_config = globals_->camera()->getConfig();
+  if (submap_ids) {
+    counts->dense.assign(submap_ids->size() * input_ids->size(), 0);
+  }
+  for (int v = v_begin; v < v_end; v += subsampling) {
+    for (int u = 0; u < cam_config.width; u += subsampling) {
+      const int submap_id = id_buffer.at<int>(v, u);
+      if (submap_id < 0) {
         continue;
       }
+      const float depth = input.depthImage().at<float>(v, u);
+      if (depth < cam_config.min_range || depth > cam_config.max_range) {
+        continue;
+      }
+      const int input_id = input.idImage().at<int>(v, u);
+      if (submap_ids) {
+        counts->dense[submap_ids->getIndex(submap_id) * input_ids->size() +
+                      input_ids->getIndex(input_id)]++;
+      } else {
+        counts->sparse[submap_id][input_id]++;
+      }
+    }
+  }
+}
 
-      // Compensate for vertex sparsity.
-      const int size_x = std::ceil(size_factor_x / p_C.z());
-      const int size_y = std::ceil(size_factor_y / p_C.z());
-      result.insertRenderedPoint(u, v, size_x, size_y);
+std::vector<TrackingInfo> ProjectiveIDTracker::mergeTileCounts(
+    const std::vector<TileCounts>& tile_counts, const DenseIDMap* submap_ids,
+    const DenseIDMap* input_ids) const {
+  CountMap counts;
+  std::vector<int> dense_counts;
+  for (const TileCounts& tile_result : tile_counts) {
+    if (submap_ids) {
+      if (dense_counts.empty()) {
+        dense_counts = tile_result.dense;
+      } else {
+        for (size_t i = 0; i < dense_counts.size(); ++i) {
+          dense_counts[i] += tile_result.dense[i];
+        }
+      }
+      continue;
+    }
+    for (const auto& submap_counts : tile_result.sparse) {
+      auto& total = counts[submap_counts.first];
+      for (const auto& id_count : submap_counts.second) {
+        total[id_count.first] += id_count.second;
+      }
+    }
+  }
+  for (size_t i = 0; i < dense_counts.size(); ++i) {
+    if (dense_counts[i] > 0) {
+      counts[submap_ids->getID(i / input_ids->size())]
+            [input_ids->getID(i % input_ids->size())] = dense_counts[i];
+    }
+  }
+  std::vector<TrackingInfo> infos;
+  infos.reserve(counts.size());
+  for (const auto& submap_counts : counts) {
+    infos.emplace_back(submap_counts.first);
+    for (const auto& id_count : submap_counts.second) {
+      infos.back().insertCount(id_count.first, id_count.second);
+    }
+  }
+  return infos;
+}
+
+void ProjectiveIDTracker::projectSubmapSplats(
+    const Submap& submap, const InputData& input, int rows_per_tile,
+    std::vector<std::vector<Splat>>* tiles,
+    SubmapProjectionCache* cache) const {
+  CHECK_NOTNULL(tiles);
+  // Same projection as in 'renderTrackingInfoApproximate()', where every
+  // surface point covers a patch of the size of a voxel.
+  const Camera& camera = *globals_->camera();
+  const Camera::Config& cam_config = camera.getConfig();
+  const Transformation T_C_S = input.T_M_C().inverse() * submap.getT_M_S();
+  const float block_size = submap.getTsdfLayer().block_size();
+  const FloatingPoint block_diag_half = std::sqrt(3.0f) * block_size / 2.0f;
+  const float depth_tolerance =
+      config_.depth_tolerance > 0
+          ? config_.depth_tolerance
+          : -config_.depth_tolerance * submap.getTsdfLayer().voxel_size();
+  const cv::Mat& depth_image = input.depthImage();
+
+  voxblox::BlockIndexList index_list;
+  submap.getMeshLayer().getAllAllocatedMeshes(&index_list);
+  std::vector<ProjectedVertex> buffer;
+  for (const voxblox::BlockIndex& index : index_list) {
+    if (!camera.blockIsInViewFrustum(submap, index, T_C_S, block_size,
+                                     block_diag_half)) {
+      continue;
+    }
+    for (const ProjectedVertex& vertex :
+         projectMeshBlock(submap, index, T_C_S, cache, &buffer)) {
+      if (std::abs(depth_image.at<float>(vertex.v, vertex.u) - vertex.depth) >=
+          depth_tolerance) {
+        continue;
+      }
+      Splat splat;
+      splat.u_min = std::max(0, vertex.u - vertex.size_x);
+      splat.u_max = std::min(cam_config.width - 1, vertex.u + vertex.size_x);
+      splat.v_min = std::max(0, vertex.v - vertex.size_y);
+      splat.v_max = std::min(cam_config.height - 1, vertex.v + vertex.size_y);
+      splat.depth = vertex.depth;
+      splat.submap_id = submap.getID();
+      for (int tile = splat.v_min / rows_per_tile;
+           tile <= splat.v_max / rows_per_tile; ++tile) {
+        (*tiles)[tile].push_back(splat);
+      }
     }
   }
-  result.evaluate(input.idImage(), depth_image);
-  return result;
 }
 
 TrackingInfo ProjectiveIDTracker::renderTrackingInfoVertices(
     const Submap& submap, const InputData& input) const {
-  TrackingInfo result(submap.getID());
-
-  // Compute the maximum extent to lookup vertices.
+  // Compute the maximum extent to lookup vertices. Only pixels whose vertex
+  // lies within the bounding volume of the submap can hit allocated blocks.
   const Transformation T_C_S = input.T_M_C().inverse() * submap.getT_M_S();
   const Point origin_C = T_C_S * submap.getBoundingVolume().getCenter();
-  std::vector<size_t> limits(4);  // x_min, x_max, y_min, y_max
+  const float radius = submap.getBoundingVolume().getRadius();
   const Camera::Config& cam_config = globals_->camera()->getConfig();
+  int u_min = 0;
+  int v_min = 0;
+  int u_max = cam_config.width - 1;
+  int v_max = cam_config.height - 1;
+  int u_min_sphere, v_min_sphere, u_max_sphere, v_max_sphere;
+  if (globals_->camera()->projectSphereToImagePlane(
+          origin_C, radius, &u_min_sphere, &v_min_sphere, &u_max_sphere,
+          &v_max_sphere)) {
+    // Otherwise the sphere intersects the image plane and the whole frame is
+    // checked.
+    u_min = std::max(u_min, u_min_sphere);
+    v_min = std::max(v_min, v_min_sphere);
+    u_max = std::min(u_max, u_max_sphere);
+    v_max = std::min(v_max, v_max_sphere);
+  }
+  const float depth_min = std::max(cam_config.min_range, origin_C.z() - radius);
+  const float depth_max = std::min(cam_config.max_range, origin_C.z() + radius);
+  TrackingInfo result(submap.getID());
+  if (u_min > u_max || v_min > v_max || depth_min > depth_max) {
+    return result;
+  }
 
-  // NOTE(schmluk): Currently just iterate over the whole frame since the sphere
-  // tangent computation was not robustly implemented.
-  size_t subsampling_factor = 1;
-  limits = {0u, static_cast<size_t>(cam_config.width), 0u,
-            static_cast<size_t>(cam_config.height)};
+  // Start on the subsampling grid of the full image.
+  const int step = rendering_subsampling_;
+  u_min = (u_min + step - 1) / step * step;
+  v_min = (v_min + step - 1) / step * step;
   const Transformation T_S_C = T_C_S.inverse();
   const TsdfLayer& tsdf_layer = submap.getTsdfLayer();
   const float depth_tolerance =
       config_.depth_tolerance > 0
           ? config_.depth_tolerance
           : -config_.depth_tolerance * submap.getTsdfLayer().voxel_size();
-  for (size_t u = limits[0]; u < limits[1];
-       u += config_.rendering_subsampling) {
-    for (size_t v = limits[2]; v < limits[3];
-         v += config_.rendering_subsampling) {
+  for (int v = v_min; v <= v_max; v += step) {
+    for (int u = u_min; u <= u_max; u += step) {
       const float depth = input.depthImage().at<float>(v, u);
-      if (depth < cam_config.min_range || depth > cam_config.max_range) {
+      if (depth < depth_min || depth > depth_max) {
         continue;
       }
       const cv::Vec3f& vertex = input.vertexMap().at<cv::Vec3f>(v, u);
@@ -393,7 +1091,7 @@ TrackingInfo ProjectiveIDTracker::renderTrackingInfoVertices(
         }
         if (voxel.weight > 1e-6 && std::abs(voxel.distance) < depth_tolerance) {
           result.insertVertexPoint(input.idImage().at<int>(v, u));
-          if (visualizationIsOn()) {
+          if (visualize_rendered_) {
             result.insertVertexVisualizationPoint(u, v);
           }
         }
@@ -0,0 +1,157 @@
+#include "panoptic_mapping/tracking/sparse_assignment.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+namespace panoptic_mapping {
+
+namespace {
+
+int findRoot(std::vector<int>* parents, int node) {
+  while ((*parents)[node] != node) {
+    (*parents)[node] = (*parents)[(*parents)[node]];
+    node = (*parents)[node];
+  }
+  return node;
+}
+
+// Hungarian method minimizing the total cost of a dense row-major n x m cost
+// matrix with n <= m. Returns the assigned column of every row.
+std::vector<int> solveDenseAssignment(const std::vector<double>& cost, int n,
+                                      int m) {
+  const double kInf = std::numeric_limits<double>::infinity();
+  // Potentials and matching use 1-based indices, 0 is a virtual column.
+  std::vector<double> u(n + 1, 0.0);
+  std::vector<double> v(m + 1, 0.0);
+  std::vector<double> min_slack(m + 1);
+  std::vector<int> row_of_col(m + 1, 0);
+  std::vector<int> way(m + 1, 0);
+  std::vector<bool> used(m + 1);
+  for (int i = 1; i <= n; ++i) {
+    row_of_col[0] = i;
+    int j0 = 0;
+    std::fill(min_slack.begin(), min_slack.end(), kInf);
+    std::fill(used.begin(), used.end(), false);
+    do {
+      used[j0] = true;
+      const int i0 = row_of_col[j0];
+      double delta = kInf;
+      int j1 = 0;
+      for (int j = 1; j <= m; ++j) {
+        if (used[j]) {
+          continue;
+        }
+        const double slack = cost[(i0 - 1) * m + j - 1] - u[i0] - v[j];
+        if (slack < min_slack[j]) {
+          min_slack[j] = slack;
+          way[j] = j0;
+        }
+        if (min_slack[j] < delta) {
+          delta = min_slack[j];
+          j1 = j;
+        }
+      }
+      for (int j = 0; j <= m; ++j) {
+        if (used[j]) {
+          u[row_of_col[j]] += delta;
+          v[j] -= delta;
+        } else {
+          min_slack[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (row_of_col[j0] != 0);
+
+    // Augment along the found path.
+    do {
+      const int j1 = way[j0];
+      row_of_col[j0] = row_of_col[j1];
+      j0 = j1;
+    } while (j0 != 0);
+  }
+
+  std::vector<int> result(n, -1);
+  for (int j = 1; j <= m; ++j) {
+    if (row_of_col[j] != 0) {
+      result[row_of_col[j] - 1] = j - 1;
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
+std::vector<size_t> solveSparseAssignment(
+    const std::vector<AssignmentCandidate>& candidates) {
+  // Dense node indices of all rows and columns.
+  std::unordered_map<int, int> row_nodes;
+  std::unordered_map<int, int> col_nodes;
+  for (const AssignmentCandidate& candidate : candidates) {
+    row_nodes.emplace(candidate.row, row_nodes.size());
+  }
+  for (const AssignmentCandidate& candidate : candidates) {
+    col_nodes.emplace(candidate.col, row_nodes.size() + col_nodes.size());
+  }
+
+  // Find the connected components of the candidate graph.
+  std::vector<int> parents(row_nodes.size() + col_nodes.size());
+  std::iota(parents.begin(), parents.end(), 0);
+  for (const AssignmentCandidate& candidate : candidates) {
+    const int row_root = findRoot(&parents, row_nodes.at(candidate.row));
+    const int col_root = findRoot(&parents, col_nodes.at(candidate.col));
+    parents[row_root] = col_root;
+  }
+  std::unordered_map<int, std::vector<size_t>> components;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    components[findRoot(&parents, row_nodes.at(candidates[i].row))].push_back(
+        i);
+  }
+
+  // Solve every component separately.
+  std::vector<size_t> result;
+  for (const auto& root_component : components) {
+    const std::vector<size_t>& component = root_component.second;
+    if (component.size() == 1) {
+      result.push_back(component.front());
+      continue;
+    }
+
+    // Local indices, the Hungarian method requires rows <= cols.
+    std::unordered_map<int, int> rows;
+    std::unordered_map<int, int> cols;
+    for (const size_t i : component) {
+      rows.emplace(candidates[i].row, rows.size());
+      cols.emplace(candidates[i].col, cols.size());
+    }
+    const bool transpose = rows.size() > cols.size();
+    const int n = transpose ? cols.size() : rows.size();
+    const int m = transpose ? rows.size() : cols.size();
+
+    // Missing pairs have a value of 0 and are discarded after the solution,
+    // which is equivalent to leaving them unassigned.
+    std::vector<double> cost(n * m, 0.0);
+    std::vector<int> candidate_index(n * m, -1);
+    for (const size_t i : component) {
+      int r = rows.at(candidates[i].row);
+      int c = cols.at(candidates[i].col);
+      if (transpose) {
+        std::swap(r, c);
+      }
+      cost[r * m + c] = -static_cast<double>(candidates[i].value);
+      candidate_index[r * m + c] = static_cast<int>(i);
+    }
+    const std::vector<int> assignment = solveDenseAssignment(cost, n, m);
+    for (int r = 0; r < n; ++r) {
+      if (assignment[r] >= 0 && candidate_index[r * m + assignment[r]] >= 0) {
+        result.push_back(candidate_index[r * m + assignment[r]]);
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+}  // namespace panoptic_mapping
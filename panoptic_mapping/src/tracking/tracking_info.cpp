@@ -1,13 +1,17 @@
 #include "panoptic_mapping/tracking/tracking_info.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <future>
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <glog/logging.h>
+#include <opencv2/core.hpp>
 
 namespace panoptic_mapping {
 
@@ -21,13 +25,90 @@ void incrementMap(std::unordered_map<int, int>* map, int id, int value = 1) {
   }
 }
 
-TrackingInfo::TrackingInfo(int submap_id, Camera::Config camera)
-    : submap_id_(submap_id), camera_(std::move(camera)) {
-  image_ =
-      cv::Mat(cv::Size(camera_.width, camera_.height), CV_32SC1, cv::Scalar(0));
-  u_min_ = camera_.width;
+// Utility function to convert dense histograms to the sparse representation.
+void insertDenseCounts(const std::vector<int>& dense_counts,
+                       const DenseIDMap& id_map,
+                       std::unordered_map<int, int>* map) {
+  for (size_t i = 0; i < dense_counts.size(); ++i) {
+    if (dense_counts[i] > 0) {
+      incrementMap(map, id_map.getID(i), dense_counts[i]);
+    }
+  }
+}
+
+DenseIDMap::DenseIDMap(const cv::Mat& id_image) {
+  if (id_image.empty()) {
+    return;
+  }
+  double min_value, max_value;
+  cv::minMaxLoc(id_image, &min_value, &max_value);
+  min_id_ = static_cast<int>(min_value);
+  const int64_t range = static_cast<int64_t>(max_value) - min_id_ + 1;
+  use_lookup_table_ = range <= kMaxLookupTableSize;
+  if (use_lookup_table_) {
+    // Mark all present IDs, the lookup table is sorted by construction.
+    lookup_table_.assign(range, -1);
+    for (auto it = id_image.begin<int>(); it != id_image.end<int>(); ++it) {
+      lookup_table_[*it - min_id_] = 0;
+    }
+    for (size_t i = 0; i < lookup_table_.size(); ++i) {
+      if (lookup_table_[i] == 0) {
+        ids_.push_back(static_cast<int>(i) + min_id_);
+      }
+    }
+  } else {
+    std::unordered_set<int> ids(id_image.begin<int>(), id_image.end<int>());
+    ids_.assign(ids.begin(), ids.end());
+    std::sort(ids_.begin(), ids_.end());
+  }
+  setupIndices();
+}
+
+DenseIDMap::DenseIDMap(const std::vector<int>& ids) : ids_(ids) {
+  std::sort(ids_.begin(), ids_.end());
+  ids_.erase(std::unique(ids_.begin(), ids_.end()), ids_.end());
+  if (!ids_.empty()) {
+    min_id_ = ids_.front();
+    use_lookup_table_ =
+        static_cast<int64_t>(ids_.back()) - min_id_ + 1 <= kMaxLookupTableSize;
+    if (use_lookup_table_) {
+      lookup_table_.assign(ids_.back() - min_id_ + 1, -1);
+    }
+  }
+  setupIndices();
+}
+
+void DenseIDMap::setupIndices() {
+  for (size_t i = 0; i < ids_.size(); ++i) {
+    if (use_lookup_table_) {
+      lookup_table_[ids_[i] - min_id_] = static_cast<int>(i);
+    } else {
+      fallback_map_[ids_[i]] = static_cast<int>(i);
+    }
+  }
+}
+
+TrackingInfo::TrackingInfo(int submap_id, const Camera::Config& camera,
+                           TrackingRenderBuffer* buffer)
+    : submap_id_(submap_id),
+      width_(camera.width),
+      height_(camera.height),
+      min_range_(camera.min_range),
+      max_range_(camera.max_range),
+      buffer_(buffer) {
+  if (buffer_) {
+    // The buffer is only allocated once and stays zero outside of rendering.
+    if (buffer_->image.cols != width_ || buffer_->image.rows != height_) {
+      buffer_->image =
+          cv::Mat(cv::Size(width_, height_), CV_32SC1, cv::Scalar(0));
+    }
+    image_ = buffer_->image;
+  } else {
+    image_ = cv::Mat(cv::Size(width_, height_), CV_32SC1, cv::Scalar(0));
+  }
+  u_min_ = width_;
   u_max_ = 0;
-  v_min_ = camera_.height;
+  v_min_ = height_;
   v_max_ = 0;
 }
 
@@ -35,7 +116,7 @@ void TrackingInfo::insertRenderedPoint(int u, int v, int size_x, int size_y) {
   // Mark the left side of the maximum vertex size for later evaluation.
   const int u_min = std::max(0, u - size_x);
   const int width = u + 2 * size_x + 1 - u_min;
-  const int v_max = std::min(camera_.height - 1, v + size_y);
+  const int v_max = std::min(height_ - 1, v + size_y);
   const int v_min = std::max(0, v - size_y);
   for (int v2 = v_min; v2 <= v_max; ++v2) {
     int& data = image_.at<int>(v2, u_min);
@@ -48,28 +129,87 @@ void TrackingInfo::insertRenderedPoint(int u, int v, int size_x, int size_y) {
 }
 
 void TrackingInfo::evaluate(const cv::Mat& id_image,
-                            const cv::Mat& depth_image) {
+                            const cv::Mat& depth_image,
+                            const DenseIDMap* id_map, int subsampling) {
+  evaluateRows(
+      [&](int v) {
+        const int* ids = id_image.ptr<int>(v);
+        const float* depths = depth_image.ptr<float>(v);
+        return [this, ids, depths](int u, int* id) {
+          *id = ids[u];
+          return depths[u] >= min_range_ && depths[u] <= max_range_;
+        };
+      },
+      id_map, subsampling);
+}
+
+void TrackingInfo::evaluate(const IDSegments& segments,
+                            const DenseIDMap* id_map, int subsampling) {
+  evaluateRows(
+      [&segments](int v) {
+        return [run = segments.rowBegin(v)](int u, int* id) mutable {
+          while (run->u_end <= u) {
+            ++run;
+          }
+          *id = run->id;
+          return run->is_valid;
+        };
+      },
+      id_map, subsampling);
+}
+
+template <typename RowLookupT>
+void TrackingInfo::evaluateRows(RowLookupT row_lookup,
+                                const DenseIDMap* id_map, int subsampling) {
   // Pass through the image and lookup which pixels should be covered by the
   // submap. Must be called after all input is inserted.
-  for (int v = v_min_; v <= v_max_; ++v) {
+  std::vector<int> local_counts;
+  std::vector<int>& dense_counts =
+      buffer_ ? buffer_->dense_counts : local_counts;
+  dense_counts.assign(id_map ? id_map->size() : 0, 0);
+  const int u_max = std::min(u_max_, width_ - 1);
+  const int weight = subsampling * subsampling;
+  // Sample on a fixed grid, such that all renderings use the same pixels.
+  const int v_start = (v_min_ + subsampling - 1) / subsampling * subsampling;
+  for (int v = v_start; v <= v_max_; v += subsampling) {
+    auto lookup = row_lookup(v);
     int range =
         0;  // Number of pixels in x direction from current index to be counted.
-    for (int u = u_min_; u <= std::min(u_max_, camera_.width - 1); ++u) {
+    for (int u = u_min_; u <= u_max; ++u) {
       range = std::max(range, image_.at<int>(v, u)) - 1;
-      if (range > 0) {
-        const float depth = depth_image.at<float>(v, u);
-        if (depth >= camera_.min_range && depth <= camera_.max_range) {
-          incrementMap(&counts_, id_image.at<int>(v, u));
+      int id;
+      if (range > 0 && u % subsampling == 0 && lookup(u, &id)) {
+        if (id_map) {
+          dense_counts[id_map->getIndex(id)] += weight;
+        } else {
+          incrementMap(&counts_, id, weight);
         }
       }
     }
   }
+  if (id_map) {
+    insertDenseCounts(dense_counts, *id_map, &counts_);
+  }
+
+  // Only the touched region needs to be reset for the next user of the buffer.
+  if (buffer_) {
+    if (v_min_ <= v_max_ && u_min_ <= u_max) {
+      image_(cv::Rect(u_min_, v_min_, u_max - u_min_ + 1, v_max_ - v_min_ + 1))
+          .setTo(0);
+    }
+    image_.release();
+    buffer_ = nullptr;
+  }
 }
 
 void TrackingInfo::insertVertexPoint(int input_id) {
   incrementMap(&counts_, input_id);
 }
 
+void TrackingInfo::insertCount(int input_id, int count) {
+  incrementMap(&counts_, input_id, count);
+}
+
 void TrackingInfoAggregator::insertTrackingInfos(
     const std::vector<TrackingInfo>& infos) {
   for (const TrackingInfo& info : infos) {
@@ -96,14 +236,102 @@ void TrackingInfoAggregator::insertTrackingInfo(const TrackingInfo& info) {
 void TrackingInfoAggregator::insertInputImage(const cv::Mat& id_image,
                                               const cv::Mat& depth_image,
                                               const Camera::Config& camera,
-                                              int rendering_subsampling) {
-  for (int u = 0; u < id_image.cols; u += rendering_subsampling) {
-    for (int v = 0; v < id_image.rows; v += rendering_subsampling) {
-      const float depth = depth_image.at<float>(v, u);
-      if (depth >= camera.min_range && depth <= camera.max_range) {
-        incrementMap(&total_input_count_, id_image.at<int>(v, u));
+                                              int rendering_subsampling,
+                                              const DenseIDMap* id_map,
+                                              ThreadPool* thread_pool,
+                                              int num_bands) {
+  // Count the pixels of a band of sampled rows [v_start, v_end).
+  auto count_band = [&](int v_start, int v_end, std::vector<int>* dense_counts,
+                        std::unordered_map<int, int>* counts) {
+    for (int v = v_start; v < v_end; v += rendering_subsampling) {
+      const int* ids = id_image.ptr<int>(v);
+      const float* depths = depth_image.ptr<float>(v);
+      for (int u = 0; u < id_image.cols; u += rendering_subsampling) {
+        if (depths[u] >= camera.min_range && depths[u] <= camera.max_range) {
+          if (id_map) {
+            (*dense_counts)[id_map->getIndex(ids[u])]++;
+          } else {
+            incrementMap(counts, ids[u]);
+          }
+        }
       }
     }
+  };
+  const size_t num_ids = id_map ? id_map->size() : 0;
+  if (!thread_pool || num_bands <= 1) {
+    std::vector<int> dense_counts(num_ids, 0);
+    count_band(0, id_image.rows, &dense_counts, &total_input_count_);
+    if (id_map) {
+      insertDenseCounts(dense_counts, *id_map, &total_input_count_);
+    }
+    return;
+  }
+
+  // Bands start at sampled rows such that the result is identical to the
+  // serial pass.
+  const int num_samples =
+      (id_image.rows + rendering_subsampling - 1) / rendering_subsampling;
+  const int samples_per_band = (num_samples + num_bands - 1) / num_bands;
+  const int band_rows = samples_per_band * rendering_subsampling;
+  std::vector<std::future<void>> futures;
+  std::vector<std::vector<int>> dense_counts;
+  std::vector<std::unordered_map<int, int>> counts;
+  for (int v = 0; v < id_image.rows; v += band_rows) {
+    dense_counts.emplace_back(num_ids, 0);
+    counts.emplace_back();
+  }
+  for (size_t i = 0; i < dense_counts.size(); ++i) {
+    futures.emplace_back(thread_pool->submit([&, i]() {
+      const int v_start = static_cast<int>(i) * band_rows;
+      count_band(v_start, std::min(v_start + band_rows, id_image.rows),
+                 &dense_counts[i], &counts[i]);
+    }));
+  }
+  thread_pool->waitAll(&futures);
+
+  // Combine the bands.
+  if (id_map) {
+    for (size_t i = 1; i < dense_counts.size(); ++i) {
+      for (size_t j = 0; j < num_ids; ++j) {
+        dense_counts[0][j] += dense_counts[i][j];
+      }
+    }
+    insertDenseCounts(dense_counts[0], *id_map, &total_input_count_);
+  } else {
+    for (const auto& band_counts : counts) {
+      for (const auto& id_count : band_counts) {
+        incrementMap(&total_input_count_, id_count.first, id_count.second);
+      }
+    }
+  }
+}
+
+void TrackingInfoAggregator::insertInputSegments(const IDSegments& segments,
+                                                 int rendering_subsampling,
+                                                 const DenseIDMap* id_map) {
+  // The number of sampled columns of a run [u_begin, u_end) is the number of
+  // multiples of the subsampling in the run.
+  std::vector<int> dense_counts(id_map ? id_map->size() : 0, 0);
+  const int s = rendering_subsampling;
+  for (int v = 0; v < segments.rows(); v += s) {
+    for (const IDSegments::Run* run = segments.rowBegin(v);
+         run != segments.rowEnd(v); ++run) {
+      if (!run->is_valid) {
+        continue;
+      }
+      const int count = (run->u_end + s - 1) / s - (run->u_begin + s - 1) / s;
+      if (count == 0) {
+        continue;
+      }
+      if (id_map) {
+        dense_counts[id_map->getIndex(run->id)] += count;
+      } else {
+        incrementMap(&total_input_count_, run->id, count);
+      }
+    }
+  }
+  if (id_map) {
+    insertDenseCounts(dense_counts, *id_map, &total_input_count_);
   }
 }
 
@@ -0,0 +1,272 @@
+#include "panoptic_mapping/tracking/tsdf_raycast_renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <vector>
+
+namespace panoptic_mapping {
+
+void TsdfRaycastRenderer::Config::checkParams() const {
+  checkParamGE(min_weight, 0.f, "min_weight");
+  checkParamGT(min_step, 0.f, "min_step");
+  checkParamGT(max_steps, 0, "max_steps");
+  checkParamGT(tile_size, 0, "tile_size");
+}
+
+void TsdfRaycastRenderer::Config::setupParamsAndPrinting() {
+  setupParam("min_weight", &min_weight);
+  setupParam("min_step", &min_step, "voxels");
+  setupParam("max_steps", &max_steps);
+  setupParam("tile_size", &tile_size, "px");
+}
+
+TsdfRaycastRenderer::TsdfRaycastRenderer(const Config& config)
+    : config_(config.checkValid()) {}
+
+void TsdfRaycastRenderer::render(
+    const SubmapCollection& submaps, const std::vector<int>& submap_ids,
+    const Camera& camera, const Transformation& T_M_C,
+    const cv::Mat& depth_image, float depth_tolerance, int subsampling,
+    ThreadPool* thread_pool, int num_threads, cv::Mat* rendered_depth,
+    cv::Mat* rendered_ids) const {
+  CHECK_NOTNULL(thread_pool);
+  CHECK_NOTNULL(rendered_depth);
+  CHECK_NOTNULL(rendered_ids);
+  CHECK_GT(subsampling, 0);
+  const Camera::Config& cam_config = camera.getConfig();
+  rendered_depth->create(cam_config.height, cam_config.width, CV_32FC1);
+  rendered_depth->setTo(0.f);
+  rendered_ids->create(cam_config.height, cam_config.width, CV_32SC1);
+  rendered_ids->setTo(-1);
+
+  // Set up the submaps once per frame.
+  const Transformation T_C_M = T_M_C.inverse();
+  std::vector<SubmapView> views;
+  views.reserve(submap_ids.size());
+  for (const int submap_id : submap_ids) {
+    const Submap& submap = submaps.getSubmap(submap_id);
+    SubmapView view;
+    view.submap = &submap;
+    const Transformation T_C_S = T_C_M * submap.getT_M_S();
+    view.T_S_C = T_C_S.inverse();
+    view.center_C = T_C_S * submap.getBoundingVolume().getCenter();
+    view.radius = submap.getBoundingVolume().getRadius();
+    view.depth_tolerance =
+        depth_tolerance > 0.f
+            ? depth_tolerance
+            : -depth_tolerance * submap.getTsdfLayer().voxel_size();
+    view.u_min = 0;
+    view.v_min = 0;
+    view.u_max = cam_config.width - 1;
+    view.v_max = cam_config.height - 1;
+    int u_min, v_min, u_max, v_max;
+    if (camera.projectSphereToImagePlane(view.center_C, view.radius, &u_min,
+                                         &v_min, &u_max, &v_max)) {
+      // Otherwise the sphere intersects the image plane.
+      view.u_min = std::max(view.u_min, u_min);
+      view.v_min = std::max(view.v_min, v_min);
+      view.u_max = std::min(view.u_max, u_max);
+      view.v_max = std::min(view.v_max, v_max);
+    }
+    if (view.u_min <= view.u_max && view.v_min <= view.v_max) {
+      views.push_back(view);
+    }
+  }
+  if (views.empty()) {
+    return;
+  }
+
+  // Render the tiles in parallel.
+  const int tile_size = config_.tile_size;
+  const int tiles_x = (cam_config.width + tile_size - 1) / tile_size;
+  const int tiles_y = (cam_config.height + tile_size - 1) / tile_size;
+  const int num_tiles = tiles_x * tiles_y;
+  std::atomic<int> next_tile(0);
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < std::max(num_threads, 1); ++i) {
+    futures.emplace_back(thread_pool->submit([&]() {
+      int tile;
+      while ((tile = next_tile.fetch_add(1, std::memory_order_relaxed)) <
+             num_tiles) {
+        renderTile(views, camera, depth_image, subsampling,
+                   (tile % tiles_x) * tile_size, (tile / tiles_x) * tile_size,
+                   rendered_depth, rendered_ids);
+      }
+    }));
+  }
+  thread_pool->waitAll(&futures);
+}
+
+void TsdfRaycastRenderer::renderTile(const std::vector<SubmapView>& views,
+                                     const Camera& camera,
+                                     const cv::Mat& depth_image,
+                                     int subsampling, int u_begin, int v_begin,
+                                     cv::Mat* rendered_depth,
+                                     cv::Mat* rendered_ids) const {
+  const Camera::Config& cam_config = camera.getConfig();
+  const int u_end = std::min(u_begin + config_.tile_size, cam_config.width);
+  const int v_end = std::min(v_begin + config_.tile_size, cam_config.height);
+
+  // Only submaps whose bounds overlap the tile are rendered.
+  std::vector<const SubmapView*> tile_views;
+  for (const SubmapView& view : views) {
+    if (view.u_min < u_end && view.u_max >= u_begin && view.v_min < v_end &&
+        view.v_max >= v_begin) {
+      tile_views.push_back(&view);
+    }
+  }
+  if (tile_views.empty()) {
+    return;
+  }
+
+  // Start on the subsampling grid of the full image.
+  const int u_start = (u_begin + subsampling - 1) / subsampling * subsampling;
+  const int v_start = (v_begin + subsampling - 1) / subsampling * subsampling;
+  for (int v = v_start; v < v_end; v += subsampling) {
+    const float* depths = depth_image.ptr<float>(v);
+    float* rendered_depths = rendered_depth->ptr<float>(v);
+    int* ids = rendered_ids->ptr<int>(v);
+    for (int u = u_start; u < u_end; u += subsampling) {
+      const float depth = depths[u];
+      if (depth < cam_config.min_range || depth > cam_config.max_range) {
+        continue;
+      }
+      // Distances along the normalized ray are 'norm' times the depth.
+      Point direction_C((u - cam_config.vx) / cam_config.fx,
+                        (v - cam_config.vy) / cam_config.fy, 1.f);
+      const float norm = direction_C.norm();
+      direction_C /= norm;
+      const float t_measured = depth * norm;
+
+      // Find the closest surface that agrees with the measurement.
+      float t_best = std::numeric_limits<float>::max();
+      int id_best = -1;
+      for (const SubmapView* view : tile_views) {
+        if (u < view->u_min || u > view->u_max || v < view->v_min ||
+            v > view->v_max) {
+          continue;
+        }
+        // Intersect the band around the measurement with the bounding
+        // sphere. Marching starts one truncation distance in front of the
+        // band to observe the distance field in front of the surface.
+        const float t_center = direction_C.dot(view->center_C);
+        const float distance_squared =
+            view->center_C.squaredNorm() - t_center * t_center;
+        const float radius_squared = view->radius * view->radius;
+        if (distance_squared > radius_squared) {
+          continue;
+        }
+        const float half_chord = std::sqrt(radius_squared - distance_squared);
+        const float tolerance = view->depth_tolerance * norm;
+        const float t_hit_min = t_measured - tolerance;
+        const float t_max = std::min({t_measured + tolerance,
+                                      t_center + half_chord, t_best});
+        const float t_begin =
+            std::max(t_center - half_chord,
+                     t_hit_min - view->submap->getConfig().truncation_distance);
+        float t_hit;
+        if (t_begin < t_max && castRay(*view, direction_C, t_begin, t_hit_min,
+                                       t_max, &t_hit)) {
+          // Ties are resolved by ID to be independent of the order.
+          if (t_hit < t_best ||
+              (t_hit == t_best && view->submap->getID() < id_best)) {
+            t_best = t_hit;
+            id_best = view->submap->getID();
+          }
+        }
+      }
+      if (id_best >= 0) {
+        rendered_depths[u] = t_best / norm;
+        ids[u] = id_best;
+      }
+    }
+  }
+}
+
+bool TsdfRaycastRenderer::castRay(const SubmapView& view,
+                                  const Point& direction_C, float t_begin,
+                                  float t_hit_min, float t_max,
+                                  float* t_hit) const {
+  const TsdfLayer& layer = view.submap->getTsdfLayer();
+  const ClassLayer* class_layer =
+      view.submap->hasClassLayer() ? &view.submap->getClassLayer() : nullptr;
+  const float block_size = layer.block_size();
+  const float min_step = config_.min_step * layer.voxel_size();
+  const Point origin_S = view.T_S_C.getPosition();
+  const Point direction_S = view.T_S_C.getRotation().rotate(direction_C);
+
+  BlockIndex block_index;
+  TsdfBlock::ConstPtr block;
+  bool has_block = false;
+  bool previous_is_in_front = false;
+  float t_previous = 0.f;
+  float distance_previous = 0.f;
+  float t = t_begin;
+  for (int step = 0; step < config_.max_steps && t <= t_max; ++step) {
+    const Point p_S = origin_S + t * direction_S;
+    const BlockIndex index = layer.computeBlockIndexFromCoordinates(p_S);
+    if (!has_block || index != block_index) {
+      block_index = index;
+      block = layer.getBlockPtrByIndex(index);
+      has_block = true;
+    }
+
+    // Skip unallocated blocks by moving to where the ray leaves them.
+    if (!block) {
+      float t_exit = std::numeric_limits<float>::max();
+      for (int i = 0; i < 3; ++i) {
+        if (direction_S[i] == 0.f) {
+          continue;
+        }
+        const float plane = (index[i] + (direction_S[i] > 0.f ? 1 : 0)) *
+                            block_size;
+        t_exit = std::min(t_exit, (plane - origin_S[i]) / direction_S[i]);
+      }
+      t = std::max(t_exit, t) + 1e-3f * min_step;
+      previous_is_in_front = false;
+      continue;
+    }
+    const size_t linear_index = block->computeLinearIndexFromCoordinates(p_S);
+    const TsdfVoxel& voxel = block->getVoxelByLinearIndex(linear_index);
+    if (voxel.weight < config_.min_weight) {
+      t += min_step;
+      previous_is_in_front = false;
+      continue;
+    }
+    if (voxel.distance > 0.f) {
+      t_previous = t;
+      distance_previous = voxel.distance;
+      previous_is_in_front = true;
+      t += std::max(voxel.distance, min_step);
+      continue;
+    }
+
+    // Zero crossing from front to back, interpolated linearly.
+    if (previous_is_in_front) {
+      const float t_surface =
+          t_previous + (t - t_previous) * distance_previous /
+                           (distance_previous - voxel.distance);
+      bool belongs = true;
+      if (class_layer) {
+        // Missing class blocks are unobserved, i.e. belong to the submap.
+        const ClassBlock::ConstPtr class_block =
+            class_layer->getBlockConstPtrByIndex(block_index);
+        belongs = !class_block ||
+                  class_block->getVoxelByLinearIndex(linear_index)
+                      .belongsToSubmap();
+      }
+      if (belongs && t_surface >= t_hit_min && t_surface <= t_max) {
+        *t_hit = t_surface;
+        return true;
+      }
+    }
+    previous_is_in_front = false;
+    t += min_step;
+  }
+  return false;
+}
+
+}  // namespace panoptic_mapping
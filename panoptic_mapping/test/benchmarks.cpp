@@ -0,0 +1,377 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <opencv2/core/mat.hpp>
+
+#include "panoptic_mapping/3rd_party/config_utilities.hpp"
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/common/globals.h"
+#include "panoptic_mapping/common/input_data.h"
+#include "panoptic_mapping/integration/class_projective_tsdf_integrator.h"
+#include "panoptic_mapping/integration/mesh_integrator.h"
+#include "panoptic_mapping/integration/projective_tsdf_integrator.h"
+#include "panoptic_mapping/labels/null_label_handler.h"
+#include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/map_management/tsdf_registrator.h"
+#include "panoptic_mapping/submap_allocation/semantic_submap_allocator.h"
+#include "panoptic_mapping/test/randomization_utils.h"
+#include "panoptic_mapping/test/temporary_file.h"
+#include "panoptic_mapping/tracking/projective_id_tracker.h"
+
+/**
+ * Benchmarks of the hot paths of the mapper. By default all benchmarks run on
+ * a synthetic scene of a slanted wall observed by the default camera. Setting
+ * the environment variable 'PANOPTIC_MAPPING_BENCHMARK_MAP' to a recorded map
+ * (.panmap) additionally runs the map benchmarks on that map.
+ */
+
+namespace panoptic_mapping {
+namespace test {
+
+struct BenchmarkConfig {
+  // Synthetic scene.
+  const int num_submaps = 4;
+  const float wall_distance = 2.f;  // m
+  const float wall_slope = 0.5f;    // m per image width.
+  const int num_frames = 5;         // Integrated to build maps.
+  const float frame_offset = 0.05f;  // m, lateral between frames.
+
+  // Submaps.
+  const float voxel_size = 0.05f;
+  const float truncation_distance = 0.1f;
+  const int voxels_per_side = 16;
+
+  // Random maps for the serialization benchmarks.
+  const size_t num_random_blocks_per_submap = 100;
+  const FloatingPoint random_extent = 10.f;  // m
+
+  // Recorded map.
+  const char* recorded_map_env = "PANOPTIC_MAPPING_BENCHMARK_MAP";
+} config;
+
+// Setup.
+std::shared_ptr<Globals> createGlobals() {
+  auto camera = std::make_shared<Camera>(Camera::Config());
+  auto label_handler =
+      std::make_shared<NullLabelHandler>(NullLabelHandler::Config());
+  return std::make_shared<Globals>(camera, label_handler);
+}
+
+Submap::Config createSubmapConfig(const std::string& class_layer_type = "") {
+  Submap::Config submap_config;
+  if (!class_layer_type.empty()) {
+    // The classification type can only be set via params.
+    config_utilities::internal::ParamMap params;
+    params["_name_space"] = std::string("/submap");
+    params["_name_space_private"] = std::string("/submap");
+    params["/submap/classification/type"] = class_layer_type;
+    config_utilities::internal::setupConfigFromParamMap(params,
+                                                        &submap_config);
+  }
+  submap_config.voxel_size = config.voxel_size;
+  submap_config.truncation_distance = config.truncation_distance;
+  submap_config.voxels_per_side = config.voxels_per_side;
+  return submap_config;
+}
+
+// Creates the submaps of the synthetic scene, whose IDs are used in the id
+// image.
+std::vector<int> createSubmaps(SubmapCollection* submaps,
+                               const std::string& class_layer_type = "") {
+  const Submap::Config submap_config = createSubmapConfig(class_layer_type);
+  std::vector<int> submap_ids;
+  for (int i = 0; i < config.num_submaps; ++i) {
+    Submap* submap = submaps->createSubmap(submap_config);
+    submap->setClassID(i);
+    submap->setInstanceID(i);
+    submap_ids.push_back(submap->getID());
+  }
+  return submap_ids;
+}
+
+// Synthetic frame of a slanted wall, split into vertical stripes of submaps.
+std::unique_ptr<InputData> createInput(const Globals& globals,
+                                       const std::vector<int>& submap_ids,
+                                       float offset = 0.f) {
+  const Camera::Config& camera = globals.camera()->getConfig();
+  cv::Mat depth_image(camera.height, camera.width, CV_32FC1);
+  cv::Mat id_image(camera.height, camera.width, CV_32SC1);
+  cv::Mat color_image(camera.height, camera.width, CV_8UC3);
+  const int stripe_width = camera.width / submap_ids.size() + 1;
+  for (int v = 0; v < camera.height; ++v) {
+    for (int u = 0; u < camera.width; ++u) {
+      depth_image.at<float>(v, u) =
+          config.wall_distance + config.wall_slope * u / camera.width;
+      id_image.at<int>(v, u) = submap_ids[u / stripe_width];
+      color_image.at<cv::Vec3b>(v, u) =
+          cv::Vec3b(getRandomInt<uint8_t>(), getRandomInt<uint8_t>(),
+                    getRandomInt<uint8_t>());
+    }
+  }
+
+  auto input = std::make_unique<InputData>();
+  Transformation T_M_C;
+  T_M_C.getPosition().x() = offset;
+  input->setT_M_C(T_M_C);
+  input->setDepthImage(depth_image);
+  input->setIdImage(id_image);
+  input->setColorImage(color_image);
+  cv::Mat vertex_map, validity_image, range_image;
+  const float max_range = globals.camera()->computeDerivedImages(
+      depth_image, &vertex_map, &validity_image, &range_image,
+      globals.threadPool());
+  input->setVertexMap(vertex_map);
+  input->setValidityImage(validity_image);
+  input->setRangeImage(range_image, max_range);
+  return input;
+}
+
+// Builds a map of the synthetic scene by integrating several frames.
+std::unique_ptr<SubmapCollection> createIntegratedMap(
+    std::shared_ptr<Globals> globals,
+    const std::string& class_layer_type = "") {
+  auto submaps = std::make_unique<SubmapCollection>();
+  const std::vector<int> submap_ids =
+      createSubmaps(submaps.get(), class_layer_type);
+  ProjectiveIntegrator integrator(ProjectiveIntegrator::Config(), globals,
+                                  false);
+  for (int i = 0; i < config.num_frames; ++i) {
+    auto input = createInput(*globals, submap_ids, i * config.frame_offset);
+    integrator.processInput(submaps.get(), input.get());
+  }
+  for (Submap& submap : *submaps) {
+    submap.updateEverything(false);
+  }
+  return submaps;
+}
+
+// Builds a map of random voxels, which is the worst case for serialization.
+std::unique_ptr<SubmapCollection> createRandomMap() {
+  auto submaps = std::make_unique<SubmapCollection>();
+  createSubmaps(submaps.get(), "binary_count");
+  const size_t voxels_per_block =
+      config.voxels_per_side * config.voxels_per_side * config.voxels_per_side;
+  for (Submap& submap : *submaps) {
+    for (size_t i = 0; i < config.num_random_blocks_per_submap; ++i) {
+      const Point position(
+          getRandomReal(-config.random_extent, config.random_extent),
+          getRandomReal(-config.random_extent, config.random_extent),
+          getRandomReal(-config.random_extent, config.random_extent));
+      auto block =
+          submap.getTsdfLayerPtr()->allocateBlockPtrByCoordinates(position);
+      auto class_block =
+          submap.getClassLayerPtr()->allocateBlockPtrByCoordinates(position);
+      for (size_t j = 0; j < voxels_per_block; ++j) {
+        randomizeVoxel(&block->getVoxelByLinearIndex(j));
+        randomizeVoxel(static_cast<BinaryCountVoxel*>(
+            &class_block->getVoxelByLinearIndex(j)));
+      }
+    }
+    submap.updateBoundingVolume();
+  }
+  return submaps;
+}
+
+// Returns the recorded map if specified, otherwise skips the benchmark.
+std::unique_ptr<SubmapCollection> loadRecordedMap(benchmark::State* state) {
+  const char* file_path = std::getenv(config.recorded_map_env);
+  if (!file_path) {
+    state->SkipWithError("No recorded map specified.");
+    return nullptr;
+  }
+  auto submaps = std::make_unique<SubmapCollection>();
+  if (!submaps->loadFromFile(file_path)) {
+    state->SkipWithError("Could not load the recorded map.");
+    return nullptr;
+  }
+  return submaps;
+}
+
+// Integration.
+void BM_ProjectiveIntegrator(benchmark::State& state,
+                             const std::string& interpolation_method) {
+  auto globals = createGlobals();
+  SubmapCollection submaps;
+  const std::vector<int> submap_ids = createSubmaps(&submaps);
+  ProjectiveIntegrator::Config integrator_config;
+  integrator_config.interpolation_method = interpolation_method;
+  ProjectiveIntegrator integrator(integrator_config, globals, false);
+  auto input = createInput(*globals, submap_ids);
+  for (auto _ : state) {
+    integrator.processInput(&submaps, input.get());
+  }
+}
+BENCHMARK_CAPTURE(BM_ProjectiveIntegrator, nearest, std::string("nearest"))
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ProjectiveIntegrator, bilinear, std::string("bilinear"))
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ProjectiveIntegrator, adaptive, std::string("adaptive"))
+    ->Unit(benchmark::kMillisecond);
+
+void BM_ClassProjectiveIntegrator(benchmark::State& state,
+                                  const std::string& class_layer_type) {
+  auto globals = createGlobals();
+  SubmapCollection submaps;
+  const std::vector<int> submap_ids =
+      createSubmaps(&submaps, class_layer_type);
+  ClassProjectiveIntegrator integrator(ClassProjectiveIntegrator::Config(),
+                                       globals);
+  auto input = createInput(*globals, submap_ids);
+  for (auto _ : state) {
+    integrator.processInput(&submaps, input.get());
+  }
+}
+BENCHMARK_CAPTURE(BM_ClassProjectiveIntegrator, binary_count,
+                  std::string("binary_count"))
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ClassProjectiveIntegrator, moving_binary_count,
+                  std::string("moving_binary_count"))
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ClassProjectiveIntegrator, fixed_count,
+                  std::string("fixed_count"))
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ClassProjectiveIntegrator, variable_count,
+                  std::string("variable_count"))
+    ->Unit(benchmark::kMillisecond);
+
+// Tracking.
+void BM_ProjectiveIDTracker(benchmark::State& state,
+                            bool use_approximate_rendering) {
+  auto globals = createGlobals();
+  auto submaps = createIntegratedMap(globals);
+  std::vector<int> submap_ids;
+  for (const Submap& submap : *submaps) {
+    submap_ids.push_back(submap.getID());
+  }
+  ProjectiveIDTracker::Config tracker_config;
+  tracker_config.use_approximate_rendering = use_approximate_rendering;
+  ProjectiveIDTracker tracker(tracker_config, globals, false);
+  tracker.setSubmapAllocator(std::make_shared<SemanticSubmapAllocator>(
+      SemanticSubmapAllocator::Config(), false));
+  auto input = createInput(*globals, submap_ids);
+  const cv::Mat id_image = input->idImage().clone();
+  for (auto _ : state) {
+    // The tracker overwrites the id image.
+    state.PauseTiming();
+    input->setIdImage(id_image.clone());
+    state.ResumeTiming();
+    tracker.processInput(submaps.get(), input.get());
+  }
+}
+BENCHMARK_CAPTURE(BM_ProjectiveIDTracker, approximate, true)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ProjectiveIDTracker, exact, false)
+    ->Unit(benchmark::kMillisecond);
+
+// Map benchmarks, run on the synthetic and optionally the recorded map.
+void runMeshing(benchmark::State* state, SubmapCollection* submaps) {
+  std::vector<std::unique_ptr<MeshIntegrator>> mesh_integrators;
+  for (Submap& submap : *submaps) {
+    mesh_integrators.emplace_back(std::make_unique<MeshIntegrator>(
+        submap.getConfig().mesh, submap.getTsdfLayerPtr(),
+        submap.getMeshLayerPtr(), submap.getClassLayerPtr(),
+        submap.getConfig().truncation_distance));
+  }
+  for (auto _ : *state) {
+    for (auto& mesh_integrator : mesh_integrators) {
+      mesh_integrator->generateMesh(false, false);
+    }
+  }
+}
+
+void BM_MeshIntegrator(benchmark::State& state) {
+  auto submaps = createIntegratedMap(createGlobals());
+  runMeshing(&state, submaps.get());
+}
+BENCHMARK(BM_MeshIntegrator)->Unit(benchmark::kMillisecond);
+
+void BM_MeshIntegratorRecorded(benchmark::State& state) {
+  auto submaps = loadRecordedMap(&state);
+  if (submaps) {
+    runMeshing(&state, submaps.get());
+  }
+}
+BENCHMARK(BM_MeshIntegratorRecorded)->Unit(benchmark::kMillisecond);
+
+void runRegistration(benchmark::State* state, SubmapCollection* submaps) {
+  TsdfRegistrator registrator(TsdfRegistrator::Config());
+  for (auto _ : *state) {
+    registrator.checkSubmapCollectionForChange(submaps);
+  }
+}
+
+void BM_TsdfRegistrator(benchmark::State& state) {
+  auto submaps = createIntegratedMap(createGlobals());
+  runRegistration(&state, submaps.get());
+}
+BENCHMARK(BM_TsdfRegistrator)->Unit(benchmark::kMillisecond);
+
+void BM_TsdfRegistratorRecorded(benchmark::State& state) {
+  auto submaps = loadRecordedMap(&state);
+  if (submaps) {
+    runRegistration(&state, submaps.get());
+  }
+}
+BENCHMARK(BM_TsdfRegistratorRecorded)->Unit(benchmark::kMillisecond);
+
+void runClone(benchmark::State* state, const SubmapCollection& submaps) {
+  for (auto _ : *state) {
+    benchmark::DoNotOptimize(submaps.clone());
+  }
+}
+
+void BM_SubmapCollectionClone(benchmark::State& state) {
+  auto submaps = createRandomMap();
+  runClone(&state, *submaps);
+}
+BENCHMARK(BM_SubmapCollectionClone)->Unit(benchmark::kMillisecond);
+
+void BM_SubmapCollectionCloneRecorded(benchmark::State& state) {
+  auto submaps = loadRecordedMap(&state);
+  if (submaps) {
+    runClone(&state, *submaps);
+  }
+}
+BENCHMARK(BM_SubmapCollectionCloneRecorded)->Unit(benchmark::kMillisecond);
+
+void runSaveLoad(benchmark::State* state, const SubmapCollection& submaps) {
+  // The map files need the '.panmap' extension.
+  TempFile tmp("benchmark_map");
+  const std::string file_path = tmp.path() + ".panmap";
+  for (auto _ : *state) {
+    if (!submaps.saveToFile(file_path)) {
+      state->SkipWithError("Could not save the map.");
+      break;
+    }
+    SubmapCollection loaded;
+    if (!loaded.loadFromFile(file_path, false)) {
+      state->SkipWithError("Could not load the map.");
+      break;
+    }
+  }
+  std::remove(file_path.c_str());
+}
+
+void BM_SaveLoad(benchmark::State& state) {
+  auto submaps = createRandomMap();
+  runSaveLoad(&state, *submaps);
+}
+BENCHMARK(BM_SaveLoad)->Unit(benchmark::kMillisecond);
+
+void BM_SaveLoadRecorded(benchmark::State& state) {
+  auto submaps = loadRecordedMap(&state);
+  if (submaps) {
+    runSaveLoad(&state, *submaps);
+  }
+}
+BENCHMARK(BM_SaveLoadRecorded)->Unit(benchmark::kMillisecond);
+
+}  // namespace test
+}  // namespace panoptic_mapping
+
+BENCHMARK_MAIN();
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "panoptic_mapping/common/camera.h"
+#include "panoptic_mapping/common/common.h"
+#include "panoptic_mapping/map/submap_collection.h"
+#include "panoptic_mapping/map_management/tsdf_registrator.h"
+#include "panoptic_mapping/tools/planning_interface.h"
+
+/**
+ * Benchmarks of the collection level operations over the number of submaps.
+ * The maps are generated procedurally with a constant submap density, such
+ * that the cost of an operation on a fixed neighborhood stays constant and
+ * any growth with the submap count exposes a scan over all submaps. Each
+ * benchmark runs for 10 to 10,000 submaps of a small and a large size and
+ * reports the fitted complexity over the submap count. Use the flags
+ * '--benchmark_out=<file> --benchmark_out_format=csv|json' to export the
+ * curves.
+ */
+
+namespace panoptic_mapping {
+namespace test {
+
+struct ScalingConfig {
+  // Range of the number of submaps.
+  const int min_submaps = 10;
+  const int max_submaps = 10000;
+  const int submaps_multiplier = 10;
+
+  // Number of blocks per submap for the small and large submap runs.
+  const int small_submap_blocks = 1;
+  const int large_submap_blocks = 8;
+
+  // Submaps are placed uniformly in a cube such that each one takes this
+  // volume on average.
+  const float space_per_submap = 8.f;  // m3
+
+  // Class mix. The remaining submaps are background, there is always one
+  // free space submap.
+  const float instance_fraction = 0.7f;
+  const float active_fraction = 0.1f;
+
+  // Submaps.
+  const float voxel_size = 0.1f;
+  const float truncation_distance = 0.2f;
+  const int voxels_per_side = 8;
+
+  // Queries.
+  const float query_radius = 5.f;  // m
+  const int num_planning_queries = 1000;
+  const unsigned int seed = 42;
+} config;
+
+// Procedurally generated map.
+struct ScalingMap {
+  std::shared_ptr<SubmapCollection> submaps;
+  float extent = 0.f;  // Side length of the occupied cube in m.
+};
+
+// Fills a block with a horizontal surface through its center.
+void fillBlock(const Point& block_origin, float block_size, TsdfBlock* block) {
+  const float truncation = config.truncation_distance;
+  const float surface_height = block_origin.z() + 0.5f * block_size;
+  for (size_t i = 0; i < block->num_voxels(); ++i) {
+    const Point center = block->computeCoordinatesFromLinearIndex(i);
+    TsdfVoxel& voxel = block->getVoxelByLinearIndex(i);
+    voxel.distance = std::clamp(center.z() - surface_height, -truncation,
+                                truncation);
+    voxel.weight = 1.f;
+  }
+  block->has_data() = true;
+  block->setUpdatedAll();
+}
+
+// Adds a submap of the class mix at a random position. Inactive submaps
+// compute their iso-surface points for change detection.
+void addSubmap(SubmapCollection* submaps, int blocks_per_submap, float extent,
+               std::mt19937* random_engine) {
+  std::uniform_real_distribution<float> position(0.f, extent);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  Submap::Config submap_config;
+  submap_config.voxel_size = config.voxel_size;
+  submap_config.truncation_distance = config.truncation_distance;
+  submap_config.voxels_per_side = config.voxels_per_side;
+  Submap* submap = submaps->createSubmap(submap_config);
+  const bool is_free_space = submaps->getActiveFreeSpaceSubmapID() < 0;
+  if (is_free_space) {
+    submap->setLabel(PanopticLabel::kFreeSpace);
+    submaps->setActiveFreeSpaceSubmapID(submap->getID());
+  } else {
+    submap->setLabel(unit(*random_engine) < config.instance_fraction
+                         ? PanopticLabel::kInstance
+                         : PanopticLabel::kBackground);
+    submap->setClassID(submap->getID() % 40);
+    submap->setInstanceID(submap->getID());
+  }
+  Transformation T_M_S;
+  T_M_S.getPosition() = Point(position(*random_engine),
+                              position(*random_engine),
+                              position(*random_engine));
+  submap->setT_M_S(T_M_S);
+
+  // Blocks are packed into a cube at the submap origin.
+  const float block_size = config.voxel_size * config.voxels_per_side;
+  const int blocks_per_axis =
+      static_cast<int>(std::ceil(std::cbrt(blocks_per_submap)));
+  TsdfLayer& layer = *submap->getTsdfLayerPtr();
+  for (int j = 0; j < blocks_per_submap; ++j) {
+    const BlockIndex index(j % blocks_per_axis,
+                           (j / blocks_per_axis) % blocks_per_axis,
+                           j / (blocks_per_axis * blocks_per_axis));
+    fillBlock(index.cast<float>() * block_size, block_size,
+              layer.allocateBlockPtrByIndex(index).get());
+  }
+  submap->updateBoundingVolume();
+  if (!is_free_space && unit(*random_engine) >= config.active_fraction) {
+    submap->finishActivePeriod();
+  }
+}
+
+ScalingMap createScalingMap(int num_submaps, int blocks_per_submap) {
+  std::mt19937 random_engine(config.seed);
+  ScalingMap map;
+  map.submaps = std::make_shared<SubmapCollection>();
+  map.extent = std::cbrt(config.space_per_submap * num_submaps);
+  map.submaps->reserve(num_submaps);
+  for (int i = 0; i < num_submaps; ++i) {
+    addSubmap(map.submaps.get(), blocks_per_submap, map.extent,
+              &random_engine);
+  }
+  return map;
+}
+
+// The last generated map is kept since generating large maps is expensive.
+// Benchmarks that modify the map keep its size and class mix.
+ScalingMap& getScalingMap(const benchmark::State& state,
+                          int blocks_per_submap) {
+  static ScalingMap map;
+  static std::pair<int64_t, int64_t> key(-1, -1);
+  const std::pair<int64_t, int64_t> requested(state.range(0),
+                                              blocks_per_submap);
+  if (key != requested) {
+    map = ScalingMap();
+    map = createScalingMap(requested.first, requested.second);
+    key = requested;
+  }
+  return map;
+}
+
+void finishState(benchmark::State* state, int blocks_per_submap) {
+  state->SetComplexityN(state->range(0));
+  state->counters["submaps"] = state->range(0);
+  state->counters["blocks_per_submap"] = blocks_per_submap;
+}
+
+// Registers a benchmark for small and large submaps over the submap counts.
+#define SCALING_BENCHMARK(function, unit)                                 \
+  BENCHMARK_CAPTURE(function, small_submaps, config.small_submap_blocks)  \
+      ->RangeMultiplier(config.submaps_multiplier)                        \
+      ->Range(config.min_submaps, config.max_submaps)                     \
+      ->Complexity()                                                      \
+      ->Unit(unit);                                                       \
+  BENCHMARK_CAPTURE(function, large_submaps, config.large_submap_blocks)  \
+      ->RangeMultiplier(config.submaps_multiplier)                        \
+      ->Range(config.min_submaps, config.max_submaps)                     \
+      ->Complexity()                                                      \
+      ->Unit(unit)
+
+// Visibility search of the tracker and integrators.
+void BM_FindVisibleSubmapIDs(benchmark::State& state, int blocks_per_submap) {
+  const ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  const Camera camera((Camera::Config()));
+  Transformation T_M_C;
+  T_M_C.getPosition() = Point::Constant(0.5f * map.extent);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        camera.findVisibleSubmapIDs(*map.submaps, T_M_C, false));
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_FindVisibleSubmapIDs, benchmark::kMicrosecond);
+
+// Spatial index lookup of a fixed size neighborhood.
+void BM_FindSubmapsIntersecting(benchmark::State& state,
+                                int blocks_per_submap) {
+  const ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  const Point center = Point::Constant(0.5f * map.extent);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        map.submaps->findSubmapsIntersecting(center, config.query_radius));
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_FindSubmapsIntersecting, benchmark::kMicrosecond);
+
+// Change detection of all inactive against overlapping active submaps.
+void BM_ChangeDetection(benchmark::State& state, int blocks_per_submap) {
+  ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  TsdfRegistrator::Config registrator_config;
+  registrator_config.verbosity = 0;
+  TsdfRegistrator registrator(registrator_config);
+  for (auto _ : state) {
+    registrator.checkSubmapCollectionForChange(map.submaps.get());
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_ChangeDetection, benchmark::kMillisecond);
+
+// Removing a submap, which is then replaced outside of the timing.
+void BM_RemoveSubmap(benchmark::State& state, int blocks_per_submap) {
+  ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  std::mt19937 random_engine(config.seed);
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<int> ids;
+    for (const Submap& submap : *map.submaps) {
+      if (submap.getLabel() != PanopticLabel::kFreeSpace) {
+        ids.push_back(submap.getID());
+      }
+    }
+    const int id = ids[random_engine() % ids.size()];
+    state.ResumeTiming();
+    map.submaps->removeSubmap(id);
+    state.PauseTiming();
+    addSubmap(map.submaps.get(), blocks_per_submap, map.extent,
+              &random_engine);
+    state.ResumeTiming();
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_RemoveSubmap, benchmark::kMicrosecond);
+
+// Batched planning queries at random positions in the map.
+void BM_PlanningQueries(benchmark::State& state, int blocks_per_submap) {
+  const ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  const PlanningInterface planning_interface(map.submaps);
+  std::mt19937 random_engine(config.seed);
+  std::uniform_real_distribution<float> position(0.f, map.extent);
+  Pointcloud positions;
+  for (int i = 0; i < config.num_planning_queries; ++i) {
+    positions.emplace_back(position(random_engine), position(random_engine),
+                           position(random_engine));
+  }
+  std::vector<PlanningInterface::VoxelState> states;
+  for (auto _ : state) {
+    planning_interface.getVoxelStates(positions, &states);
+    benchmark::DoNotOptimize(states.data());
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_PlanningQueries, benchmark::kMicrosecond);
+
+// Copying the whole collection, e.g. for the mapping thread.
+void BM_CollectionClone(benchmark::State& state, int blocks_per_submap) {
+  const ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.submaps->clone());
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_CollectionClone, benchmark::kMillisecond);
+
+// Memory accounting over all submaps.
+void BM_ComputeMemoryUsage(benchmark::State& state, int blocks_per_submap) {
+  const ScalingMap& map = getScalingMap(state, blocks_per_submap);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.submaps->computeMemoryUsage());
+  }
+  finishState(&state, blocks_per_submap);
+}
+SCALING_BENCHMARK(BM_ComputeMemoryUsage, benchmark::kMicrosecond);
+
+}  // namespace test
+}  // namespace panoptic_mapping
+
+BENCHMARK_MAIN();
@@ -1,6 +1,8 @@
 #include "panoptic_mapping/tools/serialization.h"
 
+#include <cmath>
 #include <fstream>
+#include <memory>
 #include <queue>
 #include <random>
 #include <string>
@@ -12,13 +14,18 @@
 #include "panoptic_mapping/Submap.pb.h"
 #include "panoptic_mapping/common/common.h"
 #include "panoptic_mapping/map/classification/binary_count.h"
+#include "panoptic_mapping/map/classification/dense_count.h"
 #include "panoptic_mapping/map/classification/fixed_count.h"
 #include "panoptic_mapping/map/classification/moving_binary_count.h"
+#include "panoptic_mapping/map/classification/top_k_count.h"
 #include "panoptic_mapping/map/classification/uncertainty.h"
 #include "panoptic_mapping/map/classification/variable_count.h"
+#include "panoptic_mapping/map/mapped_tsdf_layer.h"
+#include "panoptic_mapping/map/submap_collection.h"
 #include "panoptic_mapping/test/comparison_utils.h"
 #include "panoptic_mapping/test/randomization_utils.h"
 #include "panoptic_mapping/test/temporary_file.h"
+#include "panoptic_mapping/tools/map_checkpointer.h"
 
 namespace panoptic_mapping {
 namespace test {
@@ -149,6 +156,67 @@ inline void testLayerSerialization() {
   }
 }
 
+// Serialize and deserialize a given layer using the run-length encoding.
+template <typename VoxelT, typename LayerT>
+inline void testEncodedLayerSerialization() {
+  for (size_t i = 0; i < config.num_layer_tests; ++i) {
+    LayerT before(typename LayerT::Config(), config.voxel_size,
+                  config.voxels_per_side);
+
+    // Only randomize some voxels such that the blocks contain runs.
+    for (size_t i = 0; i < config.num_blocks_per_layer; ++i) {
+      const Point position(getRandomReal(-10.f, 10.f),
+                           getRandomReal(-10.f, 10.f),
+                           getRandomReal(-10.f, 10.f));
+      auto block = before.allocateNewBlockByCoordinates(position);
+      for (size_t i = 0; i < config.voxels_per_block; ++i) {
+        if (getRandomReal(0.f, 1.f) < 0.1f) {
+          randomizeVoxel(
+              static_cast<VoxelT*>(&block->getVoxelByLinearIndex(i)));
+        }
+      }
+    }
+
+    // Save and load via temporary filestream.
+    TempFile tmp("serialization_test");
+    EXPECT_TRUE(tmp);
+    SubmapProto submap_proto;
+    submap_proto.set_class_voxel_type(static_cast<int>(before.getVoxelType()));
+    submap_proto.set_num_class_blocks(before.getNumberOfAllocatedBlocks());
+    submap_proto.set_class_block_encoding(
+        static_cast<uint32_t>(ClassBlockEncoding::kRunLength));
+    submap_proto.set_voxel_size(config.voxel_size);
+    submap_proto.set_voxels_per_side(config.voxels_per_side);
+    EXPECT_TRUE(
+        voxblox::utils::writeProtoMsgToStream(submap_proto, &tmp.stream()));
+    voxblox::BlockIndexList block_indices;
+    before.getAllAllocatedBlocks(&block_indices);
+    EXPECT_TRUE(saveClassBlocksToStream(before, block_indices, &tmp.stream()));
+    size_t tmp_byte_offset = 0;
+
+    SubmapProto submap_proto_after;
+    EXPECT_TRUE(voxblox::utils::readProtoMsgFromStream(
+        &tmp.stream(), &submap_proto_after, &tmp_byte_offset));
+    auto loaded = loadClassLayerFromStream(submap_proto_after, &tmp.stream(),
+                                           &tmp_byte_offset);
+    if (!loaded) {
+      FAIL() << "Could not loadClassLayerFromStream";
+      return;
+    }
+
+    // Check the layers for type and content.
+    EXPECT_EQ(before.getVoxelType(), loaded->getVoxelType());
+    LayerT* after = dynamic_cast<LayerT*>(loaded.get());
+    if (after == nullptr) {
+      FAIL() << "Could not cast loaded layer to LayerT.";
+      return;
+    }
+    if (!checkLayerEqual(before.getLayer(), after->getLayer())) {
+      return;
+    }
+  }
+}
+
 TEST(BinaryCount, SerializeVoxel) {
   testVoxelSerialization<BinaryCountVoxel>();
 }
@@ -161,6 +229,10 @@ TEST(BinaryCount, SerializeLayer) {
   testLayerSerialization<BinaryCountVoxel, BinaryCountLayer>();
 }
 
+TEST(BinaryCount, SerializeEncodedLayer) {
+  testEncodedLayerSerialization<BinaryCountVoxel, BinaryCountLayer>();
+}
+
 TEST(FixedCount, SerializeVoxel) { testVoxelSerialization<FixedCountVoxel>(); }
 
 TEST(FixedCount, SerializeBlock) {
@@ -171,6 +243,10 @@ TEST(FixedCount, SerializeLayer) {
   testLayerSerialization<FixedCountVoxel, FixedCountLayer>();
 }
 
+TEST(FixedCount, SerializeEncodedLayer) {
+  testEncodedLayerSerialization<FixedCountVoxel, FixedCountLayer>();
+}
+
 TEST(MovingBinaryCount, SerializeVoxel) {
   testVoxelSerialization<MovingBinaryCountVoxel>();
 }
@@ -183,6 +259,11 @@ TEST(MovingBinaryCount, SerializeLayer) {
   testLayerSerialization<MovingBinaryCountVoxel, MovingBinaryCountLayer>();
 }
 
+TEST(MovingBinaryCount, SerializeEncodedLayer) {
+  testEncodedLayerSerialization<MovingBinaryCountVoxel,
+                                MovingBinaryCountLayer>();
+}
+
 TEST(VariableCount, SerializeVoxel) {
   testVoxelSerialization<VariableCountVoxel>();
 }
@@ -195,6 +276,10 @@ TEST(VariableCount, SerializeLayer) {
   testLayerSerialization<VariableCountVoxel, VariableCountLayer>();
 }
 
+TEST(VariableCount, SerializeEncodedLayer) {
+  testEncodedLayerSerialization<VariableCountVoxel, VariableCountLayer>();
+}
+
 TEST(Uncertainty, SerializeVoxel) {
   testVoxelSerialization<UncertaintyVoxel>();
 }
@@ -207,6 +292,419 @@ TEST(Uncertainty, SerializeLayer) {
   testLayerSerialization<UncertaintyVoxel, UncertaintyLayer>();
 }
 
+TEST(Uncertainty, SerializeEncodedLayer) {
+  testEncodedLayerSerialization<UncertaintyVoxel, UncertaintyLayer>();
+}
+
+TEST(TopKCount, SerializeVoxel) { testVoxelSerialization<TopKCountVoxel>(); }
+
+TEST(TopKCount, SerializeBlock) {
+  testBlockSerialization<TopKCountVoxel, TopKCountLayer>();
+}
+
+TEST(TopKCount, SerializeLayer) {
+  testLayerSerialization<TopKCountVoxel, TopKCountLayer>();
+}
+
+TEST(TopKCount, SerializeEncodedLayer) {
+  testEncodedLayerSerialization<TopKCountVoxel, TopKCountLayer>();
+}
+
+// Serialize and deserialize a dense count layer whose blocks store different
+// numbers of counts.
+inline void testDenseCountLayerSerialization(ClassBlockEncoding encoding) {
+  std::uniform_int_distribution<size_t> num_counts_distribution(
+      1, kMaxNumClasses);
+  for (size_t i = 0; i < config.num_layer_tests; ++i) {
+    DenseCountLayer before(DenseCountLayer::Config(), config.voxel_size,
+                           config.voxels_per_side);
+    for (size_t i = 0; i < config.num_blocks_per_layer; ++i) {
+      const Point position(getRandomReal(-10.f, 10.f),
+                           getRandomReal(-10.f, 10.f),
+                           getRandomReal(-10.f, 10.f));
+      auto block = std::dynamic_pointer_cast<DenseCountBlock>(
+          before.allocateNewBlockByCoordinates(position));
+      randomizeBlock(block.get(), num_counts_distribution(random_engine),
+                     0.1f);
+    }
+
+    // Save and load via temporary filestream.
+    TempFile tmp("serialization_test");
+    EXPECT_TRUE(tmp);
+    SubmapProto submap_proto;
+    submap_proto.set_class_voxel_type(static_cast<int>(before.getVoxelType()));
+    submap_proto.set_num_class_blocks(before.getNumberOfAllocatedBlocks());
+    submap_proto.set_class_block_encoding(static_cast<uint32_t>(encoding));
+    submap_proto.set_voxel_size(config.voxel_size);
+    submap_proto.set_voxels_per_side(config.voxels_per_side);
+    EXPECT_TRUE(
+        voxblox::utils::writeProtoMsgToStream(submap_proto, &tmp.stream()));
+    if (encoding == ClassBlockEncoding::kRunLength) {
+      voxblox::BlockIndexList block_indices;
+      before.getAllAllocatedBlocks(&block_indices);
+      EXPECT_TRUE(
+          saveClassBlocksToStream(before, block_indices, &tmp.stream()));
+    } else {
+      EXPECT_TRUE(before.saveBlocksToStream(true, voxblox::BlockIndexList(),
+                                            &tmp.stream()));
+    }
+    size_t tmp_byte_offset = 0;
+
+    SubmapProto submap_proto_after;
+    EXPECT_TRUE(voxblox::utils::readProtoMsgFromStream(
+        &tmp.stream(), &submap_proto_after, &tmp_byte_offset));
+    auto loaded = loadClassLayerFromStream(submap_proto_after, &tmp.stream(),
+                                           &tmp_byte_offset);
+    if (!loaded) {
+      FAIL() << "Could not loadClassLayerFromStream";
+      return;
+    }
+
+    // Check the layers for type and content.
+    EXPECT_EQ(before.getVoxelType(), loaded->getVoxelType());
+    DenseCountLayer* after = dynamic_cast<DenseCountLayer*>(loaded.get());
+    if (after == nullptr) {
+      FAIL() << "Could not cast loaded layer to DenseCountLayer.";
+      return;
+    }
+    if (!checkLayerEqual(before, *after)) {
+      return;
+    }
+  }
+}
+
+TEST(DenseCount, SerializeLayer) {
+  testDenseCountLayerSerialization(ClassBlockEncoding::kVoxbloxBlock);
+}
+
+TEST(DenseCount, SerializeEncodedLayer) {
+  testDenseCountLayerSerialization(ClassBlockEncoding::kRunLength);
+}
+
+// Blocks of a layer with a fixed number of counts can be loaded by adaptive
+// and wider layers but not by narrower ones.
+TEST(DenseCount, LoadBlocksWithDifferentNumCounts) {
+  DenseCountLayer::Config layer_config;
+  layer_config.num_counts = 20;
+  DenseCountLayer before(layer_config, config.voxel_size,
+                         config.voxels_per_side);
+  auto block = std::dynamic_pointer_cast<DenseCountBlock>(
+      before.allocateNewBlockByCoordinates(config.origin));
+  randomizeBlock(block.get(), layer_config.num_counts, 0.5f);
+
+  TempFile tmp("serialization_test");
+  EXPECT_TRUE(tmp);
+  EXPECT_TRUE(before.saveBlocksToStream(true, voxblox::BlockIndexList(),
+                                        &tmp.stream()));
+  size_t tmp_byte_offset = 0;
+  voxblox::BlockProto block_proto;
+  EXPECT_TRUE(voxblox::utils::readProtoMsgFromStream(
+      &tmp.stream(), &block_proto, &tmp_byte_offset));
+
+  // Adaptive layers grow to the serialized number of counts.
+  DenseCountLayer adaptive(DenseCountLayer::Config(), config.voxel_size,
+                           config.voxels_per_side);
+  EXPECT_TRUE(adaptive.addBlockFromProto(block_proto));
+  checkLayerEqual(before, adaptive);
+
+  // Wider layers keep their number of counts.
+  layer_config.num_counts = 64;
+  DenseCountLayer wider(layer_config, config.voxel_size,
+                        config.voxels_per_side);
+  EXPECT_TRUE(wider.addBlockFromProto(block_proto));
+  auto wider_block = wider.getDenseBlockPtrByIndex(BlockIndex::Zero());
+  if (!wider_block) {
+    FAIL() << "Loaded block was not allocated.";
+    return;
+  }
+  EXPECT_EQ(wider_block->numCounts(), 64u);
+  for (size_t i = 0; i < block->num_voxels(); ++i) {
+    EXPECT_EQ(block->getTotalCount(i), wider_block->getTotalCount(i));
+    if (!block->isObserved(i)) {
+      continue;
+    }
+    for (size_t id = 0; id < block->numCounts(); ++id) {
+      EXPECT_EQ(block->getCount(i, id), wider_block->getCount(i, id));
+    }
+  }
+
+  // Narrower layers reject the block.
+  layer_config.num_counts = 8;
+  DenseCountLayer narrower(layer_config, config.voxel_size,
+                           config.voxels_per_side);
+  EXPECT_FALSE(narrower.addBlockFromProto(block_proto));
+}
+
+// Quantize random TSDF blocks and check the reconstruction error.
+inline void testQuantizedTsdfBlockSerialization(int distance_bits,
+                                                bool drop_color) {
+  const float truncation_distance = 0.3f;
+  TsdfQuantization quantization;
+  quantization.distance_bits = distance_bits;
+  quantization.drop_color = drop_color;
+  const float max_distance_error = truncation_distance /
+                                   ((1 << distance_bits) - 1);
+  for (size_t i = 0; i < config.num_block_tests; ++i) {
+    TsdfLayer before(config.voxel_size, config.voxels_per_side);
+    TsdfLayer after(config.voxel_size, config.voxels_per_side);
+    const BlockIndex index(getRandomInt(-100, 100), getRandomInt(-100, 100),
+                           getRandomInt(-100, 100));
+    TsdfBlock& block = *before.allocateBlockPtrByIndex(index);
+    for (size_t j = 0; j < config.voxels_per_block; ++j) {
+      if (getRandomReal(0.f, 1.f) < 0.1f) {
+        TsdfVoxel& voxel = block.getVoxelByLinearIndex(j);
+        randomizeVoxel(&voxel);
+        voxel.distance =
+            getRandomReal(-truncation_distance, truncation_distance);
+        voxel.weight = getRandomReal(0.1f, 100.f);
+      }
+    }
+
+    TsdfBlockProto proto;
+    EXPECT_TRUE(encodeTsdfBlock(before, index, truncation_distance,
+                                quantization, &proto));
+    BlockIndex decoded_index;
+    EXPECT_TRUE(
+        decodeTsdfBlock(proto, truncation_distance, &after, &decoded_index));
+    EXPECT_EQ(index, decoded_index);
+    if (!after.hasBlock(index)) {
+      FAIL() << "Decoded block was not allocated.";
+      return;
+    }
+    const TsdfBlock& decoded = after.getBlockByIndex(index);
+    const float max_log_weight_error = proto.log_weight_step() / 2.f + 1e-5f;
+    for (size_t j = 0; j < config.voxels_per_block; ++j) {
+      const TsdfVoxel& v1 = block.getVoxelByLinearIndex(j);
+      const TsdfVoxel& v2 = decoded.getVoxelByLinearIndex(j);
+      if (v1.weight <= 0.f) {
+        EXPECT_EQ(v2.weight, 0.f);
+        continue;
+      }
+      EXPECT_NEAR(v1.distance, v2.distance, max_distance_error + 1e-6f);
+      EXPECT_NEAR(std::log(v1.weight), std::log(v2.weight),
+                  max_log_weight_error);
+      if (!drop_color) {
+        EXPECT_EQ(v1.color.r, v2.color.r);
+        EXPECT_EQ(v1.color.g, v2.color.g);
+        EXPECT_EQ(v1.color.b, v2.color.b);
+      }
+    }
+  }
+}
+
+TEST(TsdfBlock, SerializeQuantizedBlock) {
+  testQuantizedTsdfBlockSerialization(16, false);
+  testQuantizedTsdfBlockSerialization(8, true);
+}
+
+// Randomize some TSDF blocks of a submap. The blocks are flagged as changed
+// such that they are picked up by the next snapshot.
+inline void randomizeTsdfBlocks(Submap* submap, size_t num_blocks) {
+  std::uniform_int_distribution<int> index_distribution(-10, 10);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const BlockIndex index(index_distribution(random_engine),
+                           index_distribution(random_engine),
+                           index_distribution(random_engine));
+    TsdfBlock::Ptr block = submap->allocateBlocks(index).tsdf;
+    for (size_t j = 0; j < config.voxels_per_block; ++j) {
+      randomizeVoxel(&block->getVoxelByLinearIndex(j));
+    }
+    block->has_data() = true;
+    block->updated().set(voxblox::Update::kMap);
+  }
+}
+
+inline Submap* createRandomSubmap(SubmapCollection* map, int class_id) {
+  Submap::Config submap_config;
+  submap_config.voxel_size = config.voxel_size;
+  submap_config.voxels_per_side = config.voxels_per_side;
+  Submap* submap = map->createSubmap(submap_config);
+  submap->setClassID(class_id);
+  randomizeTsdfBlocks(submap, config.num_blocks_per_layer);
+  submap->updateBoundingVolume();
+  return submap;
+}
+
+TEST(SubmapCollection, SerializeIndexedMap) {
+  SubmapCollection before;
+  for (int i = 0; i < 3; ++i) {
+    createRandomSubmap(&before, i);
+  }
+  TempFile tmp("serialization_test_map", ".panmap");
+  EXPECT_TRUE(tmp);
+  EXPECT_TRUE(before.saveToFile(tmp.path()));
+
+  // Load all submaps.
+  SubmapCollection after;
+  EXPECT_TRUE(after.loadFromFile(tmp.path(), false));
+  checkSubmapsEqual(before, after);
+
+  // Load a single submap via the index.
+  auto it = before.begin();
+  ++it;
+  const Submap& selected = *it;
+  SubmapCollection selected_after;
+  EXPECT_TRUE(selected_after.loadSubmapsFromFile(
+      tmp.path(), std::vector<int>{selected.getID()}, false));
+  EXPECT_EQ(selected_after.size(), 1u);
+  if (selected_after.size() == 1u) {
+    checkLayerEqual(selected.getTsdfLayer(),
+                    selected_after.begin()->getTsdfLayer());
+    EXPECT_EQ(selected.getClassID(), selected_after.begin()->getClassID());
+  }
+}
+
+TEST(MappedTsdfLayer, SerializeRawBlocks) {
+  SubmapCollection map;
+  const Submap* submap = createRandomSubmap(&map, 0);
+  const TsdfLayer& before = submap->getTsdfLayer();
+  TempFile tmp("serialization_test_raw");
+  EXPECT_TRUE(tmp);
+  EXPECT_TRUE(MappedTsdfLayer::saveToFile(before, tmp.path()));
+
+  // Access the voxels in the mapped file.
+  MappedTsdfLayer mapped;
+  EXPECT_TRUE(mapped.open(tmp.path()));
+  EXPECT_EQ(mapped.getNumberOfAllocatedBlocks(),
+            before.getNumberOfAllocatedBlocks());
+  EXPECT_EQ(mapped.voxels_per_side(), before.voxels_per_side());
+  EXPECT_EQ(mapped.voxel_size(), before.voxel_size());
+  voxblox::BlockIndexList indices;
+  before.getAllAllocatedBlocks(&indices);
+  for (const BlockIndex& index : indices) {
+    const TsdfVoxel* voxels = mapped.getBlockVoxels(index);
+    if (voxels == nullptr) {
+      FAIL() << "Block " << index.transpose() << " is not mapped.";
+      return;
+    }
+    const TsdfBlock& block = before.getBlockByIndex(index);
+    for (size_t i = 0; i < block.num_voxels(); ++i) {
+      if (!checkVoxelEqual(block.getVoxelByLinearIndex(i), voxels[i])) {
+        return;
+      }
+    }
+  }
+
+  // Copy the mapped blocks into a layer.
+  TsdfLayer after(before.voxel_size(), before.voxels_per_side());
+  EXPECT_TRUE(mapped.copyToLayer(&after));
+  checkLayerEqual(before, after);
+}
+
+TEST(MapCheckpointer, ReplayAndCompactCheckpoints) {
+  TempFile checkpoint_file("serialization_test_checkpoint");
+  TempFile map_file("serialization_test_compacted", ".panmap");
+  EXPECT_TRUE(checkpoint_file);
+  EXPECT_TRUE(map_file);
+  MapCheckpointer::Config checkpointer_config;
+  checkpointer_config.file_path = checkpoint_file.path();
+  MapCheckpointer checkpointer(checkpointer_config, false);
+
+  // Full checkpoint.
+  SubmapCollection map;
+  Submap* changed = createRandomSubmap(&map, 0);
+  const int removed_id = createRandomSubmap(&map, 1)->getID();
+  std::shared_ptr<const SubmapCollection> snapshot = map.snapshot(nullptr);
+  EXPECT_TRUE(checkpointer.writeCheckpoint(snapshot));
+
+  // Incremental checkpoint with changed, removed, and new submaps.
+  randomizeTsdfBlocks(changed, 2);
+  map.removeSubmap(removed_id);
+  createRandomSubmap(&map, 2);
+  snapshot = map.snapshot(snapshot.get());
+  EXPECT_TRUE(checkpointer.writeCheckpoint(snapshot));
+  checkpointer.wait();
+
+  // Replay the checkpoints.
+  SubmapCollection replayed;
+  EXPECT_TRUE(replayed.loadFromCheckpointFile(checkpoint_file.path(), false));
+  checkSubmapsEqual(map, replayed);
+
+  // Compact the checkpoints into a map file.
+  EXPECT_TRUE(
+      MapCheckpointer::compact(checkpoint_file.path(), map_file.path()));
+  SubmapCollection compacted;
+  EXPECT_TRUE(compacted.loadFromFile(map_file.path(), false));
+  checkSubmapsEqual(map, compacted);
+}
+
+// Set some blocks of a submap to a uniform value in front of the surface and
+// collapse them.
+inline void collapseUniformTsdfBlocks(Submap* submap,
+                                      const voxblox::BlockIndexList& indices,
+                                      float weight) {
+  for (const BlockIndex& index : indices) {
+    submap->expandCollapsedBlocks(voxblox::IndexSet{index});
+    TsdfBlock::Ptr block = submap->allocateBlocks(index).tsdf;
+    for (size_t j = 0; j < config.voxels_per_block; ++j) {
+      TsdfVoxel& voxel = block->getVoxelByLinearIndex(j);
+      voxel.distance = submap->getConfig().truncation_distance;
+      voxel.weight = weight;
+    }
+    block->has_data() = true;
+    block->updated().set(voxblox::Update::kMap);
+  }
+  // Blocks that changed since the last call are not collapsed.
+  submap->collapseUniformBlocks();
+  submap->collapseUniformBlocks();
+}
+
+// The TSDF layer of a submap with all collapsed blocks expanded.
+inline std::unique_ptr<TsdfLayer> expandedTsdfLayer(const Submap& submap) {
+  auto layer = std::make_unique<TsdfLayer>(submap.getTsdfLayer());
+  if (submap.getCollapsedBlocks()) {
+    for (const auto& index_voxel_pair :
+         submap.getCollapsedBlocks()->getBlocks()) {
+      CollapsedTsdfBlocks::expandBlock(index_voxel_pair.first,
+                                       index_voxel_pair.second, layer.get());
+    }
+  }
+  return layer;
+}
+
+TEST(MapCheckpointer, ReplayCollapsedBlocks) {
+  TempFile checkpoint_file("serialization_test_collapsed_checkpoint");
+  EXPECT_TRUE(checkpoint_file);
+  MapCheckpointer::Config checkpointer_config;
+  checkpointer_config.file_path = checkpoint_file.path();
+  MapCheckpointer checkpointer(checkpointer_config, false);
+  SubmapCollection map;
+  Submap::Config submap_config;
+  submap_config.voxel_size = config.voxel_size;
+  submap_config.voxels_per_side = config.voxels_per_side;
+  submap_config.block_collapsing.collapse_uniform_blocks = true;
+  Submap* submap = map.createSubmap(submap_config);
+  randomizeTsdfBlocks(submap, config.num_blocks_per_layer);
+  const voxblox::BlockIndexList collapsed_indices = {
+      BlockIndex(20, 0, 0), BlockIndex(21, 0, 0), BlockIndex(22, 0, 0)};
+
+  // Full checkpoint with collapsed blocks.
+  collapseUniformTsdfBlocks(submap, collapsed_indices, 1.f);
+  ASSERT_NE(submap->getCollapsedBlocks(), nullptr);
+  EXPECT_EQ(submap->getCollapsedBlocks()->size(), collapsed_indices.size());
+  std::shared_ptr<const SubmapCollection> snapshot = map.snapshot(nullptr);
+  EXPECT_TRUE(checkpointer.writeCheckpoint(snapshot));
+
+  // Incremental checkpoint where a collapsed block changed its value.
+  collapseUniformTsdfBlocks(submap, {collapsed_indices[1]}, 2.f);
+  EXPECT_EQ(submap->getCollapsedBlocks()->size(), collapsed_indices.size());
+  snapshot = map.snapshot(snapshot.get());
+  EXPECT_TRUE(checkpointer.writeCheckpoint(snapshot));
+
+  // Incremental checkpoint where another block was collapsed.
+  collapseUniformTsdfBlocks(submap, {BlockIndex(23, 0, 0)}, 1.f);
+  snapshot = map.snapshot(snapshot.get());
+  EXPECT_TRUE(checkpointer.writeCheckpoint(snapshot));
+  checkpointer.wait();
+
+  // The collapsed blocks are restored expanded.
+  SubmapCollection replayed;
+  EXPECT_TRUE(replayed.loadFromCheckpointFile(checkpoint_file.path(), false));
+  ASSERT_EQ(replayed.size(), 1u);
+  checkLayerEqual(*expandedTsdfLayer(*submap),
+                  replayed.begin()->getTsdfLayer());
+}
+
 }  // namespace test
 }  // namespace panoptic_mapping
 
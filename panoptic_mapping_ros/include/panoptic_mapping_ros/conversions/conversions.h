@@ -2,8 +2,10 @@
 #define PANOPTIC_MAPPING_ROS_CONVERSIONS_CONVERSIONS_H_
 
 #include <panoptic_mapping/common/input_data.h>
+#include <panoptic_mapping/map/change_feed.h>
 #include <panoptic_mapping_msgs/DetectronLabel.h>
 #include <panoptic_mapping_msgs/DetectronLabels.h>
+#include <panoptic_mapping_msgs/MapChanges.h>
 
 namespace panoptic_mapping {
 
@@ -13,6 +15,9 @@ DetectronLabel detectronLabelFromMsg(
 DetectronLabels detectronLabelsFromMsg(
     const panoptic_mapping_msgs::DetectronLabels& msg);
 
+// The header of the message is not set.
+panoptic_mapping_msgs::MapChanges mapChangesToMsg(const MapChangeSet& changes);
+
 }  // namespace panoptic_mapping
 
 #endif  // PANOPTIC_MAPPING_ROS_CONVERSIONS_CONVERSIONS_H_
@@ -1,6 +1,7 @@
 #ifndef PANOPTIC_MAPPING_ROS_INPUT_INPUT_SUBSCRIBER_H_
 #define PANOPTIC_MAPPING_ROS_INPUT_INPUT_SUBSCRIBER_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -9,8 +10,10 @@
 #include <utility>
 #include <vector>
 
+#include <image_transport/image_transport.h>
 #include <panoptic_mapping/common/input_data.h>
 #include <ros/ros.h>
+#include <ros/serialization.h>
 #include <sensor_msgs/Image.h>
 
 #include "panoptic_mapping_ros/input/input_synchronizer.h"
@@ -23,8 +26,11 @@ namespace panoptic_mapping {
 struct InputSynchronizerData {
   std::shared_ptr<InputData> data;
   bool valid = true;
-  bool ready = false;
+  bool complete = false;  // All inputs were received.
+  bool has_pose = false;  // The pose was looked up after completion.
+  bool ready = false;     // Complete and posed, can be retrieved.
   ros::Time timestamp;
+  std::atomic<size_t> num_bytes{0};  // Size of the received messages.
   std::mutex write_mutex_;  // Lock this mutex when writing to common data
                             // structures such as the input list
 };
@@ -52,6 +58,16 @@ inline const ros::Time& getTimeStampFromMsg(
   return msg->header.stamp;
 }
 
+// Approximate memory of a message once stored in the input data.
+template <typename MsgT>
+inline size_t getSizeOfMsg(const MsgT& msg) {
+  return ros::serialization::serializationLength(msg);
+}
+
+inline size_t getSizeOfMsg(const sensor_msgs::ImageConstPtr& msg) {
+  return msg->data.size();
+}
+
 /**
  * @brief Tool to manage the subscription and and extraction of each input
  * topic.
@@ -76,9 +92,7 @@ class InputSubscriber : public InputSubscriberBase {
                   std::function<void(const MsgT&, InputSynchronizerData*)>
                       extraction_function,
                   InputSynchronizerBase* parent)
-      : extraction_function_(std::move(extraction_function)),
-        nh_(nh),
-        parent_(parent) {
+      : InputSubscriber(nh, std::move(extraction_function), parent) {
     // Subscribe to the topic.
     subscriber_ = nh_.subscribe(topic_name, queue_size,
                                 &InputSubscriber<MsgT>::msgCallback, this);
@@ -90,11 +104,21 @@ class InputSubscriber : public InputSubscriberBase {
     InputSynchronizerData* data;
     if (parent_->getDataInQueue(stamp, &data)) {
       extraction_function_(msg, data);
+      data->num_bytes += getSizeOfMsg(msg);
       parent_->checkDataIsReady(data);
     }
   }
 
- private:
+ protected:
+  // Setup without subscribing, for derived subscribers.
+  InputSubscriber(const ros::NodeHandle& nh,
+                  std::function<void(const MsgT&, InputSynchronizerData*)>
+                      extraction_function,
+                  InputSynchronizerBase* parent)
+      : nh_(nh),
+        extraction_function_(std::move(extraction_function)),
+        parent_(parent) {}
+
   // ROS Subscriber.
   ros::NodeHandle nh_;
   ros::Subscriber subscriber_;
@@ -107,6 +131,35 @@ class InputSubscriber : public InputSubscriberBase {
   InputSynchronizerBase* const parent_;
 };
 
+/**
+ * @brief Image subscriber that receives the images via image_transport, such
+ * that compressed images can be used. Decoding is performed by the transport
+ * plugins in the subscriber callback, so different input types are decoded in
+ * parallel on the ROS spinner threads before they are synchronized.
+ */
+class ImageTransportSubscriber
+    : public InputSubscriber<sensor_msgs::ImageConstPtr> {
+ public:
+  ImageTransportSubscriber(
+      const ros::NodeHandle& nh, const std::string& topic_name, int queue_size,
+      const std::string& transport,
+      std::function<void(const sensor_msgs::ImageConstPtr&,
+                         InputSynchronizerData*)>
+          extraction_function,
+      InputSynchronizerBase* parent)
+      : InputSubscriber(nh, std::move(extraction_function), parent),
+        image_transport_(nh) {
+    image_subscriber_ = image_transport_.subscribe(
+        topic_name, queue_size,
+        [this](const sensor_msgs::ImageConstPtr& msg) { msgCallback(msg); },
+        ros::VoidPtr(), image_transport::TransportHints(transport));
+  }
+
+ private:
+  image_transport::ImageTransport image_transport_;
+  image_transport::Subscriber image_subscriber_;
+};
+
 }  // namespace panoptic_mapping
 
 #endif  // PANOPTIC_MAPPING_ROS_INPUT_INPUT_SUBSCRIBER_H_
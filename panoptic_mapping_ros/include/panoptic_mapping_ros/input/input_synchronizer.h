@@ -2,6 +2,7 @@
 #define PANOPTIC_MAPPING_ROS_INPUT_INPUT_SYNCHRONIZER_H_
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <limits>
 #include <memory>
@@ -15,9 +16,9 @@
 #include <panoptic_mapping/3rd_party/config_utilities.hpp>
 #include <panoptic_mapping/common/input_data.h>
 #include <ros/ros.h>
-#include <tf/transform_listener.h>
 
 #include "panoptic_mapping_ros/input/input_subscriber.h"
+#include "panoptic_mapping_ros/input/pose_source.h"
 
 namespace panoptic_mapping {
 
@@ -38,6 +39,49 @@ class InputSynchronizer : public InputSynchronizerBase {
         0.1f;  // s, Maximum time to wait for transforms.
     double max_delay = 0.0; // s, Maximum delay between Image messages that should be synced
 
+    // If true, read-only images whose encoding matches are not copied but
+    // reference the buffers of the received messages.
+    bool share_image_buffers = false;
+
+    // Image transports to receive the images with, e.g. 'raw', 'compressed'
+    // or 'compressedDepth'. Compressed images are decoded in parallel per
+    // input type on the ROS spinner threads. Segmentation images need to be
+    // compressed losslessly, e.g. as 16 bit png.
+    std::string depth_image_transport = "raw";
+    std::string color_image_transport = "raw";
+    std::string segmentation_image_transport = "raw";
+    std::string uncertainty_image_transport = "raw";
+
+    // If true, 'getInputData()' returns the most recent ready input and drops
+    // all older inputs. Otherwise inputs are returned in order of arrival.
+    bool process_latest_only = false;
+
+    // Which inputs to drop when the queue is full: 'oldest' drops the oldest
+    // input, 'newest' rejects newly arriving inputs, and 'incomplete' drops
+    // the oldest input that is still missing data before any ready input.
+    std::string drop_policy = "oldest";
+
+    // If > 0, the queue is also considered full once the received messages
+    // exceed this size in MB.
+    float max_queued_megabytes = 0.f;
+
+    // If > 0, 'input_backpressure' (std_msgs/Bool, latched) is set once this
+    // many ready inputs wait to be processed, and cleared once the backlog
+    // drops to half of it. Sensor drivers can use it to throttle.
+    int backpressure_ready_inputs = 0;
+
+    // Source of the sensor poses. 'tf' looks them up from tf. 'odometry'
+    // buffers and interpolates nav_msgs/Odometry in the global frame received
+    // on 'odometry_in', the static sensor extrinsics are taken from tf.
+    std::string pose_source = "tf";
+    float pose_buffer_duration = 10.f;  // s
+
+    // If true, pose lookups never wait. Inputs whose pose is not yet available
+    // when they are complete are deferred until it arrives, and dropped if it
+    // can no longer become available. Otherwise poses are looked up waiting
+    // up to 'transform_lookup_time'.
+    bool defer_missing_poses = false;
+
     Config() { setConfigName("InputSynchronizer"); }
 
    protected:
@@ -45,6 +89,18 @@ class InputSynchronizer : public InputSynchronizerBase {
     void checkParams() const override;
   };
 
+  /**
+   * @brief Current state of the input queue for monitoring.
+   */
+  struct QueueStatistics {
+    size_t num_queued = 0;  // Data points, including incomplete ones.
+    size_t num_ready = 0;
+    size_t num_bytes = 0;
+    uint64_t num_dropped = 0;
+    uint64_t num_late_messages = 0;
+    bool backpressure = false;
+  };
+
   InputSynchronizer(const Config& config, const ros::NodeHandle& nh);
   ~InputSynchronizer() override = default;
 
@@ -64,14 +120,50 @@ class InputSynchronizer : public InputSynchronizerBase {
   bool hasInputData() const { return data_is_ready_; }
 
   /**
-   * @brief Extract the most recent input data from the queue. The data will be
-   * deleted from the queue. This call is blocking.
+   * @brief Get the number of inputs that are ready to be retrieved, i.e. the
+   * backlog of the consumer.
+   */
+  size_t getNumberOfReadyInputs();
+
+  /**
+   * @brief Extract the oldest ready input data from the queue, or the most
+   * recent one if 'process_latest_only' is set. The data will be deleted from
+   * the queue. This call is blocking.
    *
    * @return std::shared_ptr<InputData> The data. Nullptr if none is ready or
    * data lookup failed.
    */
   std::shared_ptr<InputData> getInputData();
 
+  /**
+   * @brief Wait until input data is ready and extract it, see
+   * 'getInputData()'. Waiting threads are woken up as soon as the last
+   * required input of a data point is received.
+   *
+   * @param timeout Maximum time to wait in seconds.
+   * @return std::shared_ptr<InputData> The data. Nullptr if none got ready in
+   * time, data lookup failed, or the synchronizer was closed.
+   */
+  std::shared_ptr<InputData> waitForInputData(double timeout);
+
+  /**
+   * @brief Get the total number of inputs that were dropped, either because
+   * the queue was full or because only the latest input is processed.
+   */
+  uint64_t getNumberOfDroppedInputs() const { return num_dropped_inputs_; }
+
+  /**
+   * @brief Get the total number of messages that arrived after their input
+   * was already processed or dropped and were therefore discarded.
+   */
+  uint64_t getNumberOfLateMessages() const { return num_late_messages_; }
+
+  QueueStatistics getQueueStatistics();
+
+  // Wake up all threads waiting for input data and stop further waiting.
+  void close();
+  bool isClosed() const { return closed_; }
+
   // Setup.
   /**
    * @brief Setup tool. Adds inputs types to the list of required inputs. First
@@ -105,25 +197,41 @@ class InputSynchronizer : public InputSynchronizerBase {
         extraction_function, this));
   }
 
+  // Image queues received via image_transport if the transport isn't raw.
+  void addImageQueue(
+      InputData::InputType type, const std::string& transport,
+      std::function<void(const sensor_msgs::ImageConstPtr&,
+                         InputSynchronizerData*)>
+          extraction_function);
+
   /**
-   * @brief Try to lookup the specified transform from tf.
+   * @brief Look up the pose of the sensor from the pose source.
    *
    * @param timestamp Timestamp to lookup.
-   * @param base_frame Base frame to lookup.
-   * @param child_frame Child frame to lookup.
-   * @param transformation Output transform if it could be looked up.
-   * @return True if the transform could be looked up.
+   * @param timeout Maximum time to wait in seconds, 0 to not wait.
+   * @param T_M_C Output pose if it could be looked up.
    */
-  bool lookupTransform(const ros::Time& timestamp,
-                       const std::string& base_frame,
-                       const std::string& child_frame,
-                       Transformation* transformation) const;
+  PoseLookupResult lookupPose(const ros::Time& timestamp, double timeout,
+                              Transformation* T_M_C);
+
+  // Deferred pose lookup, require the data_mutex_ to be locked. Returns true
+  // if the pose of the data is available.
+  bool lookupDeferredPose(InputSynchronizerData* data);
+  void retryDeferredPoses();
+  void retryDeferredPosesLocked();
 
   bool getDataInQueue(const ros::Time& timestamp,
                       InputSynchronizerData** data) override;
 
   bool allocateDataInQueue(const ros::Time& timestamp);
 
+  // Queue management, require the data_mutex_ to be locked.
+  bool queueIsFull() const;
+  size_t getQueuedBytes() const;
+  void dropFromQueue(size_t index);
+  void updateReadyState();
+  void updateBackpressure();
+
   void checkDataIsReady(InputSynchronizerData* data) override;
 
  private:
@@ -131,9 +239,13 @@ class InputSynchronizer : public InputSynchronizerBase {
   friend class InputSubscriber;
   const Config config_;
 
+  enum class DropPolicy { kOldest, kNewest, kIncomplete };
+  DropPolicy drop_policy_ = DropPolicy::kOldest;
+
   // ROS.
   ros::NodeHandle nh_;
-  tf::TransformListener tf_listener_;
+  std::unique_ptr<PoseSourceBase> pose_source_;
+  ros::Publisher backpressure_pub_;
 
   // Inputs.
   InputData::InputTypes requested_inputs_;
@@ -149,6 +261,12 @@ class InputSynchronizer : public InputSynchronizerBase {
 
   // Variables.
   std::atomic<bool> data_is_ready_;
+  std::atomic<bool> closed_{false};
+  std::atomic<uint64_t> num_dropped_inputs_{0};
+  std::atomic<uint64_t> num_late_messages_{0};
+  bool backpressure_ = false;
+  ros::Time last_rejected_time_ = ros::Time(0);
+  std::condition_variable data_ready_cv_;
   ros::Time oldest_time_ = ros::Time(0);
   std::string used_sensor_frame_name_;
   std::mutex data_mutex_;
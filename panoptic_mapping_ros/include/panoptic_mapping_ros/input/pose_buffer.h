@@ -0,0 +1,62 @@
+#ifndef PANOPTIC_MAPPING_ROS_INPUT_POSE_BUFFER_H_
+#define PANOPTIC_MAPPING_ROS_INPUT_POSE_BUFFER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include <panoptic_mapping/common/common.h>
+
+namespace panoptic_mapping {
+
+// Outcome of looking up a pose at a timestamp.
+enum class PoseLookupResult {
+  kSuccess,  // The pose is available.
+  kPending,  // The pose is not yet available but may arrive later.
+  kFailed    // The pose is not and will not become available.
+};
+
+/**
+ * @brief Thread-safe buffer of timestamped poses that interpolates between
+ * them, linearly for the translation and spherically for the rotation.
+ * Poses older than the buffer duration relative to the newest pose are
+ * removed.
+ */
+class PoseBuffer {
+ public:
+  explicit PoseBuffer(double max_duration);
+  virtual ~PoseBuffer() = default;
+
+  // Add a pose, timestamps in seconds. Out of order poses are sorted in.
+  void addPose(double timestamp, const Transformation& pose);
+
+  /**
+   * @brief Get the interpolated pose at a timestamp.
+   *
+   * @param timestamp Query time in seconds.
+   * @param timeout Maximum time to wait for the pose to arrive in seconds, 0
+   * to return immediately.
+   * @param pose Output pose if successful.
+   * @return kPending if the timestamp is newer than all poses, kFailed if it
+   * is older than the buffer.
+   */
+  PoseLookupResult getPose(double timestamp, double timeout,
+                           Transformation* pose) const;
+
+  // Timestamp of the newest pose, 0 if empty.
+  double getNewestTimestamp() const;
+  size_t size() const;
+
+ private:
+  PoseLookupResult interpolate(double timestamp, Transformation* pose) const;
+
+  const double max_duration_;
+  std::deque<std::pair<double, Transformation>> poses_;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable pose_added_cv_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_ROS_INPUT_POSE_BUFFER_H_
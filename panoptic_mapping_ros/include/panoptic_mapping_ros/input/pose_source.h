@@ -0,0 +1,105 @@
+#ifndef PANOPTIC_MAPPING_ROS_INPUT_POSE_SOURCE_H_
+#define PANOPTIC_MAPPING_ROS_INPUT_POSE_SOURCE_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <nav_msgs/Odometry.h>
+#include <panoptic_mapping/common/common.h>
+#include <ros/ros.h>
+#include <tf/transform_listener.h>
+
+#include "panoptic_mapping_ros/input/pose_buffer.h"
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Interface to look up the pose of the sensor in the global frame.
+ */
+class PoseSourceBase {
+ public:
+  explicit PoseSourceBase(std::string global_frame_name)
+      : global_frame_name_(std::move(global_frame_name)) {}
+  virtual ~PoseSourceBase() = default;
+
+  /**
+   * @brief Look up the pose T_M_C of a sensor.
+   *
+   * @param timestamp Time of the pose.
+   * @param sensor_frame_name Frame of the sensor.
+   * @param timeout Maximum time to wait for the pose in seconds, 0 to return
+   * immediately.
+   * @param T_M_C Output pose if successful.
+   */
+  virtual PoseLookupResult lookup(const ros::Time& timestamp,
+                                  const std::string& sensor_frame_name,
+                                  double timeout, Transformation* T_M_C) = 0;
+
+  // Set a function that is called whenever new poses arrived, if the source
+  // receives poses itself.
+  void setPoseCallback(std::function<void()> callback) {
+    pose_callback_ = std::move(callback);
+  }
+
+ protected:
+  const std::string global_frame_name_;
+  std::function<void()> pose_callback_;
+};
+
+/**
+ * @brief Looks up the sensor pose from tf.
+ */
+class TfPoseSource : public PoseSourceBase {
+ public:
+  TfPoseSource(std::string global_frame_name, int verbosity);
+  ~TfPoseSource() override = default;
+
+  PoseLookupResult lookup(const ros::Time& timestamp,
+                          const std::string& sensor_frame_name,
+                          double timeout, Transformation* T_M_C) override;
+
+ private:
+  const int verbosity_;
+  tf::TransformListener tf_listener_;
+};
+
+/**
+ * @brief Buffers nav_msgs/Odometry messages in the global frame and
+ * interpolates the body pose at the query time. The static transform from the
+ * odometry body frame to the sensor frame is looked up once from tf.
+ */
+class OdometryPoseSource : public PoseSourceBase {
+ public:
+  OdometryPoseSource(std::string global_frame_name, const ros::NodeHandle& nh,
+                     const std::string& topic, double buffer_duration,
+                     int verbosity);
+  ~OdometryPoseSource() override = default;
+
+  PoseLookupResult lookup(const ros::Time& timestamp,
+                          const std::string& sensor_frame_name,
+                          double timeout, Transformation* T_M_C) override;
+
+ private:
+  void odometryCallback(const nav_msgs::Odometry::ConstPtr& msg);
+  bool lookupExtrinsics(const std::string& sensor_frame_name,
+                        Transformation* T_B_C);
+
+  const int verbosity_;
+  ros::NodeHandle nh_;
+  ros::Subscriber odometry_sub_;
+  PoseBuffer buffer_;
+  tf::TransformListener tf_listener_;
+
+  // Body frame of the odometry and cached extrinsics by sensor frame.
+  std::mutex mutex_;
+  std::string body_frame_name_;
+  std::unordered_map<std::string, Transformation> T_B_C_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_ROS_INPUT_POSE_SOURCE_H_
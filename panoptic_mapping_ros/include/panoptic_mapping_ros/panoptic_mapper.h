@@ -1,30 +1,55 @@
 #ifndef PANOPTIC_MAPPING_ROS_PANOPTIC_MAPPER_H_
 #define PANOPTIC_MAPPING_ROS_PANOPTIC_MAPPER_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <deque>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <panoptic_mapping/3rd_party/config_utilities.hpp>
+#include <panoptic_mapping/common/bounded_queue.h>
 #include <panoptic_mapping/common/common.h>
 #include <panoptic_mapping/common/globals.h>
+#include <panoptic_mapping/common/image_buffer_pool.h>
 #include <panoptic_mapping/integration/tsdf_integrator_base.h>
+#include <panoptic_mapping/map/background_mesher.h>
+#include <panoptic_mapping/map/change_feed.h>
 #include <panoptic_mapping/map/submap.h>
 #include <panoptic_mapping/map/submap_collection.h>
 #include <panoptic_mapping/map_management/map_manager_base.h>
 #include <panoptic_mapping/tools/data_writer_base.h>
+#include <panoptic_mapping/tools/esdf_map.h>
+#include <panoptic_mapping/tools/frame_log_writer.h>
+#include <panoptic_mapping/tools/keyframe_selector.h>
+#include <panoptic_mapping/tools/map_checkpointer.h>
 #include <panoptic_mapping/tools/planning_interface.h>
+#include <panoptic_mapping/tools/quality_controller.h>
+#include <panoptic_mapping/tools/region_sharding.h>
+#include <panoptic_mapping/tools/shared_map_exporter.h>
+#include <panoptic_mapping/tools/submap_stream_receiver.h>
+#include <panoptic_mapping/tools/submap_streamer.h>
 #include <panoptic_mapping/tools/thread_safe_submap_collection.h>
+#include <panoptic_mapping/tools/voxel_state_map.h>
 #include <panoptic_mapping/tracking/id_tracker_base.h>
+#include <panoptic_mapping_msgs/GetLoadMapStatus.h>
+#include <panoptic_mapping_msgs/QueryMap.h>
 #include <panoptic_mapping_msgs/SaveLoadMap.h>
 #include <panoptic_mapping_msgs/SetVisualizationMode.h>
+#include <panoptic_mapping_msgs/SubmapStream.h>
 #include <ros/ros.h>
 #include <std_srvs/Empty.h>
 
 #include "panoptic_mapping_ros/input/input_synchronizer.h"
+#include "panoptic_mapping_ros/tools/metrics_exporter.h"
 #include "panoptic_mapping_ros/visualization/planning_visualizer.h"
 #include "panoptic_mapping_ros/visualization/submap_visualizer.h"
 #include "panoptic_mapping_ros/visualization/tracking_visualizer.h"
@@ -45,16 +70,98 @@ class PanopticMapper {
     float visualization_interval = -1.f;
     float data_logging_interval = 0.f;
     float print_timing_interval = 0.f;
+    float print_memory_usage_interval = 0.f;
+    float checkpoint_interval = 0.f;
+    float submap_stream_interval = 0.f;
+
+    // Interval in seconds in which runtime metrics are exported as
+    // diagnostics and, if configured, on a Prometheus endpoint. See
+    // 'metrics/...' for the exporter settings, 0 to disable.
+    float metrics_interval = 0.f;
+
+    // Interval in seconds in which snapshots of the map are exported to shared
+    // memory for other processes on the same machine, see
+    // 'shared_map_exporter/...' for the segment settings, 0 to disable.
+    float shared_map_export_interval = 0.f;
+
+    // Name of this mapper in its submap stream. Defaults to the node name. If
+    // 'region_sharding/num_shards' > 1, the submaps of shard k are streamed on
+    // 'submap_stream/shard_<k>' instead of 'submap_stream'.
+    std::string submap_stream_source = "";
+
+    // If true, ingest the submap streams of other mappers received on the
+    // 'submap_stream_in' topic into the map, e.g. on a central server.
+    bool ingest_submap_streams = false;
+
+    // If true, publish the blocks and submaps that changed in every frame on
+    // the 'map_changes' topic.
+    bool publish_map_changes = false;
 
     // If true maintain and update the threadsafe submap collection for access.
     bool use_threadsafe_submap_collection = false;
 
+    // If true maintain an ESDF of the free space submap after every frame,
+    // which can be queried through the planning interface.
+    bool use_esdf = false;
+
+    // If true, materialize the voxel states of the whole map for constant time
+    // state lookups of the planning interface.
+    bool use_voxel_state_map = false;
+
+    // If true decide per frame whether to track and integrate it, based on
+    // the camera motion, segmentation change, and processing backlog. Frames
+    // that are not keyframes are only tracked or skipped.
+    bool use_keyframe_selection = false;
+
+    // If true record all synchronized inputs to a frame log, which can be
+    // replayed with the 'offline_replay' app. See 'frame_log/...' for the
+    // file settings.
+    bool record_frame_log = false;
+
     // Number of threads used for ROS spinning.
     int ros_spinner_threads = std::thread::hardware_concurrency();
 
-    // Frequency in seconds in which the input queue is queried.
+    // Number of worker threads of the thread pool shared by all modules.
+    int thread_pool_threads = std::thread::hardware_concurrency();
+
+    // CPU cores to pin the thread pool workers to, one core per worker in
+    // round robin. Keep them disjoint from the cores of the camera drivers
+    // and ROS spinners to reduce jitter. Empty to not pin the workers.
+    std::vector<int> thread_pool_cores;
+
+    // Real-time (SCHED_FIFO) priority in [1, 99] of the thread pool workers,
+    // 0 for default scheduling. Usually requires CAP_SYS_NICE.
+    int thread_pool_priority = 0;
+
+    // If true, the thread pool workers are assigned to the NUMA nodes of the
+    // machine and submaps are distributed over the nodes, such that the
+    // blocks of each submap are allocated and processed on one node.
+    bool thread_pool_numa_aware = false;
+
+    // CPU cores the preprocessing, mapping, input and visualization stage
+    // threads may run on. Empty to not pin the respective thread.
+    std::vector<int> preprocessing_stage_cores;
+    std::vector<int> mapping_stage_cores;
+    std::vector<int> input_stage_cores;
+    std::vector<int> visualization_stage_cores;
+
+    // Real-time priority of the pipeline stage threads, see
+    // 'thread_pool_priority'.
+    int pipeline_stage_priority = 0;
+
+    // Maximum number of removed TSDF blocks kept for reuse.
+    int max_pooled_blocks = 1024;
+
+    // Frequency in seconds in which the input queue is queried. In
+    // event-driven mode this is the interval in which idle input processing
+    // checks for shutdown.
     float check_input_interval = 0.01f;
 
+    // If true, inputs are processed on a dedicated thread as soon as all of
+    // their data is received, instead of polling the input queue every
+    // 'check_input_interval'.
+    bool use_event_driven_input = false;
+
     // If true loaded submaps change states are set to unknown, otherwise to
     // persistent.
     bool load_submaps_conservative = true;
@@ -62,6 +169,11 @@ class PanopticMapper {
     // If true, keeps the active freespace ID as set in the loaded map
     bool loaded_freespace_stays_active = false;
 
+    // If true, the 'load_map' service returns immediately with an ID to poll
+    // the status of the load. The map is loaded and prepared on a worker
+    // thread and replaces the current map between two frames.
+    bool load_map_asynchronously = false;
+
     // If true, finish mapping and shutdown the panoptic mapper when no frames
     // are received for 3 seconds after the first frame was received.
     bool shutdown_when_finished = false;
@@ -70,12 +182,62 @@ class PanopticMapper {
     // shutting down when finished.
     std::string save_map_path_when_finished = "";
 
+    // If true, visualize the entire map after finishing mapping. This can take
+    // long for large maps.
+    bool visualize_when_finished = true;
+
+    // If true, also store the meshes, iso-surface points, and bounding volumes
+    // in saved maps, such that loading the map does not recompute them.
+    bool save_derived_data = false;
+
     // If true, display units when printing the component configs.
     bool display_config_units = true;
 
     // If true, indicate the default values when printing component configs.
     bool indicate_default_values = true;
 
+    // If true, input preprocessing (vertex map, validity image) runs in a
+    // separate thread from the mapping stages (tracking, integration, map
+    // management), such that consecutive frames overlap. The mapping stages
+    // are executed in frame order and hand over the submap collection
+    // explicitly, so the resulting map is identical to sequential processing.
+    // The ESDF and voxel states of a frame are computed from a snapshot of the
+    // map in a third thread while the next frame is tracked and integrated.
+    // Tracking and map management themselves are not overlapped since both
+    // modify the submap collection.
+    bool use_pipelined_processing = false;
+
+    // Maximum number of frames buffered between two pipeline stages. Producers
+    // block when the queue is full.
+    int pipeline_queue_length = 2;
+
+    // If > 0, record up to this many timed spans with their thread and frame
+    // for tracing, dropping the oldest ones. They are written in the Chrome
+    // trace format to 'trace_file_path' on shutdown or when calling the
+    // 'save_trace' service.
+    int max_trace_spans = 0;
+    std::string trace_file_path = "";
+
+    // If true, sample hardware performance counters (cycles, instructions,
+    // cache and branch misses) for all timers. They are included in the timing
+    // printout. Requires Linux perf events to be permitted.
+    bool use_performance_counters = false;
+
+    // If true, adapt the tracking resolution and map management frequency to
+    // meet the frame deadline of the quality controller.
+    bool use_quality_control = false;
+
+    // If true, the active submaps are meshed on a background thread while the
+    // next frame is integrated. The meshes are updated once per frame before
+    // map management.
+    bool use_background_meshing = false;
+
+    // If true, the submap, planning, and tracking visualizations are
+    // published by a dedicated thread from snapshots of the map, such that
+    // visualizing does not delay the mapping. Requires
+    // 'use_background_meshing' since the snapshots are not meshed.
+    bool use_visualization_thread = false;
+
     Config() { setConfigName("PanopticMapper"); }
 
    protected:
@@ -85,14 +247,24 @@ class PanopticMapper {
 
   // Construction.
   PanopticMapper(const ros::NodeHandle& nh, const ros::NodeHandle& nh_private);
-  virtual ~PanopticMapper() = default;
+  virtual ~PanopticMapper();
 
   // ROS callbacks.
   // Timers.
   void publishVisualizationCallback(const ros::TimerEvent&);
   void dataLoggingCallback(const ros::TimerEvent&);
   void printTimingsCallback(const ros::TimerEvent&);
+  void printMemoryUsageCallback(const ros::TimerEvent&);
+  void checkpointCallback(const ros::TimerEvent&);
+  void streamSubmapsCallback(const ros::TimerEvent&);
+  void metricsCallback(const ros::TimerEvent&);
+  void sharedMapExportCallback(const ros::TimerEvent&);
   void inputCallback(const ros::TimerEvent&);
+  void handleInput(std::shared_ptr<InputData> data);
+
+  // Subscribers.
+  void submapStreamCallback(
+      const panoptic_mapping_msgs::SubmapStream::ConstPtr& msg);
 
   // Services.
   bool saveMapCallback(
@@ -101,20 +273,40 @@ class PanopticMapper {
   bool loadMapCallback(
       panoptic_mapping_msgs::SaveLoadMap::Request& request,     // NOLINT
       panoptic_mapping_msgs::SaveLoadMap::Response& response);  // NOLINT
+  bool getLoadMapStatusCallback(
+      panoptic_mapping_msgs::GetLoadMapStatus::Request& request,     // NOLINT
+      panoptic_mapping_msgs::GetLoadMapStatus::Response& response);  // NOLINT
+  bool queryMapCallback(
+      panoptic_mapping_msgs::QueryMap::Request& request,     // NOLINT
+      panoptic_mapping_msgs::QueryMap::Response& response);  // NOLINT
   bool setVisualizationModeCallback(
       panoptic_mapping_msgs::SetVisualizationMode::Request& request,  // NOLINT
       panoptic_mapping_msgs::SetVisualizationMode::Response&          // NOLINT
           response);
   bool printTimingsCallback(std_srvs::Empty::Request& request,      // NOLINT
                             std_srvs::Empty::Response& response);   // NOLINT
+  bool printMemoryUsageCallback(
+      std_srvs::Empty::Request& request,     // NOLINT
+      std_srvs::Empty::Response& response);  // NOLINT
   bool finishMappingCallback(std_srvs::Empty::Request& request,     // NOLINT
                              std_srvs::Empty::Response& response);  // NOLINT
+  bool saveTraceCallback(std_srvs::Empty::Request& request,     // NOLINT
+                         std_srvs::Empty::Response& response);  // NOLINT
 
   // Processing.
   // Integrate a set of input images. The input is usually gathered from ROS
   // topics and provided by the InputSynchronizer.
   void processInput(InputData* input);
 
+  // The stages of 'processInput()'. Preprocessing only modifies the input and
+  // can run concurrently to mapping, which acquires the submap collection.
+  void preprocessInput(InputData* input);
+  void computeDerivedImages(InputData* input, const Camera& camera);
+  void mapInput(InputData* input);
+
+  // Number of frames that are waiting to be mapped.
+  size_t getProcessingBacklog();
+
   // Performs various post-processing actions.
   // NOTE(schmluk): This is currently a preliminary tool to play around with.
   void finishMapping();
@@ -123,11 +315,27 @@ class PanopticMapper {
   bool saveMap(const std::string& file_path);
   bool loadMap(const std::string& file_path);
 
+  // Start loading a map on a worker thread. Returns the ID of the load or 0 if
+  // another load is still running.
+  uint32_t loadMapAsync(const std::string& file_path);
+
   // Utilities.
   // Print all timings (from voxblox::timing) to console.
   void printTimings() const;
 
+  // Write all traced spans to the trace file.
+  bool saveTrace() const;
+
+  // Print the memory used by the map per panoptic label and layer type.
+  void printMemoryUsage();
+
+  // Take a copy-on-write snapshot of the current map for read-only access
+  // from other threads. All snapshots are taken through the thread-safe
+  // submap collection since changes are tracked relative to the last one.
+  std::shared_ptr<const SubmapCollection> takeSnapshot();
+
   // Update the meshes and publish the all visualizations of the current map.
+  // If the visualization thread is used this only requests a visualization.
   void publishVisualization();
 
   // Access.
@@ -135,10 +343,14 @@ class PanopticMapper {
   const ThreadSafeSubmapCollection& getThreadSafeSubmapCollection() const {
     return *thread_safe_submaps_;
   }
-  const PlanningInterface& getPlanningInterface() const {
-    return *planning_interface_;
-  }
+  // Run a query on the planning interface of the current map. The map and the
+  // planning maps, which the planning stage updates if pipelined, are locked
+  // while the query runs, so queries should be short.
+  void queryPlanningInterface(
+      const std::function<void(const PlanningInterface&)>& query);
   MapManagerBase* getMapManagerPtr() { return map_manager_.get(); }
+  // Subscribe to the changes of the map, emitted once per frame.
+  ChangeFeed* getChangeFeed() { return change_feed_.get(); }
   const Config& getConfig() const { return config_; }
 
  private:
@@ -146,6 +358,28 @@ class PanopticMapper {
   void setupMembers();
   void setupCollectionDependentMembers();
   void setupRos();
+  void setupPipeline();
+
+  // Map loading. Preparing the map does not access the current map, setting
+  // it replaces the current map and needs to happen between frames.
+  std::shared_ptr<SubmapCollection> prepareLoadedMap(
+      const std::string& file_path) const;
+  void setLoadedMap(std::shared_ptr<SubmapCollection> loaded_map);
+  void applyAsyncLoadedMap();
+
+  // Pipeline.
+  void inputStage();
+  void preprocessingStage();
+  void mappingStage();
+  void planningStage();
+  void stopPipeline();
+  void stopInputProcessing();
+
+  // Visualization thread. Requests are coalesced, such that the thread always
+  // visualizes the latest state of the map.
+  void visualizationStage();
+  void requestVisualization(bool visualize_map);
+  void visualizeSnapshot();
 
  private:
   // Node handles.
@@ -154,14 +388,26 @@ class PanopticMapper {
 
   // Subscribers, Publishers, Services, Timers.
   ros::ServiceServer load_map_srv_;
+  ros::ServiceServer get_load_map_status_srv_;
   ros::ServiceServer save_map_srv_;
   ros::ServiceServer set_visualization_mode_srv_;
   ros::ServiceServer set_color_mode_srv_;
   ros::ServiceServer print_timings_srv_;
+  ros::ServiceServer print_memory_usage_srv_;
   ros::ServiceServer finish_mapping_srv_;
+  ros::ServiceServer save_trace_srv_;
+  ros::ServiceServer query_map_srv_;
+  std::vector<ros::Publisher> submap_stream_pubs_;  // Per streamer.
+  ros::Publisher map_changes_pub_;
+  ros::Subscriber submap_stream_sub_;
   ros::Timer visualization_timer_;
   ros::Timer data_logging_timer_;
   ros::Timer print_timing_timer_;
+  ros::Timer print_memory_usage_timer_;
+  ros::Timer checkpoint_timer_;
+  ros::Timer submap_stream_timer_;
+  ros::Timer metrics_timer_;
+  ros::Timer shared_map_export_timer_;
   ros::Timer input_timer_;
 
   // Members.
@@ -171,29 +417,110 @@ class PanopticMapper {
   std::shared_ptr<SubmapCollection> submaps_;
   std::shared_ptr<ThreadSafeSubmapCollection> thread_safe_submaps_;
 
+  // Guards all access to 'submaps_' that can happen concurrently to the
+  // mapping stage, i.e. from other ROS callbacks or pipeline threads.
+  std::mutex submaps_mutex_;
+
   // Mapping.
   std::unique_ptr<IDTrackerBase> id_tracker_;
   std::unique_ptr<TsdfIntegratorBase> tsdf_integrator_;
   std::unique_ptr<MapManagerBase> map_manager_;
+  std::unique_ptr<KeyframeSelector> keyframe_selector_;
 
   // Tools.
   std::shared_ptr<Globals> globals_;
+  std::shared_ptr<QualityController> quality_controller_;
+  std::shared_ptr<ChangeFeed> change_feed_;
+  std::unique_ptr<BackgroundMesher> background_mesher_;
   std::unique_ptr<InputSynchronizer> input_synchronizer_;
   std::unique_ptr<DataWriterBase> data_logger_;
+  std::unique_ptr<MapCheckpointer> checkpointer_;
+  std::unique_ptr<MetricsExporter> metrics_exporter_;
+  std::unique_ptr<SharedMapExporter> shared_map_exporter_;
+  std::unique_ptr<FrameLogWriter> frame_log_writer_;
+  // One streamer per shard if the map is streamed to region-sharded servers.
+  std::vector<std::unique_ptr<SubmapStreamer>> submap_streamers_;
+  std::unique_ptr<RegionSharding> region_sharding_;
+  std::string submap_stream_source_;
+  // Receivers of the ingested submap streams by source, guarded by
+  // 'submaps_mutex_'.
+  std::unordered_map<std::string, std::unique_ptr<SubmapStreamReceiver>>
+      submap_stream_receivers_;
   std::shared_ptr<PlanningInterface> planning_interface_;
+  std::shared_ptr<EsdfMap> esdf_map_;
+  std::shared_ptr<VoxelStateMap> voxel_state_map_;
+  int voxel_state_subscription_ = -1;
 
   // Visualization.
   std::unique_ptr<SubmapVisualizer> submap_visualizer_;
   std::unique_ptr<PlanningVisualizer> planning_visualizer_;
   std::unique_ptr<TrackingVisualizer> tracking_visualizer_;
 
+  // Guards the submap and planning visualizer if they are used by the
+  // visualization thread. Acquire 'submaps_mutex_' first if both are needed.
+  std::mutex visualizer_mutex_;
+  std::thread visualization_thread_;
+  std::mutex visualization_request_mutex_;
+  std::condition_variable visualization_request_cv_;
+  bool visualization_requested_ = false;
+  bool map_visualization_requested_ = false;
+  bool stop_visualization_ = false;
+
+  // State of the map for the next visualized snapshot, guarded by
+  // 'submaps_mutex_'. The number of loaded maps is also guarded by
+  // 'visualizer_mutex_' to detect snapshots of replaced maps.
+  MapChangeSet visualization_changes_;
+  Point view_position_M_ = Point::Zero();
+  bool has_view_position_ = false;
+  int num_loaded_maps_ = 0;
+
   // Which processing to perform.
   bool compute_vertex_map_ = false;
   bool compute_validity_image_ = false;
+  bool compute_range_image_ = false;
+  ImageBufferPool image_buffer_pool_;
+
+  // Pipelined processing.
+  std::unique_ptr<BoundedQueue<std::shared_ptr<InputData>>>
+      preprocessing_queue_;
+  std::unique_ptr<BoundedQueue<std::shared_ptr<InputData>>> mapping_queue_;
+  std::thread input_thread_;
+  std::thread preprocessing_thread_;
+  std::thread mapping_thread_;
+
+  // Update of the planning maps from the snapshot after a mapped frame.
+  struct PlanningUpdate {
+    std::shared_ptr<const SubmapCollection> snapshot;
+    std::shared_ptr<EsdfMap> esdf_map;  // Only set if the ESDF is updated.
+    voxblox::IndexSet esdf_blocks;
+    std::shared_ptr<VoxelStateMap> voxel_state_map;
+    MapChangeSet changes;
+  };
+  // Take the update of the current frame, requires 'submaps_mutex_'.
+  std::shared_ptr<PlanningUpdate> takePlanningUpdate(bool update_esdf);
+  std::unique_ptr<BoundedQueue<std::shared_ptr<PlanningUpdate>>>
+      planning_queue_;
+  std::thread planning_thread_;
+  // Changes for the next planning update, guarded by 'submaps_mutex_'.
+  MapChangeSet planning_changes_;
+  // Guards the planning maps while they are updated by the planning stage.
+  // Acquire 'submaps_mutex_' first if both are needed.
+  std::mutex planning_mutex_;
+
+  // Asynchronous map loading, guarded by 'load_mutex_'.
+  enum class LoadStatus { kLoading, kSucceeded, kFailed };
+  std::mutex load_mutex_;
+  std::future<std::shared_ptr<SubmapCollection>> loading_map_;
+  uint32_t current_load_id_ = 0;
+  std::unordered_map<uint32_t, LoadStatus> load_statuses_;
 
   // Tracking variables.
   ros::WallTime previous_frame_time_ = ros::WallTime::now();
   std::unique_ptr<Timer> frame_timer_;
+  int64_t num_preprocessed_frames_ = 0;
+  int64_t num_mapped_frames_ = 0;
+  std::atomic<int64_t> num_skipped_frames_{0};
+  uint64_t num_reported_dropped_inputs_ = 0;
   ros::Time last_input_;
   bool got_a_frame_ = false;
 
@@ -0,0 +1,123 @@
+#ifndef PANOPTIC_MAPPING_ROS_TOOLS_METRICS_EXPORTER_H_
+#define PANOPTIC_MAPPING_ROS_TOOLS_METRICS_EXPORTER_H_
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <panoptic_mapping/3rd_party/config_utilities.hpp>
+#include <panoptic_mapping/common/common.h>
+#include <ros/ros.h>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Collects runtime metrics of the mapper and exports them as
+ * diagnostic_msgs on '/diagnostics' and optionally in the Prometheus text
+ * format over HTTP. Latencies and frames can be recorded from any thread,
+ * gauges and counters are usually updated right before publishing.
+ */
+class MetricsExporter {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // If true, publish the metrics as diagnostic_msgs/DiagnosticArray.
+    bool publish_diagnostics = true;
+
+    // Name and hardware id of the published diagnostic status.
+    std::string diagnostics_name = "panoptic_mapper";
+    std::string hardware_id = "";
+
+    // Port of the Prometheus HTTP endpoint, 0 to disable it.
+    int prometheus_port = 0;
+
+    // Number of most recent latencies per stage used for the percentiles.
+    int latency_window = 500;
+
+    // Time window over which the frame rate is computed in seconds.
+    float frame_rate_window = 5.f;
+
+    Config() { setConfigName("MetricsExporter"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  MetricsExporter(const Config& config, const ros::NodeHandle& nh);
+  virtual ~MetricsExporter();
+
+  // Recording. Thread-safe.
+  void recordFrame();
+  void recordLatency(const std::string& stage, double seconds);
+
+  /**
+   * @brief Set the current value of a metric. Counters are expected to only
+   * increase, gauges can take any value. Thread-safe.
+   *
+   * @param name Metric name, in Prometheus snake case without prefix.
+   * @param value Current value.
+   * @param labels Optional labels, e.g. 'state="active"'.
+   */
+  void setGauge(const std::string& name, double value,
+                const std::string& labels = "");
+  void setCounter(const std::string& name, double value,
+                  const std::string& labels = "");
+
+  /**
+   * @brief Publish the diagnostics and update the Prometheus endpoint.
+   *
+   * @param warning If not empty, the diagnostic status is published as a
+   * warning with this message.
+   */
+  void publish(const std::string& warning = "");
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  struct Value {
+    double value = 0.0;
+    bool is_counter = false;
+  };
+  struct LatencyWindow {
+    std::vector<double> samples;  // Ring buffer.
+    size_t next = 0;
+    uint64_t count = 0;
+    double sum = 0.0;
+  };
+
+  void setValue(const std::string& name, const std::string& labels,
+                double value, bool is_counter);
+  double computeFrameRate(double now) const;
+  std::string toPrometheus(double frame_rate) const;
+  void serveHttp();
+
+  static constexpr const char* kPrefix = "panoptic_mapping_";
+  static const std::vector<double> kQuantiles;
+
+  const Config config_;
+  ros::NodeHandle nh_;
+  ros::Publisher diagnostics_pub_;
+
+  // Metrics, guarded by the mutex.
+  mutable std::mutex mutex_;
+  std::deque<double> frame_times_;  // Wall time in s.
+  std::map<std::string, LatencyWindow> latencies_;
+  std::map<std::pair<std::string, std::string>, Value> values_;
+  uint64_t num_frames_ = 0;
+
+  // Prometheus endpoint.
+  std::thread http_thread_;
+  std::atomic<bool> stop_http_{false};
+  int server_socket_ = -1;
+  std::string prometheus_text_;  // Guarded by the mutex.
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_ROS_TOOLS_METRICS_EXPORTER_H_
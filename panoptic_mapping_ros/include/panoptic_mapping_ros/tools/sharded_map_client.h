@@ -0,0 +1,77 @@
+#ifndef PANOPTIC_MAPPING_ROS_TOOLS_SHARDED_MAP_CLIENT_H_
+#define PANOPTIC_MAPPING_ROS_TOOLS_SHARDED_MAP_CLIENT_H_
+
+#include <string>
+#include <vector>
+
+#include <panoptic_mapping/3rd_party/config_utilities.hpp>
+#include <panoptic_mapping/common/common.h>
+#include <panoptic_mapping/tools/planning_interface.h>
+#include <panoptic_mapping/tools/region_sharding.h>
+#include <panoptic_mapping_msgs/QueryMap.h>
+#include <ros/ros.h>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Client for a map that is distributed over region-sharded map servers.
+ * Each server is a panoptic mapper that ingests the submap stream of its
+ * shard and answers batched lookups via its 'query_map' service. Batches are
+ * split by shard, sent to all servers concurrently, and merged in the order of
+ * the positions.
+ */
+class ShardedMapClient {
+ public:
+  struct Config : public config_utilities::Config<Config> {
+    int verbosity = 2;
+
+    // The service of shard k is '<shard_namespace_prefix><k>/query_map'.
+    std::string shard_namespace_prefix = "shard_";
+
+    // Time to wait for the services to become available on setup in
+    // seconds, 0 to not wait.
+    float wait_for_services = 0.f;
+
+    // Must match the sharding of the streamed submaps.
+    RegionSharding::Config sharding;
+
+    Config() { setConfigName("ShardedMapClient"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
+  ShardedMapClient(const Config& config, const ros::NodeHandle& nh);
+  virtual ~ShardedMapClient() = default;
+
+  // Batched lookups, see 'PlanningInterface'. Return false if any of the
+  // involved shards could not be queried.
+  bool isObserved(const Pointcloud& positions, std::vector<uint8_t>* observed,
+                  bool include_inactive_maps = true);
+  bool getVoxelStates(const Pointcloud& positions,
+                      std::vector<PlanningInterface::VoxelState>* states);
+  bool getDistances(const Pointcloud& positions, std::vector<float>* distances,
+                    std::vector<uint8_t>* observed,
+                    bool consider_change_state = true,
+                    bool include_free_space = true);
+
+  const Config& getConfig() const { return config_; }
+
+ private:
+  // Split the query by shard, call all shards, and store the responses per
+  // shard together with the indices of their positions.
+  bool query(const Pointcloud& positions,
+             const panoptic_mapping_msgs::QueryMap::Request& request,
+             std::vector<std::vector<size_t>>* indices,
+             std::vector<panoptic_mapping_msgs::QueryMap::Response>* responses);
+
+  const Config config_;
+  const RegionSharding sharding_;
+  ros::NodeHandle nh_;
+  std::vector<ros::ServiceClient> clients_;  // Per shard.
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_ROS_TOOLS_SHARDED_MAP_CLIENT_H_
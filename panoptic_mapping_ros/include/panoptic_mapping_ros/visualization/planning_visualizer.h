@@ -3,12 +3,17 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <panoptic_mapping/common/common.h>
+#include <panoptic_mapping/map/change_feed.h>
 #include <panoptic_mapping/map/submap_collection.h>
 #include <panoptic_mapping/tools/planning_interface.h>
 #include <ros/node_handle.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <voxblox/core/block_hash.h>
 
 namespace panoptic_mapping {
 
@@ -20,6 +25,11 @@ class PlanningVisualizer {
     bool visualize_planning_slice = true;
     float slice_resolution = 0.1;  // m
     float slice_height = 1.0;      // m
+
+    // If true, the slice is cached in tiles and only tiles overlapping changed
+    // blocks or submaps are recomputed. Requires the submap collection to be
+    // passed to the visualization calls.
+    bool only_update_changed_regions = false;
     std::string ros_namespace;
 
     Config() { setConfigName("PlanningVisualizer"); }
@@ -36,17 +46,26 @@ class PlanningVisualizer {
       std::shared_ptr<const PlanningInterface> planning_interface);
   virtual ~PlanningVisualizer() = default;
 
-  // Visualization message creation.
-  visualization_msgs::Marker generateSliceMsg();
+  // Visualization message creation. If given, the submaps of the planning
+  // interface are used to track the changed regions.
+  visualization_msgs::Marker generateSliceMsg(
+      SubmapCollection* submaps = nullptr);
 
   // Publish visualization requests.
-  void visualizeAll();
-  void visualizePlanningSlice();
+  void visualizeAll(SubmapCollection* submaps = nullptr);
+  void visualizePlanningSlice(SubmapCollection* submaps = nullptr);
 
   // Interaction.
   void setGlobalFrameName(const std::string& frame_name) {
     global_frame_name_ = frame_name;
   }
+  // Visualize another interface of the same map, e.g. of a newer snapshot.
+  void setPlanningInterface(
+      std::shared_ptr<const PlanningInterface> planning_interface) {
+    planning_interface_ = std::move(planning_interface);
+  }
+  // Add the changed blocks of the map, since snapshots do not record them.
+  void recordChanges(const MapChangeSet& changes);
 
  private:
   const Config config_;
@@ -57,6 +76,30 @@ class PlanningVisualizer {
   // Data.
   std::string global_frame_name_;
 
+  // Cached slice states in tiles of kTileSize_ x kTileSize_ cells, indexed by
+  // (x, y, 0).
+  static constexpr int kTileSize_ = 32;
+  voxblox::AnyIndexHashMapType<std::vector<uint8_t>>::type tiles_;
+
+  // Properties of each submap that affect the slice when changed.
+  struct SubmapState {
+    bool is_active;
+    ChangeState change_state;
+    size_t num_blocks;
+    Transformation T_M_S;
+    Point min_M;  // Extent in mission frame.
+    Point max_M;
+  };
+  std::unordered_map<int, SubmapState> submap_states_;
+
+  // Changed blocks by submap ID added by 'recordChanges()'.
+  std::unordered_map<int, voxblox::IndexSet> recorded_blocks_;
+
+  // Remove the cached tiles of changed regions.
+  void invalidateChangedTiles(SubmapCollection* submaps);
+  void invalidateTiles(const Point& min_M, const Point& max_M);
+  BlockIndex getTileIndex(int cell_x, int cell_y) const;
+
   // Publishers.
   ros::NodeHandle nh_;
   ros::Publisher slice_pub_;
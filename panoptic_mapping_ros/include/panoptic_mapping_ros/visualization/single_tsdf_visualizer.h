@@ -1,6 +1,8 @@
 #ifndef PANOPTIC_MAPPING_ROS_VISUALIZATION_SINGLE_TSDF_VISUALIZER_H_
 #define PANOPTIC_MAPPING_ROS_VISUALIZATION_SINGLE_TSDF_VISUALIZER_H_
 
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -10,6 +12,7 @@
 #include <panoptic_mapping/common/common.h>
 #include <panoptic_mapping/common/globals.h>
 #include <panoptic_mapping/map/submap_collection.h>
+#include <voxblox/core/block_hash.h>
 
 #include "panoptic_mapping_ros/visualization/submap_visualizer.h"
 
@@ -54,6 +57,19 @@ class SingleTsdfVisualizer : public SubmapVisualizer {
   void setColorMode(ColorMode color_mode) override;
 
  protected:
+  /**
+   * @brief Colors of a mesh block. Each vertex refers to the voxel it lies in,
+   * whose color is computed once per color mode. The table is valid as long
+   * as the mesh of the block is not regenerated, such that republishing and
+   * switching between color modes do not query the class voxels again.
+   */
+  struct BlockColorTable {
+    uint64_t generation = std::numeric_limits<uint64_t>::max();
+    std::vector<size_t> voxels;          // Linear indices of the voxels.
+    std::vector<uint32_t> vertex_voxels;  // Index into voxels per vertex.
+    std::unordered_map<ColorMode, std::vector<Color>> colors;  // Per voxel.
+  };
+
   void colorMeshBlock(const Submap& submap,
                       voxblox_msgs::MeshBlock* mesh_block);
   std::function<Color(const ClassVoxel&)> getColoring() const;
@@ -71,6 +87,7 @@ class SingleTsdfVisualizer : public SubmapVisualizer {
 
   // Cached / tracked data.
   SubmapVisInfo info_;
+  voxblox::AnyIndexHashMapType<BlockColorTable>::type color_tables_;
 };
 
 }  // namespace panoptic_mapping
@@ -8,10 +8,14 @@
 
 #include <panoptic_mapping/common/common.h>
 #include <panoptic_mapping/common/globals.h>
+#include <panoptic_mapping/map/change_feed.h>
 #include <panoptic_mapping/map/submap_collection.h>
+#include <panoptic_mapping_msgs/MeshColorUpdate.h>
 #include <ros/node_handle.h>
+#include <tf2_ros/static_transform_broadcaster.h>
 #include <tf2_ros/transform_broadcaster.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <voxblox/core/block_hash.h>
 #include <voxblox/mesh/mesh_integrator.h>
 #include <voxblox/utils/color_maps.h>
 #include <voxblox_msgs/MultiMesh.h>
@@ -32,6 +36,39 @@ class SubmapVisualizer {
     bool visualize_free_space = true;
     bool visualize_bounding_volumes = true;
     bool include_free_space = false;
+
+    // If true, submaps whose color or alpha changed but not their geometry are
+    // updated with a color-only message on 'mesh_color_updates' instead of
+    // re-sending all their blocks on 'mesh'. Requires a mesh display that
+    // subscribes to these updates.
+    bool publish_color_updates = false;
+
+    // If true, inactive submaps that have a decimated mesh are shown by it
+    // instead of their full mesh.
+    bool use_decimated_meshes = false;
+
+    // Only every n-th voxel per dimension of the free space is visualized.
+    int free_space_voxel_stride = 1;
+
+    // If true, the TSDF blocks are published as a point cloud of block centers
+    // with the submap ID as intensity on 'tsdf_block_centers' instead of as
+    // markers.
+    bool tsdf_blocks_as_pointcloud = false;
+
+    // Only blocks within this distance of the view position are included in
+    // the free space and TSDF block point clouds, 0 to include all blocks.
+    float max_pointcloud_distance = 0.f;
+
+    // How the submap frames are published on TF. 'dynamic' sends all submap
+    // transforms on every visualization, 'static' sends them as static
+    // transforms once when submaps are created or moved, and 'none' does not
+    // publish them, e.g. if 'publish_in_global_frame' is set.
+    std::string tf_mode = "dynamic";
+
+    // If true, the meshes, TSDF blocks, and bounding volumes are published in
+    // the global frame, such that no TF of the submaps is needed. The meshes
+    // of moved submaps are transformed and re-sent whenever they change.
+    bool publish_in_global_frame = false;
     std::string ros_namespace;
 
     Config() { setConfigName("SubmapVisualizer"); }
@@ -82,7 +119,10 @@ class SubmapVisualizer {
       SubmapCollection* submaps);
   virtual visualization_msgs::MarkerArray generateBlockMsgs(
       const SubmapCollection& submaps);
+  // The free space points are updated incrementally for the changed blocks.
   virtual pcl::PointCloud<pcl::PointXYZI> generateFreeSpaceMsg(
+      SubmapCollection* submaps);
+  virtual pcl::PointCloud<pcl::PointXYZI> generateBlockCloudMsg(
       const SubmapCollection& submaps);
   virtual visualization_msgs::MarkerArray generateBoundingVolumeMsgs(
       const SubmapCollection& submaps);
@@ -91,10 +131,14 @@ class SubmapVisualizer {
   virtual void visualizeAll(SubmapCollection* submaps);
   virtual void visualizeMeshes(SubmapCollection* submaps);
   virtual void visualizeTsdfBlocks(const SubmapCollection& submaps);
-  virtual void visualizeFreeSpace(const SubmapCollection& submaps);
+  virtual void visualizeFreeSpace(SubmapCollection* submaps);
   virtual void visualizeBoundingVolume(const SubmapCollection& submaps);
   virtual void publishTfTransforms(const SubmapCollection& submaps);
 
+  // Whether any enabled visualization topic has subscribers. Visualizations
+  // without subscribers are not computed.
+  virtual bool hasSubscribers() const;
+
   // Interaction.
   virtual void reset();
   virtual void clearMesh();
@@ -103,6 +147,21 @@ class SubmapVisualizer {
   virtual void setGlobalFrameName(const std::string& frame_name) {
     global_frame_name_ = frame_name;
   }
+  // Position in mission frame around which point clouds are visualized, e.g.
+  // the current camera position.
+  virtual void setViewPosition(const Point& position_M) {
+    view_position_M_ = position_M;
+    has_view_position_ = true;
+  }
+  // If true, the visualized collections are consecutive snapshots of the same
+  // map, e.g. when visualizing on another thread. The tracking is then kept
+  // across collections and their meshes are not updated, which is up to the
+  // owner of the map.
+  virtual void setVisualizeSnapshots(bool visualize_snapshots) {
+    visualize_snapshots_ = visualize_snapshots;
+  }
+  // Add the changed blocks of the map, since snapshots do not record them.
+  virtual void recordChanges(const MapChangeSet& changes);
 
  protected:
   static const Color kUnknownColor_;
@@ -114,6 +173,7 @@ class SubmapVisualizer {
 
     // Visualization data.
     bool republish_everything = false;
+    bool republish_colors = false;  // Only color or alpha changed.
     bool was_deleted = false;
     bool change_color = true;
     Color color = kUnknownColor_;
@@ -123,22 +183,51 @@ class SubmapVisualizer {
     ChangeState previous_change_state;        // kChange
     bool was_active;                          // kActive
     voxblox::BlockIndexList previous_blocks;  // Track deleted blocks.
+    voxblox::ColorMode published_color_mode = voxblox::ColorMode::kGray;
+    // Mesh generations of the blocks published in kClassification.
+    voxblox::AnyIndexHashMapType<uint64_t>::type published_generations;
+    // Decimated mesh currently shown instead of the full mesh.
+    bool shows_decimated_mesh = false;
+    std::weak_ptr<const IndexedMesh> published_decimated_mesh;
+    // Pose of the mesh published in the global frame.
+    Transformation published_T_M_S;
   };
 
+  enum class TfMode { kDynamic, kStatic, kNone };
+
   virtual void updateVisInfos(const SubmapCollection& submaps);
   virtual void setSubmapVisColor(const Submap& submap, SubmapVisInfo* info);
-  virtual void generateClassificationMesh(Submap* submap,
+  Color getClassColor(const Submap& submap);
+  virtual void generateClassificationMesh(Submap* submap, SubmapVisInfo* info,
                                           voxblox_msgs::Mesh* mesh);
+  virtual void computeFreeSpacePoints(const TsdfBlock& block,
+                                      const BlockIndex& block_index,
+                                      pcl::PointCloud<pcl::PointXYZI>* points)
+      const;
+  // Whether a block of the given center and size is within the maximum point
+  // cloud distance of the view position.
+  bool blockIsInViewRange(const Point& center_M, float block_size) const;
+  // Whether the mesh of a submap changed since it was last published.
+  bool meshChangedSincePublished(const Submap& submap,
+                                 const SubmapVisInfo& info) const;
+  // Set the frame and pose of a marker at a position in submap frame.
+  void setMarkerPose(const Submap& submap, const Point& position_S,
+                     visualization_msgs::Marker* marker) const;
 
  protected:
   // Settings.
   VisualizationMode visualization_mode_;
   ColorMode color_mode_;
+  TfMode tf_mode_ = TfMode::kDynamic;
   std::string global_frame_name_ = "mission";
+  Point view_position_M_ = Point::Zero();
+  bool has_view_position_ = false;
+  bool visualize_snapshots_ = false;
 
   // Members.
   std::shared_ptr<Globals> globals_;
   tf2_ros::TransformBroadcaster tf_broadcaster_;
+  tf2_ros::StaticTransformBroadcaster static_tf_broadcaster_;
   voxblox::ExponentialOffsetIdColorMap id_color_map_;
 
   // Cached / tracked data.
@@ -146,12 +235,24 @@ class SubmapVisualizer {
   bool vis_infos_are_updated_ = false;
   const SubmapCollection* previous_submaps_ =
       nullptr;  // Only for tracking, not for use!
+  // Color updates created by the last call to 'generateMeshMsgs()'.
+  std::vector<panoptic_mapping_msgs::MeshColorUpdate> color_update_msgs_;
+  // Visualized points per block of the free space submap.
+  voxblox::AnyIndexHashMapType<pcl::PointCloud<pcl::PointXYZI>>::type
+      free_space_points_;
+  int free_space_submap_id_ = -1;
+  // Changed blocks by submap ID added by 'recordChanges()'.
+  std::unordered_map<int, voxblox::IndexSet> recorded_blocks_;
+  // Poses of the submaps sent as static transforms by submap ID.
+  std::unordered_map<int, Transformation> published_tf_poses_;
 
   // ROS.
   ros::NodeHandle nh_;
   ros::Publisher freespace_pub_;
   ros::Publisher mesh_pub_;
+  ros::Publisher mesh_color_update_pub_;
   ros::Publisher tsdf_blocks_pub_;
+  ros::Publisher tsdf_block_centers_pub_;
   ros::Publisher bounding_volume_pub_;
 
  private:
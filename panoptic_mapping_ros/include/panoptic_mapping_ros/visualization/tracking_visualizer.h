@@ -1,6 +1,7 @@
 #ifndef PANOPTIC_MAPPING_ROS_VISUALIZATION_TRACKING_VISUALIZER_H_
 #define PANOPTIC_MAPPING_ROS_VISUALIZATION_TRACKING_VISUALIZER_H_
 
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -36,12 +37,30 @@ class TrackingVisualizer {
   // Publish visualization requests.
   void publishImage(const cv::Mat& image, const std::string& name);
 
+  // If true, the images of the tracker are queued and published by
+  // 'publishQueuedImages()', e.g. on a visualization thread. Only the latest
+  // image per topic is kept.
+  void setQueueImages(bool queue_images) { queue_images_ = queue_images; }
+  void publishQueuedImages();
+
+  // Whether the image topic 'name' has subscribers. Advertises the topic if
+  // it does not exist yet, such that subscribers can connect.
+  bool hasSubscribers(const std::string& name);
+
  private:
   const Config config_;
 
+  ros::Publisher& getPublisher(const std::string& name);
+
   // Publishers.
   ros::NodeHandle nh_;
   std::unordered_map<std::string, ros::Publisher> publishers_;
+
+  // Queued images by topic. The mutex also guards the publishers, since
+  // images are queued by the tracker while others are published.
+  bool queue_images_ = false;
+  std::unordered_map<std::string, cv::Mat> queued_images_;
+  std::mutex mutex_;
 };
 
 }  // namespace panoptic_mapping
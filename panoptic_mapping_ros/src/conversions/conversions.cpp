@@ -1,7 +1,27 @@
 #include "panoptic_mapping_ros/conversions/conversions.h"
 
+#include <unordered_set>
+#include <vector>
+
 namespace panoptic_mapping {
 
+namespace {
+
+void toMsg(const voxblox::IndexSet& indices, std::vector<int32_t>* msg) {
+  msg->reserve(3 * indices.size());
+  for (const BlockIndex& index : indices) {
+    msg->push_back(index.x());
+    msg->push_back(index.y());
+    msg->push_back(index.z());
+  }
+}
+
+void toMsg(const std::unordered_set<int>& ids, std::vector<int32_t>* msg) {
+  msg->assign(ids.begin(), ids.end());
+}
+
+}  // namespace
+
 DetectronLabel detectronLabelFromMsg(
     const panoptic_mapping_msgs::DetectronLabel& msg) {
   DetectronLabel result;
@@ -22,4 +42,24 @@ DetectronLabels detectronLabelsFromMsg(
   return result;
 }
 
+panoptic_mapping_msgs::MapChanges mapChangesToMsg(const MapChangeSet& changes) {
+  panoptic_mapping_msgs::MapChanges msg;
+  msg.sequence_number = changes.sequence_number;
+  toMsg(changes.created_submaps, &msg.created_submaps);
+  toMsg(changes.removed_submaps, &msg.removed_submaps);
+  toMsg(changes.finished_submaps, &msg.finished_submaps);
+  toMsg(changes.moved_submaps, &msg.moved_submaps);
+  toMsg(changes.change_state_submaps, &msg.change_state_submaps);
+  msg.blocks.reserve(changes.blocks.size());
+  for (const auto& id_blocks_pair : changes.blocks) {
+    panoptic_mapping_msgs::SubmapBlockChanges& blocks_msg =
+        msg.blocks.emplace_back();
+    blocks_msg.submap_id = id_blocks_pair.first;
+    toMsg(id_blocks_pair.second.created, &blocks_msg.created_blocks);
+    toMsg(id_blocks_pair.second.updated, &blocks_msg.updated_blocks);
+    toMsg(id_blocks_pair.second.removed, &blocks_msg.removed_blocks);
+  }
+  return msg;
+}
+
 }  // namespace panoptic_mapping
@@ -1,21 +1,46 @@
 #include "panoptic_mapping_ros/input/input_synchronizer.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 
 #include <cv_bridge/cv_bridge.h>
-#include <minkindr_conversions/kindr_tf.h>
 #include <panoptic_mapping_msgs/DetectronLabels.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include <std_msgs/Bool.h>
 
 #include "panoptic_mapping_ros/conversions/conversions.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+// Convert an image message to the requested encoding. If sharing is enabled
+// and the encoding already matches, the image references the message buffer
+// and 'owner' is set to keep the message alive. Otherwise the image is copied.
+cv::Mat imageFromMsg(const sensor_msgs::ImageConstPtr& msg,
+                     const std::string& encoding, bool share,
+                     std::shared_ptr<const void>* owner) {
+  if (!share) {
+    return cv_bridge::toCvCopy(msg, encoding)->image;
+  }
+  const cv_bridge::CvImageConstPtr image = cv_bridge::toCvShare(msg, encoding);
+  if (static_cast<const void*>(image->image.data) ==
+      static_cast<const void*>(msg->data.data())) {
+    *owner = std::shared_ptr<const void>(image.get(), [image](const void*) {});
+  }
+  return image->image;
+}
+
+}  // namespace
+
 const std::unordered_map<InputData::InputType, std::string>
     InputSynchronizer::kDefaultTopicNames_ = {
         {InputData::InputType::kDepthImage, "depth_image_in"},
@@ -29,6 +54,20 @@ void InputSynchronizer::Config::checkParams() const {
   checkParamCond(!global_frame_name.empty(),
                  "'global_frame_name' may not be empty.");
   checkParamGE(transform_lookup_time, 0.f, "transform_lookup_time");
+  checkParamCond(drop_policy == "oldest" || drop_policy == "newest" ||
+                     drop_policy == "incomplete",
+                 "'drop_policy' must be one of 'oldest', 'newest', or "
+                 "'incomplete'.");
+  checkParamGE(max_queued_megabytes, 0.f, "max_queued_megabytes");
+  checkParamGE(backpressure_ready_inputs, 0, "backpressure_ready_inputs");
+  checkParamCond(!depth_image_transport.empty() &&
+                     !color_image_transport.empty() &&
+                     !segmentation_image_transport.empty() &&
+                     !uncertainty_image_transport.empty(),
+                 "The image transports may not be empty.");
+  checkParamCond(pose_source == "tf" || pose_source == "odometry",
+                 "'pose_source' must be one of 'tf' or 'odometry'.");
+  checkParamGT(pose_buffer_duration, 0.f, "pose_buffer_duration");
 }
 
 void InputSynchronizer::Config::setupParamsAndPrinting() {
@@ -38,6 +77,18 @@ void InputSynchronizer::Config::setupParamsAndPrinting() {
   setupParam("sensor_frame_name", &sensor_frame_name);
   setupParam("transform_lookup_time", &transform_lookup_time);
   setupParam("max_delay", &max_delay);
+  setupParam("share_image_buffers", &share_image_buffers);
+  setupParam("depth_image_transport", &depth_image_transport);
+  setupParam("color_image_transport", &color_image_transport);
+  setupParam("segmentation_image_transport", &segmentation_image_transport);
+  setupParam("uncertainty_image_transport", &uncertainty_image_transport);
+  setupParam("process_latest_only", &process_latest_only);
+  setupParam("drop_policy", &drop_policy);
+  setupParam("max_queued_megabytes", &max_queued_megabytes, "MB");
+  setupParam("backpressure_ready_inputs", &backpressure_ready_inputs);
+  setupParam("pose_source", &pose_source);
+  setupParam("pose_buffer_duration", &pose_buffer_duration, "s");
+  setupParam("defer_missing_poses", &defer_missing_poses);
 }
 
 InputSynchronizer::InputSynchronizer(const Config& config,
@@ -47,6 +98,29 @@ InputSynchronizer::InputSynchronizer(const Config& config,
   if (!config_.sensor_frame_name.empty()) {
     used_sensor_frame_name_ = config_.sensor_frame_name;
   }
+  if (config_.pose_source == "odometry") {
+    pose_source_ = std::make_unique<OdometryPoseSource>(
+        config_.global_frame_name, nh_, "odometry_in",
+        config_.pose_buffer_duration, config_.verbosity);
+  } else {
+    pose_source_ = std::make_unique<TfPoseSource>(config_.global_frame_name,
+                                                  config_.verbosity);
+  }
+  if (config_.defer_missing_poses) {
+    pose_source_->setPoseCallback([this]() { retryDeferredPoses(); });
+  }
+  if (config_.drop_policy == "newest") {
+    drop_policy_ = DropPolicy::kNewest;
+  } else if (config_.drop_policy == "incomplete") {
+    drop_policy_ = DropPolicy::kIncomplete;
+  }
+  if (config_.backpressure_ready_inputs > 0) {
+    backpressure_pub_ =
+        nh_.advertise<std_msgs::Bool>("input_backpressure", 1, true);
+    std_msgs::Bool msg;
+    msg.data = false;
+    backpressure_pub_.publish(msg);
+  }
 }
 
 void InputSynchronizer::requestInputs(const InputData::InputTypes& types) {
@@ -59,6 +133,8 @@ void InputSynchronizer::advertiseInputTopics() {
   // Parse all required inputs and allocate an input queue for each.
   // NOTE(schmluk): Image copies appear to be necessary since some of the data
   // is mutable and they get corrupted sometimes otherwise. Better be safe.
+  // Read-only images can share the message buffers if 'share_image_buffers'
+  // is set, the id image is modified by the trackers and always copied.
   // NOTE(schmluk): each input writes to a different image so we can do this
   // concurrently, only lock the mutex when writing to the contained inputs.
   subscribers_.clear();
@@ -67,11 +143,12 @@ void InputSynchronizer::advertiseInputTopics() {
     switch (type) {
       case InputData::InputType::kDepthImage: {
         using MsgT = sensor_msgs::ImageConstPtr;
-        addQueue<MsgT>(
-            type, [this](const MsgT& msg, InputSynchronizerData* data) {
-              const cv_bridge::CvImageConstPtr depth =
-                  cv_bridge::toCvCopy(msg, "32FC1");
-              data->data->depth_image_ = depth->image;
+        addImageQueue(
+            type, config_.depth_image_transport,
+            [this](const MsgT& msg, InputSynchronizerData* data) {
+              std::shared_ptr<const void> owner;
+              data->data->depth_image_ = imageFromMsg(
+                  msg, "32FC1", config_.share_image_buffers, &owner);
 
               // NOTE(schmluk): If the sensor frame name is not set
               // recover it from the depth image.
@@ -80,6 +157,9 @@ void InputSynchronizer::advertiseInputTopics() {
               }
 
               const std::lock_guard<std::mutex> lock(data->write_mutex_);
+              if (owner) {
+                data->data->addBufferOwner(std::move(owner));
+              }
               data->data->contained_inputs_.insert(
                   InputData::InputType::kDepthImage);
             });
@@ -88,27 +168,39 @@ void InputSynchronizer::advertiseInputTopics() {
       }
       case InputData::InputType::kColorImage: {
         using MsgT = sensor_msgs::ImageConstPtr;
-        addQueue<MsgT>(type, [](const MsgT& msg, InputSynchronizerData* data) {
-          const cv_bridge::CvImageConstPtr color =
-              cv_bridge::toCvCopy(msg, "bgr8");
-          data->data->color_image_ = color->image;
-          const std::lock_guard<std::mutex> lock(data->write_mutex_);
-          data->data->contained_inputs_.insert(
-              InputData::InputType::kColorImage);
-        });
+        addImageQueue(
+            type, config_.color_image_transport,
+            [this](const MsgT& msg, InputSynchronizerData* data) {
+              std::shared_ptr<const void> owner;
+              data->data->color_image_ = imageFromMsg(
+                  msg, "bgr8", config_.share_image_buffers, &owner);
+              const std::lock_guard<std::mutex> lock(data->write_mutex_);
+              if (owner) {
+                data->data->addBufferOwner(std::move(owner));
+              }
+              data->data->contained_inputs_.insert(
+                  InputData::InputType::kColorImage);
+            });
         subscribed_inputs_.insert(InputData::InputType::kColorImage);
         break;
       }
       case InputData::InputType::kSegmentationImage: {
         using MsgT = sensor_msgs::ImageConstPtr;
-        addQueue<MsgT>(type, [](const MsgT& msg, InputSynchronizerData* data) {
-          const cv_bridge::CvImageConstPtr seg =
-              cv_bridge::toCvCopy(msg, "32SC1");
-          data->data->id_image_ = seg->image;
-          const std::lock_guard<std::mutex> lock(data->write_mutex_);
-          data->data->contained_inputs_.insert(
-              InputData::InputType::kSegmentationImage);
-        });
+        addImageQueue(
+            type, config_.segmentation_image_transport,
+            [](const MsgT& msg, InputSynchronizerData* data) {
+              // Losslessly compressed ids arrive as 8 or 16 bit images.
+              if (msg->encoding == sensor_msgs::image_encodings::TYPE_32SC1) {
+                data->data->id_image_ =
+                    cv_bridge::toCvCopy(msg, "32SC1")->image;
+              } else {
+                cv_bridge::toCvShare(msg)->image.convertTo(
+                    data->data->id_image_, CV_32SC1);
+              }
+              const std::lock_guard<std::mutex> lock(data->write_mutex_);
+              data->data->contained_inputs_.insert(
+                  InputData::InputType::kSegmentationImage);
+            });
         subscribed_inputs_.insert(InputData::InputType::kSegmentationImage);
         break;
       }
@@ -125,12 +217,16 @@ void InputSynchronizer::advertiseInputTopics() {
       }
       case InputData::InputType::kUncertaintyImage: {
         using MsgT = sensor_msgs::ImageConstPtr;
-        addQueue<MsgT>(
-            type, [this](const MsgT& msg, InputSynchronizerData* data) {
-              const cv_bridge::CvImageConstPtr uncertainty =
-                  cv_bridge::toCvCopy(msg, "32FC1");
-              data->data->uncertainty_image_ = uncertainty->image;
+        addImageQueue(
+            type, config_.uncertainty_image_transport,
+            [this](const MsgT& msg, InputSynchronizerData* data) {
+              std::shared_ptr<const void> owner;
+              data->data->uncertainty_image_ = imageFromMsg(
+                  msg, "32FC1", config_.share_image_buffers, &owner);
               const std::lock_guard<std::mutex> lock(data->write_mutex_);
+              if (owner) {
+                data->data->addBufferOwner(std::move(owner));
+              }
               data->data->contained_inputs_.insert(
                   InputData::InputType::kUncertaintyImage);
             });
@@ -141,17 +237,47 @@ void InputSynchronizer::advertiseInputTopics() {
   }
 }
 
+void InputSynchronizer::addImageQueue(
+    InputData::InputType type, const std::string& transport,
+    std::function<void(const sensor_msgs::ImageConstPtr&,
+                       InputSynchronizerData*)>
+        extraction_function) {
+  using MsgT = sensor_msgs::ImageConstPtr;
+  if (transport == "raw") {
+    addQueue<MsgT>(type, std::move(extraction_function));
+    return;
+  }
+  subscribers_.emplace_back(std::make_unique<ImageTransportSubscriber>(
+      nh_, kDefaultTopicNames_.at(type), config_.max_input_queue_length,
+      transport, std::move(extraction_function), this));
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Receiving '" << kDefaultTopicNames_.at(type) << "' via '"
+      << transport << "' image transport.";
+}
+
 bool InputSynchronizer::getDataInQueue(const ros::Time& timestamp,
                                        InputSynchronizerData** data) {
   // These are common operations for all subscribers so mutex them to avoid race
   // conditions.
   std::lock_guard<std::mutex> lock(data_mutex_);
 
+  // Poses are not received by tf sources, so retry whenever inputs arrive.
+  if (config_.defer_missing_poses) {
+    retryDeferredPosesLocked();
+  }
+
   // Check the data is still relevant to the queue.
   if (timestamp < oldest_time_) {
+    num_late_messages_++;
     return false;
   }
   double max_delay = config_.max_delay;
+  if (!last_rejected_time_.isZero() &&
+      std::abs(last_rejected_time_.toSec() - timestamp.toSec()) <=
+          max_delay) {
+    // The remaining messages of a dropped input.
+    return false;
+  }
   auto it = find_if(data_queue_.begin(), data_queue_.end(),
                     [&timestamp, &max_delay](const auto& arg) {
                       return abs(arg->timestamp.toSec() - timestamp.toSec()) <=
@@ -178,54 +304,66 @@ bool InputSynchronizer::allocateDataInQueue(const ros::Time& timestamp) {
   // NOTE(schmluk): This obviously modifies the queue but the data_mutex_ should
   // already be locked from the calling getDataInQueue().
   // Check max queue size.
-  if (data_queue_.size() > config_.max_input_queue_length) {
+  if (queueIsFull()) {
+    if (drop_policy_ == DropPolicy::kNewest) {
+      last_rejected_time_ = timestamp;
+      num_dropped_inputs_++;
+      LOG_IF(WARNING, config_.verbosity >= 2)
+          << "Input queue is full, dropping new data.";
+      return false;
+    }
     std::sort(data_queue_.begin(), data_queue_.end(),
               [](const auto& lhs, const auto& rhs) -> bool {
                 return lhs->timestamp < rhs->timestamp;
               });
-    // Print missing topics if required.
-    std::stringstream info;
-    if (config_.verbosity >= 3 && *data_queue_.begin() &&
-        data_queue_.begin()->get()->data) {
-      const InputData data = *data_queue_.begin()->get()->data;
-      std::vector<std::string> missing_data;
-      for (const auto& type : subscribed_inputs_) {
-        if (!data.has(type)) {
-          missing_data.push_back(InputData::inputTypeToString(type));
-        }
-      }
-      if (!missing_data.empty()) {
-        info << " (Missing inputs: " << missing_data[0];
-        for (size_t i = 1; i < missing_data.size(); ++i) {
-          info << ", " << missing_data[i];
+    while (!data_queue_.empty() && queueIsFull()) {
+      size_t index = 0;
+      if (drop_policy_ == DropPolicy::kIncomplete) {
+        const auto it =
+            std::find_if(data_queue_.begin(), data_queue_.end(),
+                         [](const auto& data) { return !data->ready; });
+        if (it != data_queue_.end()) {
+          index = it - data_queue_.begin();
         }
-        info << ")";
       }
-    }
 
-    // Erase first element and update queue.
-    data_queue_.erase(data_queue_.begin());
-    data_is_ready_ = false;
-    for (size_t i = 0; i < data_queue_.size(); ++i) {
-      if (data_queue_[i]->ready) {
-        data_is_ready_ = true;
-        break;
+      // Print missing topics if required.
+      std::stringstream info;
+      if (config_.verbosity >= 3 && data_queue_[index]->data) {
+        const InputData data = *data_queue_[index]->data;
+        std::vector<std::string> missing_data;
+        for (const auto& type : subscribed_inputs_) {
+          if (!data.has(type)) {
+            missing_data.push_back(InputData::inputTypeToString(type));
+          }
+        }
+        if (!missing_data.empty()) {
+          info << " (Missing inputs: " << missing_data[0];
+          for (size_t i = 1; i < missing_data.size(); ++i) {
+            info << ", " << missing_data[i];
+          }
+          info << ")";
+        }
       }
+      LOG_IF(WARNING, config_.verbosity >= 2)
+          << "Input queue is getting too long, dropping "
+          << (index == 0 ? "oldest" : "incomplete") << " data" << info.str()
+          << ".";
+      dropFromQueue(index);
     }
-    LOG_IF(WARNING, config_.verbosity >= 2)
-        << "Input queue is getting too long, dropping oldest data" << info.str()
-        << ".";
-    oldest_time_ = data_queue_.front()->timestamp;
+    updateReadyState();
+    oldest_time_ =
+        data_queue_.empty() ? timestamp : data_queue_.front()->timestamp;
   }
 
   data_queue_.emplace_back(new InputSynchronizerData());
   InputSynchronizerData& data = *data_queue_.back();
 
-  // Check transform.
+  // Check transform. Deferred poses are looked up once the data is complete.
   Transformation T_M_C;
-  if (!used_sensor_frame_name_.empty()) {
-    if (!lookupTransform(timestamp, config_.global_frame_name,
-                         used_sensor_frame_name_, &T_M_C)) {
+  if (!config_.defer_missing_poses && !used_sensor_frame_name_.empty()) {
+    if (lookupPose(timestamp, config_.transform_lookup_time, &T_M_C) !=
+        PoseLookupResult::kSuccess) {
       data.valid = false;
       return false;
     }
@@ -241,81 +379,230 @@ bool InputSynchronizer::allocateDataInQueue(const ros::Time& timestamp) {
 }
 
 void InputSynchronizer::checkDataIsReady(InputSynchronizerData* data) {
-  const std::lock_guard<std::mutex> lock(data->write_mutex_);
-  for (const InputData::InputType input : subscribed_inputs_) {
-    if (!data->data->has(input)) {
+  {
+    const std::lock_guard<std::mutex> lock(data->write_mutex_);
+    for (const InputData::InputType input : subscribed_inputs_) {
+      if (!data->data->has(input)) {
+        return;
+      }
+    }
+  }
+  {
+    // Has all required inputs. Synchronize with threads checking the flag
+    // before they start waiting.
+    const std::lock_guard<std::mutex> lock(data_mutex_);
+    data->complete = true;
+    if (config_.defer_missing_poses && !lookupDeferredPose(data)) {
       return;
     }
+    data->ready = true;
+    data_is_ready_ = true;
+    updateBackpressure();
   }
-  // Has all required inputs.
-  data->ready = true;
-  data_is_ready_ = true;
+  data_ready_cv_.notify_all();
+}
+
+bool InputSynchronizer::lookupDeferredPose(InputSynchronizerData* data) {
+  if (data->has_pose) {
+    return true;
+  }
+  if (used_sensor_frame_name_.empty()) {
+    return false;
+  }
+  Transformation T_M_C;
+  switch (lookupPose(data->timestamp, 0.0, &T_M_C)) {
+    case PoseLookupResult::kSuccess:
+      data->data->setT_M_C(T_M_C);
+      data->data->setFrameName(used_sensor_frame_name_);
+      data->has_pose = true;
+      return true;
+    case PoseLookupResult::kFailed:
+      data->valid = false;
+      return false;
+    default:
+      return false;
+  }
+}
+
+void InputSynchronizer::retryDeferredPoses() {
+  const std::lock_guard<std::mutex> lock(data_mutex_);
+  retryDeferredPosesLocked();
+}
+
+void InputSynchronizer::retryDeferredPosesLocked() {
+  bool got_ready = false;
+  for (size_t i = 0; i < data_queue_.size();) {
+    InputSynchronizerData& data = *data_queue_[i];
+    if (!data.complete || data.ready) {
+      ++i;
+      continue;
+    }
+    if (lookupDeferredPose(&data)) {
+      data.ready = true;
+      got_ready = true;
+    } else if (!data.valid) {
+      LOG_IF(WARNING, config_.verbosity >= 2)
+          << "No pose available for input at " << data.timestamp
+          << ", dropping it.";
+      dropFromQueue(i);
+      continue;
+    }
+    ++i;
+  }
+  if (got_ready) {
+    updateReadyState();
+    data_ready_cv_.notify_all();
+  }
+}
+
+std::shared_ptr<InputData> InputSynchronizer::waitForInputData(
+    double timeout) {
+  {
+    std::unique_lock<std::mutex> lock(data_mutex_);
+    data_ready_cv_.wait_for(lock, std::chrono::duration<double>(timeout),
+                            [this]() { return closed_ || data_is_ready_; });
+    if (closed_ || !data_is_ready_) {
+      return nullptr;
+    }
+  }
+  return getInputData();
+}
+
+size_t InputSynchronizer::getNumberOfReadyInputs() {
+  std::lock_guard<std::mutex> lock(data_mutex_);
+  return std::count_if(data_queue_.begin(), data_queue_.end(),
+                       [](const auto& data) { return data->ready; });
+}
+
+InputSynchronizer::QueueStatistics InputSynchronizer::getQueueStatistics() {
+  std::lock_guard<std::mutex> lock(data_mutex_);
+  QueueStatistics result;
+  result.num_queued = data_queue_.size();
+  result.num_ready =
+      std::count_if(data_queue_.begin(), data_queue_.end(),
+                    [](const auto& data) { return data->ready; });
+  result.num_bytes = getQueuedBytes();
+  result.num_dropped = num_dropped_inputs_;
+  result.num_late_messages = num_late_messages_;
+  result.backpressure = backpressure_;
+  return result;
+}
+
+bool InputSynchronizer::queueIsFull() const {
+  if (data_queue_.size() > config_.max_input_queue_length) {
+    return true;
+  }
+  return config_.max_queued_megabytes > 0.f &&
+         static_cast<double>(getQueuedBytes()) >
+             config_.max_queued_megabytes * 1e6;
+}
+
+size_t InputSynchronizer::getQueuedBytes() const {
+  size_t result = 0;
+  for (const auto& data : data_queue_) {
+    result += data->num_bytes;
+  }
+  return result;
+}
+
+void InputSynchronizer::dropFromQueue(size_t index) {
+  // Reject the remaining messages of the dropped input.
+  last_rejected_time_ = data_queue_[index]->timestamp;
+  data_queue_.erase(data_queue_.begin() + index);
+  num_dropped_inputs_++;
+}
+
+void InputSynchronizer::updateReadyState() {
+  data_is_ready_ =
+      std::any_of(data_queue_.begin(), data_queue_.end(),
+                  [](const auto& data) { return data->ready; });
+  updateBackpressure();
+}
+
+void InputSynchronizer::updateBackpressure() {
+  if (config_.backpressure_ready_inputs <= 0) {
+    return;
+  }
+  const int num_ready =
+      std::count_if(data_queue_.begin(), data_queue_.end(),
+                    [](const auto& data) { return data->ready; });
+  // Hysteresis to avoid toggling with every input.
+  const bool backpressure =
+      backpressure_ ? num_ready > config_.backpressure_ready_inputs / 2
+                    : num_ready >= config_.backpressure_ready_inputs;
+  if (backpressure == backpressure_) {
+    return;
+  }
+  backpressure_ = backpressure;
+  std_msgs::Bool msg;
+  msg.data = backpressure;
+  backpressure_pub_.publish(msg);
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << (backpressure ? "Signaling" : "Releasing") << " input backpressure ("
+      << num_ready << " ready inputs).";
+}
+
+void InputSynchronizer::close() {
+  {
+    const std::lock_guard<std::mutex> lock(data_mutex_);
+    closed_ = true;
+  }
+  data_ready_cv_.notify_all();
 }
 
 std::shared_ptr<InputData> InputSynchronizer::getInputData() {
   std::shared_ptr<InputData> result = nullptr;
   std::lock_guard<std::mutex> lock(data_mutex_);
-  // Get the first datum that is ready.
+  // Get the first datum that is ready, or the last one if only the latest
+  // input is processed.
   std::sort(data_queue_.begin(), data_queue_.end(),
             [](const auto& lhs, const auto& rhs) -> bool {
               return lhs->timestamp < rhs->timestamp;
             });
-  for (size_t i = 0; i < data_queue_.size(); ++i) {
+  const int num_data = data_queue_.size();
+  for (int j = 0; j < num_data; ++j) {
+    const int i = config_.process_latest_only ? num_data - 1 - j : j;
     if (data_queue_[i]->ready) {
       // In case the sensor frame name is taken from the depth message check it
       // was written. This only happens for the first message.
       if (data_queue_[i]->data->sensorFrameName().empty()) {
         Transformation T_M_C;
-        if (!lookupTransform(data_queue_[i]->timestamp,
-                             config_.global_frame_name, used_sensor_frame_name_,
-                             &T_M_C)) {
+        if (lookupPose(data_queue_[i]->timestamp,
+                       config_.transform_lookup_time,
+                       &T_M_C) != PoseLookupResult::kSuccess) {
           return result;
         }
         data_queue_[i]->data->setT_M_C(T_M_C);
         data_queue_[i]->data->setFrameName(used_sensor_frame_name_);
       }
 
-      // Get the result and erase from the queue.
+      // Get the result and erase from the queue. If only the latest input is
+      // processed all older data is dropped.
       result = data_queue_[i]->data;
-      data_queue_.erase(data_queue_.begin() + i);
-      oldest_time_ = data_queue_.front()->timestamp;
+      const ros::Time timestamp = data_queue_[i]->timestamp;
+      const int first_erased = config_.process_latest_only ? 0 : i;
+      LOG_IF(INFO, config_.verbosity >= 3 && i > first_erased)
+          << "Dropping " << i - first_erased
+          << " older inputs to process the latest one.";
+      data_queue_.erase(data_queue_.begin() + first_erased,
+                        data_queue_.begin() + i + 1);
+      num_dropped_inputs_ += i - first_erased;
+      oldest_time_ =
+          data_queue_.empty() ? timestamp : data_queue_.front()->timestamp;
       break;
     }
   }
 
   // Check whether there are other ready data points.
-  for (size_t i = 0; i < data_queue_.size(); ++i) {
-    if (data_queue_[i]->ready) {
-      return result;
-    }
-  }
-  data_is_ready_ = false;
+  updateReadyState();
   return result;
 }
 
-bool InputSynchronizer::lookupTransform(const ros::Time& timestamp,
-                                        const std::string& base_frame,
-                                        const std::string& child_frame,
-                                        Transformation* transformation) const {
-  // Try to lookup the transform for the maximum wait time.
-  tf::StampedTransform transform;
-  try {
-    tf_listener_.waitForTransform(base_frame, child_frame, timestamp,
-                                  ros::Duration(config_.transform_lookup_time));
-    tf_listener_.lookupTransform(base_frame, child_frame, timestamp, transform);
-  } catch (tf::TransformException& ex) {
-    LOG_IF(WARNING, config_.verbosity >= 2)
-        << "Unable to lookup transform between '" << base_frame << "' and '"
-        << child_frame << "' at time '" << timestamp << "' over '"
-        << config_.transform_lookup_time << "s', skipping inputs. Exception: '"
-        << ex.what() << "'.";
-    return false;
-  }
-  CHECK_NOTNULL(transformation);
-  Transformation T_M_C;
-  tf::transformTFToKindr(transform, &T_M_C);
-  *transformation = T_M_C;
-  return true;
+PoseLookupResult InputSynchronizer::lookupPose(const ros::Time& timestamp,
+                                               double timeout,
+                                               Transformation* T_M_C) {
+  return pose_source_->lookup(timestamp, used_sensor_frame_name_, timeout,
+                              T_M_C);
 }
 
 }  // namespace panoptic_mapping
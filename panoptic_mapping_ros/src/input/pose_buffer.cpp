@@ -0,0 +1,86 @@
+#include "panoptic_mapping_ros/input/pose_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace panoptic_mapping {
+
+PoseBuffer::PoseBuffer(double max_duration) : max_duration_(max_duration) {}
+
+void PoseBuffer::addPose(double timestamp, const Transformation& pose) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (poses_.empty() || timestamp > poses_.back().first) {
+      poses_.emplace_back(timestamp, pose);
+    } else {
+      const auto it = std::lower_bound(
+          poses_.begin(), poses_.end(), timestamp,
+          [](const auto& entry, double time) { return entry.first < time; });
+      if (it != poses_.end() && it->first == timestamp) {
+        it->second = pose;
+      } else {
+        poses_.emplace(it, timestamp, pose);
+      }
+    }
+    while (poses_.front().first < poses_.back().first - max_duration_) {
+      poses_.pop_front();
+    }
+  }
+  pose_added_cv_.notify_all();
+}
+
+PoseLookupResult PoseBuffer::getPose(double timestamp, double timeout,
+                                     Transformation* pose) const {
+  CHECK_NOTNULL(pose);
+  std::unique_lock<std::mutex> lock(mutex_);
+  PoseLookupResult result = interpolate(timestamp, pose);
+  if (result != PoseLookupResult::kPending || timeout <= 0.0) {
+    return result;
+  }
+  pose_added_cv_.wait_for(lock, std::chrono::duration<double>(timeout),
+                          [&]() {
+                            result = interpolate(timestamp, pose);
+                            return result != PoseLookupResult::kPending;
+                          });
+  return result;
+}
+
+PoseLookupResult PoseBuffer::interpolate(double timestamp,
+                                         Transformation* pose) const {
+  if (poses_.empty() || timestamp > poses_.back().first) {
+    return PoseLookupResult::kPending;
+  }
+  if (timestamp < poses_.front().first) {
+    return PoseLookupResult::kFailed;
+  }
+  const auto upper = std::lower_bound(
+      poses_.begin(), poses_.end(), timestamp,
+      [](const auto& entry, double time) { return entry.first < time; });
+  if (upper->first == timestamp || upper == poses_.begin()) {
+    *pose = upper->second;
+    return PoseLookupResult::kSuccess;
+  }
+  const auto lower = upper - 1;
+  const FloatingPoint t = static_cast<FloatingPoint>(
+      (timestamp - lower->first) / (upper->first - lower->first));
+  const Point position = (1.f - t) * lower->second.getPosition() +
+                         t * upper->second.getPosition();
+  const auto rotation = lower->second.getRotation().toImplementation().slerp(
+      t, upper->second.getRotation().toImplementation());
+  *pose = Transformation(Transformation::Rotation(rotation.normalized()),
+                         position);
+  return PoseLookupResult::kSuccess;
+}
+
+double PoseBuffer::getNewestTimestamp() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return poses_.empty() ? 0.0 : poses_.back().first;
+}
+
+size_t PoseBuffer::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return poses_.size();
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,141 @@
+#include "panoptic_mapping_ros/input/pose_source.h"
+
+#include <string>
+#include <utility>
+
+#include <minkindr_conversions/kindr_tf.h>
+
+namespace panoptic_mapping {
+
+TfPoseSource::TfPoseSource(std::string global_frame_name, int verbosity)
+    : PoseSourceBase(std::move(global_frame_name)), verbosity_(verbosity) {}
+
+PoseLookupResult TfPoseSource::lookup(const ros::Time& timestamp,
+                                      const std::string& sensor_frame_name,
+                                      double timeout, Transformation* T_M_C) {
+  CHECK_NOTNULL(T_M_C);
+  tf::StampedTransform transform;
+  try {
+    if (timeout > 0.0) {
+      // Try to lookup the transform for the maximum wait time.
+      tf_listener_.waitForTransform(global_frame_name_, sensor_frame_name,
+                                    timestamp, ros::Duration(timeout));
+    } else if (!tf_listener_.canTransform(global_frame_name_,
+                                          sensor_frame_name, timestamp)) {
+      // Pending if tf has not yet received data up to the timestamp.
+      ros::Time latest;
+      if (tf_listener_.getLatestCommonTime(global_frame_name_,
+                                           sensor_frame_name, latest,
+                                           nullptr) != tf::NO_ERROR ||
+          latest < timestamp) {
+        return PoseLookupResult::kPending;
+      }
+    }
+    tf_listener_.lookupTransform(global_frame_name_, sensor_frame_name,
+                                 timestamp, transform);
+  } catch (tf::TransformException& ex) {
+    LOG_IF(WARNING, verbosity_ >= 2)
+        << "Unable to lookup transform between '" << global_frame_name_
+        << "' and '" << sensor_frame_name << "' at time '" << timestamp
+        << "' over '" << timeout << "s', skipping inputs. Exception: '"
+        << ex.what() << "'.";
+    return PoseLookupResult::kFailed;
+  }
+  tf::transformTFToKindr(transform, T_M_C);
+  return PoseLookupResult::kSuccess;
+}
+
+OdometryPoseSource::OdometryPoseSource(std::string global_frame_name,
+                                       const ros::NodeHandle& nh,
+                                       const std::string& topic,
+                                       double buffer_duration, int verbosity)
+    : PoseSourceBase(std::move(global_frame_name)),
+      verbosity_(verbosity),
+      nh_(nh),
+      buffer_(buffer_duration) {
+  odometry_sub_ = nh_.subscribe(topic, 100,
+                                &OdometryPoseSource::odometryCallback, this);
+}
+
+void OdometryPoseSource::odometryCallback(
+    const nav_msgs::Odometry::ConstPtr& msg) {
+  if (msg->header.frame_id != global_frame_name_) {
+    LOG_FIRST_N(WARNING, 1)
+        << "Odometry is expressed in '" << msg->header.frame_id
+        << "' but the global frame is '" << global_frame_name_
+        << "', ignoring odometry.";
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (body_frame_name_ != msg->child_frame_id) {
+      body_frame_name_ = msg->child_frame_id;
+      T_B_C_.clear();
+    }
+  }
+  const auto& pose = msg->pose.pose;
+  const Eigen::Quaternion<FloatingPoint> rotation(
+      pose.orientation.w, pose.orientation.x, pose.orientation.y,
+      pose.orientation.z);
+  const Transformation T_M_B(
+      Transformation::Rotation(rotation.normalized()),
+      Point(pose.position.x, pose.position.y, pose.position.z));
+  buffer_.addPose(msg->header.stamp.toSec(), T_M_B);
+  if (pose_callback_) {
+    pose_callback_();
+  }
+}
+
+PoseLookupResult OdometryPoseSource::lookup(
+    const ros::Time& timestamp, const std::string& sensor_frame_name,
+    double timeout, Transformation* T_M_C) {
+  CHECK_NOTNULL(T_M_C);
+  Transformation T_M_B;
+  const PoseLookupResult result =
+      buffer_.getPose(timestamp.toSec(), timeout, &T_M_B);
+  if (result != PoseLookupResult::kSuccess) {
+    return result;
+  }
+  Transformation T_B_C;
+  if (!lookupExtrinsics(sensor_frame_name, &T_B_C)) {
+    return PoseLookupResult::kPending;
+  }
+  *T_M_C = T_M_B * T_B_C;
+  return PoseLookupResult::kSuccess;
+}
+
+bool OdometryPoseSource::lookupExtrinsics(const std::string& sensor_frame_name,
+                                          Transformation* T_B_C) {
+  std::string body_frame_name;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = T_B_C_.find(sensor_frame_name);
+    if (it != T_B_C_.end()) {
+      *T_B_C = it->second;
+      return true;
+    }
+    body_frame_name = body_frame_name_;
+  }
+  if (body_frame_name == sensor_frame_name) {
+    *T_B_C = Transformation();
+  } else {
+    // The extrinsics are static, use the latest transform.
+    tf::StampedTransform transform;
+    try {
+      tf_listener_.lookupTransform(body_frame_name, sensor_frame_name,
+                                   ros::Time(0), transform);
+    } catch (tf::TransformException& ex) {
+      LOG_IF(WARNING, verbosity_ >= 2)
+          << "Unable to lookup the static transform between '"
+          << body_frame_name << "' and '" << sensor_frame_name
+          << "'. Exception: '" << ex.what() << "'.";
+      return false;
+    }
+    tf::transformTFToKindr(transform, T_B_C);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  T_B_C_[sensor_frame_name] = *T_B_C;
+  return true;
+}
+
+}  // namespace panoptic_mapping
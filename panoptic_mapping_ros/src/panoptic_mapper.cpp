@@ -1,5 +1,6 @@
 #include "panoptic_mapping_ros/panoptic_mapper.h"
 
+#include <chrono>
 #include <map>
 #include <memory>
 #include <sstream>
@@ -8,13 +9,46 @@
 #include <vector>
 
 #include <panoptic_mapping/common/camera.h>
+#include <panoptic_mapping/common/thread_scheduling.h>
 #include <panoptic_mapping/labels/label_handler_base.h>
-#include <panoptic_mapping/map/classification/fixed_count.h>
+#include <panoptic_mapping/map/block_pool.h>
 #include <panoptic_mapping/submap_allocation/freespace_allocator_base.h>
 #include <panoptic_mapping/submap_allocation/submap_allocator_base.h>
 
+#include "panoptic_mapping_ros/conversions/conversions.h"
+
 namespace panoptic_mapping {
 
+namespace {
+
+// The printing settings of config_utilities are global. Apply the settings of
+// one mapper only while it prints its configs and restore the previous ones
+// afterwards, such that mappers in the same process do not interfere.
+class ScopedPrintSettings {
+ public:
+  ScopedPrintSettings(bool indicate_default_values, bool indicate_units)
+      : previous_indicate_default_values_(
+            config_utilities::GlobalSettings().indicate_default_values),
+        previous_indicate_units_(
+            config_utilities::GlobalSettings().indicate_units) {
+    config_utilities::GlobalSettings().indicate_default_values =
+        indicate_default_values;
+    config_utilities::GlobalSettings().indicate_units = indicate_units;
+  }
+  ~ScopedPrintSettings() {
+    config_utilities::GlobalSettings().indicate_default_values =
+        previous_indicate_default_values_;
+    config_utilities::GlobalSettings().indicate_units =
+        previous_indicate_units_;
+  }
+
+ private:
+  const bool previous_indicate_default_values_;
+  const bool previous_indicate_units_;
+};
+
+}  // namespace
+
 // Modules that don't have a default type will be required to be explicitly set.
 // Entries: <key, <ros_namespace, default type parameter>.
 const std::map<std::string, std::pair<std::string, std::string>>
@@ -29,13 +63,39 @@ const std::map<std::string, std::pair<std::string, std::string>>
         {"vis_submaps", {"visualization/submaps", "submaps"}},
         {"vis_tracking", {"visualization/tracking", ""}},
         {"vis_planning", {"visualization/planning", ""}},
-        {"data_writer", {"data_writer", "null"}}};
+        {"data_writer", {"data_writer", "null"}},
+        {"mesh_service", {"mesh_service", ""}},
+        {"checkpointer", {"checkpointer", ""}},
+        {"esdf", {"esdf", ""}},
+        {"voxel_state_map", {"voxel_state_map", ""}},
+        {"keyframe_selector", {"keyframe_selector", ""}},
+        {"submap_streamer", {"submap_streamer", ""}},
+        {"submap_stream_receiver", {"submap_stream_receiver", ""}},
+        {"region_sharding", {"region_sharding", ""}},
+        {"metrics", {"metrics", ""}},
+        {"shared_map_exporter", {"shared_map_exporter", ""}},
+        {"frame_log", {"frame_log", ""}},
+        {"quality_controller", {"quality_controller", ""}},
+        {"background_mesher", {"background_mesher", ""}}};
 
 void PanopticMapper::Config::checkParams() const {
   checkParamCond(!global_frame_name.empty(),
                  "'global_frame_name' may not be empty.");
   checkParamGT(ros_spinner_threads, 1, "ros_spinner_threads");
+  checkParamGT(thread_pool_threads, 0, "thread_pool_threads");
+  checkParamGE(thread_pool_priority, 0, "thread_pool_priority");
+  checkParamLE(thread_pool_priority, 99, "thread_pool_priority");
+  checkParamGE(pipeline_stage_priority, 0, "pipeline_stage_priority");
+  checkParamLE(pipeline_stage_priority, 99, "pipeline_stage_priority");
+  checkParamGE(max_pooled_blocks, 0, "max_pooled_blocks");
   checkParamGT(check_input_interval, 0.f, "check_input_interval");
+  checkParamGT(pipeline_queue_length, 0, "pipeline_queue_length");
+  checkParamGE(max_trace_spans, 0, "max_trace_spans");
+  checkParamCond(max_trace_spans == 0 || !trace_file_path.empty(),
+                 "'trace_file_path' must be set to record traces.");
+  checkParamCond(!use_visualization_thread || use_background_meshing,
+                 "'use_visualization_thread' requires "
+                 "'use_background_meshing'.");
 }
 
 void PanopticMapper::Config::setupParamsAndPrinting() {
@@ -44,16 +104,50 @@ void PanopticMapper::Config::setupParamsAndPrinting() {
   setupParam("visualization_interval", &visualization_interval, "s");
   setupParam("data_logging_interval", &data_logging_interval, "s");
   setupParam("print_timing_interval", &print_timing_interval, "s");
+  setupParam("print_memory_usage_interval", &print_memory_usage_interval, "s");
+  setupParam("checkpoint_interval", &checkpoint_interval, "s");
+  setupParam("submap_stream_interval", &submap_stream_interval, "s");
+  setupParam("metrics_interval", &metrics_interval, "s");
+  setupParam("shared_map_export_interval", &shared_map_export_interval, "s");
+  setupParam("submap_stream_source", &submap_stream_source);
+  setupParam("ingest_submap_streams", &ingest_submap_streams);
+  setupParam("publish_map_changes", &publish_map_changes);
   setupParam("use_threadsafe_submap_collection",
              &use_threadsafe_submap_collection);
+  setupParam("use_esdf", &use_esdf);
+  setupParam("use_voxel_state_map", &use_voxel_state_map);
+  setupParam("use_keyframe_selection", &use_keyframe_selection);
+  setupParam("record_frame_log", &record_frame_log);
   setupParam("ros_spinner_threads", &ros_spinner_threads);
+  setupParam("thread_pool_threads", &thread_pool_threads);
+  setupParam("thread_pool_cores", &thread_pool_cores);
+  setupParam("thread_pool_priority", &thread_pool_priority);
+  setupParam("thread_pool_numa_aware", &thread_pool_numa_aware);
+  setupParam("preprocessing_stage_cores", &preprocessing_stage_cores);
+  setupParam("mapping_stage_cores", &mapping_stage_cores);
+  setupParam("input_stage_cores", &input_stage_cores);
+  setupParam("visualization_stage_cores", &visualization_stage_cores);
+  setupParam("pipeline_stage_priority", &pipeline_stage_priority);
+  setupParam("max_pooled_blocks", &max_pooled_blocks);
   setupParam("check_input_interval", &check_input_interval, "s");
+  setupParam("use_event_driven_input", &use_event_driven_input);
   setupParam("load_submaps_conservative", &load_submaps_conservative);
   setupParam("loaded_freespace_stays_active", &loaded_freespace_stays_active);
+  setupParam("load_map_asynchronously", &load_map_asynchronously);
   setupParam("shutdown_when_finished", &shutdown_when_finished);
   setupParam("save_map_path_when_finished", &save_map_path_when_finished);
+  setupParam("visualize_when_finished", &visualize_when_finished);
+  setupParam("save_derived_data", &save_derived_data);
   setupParam("display_config_units", &display_config_units);
   setupParam("indicate_default_values", &indicate_default_values);
+  setupParam("use_pipelined_processing", &use_pipelined_processing);
+  setupParam("pipeline_queue_length", &pipeline_queue_length);
+  setupParam("max_trace_spans", &max_trace_spans);
+  setupParam("trace_file_path", &trace_file_path);
+  setupParam("use_performance_counters", &use_performance_counters);
+  setupParam("use_quality_control", &use_quality_control);
+  setupParam("use_background_meshing", &use_background_meshing);
+  setupParam("use_visualization_thread", &use_visualization_thread);
 }
 
 PanopticMapper::PanopticMapper(const ros::NodeHandle& nh,
@@ -63,26 +157,38 @@ PanopticMapper::PanopticMapper(const ros::NodeHandle& nh,
       config_(
           config_utilities::getConfigFromRos<PanopticMapper::Config>(nh_private)
               .checkValid()) {
-  // Setup printing of configs.
-  // NOTE(schmluk): These settings are global so multiple panoptic mappers in
-  // the same process might interfere.
-  config_utilities::GlobalSettings().indicate_default_values =
-      config_.indicate_default_values;
-  config_utilities::GlobalSettings().indicate_units =
-      config_.display_config_units;
+  // Setup printing of configs for the setup of this mapper.
+  const ScopedPrintSettings print_settings(config_.indicate_default_values,
+                                           config_.display_config_units);
   LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
 
   // Setup all components of the panoptic mapper.
   setupMembers();
+  setupPipeline();
   setupRos();
 }
 
+PanopticMapper::~PanopticMapper() {
+  stopInputProcessing();
+  stopPipeline();
+  if (config_.max_trace_spans > 0) {
+    saveTrace();
+  }
+}
+
 void PanopticMapper::setupMembers() {
+  // Tracing.
+  if (config_.max_trace_spans > 0) {
+    Tracer::getGlobalInstance()->enable(config_.max_trace_spans);
+  }
+  if (config_.use_performance_counters &&
+      !Timing::enablePerformanceCounters()) {
+    LOG(WARNING) << "Hardware performance counters are not available.";
+  }
+
   // Map.
   submaps_ = std::make_shared<SubmapCollection>();
-
-  // Threadsafe wrapper for the map.
-  thread_safe_submaps_ = std::make_shared<ThreadSafeSubmapCollection>(submaps_);
+  change_feed_ = std::make_shared<ChangeFeed>();
 
   // Camera.
   auto camera = std::make_shared<Camera>(
@@ -93,11 +199,38 @@ void PanopticMapper::setupMembers() {
       config_utilities::FactoryRos::create<LabelHandlerBase>(
           defaultNh("label_handler"));
 
-  // Setup the number of labels.
-  FixedCountVoxel::setNumCounts(label_handler->numberOfLabels());
+  // Thread pool shared by all modules.
+  ThreadPool* thread_pool = ThreadPool::getGlobalInstance();
+  thread_pool->setNumThreads(config_.thread_pool_threads);
+  thread_pool->setScheduling(config_.thread_pool_cores,
+                             config_.thread_pool_priority,
+                             config_.thread_pool_numa_aware);
+
+  // Recycling of removed TSDF blocks shared by all submaps.
+  BlockPool<TsdfVoxel>::getGlobalInstance()->setMaxBlocks(
+      config_.max_pooled_blocks);
+
+  // Meshing on demand of the tracker and visualization.
+  auto mesh_service = std::make_shared<MeshService>(
+      config_utilities::getConfigFromRos<MeshService::Config>(
+          defaultNh("mesh_service")));
+  if (config_.use_background_meshing) {
+    background_mesher_ = std::make_unique<BackgroundMesher>(
+        config_utilities::getConfigFromRos<BackgroundMesher::Config>(
+            defaultNh("background_mesher")));
+  }
+
+  // Adaptive quality to meet the frame deadline.
+  if (config_.use_quality_control) {
+    quality_controller_ = std::make_shared<QualityController>(
+        config_utilities::getConfigFromRos<QualityController::Config>(
+            defaultNh("quality_controller")));
+  }
 
   // Globals.
-  globals_ = std::make_shared<Globals>(camera, label_handler);
+  globals_ = std::make_shared<Globals>(camera, label_handler, thread_pool,
+                                       mesh_service, quality_controller_);
+  submaps_->setThreadPool(globals_->threadPool());
 
   // Submap Allocation.
   std::shared_ptr<SubmapAllocatorBase> submap_allocator =
@@ -120,6 +253,21 @@ void PanopticMapper::setupMembers() {
   // Map Manager.
   map_manager_ = config_utilities::FactoryRos::create<MapManagerBase>(
       defaultNh("map_management"));
+  map_manager_->setQualityController(quality_controller_);
+
+  // Keyframe selection.
+  if (config_.use_keyframe_selection) {
+    keyframe_selector_ = std::make_unique<KeyframeSelector>(
+        config_utilities::getConfigFromRos<KeyframeSelector::Config>(
+            defaultNh("keyframe_selector")));
+  }
+
+  // Frame recording.
+  if (config_.record_frame_log) {
+    frame_log_writer_ = std::make_unique<FrameLogWriter>(
+        config_utilities::getConfigFromRos<FrameLogWriter::Config>(
+            defaultNh("frame_log")));
+  }
 
   // Visualization.
   ros::NodeHandle visualization_nh(nh_private_, "visualization");
@@ -135,6 +283,16 @@ void PanopticMapper::setupMembers() {
           defaultNh("vis_tracking")));
   tracking_visualizer_->registerIDTracker(id_tracker_.get());
 
+  // The visualization thread works on snapshots, which do not record their
+  // changed blocks, so the changes are collected from the feed.
+  if (config_.use_visualization_thread) {
+    submap_visualizer_->setVisualizeSnapshots(true);
+    tracking_visualizer_->setQueueImages(true);
+    change_feed_->subscribe([this](const MapChangeSet& changes) {
+      visualization_changes_.merge(changes);
+    });
+  }
+
   // Planning.
   setupCollectionDependentMembers();
 
@@ -142,6 +300,52 @@ void PanopticMapper::setupMembers() {
   data_logger_ = config_utilities::FactoryRos::create<DataWriterBase>(
       defaultNh("data_writer"));
 
+  // Checkpointing.
+  if (config_.checkpoint_interval > 0.f) {
+    checkpointer_ = std::make_unique<MapCheckpointer>(
+        config_utilities::getConfigFromRos<MapCheckpointer::Config>(
+            defaultNh("checkpointer")));
+  }
+
+  // Metrics.
+  if (config_.metrics_interval > 0.f) {
+    metrics_exporter_ = std::make_unique<MetricsExporter>(
+        config_utilities::getConfigFromRos<MetricsExporter::Config>(
+            defaultNh("metrics")),
+        nh_private_);
+  }
+
+  // Shared memory export.
+  if (config_.shared_map_export_interval > 0.f) {
+    shared_map_exporter_ = std::make_unique<SharedMapExporter>(
+        config_utilities::getConfigFromRos<SharedMapExporter::Config>(
+            defaultNh("shared_map_exporter")));
+  }
+
+  // Submap streaming.
+  if (config_.submap_stream_interval > 0.f) {
+    region_sharding_ = std::make_unique<RegionSharding>(
+        config_utilities::getConfigFromRos<RegionSharding::Config>(
+            defaultNh("region_sharding")));
+    const int num_shards = region_sharding_->getConfig().num_shards;
+    const auto streamer_config =
+        config_utilities::getConfigFromRos<SubmapStreamer::Config>(
+            defaultNh("submap_streamer"));
+    for (int shard = 0; shard < num_shards; ++shard) {
+      submap_streamers_.emplace_back(
+          std::make_unique<SubmapStreamer>(streamer_config, shard == 0));
+      if (num_shards > 1) {
+        submap_streamers_.back()->setSubmapFilter(
+            [this, shard](const Submap& submap) {
+              return region_sharding_->submapIsInShard(submap, shard);
+            });
+      }
+    }
+  }
+  submap_stream_source_ = config_.submap_stream_source.empty()
+                              ? ros::this_node::getName()
+                              : config_.submap_stream_source;
+
   // Setup all requested inputs from all modules.
   InputData::InputTypes requested_inputs;
   std::vector<InputDataUser*> input_data_users = {
@@ -157,6 +361,9 @@ void PanopticMapper::setupMembers() {
   compute_validity_image_ =
       requested_inputs.find(InputData::InputType::kValidityImage) !=
       requested_inputs.end();
+  compute_range_image_ =
+      requested_inputs.find(InputData::InputType::kRangeImage) !=
+      requested_inputs.end();
 
   // Setup the input synchronizer.
   input_synchronizer_ = std::make_unique<InputSynchronizer>(
@@ -167,8 +374,40 @@ void PanopticMapper::setupMembers() {
 }
 
 void PanopticMapper::setupCollectionDependentMembers() {
+  // Report all changes of the map.
+  submaps_->setChangeFeed(change_feed_);
+
+  // Threadsafe wrapper for the map.
+  thread_safe_submaps_ = std::make_shared<ThreadSafeSubmapCollection>(submaps_);
+  map_manager_->setThreadSafeSubmapCollection(thread_safe_submaps_);
+
   // Planning Interface.
   planning_interface_ = std::make_shared<PlanningInterface>(submaps_);
+  if (config_.use_esdf) {
+    esdf_map_ = std::make_shared<EsdfMap>(
+        config_utilities::getConfigFromRos<EsdfMap::Config>(defaultNh("esdf")));
+    planning_interface_->setEsdfMap(esdf_map_);
+  }
+  if (config_.use_voxel_state_map) {
+    // The states are recomputed from the changes of every frame.
+    if (voxel_state_subscription_ >= 0) {
+      change_feed_->unsubscribe(voxel_state_subscription_);
+    }
+    voxel_state_map_ = std::make_shared<VoxelStateMap>(
+        config_utilities::getConfigFromRos<VoxelStateMap::Config>(
+            defaultNh("voxel_state_map")));
+    // In the pipeline the changes are processed with the planning update.
+    planning_changes_ = MapChangeSet();
+    voxel_state_subscription_ =
+        change_feed_->subscribe([this](const MapChangeSet& changes) {
+          if (config_.use_pipelined_processing) {
+            planning_changes_.merge(changes);
+          } else {
+            voxel_state_map_->processChanges(changes, *submaps_);
+          }
+        });
+    planning_interface_->setVoxelStateMap(voxel_state_map_);
+  }
 
   // Planning Visualizer.
   planning_visualizer_ = std::make_unique<PlanningVisualizer>(
@@ -187,13 +426,55 @@ void PanopticMapper::setupRos() {
       "save_map", &PanopticMapper::saveMapCallback, this);
   load_map_srv_ = nh_private_.advertiseService(
       "load_map", &PanopticMapper::loadMapCallback, this);
+  if (config_.load_map_asynchronously) {
+    get_load_map_status_srv_ = nh_private_.advertiseService(
+        "get_load_map_status", &PanopticMapper::getLoadMapStatusCallback,
+        this);
+  }
   set_visualization_mode_srv_ = nh_private_.advertiseService(
       "set_visualization_mode", &PanopticMapper::setVisualizationModeCallback,
       this);
   print_timings_srv_ = nh_private_.advertiseService(
       "print_timings", &PanopticMapper::printTimingsCallback, this);
+  print_memory_usage_srv_ = nh_private_.advertiseService(
+      "print_memory_usage", &PanopticMapper::printMemoryUsageCallback, this);
   finish_mapping_srv_ = nh_private_.advertiseService(
       "finish_mapping", &PanopticMapper::finishMappingCallback, this);
+  if (config_.max_trace_spans > 0) {
+    save_trace_srv_ = nh_private_.advertiseService(
+        "save_trace", &PanopticMapper::saveTraceCallback, this);
+  }
+  query_map_srv_ = nh_private_.advertiseService(
+      "query_map", &PanopticMapper::queryMapCallback, this);
+
+  // Submap streams. Newly connected receivers need all submaps.
+  for (size_t i = 0; i < submap_streamers_.size(); ++i) {
+    const std::string topic =
+        submap_streamers_.size() == 1
+            ? "submap_stream"
+            : "submap_stream/shard_" + std::to_string(i);
+    SubmapStreamer* streamer = submap_streamers_[i].get();
+    submap_stream_pubs_.push_back(
+        nh_private_.advertise<panoptic_mapping_msgs::SubmapStream>(
+            topic, 10, [streamer](const ros::SingleSubscriberPublisher&) {
+              streamer->requestFullMessage();
+            }));
+  }
+  if (config_.publish_map_changes) {
+    map_changes_pub_ =
+        nh_private_.advertise<panoptic_mapping_msgs::MapChanges>("map_changes",
+                                                                 100);
+    change_feed_->subscribe([this](const MapChangeSet& changes) {
+      panoptic_mapping_msgs::MapChanges msg = mapChangesToMsg(changes);
+      msg.header.stamp = ros::Time::now();
+      msg.header.frame_id = config_.global_frame_name;
+      map_changes_pub_.publish(msg);
+    });
+  }
+  if (config_.ingest_submap_streams) {
+    submap_stream_sub_ = nh_private_.subscribe(
+        "submap_stream_in", 100, &PanopticMapper::submapStreamCallback, this);
+  }
 
   // Timers.
   if (config_.visualization_interval > 0.0) {
@@ -211,20 +492,225 @@ void PanopticMapper::setupRos() {
         nh_private_.createTimer(ros::Duration(config_.print_timing_interval),
                                 &PanopticMapper::dataLoggingCallback, this);
   }
-  input_timer_ =
-      nh_private_.createTimer(ros::Duration(config_.check_input_interval),
-                              &PanopticMapper::inputCallback, this);
+  if (config_.print_memory_usage_interval > 0.0) {
+    print_memory_usage_timer_ = nh_private_.createTimer(
+        ros::Duration(config_.print_memory_usage_interval),
+        &PanopticMapper::printMemoryUsageCallback, this);
+  }
+  if (checkpointer_) {
+    checkpoint_timer_ =
+        nh_private_.createTimer(ros::Duration(config_.checkpoint_interval),
+                                &PanopticMapper::checkpointCallback, this);
+  }
+  if (!submap_streamers_.empty()) {
+    submap_stream_timer_ =
+        nh_private_.createTimer(ros::Duration(config_.submap_stream_interval),
+                                &PanopticMapper::streamSubmapsCallback, this);
+  }
+  if (metrics_exporter_) {
+    metrics_timer_ =
+        nh_private_.createTimer(ros::Duration(config_.metrics_interval),
+                                &PanopticMapper::metricsCallback, this);
+  }
+  if (shared_map_exporter_ && shared_map_exporter_->isOpen()) {
+    shared_map_export_timer_ = nh_private_.createTimer(
+        ros::Duration(config_.shared_map_export_interval),
+        &PanopticMapper::sharedMapExportCallback, this);
+  }
+  if (!config_.use_event_driven_input) {
+    input_timer_ =
+        nh_private_.createTimer(ros::Duration(config_.check_input_interval),
+                                &PanopticMapper::inputCallback, this);
+  }
+}
+
+void PanopticMapper::setupPipeline() {
+  if (config_.use_pipelined_processing) {
+    preprocessing_queue_ =
+        std::make_unique<BoundedQueue<std::shared_ptr<InputData>>>(
+            config_.pipeline_queue_length);
+    mapping_queue_ =
+        std::make_unique<BoundedQueue<std::shared_ptr<InputData>>>(
+            config_.pipeline_queue_length);
+    preprocessing_thread_ =
+        std::thread(&PanopticMapper::preprocessingStage, this);
+    mapping_thread_ = std::thread(&PanopticMapper::mappingStage, this);
+    thread_scheduling::configureThread(&preprocessing_thread_,
+                                       config_.preprocessing_stage_cores,
+                                       config_.pipeline_stage_priority,
+                                       "preprocessing");
+    thread_scheduling::configureThread(&mapping_thread_,
+                                       config_.mapping_stage_cores,
+                                       config_.pipeline_stage_priority,
+                                       "mapping");
+    if (config_.use_esdf || config_.use_voxel_state_map) {
+      planning_queue_ =
+          std::make_unique<BoundedQueue<std::shared_ptr<PlanningUpdate>>>(
+              config_.pipeline_queue_length);
+      planning_thread_ = std::thread(&PanopticMapper::planningStage, this);
+      thread_scheduling::configureThread(&planning_thread_, {},
+                                         config_.pipeline_stage_priority,
+                                         "planning");
+    }
+  }
+  if (config_.use_event_driven_input) {
+    input_thread_ = std::thread(&PanopticMapper::inputStage, this);
+    thread_scheduling::configureThread(&input_thread_,
+                                       config_.input_stage_cores,
+                                       config_.pipeline_stage_priority,
+                                       "input");
+  }
+  if (config_.use_visualization_thread) {
+    // Visualization is not time critical, so it uses default scheduling.
+    visualization_thread_ =
+        std::thread(&PanopticMapper::visualizationStage, this);
+    thread_scheduling::configureThread(&visualization_thread_,
+                                       config_.visualization_stage_cores, 0,
+                                       "visualization");
+  }
+}
+
+void PanopticMapper::inputStage() {
+  while (!input_synchronizer_->isClosed()) {
+    handleInput(
+        input_synchronizer_->waitForInputData(config_.check_input_interval));
+  }
+}
+
+void PanopticMapper::preprocessingStage() {
+  std::shared_ptr<InputData> input;
+  while (preprocessing_queue_->pop(&input)) {
+    preprocessInput(input.get());
+    if (!mapping_queue_->push(std::move(input))) {
+      break;
+    }
+  }
+}
+
+void PanopticMapper::mappingStage() {
+  std::shared_ptr<InputData> input;
+  while (mapping_queue_->pop(&input)) {
+    mapInput(input.get());
+  }
+}
+
+void PanopticMapper::planningStage() {
+  std::shared_ptr<PlanningUpdate> update;
+  while (planning_queue_->pop(&update)) {
+    Timer timer("input/planning_update");
+    std::lock_guard<std::mutex> lock(planning_mutex_);
+    if (update->esdf_map) {
+      update->esdf_map->update(*update->snapshot, update->esdf_blocks);
+    }
+    if (update->voxel_state_map) {
+      update->voxel_state_map->processChanges(update->changes,
+                                              *update->snapshot);
+      update->voxel_state_map->update(PlanningInterface(update->snapshot));
+    }
+  }
+}
+
+void PanopticMapper::visualizationStage() {
+  while (true) {
+    bool visualize_map;
+    {
+      std::unique_lock<std::mutex> lock(visualization_request_mutex_);
+      visualization_request_cv_.wait(lock, [this]() {
+        return visualization_requested_ || stop_visualization_;
+      });
+      if (stop_visualization_) {
+        return;
+      }
+      visualize_map = map_visualization_requested_;
+      visualization_requested_ = false;
+      map_visualization_requested_ = false;
+    }
+    tracking_visualizer_->publishQueuedImages();
+    if (visualize_map) {
+      visualizeSnapshot();
+    }
+  }
+}
+
+void PanopticMapper::requestVisualization(bool visualize_map) {
+  {
+    std::lock_guard<std::mutex> lock(visualization_request_mutex_);
+    visualization_requested_ = true;
+    map_visualization_requested_ |= visualize_map;
+  }
+  visualization_request_cv_.notify_one();
+}
+
+void PanopticMapper::stopInputProcessing() {
+  input_timer_.stop();
+  input_synchronizer_->close();
+  // The input thread itself may be shutting down the mapper.
+  if (input_thread_.joinable() &&
+      input_thread_.get_id() != std::this_thread::get_id()) {
+    input_thread_.join();
+  }
+}
+
+void PanopticMapper::stopPipeline() {
+  // Let the stages finish all queued frames in order.
+  if (preprocessing_queue_) {
+    preprocessing_queue_->close();
+  }
+  if (preprocessing_thread_.joinable()) {
+    preprocessing_thread_.join();
+  }
+  if (mapping_queue_) {
+    mapping_queue_->close();
+  }
+  if (mapping_thread_.joinable()) {
+    mapping_thread_.join();
+  }
+  if (planning_queue_) {
+    planning_queue_->close();
+  }
+  if (planning_thread_.joinable()) {
+    planning_thread_.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(visualization_request_mutex_);
+    stop_visualization_ = true;
+  }
+  visualization_request_cv_.notify_one();
+  if (visualization_thread_.joinable()) {
+    visualization_thread_.join();
+  }
 }
 
 void PanopticMapper::inputCallback(const ros::TimerEvent&) {
+  std::shared_ptr<InputData> data;
   if (input_synchronizer_->hasInputData()) {
-    std::shared_ptr<InputData> data = input_synchronizer_->getInputData();
-    if (data) {
+    data = input_synchronizer_->getInputData();
+    if (!data) {
+      return;
+    }
+  }
+  handleInput(std::move(data));
+}
+
+void PanopticMapper::handleInput(std::shared_ptr<InputData> data) {
+  // Asynchronously loaded maps are swapped in between frames.
+  if (config_.load_map_asynchronously) {
+    applyAsyncLoadedMap();
+  }
+  if (data) {
+    // Inputs are recorded before they are modified by the processing.
+    if (frame_log_writer_) {
+      frame_log_writer_->writeFrame(*data);
+    }
+    if (config_.use_pipelined_processing) {
+      // Blocks while the pipeline is saturated.
+      preprocessing_queue_->push(std::move(data));
+    } else {
       processInput(data.get());
-      if (config_.shutdown_when_finished) {
-        last_input_ = ros::Time::now();
-        got_a_frame_ = true;
-      }
+    }
+    if (config_.shutdown_when_finished) {
+      last_input_ = ros::Time::now();
+      got_a_frame_ = true;
     }
   } else {
     if (config_.shutdown_when_finished && got_a_frame_ &&
@@ -232,6 +718,8 @@ void PanopticMapper::inputCallback(const ros::TimerEvent&) {
       // No more frames, finish up.
       LOG_IF(INFO, config_.verbosity >= 1)
           << "No more frames received for 3 seconds, shutting down.";
+      stopInputProcessing();
+      stopPipeline();
       finishMapping();
       if (!config_.save_map_path_when_finished.empty()) {
         saveMap(config_.save_map_path_when_finished);
@@ -243,45 +731,162 @@ void PanopticMapper::inputCallback(const ros::TimerEvent&) {
 }
 
 void PanopticMapper::processInput(InputData* input) {
+  CHECK_NOTNULL(input);
+  preprocessInput(input);
+  mapInput(input);
+}
+
+void PanopticMapper::preprocessInput(InputData* input) {
+  CHECK_NOTNULL(input);
+  Tracer::setThreadFrame(num_preprocessed_frames_++);
+  Timer timer("input/preprocessing");
+
+  // Compute and store the validity image, vertex map, and range image in a
+  // single pass. The derived images are taken from a pool of buffers that are
+  // reused once previous inputs were released.
+  if (!compute_validity_image_ && !compute_vertex_map_ &&
+      !compute_range_image_) {
+    return;
+  }
+  const ros::WallTime t0 = ros::WallTime::now();
+  Timer derived_timer("input/compute_derived_images");
+  computeDerivedImages(input, *globals_->camera());
+  for (const InputData::AdditionalView& view : input->additionalViews()) {
+    computeDerivedImages(view.input.get(), *view.camera);
+  }
+  if (metrics_exporter_) {
+    metrics_exporter_->recordLatency(
+        "preprocessing", (ros::WallTime::now() - t0).toSec());
+  }
+}
+
+void PanopticMapper::computeDerivedImages(InputData* input,
+                                          const Camera& camera) {
+  CHECK_NOTNULL(input);
+  const cv::Mat& depth_image = input->depthImage();
+  const int rows = depth_image.rows;
+  const int cols = depth_image.cols;
+  cv::Mat validity_image;
+  cv::Mat vertex_map;
+  cv::Mat range_image;
+  if (compute_validity_image_) {
+    validity_image = image_buffer_pool_.get(rows, cols, CV_8UC1);
+  }
+  if (compute_vertex_map_) {
+    vertex_map = image_buffer_pool_.get(rows, cols, CV_32FC3);
+  }
+  if (compute_range_image_) {
+    range_image = image_buffer_pool_.get(rows, cols, CV_32FC1);
+  }
+  const float max_range_in_image = camera.computeDerivedImages(
+      depth_image, compute_vertex_map_ ? &vertex_map : nullptr,
+      compute_validity_image_ ? &validity_image : nullptr,
+      compute_range_image_ ? &range_image : nullptr, globals_->threadPool());
+  if (compute_validity_image_) {
+    input->setValidityImage(validity_image);
+  }
+  if (compute_vertex_map_) {
+    input->setVertexMap(vertex_map);
+  }
+  if (compute_range_image_) {
+    input->setRangeImage(range_image, max_range_in_image);
+  }
+}
+
+void PanopticMapper::mapInput(InputData* input) {
   CHECK_NOTNULL(input);
   Timer timer("input");
   frame_timer_ = std::make_unique<Timer>("frame");
+  // Frames are mapped in the order they were preprocessed, so the sequence
+  // numbers of both stages match.
+  Tracer::getGlobalInstance()->setFrame(num_mapped_frames_);
+  Tracer::setThreadFrame(num_mapped_frames_);
+  num_mapped_frames_++;
+
+  // Decide how much of the frame to process.
+  KeyframeSelector::Decision decision = KeyframeSelector::Decision::kKeyframe;
+  if (keyframe_selector_) {
+    decision =
+        keyframe_selector_->processInput(*input, getProcessingBacklog());
+    if (decision == KeyframeSelector::Decision::kSkip) {
+      num_skipped_frames_++;
+      return;
+    }
+  }
+  const bool integrate = decision == KeyframeSelector::Decision::kKeyframe;
+  ros::WallTime t0, t1, t2, t3;
+  std::shared_ptr<PlanningUpdate> planning_update;
+  {
+    // The mapping stages have exclusive access to the submap collection.
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    t0 = ros::WallTime::now();
+
+    // Track the segmentation images and allocate new submaps.
+    Timer id_timer("input/id_tracking");
+    id_tracker_->processInput(submaps_.get(), input);
+    t1 = ros::WallTime::now();
+    id_timer.Stop();
+    if (config_.use_visualization_thread) {
+      // Applied with the next visualized snapshot.
+      view_position_M_ = input->T_M_C().getPosition();
+      has_view_position_ = true;
+    } else {
+      submap_visualizer_->setViewPosition(input->T_M_C().getPosition());
+    }
 
-  // Compute and store the validity image.
-  if (compute_validity_image_) {
-    Timer validity_timer("input/compute_validity_image");
-    input->setValidityImage(
-        globals_->camera()->computeValidityImage(input->depthImage()));
+    // Integrate the images.
+    if (integrate) {
+      Timer tsdf_timer("input/tsdf_integration");
+      tsdf_integrator_->processInput(submaps_.get(), input);
+    }
+    t2 = ros::WallTime::now();
+
+    // Take over the meshes of the previous frame before submaps are finished.
+    if (background_mesher_) {
+      background_mesher_->synchronize(submaps_.get());
+    }
+
+    // Perform all requested map management actions.
+    Timer management_timer("input/map_management");
+    map_manager_->tick(submaps_.get());
+    t3 = ros::WallTime::now();
+    management_timer.Stop();
+    if (quality_controller_) {
+      quality_controller_->recordFrame((t1 - t0).toSec() * 1000.0,
+                                       (t2 - t1).toSec() * 1000.0,
+                                       (t3 - t2).toSec() * 1000.0);
+    }
+
+    // Update the distance field for planning.
+    if (esdf_map_ && integrate && !planning_queue_) {
+      esdf_map_->update(submaps_.get());
+    }
+
+    // Mesh the blocks of this frame while the next one is integrated.
+    if (background_mesher_) {
+      background_mesher_->capture(submaps_.get());
+    }
+
+    // Emit the changes of this frame.
+    change_feed_->publish();
+    if (planning_queue_) {
+      planning_update = takePlanningUpdate(integrate);
+    } else if (voxel_state_map_) {
+      voxel_state_map_->update(*planning_interface_);
+    }
   }
 
-  // Compute and store the vertex map.
-  if (compute_vertex_map_) {
-    Timer vertex_timer("input/compute_vertex_map");
-    input->setVertexMap(
-        globals_->camera()->computeVertexMap(input->depthImage()));
-  }
-  ros::WallTime t0 = ros::WallTime::now();
-
-  // Track the segmentation images and allocate new submaps.
-  Timer id_timer("input/id_tracking");
-  id_tracker_->processInput(submaps_.get(), input);
-  ros::WallTime t1 = ros::WallTime::now();
-  id_timer.Stop();
-
-  // Integrate the images.
-  Timer tsdf_timer("input/tsdf_integration");
-  tsdf_integrator_->processInput(submaps_.get(), input);
-  ros::WallTime t2 = ros::WallTime::now();
-  tsdf_timer.Stop();
-
-  // Perform all requested map management actions.
-  Timer management_timer("input/map_management");
-  map_manager_->tick(submaps_.get());
-  ros::WallTime t3 = ros::WallTime::now();
-  management_timer.Stop();
-
-  // If requested perform visualization and logging.
-  if (config_.visualization_interval < 0.f) {
+  // The planning maps are updated from the snapshot while the next frame is
+  // tracked. Blocks if the planning stage falls behind.
+  if (planning_update) {
+    planning_queue_->push(std::move(planning_update));
+  }
+
+  // If requested perform visualization and logging. The thread publishes the
+  // tracking images of every frame.
+  if (config_.use_visualization_thread) {
+    requestVisualization(config_.visualization_interval < 0.f);
+  } else if (config_.visualization_interval < 0.f) {
     Timer vis_timer("input/visualization");
     publishVisualizationCallback(ros::TimerEvent());
   }
@@ -292,13 +897,24 @@ void PanopticMapper::processInput(InputData* input) {
 
   // If requested update the thread_safe_submaps.
   if (config_.use_threadsafe_submap_collection) {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
     thread_safe_submaps_->update();
   }
 
   // Logging.
   timer.Stop();
+  if (metrics_exporter_) {
+    metrics_exporter_->recordFrame();
+    metrics_exporter_->recordLatency("tracking", (t1 - t0).toSec());
+    if (integrate) {
+      metrics_exporter_->recordLatency("integration", (t2 - t1).toSec());
+    }
+    metrics_exporter_->recordLatency("management", (t3 - t2).toSec());
+    metrics_exporter_->recordLatency("visualization", (t4 - t3).toSec());
+    metrics_exporter_->recordLatency("total", (t4 - t0).toSec());
+  }
   std::stringstream info;
-  info << "Processed input data.";
+  info << (integrate ? "Processed input data." : "Tracked input data.");
   if (config_.verbosity >= 3) {
     info << "\n(tracking: " << int((t1 - t0).toSec() * 1000)
          << " + integration: " << int((t2 - t1).toSec() * 1000)
@@ -316,31 +932,193 @@ void PanopticMapper::processInput(InputData* input) {
   LOG_IF(INFO, config_.print_timing_interval < 0.0) << "\n" << Timing::Print();
 }
 
+std::shared_ptr<PanopticMapper::PlanningUpdate>
+PanopticMapper::takePlanningUpdate(bool update_esdf) {
+  update_esdf &= static_cast<bool>(esdf_map_);
+  if (!update_esdf && !voxel_state_map_) {
+    return nullptr;
+  }
+  auto update = std::make_shared<PlanningUpdate>();
+  update->snapshot = thread_safe_submaps_->update();
+  if (update_esdf) {
+    update->esdf_map = esdf_map_;
+    update->esdf_blocks = EsdfMap::takeChangedBlocks(submaps_.get());
+  }
+  if (voxel_state_map_) {
+    update->voxel_state_map = voxel_state_map_;
+    update->changes = std::move(planning_changes_);
+    planning_changes_ = MapChangeSet();
+  }
+  return update;
+}
+
+size_t PanopticMapper::getProcessingBacklog() {
+  size_t backlog = input_synchronizer_->getNumberOfReadyInputs();
+  if (preprocessing_queue_) {
+    backlog += preprocessing_queue_->size();
+  }
+  if (mapping_queue_) {
+    backlog += mapping_queue_->size();
+  }
+  return backlog;
+}
+
 void PanopticMapper::finishMapping() {
-  map_manager_->finishMapping(submaps_.get());
-  submap_visualizer_->visualizeAll(submaps_.get());
+  {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    if (background_mesher_) {
+      background_mesher_->synchronize(submaps_.get());
+    }
+    tsdf_integrator_->finishIntegration(submaps_.get());
+    map_manager_->finishMapping(submaps_.get());
+    if (config_.visualize_when_finished &&
+        !config_.use_visualization_thread) {
+      submap_visualizer_->visualizeAll(submaps_.get());
+    }
+  }
+  // The visualization thread is already stopped when shutting down, so the
+  // final map is visualized directly.
+  if (config_.visualize_when_finished && config_.use_visualization_thread) {
+    if (visualization_thread_.joinable()) {
+      requestVisualization(true);
+    } else {
+      visualizeSnapshot();
+    }
+  }
   LOG_IF(INFO, config_.verbosity >= 2) << "Finished mapping.";
 }
 
 void PanopticMapper::publishVisualization() {
+  if (config_.use_visualization_thread) {
+    requestVisualization(true);
+    return;
+  }
   Timer timer("visualization");
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
   submap_visualizer_->visualizeAll(submaps_.get());
-  planning_visualizer_->visualizeAll();
+  std::lock_guard<std::mutex> planning_lock(planning_mutex_);
+  planning_visualizer_->visualizeAll(submaps_.get());
+}
+
+void PanopticMapper::visualizeSnapshot() {
+  Timer timer("visualization");
+  std::shared_ptr<const SubmapCollection> snapshot;
+  MapChangeSet changes;
+  Point view_position_M;
+  bool has_view_position;
+  int num_loaded_maps;
+  {
+    // The meshes of the map are taken over by the mapping, so they are not
+    // synchronized here to not wait for the background mesher.
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    snapshot = thread_safe_submaps_->update();
+    changes = std::move(visualization_changes_);
+    visualization_changes_ = MapChangeSet();
+    view_position_M = view_position_M_;
+    has_view_position = has_view_position_;
+    num_loaded_maps = num_loaded_maps_;
+  }
+  std::lock_guard<std::mutex> lock(visualizer_mutex_);
+  if (num_loaded_maps != num_loaded_maps_) {
+    // The map was replaced and is visualized with the next request.
+    return;
+  }
+  if (has_view_position) {
+    submap_visualizer_->setViewPosition(view_position_M);
+  }
+  submap_visualizer_->recordChanges(changes);
+  planning_visualizer_->recordChanges(changes);
+
+  // The visualizers only modify the published state of the snapshot meshes,
+  // which is not used by other readers of the snapshots.
+  SubmapCollection* submaps = const_cast<SubmapCollection*>(snapshot.get());
+  submap_visualizer_->visualizeAll(submaps);
+  planning_visualizer_->setPlanningInterface(
+      std::make_shared<PlanningInterface>(snapshot));
+  planning_visualizer_->visualizeAll(submaps);
 }
 
 bool PanopticMapper::saveMap(const std::string& file_path) {
-  bool success = submaps_->saveToFile(file_path);
-  LOG_IF(INFO, success) << "Successfully saved " << submaps_->size()
+  // Save a snapshot such that mapping can continue while writing.
+  std::shared_ptr<const SubmapCollection> snapshot = takeSnapshot();
+  bool success = snapshot->saveToFile(file_path, config_.save_derived_data);
+  LOG_IF(INFO, success) << "Successfully saved " << snapshot->size()
                         << " submaps to '" << file_path << "'.";
   return success;
 }
 
+void PanopticMapper::queryPlanningInterface(
+    const std::function<void(const PlanningInterface&)>& query) {
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  std::lock_guard<std::mutex> planning_lock(planning_mutex_);
+  query(*planning_interface_);
+}
+
+std::shared_ptr<const SubmapCollection> PanopticMapper::takeSnapshot() {
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  if (background_mesher_) {
+    background_mesher_->synchronize(submaps_.get());
+  }
+  return thread_safe_submaps_->update();
+}
+
 bool PanopticMapper::loadMap(const std::string& file_path) {
+  std::shared_ptr<SubmapCollection> loaded_map = prepareLoadedMap(file_path);
+  if (!loaded_map) {
+    return false;
+  }
+  setLoadedMap(std::move(loaded_map));
+  return true;
+}
+
+uint32_t PanopticMapper::loadMapAsync(const std::string& file_path) {
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  if (loading_map_.valid()) {
+    LOG(WARNING) << "Can not load '" << file_path
+                 << "' while loading another map.";
+    return 0;
+  }
+  current_load_id_++;
+  load_statuses_[current_load_id_] = LoadStatus::kLoading;
+  loading_map_ = std::async(std::launch::async, [this, file_path]() {
+    return prepareLoadedMap(file_path);
+  });
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Started loading '" << file_path << "' (load " << current_load_id_
+      << ").";
+  return current_load_id_;
+}
+
+void PanopticMapper::applyAsyncLoadedMap() {
+  std::shared_ptr<SubmapCollection> loaded_map;
+  uint32_t load_id;
+  {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (!loading_map_.valid() ||
+        loading_map_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+      return;
+    }
+    loaded_map = loading_map_.get();
+    load_id = current_load_id_;
+  }
+  const bool success = loaded_map != nullptr;
+  if (success) {
+    setLoadedMap(std::move(loaded_map));
+  }
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  load_statuses_[load_id] =
+      success ? LoadStatus::kSucceeded : LoadStatus::kFailed;
+}
+
+std::shared_ptr<SubmapCollection> PanopticMapper::prepareLoadedMap(
+    const std::string& file_path) const {
   auto loaded_map = std::make_shared<SubmapCollection>();
+  loaded_map->setThreadPool(globals_->threadPool());
 
   // Load the map.
   if (!loaded_map->loadFromFile(file_path, true)) {
-    return false;
+    return nullptr;
   }
 
   // Loaded submaps are 'from the past' so set them to inactive.
@@ -365,9 +1143,26 @@ bool PanopticMapper::loadMap(const std::string& file_path) {
   } else {
     loaded_map->setActiveFreeSpaceSubmapID(-1);
   }
+  return loaded_map;
+}
 
-  // Set the map.
-  submaps_ = loaded_map;
+void PanopticMapper::setLoadedMap(
+    std::shared_ptr<SubmapCollection> loaded_map) {
+  // Set the map. Ingested streams start over with a full message.
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  std::lock_guard<std::mutex> visualizer_lock(visualizer_mutex_);
+  num_loaded_maps_++;
+  visualization_changes_ = MapChangeSet();
+  for (const Submap& submap : *submaps_) {
+    change_feed_->recordSubmap(submap.getID(),
+                               ChangeFeed::SubmapChange::kRemoved);
+  }
+  submaps_->setChangeFeed(nullptr);
+  if (background_mesher_) {
+    background_mesher_->reset();
+  }
+  submaps_ = std::move(loaded_map);
+  submap_stream_receivers_.clear();
 
   // Setup the interfaces that use the new collection.
   setupCollectionDependentMembers();
@@ -375,14 +1170,20 @@ bool PanopticMapper::loadMap(const std::string& file_path) {
   // Reproduce the mesh and visualization.
   submap_visualizer_->clearMesh();
   submap_visualizer_->reset();
-  submap_visualizer_->visualizeAll(submaps_.get());
+  if (config_.use_visualization_thread) {
+    requestVisualization(true);
+  } else {
+    submap_visualizer_->visualizeAll(submaps_.get());
+  }
+
+  change_feed_->publish();
 
   LOG_IF(INFO, config_.verbosity >= 1)
       << "Successfully loaded " << submaps_->size() << " submaps.";
-  return true;
 }
 
 void PanopticMapper::dataLoggingCallback(const ros::TimerEvent&) {
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
   data_logger_->writeData(ros::Time::now().toSec(), *submaps_);
 }
 
@@ -396,6 +1197,7 @@ bool PanopticMapper::setVisualizationModeCallback(
   response.visualization_mode_set = false;
   response.color_mode_set = false;
   bool success = true;
+  std::unique_lock<std::mutex> visualizer_lock(visualizer_mutex_);
 
   // Set the visualization mode if requested.
   if (!request.visualization_mode.empty()) {
@@ -429,6 +1231,12 @@ bool PanopticMapper::setVisualizationModeCallback(
   }
 
   // Republish the visualization.
+  if (config_.use_visualization_thread) {
+    requestVisualization(true);
+    return success;
+  }
+  visualizer_lock.unlock();
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
   submap_visualizer_->visualizeAll(submaps_.get());
   return success;
 }
@@ -443,10 +1251,71 @@ bool PanopticMapper::saveMapCallback(
 bool PanopticMapper::loadMapCallback(
     panoptic_mapping_msgs::SaveLoadMap::Request& request,
     panoptic_mapping_msgs::SaveLoadMap::Response& response) {
-  response.success = loadMap(request.file_path);
+  if (config_.load_map_asynchronously) {
+    response.load_id = loadMapAsync(request.file_path);
+    response.success = response.load_id != 0;
+  } else {
+    response.success = loadMap(request.file_path);
+  }
   return response.success;
 }
 
+bool PanopticMapper::getLoadMapStatusCallback(
+    panoptic_mapping_msgs::GetLoadMapStatus::Request& request,
+    panoptic_mapping_msgs::GetLoadMapStatus::Response& response) {
+  std::lock_guard<std::mutex> lock(load_mutex_);
+  auto it = load_statuses_.find(request.load_id);
+  if (it == load_statuses_.end()) {
+    response.status = "unknown";
+  } else if (it->second == LoadStatus::kLoading) {
+    response.status = "loading";
+  } else if (it->second == LoadStatus::kSucceeded) {
+    response.status = "succeeded";
+  } else {
+    response.status = "failed";
+  }
+  return true;
+}
+
+bool PanopticMapper::queryMapCallback(
+    panoptic_mapping_msgs::QueryMap::Request& request,
+    panoptic_mapping_msgs::QueryMap::Response& response) {
+  Timer timer("query_map");
+  Pointcloud positions;
+  positions.reserve(request.points.size());
+  for (const geometry_msgs::Point& point : request.points) {
+    positions.emplace_back(point.x, point.y, point.z);
+  }
+
+  // Answer the queries on a snapshot so mapping is not blocked.
+  PlanningInterface planning_interface(takeSnapshot());
+  switch (request.query) {
+    case panoptic_mapping_msgs::QueryMap::Request::IS_OBSERVED: {
+      planning_interface.isObserved(positions, &response.observed,
+                                    request.include_inactive_maps);
+      return true;
+    }
+    case panoptic_mapping_msgs::QueryMap::Request::VOXEL_STATE: {
+      std::vector<PlanningInterface::VoxelState> states;
+      planning_interface.getVoxelStates(positions, &states);
+      response.voxel_states.reserve(states.size());
+      for (const PlanningInterface::VoxelState state : states) {
+        response.voxel_states.push_back(static_cast<uint8_t>(state));
+      }
+      return true;
+    }
+    case panoptic_mapping_msgs::QueryMap::Request::DISTANCE: {
+      planning_interface.getDistances(
+          positions, &response.distances, &response.observed,
+          request.consider_change_state, request.include_free_space);
+      return true;
+    }
+  }
+  LOG(WARNING) << "Unknown map query type "
+               << static_cast<int>(request.query) << ".";
+  return false;
+}
+
 bool PanopticMapper::printTimingsCallback(std_srvs::Empty::Request& request,
                                           std_srvs::Empty::Response& response) {
   printTimings();
@@ -459,6 +1328,150 @@ void PanopticMapper::printTimingsCallback(const ros::TimerEvent&) {
 
 void PanopticMapper::printTimings() const { LOG(INFO) << Timing::Print(); }
 
+bool PanopticMapper::saveTraceCallback(std_srvs::Empty::Request& request,
+                                       std_srvs::Empty::Response& response) {
+  return saveTrace();
+}
+
+bool PanopticMapper::saveTrace() const {
+  const Tracer* tracer = Tracer::getGlobalInstance();
+  if (!tracer->writeChromeTrace(config_.trace_file_path)) {
+    return false;
+  }
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Saved " << tracer->getNumberOfSpans() << " traced spans to '"
+      << config_.trace_file_path << "'.";
+  return true;
+}
+
+bool PanopticMapper::printMemoryUsageCallback(
+    std_srvs::Empty::Request& request, std_srvs::Empty::Response& response) {
+  printMemoryUsage();
+  return true;
+}
+
+void PanopticMapper::printMemoryUsageCallback(const ros::TimerEvent&) {
+  printMemoryUsage();
+}
+
+void PanopticMapper::metricsCallback(const ros::TimerEvent&) {
+  Timer timer("metrics");
+  int num_active = 0;
+  int num_inactive = 0;
+  size_t num_blocks = 0;
+  CollectionMemoryUsage memory;
+  {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    for (const Submap& submap : *submaps_) {
+      if (submap.isActive()) {
+        num_active++;
+      } else {
+        num_inactive++;
+      }
+      if (!submap.isEvicted()) {
+        num_blocks += submap.getTsdfLayer().getNumberOfAllocatedBlocks();
+      }
+    }
+    memory = submaps_->computeMemoryUsage();
+  }
+
+  // Map state.
+  metrics_exporter_->setGauge("submaps", num_active, "state=\"active\"");
+  metrics_exporter_->setGauge("submaps", num_inactive, "state=\"inactive\"");
+  metrics_exporter_->setGauge("evicted_submaps", memory.num_evicted_submaps);
+  metrics_exporter_->setGauge("allocated_blocks", num_blocks);
+  const std::pair<std::string, size_t> layers[] = {
+      {"tsdf", memory.total.tsdf},
+      {"classification", memory.total.classification},
+      {"mesh", memory.total.mesh},
+      {"iso_surface_points", memory.total.iso_surface_points},
+      {"overhead", memory.total.overhead}};
+  for (const auto& layer : layers) {
+    metrics_exporter_->setGauge("memory_bytes", layer.second,
+                                "layer=\"" + layer.first + "\"");
+  }
+
+  // Input processing. Report a warning if inputs were dropped since the last
+  // export.
+  const InputSynchronizer::QueueStatistics queue =
+      input_synchronizer_->getQueueStatistics();
+  const uint64_t num_dropped = queue.num_dropped;
+  metrics_exporter_->setCounter("dropped_inputs_total", num_dropped);
+  metrics_exporter_->setCounter("late_messages_total",
+                                queue.num_late_messages);
+  metrics_exporter_->setGauge("input_queue_length", queue.num_queued);
+  metrics_exporter_->setGauge("input_queue_bytes", queue.num_bytes);
+  metrics_exporter_->setGauge("input_backpressure", queue.backpressure);
+  metrics_exporter_->setCounter("skipped_frames_total", num_skipped_frames_);
+  metrics_exporter_->setGauge("input_backlog", getProcessingBacklog());
+  std::string warning;
+  if (num_dropped > num_reported_dropped_inputs_) {
+    warning = "Dropped " +
+              std::to_string(num_dropped - num_reported_dropped_inputs_) +
+              " inputs.";
+    num_reported_dropped_inputs_ = num_dropped;
+  }
+  metrics_exporter_->publish(warning);
+}
+
+void PanopticMapper::checkpointCallback(const ros::TimerEvent&) {
+  checkpointer_->writeCheckpointAsync(takeSnapshot());
+}
+
+void PanopticMapper::sharedMapExportCallback(const ros::TimerEvent&) {
+  shared_map_exporter_->exportSnapshot(*takeSnapshot());
+}
+
+void PanopticMapper::streamSubmapsCallback(const ros::TimerEvent&) {
+  // All shards are encoded from the same snapshot.
+  std::shared_ptr<const SubmapCollection> snapshot;
+  for (size_t i = 0; i < submap_streamers_.size(); ++i) {
+    if (submap_stream_pubs_[i].getNumSubscribers() == 0) {
+      continue;
+    }
+    if (!snapshot) {
+      snapshot = takeSnapshot();
+    }
+    SubmapStreamer& streamer = *submap_streamers_[i];
+    std::string data;
+    const uint64_t sequence_number = streamer.getSequenceNumber();
+    if (!streamer.encodeMessage(snapshot, &data)) {
+      continue;
+    }
+    panoptic_mapping_msgs::SubmapStream msg;
+    msg.header.stamp = ros::Time::now();
+    msg.header.frame_id = config_.global_frame_name;
+    msg.source = submap_stream_source_;
+    msg.sequence_number = sequence_number;
+    msg.data.assign(data.begin(), data.end());
+    submap_stream_pubs_[i].publish(msg);
+  }
+}
+
+void PanopticMapper::submapStreamCallback(
+    const panoptic_mapping_msgs::SubmapStream::ConstPtr& msg) {
+  if (msg->source == submap_stream_source_) {
+    return;
+  }
+  Timer timer("input/submap_stream");
+  const std::string data(msg->data.begin(), msg->data.end());
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  std::unique_ptr<SubmapStreamReceiver>& receiver =
+      submap_stream_receivers_[msg->source];
+  if (!receiver) {
+    receiver = std::make_unique<SubmapStreamReceiver>(
+        config_utilities::getConfigFromRos<SubmapStreamReceiver::Config>(
+            defaultNh("submap_stream_receiver")),
+        submap_stream_receivers_.size() == 1);
+  }
+  receiver->applyMessage(data, submaps_.get());
+}
+
+void PanopticMapper::printMemoryUsage() {
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  LOG(INFO) << submaps_->computeMemoryUsage().toString();
+}
+
 bool PanopticMapper::finishMappingCallback(
     std_srvs::Empty::Request& request, std_srvs::Empty::Response& response) {
   finishMapping();
@@ -0,0 +1,290 @@
+#include "panoptic_mapping_ros/tools/metrics_exporter.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+namespace panoptic_mapping {
+
+const std::vector<double> MetricsExporter::kQuantiles = {0.5, 0.95, 0.99};
+
+void MetricsExporter::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("publish_diagnostics", &publish_diagnostics);
+  setupParam("diagnostics_name", &diagnostics_name);
+  setupParam("hardware_id", &hardware_id);
+  setupParam("prometheus_port", &prometheus_port);
+  setupParam("latency_window", &latency_window);
+  setupParam("frame_rate_window", &frame_rate_window, "s");
+}
+
+void MetricsExporter::Config::checkParams() const {
+  checkParamGE(prometheus_port, 0, "prometheus_port");
+  checkParamCond(prometheus_port <= 65535,
+                 "'prometheus_port' must be a valid port.");
+  checkParamGT(latency_window, 0, "latency_window");
+  checkParamGT(frame_rate_window, 0.f, "frame_rate_window");
+}
+
+MetricsExporter::MetricsExporter(const Config& config,
+                                 const ros::NodeHandle& nh)
+    : config_(config.checkValid()), nh_(nh) {
+  LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
+  if (config_.publish_diagnostics) {
+    diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>(
+        "/diagnostics", 10);
+  }
+  if (config_.prometheus_port <= 0) {
+    return;
+  }
+
+  // Setup the Prometheus endpoint.
+  server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (server_socket_ < 0) {
+    LOG(ERROR) << "Could not create the metrics socket: "
+               << std::strerror(errno);
+    return;
+  }
+  const int reuse = 1;
+  setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(static_cast<uint16_t>(config_.prometheus_port));
+  if (bind(server_socket_, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) < 0 ||
+      listen(server_socket_, 4) < 0) {
+    LOG(ERROR) << "Could not serve metrics on port " << config_.prometheus_port
+               << ": " << std::strerror(errno);
+    close(server_socket_);
+    server_socket_ = -1;
+    return;
+  }
+  http_thread_ = std::thread(&MetricsExporter::serveHttp, this);
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Serving Prometheus metrics on port " << config_.prometheus_port
+      << ".";
+}
+
+MetricsExporter::~MetricsExporter() {
+  stop_http_ = true;
+  if (http_thread_.joinable()) {
+    http_thread_.join();
+  }
+  if (server_socket_ >= 0) {
+    close(server_socket_);
+  }
+}
+
+void MetricsExporter::recordFrame() {
+  const double now = ros::WallTime::now().toSec();
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_frames_++;
+  frame_times_.push_back(now);
+  while (!frame_times_.empty() &&
+         frame_times_.front() < now - config_.frame_rate_window) {
+    frame_times_.pop_front();
+  }
+}
+
+void MetricsExporter::recordLatency(const std::string& stage,
+                                    double seconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LatencyWindow& window = latencies_[stage];
+  if (window.samples.size() < static_cast<size_t>(config_.latency_window)) {
+    window.samples.push_back(seconds);
+  } else {
+    window.samples[window.next] = seconds;
+    window.next = (window.next + 1) % window.samples.size();
+  }
+  window.count++;
+  window.sum += seconds;
+}
+
+void MetricsExporter::setGauge(const std::string& name, double value,
+                               const std::string& labels) {
+  setValue(name, labels, value, false);
+}
+
+void MetricsExporter::setCounter(const std::string& name, double value,
+                                 const std::string& labels) {
+  setValue(name, labels, value, true);
+}
+
+void MetricsExporter::setValue(const std::string& name,
+                               const std::string& labels, double value,
+                               bool is_counter) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Value& entry = values_[{name, labels}];
+  entry.value = value;
+  entry.is_counter = is_counter;
+}
+
+double MetricsExporter::computeFrameRate(double now) const {
+  // Frames within the window, the window is shorter at startup.
+  const auto first = std::lower_bound(frame_times_.begin(), frame_times_.end(),
+                                      now - config_.frame_rate_window);
+  const size_t num_frames = std::distance(first, frame_times_.end());
+  if (num_frames < 2) {
+    return 0.0;
+  }
+  const double duration = now - *first;
+  return duration > 0.0 ? static_cast<double>(num_frames - 1) / duration : 0.0;
+}
+
+void MetricsExporter::publish(const std::string& warning) {
+  const double now = ros::WallTime::now().toSec();
+  std::lock_guard<std::mutex> lock(mutex_);
+  const double frame_rate = computeFrameRate(now);
+  if (config_.prometheus_port > 0) {
+    prometheus_text_ = toPrometheus(frame_rate);
+  }
+  if (!config_.publish_diagnostics) {
+    return;
+  }
+
+  // Diagnostics.
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = config_.diagnostics_name;
+  status.hardware_id = config_.hardware_id;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  std::stringstream message;
+  message << "Mapping at " << std::fixed << std::setprecision(1) << frame_rate
+          << " Hz.";
+  if (!warning.empty()) {
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    message << " " << warning;
+  }
+  status.message = message.str();
+  auto add = [&status](const std::string& key, double value) {
+    diagnostic_msgs::KeyValue entry;
+    entry.key = key;
+    std::stringstream ss;
+    ss << value;
+    entry.value = ss.str();
+    status.values.push_back(entry);
+  };
+  add("frame_rate [Hz]", frame_rate);
+  add("frames [1]", static_cast<double>(num_frames_));
+  for (const auto& value : values_) {
+    add(value.first.first +
+            (value.first.second.empty() ? "" : "{" + value.first.second + "}"),
+        value.second.value);
+  }
+  for (const auto& stage : latencies_) {
+    std::vector<double> samples = stage.second.samples;
+    for (const double quantile : kQuantiles) {
+      const size_t index = std::min(
+          samples.size() - 1, static_cast<size_t>(quantile * samples.size()));
+      std::nth_element(samples.begin(), samples.begin() + index,
+                       samples.end());
+      std::stringstream key;
+      key << "latency/" << stage.first << "/p"
+          << static_cast<int>(quantile * 100.0) << " [ms]";
+      add(key.str(), samples[index] * 1000.0);
+    }
+  }
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now();
+  msg.status.push_back(status);
+  diagnostics_pub_.publish(msg);
+}
+
+std::string MetricsExporter::toPrometheus(double frame_rate) const {
+  std::stringstream ss;
+  ss << "# TYPE " << kPrefix << "frame_rate_hz gauge\n"
+     << kPrefix << "frame_rate_hz " << frame_rate << "\n";
+  ss << "# TYPE " << kPrefix << "frames_total counter\n"
+     << kPrefix << "frames_total " << num_frames_ << "\n";
+  std::string previous_name;
+  for (const auto& value : values_) {
+    const std::string& name = value.first.first;
+    if (name != previous_name) {
+      ss << "# TYPE " << kPrefix << name << " "
+         << (value.second.is_counter ? "counter" : "gauge") << "\n";
+      previous_name = name;
+    }
+    ss << kPrefix << name;
+    if (!value.first.second.empty()) {
+      ss << "{" << value.first.second << "}";
+    }
+    ss << " " << value.second.value << "\n";
+  }
+  if (!latencies_.empty()) {
+    const std::string name = std::string(kPrefix) + "stage_latency_seconds";
+    ss << "# TYPE " << name << " summary\n";
+    for (const auto& stage : latencies_) {
+      std::vector<double> samples = stage.second.samples;
+      for (const double quantile : kQuantiles) {
+        const size_t index = std::min(
+            samples.size() - 1, static_cast<size_t>(quantile * samples.size()));
+        std::nth_element(samples.begin(), samples.begin() + index,
+                         samples.end());
+        ss << name << "{stage=\"" << stage.first << "\",quantile=\""
+           << quantile << "\"} " << samples[index] << "\n";
+      }
+      ss << name << "_sum{stage=\"" << stage.first << "\"} "
+         << stage.second.sum << "\n";
+      ss << name << "_count{stage=\"" << stage.first << "\"} "
+         << stage.second.count << "\n";
+    }
+  }
+  return ss.str();
+}
+
+void MetricsExporter::serveHttp() {
+  // Minimal HTTP server that answers every request with the metrics.
+  while (!stop_http_) {
+    pollfd server{server_socket_, POLLIN, 0};
+    if (poll(&server, 1, 200) <= 0) {
+      continue;
+    }
+    const int client = accept(server_socket_, nullptr, nullptr);
+    if (client < 0) {
+      continue;
+    }
+    // Read the request header, its content is not needed.
+    char buffer[1024];
+    pollfd request{client, POLLIN, 0};
+    if (poll(&request, 1, 1000) > 0) {
+      const ssize_t unused = recv(client, buffer, sizeof(buffer), 0);
+      (void)unused;
+    }
+    std::string body;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      body = prometheus_text_;
+    }
+    std::stringstream response;
+    response << "HTTP/1.1 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    const std::string data = response.str();
+    size_t sent = 0;
+    while (sent < data.size()) {
+      const ssize_t count =
+          send(client, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (count <= 0) {
+        break;
+      }
+      sent += count;
+    }
+    close(client);
+  }
+}
+
+}  // namespace panoptic_mapping
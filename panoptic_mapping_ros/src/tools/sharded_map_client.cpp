@@ -0,0 +1,166 @@
+#include "panoptic_mapping_ros/tools/sharded_map_client.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include <panoptic_mapping/common/thread_pool.h>
+
+namespace panoptic_mapping {
+
+void ShardedMapClient::Config::checkParams() const {
+  checkParamGE(wait_for_services, 0.f, "wait_for_services");
+  checkParamConfig(sharding);
+}
+
+void ShardedMapClient::Config::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("shard_namespace_prefix", &shard_namespace_prefix);
+  setupParam("wait_for_services", &wait_for_services, "s");
+  setupParam("sharding", &sharding);
+}
+
+ShardedMapClient::ShardedMapClient(const Config& config,
+                                   const ros::NodeHandle& nh)
+    : config_(config.checkValid()), sharding_(config_.sharding), nh_(nh) {
+  LOG_IF(INFO, config_.verbosity >= 1) << "\n" << config_.toString();
+  for (int shard = 0; shard < config_.sharding.num_shards; ++shard) {
+    // Persistent connections avoid the connection setup for every batch.
+    clients_.push_back(nh_.serviceClient<panoptic_mapping_msgs::QueryMap>(
+        config_.shard_namespace_prefix + std::to_string(shard) + "/query_map",
+        true));
+    if (config_.wait_for_services > 0.f &&
+        !clients_.back().waitForExistence(
+            ros::Duration(config_.wait_for_services))) {
+      LOG_IF(WARNING, config_.verbosity >= 1)
+          << "Map query service '" << clients_.back().getService()
+          << "' is not available.";
+    }
+  }
+}
+
+bool ShardedMapClient::isObserved(const Pointcloud& positions,
+                                  std::vector<uint8_t>* observed,
+                                  bool include_inactive_maps) {
+  CHECK_NOTNULL(observed);
+  panoptic_mapping_msgs::QueryMap::Request request;
+  request.query = panoptic_mapping_msgs::QueryMap::Request::IS_OBSERVED;
+  request.include_inactive_maps = include_inactive_maps;
+  std::vector<std::vector<size_t>> indices;
+  std::vector<panoptic_mapping_msgs::QueryMap::Response> responses;
+  const bool success = query(positions, request, &indices, &responses);
+  observed->assign(positions.size(), 0u);
+  for (size_t shard = 0; shard < indices.size(); ++shard) {
+    if (responses[shard].observed.size() != indices[shard].size()) {
+      continue;
+    }
+    for (size_t i = 0; i < indices[shard].size(); ++i) {
+      (*observed)[indices[shard][i]] = responses[shard].observed[i];
+    }
+  }
+  return success;
+}
+
+bool ShardedMapClient::getVoxelStates(
+    const Pointcloud& positions,
+    std::vector<PlanningInterface::VoxelState>* states) {
+  CHECK_NOTNULL(states);
+  panoptic_mapping_msgs::QueryMap::Request request;
+  request.query = panoptic_mapping_msgs::QueryMap::Request::VOXEL_STATE;
+  std::vector<std::vector<size_t>> indices;
+  std::vector<panoptic_mapping_msgs::QueryMap::Response> responses;
+  const bool success = query(positions, request, &indices, &responses);
+  states->assign(positions.size(), PlanningInterface::VoxelState::kUnknown);
+  for (size_t shard = 0; shard < indices.size(); ++shard) {
+    if (responses[shard].voxel_states.size() != indices[shard].size()) {
+      continue;
+    }
+    for (size_t i = 0; i < indices[shard].size(); ++i) {
+      (*states)[indices[shard][i]] = static_cast<PlanningInterface::VoxelState>(
+          responses[shard].voxel_states[i]);
+    }
+  }
+  return success;
+}
+
+bool ShardedMapClient::getDistances(const Pointcloud& positions,
+                                    std::vector<float>* distances,
+                                    std::vector<uint8_t>* observed,
+                                    bool consider_change_state,
+                                    bool include_free_space) {
+  CHECK_NOTNULL(distances);
+  CHECK_NOTNULL(observed);
+  panoptic_mapping_msgs::QueryMap::Request request;
+  request.query = panoptic_mapping_msgs::QueryMap::Request::DISTANCE;
+  request.consider_change_state = consider_change_state;
+  request.include_free_space = include_free_space;
+  std::vector<std::vector<size_t>> indices;
+  std::vector<panoptic_mapping_msgs::QueryMap::Response> responses;
+  const bool success = query(positions, request, &indices, &responses);
+  distances->assign(positions.size(), 0.f);
+  observed->assign(positions.size(), 0u);
+  for (size_t shard = 0; shard < indices.size(); ++shard) {
+    const panoptic_mapping_msgs::QueryMap::Response& response =
+        responses[shard];
+    if (response.distances.size() != indices[shard].size() ||
+        response.observed.size() != indices[shard].size()) {
+      continue;
+    }
+    for (size_t i = 0; i < indices[shard].size(); ++i) {
+      (*distances)[indices[shard][i]] = response.distances[i];
+      (*observed)[indices[shard][i]] = response.observed[i];
+    }
+  }
+  return success;
+}
+
+bool ShardedMapClient::query(
+    const Pointcloud& positions,
+    const panoptic_mapping_msgs::QueryMap::Request& request,
+    std::vector<std::vector<size_t>>* indices,
+    std::vector<panoptic_mapping_msgs::QueryMap::Response>* responses) {
+  Timer timer("sharded_map_client/query");
+  sharding_.splitByShard(positions, indices);
+  const size_t num_shards = indices->size();
+  responses->assign(num_shards, panoptic_mapping_msgs::QueryMap::Response());
+
+  // Call all involved shards concurrently.
+  std::vector<std::future<bool>> calls(num_shards);
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    if (indices->at(shard).empty()) {
+      continue;
+    }
+    panoptic_mapping_msgs::QueryMap::Request shard_request = request;
+    shard_request.points.reserve(indices->at(shard).size());
+    for (const size_t index : indices->at(shard)) {
+      geometry_msgs::Point point;
+      point.x = positions[index].x();
+      point.y = positions[index].y();
+      point.z = positions[index].z();
+      shard_request.points.push_back(point);
+    }
+    calls[shard] = ThreadPool::getGlobalInstance()->submit(
+        [this, shard, shard_request, responses]() mutable {
+          ros::ServiceClient& client = clients_[shard];
+          // Reconnect if a persistent connection was dropped.
+          if (!client.isValid()) {
+            client = nh_.serviceClient<panoptic_mapping_msgs::QueryMap>(
+                client.getService(), true);
+          }
+          return client.call(shard_request, (*responses)[shard]);
+        });
+  }
+  bool success = true;
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    if (calls[shard].valid() &&
+        !ThreadPool::getGlobalInstance()->wait(&calls[shard])) {
+      LOG_IF(WARNING, config_.verbosity >= 2)
+          << "Could not query map shard " << shard << " ('"
+          << clients_[shard].getService() << "').";
+      success = false;
+    }
+  }
+  return success;
+}
+
+}  // namespace panoptic_mapping
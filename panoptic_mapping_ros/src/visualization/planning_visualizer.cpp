@@ -1,14 +1,68 @@
 #include "panoptic_mapping_ros/visualization/planning_visualizer.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <limits>
 #include <memory>
-#include <numeric>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace panoptic_mapping {
+namespace {
+
+std_msgs::ColorRGBA stateToColor(PlanningInterface::VoxelState state) {
+  std_msgs::ColorRGBA color;
+  color.a = 0.6;
+  switch (state) {
+    case PlanningInterface::VoxelState::kUnknown: {
+      color.r = 0.7;
+      color.g = 0.7;
+      color.b = 0.7;
+      break;
+    }
+    case PlanningInterface::VoxelState::kKnownFree: {
+      color.r = 0.3;
+      color.g = 0.3;
+      color.b = 1.0;
+      break;
+    }
+    case PlanningInterface::VoxelState::kExpectedFree: {
+      color.r = 0.7;
+      color.g = 0.7;
+      color.b = 1.0;
+      break;
+    }
+    case PlanningInterface::VoxelState::kKnownOccupied: {
+      color.r = 1.0;
+      color.g = 0.3;
+      color.b = 0.3;
+      break;
+    }
+    case PlanningInterface::VoxelState::kPersistentOccupied: {
+      color.r = 1.0;
+      color.g = 0.7;
+      color.b = 0.3;
+      break;
+    }
+    case PlanningInterface::VoxelState::kExpectedOccupied: {
+      color.r = 1.0;
+      color.g = 0.7;
+      color.b = 0.7;
+      break;
+    }
+  }
+  return color;
+}
+
+// Floored integer division.
+int floorDivide(int value, int divisor) {
+  return value >= 0 ? value / divisor : (value - divisor + 1) / divisor;
+}
+
+}  // namespace
 
 void PlanningVisualizer::Config::checkParams() const {
   checkParamGT(slice_resolution, 0.f, "slice_resolution");
@@ -19,6 +73,7 @@ void PlanningVisualizer::Config::setupParamsAndPrinting() {
   setupParam("visualize_planning_slice", &visualize_planning_slice);
   setupParam("slice_resolution", &slice_resolution);
   setupParam("slice_height", &slice_height);
+  setupParam("only_update_changed_regions", &only_update_changed_regions);
 }
 
 void PlanningVisualizer::Config::fromRosParam() {
@@ -42,16 +97,35 @@ PlanningVisualizer::PlanningVisualizer(
   }
 }
 
-void PlanningVisualizer::visualizeAll() { visualizePlanningSlice(); }
+void PlanningVisualizer::visualizeAll(SubmapCollection* submaps) {
+  visualizePlanningSlice(submaps);
+}
 
-void PlanningVisualizer::visualizePlanningSlice() {
+void PlanningVisualizer::visualizePlanningSlice(SubmapCollection* submaps) {
   if (config_.visualize_planning_slice && slice_pub_.getNumSubscribers() > 0) {
-    visualization_msgs::Marker msg = generateSliceMsg();
+    visualization_msgs::Marker msg = generateSliceMsg(submaps);
     slice_pub_.publish(msg);
   }
 }
 
-visualization_msgs::Marker PlanningVisualizer::generateSliceMsg() {
+void PlanningVisualizer::recordChanges(const MapChangeSet& changes) {
+  if (!config_.only_update_changed_regions) {
+    return;
+  }
+  for (const auto& id_blocks_pair : changes.blocks) {
+    voxblox::IndexSet& blocks = recorded_blocks_[id_blocks_pair.first];
+    blocks.insert(id_blocks_pair.second.created.begin(),
+                  id_blocks_pair.second.created.end());
+    blocks.insert(id_blocks_pair.second.updated.begin(),
+                  id_blocks_pair.second.updated.end());
+  }
+  for (const int submap_id : changes.removed_submaps) {
+    recorded_blocks_.erase(submap_id);
+  }
+}
+
+visualization_msgs::Marker PlanningVisualizer::generateSliceMsg(
+    SubmapCollection* submaps) {
   // Setup the message.
   visualization_msgs::Marker marker;
   marker.header.frame_id = global_frame_name_;
@@ -90,106 +164,183 @@ visualization_msgs::Marker PlanningVisualizer::generateSliceMsg() {
     return marker;
   }
 
-  // Compute the resolution.
-  size_t x_steps = (x_max - x_min) / config_.slice_resolution;
-  size_t y_steps = (y_max - y_min) / config_.slice_resolution;
-  if (x_steps <= 0u || y_steps <= 0u) {
+  // Compute the cells of the slice, which are aligned with the origin such
+  // that they can be cached.
+  const float resolution = config_.slice_resolution;
+  const int x_begin = std::floor(x_min / resolution);
+  const int x_end = std::floor(x_max / resolution);
+  const int y_begin = std::floor(y_min / resolution);
+  const int y_end = std::floor(y_max / resolution);
+  if (x_end <= x_begin || y_end <= y_begin) {
     return marker;
   }
 
-  // General properties.
-  marker.points.reserve(x_steps * y_steps);
-  marker.colors.reserve(x_steps * y_steps);
+  // Drop the cached tiles that may have changed.
+  if (config_.only_update_changed_regions && submaps) {
+    invalidateChangedTiles(submaps);
+  } else {
+    tiles_.clear();
+  }
 
-  // If requested monitor querry time.
-  std::vector<float> times;
-  if (config_.verbosity >= 3) {
-    times.reserve(x_steps * y_steps);
+  // Look up the states of all missing tiles in a single batched query.
+  std::vector<BlockIndex> new_tiles;
+  Pointcloud positions;
+  const BlockIndex min_tile = getTileIndex(x_begin, y_begin);
+  const BlockIndex max_tile = getTileIndex(x_end - 1, y_end - 1);
+  for (int tile_x = min_tile.x(); tile_x <= max_tile.x(); ++tile_x) {
+    for (int tile_y = min_tile.y(); tile_y <= max_tile.y(); ++tile_y) {
+      const BlockIndex tile_index(tile_x, tile_y, 0);
+      if (tiles_.find(tile_index) != tiles_.end()) {
+        continue;
+      }
+      new_tiles.push_back(tile_index);
+      for (int x = 0; x < kTileSize_; ++x) {
+        for (int y = 0; y < kTileSize_; ++y) {
+          positions.emplace_back(
+              static_cast<float>(tile_x * kTileSize_ + x) * resolution,
+              static_cast<float>(tile_y * kTileSize_ + y) * resolution,
+              config_.slice_height);
+        }
+      }
+    }
+  }
+  if (!positions.empty()) {
+    auto t_start = std::chrono::high_resolution_clock::now();
+    std::vector<PlanningInterface::VoxelState> states;
+    planning_interface_->getVoxelStates(positions, &states);
+    auto t_end = std::chrono::high_resolution_clock::now();
+    constexpr size_t kCellsPerTile = kTileSize_ * kTileSize_;
+    for (size_t i = 0; i < new_tiles.size(); ++i) {
+      std::vector<uint8_t>& tile = tiles_[new_tiles[i]];
+      tile.reserve(kCellsPerTile);
+      for (size_t j = i * kCellsPerTile; j < (i + 1) * kCellsPerTile; ++j) {
+        tile.push_back(static_cast<uint8_t>(states[j]));
+      }
+    }
+    LOG_IF(INFO, config_.verbosity >= 3)
+        << "Map lookups of " << new_tiles.size() << " slice tiles based on "
+        << planning_interface_->getSubmapCollection().size()
+        << " submaps took "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(t_end -
+                                                                 t_start)
+               .count()
+        << "ms.";
   }
 
   // Generate all points.
-  for (size_t x = 0; x < x_steps; ++x) {
-    for (size_t y = 0; y < y_steps; ++y) {
-      Point position(x_min + static_cast<float>(x) * config_.slice_resolution,
-                     y_min + static_cast<float>(y) * config_.slice_resolution,
-                     config_.slice_height);
+  const size_t num_cells = static_cast<size_t>(x_end - x_begin) *
+                           static_cast<size_t>(y_end - y_begin);
+  marker.points.reserve(num_cells);
+  marker.colors.reserve(num_cells);
+  for (int x = x_begin; x < x_end; ++x) {
+    for (int y = y_begin; y < y_end; ++y) {
+      const BlockIndex tile_index = getTileIndex(x, y);
+      const std::vector<uint8_t>& tile = tiles_.at(tile_index);
+      const int tile_x = x - tile_index.x() * kTileSize_;
+      const int tile_y = y - tile_index.y() * kTileSize_;
+      const uint8_t state = tile[tile_x * kTileSize_ + tile_y];
       geometry_msgs::Point point;
-      point.x = position.x();
-      point.y = position.y();
-      point.z = position.z();
+      point.x = static_cast<float>(x) * resolution;
+      point.y = static_cast<float>(y) * resolution;
+      point.z = config_.slice_height;
       marker.points.emplace_back(point);
-      std_msgs::ColorRGBA color;
-      color.a = 0.6;
-      PlanningInterface::VoxelState state;
-      if (config_.verbosity >= 3) {
-        auto t_start = std::chrono::high_resolution_clock::now();
-        state = planning_interface_->getVoxelState(position);
-        auto t_end = std::chrono::high_resolution_clock::now();
-        times.emplace_back(
-            static_cast<float>(
-                std::chrono::duration_cast<std::chrono::nanoseconds>(t_end -
-                                                                     t_start)
-                    .count()) /
-            1000.f);
-      } else {
-        state = planning_interface_->getVoxelState(position);
+      marker.colors.emplace_back(
+          stateToColor(static_cast<PlanningInterface::VoxelState>(state)));
+    }
+  }
+  return marker;
+}
+
+void PlanningVisualizer::invalidateChangedTiles(SubmapCollection* submaps) {
+  std::unordered_set<int> submap_ids;
+  for (Submap& submap : *submaps) {
+    submap_ids.insert(submap.getID());
+    voxblox::IndexSet changed_blocks = submap.takeChangedBlocks(
+        Submap::ChangeConsumer::kPlanningVisualization);
+    auto recorded_it = recorded_blocks_.find(submap.getID());
+    if (recorded_it != recorded_blocks_.end()) {
+      changed_blocks.insert(recorded_it->second.begin(),
+                            recorded_it->second.end());
+    }
+    SubmapState state;
+    state.is_active = submap.isActive();
+    state.change_state = submap.getChangeState();
+    state.num_blocks = submap.getTsdfLayer().getNumberOfAllocatedBlocks();
+    state.T_M_S = submap.getT_M_S();
+    const Point center_M =
+        submap.getT_M_S() * submap.getBoundingVolume().getCenter();
+    const Point extent =
+        Point::Constant(submap.getBoundingVolume().getRadius());
+    state.min_M = center_M - extent;
+    state.max_M = center_M + extent;
+
+    // Changes that affect the whole submap. Removed blocks are not recorded
+    // as changed.
+    auto it = submap_states_.find(submap.getID());
+    if (it == submap_states_.end() ||
+        it->second.is_active != state.is_active ||
+        it->second.change_state != state.change_state ||
+        it->second.num_blocks > state.num_blocks ||
+        !it->second.T_M_S.getTransformationMatrix().isApprox(
+            state.T_M_S.getTransformationMatrix())) {
+      if (it != submap_states_.end()) {
+        invalidateTiles(it->second.min_M, it->second.max_M);
       }
-      switch (state) {
-        case PlanningInterface::VoxelState::kUnknown: {
-          color.r = 0.7;
-          color.g = 0.7;
-          color.b = 0.7;
-          break;
-        }
-        case PlanningInterface::VoxelState::kKnownFree: {
-          color.r = 0.3;
-          color.g = 0.3;
-          color.b = 1.0;
-          break;
-        }
-        case PlanningInterface::VoxelState::kExpectedFree: {
-          color.r = 0.7;
-          color.g = 0.7;
-          color.b = 1.0;
-          break;
-        }
-        case PlanningInterface::VoxelState::kKnownOccupied: {
-          color.r = 1.0;
-          color.g = 0.3;
-          color.b = 0.3;
-          break;
-        }
-        case PlanningInterface::VoxelState::kPersistentOccupied: {
-          color.r = 1.0;
-          color.g = 0.7;
-          color.b = 0.3;
-          break;
-        }
-        case PlanningInterface::VoxelState::kExpectedOccupied: {
-          color.r = 1.0;
-          color.g = 0.7;
-          color.b = 0.7;
-          break;
-        }
+      invalidateTiles(state.min_M, state.max_M);
+      submap_states_[submap.getID()] = state;
+      continue;
+    }
+    it->second = state;
+
+    // Changed blocks that intersect the slice.
+    const float block_size = submap.getTsdfLayer().block_size();
+    const float block_diag_half = std::sqrt(3.f) * block_size / 2.f;
+    for (const BlockIndex& index : changed_blocks) {
+      const Point block_center_M =
+          state.T_M_S *
+          ((index.cast<FloatingPoint>() + Point::Constant(0.5f)) * block_size);
+      if (std::abs(block_center_M.z() - config_.slice_height) <=
+          block_diag_half) {
+        invalidateTiles(block_center_M - Point::Constant(block_diag_half),
+                        block_center_M + Point::Constant(block_diag_half));
       }
-      marker.colors.emplace_back(color);
     }
   }
-  if (config_.verbosity >= 3 && !times.empty()) {
-    // Print timings.
-    const float mean =
-        std::accumulate(times.begin(), times.end(), 0.f) / times.size();
-    const float square_sum =
-        std::inner_product(times.begin(), times.end(), times.begin(), 0.f);
-    const float stddev = std::sqrt(square_sum / times.size() - mean * mean);
-    const float max = *std::max_element(times.begin(), times.end());
-    LOG(INFO) << "Map lookups based on "
-              << planning_interface_->getSubmapCollection().size()
-              << " submaps took " << std::fixed << std::setprecision(1) << mean
-              << "+/-" << std::fixed << std::setprecision(1) << stddev
-              << ", max " << std::fixed << std::setprecision(1) << max << "us.";
+
+  recorded_blocks_.clear();
+
+  // Removed submaps.
+  for (auto it = submap_states_.begin(); it != submap_states_.end();) {
+    if (submap_ids.find(it->first) == submap_ids.end()) {
+      invalidateTiles(it->second.min_M, it->second.max_M);
+      it = submap_states_.erase(it);
+    } else {
+      ++it;
+    }
   }
-  return marker;
+}
+
+void PlanningVisualizer::invalidateTiles(const Point& min_M,
+                                         const Point& max_M) {
+  if (min_M.z() > config_.slice_height || max_M.z() < config_.slice_height) {
+    return;
+  }
+  const BlockIndex min_tile =
+      getTileIndex(std::floor(min_M.x() / config_.slice_resolution),
+                   std::floor(min_M.y() / config_.slice_resolution));
+  const BlockIndex max_tile =
+      getTileIndex(std::floor(max_M.x() / config_.slice_resolution),
+                   std::floor(max_M.y() / config_.slice_resolution));
+  for (int x = min_tile.x(); x <= max_tile.x(); ++x) {
+    for (int y = min_tile.y(); y <= max_tile.y(); ++y) {
+      tiles_.erase(BlockIndex(x, y, 0));
+    }
+  }
+}
+
+BlockIndex PlanningVisualizer::getTileIndex(int cell_x, int cell_y) const {
+  return BlockIndex(floorDivide(cell_x, kTileSize_),
+                    floorDivide(cell_y, kTileSize_), 0);
 }
 
 }  // namespace panoptic_mapping
@@ -1,7 +1,10 @@
 #include "panoptic_mapping_ros/visualization/single_tsdf_visualizer.h"
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <memory>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -79,8 +82,10 @@ std::vector<voxblox_msgs::MultiMesh> SingleTsdfVisualizer::generateMeshMsgs(
   msg.header.frame_id = submap.getFrameName();
   msg.name_space = map_name_space_;
 
-  // Update the mesh.
-  submap.updateMesh(true, false);
+  // Update the mesh, snapshots are meshed by the owner of the map.
+  if (!visualize_snapshots_) {
+    submap.updateMesh(true, false);
+  }
 
   // Mark the whole mesh for re-publishing if requested.
   if (info_.republish_everything) {
@@ -114,6 +119,7 @@ std::vector<voxblox_msgs::MultiMesh> SingleTsdfVisualizer::generateMeshMsgs(
       mesh_block.index[1] = block_index.y();
       mesh_block.index[2] = block_index.z();
       msg.mesh.mesh_blocks.push_back(mesh_block);
+      color_tables_.erase(block_index);
     }
   }
   info_.previous_blocks = block_indices;
@@ -145,39 +151,68 @@ void SingleTsdfVisualizer::colorMeshBlock(const Submap& submap,
   const voxblox::BlockIndex block_index(
       mesh_block->index[0], mesh_block->index[1], mesh_block->index[2]);
   if (!submap.getClassLayer().hasBlock(block_index)) {
+    color_tables_.erase(block_index);
     return;
   }
 
   // Setup.
   const ClassBlock::ConstPtr class_block =
       submap.getClassLayer().getBlockConstPtrByIndex(block_index);
-  const float point_conv_factor = 2.f / std::numeric_limits<uint16_t>::max();
-  const float block_edge_length = submap.getClassLayer().block_size();
   const size_t num_vertices = mesh_block->x.size();
   mesh_block->r.resize(num_vertices);
   mesh_block->g.resize(num_vertices);
   mesh_block->b.resize(num_vertices);
 
-  // Coloring schemes.
-  std::function<Color(const ClassVoxel&)> get_color = getColoring();
-
-  for (int i = 0; i < num_vertices; ++i) {
-    // Get the vertex position in map frame.
-    const float mesh_x =
-        (static_cast<float>(mesh_block->x[i]) * point_conv_factor +
-         static_cast<float>(block_index[0])) *
-        block_edge_length;
-    const float mesh_y =
-        (static_cast<float>(mesh_block->y[i]) * point_conv_factor +
-         static_cast<float>(block_index[1])) *
-        block_edge_length;
-    const float mesh_z =
-        (static_cast<float>(mesh_block->z[i]) * point_conv_factor +
-         static_cast<float>(block_index[2])) *
-        block_edge_length;
-    const ClassVoxel& voxel =
-        class_block->getVoxelByCoordinates({mesh_x, mesh_y, mesh_z});
-    const Color color = get_color(voxel);
+  // Look up the voxel of every vertex if the mesh of the block changed.
+  BlockColorTable& table = color_tables_[block_index];
+  const uint64_t generation = submap.getMeshGeneration(block_index);
+  if (table.generation != generation ||
+      table.vertex_voxels.size() != num_vertices) {
+    table = BlockColorTable();
+    table.generation = generation;
+    table.vertex_voxels.resize(num_vertices);
+    // Vertex coordinates are quantized relative to the block origin in units
+    // of twice the block size.
+    const int voxels_per_side = submap.getClassLayer().voxels_per_side();
+    const float point_conv_factor = 2.f * voxels_per_side /
+                                    std::numeric_limits<uint16_t>::max();
+    auto voxel_index = [&](uint16_t coordinate) {
+      return std::clamp(
+          static_cast<int>(std::floor(coordinate * point_conv_factor)), 0,
+          voxels_per_side - 1);
+    };
+    std::unordered_map<size_t, uint32_t> table_indices;
+    for (size_t i = 0; i < num_vertices; ++i) {
+      const size_t linear_index =
+          voxel_index(mesh_block->x[i]) +
+          voxels_per_side * (voxel_index(mesh_block->y[i]) +
+                             voxels_per_side * voxel_index(mesh_block->z[i]));
+      const auto it =
+          table_indices.emplace(linear_index, table.voxels.size()).first;
+      if (it->second == table.voxels.size()) {
+        table.voxels.push_back(linear_index);
+      }
+      table.vertex_voxels[i] = it->second;
+    }
+  }
+
+  // Compute the voxel colors once per color mode.
+  auto colors_it = table.colors.find(color_mode_);
+  if (colors_it == table.colors.end()) {
+    const std::function<Color(const ClassVoxel&)> get_color = getColoring();
+    std::vector<Color> colors;
+    colors.reserve(table.voxels.size());
+    for (const size_t linear_index : table.voxels) {
+      colors.push_back(
+          get_color(class_block->getVoxelByLinearIndex(linear_index)));
+    }
+    colors_it = table.colors.emplace(color_mode_, std::move(colors)).first;
+  }
+
+  // Color the vertices.
+  const std::vector<Color>& colors = colors_it->second;
+  for (size_t i = 0; i < num_vertices; ++i) {
+    const Color& color = colors[table.vertex_voxels[i]];
     mesh_block->r[i] = color.r;
     mesh_block->g[i] = color.g;
     mesh_block->b[i] = color.b;
@@ -263,8 +298,9 @@ std::function<Color(const ClassVoxel&)> SingleTsdfVisualizer::getColoring()
 void SingleTsdfVisualizer::updateVisInfos(const SubmapCollection& submaps) {
   // Check whether the same submap collection is being visualized (cached
   // data).
-  if (previous_submaps_ != &submaps) {
+  if (previous_submaps_ != &submaps && !visualize_snapshots_) {
     reset();
+    color_tables_.clear();
     previous_submaps_ = &submaps;
   }
 }
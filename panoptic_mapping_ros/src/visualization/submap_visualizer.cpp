@@ -1,5 +1,8 @@
 #include "panoptic_mapping_ros/visualization/submap_visualizer.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <memory>
 #include <string>
 #include <utility>
@@ -10,6 +13,63 @@
 #include <voxblox_ros/ptcloud_vis.h>
 
 namespace panoptic_mapping {
+namespace {
+
+// Transform the triangles of a mesh message from submap into global frame.
+// Each triangle is binned into the block of its minimum corner, such that its
+// vertices stay within the range of two block sizes encoded in the message.
+void transformMeshMsg(const Transformation& T_M_S, voxblox_msgs::Mesh* mesh) {
+  const FloatingPoint block_size = mesh->block_edge_length;
+  const FloatingPoint block_size_inv = 1.f / block_size;
+  const FloatingPoint point_conv_factor =
+      2.f / std::numeric_limits<uint16_t>::max();
+  voxblox::AnyIndexHashMapType<voxblox_msgs::MeshBlock>::type blocks;
+  for (const voxblox_msgs::MeshBlock& block : mesh->mesh_blocks) {
+    const Point origin(block.index[0], block.index[1], block.index[2]);
+    const bool has_colors = block.r.size() == block.x.size();
+    for (size_t i = 0; i + 2 < block.x.size(); i += 3) {
+      Point vertices_M[3];
+      for (size_t j = 0; j < 3; ++j) {
+        const Point vertex_S =
+            (Point(block.x[i + j], block.y[i + j], block.z[i + j]) *
+                 point_conv_factor +
+             origin) *
+            block_size;
+        vertices_M[j] = T_M_S * vertex_S;
+      }
+      const BlockIndex index = voxblox::getGridIndexFromPoint<BlockIndex>(
+          vertices_M[0].cwiseMin(vertices_M[1]).cwiseMin(vertices_M[2]),
+          block_size_inv);
+      voxblox_msgs::MeshBlock& result = blocks[index];
+      for (size_t j = 0; j < 3; ++j) {
+        const Point position =
+            vertices_M[j] * block_size_inv - index.cast<FloatingPoint>();
+        result.x.push_back(
+            static_cast<uint16_t>(position.x() / point_conv_factor));
+        result.y.push_back(
+            static_cast<uint16_t>(position.y() / point_conv_factor));
+        result.z.push_back(
+            static_cast<uint16_t>(position.z() / point_conv_factor));
+        if (has_colors) {
+          result.r.push_back(block.r[i + j]);
+          result.g.push_back(block.g[i + j]);
+          result.b.push_back(block.b[i + j]);
+        }
+      }
+    }
+  }
+  mesh->mesh_blocks.clear();
+  mesh->mesh_blocks.reserve(blocks.size());
+  for (auto& index_block_pair : blocks) {
+    voxblox_msgs::MeshBlock& block = index_block_pair.second;
+    block.index[0] = index_block_pair.first.x();
+    block.index[1] = index_block_pair.first.y();
+    block.index[2] = index_block_pair.first.z();
+    mesh->mesh_blocks.push_back(std::move(block));
+  }
+}
+
+}  // namespace
 
 const Color SubmapVisualizer::kUnknownColor_(50, 50, 50);
 
@@ -19,6 +79,11 @@ config_utilities::Factory::RegistrationRos<SubmapVisualizer, SubmapVisualizer,
 
 void SubmapVisualizer::Config::checkParams() const {
   checkParamGT(submap_color_discretization, 0, "submap_color_discretization");
+  checkParamGT(free_space_voxel_stride, 0, "free_space_voxel_stride");
+  checkParamGE(max_pointcloud_distance, 0.f, "max_pointcloud_distance");
+  checkParamCond(
+      tf_mode == "dynamic" || tf_mode == "static" || tf_mode == "none",
+      "'tf_mode' must be 'dynamic', 'static', or 'none'.");
   // NOTE(schmluk): if the visualization or color mode is not valid it will be
   // defaulted to 'all' or 'color' and a warning will be raised.
 }
@@ -33,6 +98,13 @@ void SubmapVisualizer::Config::setupParamsAndPrinting() {
   setupParam("visualize_free_space", &visualize_free_space);
   setupParam("visualize_bounding_volumes", &visualize_bounding_volumes);
   setupParam("include_free_space", &include_free_space);
+  setupParam("publish_color_updates", &publish_color_updates);
+  setupParam("use_decimated_meshes", &use_decimated_meshes);
+  setupParam("free_space_voxel_stride", &free_space_voxel_stride);
+  setupParam("tsdf_blocks_as_pointcloud", &tsdf_blocks_as_pointcloud);
+  setupParam("max_pointcloud_distance", &max_pointcloud_distance, "m");
+  setupParam("tf_mode", &tf_mode);
+  setupParam("publish_in_global_frame", &publish_in_global_frame);
 }
 
 void SubmapVisualizer::Config::printFields() const {
@@ -55,6 +127,11 @@ SubmapVisualizer::SubmapVisualizer(const Config& config,
   setVisualizationMode(visualizationModeFromString(config_.visualization_mode));
   setColorMode(colorModeFromString(config_.color_mode));
   id_color_map_.setItemsPerRevolution(config_.submap_color_discretization);
+  if (config_.tf_mode == "static") {
+    tf_mode_ = TfMode::kStatic;
+  } else if (config_.tf_mode == "none") {
+    tf_mode_ = TfMode::kNone;
+  }
 
   // Setup publishers.
   nh_ = ros::NodeHandle(config_.ros_namespace);
@@ -64,10 +141,20 @@ SubmapVisualizer::SubmapVisualizer(const Config& config,
   }
   if (config_.visualize_mesh) {
     mesh_pub_ = nh_.advertise<voxblox_msgs::MultiMesh>("mesh", 1000);
+    if (config_.publish_color_updates) {
+      mesh_color_update_pub_ =
+          nh_.advertise<panoptic_mapping_msgs::MeshColorUpdate>(
+              "mesh_color_updates", 100);
+    }
   }
   if (config_.visualize_tsdf_blocks) {
-    tsdf_blocks_pub_ =
-        nh_.advertise<visualization_msgs::MarkerArray>("tsdf_blocks", 100);
+    if (config_.tsdf_blocks_as_pointcloud) {
+      tsdf_block_centers_pub_ = nh_.advertise<pcl::PointCloud<pcl::PointXYZI>>(
+          "tsdf_block_centers", 100);
+    } else {
+      tsdf_blocks_pub_ =
+          nh_.advertise<visualization_msgs::MarkerArray>("tsdf_blocks", 100);
+    }
   }
   if (config_.visualize_bounding_volumes) {
     bounding_volume_pub_ =
@@ -79,6 +166,29 @@ void SubmapVisualizer::reset() {
   // Erase all current tracking / cached data.
   vis_infos_.clear();
   previous_submaps_ = nullptr;
+  free_space_points_.clear();
+  free_space_submap_id_ = -1;
+  recorded_blocks_.clear();
+  published_tf_poses_.clear();
+}
+
+void SubmapVisualizer::recordChanges(const MapChangeSet& changes) {
+  // Only the free space points are updated by block.
+  if (!config_.visualize_free_space) {
+    return;
+  }
+  for (const auto& id_blocks_pair : changes.blocks) {
+    voxblox::IndexSet& blocks = recorded_blocks_[id_blocks_pair.first];
+    blocks.insert(id_blocks_pair.second.created.begin(),
+                  id_blocks_pair.second.created.end());
+    blocks.insert(id_blocks_pair.second.updated.begin(),
+                  id_blocks_pair.second.updated.end());
+    blocks.insert(id_blocks_pair.second.removed.begin(),
+                  id_blocks_pair.second.removed.end());
+  }
+  for (const int submap_id : changes.removed_submaps) {
+    recorded_blocks_.erase(submap_id);
+  }
 }
 
 void SubmapVisualizer::clearMesh() {
@@ -97,33 +207,60 @@ void SubmapVisualizer::clearMesh() {
 
 void SubmapVisualizer::visualizeAll(SubmapCollection* submaps) {
   publishTfTransforms(*submaps);
+  if (!hasSubscribers()) {
+    // The vis infos track the changes since the last update, so they can be
+    // updated lazily once there are subscribers.
+    return;
+  }
   updateVisInfos(*submaps);
   vis_infos_are_updated_ = true;  // Prevent repeated updates.
   visualizeMeshes(submaps);
   visualizeTsdfBlocks(*submaps);
-  visualizeFreeSpace(*submaps);
+  visualizeFreeSpace(submaps);
   visualizeBoundingVolume(*submaps);
   vis_infos_are_updated_ = false;
 }
 
+bool SubmapVisualizer::hasSubscribers() const {
+  return (config_.visualize_mesh && mesh_pub_.getNumSubscribers() > 0) ||
+         (config_.visualize_tsdf_blocks &&
+          (tsdf_blocks_pub_.getNumSubscribers() > 0 ||
+           tsdf_block_centers_pub_.getNumSubscribers() > 0)) ||
+         (config_.visualize_free_space &&
+          freespace_pub_.getNumSubscribers() > 0) ||
+         (config_.visualize_bounding_volumes &&
+          bounding_volume_pub_.getNumSubscribers() > 0);
+}
+
 void SubmapVisualizer::visualizeMeshes(SubmapCollection* submaps) {
   if (config_.visualize_mesh && mesh_pub_.getNumSubscribers() > 0) {
     std::vector<voxblox_msgs::MultiMesh> msgs = generateMeshMsgs(submaps);
     for (auto& msg : msgs) {
       mesh_pub_.publish(msg);
     }
+    for (auto& msg : color_update_msgs_) {
+      mesh_color_update_pub_.publish(msg);
+    }
+    color_update_msgs_.clear();
   }
 }
 
 void SubmapVisualizer::visualizeTsdfBlocks(const SubmapCollection& submaps) {
-  if (config_.visualize_tsdf_blocks &&
-      tsdf_blocks_pub_.getNumSubscribers() > 0) {
+  if (!config_.visualize_tsdf_blocks) {
+    return;
+  }
+  if (tsdf_blocks_pub_.getNumSubscribers() > 0) {
     visualization_msgs::MarkerArray markers = generateBlockMsgs(submaps);
     tsdf_blocks_pub_.publish(markers);
   }
+  if (tsdf_block_centers_pub_.getNumSubscribers() > 0) {
+    pcl::PointCloud<pcl::PointXYZI> msg = generateBlockCloudMsg(submaps);
+    msg.header.frame_id = global_frame_name_;
+    tsdf_block_centers_pub_.publish(msg);
+  }
 }
 
-void SubmapVisualizer::visualizeFreeSpace(const SubmapCollection& submaps) {
+void SubmapVisualizer::visualizeFreeSpace(SubmapCollection* submaps) {
   if (config_.visualize_free_space && freespace_pub_.getNumSubscribers() > 0) {
     pcl::PointCloud<pcl::PointXYZI> msg = generateFreeSpaceMsg(submaps);
     msg.header.frame_id = global_frame_name_;
@@ -144,6 +281,7 @@ void SubmapVisualizer::visualizeBoundingVolume(
 std::vector<voxblox_msgs::MultiMesh> SubmapVisualizer::generateMeshMsgs(
     SubmapCollection* submaps) {
   std::vector<voxblox_msgs::MultiMesh> result;
+  color_update_msgs_.clear();
 
   // Update the visualization infos.
   if (!vis_infos_are_updated_) {
@@ -164,6 +302,28 @@ std::vector<voxblox_msgs::MultiMesh> SubmapVisualizer::generateMeshMsgs(
     }
   }
 
+  // Update the meshes of all submaps jointly. If a mesh service is used, its
+  // time budget applies and the remaining blocks follow in later calls.
+  // Snapshots are meshed by the owner of the map.
+  if (!visualize_snapshots_) {
+    std::vector<Submap*> meshed_submaps;
+    for (Submap& submap : *submaps) {
+      if (submap.getLabel() != PanopticLabel::kFreeSpace &&
+          vis_infos_.find(submap.getID()) != vis_infos_.end()) {
+        meshed_submaps.emplace_back(&submap);
+      }
+    }
+    MeshService* mesh_service = globals_->meshService().get();
+    if (mesh_service) {
+      for (const Submap* submap : meshed_submaps) {
+        mesh_service->requestSubmap(*submap);
+      }
+      mesh_service->processRequests(submaps);
+    } else {
+      SubmapCollection::updateMeshes(meshed_submaps, submaps->getThreadPool());
+    }
+  }
+
   // Process all submaps based on their visualization info.
   for (Submap& submap : *submaps) {
     if (submap.getLabel() == PanopticLabel::kFreeSpace) {
@@ -182,73 +342,169 @@ std::vector<voxblox_msgs::MultiMesh> SubmapVisualizer::generateMeshMsgs(
     // Setup message.
     voxblox_msgs::MultiMesh msg;
     msg.header.stamp = ros::Time::now();
-    msg.header.frame_id = submap.getFrameName();
+    msg.header.frame_id = config_.publish_in_global_frame
+                              ? global_frame_name_
+                              : submap.getFrameName();
     msg.name_space = info.name_space;
 
-    // Update the mesh.
-    submap.updateMesh();
+    // Set the voxblox internal color mode. Gray will be used for overwriting.
+    // Submaps without color are shown in their class color in 'color' mode
+    // and by their normals in 'persistent' mode.
+    voxblox::ColorMode color_mode_voxblox = voxblox::ColorMode::kGray;
+    const bool store_color = submap.getConfig().store_color;
+    if ((color_mode_ == ColorMode::kColor && store_color) ||
+        color_mode_ == ColorMode::kClassification ||
+        (color_mode_ == ColorMode::kPersistent &&
+         submap.getChangeState() != ChangeState::kAbsent)) {
+      color_mode_voxblox = store_color || color_mode_ != ColorMode::kPersistent
+                               ? voxblox::ColorMode::kColor
+                               : voxblox::ColorMode::kNormals;
+    } else if (color_mode_ == ColorMode::kNormals) {
+      color_mode_voxblox = voxblox::ColorMode::kNormals;
+    }
+
+    // The vertex colors of the published blocks are outdated if the voxblox
+    // color mode changed, e.g. for submaps becoming absent in kPersistent.
+    if (color_mode_voxblox != info.published_color_mode) {
+      if (color_mode_voxblox == voxblox::ColorMode::kGray) {
+        info.republish_colors = true;
+      } else {
+        info.republish_everything = true;
+      }
+      info.published_color_mode = color_mode_voxblox;
+    }
+
+    // If only the colors changed, update them without re-sending the geometry
+    // if possible.
+    bool send_color_update = false;
+    if (info.republish_colors) {
+      if (config_.publish_color_updates && !info.republish_everything) {
+        send_color_update = true;
+      } else {
+        info.republish_everything = true;
+      }
+      info.republish_colors = false;
+    }
+
+    // Inactive submaps can be shown by their decimated mesh. Its triangles are
+    // binned into blocks anew, so switching between the decimated and the full
+    // mesh resets the visual of the submap.
+    const std::shared_ptr<const IndexedMesh> decimated_mesh =
+        config_.use_decimated_meshes && !submap.isActive() &&
+                color_mode_ != ColorMode::kClassification
+            ? submap.getDecimatedMesh()
+            : nullptr;
+    if (static_cast<bool>(decimated_mesh) != info.shows_decimated_mesh ||
+        (decimated_mesh &&
+         info.published_decimated_mesh.lock() != decimated_mesh)) {
+      voxblox_msgs::MultiMesh reset_msg;
+      reset_msg.header = msg.header;
+      reset_msg.name_space = info.name_space;
+      result.emplace_back(reset_msg);
+      info.shows_decimated_mesh = static_cast<bool>(decimated_mesh);
+      info.published_decimated_mesh = decimated_mesh;
+      info.previous_blocks.clear();
+      info.republish_everything = true;
+    }
+
+    // Meshes of moved submaps are transformed into the global frame, where
+    // their triangles are binned into blocks anew. They are thus reset and
+    // re-sent as a whole if they changed.
+    const bool transform_mesh =
+        config_.publish_in_global_frame &&
+        !submap.getT_M_S().getTransformationMatrix().isIdentity();
+    const bool was_moved =
+        config_.publish_in_global_frame &&
+        !info.published_T_M_S.getTransformationMatrix().isApprox(
+            submap.getT_M_S().getTransformationMatrix());
+    if (was_moved ||
+        (transform_mesh && (info.republish_everything ||
+                            meshChangedSincePublished(submap, info)))) {
+      voxblox_msgs::MultiMesh reset_msg;
+      reset_msg.header = msg.header;
+      reset_msg.name_space = info.name_space;
+      result.emplace_back(reset_msg);
+      info.published_T_M_S = submap.getT_M_S();
+      info.republish_everything = true;
+    }
 
     // Mark the whole mesh for re-publishing if requested.
-    if (info.republish_everything) {
+    if (info.republish_everything && !decimated_mesh) {
       voxblox::BlockIndexList mesh_indices;
       submap.getMeshLayer().getAllAllocatedMeshes(&mesh_indices);
       for (const auto& block_index : mesh_indices) {
         submap.getMeshLayerPtr()->getMeshPtrByIndex(block_index)->updated =
             true;
       }
+      info.published_generations.clear();
       info.republish_everything = false;
     }
 
-    // Set the voxblox internal color mode. Gray will be used for overwriting.
-    voxblox::ColorMode color_mode_voxblox = voxblox::ColorMode::kGray;
-    if (color_mode_ == ColorMode::kColor ||
-        color_mode_ == ColorMode::kClassification ||
-        (color_mode_ == ColorMode::kPersistent &&
-         submap.getChangeState() != ChangeState::kAbsent)) {
-      color_mode_voxblox = voxblox::ColorMode::kColor;
-    } else if (color_mode_ == ColorMode::kNormals) {
-      color_mode_voxblox = voxblox::ColorMode::kNormals;
+    if (send_color_update) {
+      panoptic_mapping_msgs::MeshColorUpdate color_msg;
+      color_msg.header = msg.header;
+      color_msg.name_space = info.name_space;
+      color_msg.alpha = info.alpha * 255.f;
+      color_msg.uniform_color =
+          color_mode_voxblox == voxblox::ColorMode::kGray;
+      color_msg.r = info.color.r;
+      color_msg.g = info.color.g;
+      color_msg.b = info.color.b;
+      color_update_msgs_.emplace_back(std::move(color_msg));
     }
 
-    if (color_mode_ == ColorMode::kClassification) {
-      generateClassificationMesh(&submap, &msg.mesh);
+    if (decimated_mesh) {
+      // The decimated mesh does not change, so it is only sent on request.
+      if (info.republish_everything) {
+        MeshLayer mesh_layer(submap.getMeshLayer().block_size());
+        decimated_mesh->toMeshLayer(&mesh_layer);
+        voxblox::generateVoxbloxMeshMsg(&mesh_layer, color_mode_voxblox,
+                                        &msg.mesh);
+        info.republish_everything = false;
+      }
+    } else if (color_mode_ == ColorMode::kClassification) {
+      generateClassificationMesh(&submap, &info, &msg.mesh);
     } else {
       voxblox::generateVoxbloxMeshMsg(submap.getMeshLayerPtr(),
                                       color_mode_voxblox, &msg.mesh);
     }
 
     // Add removed blocks so they are cleared from the visualization as well.
+    // The blocks of decimated meshes are reset when switching back and those
+    // of transformed meshes when they change.
     voxblox::BlockIndexList block_indices;
-    submap.getTsdfLayer().getAllAllocatedBlocks(&block_indices);
+    if (!decimated_mesh) {
+      submap.getTsdfLayer().getAllAllocatedBlocks(&block_indices);
+    }
+    const voxblox::IndexSet current_blocks(block_indices.begin(),
+                                           block_indices.end());
     for (const auto& block_index : info.previous_blocks) {
-      if (std::find(block_indices.begin(), block_indices.end(), block_index) ==
-          block_indices.end()) {
+      if (!transform_mesh &&
+          current_blocks.find(block_index) == current_blocks.end()) {
         voxblox_msgs::MeshBlock mesh_block;
         mesh_block.index[0] = block_index.x();
         mesh_block.index[1] = block_index.y();
         mesh_block.index[2] = block_index.z();
         msg.mesh.mesh_blocks.push_back(mesh_block);
+        info.published_generations.erase(block_index);
       }
     }
-    info.previous_blocks = block_indices;
+    info.previous_blocks = std::move(block_indices);
 
     if (msg.mesh.mesh_blocks.empty()) {
       // Nothing changed, don't send an empty msg which would reset the mesh.
       continue;
     }
+    if (transform_mesh) {
+      transformMeshMsg(submap.getT_M_S(), &msg.mesh);
+    }
 
     // Apply the submap color if necessary.
     if (color_mode_voxblox == voxblox::ColorMode::kGray) {
       for (auto& mesh_block : msg.mesh.mesh_blocks) {
-        for (auto& r : mesh_block.r) {
-          r = info.color.r;
-        }
-        for (auto& g : mesh_block.g) {
-          g = info.color.g;
-        }
-        for (auto& b : mesh_block.b) {
-          b = info.color.b;
-        }
+        std::fill(mesh_block.r.begin(), mesh_block.r.end(), info.color.r);
+        std::fill(mesh_block.g.begin(), mesh_block.g.end(), info.color.g);
+        std::fill(mesh_block.b.begin(), mesh_block.b.end(), info.color.b);
       }
     }
 
@@ -260,53 +516,90 @@ std::vector<voxblox_msgs::MultiMesh> SubmapVisualizer::generateMeshMsgs(
 }
 
 void SubmapVisualizer::generateClassificationMesh(Submap* submap,
+                                                  SubmapVisInfo* info,
                                                   voxblox_msgs::Mesh* mesh) {
   if (!submap->hasClassLayer()) {
     return;
   }
 
-  // NOTE(schmluk): For classification visualization the layer needs to be
-  // copied and re-colored. Currently quite inefficient but easier to use.
-  TsdfLayer tsdf_layer(submap->getTsdfLayer());
-  MeshLayer mesh_layer(submap->getConfig().voxel_size *
-                       submap->getConfig().voxels_per_side);
-
-  // Get all changed blocks.
-  const int voxels_per_block = std::pow(submap->getConfig().voxels_per_side, 3);
+  // Get all blocks whose mesh changed since they were last published.
+  voxblox::BlockIndexList mesh_indices;
+  submap->getMeshLayer().getAllAllocatedMeshes(&mesh_indices);
   voxblox::BlockIndexList updated_blocks;
-  tsdf_layer.getAllAllocatedBlocks(&updated_blocks);
-  for (const auto& index : updated_blocks) {
-    TsdfBlock& block = submap->getTsdfLayerPtr()->getBlockByIndex(index);
-    // NOTE(schmluk): we abuse the esdf flag here to mesh only updated blocks.
-    // TODO(schmluk): clean this up (maybe custom bit or so).
-    tsdf_layer.getBlockByIndex(index).setUpdated(
-        voxblox::Update::kMesh, block.updated(voxblox::Update::kEsdf));
-    block.setUpdated(voxblox::Update::kEsdf, false);
+  for (const auto& index : mesh_indices) {
+    const uint64_t generation = submap->getMeshGeneration(index);
+    uint64_t& published_generation = info->published_generations[index];
+    if (published_generation != generation) {
+      published_generation = generation;
+      updated_blocks.emplace_back(index);
+    }
+  }
+  if (updated_blocks.empty()) {
+    return;
   }
-  tsdf_layer.getAllUpdatedBlocks(voxblox::Update::kMesh, &updated_blocks);
 
-  // Do the coloring.
+  // NOTE(schmluk): For classification visualization the blocks need to be
+  // copied and re-colored. Only the changed blocks and their neighbors, which
+  // are required to mesh the block borders, are copied.
+  const TsdfLayer& source_layer = submap->getTsdfLayer();
+  TsdfLayer tsdf_layer(source_layer.voxel_size(),
+                       source_layer.voxels_per_side());
+  MeshLayer mesh_layer(source_layer.block_size());
+  const int voxels_per_block = std::pow(source_layer.voxels_per_side(), 3);
+  voxblox::BlockIndexList copied_blocks;
+  for (const auto& block_index : updated_blocks) {
+    for (int x = 0; x < 2; ++x) {
+      for (int y = 0; y < 2; ++y) {
+        for (int z = 0; z < 2; ++z) {
+          const BlockIndex index = block_index + BlockIndex(x, y, z);
+          if (tsdf_layer.hasBlock(index) || !source_layer.hasBlock(index)) {
+            continue;
+          }
+          const TsdfBlock& source_block = source_layer.getBlockByIndex(index);
+          TsdfBlock& block = *tsdf_layer.allocateBlockPtrByIndex(index);
+          for (size_t linear_index = 0; linear_index < voxels_per_block;
+               ++linear_index) {
+            block.getVoxelByLinearIndex(linear_index) =
+                source_block.getVoxelByLinearIndex(linear_index);
+          }
+          block.setUpdated(voxblox::Update::kMesh, false);
+          copied_blocks.emplace_back(index);
+        }
+      }
+    }
+  }
   for (const auto& block_index : updated_blocks) {
+    tsdf_layer.getBlockByIndex(block_index)
+        .setUpdated(voxblox::Update::kMesh, true);
+  }
+
+  // Do the coloring.
+  for (const auto& block_index : copied_blocks) {
     TsdfBlock& tsdf_block = tsdf_layer.getBlockByIndex(block_index);
     const ClassBlock::ConstPtr class_block =
         submap->getClassLayer().getBlockConstPtrByIndex(block_index);
-    for (size_t linear_index = 0; linear_index < voxels_per_block;
-         ++linear_index) {
-      TsdfVoxel& tsdf_voxel = tsdf_block.getVoxelByLinearIndex(linear_index);
-      const ClassVoxel& class_voxel =
-          class_block->getVoxelByLinearIndex(linear_index);
-
-      // Coloring.
-      const float probability = class_voxel.getBelongingProbability();
-      tsdf_voxel.color.b = 0;
-      if (probability > 0.5) {
-        tsdf_voxel.color.r = ((1.f - probability) * 2.f * 255.f);
-        tsdf_voxel.color.g = 255;
-      } else {
-        tsdf_voxel.color.r = 255;
-        tsdf_voxel.color.g = (probability * 2.f * 255.f);
-      }
+    if (!class_block) {
+      continue;
     }
+    // Only observed voxels can be meshed and need to be colored.
+    submap->getVoxelMasks().forEachObservedVoxel(
+        block_index, tsdf_block, [&](size_t linear_index) {
+          TsdfVoxel& tsdf_voxel =
+              tsdf_block.getVoxelByLinearIndex(linear_index);
+          const ClassVoxel& class_voxel =
+              class_block->getVoxelByLinearIndex(linear_index);
+
+          // Coloring.
+          const float probability = class_voxel.getBelongingProbability();
+          tsdf_voxel.color.b = 0;
+          if (probability > 0.5) {
+            tsdf_voxel.color.r = ((1.f - probability) * 2.f * 255.f);
+            tsdf_voxel.color.g = 255;
+          } else {
+            tsdf_voxel.color.r = 255;
+            tsdf_voxel.color.g = (probability * 2.f * 255.f);
+          }
+        });
   }
 
   // Create the mesh.
@@ -364,15 +657,10 @@ visualization_msgs::MarkerArray SubmapVisualizer::generateBlockMsgs(
       marker.scale.x = block_size;
       marker.scale.y = block_size;
       marker.scale.z = block_size;
-      marker.pose.orientation.x = 0.0;
-      marker.pose.orientation.y = 0.0;
-      marker.pose.orientation.z = 0.0;
-      marker.pose.orientation.w = 1.0;
-      Point origin =
+      const Point origin =
           submap.getTsdfLayer().getBlockByIndex(block_index).origin();
-      marker.pose.position.x = origin.x() + block_size / 2.0;
-      marker.pose.position.y = origin.y() + block_size / 2.0;
-      marker.pose.position.z = origin.z() + block_size / 2.0;
+      setMarkerPose(submap, origin + Point::Constant(block_size / 2.f),
+                    &marker);
       result.markers.push_back(marker);
     }
   }
@@ -380,18 +668,148 @@ visualization_msgs::MarkerArray SubmapVisualizer::generateBlockMsgs(
 }
 
 pcl::PointCloud<pcl::PointXYZI> SubmapVisualizer::generateFreeSpaceMsg(
-    const SubmapCollection& submaps) {
+    SubmapCollection* submaps) {
+  // Create a pointcloud with distance = intensity.
   pcl::PointCloud<pcl::PointXYZI> result;
+  const int free_space_id = submaps->getActiveFreeSpaceSubmapID();
+  if (!submaps->submapIdExists(free_space_id)) {
+    free_space_points_.clear();
+    free_space_submap_id_ = -1;
+    return result;
+  }
+  Submap* submap = submaps->getSubmapPtr(free_space_id);
+  const TsdfLayer& layer = submap->getTsdfLayer();
+
+  // Only recompute the points of blocks that changed since the last call.
+  voxblox::IndexSet changed_blocks =
+      submap->takeChangedBlocks(Submap::ChangeConsumer::kVisualization);
+  auto recorded_it = recorded_blocks_.find(free_space_id);
+  if (recorded_it != recorded_blocks_.end()) {
+    changed_blocks.insert(recorded_it->second.begin(),
+                          recorded_it->second.end());
+  }
+  recorded_blocks_.clear();
+  if (free_space_submap_id_ != free_space_id) {
+    free_space_points_.clear();
+    free_space_submap_id_ = free_space_id;
+    voxblox::BlockIndexList block_indices;
+    layer.getAllAllocatedBlocks(&block_indices);
+    changed_blocks.insert(block_indices.begin(), block_indices.end());
+  }
+  for (const BlockIndex& index : changed_blocks) {
+    TsdfBlock::ConstPtr block = layer.getBlockPtrByIndex(index);
+    if (block) {
+      computeFreeSpacePoints(*block, index, &free_space_points_[index]);
+    } else {
+      free_space_points_.erase(index);
+    }
+  }
 
-  // Create a pointcloud with distance = intensity. Taken from voxblox.
-  const int free_space_id = submaps.getActiveFreeSpaceSubmapID();
-  if (submaps.submapIdExists(free_space_id)) {
-    createDistancePointcloudFromTsdfLayer(
-        submaps.getSubmap(free_space_id).getTsdfLayer(), &result);
+  // Assemble the blocks in view range. Blocks can also be removed without
+  // being recorded as changed.
+  const float block_size = layer.block_size();
+  const Transformation& T_M_S = submap->getT_M_S();
+  for (auto it = free_space_points_.begin(); it != free_space_points_.end();) {
+    if (!layer.hasBlock(it->first)) {
+      it = free_space_points_.erase(it);
+      continue;
+    }
+    const Point center_S =
+        (it->first.cast<FloatingPoint>() + Point::Constant(0.5f)) * block_size;
+    if (blockIsInViewRange(T_M_S * center_S, block_size)) {
+      result.points.insert(result.points.end(), it->second.points.begin(),
+                           it->second.points.end());
+    }
+    ++it;
   }
+  result.width = result.points.size();
+  result.height = 1;
   return result;
 }
 
+void SubmapVisualizer::computeFreeSpacePoints(
+    const TsdfBlock& block, const BlockIndex& block_index,
+    pcl::PointCloud<pcl::PointXYZI>* points) const {
+  // Subsample by the global voxel index, such that the pattern is consistent
+  // across blocks.
+  constexpr float kMinWeight = 1e-3;
+  const int stride = config_.free_space_voxel_stride;
+  const int voxels_per_side = static_cast<int>(block.voxels_per_side());
+  const auto is_sampled = [stride](int global_index) {
+    return ((global_index % stride) + stride) % stride == 0;
+  };
+  points->clear();
+  for (size_t i = 0; i < block.num_voxels(); ++i) {
+    const TsdfVoxel& voxel = block.getVoxelByLinearIndex(i);
+    if (voxel.weight <= kMinWeight) {
+      continue;
+    }
+    const voxblox::VoxelIndex voxel_index =
+        block.computeVoxelIndexFromLinearIndex(i);
+    if (stride > 1) {
+      const voxblox::GlobalIndex global_index =
+          block_index.cast<voxblox::LongIndexElement>() * voxels_per_side +
+          voxel_index.cast<voxblox::LongIndexElement>();
+      if (!is_sampled(global_index.x()) || !is_sampled(global_index.y()) ||
+          !is_sampled(global_index.z())) {
+        continue;
+      }
+    }
+    const Point position = block.computeCoordinatesFromVoxelIndex(voxel_index);
+    pcl::PointXYZI point;
+    point.x = position.x();
+    point.y = position.y();
+    point.z = position.z();
+    point.intensity = voxel.distance;
+    points->push_back(point);
+  }
+}
+
+pcl::PointCloud<pcl::PointXYZI> SubmapVisualizer::generateBlockCloudMsg(
+    const SubmapCollection& submaps) {
+  // Create a pointcloud of block centers in mission frame with submap ID =
+  // intensity.
+  pcl::PointCloud<pcl::PointXYZI> result;
+  for (const Submap& submap : submaps) {
+    if (submap.getLabel() == PanopticLabel::kFreeSpace &&
+        !config_.include_free_space) {
+      continue;
+    }
+    const TsdfLayer& layer = submap.getTsdfLayer();
+    const float block_size = layer.block_size();
+    voxblox::BlockIndexList block_indices;
+    layer.getAllAllocatedBlocks(&block_indices);
+    for (const BlockIndex& index : block_indices) {
+      const Point center_M =
+          submap.getT_M_S() *
+          ((index.cast<FloatingPoint>() + Point::Constant(0.5f)) * block_size);
+      if (!blockIsInViewRange(center_M, block_size)) {
+        continue;
+      }
+      pcl::PointXYZI point;
+      point.x = center_M.x();
+      point.y = center_M.y();
+      point.z = center_M.z();
+      point.intensity = submap.getID();
+      result.points.push_back(point);
+    }
+  }
+  result.width = result.points.size();
+  result.height = 1;
+  return result;
+}
+
+bool SubmapVisualizer::blockIsInViewRange(const Point& center_M,
+                                          float block_size) const {
+  if (config_.max_pointcloud_distance <= 0.f || !has_view_position_) {
+    return true;
+  }
+  // Include blocks that partially overlap the view range.
+  const float block_diag_half = std::sqrt(3.f) * block_size / 2.f;
+  return (center_M - view_position_M_).norm() <=
+         config_.max_pointcloud_distance + block_diag_half;
+}
+
 visualization_msgs::MarkerArray SubmapVisualizer::generateBoundingVolumeMsgs(
     const SubmapCollection& submaps) {
   visualization_msgs::MarkerArray result;
@@ -427,14 +845,7 @@ visualization_msgs::MarkerArray SubmapVisualizer::generateBoundingVolumeMsgs(
     marker.scale.x = submap.getBoundingVolume().getRadius() * 2.f;
     marker.scale.y = marker.scale.x;
     marker.scale.z = marker.scale.x;
-    marker.pose.orientation.x = 0.0;
-    marker.pose.orientation.y = 0.0;
-    marker.pose.orientation.z = 0.0;
-    marker.pose.orientation.w = 1.0;
-    const Point& origin = submap.getBoundingVolume().getCenter();
-    marker.pose.position.x = origin.x();
-    marker.pose.position.y = origin.y();
-    marker.pose.position.z = origin.z();
+    setMarkerPose(submap, submap.getBoundingVolume().getCenter(), &marker);
     result.markers.push_back(marker);
   }
   return result;
@@ -442,7 +853,7 @@ visualization_msgs::MarkerArray SubmapVisualizer::generateBoundingVolumeMsgs(
 
 void SubmapVisualizer::updateVisInfos(const SubmapCollection& submaps) {
   // Check whether the same submap collection is being visualized (cached data).
-  if (previous_submaps_ != &submaps) {
+  if (previous_submaps_ != &submaps && !visualize_snapshots_) {
     reset();
     previous_submaps_ = &submaps;
   }
@@ -504,6 +915,13 @@ void SubmapVisualizer::setColorMode(ColorMode color_mode) {
   reset();
 }
 
+Color SubmapVisualizer::getClassColor(const Submap& submap) {
+  if (submap.getLabel() == PanopticLabel::kUnknown) {
+    return kUnknownColor_;
+  }
+  return id_color_map_.colorLookup(submap.getClassID());
+}
+
 void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
                                          SubmapVisInfo* info) {
   // Check whether colors need to be updated.
@@ -516,6 +934,13 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
     // NOTE(schmluk): Modes 'color', 'normals' are handled by
     // the mesher, so no need to set here.
     switch (color_mode_) {
+      case ColorMode::kColor: {
+        // Submaps without color are shown in their class color.
+        if (!submap.getConfig().store_color) {
+          info->color = getClassColor(submap);
+        }
+        break;
+      }
       case ColorMode::kInstances: {
         if (globals_->labelHandler()->segmentationIdExists(
                 submap.getInstanceID())) {
@@ -531,11 +956,7 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
         break;
       }
       case ColorMode::kClasses: {
-        if (submap.getLabel() == PanopticLabel::kUnknown) {
-          info->color = kUnknownColor_;
-        } else {
-          info->color = id_color_map_.colorLookup(submap.getClassID());
-        }
+        info->color = getClassColor(submap);
         break;
       }
       case ColorMode::kChange: {
@@ -563,7 +984,7 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
               break;
             }
           }
-          info->republish_everything = true;
+          info->republish_colors = true;
           info->previous_change_state = submap.getChangeState();
         }
         break;
@@ -592,7 +1013,7 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
           } else {
             info->alpha = 0.4f;
           }
-          info->republish_everything = true;
+          info->republish_colors = true;
           info->was_active = submap.isActive();
         }
         break;
@@ -604,7 +1025,7 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
           } else {
             info->alpha = 1.f;
           }
-          info->republish_everything = true;
+          info->republish_colors = true;
           info->was_active = submap.isActive();
         }
         break;
@@ -619,7 +1040,7 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
           } else {
             info->alpha = 0.4f;
           }
-          info->republish_everything = true;
+          info->republish_colors = true;
           info->was_active = is_persistent;
         }
         break;
@@ -631,17 +1052,95 @@ void SubmapVisualizer::setSubmapVisColor(const Submap& submap,
 }
 
 void SubmapVisualizer::publishTfTransforms(const SubmapCollection& submaps) {
+  if (tf_mode_ == TfMode::kNone) {
+    return;
+  }
+
   // Setup common message.
   geometry_msgs::TransformStamped msg;
   msg.header.stamp = ros::Time::now();
   msg.header.frame_id = global_frame_name_;
 
-  // Send transforms of submaps.
+  // Send the transforms of all submaps in a single message.
+  std::vector<geometry_msgs::TransformStamped> msgs;
+  if (tf_mode_ == TfMode::kDynamic) {
+    msgs.reserve(submaps.size());
+    for (const Submap& submap : submaps) {
+      msg.child_frame_id = submap.getFrameName();
+      tf::transformKindrToMsg(submap.getT_S_M().cast<double>(),
+                              &msg.transform);
+      msgs.push_back(msg);
+    }
+    tf_broadcaster_.sendTransform(msgs);
+    return;
+  }
+
+  // Static transforms are only sent for new and moved submaps. The
+  // broadcaster latches all transforms sent so far in one message.
+  for (auto it = published_tf_poses_.begin();
+       it != published_tf_poses_.end();) {
+    if (submaps.submapIdExists(it->first)) {
+      ++it;
+    } else {
+      it = published_tf_poses_.erase(it);
+    }
+  }
   for (const Submap& submap : submaps) {
+    auto it = published_tf_poses_.find(submap.getID());
+    if (it != published_tf_poses_.end() &&
+        it->second.getTransformationMatrix().isApprox(
+            submap.getT_M_S().getTransformationMatrix())) {
+      continue;
+    }
+    published_tf_poses_[submap.getID()] = submap.getT_M_S();
     msg.child_frame_id = submap.getFrameName();
     tf::transformKindrToMsg(submap.getT_S_M().cast<double>(), &msg.transform);
-    tf_broadcaster_.sendTransform(msg);
+    msgs.push_back(msg);
+  }
+  if (!msgs.empty()) {
+    static_tf_broadcaster_.sendTransform(msgs);
+  }
+}
+
+bool SubmapVisualizer::meshChangedSincePublished(
+    const Submap& submap, const SubmapVisInfo& info) const {
+  voxblox::BlockIndexList mesh_indices;
+  submap.getMeshLayer().getAllAllocatedMeshes(&mesh_indices);
+  for (const BlockIndex& index : mesh_indices) {
+    if (submap.getMeshLayer().getMeshByIndex(index).updated) {
+      return true;
+    }
+    if (color_mode_ == ColorMode::kClassification) {
+      auto it = info.published_generations.find(index);
+      if (it == info.published_generations.end() ||
+          it->second != submap.getMeshGeneration(index)) {
+        return true;
+      }
+    }
+  }
+  return submap.getTsdfLayer().getNumberOfAllocatedBlocks() !=
+         info.previous_blocks.size();
+}
+
+void SubmapVisualizer::setMarkerPose(
+    const Submap& submap, const Point& position_S,
+    visualization_msgs::Marker* marker) const {
+  Transformation T_F_S;
+  if (config_.publish_in_global_frame) {
+    marker->header.frame_id = global_frame_name_;
+    T_F_S = submap.getT_M_S();
+  } else {
+    marker->header.frame_id = submap.getFrameName();
   }
+  const Point position_F = T_F_S * position_S;
+  const Transformation::Rotation& rotation = T_F_S.getRotation();
+  marker->pose.position.x = position_F.x();
+  marker->pose.position.y = position_F.y();
+  marker->pose.position.z = position_F.z();
+  marker->pose.orientation.x = rotation.x();
+  marker->pose.orientation.y = rotation.y();
+  marker->pose.orientation.z = rotation.z();
+  marker->pose.orientation.w = rotation.w();
 }
 
 SubmapVisualizer::ColorMode SubmapVisualizer::colorModeFromString(
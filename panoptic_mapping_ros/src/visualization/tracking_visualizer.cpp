@@ -1,6 +1,7 @@
 #include "panoptic_mapping_ros/visualization/tracking_visualizer.h"
 
 #include <string>
+#include <unordered_map>
 
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/Image.h>
@@ -30,26 +31,55 @@ void TrackingVisualizer::registerIDTracker(IDTrackerBase* tracker) {
     CHECK_NOTNULL(tracker);
     tracker->setVisualizationCallback(
         [this](const cv::Mat& image, const std::string& name) {
-          publishImage(image, name);
+          if (!queue_images_) {
+            publishImage(image, name);
+            return;
+          }
+          // The tracker reuses its image buffers.
+          std::lock_guard<std::mutex> lock(mutex_);
+          queued_images_[name] = image.clone();
         });
+    tracker->setVisualizationRequestedCallback(
+        [this](const std::string& name) { return hasSubscribers(name); });
   }
 }
 
-void TrackingVisualizer::publishImage(const cv::Mat& image,
-                                      const std::string& name) {
+ros::Publisher& TrackingVisualizer::getPublisher(const std::string& name) {
   auto it = publishers_.find(name);
   if (it == publishers_.end()) {
     // Advertise a new topic if there is no publisher for the given name.
     it = publishers_.emplace(name, nh_.advertise<sensor_msgs::Image>(name, 100))
              .first;
   }
+  return it->second;
+}
 
+bool TrackingVisualizer::hasSubscribers(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return getPublisher(name).getNumSubscribers() > 0;
+}
+
+void TrackingVisualizer::publishImage(const cv::Mat& image,
+                                      const std::string& name) {
   // Publish the image, expected as BGR8.
   std_msgs::Header header;
   header.stamp = ros::Time::now();
-  it->second.publish(
+  sensor_msgs::ImagePtr msg =
       cv_bridge::CvImage(header, sensor_msgs::image_encodings::BGR8, image)
-          .toImageMsg());
+          .toImageMsg();
+  std::lock_guard<std::mutex> lock(mutex_);
+  getPublisher(name).publish(msg);
+}
+
+void TrackingVisualizer::publishQueuedImages() {
+  std::unordered_map<std::string, cv::Mat> images;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    images.swap(queued_images_);
+  }
+  for (const auto& name_image_pair : images) {
+    publishImage(name_image_pair.second, name_image_pair.first);
+  }
 }
 
 }  // namespace panoptic_mapping
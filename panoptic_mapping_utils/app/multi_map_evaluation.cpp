@@ -19,6 +19,12 @@ int main(int argc, char** argv) {
 
   // Evaluator.
   panoptic_mapping::MapEvaluator evaluator(nh, nh_private);
+  const auto batch_config = config_utilities::getConfigFromRos<
+      panoptic_mapping::MapEvaluator::BatchConfig>(
+      ros::NodeHandle(nh_private, "batch"));
+  if (batch_config.num_parallel_maps > 0) {
+    return evaluator.evaluateMapSeries(batch_config) ? 0 : 1;
+  }
   if (evaluator.setupMultiMapEvaluation()) {
     ros::spin();
   }
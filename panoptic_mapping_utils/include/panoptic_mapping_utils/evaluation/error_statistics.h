@@ -0,0 +1,52 @@
+#ifndef PANOPTIC_MAPPING_UTILS_EVALUATION_ERROR_STATISTICS_H_
+#define PANOPTIC_MAPPING_UTILS_EVALUATION_ERROR_STATISTICS_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Streaming statistics of non-negative errors that do not store the
+ * individual values. Mean and variance are accumulated with Welford's
+ * algorithm, quantiles are estimated from a histogram of logarithmically
+ * spaced bins with a relative resolution of 1% between 1e-6 and 1e4. Partial
+ * statistics, e.g. computed by different threads, can be merged exactly.
+ */
+class ErrorStatistics {
+ public:
+  ErrorStatistics();
+  virtual ~ErrorStatistics() = default;
+
+  void add(double value);
+  void merge(const ErrorStatistics& other);
+
+  // Access.
+  uint64_t getCount() const { return count_; }
+  double getMean() const { return mean_; }
+  double getRMSE() const;
+  // Sample standard deviation, 0 for 2 or less values.
+  double getStdDev() const;
+  double getMin() const;
+  double getMax() const;
+
+  // Estimated quantile for q in [0, 1], exact for the minimum and maximum.
+  double getQuantile(double q) const;
+  double getMedian() const { return getQuantile(0.5); }
+
+ private:
+  static int getBin(double value);
+  static double getBinCenter(int bin);
+
+  uint64_t count_ = 0;
+  double mean_ = 0.0;
+  double m2_ = 0.0;  // Sum of squared differences from the mean.
+  double sum_squares_ = 0.0;
+  double min_;
+  double max_;
+  std::vector<uint64_t> bins_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_UTILS_EVALUATION_ERROR_STATISTICS_H_
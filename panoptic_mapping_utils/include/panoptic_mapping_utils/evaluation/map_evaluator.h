@@ -12,6 +12,7 @@
 #include <panoptic_mapping/tools/planning_interface.h>
 #include <panoptic_mapping_msgs/SaveLoadMap.h>
 #include <panoptic_mapping_ros/visualization/submap_visualizer.h>
+#include <panoptic_mapping_utils/evaluation/voxel_hash_search.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <ros/ros.h>
@@ -46,6 +47,17 @@ class MapEvaluator {
         true;  // true: iterate through mesh, false: iterate over gt points.
     bool is_single_tsdf = false;
 
+    // Ground truth.
+    // If true, the loaded ground truth and its kd-tree are stored in a binary
+    // cache next to the ground truth file, which is used if the file is
+    // unchanged.
+    bool cache_ground_truth = true;
+
+    // Cell size of a voxel hash for nearest neighbor lookups in m, which is
+    // faster than the kd-tree for uniformly sampled ground truth clouds. Use 0
+    // to search the kd-tree.
+    float neighbor_search_cell_size = 0.f;
+
     EvaluationRequest() { setConfigName("MapEvaluator::EvaluationRequest"); }
 
    protected:
@@ -53,6 +65,29 @@ class MapEvaluator {
     void checkParams() const override;
   };
 
+  // Evaluation of all maps in a directory without the evaluation manager.
+  struct BatchConfig : public config_utilities::Config<BatchConfig> {
+    int verbosity = 2;
+
+    // Number of maps evaluated concurrently. Use 0 to instead evaluate maps
+    // one at a time through the 'process_map' service.
+    int num_parallel_maps = 0;
+
+    // Maximum summed file size of all maps loaded at the same time in MB, 0
+    // for no limit. Maps exceeding the budget on their own are loaded alone.
+    float max_loaded_megabytes = 0.f;
+
+    // If true, maps already listed in the output file are skipped and the
+    // new results are appended.
+    bool resume = true;
+
+    BatchConfig() { setConfigName("MapEvaluator::BatchConfig"); }
+
+   protected:
+    void setupParamsAndPrinting() override;
+    void checkParams() const override;
+  };
+
   // nanoflann pointcloud adapter.
   struct TreeData {
     std::vector<Point> points;
@@ -86,16 +121,47 @@ class MapEvaluator {
   void publishVisualization();
   bool setupMultiMapEvaluation();
 
+  /**
+   * @brief Evaluate all panoptic maps in the directory 'map_file' of the
+   * multi map evaluation request, 'num_parallel_maps' at a time. Results are
+   * written to '<map_file>/<output_suffix>_series.csv' as soon as each map
+   * finishes, such that interrupted series can be resumed.
+   *
+   * @return True if all maps were evaluated successfully.
+   */
+  bool evaluateMapSeries(const BatchConfig& config);
+
   // Services.
   bool evaluateMapCallback(
       panoptic_mapping_msgs::SaveLoadMap::Request& request,     // NOLINT
       panoptic_mapping_msgs::SaveLoadMap::Response& response);  // NOLINT
 
  private:
+  bool loadMultiMapRequest();
+  bool loadGroundTruth(const EvaluationRequest& request);
+  bool loadGroundTruthCache(const std::string& file_name, uint64_t hash);
+  void saveGroundTruthCache(const std::string& file_name, uint64_t hash) const;
   std::string computeReconstructionError(const EvaluationRequest& request);
   std::string computeMeshError(const EvaluationRequest& request);
+
+  // Error computations of a given map. These only read the ground truth and
+  // can run concurrently. Exactly one of planning or voxblox has to be set.
+  std::string computeReconstructionError(const EvaluationRequest& request,
+                                         const PlanningInterface* planning,
+                                         const TsdfLayer* voxblox,
+                                         bool show_progress) const;
+  std::string computeMeshError(const EvaluationRequest& request,
+                               const SubmapCollection& submaps,
+                               bool show_progress) const;
+  bool evaluateSeriesMap(const std::string& file_path,
+                         std::string* result) const;
   void visualizeReconstructionError(const EvaluationRequest& request);
+
+  // Builds the kd-tree over the ground truth if it is not built yet.
   void buildKdTree();
+  void buildNeighborSearch(const EvaluationRequest& request);
+  bool findNearestGroundTruth(const Point& point, size_t* index,
+                              float* distance_squared) const;
 
  private:
   // ROS.
@@ -107,6 +173,7 @@ class MapEvaluator {
 
   // Stored data.
   std::unique_ptr<pcl::PointCloud<pcl::PointXYZ>> gt_ptcloud_;
+  std::string gt_ptcloud_file_;
   std::shared_ptr<SubmapCollection> submaps_;
   std::shared_ptr<TsdfLayer> voxblox_;
   bool use_voxblox_;
@@ -116,6 +183,7 @@ class MapEvaluator {
   std::unique_ptr<SubmapVisualizer> visualizer_;
   TreeData kdtree_data_;
   std::unique_ptr<KDTree> kdtree_;
+  std::unique_ptr<VoxelHashSearch> voxel_search_;
 
   // Multi Map Evaluations.
   ros::ServiceServer process_map_srv_;
@@ -0,0 +1,58 @@
+#ifndef PANOPTIC_MAPPING_UTILS_EVALUATION_VOXEL_HASH_SEARCH_H_
+#define PANOPTIC_MAPPING_UTILS_EVALUATION_VOXEL_HASH_SEARCH_H_
+
+#include <utility>
+#include <vector>
+
+#include <panoptic_mapping/common/common.h>
+#include <voxblox/core/block_hash.h>
+
+namespace panoptic_mapping {
+
+/**
+ * @brief Nearest neighbor search over a spatial hash of grid cells. For
+ * uniformly sampled clouds, e.g. ground truth point clouds sampled from
+ * meshes, lookups only touch a few cells and the hash is built in linear time.
+ */
+class VoxelHashSearch {
+ public:
+  /**
+   * @brief Build the hash over a set of points.
+   *
+   * @param points Points to search, need to outlive the search.
+   * @param cell_size Side length of the grid cells in meters, ideally close to
+   * the sampling distance of the points.
+   */
+  VoxelHashSearch(const std::vector<Point>& points, float cell_size);
+  virtual ~VoxelHashSearch() = default;
+
+  /**
+   * @brief Find the exact nearest neighbor of a query point.
+   *
+   * @param query Query position.
+   * @param index Output index of the nearest point.
+   * @param distance_squared Output squared distance to the nearest point.
+   * @return False if there are no points.
+   */
+  bool findNearest(const Point& query, size_t* index,
+                   float* distance_squared) const;
+
+  float getCellSize() const { return cell_size_; }
+
+ private:
+  voxblox::AnyIndex getCell(const Point& point) const;
+
+  const std::vector<Point>& points_;
+  const float cell_size_;
+  const float cell_size_inv_;
+
+  // Point indices sorted by cell, each cell stores its range in the indices.
+  std::vector<size_t> indices_;
+  voxblox::AnyIndexHashMapType<std::pair<size_t, size_t>>::type cells_;
+  voxblox::AnyIndex min_cell_;
+  voxblox::AnyIndex max_cell_;
+};
+
+}  // namespace panoptic_mapping
+
+#endif  // PANOPTIC_MAPPING_UTILS_EVALUATION_VOXEL_HASH_SEARCH_H_
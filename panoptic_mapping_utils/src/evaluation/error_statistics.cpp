@@ -0,0 +1,119 @@
+#include "panoptic_mapping_utils/evaluation/error_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace panoptic_mapping {
+
+namespace {
+
+// Bin 0 holds all values below the minimum value, the others grow by the bin
+// ratio each. Values above the covered range are stored in the last bin.
+constexpr double kMinValue = 1e-6;
+constexpr double kMaxValue = 1e4;
+constexpr double kBinRatio = 1.01;
+const double kLogBinRatioInv = 1.0 / std::log(kBinRatio);
+const int kNumBins =
+    static_cast<int>(std::ceil(std::log(kMaxValue / kMinValue) *
+                               kLogBinRatioInv)) +
+    2;
+
+}  // namespace
+
+ErrorStatistics::ErrorStatistics()
+    : min_(std::numeric_limits<double>::max()),
+      max_(std::numeric_limits<double>::lowest()),
+      bins_(kNumBins, 0u) {}
+
+void ErrorStatistics::add(double value) {
+  count_++;
+  const double delta = value - mean_;
+  mean_ += delta / static_cast<double>(count_);
+  m2_ += delta * (value - mean_);
+  sum_squares_ += value * value;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  bins_[getBin(value)]++;
+}
+
+void ErrorStatistics::merge(const ErrorStatistics& other) {
+  if (other.count_ == 0) {
+    return;
+  }
+  // Parallel variant of Welford's algorithm.
+  const auto n_a = static_cast<double>(count_);
+  const auto n_b = static_cast<double>(other.count_);
+  const double n = n_a + n_b;
+  const double delta = other.mean_ - mean_;
+  mean_ += delta * n_b / n;
+  m2_ += other.m2_ + delta * delta * n_a * n_b / n;
+  count_ += other.count_;
+  sum_squares_ += other.sum_squares_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  for (int i = 0; i < kNumBins; ++i) {
+    bins_[i] += other.bins_[i];
+  }
+}
+
+double ErrorStatistics::getRMSE() const {
+  if (count_ == 0) {
+    return 0.0;
+  }
+  return std::sqrt(sum_squares_ / static_cast<double>(count_));
+}
+
+double ErrorStatistics::getStdDev() const {
+  if (count_ <= 2) {
+    return 0.0;
+  }
+  return std::sqrt(m2_ / static_cast<double>(count_ - 1));
+}
+
+double ErrorStatistics::getMin() const { return count_ == 0 ? 0.0 : min_; }
+
+double ErrorStatistics::getMax() const { return count_ == 0 ? 0.0 : max_; }
+
+double ErrorStatistics::getQuantile(double q) const {
+  if (count_ == 0) {
+    return 0.0;
+  }
+  q = std::min(std::max(q, 0.0), 1.0);
+  if (q == 0.0) {
+    return min_;
+  } else if (q == 1.0) {
+    return max_;
+  }
+
+  // Find the bin containing the rank of the quantile.
+  const auto rank = static_cast<uint64_t>(
+      std::ceil(q * static_cast<double>(count_)));
+  uint64_t cumulative = 0;
+  for (int i = 0; i < kNumBins; ++i) {
+    cumulative += bins_[i];
+    if (cumulative >= rank) {
+      return std::min(std::max(getBinCenter(i), min_), max_);
+    }
+  }
+  return max_;
+}
+
+int ErrorStatistics::getBin(double value) {
+  if (!(value >= kMinValue)) {
+    return 0;
+  }
+  const int bin =
+      1 + static_cast<int>(std::log(value / kMinValue) * kLogBinRatioInv);
+  return std::min(bin, kNumBins - 1);
+}
+
+double ErrorStatistics::getBinCenter(int bin) {
+  if (bin == 0) {
+    return 0.0;
+  }
+  // Geometric center of the bin.
+  return kMinValue * std::pow(kBinRatio, static_cast<double>(bin) - 0.5);
+}
+
+}  // namespace panoptic_mapping
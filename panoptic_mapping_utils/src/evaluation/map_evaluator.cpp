@@ -1,23 +1,138 @@
 #include "panoptic_mapping_utils/evaluation/map_evaluator.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <experimental/filesystem>
+#include <fstream>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include <panoptic_mapping/3rd_party/config_utilities.hpp>
+#include <panoptic_mapping/common/thread_pool.h>
 #include <pcl/io/ply_io.h>
 #include <ros/ros.h>
 #include <voxblox/interpolator/interpolator.h>
 
+#include "panoptic_mapping_utils/evaluation/error_statistics.h"
 #include "panoptic_mapping_utils/evaluation/progress_bar.h"
 
 namespace panoptic_mapping {
 
+namespace {
+
+// Columns of the multi map evaluation outputs.
+const std::string kMultiMapHeader =
+    "MeanGTError [m],StdGTError [m],GTRMSE [m],TotalPoints [1],"
+    "UnknownPoints [1],TruncatedPoints [1],GTInliers [1],MedianGTError [m],"
+    "P95GTError [m],MeanMapError [m],StdMapError [m],MapRMSE[m],"
+    "MapInliers[1],MapOutliers[1],MedianMapError [m],P95MapError [m]\n";
+constexpr size_t kMultiMapColumns = 16;
+
+// Ground truth cache format.
+constexpr uint32_t kGroundTruthCacheMagic = 0x50474743;  // "PMGC"
+constexpr uint32_t kGroundTruthCacheVersion = 1;
+constexpr int kKdTreeLeafSize = 10;
+
+// Number of ground truth points evaluated at once to bound memory use.
+constexpr size_t kReconstructionChunkSize = 1u << 20;
+
+// Number of mesh blocks evaluated between progress updates.
+constexpr size_t kMeshChunkSize = 1u << 12;
+
+// Reconstruction error statistics that are accumulated in parallel and then
+// merged.
+struct ReconstructionStatistics {
+  uint64_t total_points = 0;
+  uint64_t unknown_points = 0;
+  uint64_t truncated_points = 0;
+  uint64_t inliers = 0;
+  ErrorStatistics errors;
+
+  void add(const MapEvaluator::EvaluationRequest& request, bool observed,
+           float distance) {
+    total_points++;
+    if (!observed) {
+      unknown_points++;
+      return;
+    }
+    const float error = std::abs(distance);
+    if (error > request.maximum_distance) {
+      truncated_points++;
+      if (!request.ignore_truncated_points) {
+        errors.add(request.maximum_distance);
+      }
+    } else {
+      errors.add(error);
+    }
+    if (error <= request.inlier_distance) {
+      inliers++;
+    }
+  }
+
+  void merge(const ReconstructionStatistics& other) {
+    total_points += other.total_points;
+    unknown_points += other.unknown_points;
+    truncated_points += other.truncated_points;
+    inliers += other.inliers;
+    errors.merge(other.errors);
+  }
+};
+
+// Mesh error statistics that are accumulated in parallel and then merged.
+struct MeshStatistics {
+  uint64_t inliers = 0;
+  uint64_t outliers = 0;
+  ErrorStatistics errors;
+
+  void add(const MapEvaluator::EvaluationRequest& request, float error) {
+    errors.add(error);
+    if (error <= request.inlier_distance) {
+      inliers++;
+    } else {
+      outliers++;
+    }
+  }
+
+  void merge(const MeshStatistics& other) {
+    inliers += other.inliers;
+    outliers += other.outliers;
+    errors.merge(other.errors);
+  }
+};
+
+// FNV-1a hash of the file content.
+bool hashFile(const std::string& file_name, uint64_t* hash) {
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  *hash = 14695981039346656037ull;
+  std::vector<char> buffer(1 << 20);
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    const std::streamsize count = file.gcount();
+    for (std::streamsize i = 0; i < count; ++i) {
+      *hash ^= static_cast<uint8_t>(buffer[i]);
+      *hash *= 1099511628211ull;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 void MapEvaluator::EvaluationRequest::checkParams() const {
   checkParamGT(maximum_distance, 0.f, "maximum_distance");
   checkParamGT(inlier_distance, 0.f, "inlier_distance");
+  checkParamGE(neighbor_search_cell_size, 0.f, "neighbor_search_cell_size");
 }
 
 void MapEvaluator::EvaluationRequest::setupParamsAndPrinting() {
@@ -34,6 +149,20 @@ void MapEvaluator::EvaluationRequest::setupParamsAndPrinting() {
   setupParam("ignore_truncated_points", &ignore_truncated_points);
   setupParam("inlier_distance", &inlier_distance);
   setupParam("is_single_tsdf", &is_single_tsdf);
+  setupParam("cache_ground_truth", &cache_ground_truth);
+  setupParam("neighbor_search_cell_size", &neighbor_search_cell_size, "m");
+}
+
+void MapEvaluator::BatchConfig::checkParams() const {
+  checkParamGE(num_parallel_maps, 0, "num_parallel_maps");
+  checkParamGE(max_loaded_megabytes, 0.f, "max_loaded_megabytes");
+}
+
+void MapEvaluator::BatchConfig::setupParamsAndPrinting() {
+  setupParam("verbosity", &verbosity);
+  setupParam("num_parallel_maps", &num_parallel_maps);
+  setupParam("max_loaded_megabytes", &max_loaded_megabytes, "MB");
+  setupParam("resume", &resume);
 }
 
 MapEvaluator::MapEvaluator(const ros::NodeHandle& nh,
@@ -45,6 +174,28 @@ MapEvaluator::MapEvaluator(const ros::NodeHandle& nh,
 }
 
 bool MapEvaluator::setupMultiMapEvaluation() {
+  if (!loadMultiMapRequest()) {
+    return false;
+  }
+
+  // Setup Output File.
+  // NOTE(schmluk): The map_file is used to specify the target path here.
+  std::string out_file_name =
+      request_.map_file + "/" + request_.output_suffix + ".csv";
+  output_file_.open(out_file_name, std::ios::out);
+  if (!output_file_.is_open()) {
+    LOG(ERROR) << "Failed to open output file '" << out_file_name << "'.";
+    return false;
+  }
+  output_file_ << kMultiMapHeader;
+
+  // Advertise evaluation service.
+  process_map_srv_ = nh_private_.advertiseService(
+      "process_map", &MapEvaluator::evaluateMapCallback, this);
+  return true;
+}
+
+bool MapEvaluator::loadMultiMapRequest() {
   // Get evaluation configuration (wait till set).
   while (!nh_private_.hasParam("ground_truth_pointcloud_file")) {
     ros::Duration(0.05).sleep();
@@ -59,33 +210,278 @@ bool MapEvaluator::setupMultiMapEvaluation() {
   use_voxblox_ = false;
 
   // Load GT cloud.
+  if (!loadGroundTruth(request_)) {
+    return false;
+  }
+  buildNeighborSearch(request_);
+  return true;
+}
+
+bool MapEvaluator::loadGroundTruth(const EvaluationRequest& request) {
+  // The ground truth and its kd-tree are cached across evaluations.
+  const std::string& file_name = request.ground_truth_pointcloud_file;
+  if (gt_ptcloud_ && file_name == gt_ptcloud_file_) {
+    return true;
+  }
+  kdtree_.reset();
+  voxel_search_.reset();
+  gt_ptcloud_file_.clear();
+
+  // Use the binary cache if it was created from the same file.
+  const std::string cache_file = file_name + ".gtcache";
+  uint64_t hash = 0;
+  const bool use_cache =
+      request.cache_ground_truth && hashFile(file_name, &hash);
+  if (use_cache && loadGroundTruthCache(cache_file, hash)) {
+    gt_ptcloud_file_ = file_name;
+    LOG_IF(INFO, request.verbosity >= 2)
+        << "Loaded ground truth pointcloud from cache '" << cache_file << "'.";
+    return true;
+  }
+
   gt_ptcloud_ = std::make_unique<pcl::PointCloud<pcl::PointXYZ>>();
-  if (pcl::io::loadPLYFile<pcl::PointXYZ>(request_.ground_truth_pointcloud_file,
-                                          *gt_ptcloud_) != 0) {
+  if (pcl::io::loadPLYFile<pcl::PointXYZ>(file_name, *gt_ptcloud_) != 0) {
     LOG(ERROR) << "Could not load ground truth point cloud from '"
-               << request_.ground_truth_pointcloud_file << "'.";
+               << file_name << "'.";
+    gt_ptcloud_.reset();
     return false;
   }
-  buildKdTree();
-  LOG_IF(INFO, request_.verbosity >= 2) << "Loaded ground truth pointcloud";
+  gt_ptcloud_file_ = file_name;
+  LOG_IF(INFO, request.verbosity >= 2) << "Loaded ground truth pointcloud";
+  if (use_cache) {
+    buildKdTree();
+    saveGroundTruthCache(cache_file, hash);
+  }
+  return true;
+}
 
-  // Setup Output File.
+bool MapEvaluator::loadGroundTruthCache(const std::string& file_name,
+                                        uint64_t hash) {
+  FILE* file = std::fopen(file_name.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint64_t source_hash = 0;
+  uint64_t num_points = 0;
+  bool success = std::fread(&magic, sizeof(magic), 1, file) == 1 &&
+                 std::fread(&version, sizeof(version), 1, file) == 1 &&
+                 std::fread(&source_hash, sizeof(source_hash), 1, file) == 1 &&
+                 std::fread(&num_points, sizeof(num_points), 1, file) == 1 &&
+                 magic == kGroundTruthCacheMagic &&
+                 version == kGroundTruthCacheVersion && source_hash == hash;
+  if (success) {
+    kdtree_data_.points.resize(num_points);
+    success = std::fread(kdtree_data_.points.data(), sizeof(Point), num_points,
+                         file) == num_points;
+  }
+  if (success) {
+    // NOTE(schmluk): nanoflann does not report read errors, the hash and
+    // version checks guard against stale or foreign caches.
+    kdtree_ = std::make_unique<KDTree>(
+        3, kdtree_data_,
+        nanoflann::KDTreeSingleIndexAdaptorParams(kKdTreeLeafSize));
+    kdtree_->loadIndex(file);
+    success = !std::ferror(file) && kdtree_->vind.size() == num_points;
+  }
+  std::fclose(file);
+  if (!success) {
+    LOG(WARNING) << "Ignoring invalid or outdated ground truth cache '"
+                 << file_name << "'.";
+    kdtree_.reset();
+    kdtree_data_.points.clear();
+    return false;
+  }
+
+  gt_ptcloud_ = std::make_unique<pcl::PointCloud<pcl::PointXYZ>>();
+  gt_ptcloud_->reserve(num_points);
+  for (const Point& point : kdtree_data_.points) {
+    gt_ptcloud_->push_back(pcl::PointXYZ(point.x(), point.y(), point.z()));
+  }
+  return true;
+}
+
+void MapEvaluator::saveGroundTruthCache(const std::string& file_name,
+                                        uint64_t hash) const {
+  FILE* file = std::fopen(file_name.c_str(), "wb");
+  if (!file) {
+    LOG(WARNING) << "Could not write ground truth cache '" << file_name
+                 << "'.";
+    return;
+  }
+  const uint64_t num_points = kdtree_data_.points.size();
+  std::fwrite(&kGroundTruthCacheMagic, sizeof(kGroundTruthCacheMagic), 1,
+              file);
+  std::fwrite(&kGroundTruthCacheVersion, sizeof(kGroundTruthCacheVersion), 1,
+              file);
+  std::fwrite(&hash, sizeof(hash), 1, file);
+  std::fwrite(&num_points, sizeof(num_points), 1, file);
+  std::fwrite(kdtree_data_.points.data(), sizeof(Point), num_points, file);
+  kdtree_->saveIndex(file);
+  const bool success = !std::ferror(file);
+  std::fclose(file);
+  if (!success) {
+    LOG(WARNING) << "Could not write ground truth cache '" << file_name
+                 << "'.";
+    std::remove(file_name.c_str());
+  }
+}
+
+bool MapEvaluator::evaluateMapSeries(const BatchConfig& config) {
+  namespace fs = std::experimental::filesystem;
+  if (!config.isValid(true)) {
+    return false;
+  }
+  LOG_IF(INFO, config.verbosity >= 1) << "\n" << config.toString();
+  if (!loadMultiMapRequest()) {
+    return false;
+  }
+
+  // Find all maps in the target directory.
   // NOTE(schmluk): The map_file is used to specify the target path here.
-  std::string out_file_name =
-      request_.map_file + "/" + request_.output_suffix + ".csv";
-  output_file_.open(out_file_name, std::ios::out);
-  if (!output_file_.is_open()) {
+  if (!fs::is_directory(request_.map_file)) {
+    LOG(ERROR) << "The 'map_file' must be the target directory, got '"
+               << request_.map_file << "'.";
+    return false;
+  }
+  std::vector<std::string> map_names;
+  for (const auto& entry : fs::directory_iterator(request_.map_file)) {
+    if (entry.path().extension() == ".panmap") {
+      map_names.push_back(entry.path().filename().string());
+    }
+  }
+  std::sort(map_names.begin(), map_names.end());
+
+  // Skip all maps with complete results from previous runs.
+  const std::string out_file_name =
+      request_.map_file + "/" + request_.output_suffix + "_series.csv";
+  std::unordered_set<std::string> evaluated;
+  if (config.resume) {
+    std::ifstream previous(out_file_name);
+    std::string line;
+    if (std::getline(previous, line) &&
+        line + "\n" != "MapFile," + kMultiMapHeader) {
+      LOG(ERROR) << "Can not resume from '" << out_file_name
+                 << "', the file has a different format.";
+      return false;
+    }
+    while (std::getline(previous, line)) {
+      if (static_cast<size_t>(std::count(line.begin(), line.end(), ',')) ==
+          kMultiMapColumns) {
+        evaluated.insert(line.substr(0, line.find(',')));
+      }
+    }
+  }
+  std::vector<std::string> pending;
+  for (const std::string& name : map_names) {
+    if (evaluated.find(name) == evaluated.end()) {
+      pending.push_back(name);
+    }
+  }
+  LOG_IF(INFO, config.verbosity >= 2)
+      << "Evaluating " << pending.size() << " of " << map_names.size()
+      << " maps in '" << request_.map_file << "'.";
+
+  // Setup output file.
+  std::ofstream output(out_file_name,
+                       evaluated.empty() ? std::ios::out : std::ios::app);
+  if (!output.is_open()) {
     LOG(ERROR) << "Failed to open output file '" << out_file_name << "'.";
     return false;
   }
-  output_file_
-      << "MeanGTError [m],StdGTError [m],GTRMSE [m],TotalPoints [1],"
-      << "UnknownPoints [1],TruncatedPoints [1],GTInliers [1],MeanMapError [m],"
-      << "StdMapError [m],MapRMSE[m],MapInliers[1],MapOutliers[1]\n ";
+  if (evaluated.empty()) {
+    output << "MapFile," << kMultiMapHeader;
+    output.flush();
+  }
 
-  // Advertise evaluation service.
-  process_map_srv_ = nh_private_.advertiseService(
-      "process_map", &MapEvaluator::evaluateMapCallback, this);
+  // Evaluate the maps in parallel. All workers share the ground truth and its
+  // kd-tree, every worker only holds the map it is currently evaluating.
+  const auto max_loaded_bytes =
+      static_cast<uint64_t>(config.max_loaded_megabytes * 1e6);
+  std::mutex mutex;
+  std::condition_variable budget_released;
+  uint64_t loaded_bytes = 0;
+  size_t num_finished = 0;
+  std::atomic<size_t> next_map{0};
+  std::atomic<int> num_failed{0};
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_map++) < pending.size() && ros::ok()) {
+      const std::string file_path = request_.map_file + "/" + pending[index];
+      std::error_code error;
+      uint64_t size = fs::file_size(file_path, error);
+      if (error) {
+        size = 0;
+      }
+
+      // Wait until the map fits into the memory budget.
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        budget_released.wait(lock, [&]() {
+          return max_loaded_bytes == 0 || loaded_bytes == 0 ||
+                 loaded_bytes + size <= max_loaded_bytes;
+        });
+        loaded_bytes += size;
+      }
+
+      std::string result;
+      const bool success = evaluateSeriesMap(file_path, &result);
+
+      // Write the result right away to be able to resume.
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded_bytes -= size;
+        num_finished++;
+        if (success) {
+          output << pending[index] << "," << result << "\n";
+          output.flush();
+        } else {
+          num_failed++;
+        }
+        LOG_IF(INFO, config.verbosity >= 2)
+            << "Evaluated map " << num_finished << "/" << pending.size()
+            << " '" << pending[index] << "'"
+            << (success ? "." : " (failed).");
+      }
+      budget_released.notify_all();
+    }
+  };
+  const size_t num_workers =
+      std::min(pending.size(),
+               static_cast<size_t>(std::max(config.num_parallel_maps, 1)));
+  std::vector<std::thread> workers;
+  workers.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; ++i) {
+    workers.emplace_back(worker);
+  }
+  for (std::thread& thread : workers) {
+    thread.join();
+  }
+
+  const bool complete = num_finished == pending.size();
+  LOG_IF(INFO, config.verbosity >= 1)
+      << "Finished series evaluation: " << num_finished - num_failed
+      << " maps evaluated, " << num_failed << " failed"
+      << (complete ? "" : ", interrupted") << ".";
+  return complete && num_failed == 0;
+}
+
+bool MapEvaluator::evaluateSeriesMap(const std::string& file_path,
+                                     std::string* result) const {
+  auto submaps = std::make_shared<SubmapCollection>();
+  if (!submaps->loadFromFile(file_path)) {
+    LOG(ERROR) << "Could not load panoptic map from '" << file_path << "'.";
+    return false;
+  }
+  const PlanningInterface planning(submaps);
+  const std::string reconstruction_error =
+      computeReconstructionError(request_, &planning, nullptr, false);
+  const std::string mesh_error = computeMeshError(request_, *submaps, false);
+  if (!ros::ok()) {
+    return false;
+  }
+  *result = reconstruction_error + "," + mesh_error;
   return true;
 }
 
@@ -98,16 +494,9 @@ bool MapEvaluator::evaluate(const EvaluationRequest& request) {
 
   // Load the groundtruth pointcloud.
   if (request.evaluate || request.compute_coloring) {
-    if (!request.ground_truth_pointcloud_file.empty()) {
-      gt_ptcloud_ = std::make_unique<pcl::PointCloud<pcl::PointXYZ>>();
-      if (pcl::io::loadPLYFile<pcl::PointXYZ>(
-              request.ground_truth_pointcloud_file, *gt_ptcloud_) != 0) {
-        LOG(ERROR) << "Could not load ground truth point cloud from '"
-                   << request.ground_truth_pointcloud_file << "'.";
-        gt_ptcloud_.reset();
-        return false;
-      }
-      LOG_IF(INFO, request.verbosity >= 2) << "Loaded ground truth pointcloud";
+    if (!request.ground_truth_pointcloud_file.empty() &&
+        !loadGroundTruth(request)) {
+      return false;
     }
     if (!gt_ptcloud_) {
       LOG(ERROR) << "No ground truth pointcloud loaded.";
@@ -166,7 +555,8 @@ bool MapEvaluator::evaluate(const EvaluationRequest& request) {
     // Evaluate.
     LOG_IF(INFO, request.verbosity >= 2) << "Computing reconstruction error:";
     output_file_ << "MeanError [m],StdError [m],RMSE [m],TotalPoints [1],"
-                 << "UnknownPoints [1],TruncatedPoints [1]\n";
+                 << "UnknownPoints [1],TruncatedPoints [1],Inliers [1],"
+                 << "MedianError [m],P95Error [m]\n";
     output_file_ << computeReconstructionError(request);
     output_file_.close();
   }
@@ -189,182 +579,189 @@ bool MapEvaluator::evaluate(const EvaluationRequest& request) {
 
 std::string MapEvaluator::computeReconstructionError(
     const EvaluationRequest& request) {
-  // Go through each point, use trilateral interpolation to figure out the
-  // distance at that point.
-
-  // Setup.
-  uint64_t total_points = 0;
-  uint64_t unknown_points = 0;
-  uint64_t truncated_points = 0;
-  uint64_t inliers = 0;
-  std::vector<float> abserror;
-  abserror.reserve(gt_ptcloud_->size());  // Just reserve the worst case.
-
-  // Setup progress bar.
-  const uint64_t interval = gt_ptcloud_->size() / 100;
-  uint64_t count = 0;
-  ProgressBar bar;
-
-  // Evaluate gt pcl based(# gt points within < trunc_dist)
-  std::unique_ptr<voxblox::Interpolator<voxblox::TsdfVoxel>> interp;
-
   if (use_voxblox_) {
-    interp.reset(new voxblox::Interpolator<voxblox::TsdfVoxel>(voxblox_.get()));
+    return computeReconstructionError(request, nullptr, voxblox_.get(), true);
   }
+  return computeReconstructionError(request, planning_.get(), nullptr, true);
+}
 
-  for (const auto& pcl_point : *gt_ptcloud_) {
-    const Point point(pcl_point.x, pcl_point.y, pcl_point.z);
-    total_points++;
+std::string MapEvaluator::computeReconstructionError(
+    const EvaluationRequest& request, const PlanningInterface* planning,
+    const TsdfLayer* voxblox, bool show_progress) const {
+  CHECK(planning || voxblox);
+  // Lookup the distance at every ground truth point, using trilateral
+  // interpolation. The points are processed in chunks to bound memory use.
+  // Within a chunk, points are grouped by block and the groups evaluated in
+  // parallel, such that nearby lookups hit the same blocks.
+  ReconstructionStatistics statistics;
+  ThreadPool* thread_pool = ThreadPool::getGlobalInstance();
+  ProgressBar bar;
+  Pointcloud points;
+  std::vector<float> distances;
+  std::vector<uint8_t> observed;
+  const size_t num_points = gt_ptcloud_->size();
+  for (size_t start = 0; start < num_points;
+       start += kReconstructionChunkSize) {
+    if (!ros::ok()) {
+      return "";
+    }
+    const size_t end = std::min(start + kReconstructionChunkSize, num_points);
+    points.clear();
+    points.reserve(end - start);
+    for (size_t i = start; i < end; ++i) {
+      const auto& pcl_point = (*gt_ptcloud_)[i];
+      points.emplace_back(pcl_point.x, pcl_point.y, pcl_point.z);
+    }
 
-    // Lookup the distance.
-    float distance;
-    bool observed;
-    if (use_voxblox_) {
-      observed = interp->getDistance(point, &distance, true);
-    } else {
+    if (!voxblox) {
+      // The planning interface groups and parallelizes the batch itself.
       if (request.is_single_tsdf) {
-        observed = planning_->getDistance(point, &distance, false, true);
+        planning->getDistances(points, &distances, &observed, false, true);
       } else {
-        observed = planning_->getDistance(point, &distance, true, false);
+        planning->getDistances(points, &distances, &observed, true, false);
       }
-    }
-
-    // Compute the error.
-    if (observed) {
-      if (std::abs(distance) > request.maximum_distance) {
-        truncated_points++;
-        if (!request.ignore_truncated_points) {
-          abserror.push_back(request.maximum_distance);
+      for (size_t i = 0; i < points.size(); ++i) {
+        statistics.add(request, observed[i], distances[i]);
+      }
+    } else {
+      // Group the points by block of the voxblox layer.
+      const FloatingPoint block_size_inv = voxblox->block_size_inv();
+      std::vector<std::pair<BlockIndex, size_t>> queries;
+      queries.reserve(points.size());
+      for (size_t i = 0; i < points.size(); ++i) {
+        queries.emplace_back(voxblox::getGridIndexFromPoint<BlockIndex>(
+                                 points[i], block_size_inv),
+                             i);
+      }
+      std::sort(queries.begin(), queries.end(),
+                [](const auto& lhs, const auto& rhs) {
+                  return std::lexicographical_compare(
+                      lhs.first.data(), lhs.first.data() + 3,
+                      rhs.first.data(), rhs.first.data() + 3);
+                });
+      std::vector<size_t> group_starts;
+      for (size_t i = 0; i < queries.size(); ++i) {
+        if (i == 0 || queries[i].first != queries[i - 1].first) {
+          group_starts.push_back(i);
         }
-      } else {
-        abserror.push_back(std::abs(distance));
       }
-      if (std::abs(distance) <= request_.inlier_distance) {
-        inliers++;
+      group_starts.push_back(queries.size());
+
+      // Evaluate the groups in parallel and merge the statistics.
+      const size_t num_groups = group_starts.size() - 1;
+      const size_t num_threads =
+          std::min<size_t>(thread_pool->getNumThreads(), num_groups);
+      std::vector<ReconstructionStatistics> thread_statistics(
+          num_threads);
+      std::atomic<size_t> next_group(0);
+      std::vector<std::future<void>> threads;
+      for (size_t t = 0; t < num_threads; ++t) {
+        threads.emplace_back(thread_pool->submit([&, t]() {
+          voxblox::Interpolator<voxblox::TsdfVoxel> interp(voxblox);
+          size_t group;
+          while ((group = next_group++) < num_groups) {
+            for (size_t j = group_starts[group]; j < group_starts[group + 1];
+                 ++j) {
+              float distance = 0.f;
+              const bool is_observed = interp.getDistance(
+                  points[queries[j].second], &distance, true);
+              thread_statistics[t].add(request, is_observed, distance);
+            }
+          }
+        }));
+      }
+      thread_pool->waitAll(&threads);
+      for (const ReconstructionStatistics& partial : thread_statistics) {
+        statistics.merge(partial);
       }
-    } else {
-      unknown_points++;
     }
 
     // Progress bar.
-    if (count % interval == 0) {
-      bar.display(static_cast<float>(count) / gt_ptcloud_->size());
+    if (show_progress) {
+      bar.display(static_cast<float>(end) / num_points);
     }
-    count++;
   }
-  bar.display(1.f);
 
   // Report summary.
-  float mean = 0.0;
-  float rmse = 0.0;
-  for (auto value : abserror) {
-    mean += value;
-    rmse += std::pow(value, 2);
-  }
-  if (!abserror.empty()) {
-    mean /= static_cast<float>(abserror.size());
-    rmse = std::sqrt(rmse / static_cast<float>(abserror.size()));
-  }
-  float stddev = 0.0;
-  for (auto value : abserror) {
-    stddev += std::pow(value - mean, 2.0);
-  }
-  if (abserror.size() > 2) {
-    stddev = sqrt(stddev / static_cast<float>(abserror.size() - 1));
-  }
-
+  const ErrorStatistics& errors = statistics.errors;
   std::stringstream ss;
-  ss << mean << "," << stddev << "," << rmse << "," << total_points << ","
-     << unknown_points << "," << truncated_points << "," << inliers;
+  ss << errors.getMean() << "," << errors.getStdDev() << "," << errors.getRMSE()
+     << "," << statistics.total_points << "," << statistics.unknown_points
+     << "," << statistics.truncated_points << "," << statistics.inliers << ","
+     << errors.getMedian() << "," << errors.getQuantile(0.95);
   return ss.str();
 }
 
 std::string MapEvaluator::computeMeshError(const EvaluationRequest& request) {
-  // Setup progress bar.
-  float counter = 0.f;
-  float max_counter = 0.f;
-  ProgressBar bar;
-  for (auto& submap : *submaps_) {
+  return computeMeshError(request, *submaps_, true);
+}
+
+std::string MapEvaluator::computeMeshError(const EvaluationRequest& request,
+                                           const SubmapCollection& submaps,
+                                           bool show_progress) const {
+  // Collect the mesh blocks of all evaluated submaps.
+  std::vector<const voxblox::Mesh*> meshes;
+  for (const Submap& submap : submaps) {
+    if (!request.is_single_tsdf &&
+        (submap.getLabel() == PanopticLabel::kFreeSpace ||
+         submap.getChangeState() == ChangeState::kAbsent ||
+         submap.getChangeState() == ChangeState::kUnobserved)) {
+      continue;
+    }
+    const MeshLayer& mesh_layer = submap.getMeshLayer();
     voxblox::BlockIndexList block_list;
-    submap.getMeshLayer().getAllAllocatedMeshes(&block_list);
-    max_counter += block_list.size();
+    mesh_layer.getAllAllocatedMeshes(&block_list);
+    for (const BlockIndex& block_index : block_list) {
+      meshes.push_back(&mesh_layer.getMeshByIndex(block_index));
+    }
   }
 
-  // Setup error computation.
-  uint64_t inliers = 0;
-  uint64_t outliers = 0;
-  std::vector<float> errors;
-
-  // Parse all submaps
-  for (auto& submap : *submaps_) {
-    if (!request.is_single_tsdf) {
-      if (submap.getLabel() == PanopticLabel::kFreeSpace ||
-          submap.getChangeState() == ChangeState::kAbsent ||
-          submap.getChangeState() == ChangeState::kUnobserved) {
-        voxblox::BlockIndexList block_list;
-        submap.getMeshLayer().getAllAllocatedMeshes(&block_list);
-        counter += block_list.size();
-        bar.display(counter / max_counter);
-        continue;
-      }
+  // Look up the closest ground truth point of every vertex. The blocks are
+  // processed in chunks to report progress and in parallel within a chunk,
+  // each thread accumulating its own statistics that are merged per chunk.
+  MeshStatistics statistics;
+  ThreadPool* thread_pool = ThreadPool::getGlobalInstance();
+  ProgressBar bar;
+  for (size_t start = 0; start < meshes.size(); start += kMeshChunkSize) {
+    if (!ros::ok()) {
+      return "";
     }
-
-    // Parse all mesh vertices.
-    voxblox::BlockIndexList block_list;
-    submap.getMeshLayer().getAllAllocatedMeshes(&block_list);
-    for (auto& block_index : block_list) {
-      if (!ros::ok()) {
-        return "";
-      }
-      for (const Point& point :
-           submap.getMeshLayer().getMeshByIndex(block_index).vertices) {
-        // Find closest GT point.
-        float query_pt[3] = {point.x(), point.y(), point.z()};
-        std::vector<size_t> ret_index(1);
-        std::vector<float> out_dist_sqr(1);
-        int num_results = kdtree_->knnSearch(&query_pt[0], 1, &ret_index[0],
-                                             &out_dist_sqr[0]);
-
-        if (num_results != 0) {
-          const float error =
-              (kdtree_data_.points[ret_index[0]] - point).norm();
-          errors.emplace_back(error);
-          if (error <= request_.inlier_distance) {
-            inliers++;
-          } else {
-            outliers++;
+    const size_t end = std::min(start + kMeshChunkSize, meshes.size());
+    const size_t num_threads =
+        std::min<size_t>(thread_pool->getNumThreads(), end - start);
+    std::vector<MeshStatistics> thread_statistics(num_threads);
+    std::atomic<size_t> next_block(start);
+    std::vector<std::future<void>> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back(thread_pool->submit([&, t]() {
+        MeshStatistics& local = thread_statistics[t];
+        size_t block;
+        while ((block = next_block++) < end) {
+          for (const Point& vertex : meshes[block]->vertices) {
+            size_t index;
+            float distance_squared;
+            if (findNearestGroundTruth(vertex, &index, &distance_squared)) {
+              local.add(request, std::sqrt(distance_squared));
+            }
           }
         }
-      }
-
-      // Show progress.
-      counter += 1.f;
-      bar.display(counter / max_counter);
+      }));
+    }
+    thread_pool->waitAll(&threads);
+    for (const MeshStatistics& partial : thread_statistics) {
+      statistics.merge(partial);
+    }
+    if (show_progress) {
+      bar.display(static_cast<float>(end) / meshes.size());
     }
   }
 
   // Compute result.
-  float mean = 0.0;
-  float rmse = 0.0;
-  for (auto value : errors) {
-    mean += value;
-    rmse += std::pow(value, 2);
-  }
-  if (!errors.empty()) {
-    mean /= static_cast<float>(errors.size());
-    rmse = std::sqrt(rmse / static_cast<float>(errors.size()));
-  }
-  float stddev = 0.0;
-  for (auto value : errors) {
-    stddev += std::pow(value - mean, 2.0);
-  }
-  if (errors.size() > 2) {
-    stddev = sqrt(stddev / static_cast<float>(errors.size() - 1));
-  }
-
+  const ErrorStatistics& errors = statistics.errors;
   std::stringstream ss;
-  ss << mean << "," << stddev << "," << rmse << "," << inliers << ","
-     << outliers;
+  ss << errors.getMean() << "," << errors.getStdDev() << "," << errors.getRMSE()
+     << "," << statistics.inliers << "," << statistics.outliers << ","
+     << errors.getMedian() << "," << errors.getQuantile(0.95);
   return ss.str();
 }
 
@@ -395,7 +792,7 @@ void MapEvaluator::visualizeReconstructionError(
 
   constexpr int max_number_of_neighbors_factor = 25000;  // points per cubic
   // meter depending on voxel size for faster nn search.
-  buildKdTree();
+  buildNeighborSearch(request);
 
   // Remove inactive maps.
   if (!request.is_single_tsdf) {
@@ -406,9 +803,7 @@ void MapEvaluator::visualizeReconstructionError(
         submaps_to_remove.emplace_back(submap.getID());
       }
     }
-    for (int id : submaps_to_remove) {
-      submaps_->removeSubmap(id);
-    }
+    submaps_->removeSubmaps(submaps_to_remove);
   }
 
   // Setup progress bar.
@@ -436,12 +831,9 @@ void MapEvaluator::visualizeReconstructionError(
         const size_t size = mesh.vertices.size();
         mesh.colors.resize(size);
         for (size_t i = 0; i < size; ++i) {
-          const float query_pt[3] = {mesh.vertices[i].x(), mesh.vertices[i].y(),
-                                     mesh.vertices[i].z()};
           size_t ret_index;
           float out_dist_sqr;
-          int num_results =
-              kdtree_->knnSearch(&query_pt[0], 1, &ret_index, &out_dist_sqr);
+          findNearestGroundTruth(mesh.vertices[i], &ret_index, &out_dist_sqr);
 
           const float distance = std::sqrt(out_dist_sqr);
           const float frac = std::min(distance, request.maximum_distance) /
@@ -465,8 +857,6 @@ void MapEvaluator::visualizeReconstructionError(
   } else {
     // Parse all submaps
     for (auto& submap : *submaps_) {
-      const size_t num_voxels_per_block =
-          std::pow(submap.getTsdfLayer().voxels_per_side(), 3);
       const float voxel_size = submap.getTsdfLayer().voxel_size();
       const float voxel_size_sqr = voxel_size * voxel_size;
       const float truncation_distance = submap.getConfig().truncation_distance;
@@ -479,15 +869,21 @@ void MapEvaluator::visualizeReconstructionError(
       voxblox::BlockIndexList block_list;
       submap.getTsdfLayer().getAllAllocatedBlocks(&block_list);
       int block_count = 0;
+      std::vector<size_t> voxel_indices;
       for (auto& block_index : block_list) {
         if (!ros::ok()) {
           return;
         }
 
+        // Only observed voxels are evaluated.
         voxblox::Block<TsdfVoxel>& block =
             submap.getTsdfLayerPtr()->getBlockByIndex(block_index);
-        for (size_t linear_index = 0; linear_index < num_voxels_per_block;
-             ++linear_index) {
+        voxel_indices.clear();
+        submap.getVoxelMasks().forEachObservedVoxel(
+            block_index, block, [&](size_t linear_index) {
+              voxel_indices.push_back(linear_index);
+            });
+        for (const size_t linear_index : voxel_indices) {
           TsdfVoxel& voxel = block.getVoxelByLinearIndex(linear_index);
           if (voxel.distance > truncation_distance ||
               voxel.distance < -truncation_distance) {
@@ -568,16 +964,40 @@ void MapEvaluator::visualizeReconstructionError(
 }
 
 void MapEvaluator::buildKdTree() {
+  if (kdtree_) {
+    return;
+  }
   kdtree_data_.points.clear();
   kdtree_data_.points.reserve(gt_ptcloud_->size());
   for (const auto& point : *gt_ptcloud_) {
     kdtree_data_.points.emplace_back(point.x, point.y, point.z);
   }
-  kdtree_.reset(new KDTree(3, kdtree_data_,
-                           nanoflann::KDTreeSingleIndexAdaptorParams(10)));
+  kdtree_.reset(new KDTree(
+      3, kdtree_data_,
+      nanoflann::KDTreeSingleIndexAdaptorParams(kKdTreeLeafSize)));
   kdtree_->buildIndex();
 }
 
+void MapEvaluator::buildNeighborSearch(const EvaluationRequest& request) {
+  buildKdTree();
+  if (request.neighbor_search_cell_size <= 0.f) {
+    voxel_search_.reset();
+  } else if (!voxel_search_ || voxel_search_->getCellSize() !=
+                                   request.neighbor_search_cell_size) {
+    voxel_search_ = std::make_unique<VoxelHashSearch>(
+        kdtree_data_.points, request.neighbor_search_cell_size);
+  }
+}
+
+bool MapEvaluator::findNearestGroundTruth(const Point& point, size_t* index,
+                                          float* distance_squared) const {
+  if (voxel_search_) {
+    return voxel_search_->findNearest(point, index, distance_squared);
+  }
+  const float query_pt[3] = {point.x(), point.y(), point.z()};
+  return kdtree_->knnSearch(&query_pt[0], 1, index, distance_squared) != 0;
+}
+
 void MapEvaluator::publishVisualization() {
   // Make sure the tfs arrive otherwise the mesh will be discarded.
   visualizer_->visualizeAll(submaps_.get());
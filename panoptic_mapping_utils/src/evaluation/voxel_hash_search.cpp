@@ -0,0 +1,88 @@
+#include "panoptic_mapping_utils/evaluation/voxel_hash_search.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace panoptic_mapping {
+
+VoxelHashSearch::VoxelHashSearch(const std::vector<Point>& points,
+                                 float cell_size)
+    : points_(points), cell_size_(cell_size), cell_size_inv_(1.f / cell_size) {
+  CHECK_GT(cell_size, 0.f);
+  // Sort the points by cell to store each cell as a contiguous range.
+  std::vector<std::pair<voxblox::AnyIndex, size_t>> cells;
+  cells.reserve(points_.size());
+  min_cell_ = voxblox::AnyIndex::Constant(std::numeric_limits<int>::max());
+  max_cell_ = voxblox::AnyIndex::Constant(std::numeric_limits<int>::lowest());
+  for (size_t i = 0; i < points_.size(); ++i) {
+    const voxblox::AnyIndex cell = getCell(points_[i]);
+    min_cell_ = min_cell_.cwiseMin(cell);
+    max_cell_ = max_cell_.cwiseMax(cell);
+    cells.emplace_back(cell, i);
+  }
+  std::sort(cells.begin(), cells.end(), [](const auto& a, const auto& b) {
+    return std::lexicographical_compare(a.first.data(), a.first.data() + 3,
+                                        b.first.data(), b.first.data() + 3);
+  });
+  indices_.reserve(cells.size());
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (i == 0 || cells[i].first != cells[i - 1].first) {
+      cells_[cells[i].first] = {i, i};
+    }
+    cells_[cells[i].first].second = i + 1;
+    indices_.push_back(cells[i].second);
+  }
+}
+
+bool VoxelHashSearch::findNearest(const Point& query, size_t* index,
+                                  float* distance_squared) const {
+  CHECK_NOTNULL(index);
+  CHECK_NOTNULL(distance_squared);
+  if (points_.empty()) {
+    return false;
+  }
+
+  // Search rings of cells around the query until no unsearched cell can
+  // contain a closer point. Points outside ring r are at least r cells away.
+  const voxblox::AnyIndex center = getCell(query);
+  const int max_ring = std::max((center - min_cell_).cwiseAbs().maxCoeff(),
+                                (max_cell_ - center).cwiseAbs().maxCoeff());
+  float best = std::numeric_limits<float>::max();
+  voxblox::AnyIndex offset;
+  for (int ring = 0; ring <= max_ring; ++ring) {
+    const float ring_distance = (ring - 1) * cell_size_;
+    if (ring > 0 && best <= ring_distance * ring_distance) {
+      break;
+    }
+    for (offset.x() = -ring; offset.x() <= ring; ++offset.x()) {
+      for (offset.y() = -ring; offset.y() <= ring; ++offset.y()) {
+        for (offset.z() = -ring; offset.z() <= ring; ++offset.z()) {
+          if (offset.cwiseAbs().maxCoeff() != ring) {
+            continue;  // Only visit the shell of the ring.
+          }
+          const auto it = cells_.find(center + offset);
+          if (it == cells_.end()) {
+            continue;
+          }
+          for (size_t i = it->second.first; i < it->second.second; ++i) {
+            const float distance = (points_[indices_[i]] - query).squaredNorm();
+            if (distance < best) {
+              best = distance;
+              *index = indices_[i];
+            }
+          }
+        }
+      }
+    }
+  }
+  *distance_squared = best;
+  return true;
+}
+
+voxblox::AnyIndex VoxelHashSearch::getCell(const Point& point) const {
+  return (point * cell_size_inv_).array().floor().cast<int>();
+}
+
+}  // namespace panoptic_mapping
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <panoptic_mapping/common/common.h>
+#include <panoptic_mapping/map/submap_collection.h>
+#include <panoptic_mapping/tools/planning_interface.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+/**
+ * Python bindings to analyze panoptic maps offline. TSDF voxels and meshes are
+ * exposed as read-only NumPy views of the loaded map, which stays alive as long
+ * as any view into it exists. Batched planning queries release the GIL and run
+ * on the thread pool of the library.
+ *
+ * Example:
+ *   import panoptic_mapping_py as pm
+ *   submaps = pm.load_map("map.panmap")
+ *   block = submaps[0].tsdf_block((0, 0, 0))  # Indexed [x, y, z].
+ *   distances = block["distance"]
+ */
+
+PYBIND11_NUMPY_DTYPE(voxblox::Color, r, g, b, a);
+PYBIND11_NUMPY_DTYPE(voxblox::TsdfVoxel, distance, weight, color);
+
+namespace panoptic_mapping {
+namespace python {
+
+namespace py = pybind11;
+using CollectionPtr = std::shared_ptr<const SubmapCollection>;
+
+// Handle of a submap, which keeps its collection alive.
+struct SubmapHandle {
+  CollectionPtr submaps;
+  const Submap* submap;
+};
+
+// Base object of arrays viewing the map, keeping the collection alive.
+py::capsule keepAlive(const CollectionPtr& submaps) {
+  return py::capsule(new CollectionPtr(submaps), [](void* pointer) {
+    delete static_cast<CollectionPtr*>(pointer);
+  });
+}
+
+// Read-only array viewing memory of the map.
+template <typename T>
+py::array view(const CollectionPtr& submaps, const T* data,
+               std::vector<py::ssize_t> shape,
+               std::vector<py::ssize_t> strides) {
+  py::array result(py::dtype::of<T>(), std::move(shape), std::move(strides),
+                   data, keepAlive(submaps));
+  result.attr("setflags")(py::arg("write") = false);
+  return result;
+}
+
+// Array taking ownership of a result vector without copying it.
+template <typename T>
+py::array toArray(std::vector<T>&& values) {
+  auto* owner = new std::vector<T>(std::move(values));
+  py::capsule base(owner, [](void* pointer) {
+    delete static_cast<std::vector<T>*>(pointer);
+  });
+  return py::array_t<T>(owner->size(), owner->data(), base);
+}
+
+// Strides of the voxels of a block indexed [x, y, z].
+std::vector<py::ssize_t> blockStrides(size_t voxels_per_side,
+                                      size_t item_size) {
+  return {static_cast<py::ssize_t>(item_size),
+          static_cast<py::ssize_t>(item_size * voxels_per_side),
+          static_cast<py::ssize_t>(item_size * voxels_per_side *
+                                   voxels_per_side)};
+}
+
+py::array blockIndicesToArray(const voxblox::BlockIndexList& indices) {
+  py::array_t<int> result({static_cast<py::ssize_t>(indices.size()),
+                           static_cast<py::ssize_t>(3)});
+  auto data = result.mutable_unchecked<2>();
+  for (size_t i = 0; i < indices.size(); ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      data(i, axis) = indices[i][axis];
+    }
+  }
+  return result;
+}
+
+Pointcloud positionsFromArray(
+    const py::array_t<float, py::array::c_style | py::array::forcecast>&
+        positions) {
+  if (positions.ndim() != 2 || positions.shape(1) != 3) {
+    throw py::value_error("Positions must be of shape (N, 3).");
+  }
+  Pointcloud result(positions.shape(0));
+  const float* data = positions.data();
+  for (size_t i = 0; i < result.size(); ++i) {
+    result[i] = Point(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+  }
+  return result;
+}
+
+py::array tsdfBlock(const SubmapHandle& handle, const BlockIndex& index) {
+  const TsdfLayer& layer = handle.submap->getTsdfLayer();
+  TsdfBlock::ConstPtr block = layer.getBlockPtrByIndex(index);
+  if (!block) {
+    throw py::key_error("TSDF block is not allocated.");
+  }
+  const py::ssize_t size = block->voxels_per_side();
+  return view(handle.submaps, &block->getVoxelByLinearIndex(0),
+              {size, size, size},
+              blockStrides(size, sizeof(voxblox::TsdfVoxel)));
+}
+
+py::dict meshBlock(const SubmapHandle& handle, const BlockIndex& index) {
+  const MeshLayer& layer = handle.submap->getMeshLayer();
+  if (!layer.hasMesh(index)) {
+    throw py::key_error("Mesh block is not allocated.");
+  }
+  const voxblox::Mesh& mesh = layer.getMeshByIndex(index);
+  const py::ssize_t num_vertices = mesh.vertices.size();
+  py::dict result;
+  result["vertices"] =
+      view(handle.submaps, mesh.vertices.empty() ? nullptr
+                                                 : mesh.vertices[0].data(),
+           {num_vertices, 3},
+           {static_cast<py::ssize_t>(sizeof(Point)), sizeof(float)});
+  result["normals"] = view(
+      handle.submaps, mesh.normals.empty() ? nullptr : mesh.normals[0].data(),
+      {static_cast<py::ssize_t>(mesh.normals.size()), 3},
+      {static_cast<py::ssize_t>(sizeof(Point)), sizeof(float)});
+  result["colors"] =
+      view(handle.submaps, mesh.colors.data(),
+           {static_cast<py::ssize_t>(mesh.colors.size())},
+           {static_cast<py::ssize_t>(sizeof(voxblox::Color))});
+  result["indices"] =
+      view(handle.submaps, mesh.indices.data(),
+           {static_cast<py::ssize_t>(mesh.indices.size())},
+           {static_cast<py::ssize_t>(sizeof(voxblox::VertexIndex))});
+  return result;
+}
+
+// Class voxels are polymorphic and can not be viewed, so their belonging ID
+// and probability are extracted.
+py::tuple classBlock(const SubmapHandle& handle, const BlockIndex& index) {
+  if (!handle.submap->hasClassLayer()) {
+    throw py::key_error("The submap has no class layer.");
+  }
+  ClassBlock::ConstPtr block =
+      handle.submap->getClassLayer().getBlockConstPtrByIndex(index);
+  if (!block) {
+    throw py::key_error("Class block is not allocated.");
+  }
+  const py::ssize_t size = handle.submap->getClassLayer().voxels_per_side();
+  py::array_t<int> ids({size, size, size}, blockStrides(size, sizeof(int)));
+  py::array_t<float> probabilities({size, size, size},
+                                   blockStrides(size, sizeof(float)));
+  int* id_data = ids.mutable_data();
+  float* probability_data = probabilities.mutable_data();
+  {
+    py::gil_scoped_release release;
+    for (py::ssize_t i = 0; i < size * size * size; ++i) {
+      const ClassVoxel& voxel = block->getVoxelByLinearIndex(i);
+      id_data[i] = voxel.getBelongingID();
+      probability_data[i] = voxel.getBelongingProbability();
+    }
+  }
+  return py::make_tuple(ids, probabilities);
+}
+
+PYBIND11_MODULE(panoptic_mapping_py, m) {
+  m.doc() = "Read-only access to panoptic maps.";
+
+  py::class_<SubmapHandle>(m, "Submap")
+      .def_property_readonly(
+          "id", [](const SubmapHandle& h) { return h.submap->getID(); })
+      .def_property_readonly(
+          "instance_id",
+          [](const SubmapHandle& h) { return h.submap->getInstanceID(); })
+      .def_property_readonly(
+          "class_id",
+          [](const SubmapHandle& h) { return h.submap->getClassID(); })
+      .def_property_readonly("label",
+                             [](const SubmapHandle& h) {
+                               return panopticLabelToString(
+                                   h.submap->getLabel());
+                             })
+      .def_property_readonly(
+          "name", [](const SubmapHandle& h) { return h.submap->getName(); })
+      .def_property_readonly(
+          "is_active",
+          [](const SubmapHandle& h) { return h.submap->isActive(); })
+      .def_property_readonly("change_state",
+                             [](const SubmapHandle& h) {
+                               return changeStateToString(
+                                   h.submap->getChangeState());
+                             })
+      .def_property_readonly("voxel_size",
+                             [](const SubmapHandle& h) {
+                               return h.submap->getConfig().voxel_size;
+                             })
+      .def_property_readonly("voxels_per_side",
+                             [](const SubmapHandle& h) {
+                               return h.submap->getConfig().voxels_per_side;
+                             })
+      .def_property_readonly("T_M_S",
+                             [](const SubmapHandle& h) {
+                               const Eigen::Matrix4f matrix =
+                                   h.submap->getT_M_S()
+                                       .getTransformationMatrix();
+                               py::array_t<float> result({4, 4});
+                               auto data = result.mutable_unchecked<2>();
+                               for (int i = 0; i < 4; ++i) {
+                                 for (int j = 0; j < 4; ++j) {
+                                   data(i, j) = matrix(i, j);
+                                 }
+                               }
+                               return result;
+                             })
+      .def("tsdf_block_indices",
+           [](const SubmapHandle& h) {
+             voxblox::BlockIndexList indices;
+             h.submap->getTsdfLayer().getAllAllocatedBlocks(&indices);
+             return blockIndicesToArray(indices);
+           })
+      .def("mesh_block_indices",
+           [](const SubmapHandle& h) {
+             voxblox::BlockIndexList indices;
+             h.submap->getMeshLayer().getAllAllocatedMeshes(&indices);
+             return blockIndicesToArray(indices);
+           })
+      .def("tsdf_block", &tsdfBlock,
+           "Structured view of the voxels of a block, indexed [x, y, z].")
+      .def("mesh_block", &meshBlock,
+           "Views of the vertices, normals, colors and indices of a mesh.")
+      .def("class_block", &classBlock,
+           "Belonging IDs and probabilities of a class block, indexed "
+           "[x, y, z].");
+
+  py::class_<SubmapCollection, std::shared_ptr<SubmapCollection>>(
+      m, "SubmapCollection")
+      .def("__len__", &SubmapCollection::size)
+      .def("submap_ids",
+           [](const SubmapCollection& submaps) {
+             std::vector<int> ids;
+             for (const Submap& submap : submaps) {
+               ids.push_back(submap.getID());
+             }
+             return ids;
+           })
+      .def("__contains__", &SubmapCollection::submapIdExists)
+      .def("__getitem__",
+           [](const std::shared_ptr<SubmapCollection>& submaps, int id) {
+             if (!submaps->submapIdExists(id)) {
+               throw py::key_error("No submap with ID " + std::to_string(id) +
+                                   ".");
+             }
+             return SubmapHandle{submaps, &submaps->getSubmap(id)};
+           })
+      .def("submaps", [](const std::shared_ptr<SubmapCollection>& submaps) {
+        std::vector<SubmapHandle> result;
+        for (const Submap& submap : *submaps) {
+          result.push_back(SubmapHandle{submaps, &submap});
+        }
+        return result;
+      });
+
+  m.def(
+      "load_map",
+      [](const std::string& file_path, bool recompute_data) {
+        auto submaps = std::make_shared<SubmapCollection>();
+        bool success;
+        {
+          py::gil_scoped_release release;
+          success = submaps->loadFromFile(file_path, recompute_data);
+        }
+        if (!success) {
+          throw py::value_error("Could not load the map '" + file_path + "'.");
+        }
+        return submaps;
+      },
+      py::arg("file_path"), py::arg("recompute_data") = true);
+
+  py::enum_<PlanningInterface::VoxelState>(m, "VoxelState")
+      .value("UNKNOWN", PlanningInterface::VoxelState::kUnknown)
+      .value("KNOWN_FREE", PlanningInterface::VoxelState::kKnownFree)
+      .value("KNOWN_OCCUPIED", PlanningInterface::VoxelState::kKnownOccupied)
+      .value("PERSISTENT_OCCUPIED",
+             PlanningInterface::VoxelState::kPersistentOccupied)
+      .value("EXPECTED_FREE", PlanningInterface::VoxelState::kExpectedFree)
+      .value("EXPECTED_OCCUPIED",
+             PlanningInterface::VoxelState::kExpectedOccupied);
+
+  // Batched lookups for positions of shape (N, 3) in mission frame.
+  using Positions =
+      py::array_t<float, py::array::c_style | py::array::forcecast>;
+  py::class_<PlanningInterface, std::shared_ptr<PlanningInterface>>(
+      m, "PlanningInterface")
+      .def(py::init([](const std::shared_ptr<SubmapCollection>& submaps) {
+        return std::make_shared<PlanningInterface>(submaps);
+      }))
+      .def(
+          "is_observed",
+          [](const PlanningInterface& planning, const Positions& positions,
+             bool include_inactive_maps) {
+            const Pointcloud points = positionsFromArray(positions);
+            std::vector<uint8_t> observed;
+            {
+              py::gil_scoped_release release;
+              planning.isObserved(points, &observed, include_inactive_maps);
+            }
+            return toArray(std::move(observed));
+          },
+          py::arg("positions"), py::arg("include_inactive_maps") = true)
+      .def("get_voxel_states",
+           [](const PlanningInterface& planning, const Positions& positions) {
+             const Pointcloud points = positionsFromArray(positions);
+             std::vector<PlanningInterface::VoxelState> states;
+             {
+               py::gil_scoped_release release;
+               planning.getVoxelStates(points, &states);
+             }
+             std::vector<uint8_t> result(states.size());
+             std::transform(states.begin(), states.end(), result.begin(),
+                            [](PlanningInterface::VoxelState state) {
+                              return static_cast<uint8_t>(state);
+                            });
+             return toArray(std::move(result));
+           })
+      .def(
+          "get_distances",
+          [](const PlanningInterface& planning, const Positions& positions,
+             bool consider_change_state, bool include_free_space) {
+            const Pointcloud points = positionsFromArray(positions);
+            std::vector<float> distances;
+            std::vector<uint8_t> observed;
+            {
+              py::gil_scoped_release release;
+              planning.getDistances(points, &distances, &observed,
+                                    consider_change_state, include_free_space);
+            }
+            return py::make_tuple(toArray(std::move(distances)),
+                                  toArray(std::move(observed)));
+          },
+          py::arg("positions"), py::arg("consider_change_state") = true,
+          py::arg("include_free_space") = true);
+}
+
+}  // namespace python
+}  // namespace panoptic_mapping